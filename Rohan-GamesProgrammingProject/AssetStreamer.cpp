@@ -0,0 +1,552 @@
+//
+// AssetStreamer.cpp - Asynchronous, prioritised texture and model loading
+//
+
+#include "pch.h"
+#include "AssetStreamer.h"
+#include "ImageDecoder.h"
+#include "Profiler.h"
+#include "ReadContent.h"
+
+#include <DDSTextureLoader.h>
+#include <wincodec.h>
+
+using namespace DX;
+
+using Microsoft::WRL::ComPtr;
+
+struct AssetStreamer::Request
+{
+    std::wstring                                fileName;
+    ResourceRegistry::PathId                    pathId = ResourceRegistry::c_NoPath;
+    Priority                                    priority;
+    uint64_t                                    sequence;
+
+    // Exactly one of these is set
+    std::shared_ptr<Texture>                    texture;
+    std::shared_ptr<Model>                      model;
+
+    // Textures: the file, then for anything but DDS the decoded image
+    std::vector<uint8_t>                        bytes;
+    std::vector<uint8_t>                        pixels;
+    UINT                                        width = 0;
+    UINT                                        height = 0;
+    DXGI_FORMAT                                 format = DXGI_FORMAT_UNKNOWN;
+
+    // Models: read and parsed by the cache's own steps
+    std::unique_ptr<ModelCache::PendingLoad>    pending;
+
+    size_t                                      bytesRead = 0;
+    size_t                                      uploadSize = 0;
+    double                                      readMs = 0;
+    double                                      decodeMs = 0;
+    std::exception_ptr                          error;
+};
+
+namespace
+{
+    double MillisecondsSince(const LARGE_INTEGER& start)
+    {
+        LARGE_INTEGER end, frequency;
+        QueryPerformanceCounter(&end);
+        QueryPerformanceFrequency(&frequency);
+        return double(end.QuadPart - start.QuadPart) * 1000.0 / double(frequency.QuadPart);
+    }
+
+    bool IsDDS(const std::vector<uint8_t>& bytes)
+    {
+        return bytes.size() >= 4 && memcmp(bytes.data(), "DDS ", 4) == 0;
+    }
+
+    // Decode jobs run on worker threads that never initialise COM themselves; they use the
+    // factory as implicit members of the process's multithreaded apartment (see wWinMain).
+    IWICImagingFactory2* GetWIC()
+    {
+        static INIT_ONCE s_initOnce = INIT_ONCE_STATIC_INIT;
+
+        IWICImagingFactory2* factory = nullptr;
+        if (!InitOnceExecuteOnce(&s_initOnce,
+            [](PINIT_ONCE, PVOID, PVOID* context) -> BOOL
+            {
+                return SUCCEEDED(CoCreateInstance(CLSID_WICImagingFactory2, nullptr, CLSCTX_INPROC_SERVER,
+                    __uuidof(IWICImagingFactory2), context)) ? TRUE : FALSE;
+            }, nullptr, reinterpret_cast<LPVOID*>(&factory)))
+        {
+            throw std::exception("WIC");
+        }
+        return factory;
+    }
+
+    // The same sRGB metadata checks WICTextureLoader makes on desktop.
+    bool IsSRGB(IWICBitmapFrameDecode* frame)
+    {
+        ComPtr<IWICMetadataQueryReader> reader;
+        GUID containerFormat;
+        if (FAILED(frame->GetMetadataQueryReader(reader.GetAddressOf()))
+            || FAILED(reader->GetContainerFormat(&containerFormat)))
+            return false;
+
+        bool sRGB = false;
+
+        PROPVARIANT value;
+        PropVariantInit(&value);
+
+        if (containerFormat == GUID_ContainerFormatPng)
+        {
+            sRGB = SUCCEEDED(reader->GetMetadataByName(L"/sRGB/RenderingIntent", &value)) && value.vt == VT_UI1;
+        }
+        else
+        {
+            sRGB = SUCCEEDED(reader->GetMetadataByName(L"System.Image.ColorSpace", &value)) && value.vt == VT_UI2 && value.uiVal == 1;
+        }
+
+        (void)PropVariantClear(&value);
+        return sRGB;
+    }
+}
+
+bool AssetStreamer::RequestOrder::operator() (RequestPtr const& a, RequestPtr const& b) const
+{
+    // True when 'a' goes after 'b': lower priority, or the same priority requested later
+    if (a->priority != b->priority)
+        return a->priority < b->priority;
+
+    return a->sequence > b->sequence;
+}
+
+AssetStreamer::AssetStreamer(ID3D11Device* device, ModelCache& models, JobSystem& jobs, ResourceRegistry& registry,
+    const PackFile* pack, unsigned ioThreadCount, size_t uploadBudget) :
+    m_device(device),
+    m_models(models),
+    m_jobs(jobs),
+    m_registry(registry),
+    m_pack(pack),
+    m_uploadBudget(uploadBudget),
+    m_sequence(0),
+    m_pending(0),
+    m_stop(false),
+    m_stats{}
+{
+    // Opaque white, so a textured draw shows the material colour until the texture arrives
+    static const uint32_t s_white = 0xFFFFFFFF;
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = desc.Height = 1;
+    desc.MipLevels = desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_IMMUTABLE;
+    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+    D3D11_SUBRESOURCE_DATA initData = { &s_white, sizeof(uint32_t), 0 };
+
+    ComPtr<ID3D11Texture2D> texture;
+    DX::ThrowIfFailed(device->CreateTexture2D(&desc, &initData, texture.GetAddressOf()));
+    DX::ThrowIfFailed(device->CreateShaderResourceView(texture.Get(), nullptr, m_placeholder.GetAddressOf()));
+
+    ioThreadCount = std::max(ioThreadCount, 1u);
+    m_ioThreads.reserve(ioThreadCount);
+    for (unsigned i = 0; i < ioThreadCount; ++i)
+    {
+        m_ioThreads.emplace_back(&AssetStreamer::IoLoop, this, i);
+    }
+}
+
+AssetStreamer::~AssetStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_ioMutex);
+        m_stop = true;
+    }
+    m_ioWake.notify_all();
+
+    for (auto& thread : m_ioThreads)
+    {
+        thread.join();
+    }
+
+    // Decode jobs still point back here
+    std::vector<JobSystem::Handle> jobs;
+    {
+        std::lock_guard<std::mutex> lock(m_readyMutex);
+        jobs.swap(m_decodeJobs);
+    }
+    for (auto& job : jobs)
+    {
+        m_jobs.Wait(job);
+    }
+}
+
+AssetStreamer::TextureHandle AssetStreamer::RequestTexture(const wchar_t* fileName, Priority priority)
+{
+    const auto pathId = m_registry.Intern(fileName);
+    auto& entry = m_textures[pathId];
+    if (auto texture = entry.lock())
+        return texture;
+
+    auto texture = std::make_shared<Texture>();
+    texture->m_placeholder = m_placeholder;
+    entry = texture;
+
+    // Already loaded by another loader: nothing to stream
+    texture->m_view = m_registry.FindTexture(pathId);
+    if (texture->m_view)
+    {
+        ++m_stats.shared;
+        return texture;
+    }
+
+    auto request = std::make_shared<Request>();
+    request->fileName = fileName;
+    request->pathId = pathId;
+    request->priority = priority;
+    request->texture = texture;
+    Enqueue(request);
+
+    return texture;
+}
+
+AssetStreamer::ModelHandle AssetStreamer::RequestModel(const wchar_t* fileName, Priority priority)
+{
+    auto& entry = m_modelHandles[m_registry.Intern(fileName)];
+    if (auto model = entry.lock())
+        return model;
+
+    auto model = std::make_shared<Model>();
+    entry = model;
+
+    // Already resident through the cache: nothing to stream
+    model->m_asset = m_models.Find(fileName);
+    if (model->m_asset)
+        return model;
+
+    auto request = std::make_shared<Request>();
+    request->fileName = fileName;
+    request->priority = priority;
+    request->model = model;
+    Enqueue(request);
+
+    return model;
+}
+
+void AssetStreamer::Enqueue(RequestPtr const& request)
+{
+    request->sequence = m_sequence++;
+    ++m_pending;
+    ++m_stats.requests;
+
+    {
+        std::lock_guard<std::mutex> lock(m_ioMutex);
+        m_ioQueue.push(request);
+    }
+    m_ioWake.notify_one();
+}
+
+void AssetStreamer::IoLoop(unsigned index)
+{
+    char name[32];
+    sprintf_s(name, "I/O %u", index);
+    Profiler::SetThreadName(name);
+
+    for (;;)
+    {
+        RequestPtr request;
+        {
+            std::unique_lock<std::mutex> lock(m_ioMutex);
+            m_ioWake.wait(lock, [&]() { return m_stop || !m_ioQueue.empty(); });
+            if (m_stop)
+                break;
+
+            request = m_ioQueue.top();
+            m_ioQueue.pop();
+        }
+
+        try
+        {
+            Read(*request);
+        }
+        catch (...)
+        {
+            request->error = std::current_exception();
+        }
+
+        // Decoding goes to the job system so this thread can start on the next read
+        auto job = m_jobs.Submit([this, request]()
+        {
+            if (!request->error)
+            {
+                try
+                {
+                    Decode(*request);
+                }
+                catch (...)
+                {
+                    request->error = std::current_exception();
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_readyMutex);
+                m_ready.push_back(request);
+            }
+            m_readyWake.notify_all();
+        });
+
+        {
+            std::lock_guard<std::mutex> lock(m_readyMutex);
+            m_decodeJobs.push_back(job);
+        }
+        m_readyWake.notify_all();
+    }
+}
+
+void AssetStreamer::Read(Request& request)
+{
+    DX_PROFILE_SCOPE("ReadAsset");
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    if (request.model)
+    {
+        request.pending = m_models.Read(request.fileName.c_str());
+        request.bytesRead = request.pending->size;
+    }
+    else
+    {
+        request.bytes = DX::ReadContent(m_pack, request.fileName.c_str(),
+            [this](size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)
+        {
+            m_jobs.ParallelFor(count, grain, body);
+        });
+        request.bytesRead = request.bytes.size();
+    }
+
+    request.readMs = MillisecondsSince(start);
+}
+
+void AssetStreamer::Decode(Request& request)
+{
+    DX_PROFILE_SCOPE("DecodeAsset");
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    if (request.model)
+    {
+        ModelCache::Parse(*request.pending);
+        request.uploadSize = ModelCache::GetUploadSize(*request.pending);
+    }
+    else if (IsDDS(request.bytes))
+    {
+        // Stored in its final format; DDSTextureLoader validates it during the upload
+        request.uploadSize = request.bytes.size();
+    }
+    else if (DetectImageFormat(request.bytes.data(), request.bytes.size()) != ImageFileFormat::Unknown)
+    {
+        DecodedImage image;
+        DecodeImage(request.bytes.data(), request.bytes.size(), image);
+
+        request.width = image.width;
+        request.height = image.height;
+        if (request.width > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION || request.height > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION)
+            throw std::exception("Unsupported image size");
+
+        request.pixels = std::move(image.pixels);
+        request.format = image.sRGB ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
+        request.uploadSize = request.pixels.size();
+
+        std::vector<uint8_t>().swap(request.bytes);
+    }
+    else
+    {
+        // TIFF, GIF and the rest of what WIC decodes
+        if (request.bytes.size() > UINT32_MAX)
+            throw std::exception("Image too large");
+
+        auto wic = GetWIC();
+
+        ComPtr<IWICStream> stream;
+        DX::ThrowIfFailed(wic->CreateStream(stream.GetAddressOf()));
+        DX::ThrowIfFailed(stream->InitializeFromMemory(request.bytes.data(), static_cast<DWORD>(request.bytes.size())));
+
+        ComPtr<IWICBitmapDecoder> decoder;
+        DX::ThrowIfFailed(wic->CreateDecoderFromStream(stream.Get(), nullptr, WICDecodeMetadataCacheOnDemand, decoder.GetAddressOf()));
+
+        ComPtr<IWICBitmapFrameDecode> frame;
+        DX::ThrowIfFailed(decoder->GetFrame(0, frame.GetAddressOf()));
+        DX::ThrowIfFailed(frame->GetSize(&request.width, &request.height));
+
+        // Unlike WICTextureLoader, oversized images are rejected rather than rescaled
+        if (!request.width || !request.height
+            || request.width > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION
+            || request.height > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION)
+            throw std::exception("Unsupported image size");
+
+        ComPtr<IWICFormatConverter> converter;
+        DX::ThrowIfFailed(wic->CreateFormatConverter(converter.GetAddressOf()));
+        DX::ThrowIfFailed(converter->Initialize(frame.Get(), GUID_WICPixelFormat32bppRGBA,
+            WICBitmapDitherTypeErrorDiffusion, nullptr, 0, WICBitmapPaletteTypeMedianCut));
+
+        const UINT rowPitch = request.width * 4;
+        request.pixels.resize(size_t(rowPitch) * request.height);
+        DX::ThrowIfFailed(converter->CopyPixels(nullptr, rowPitch, static_cast<UINT>(request.pixels.size()), request.pixels.data()));
+
+        request.format = IsSRGB(frame.Get()) ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
+        request.uploadSize = request.pixels.size();
+
+        std::vector<uint8_t>().swap(request.bytes);
+    }
+
+    request.decodeMs = MillisecondsSince(start);
+}
+
+void AssetStreamer::Update()
+{
+    DX_PROFILE_SCOPE("StreamAssets");
+    UploadReady(m_uploadBudget);
+}
+
+void AssetStreamer::Flush()
+{
+    DX_PROFILE_SCOPE("FlushAssets");
+
+    while (m_pending)
+    {
+        if (UploadReady(SIZE_MAX))
+            continue;
+
+        // Nothing has finished: help with a decode (with no workers only this thread runs
+        // them), or sleep until an I/O thread hands one over
+        JobSystem::Handle job;
+        {
+            std::unique_lock<std::mutex> lock(m_readyMutex);
+            m_readyWake.wait(lock, [&]() { return !m_ready.empty() || !m_decodeJobs.empty(); });
+            if (m_ready.empty())
+            {
+                job = m_decodeJobs.front();
+            }
+        }
+
+        if (job)
+        {
+            m_jobs.Wait(job);
+        }
+    }
+}
+
+bool AssetStreamer::UploadReady(size_t budget)
+{
+    std::vector<RequestPtr> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_readyMutex);
+        ready.swap(m_ready);
+        m_decodeJobs.erase(std::remove_if(m_decodeJobs.begin(), m_decodeJobs.end(), JobSystem::IsDone), m_decodeJobs.end());
+    }
+
+    if (ready.empty())
+        return false;
+
+    // Highest priority first, then in request order
+    std::sort(ready.begin(), ready.end(), [](RequestPtr const& a, RequestPtr const& b) { return RequestOrder()(b, a); });
+
+    size_t spent = 0;
+    size_t uploaded = 0;
+    try
+    {
+        while (uploaded < ready.size())
+        {
+            auto request = ready[uploaded];
+            if (spent && spent + request->uploadSize > budget)
+                break;
+
+            spent += request->uploadSize;
+            ++uploaded;
+
+            // Resident or failed, it is no longer pending
+            --m_pending;
+            if (request->error)
+            {
+                std::rethrow_exception(request->error);
+            }
+
+            Upload(*request);
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(m_readyMutex);
+        m_ready.insert(m_ready.end(), ready.begin() + uploaded, ready.end());
+        throw;
+    }
+
+    if (uploaded < ready.size())
+    {
+        ++m_stats.budgetFrames;
+
+        std::lock_guard<std::mutex> lock(m_readyMutex);
+        m_ready.insert(m_ready.end(), ready.begin() + uploaded, ready.end());
+    }
+
+    return true;
+}
+
+void AssetStreamer::Upload(Request& request)
+{
+    DX_PROFILE_SCOPE("UploadAsset");
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    if (request.model)
+    {
+        request.model->m_asset = m_models.Complete(*request.pending);
+        request.pending.reset();
+    }
+    else
+    {
+        UploadTexture(request);
+    }
+
+    m_stats.uploadMs += MillisecondsSince(start);
+    m_stats.readMs += request.readMs;
+    m_stats.decodeMs += request.decodeMs;
+    m_stats.bytesRead += request.bytesRead;
+    m_stats.bytesUploaded += request.uploadSize;
+    ++m_stats.completed;
+}
+
+void AssetStreamer::UploadTexture(Request& request)
+{
+    ComPtr<ID3D11ShaderResourceView> view;
+
+    if (request.pixels.empty())
+    {
+        DX::ThrowIfFailed(
+            DirectX::CreateDDSTextureFromMemory(m_device.Get(), request.bytes.data(), request.bytes.size(),
+                nullptr, view.GetAddressOf()));
+    }
+    else
+    {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = request.width;
+        desc.Height = request.height;
+        desc.MipLevels = desc.ArraySize = 1;
+        desc.Format = request.format;
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+        D3D11_SUBRESOURCE_DATA initData = { request.pixels.data(), request.width * 4, 0 };
+
+        ComPtr<ID3D11Texture2D> texture;
+        DX::ThrowIfFailed(m_device->CreateTexture2D(&desc, &initData, texture.GetAddressOf()));
+        DX::ThrowIfFailed(m_device->CreateShaderResourceView(texture.Get(), nullptr, view.GetAddressOf()));
+    }
+
+    // Another loader may have added the same file meanwhile; the first one is kept
+    request.texture->m_view = m_registry.AddTexture(request.pathId, view.Get());
+
+    std::vector<uint8_t>().swap(request.bytes);
+    std::vector<uint8_t>().swap(request.pixels);
+}
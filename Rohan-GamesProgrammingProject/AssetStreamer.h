@@ -0,0 +1,164 @@
+//
+// AssetStreamer.h - Asynchronous, prioritised texture and model loading
+//
+
+#pragma once
+
+#include "JobSystem.h"
+#include "ModelCache.h"
+#include "ResourceRegistry.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace DX
+{
+    // Loads textures and models without blocking the frame. A request is queued by priority,
+    // read by one of the streamer's I/O threads, decoded (images) or parsed (models) as a job
+    // on the job system, and finally uploaded on the main thread by Update, which spends at
+    // most a fixed number of bytes a frame so a burst of finished loads cannot cause a hitch.
+    //
+    // Requests return handles at once. Until its upload has happened a texture handle gives a
+    // 1x1 placeholder and a model handle gives no asset, so callers draw without waiting.
+    //
+    // DDS files are uploaded as stored; other images are decoded to RGBA, by ImageDecoder for
+    // PNG, JPEG and BMP and through WIC for the rest, keeping an sRGB format when the file says
+    // so, as WICTextureLoader does. Models go through the ModelCache, so streamed and
+    // synchronously loaded models share assets.
+    //
+    // Textures the asset pack holds are read from it, their chunks decompressed in parallel on
+    // the job system; models reach the pack through the ModelCache.
+    //
+    // Requests are keyed by their path's id in the resource registry. A texture the registry
+    // already holds is ready at once, and every texture uploaded is added to it.
+    class AssetStreamer
+    {
+    public:
+        enum Priority
+        {
+            Priority_Low,
+            Priority_Normal,
+            Priority_High,
+        };
+
+        class Texture
+        {
+        public:
+            // The placeholder until the texture is resident.
+            ID3D11ShaderResourceView* Get() const { return m_view ? m_view.Get() : m_placeholder.Get(); }
+            bool IsReady() const { return m_view != nullptr; }
+
+        private:
+            friend class AssetStreamer;
+
+            Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>    m_view;
+            Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>    m_placeholder;
+        };
+
+        class Model
+        {
+        public:
+            // Null until the model is resident.
+            std::shared_ptr<const ModelCache::Asset> const& GetAsset() const { return m_asset; }
+            bool IsReady() const { return m_asset != nullptr; }
+
+        private:
+            friend class AssetStreamer;
+
+            std::shared_ptr<const ModelCache::Asset>            m_asset;
+        };
+
+        using TextureHandle = std::shared_ptr<const Texture>;
+        using ModelHandle = std::shared_ptr<const Model>;
+
+        struct Statistics
+        {
+            size_t  requests;
+            size_t  completed;
+            size_t  bytesRead;
+            size_t  bytesUploaded;
+            size_t  budgetFrames;       // frames that left finished loads for the next frame
+            size_t  shared;             // textures found in the resource registry, not loaded
+            double  readMs;             // summed over the I/O threads
+            double  decodeMs;           // summed over the decode jobs
+            double  uploadMs;
+        };
+
+        static const size_t c_DefaultUploadBudget = 8 * 1024 * 1024;
+
+        // The registry, and the pack when given, must outlive the streamer.
+        AssetStreamer(_In_ ID3D11Device* device, ModelCache& models, JobSystem& jobs, ResourceRegistry& registry,
+            _In_opt_ const PackFile* pack = nullptr, unsigned ioThreadCount = 1, size_t uploadBudget = c_DefaultUploadBudget);
+        ~AssetStreamer();
+
+        AssetStreamer(AssetStreamer const&) = delete;
+        AssetStreamer& operator= (AssetStreamer const&) = delete;
+
+        // Requests for a file that is already requested return the same handle.
+        TextureHandle RequestTexture(_In_z_ const wchar_t* fileName, Priority priority = Priority_Normal);
+        ModelHandle RequestModel(_In_z_ const wchar_t* fileName, Priority priority = Priority_Normal);
+
+        // Main thread, once a frame: uploads finished loads, highest priority first, until the
+        // budget is spent. At least one load is uploaded whenever any is ready, so a load larger
+        // than the budget still completes. A failed load rethrows its exception here.
+        void Update();
+
+        // Main thread: blocks until every request so far is resident, ignoring the budget.
+        void Flush();
+
+        // Requests not yet resident.
+        size_t GetPendingCount() const { return m_pending; }
+        const Statistics& GetStatistics() const { return m_stats; }
+
+    private:
+        struct Request;
+        using RequestPtr = std::shared_ptr<Request>;
+
+        struct RequestOrder
+        {
+            bool operator() (RequestPtr const& a, RequestPtr const& b) const;
+        };
+
+        void Enqueue(RequestPtr const& request);
+        void IoLoop(unsigned index);
+        void Read(Request& request);
+        void Decode(Request& request);
+        void Upload(Request& request);
+        void UploadTexture(Request& request);
+        bool UploadReady(size_t budget);
+
+        Microsoft::WRL::ComPtr<ID3D11Device>                    m_device;
+        ModelCache&                                             m_models;
+        JobSystem&                                              m_jobs;
+        ResourceRegistry&                                       m_registry;
+        const PackFile*                                         m_pack;
+        size_t                                                  m_uploadBudget;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>        m_placeholder;
+
+        // Everything requested, by path id, so repeated requests share one load
+        std::unordered_map<ResourceRegistry::PathId, std::weak_ptr<Texture>> m_textures;
+        std::unordered_map<ResourceRegistry::PathId, std::weak_ptr<Model>> m_modelHandles;
+        uint64_t                                                m_sequence;
+        size_t                                                  m_pending;
+
+        // Waiting to be read
+        std::mutex                                              m_ioMutex;
+        std::condition_variable                                 m_ioWake;
+        std::priority_queue<RequestPtr, std::vector<RequestPtr>, RequestOrder> m_ioQueue;
+        bool                                                    m_stop;
+        std::vector<std::thread>                                m_ioThreads;
+
+        // Being decoded, then waiting to be uploaded
+        std::mutex                                              m_readyMutex;
+        std::condition_variable                                 m_readyWake;
+        std::vector<JobSystem::Handle>                          m_decodeJobs;
+        std::vector<RequestPtr>                                 m_ready;
+
+        Statistics                                              m_stats;
+    };
+}
@@ -0,0 +1,694 @@
+//
+// AtlasLayout.cpp - Packing small textures into one atlas page, and remapping models onto it
+//
+
+#include "AtlasLayout.h"
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <wctype.h>
+
+using namespace DX;
+
+namespace
+{
+    // Vertices a texture coordinate may stray outside [0, 1] by and still count as inside,
+    // for exporters' rounding
+    const float c_UVTolerance = 1.0f / 4096.0f;
+
+    // A region has no key while no part uses its vertex, and c_Unmovable once one whose
+    // material stays put does
+    const int32_t c_NoRegion = -1;
+    const int32_t c_Unmovable = -2;
+
+    struct Rect
+    {
+        uint32_t    x;
+        uint32_t    y;
+        uint32_t    width;
+        uint32_t    height;
+    };
+
+    uint32_t NextPowerOfTwo(uint32_t value)
+    {
+        uint32_t result = 1;
+        while (result < value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    uint32_t Log2(uint32_t value)
+    {
+        uint32_t result = 0;
+        while (value > 1)
+        {
+            value >>= 1;
+            ++result;
+        }
+        return result;
+    }
+
+    std::wstring GetFileName(const wchar_t* path)
+    {
+        const wchar_t* name = path;
+        for (const wchar_t* c = path; *c; ++c)
+        {
+            if (*c == L'/' || *c == L'\\')
+                name = c + 1;
+        }
+
+        std::wstring result(name);
+        std::transform(result.begin(), result.end(), result.begin(), [](wchar_t c) { return wchar_t(towlower(c)); });
+        return result;
+    }
+
+    // Malformed sequences become U+FFFD
+    std::wstring FromUtf8(const uint8_t* text, size_t length)
+    {
+        std::wstring result;
+        for (size_t i = 0; i < length;)
+        {
+            uint8_t lead = text[i++];
+
+            uint32_t codePoint;
+            size_t extra;
+            if (lead < 0x80)                { codePoint = lead; extra = 0; }
+            else if ((lead & 0xE0) == 0xC0) { codePoint = lead & 0x1F; extra = 1; }
+            else if ((lead & 0xF0) == 0xE0) { codePoint = lead & 0x0F; extra = 2; }
+            else if ((lead & 0xF8) == 0xF0) { codePoint = lead & 0x07; extra = 3; }
+            else                            { codePoint = 0xFFFD; extra = 0; }
+
+            for (; extra && i < length && (text[i] & 0xC0) == 0x80; --extra)
+            {
+                codePoint = (codePoint << 6) | (text[i++] & 0x3F);
+            }
+            if (extra)
+            {
+                codePoint = 0xFFFD;
+            }
+
+            if (sizeof(wchar_t) == 2 && codePoint > 0xFFFF)
+            {
+                codePoint -= 0x10000;
+                result.push_back(wchar_t(0xD800 + (codePoint >> 10)));
+                result.push_back(wchar_t(0xDC00 + (codePoint & 0x3FF)));
+            }
+            else
+            {
+                result.push_back(wchar_t(codePoint));
+            }
+        }
+        return result;
+    }
+
+    void AppendUInt32(std::vector<uint8_t>& file, uint32_t value)
+    {
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            file.push_back(uint8_t(value >> shift));
+        }
+    }
+
+    uint32_t ReadUInt32(const uint8_t* data)
+    {
+        return data[0] | (uint32_t(data[1]) << 8) | (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 24);
+    }
+
+    // Tries one page size: each cell, largest first, takes the smallest free rectangle it fits,
+    // which is halved along its longer excess until it is the cell's size, the halves it
+    // gives up going back on the free list. Every rectangle stays a power of two aligned to its
+    // size.
+    bool PlaceCells(std::vector<Rect>& cells, std::vector<size_t> const& order, uint32_t width, uint32_t height)
+    {
+        std::vector<Rect> free = { { 0, 0, width, height } };
+        for (size_t index : order)
+        {
+            auto& cell = cells[index];
+
+            auto best = free.end();
+            for (auto it = free.begin(); it != free.end(); ++it)
+            {
+                if (it->width < cell.width || it->height < cell.height)
+                    continue;
+
+                if (best == free.end()
+                    || uint64_t(it->width) * it->height < uint64_t(best->width) * best->height
+                    || (uint64_t(it->width) * it->height == uint64_t(best->width) * best->height
+                        && (it->y < best->y || (it->y == best->y && it->x < best->x))))
+                {
+                    best = it;
+                }
+            }
+            if (best == free.end())
+                return false;
+
+            Rect rect = *best;
+            free.erase(best);
+
+            while (rect.width > cell.width || rect.height > cell.height)
+            {
+                if (rect.width / cell.width >= rect.height / cell.height && rect.width > cell.width)
+                {
+                    rect.width /= 2;
+                    free.push_back({ rect.x + rect.width, rect.y, rect.width, rect.height });
+                }
+                else
+                {
+                    rect.height /= 2;
+                    free.push_back({ rect.x, rect.y + rect.height, rect.width, rect.height });
+                }
+            }
+
+            cell.x = rect.x;
+            cell.y = rect.y;
+        }
+        return true;
+    }
+
+    // TEXCOORD0 of the vertex at 'vertex', as floats or as packed halves
+    void ReadTexCoord(const uint8_t* vertex, ModelData::VertexElement const& element, float (&uv)[2])
+    {
+        if (element.format == ModelData::Format_R16G16_Float)
+        {
+            uint16_t halves[2];
+            memcpy(halves, vertex + element.offset, sizeof(halves));
+            uv[0] = HalfToFloat(halves[0]);
+            uv[1] = HalfToFloat(halves[1]);
+        }
+        else
+        {
+            memcpy(uv, vertex + element.offset, sizeof(uv));
+        }
+    }
+
+    void WriteTexCoord(const float (&uv)[2], ModelData::VertexElement const& element, uint8_t* vertex)
+    {
+        if (element.format == ModelData::Format_R16G16_Float)
+        {
+            const uint16_t halves[2] = { FloatToHalf(uv[0]), FloatToHalf(uv[1]) };
+            memcpy(vertex + element.offset, halves, sizeof(halves));
+        }
+        else
+        {
+            memcpy(vertex + element.offset, uv, sizeof(uv));
+        }
+    }
+}
+
+const AtlasRegion* AtlasLayout::Find(const wchar_t* fileName) const
+{
+    if (!fileName || !*fileName)
+        return nullptr;
+
+    auto name = GetFileName(fileName);
+    for (auto const& region : regions)
+    {
+        if (GetFileName(region.name.c_str()) == name)
+            return &region;
+    }
+    return nullptr;
+}
+
+void AtlasLayout::GetUVTransform(AtlasRegion const& region, float transform[4]) const
+{
+    transform[0] = float(region.width - 1) / float(width);
+    transform[1] = float(region.height - 1) / float(height);
+    transform[2] = (float(region.x) + 0.5f) / float(width);
+    transform[3] = (float(region.y) + 0.5f) / float(height);
+}
+
+std::vector<std::wstring> DX::ParseAtlasSource(const uint8_t* data, size_t size)
+{
+    // A UTF-8 byte order mark, as Notepad writes
+    if (size >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF)
+    {
+        data += 3;
+        size -= 3;
+    }
+
+    std::vector<std::wstring> members;
+    for (size_t start = 0; start < size;)
+    {
+        size_t end = start;
+        while (end < size && data[end] != '\n')
+        {
+            ++end;
+        }
+        size_t next = end + 1;
+
+        for (size_t i = start; i < end; ++i)
+        {
+            if (data[i] == '#')
+            {
+                end = i;
+                break;
+            }
+            if (data[i] == 0)
+                throw std::runtime_error("Atlas source is not text");
+        }
+        while (start < end && (data[start] == ' ' || data[start] == '\t'))
+        {
+            ++start;
+        }
+        while (end > start && (data[end - 1] == ' ' || data[end - 1] == '\t' || data[end - 1] == '\r'))
+        {
+            --end;
+        }
+
+        if (end > start)
+        {
+            members.push_back(FromUtf8(data + start, end - start));
+        }
+        start = next;
+    }
+
+    if (members.empty())
+        throw std::runtime_error("Atlas source lists no textures");
+
+    return members;
+}
+
+uint32_t DX::GetAtlasCellSize(uint32_t size)
+{
+    return std::max(NextPowerOfTwo(size), c_MinAtlasCell);
+}
+
+AtlasLayout DX::PackAtlas(std::vector<AtlasRegion> members, bool blockCompressed)
+{
+    if (members.empty())
+        throw std::runtime_error("Atlas has no members");
+
+    std::vector<Rect> cells(members.size());
+    uint32_t maxWidth = 0;
+    uint32_t maxHeight = 0;
+    uint32_t minCell = c_MaxAtlasSize;
+    uint64_t area = 0;
+    for (size_t i = 0; i < members.size(); ++i)
+    {
+        if (!members[i].width || !members[i].height || members[i].width > c_MaxAtlasSize || members[i].height > c_MaxAtlasSize)
+            throw std::runtime_error("Atlas member has an unsupported size");
+
+        cells[i] = { 0, 0, GetAtlasCellSize(members[i].width), GetAtlasCellSize(members[i].height) };
+        maxWidth = std::max(maxWidth, cells[i].width);
+        maxHeight = std::max(maxHeight, cells[i].height);
+        minCell = std::min(minCell, std::min(cells[i].width, cells[i].height));
+        area += uint64_t(cells[i].width) * cells[i].height;
+    }
+
+    // Largest first, taller before wider at equal area, then in listed order
+    std::vector<size_t> order(members.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+    {
+        uint64_t areaA = uint64_t(cells[a].width) * cells[a].height;
+        uint64_t areaB = uint64_t(cells[b].width) * cells[b].height;
+        if (areaA != areaB)
+            return areaA > areaB;
+        return cells[a].height > cells[b].height;
+    });
+
+    // Grow the shorter side of the page until everything fits
+    uint32_t width = maxWidth;
+    uint32_t height = maxHeight;
+    for (;;)
+    {
+        if (uint64_t(width) * height >= area && PlaceCells(cells, order, width, height))
+            break;
+
+        if (width >= c_MaxAtlasSize && height >= c_MaxAtlasSize)
+            throw std::runtime_error("Atlas members do not fit in one page");
+
+        if ((width <= height && width < c_MaxAtlasSize) || height >= c_MaxAtlasSize)
+            width *= 2;
+        else
+            height *= 2;
+    }
+
+    AtlasLayout layout;
+    layout.width = width;
+    layout.height = height;
+
+    // Down to the level where the smallest cell is a texel, or a block, across
+    uint32_t mipCount = Log2(std::max(width, height)) + 1;
+    uint32_t cellLevels = Log2(minCell) + 1;
+    if (blockCompressed)
+    {
+        cellLevels -= 2;
+    }
+    layout.mipCount = std::max(1u, std::min(mipCount, cellLevels));
+
+    layout.regions = std::move(members);
+    for (size_t i = 0; i < cells.size(); ++i)
+    {
+        layout.regions[i].x = cells[i].x;
+        layout.regions[i].y = cells[i].y;
+    }
+    return layout;
+}
+
+void DX::PadAtlasCell(AtlasRegion const& region, uint8_t* cell, size_t rowPitch, size_t pixelBytes)
+{
+    const uint32_t cellWidth = GetAtlasCellSize(region.width);
+    const uint32_t cellHeight = GetAtlasCellSize(region.height);
+
+    for (uint32_t y = 0; y < region.height; ++y)
+    {
+        uint8_t* row = cell + y * rowPitch;
+        const uint8_t* last = row + (region.width - 1) * pixelBytes;
+        for (uint32_t x = region.width; x < cellWidth; ++x)
+        {
+            memcpy(row + x * pixelBytes, last, pixelBytes);
+        }
+    }
+
+    const uint8_t* lastRow = cell + (region.height - 1) * rowPitch;
+    for (uint32_t y = region.height; y < cellHeight; ++y)
+    {
+        memcpy(cell + y * rowPitch, lastRow, cellWidth * pixelBytes);
+    }
+}
+
+void DX::AppendAtlasLayout(AtlasLayout const& layout, std::vector<uint8_t>& file)
+{
+    const size_t start = file.size();
+
+    AppendUInt32(file, c_AtlasMagic);
+    AppendUInt32(file, c_AtlasVersion);
+    AppendUInt32(file, layout.width);
+    AppendUInt32(file, layout.height);
+    AppendUInt32(file, layout.mipCount);
+    AppendUInt32(file, uint32_t(layout.regions.size()));
+
+    for (auto const& region : layout.regions)
+    {
+        AppendUInt32(file, region.x);
+        AppendUInt32(file, region.y);
+        AppendUInt32(file, region.width);
+        AppendUInt32(file, region.height);
+
+        std::vector<uint16_t> units;
+        for (wchar_t c : region.name)
+        {
+            uint32_t codePoint = uint32_t(c);
+            if (codePoint > 0xFFFF)
+            {
+                codePoint -= 0x10000;
+                units.push_back(uint16_t(0xD800 + (codePoint >> 10)));
+                units.push_back(uint16_t(0xDC00 + (codePoint & 0x3FF)));
+            }
+            else
+            {
+                units.push_back(uint16_t(codePoint));
+            }
+        }
+
+        AppendUInt32(file, uint32_t(units.size()));
+        for (uint16_t unit : units)
+        {
+            file.push_back(uint8_t(unit));
+            file.push_back(uint8_t(unit >> 8));
+        }
+    }
+
+    AppendUInt32(file, uint32_t(file.size() - start));
+    AppendUInt32(file, c_AtlasMagic);
+}
+
+bool DX::ReadAtlasLayout(const uint8_t* data, size_t size, AtlasLayout& layout)
+{
+    if (size < 8 || ReadUInt32(data + size - 4) != c_AtlasMagic)
+        return false;
+
+    const size_t layoutBytes = ReadUInt32(data + size - 8);
+    if (layoutBytes < 24 || layoutBytes > size - 8)
+        throw std::runtime_error("Atlas layout is damaged");
+
+    const uint8_t* p = data + size - 8 - layoutBytes;
+    const uint8_t* end = data + size - 8;
+    auto read = [&]() -> uint32_t
+    {
+        if (end - p < 4)
+            throw std::runtime_error("Atlas layout is damaged");
+        uint32_t value = ReadUInt32(p);
+        p += 4;
+        return value;
+    };
+
+    if (read() != c_AtlasMagic || read() != c_AtlasVersion)
+        throw std::runtime_error("Atlas layout is damaged or from another version");
+
+    layout.width = read();
+    layout.height = read();
+    layout.mipCount = read();
+    const uint32_t count = read();
+    if (!layout.width || !layout.height || layout.width > c_MaxAtlasSize || layout.height > c_MaxAtlasSize
+        || !layout.mipCount || count > size_t(end - p) / 20)
+    {
+        throw std::runtime_error("Atlas layout is damaged");
+    }
+
+    layout.regions.resize(count);
+    for (auto& region : layout.regions)
+    {
+        region.x = read();
+        region.y = read();
+        region.width = read();
+        region.height = read();
+        if (!region.width || !region.height
+            || uint64_t(region.x) + GetAtlasCellSize(region.width) > layout.width
+            || uint64_t(region.y) + GetAtlasCellSize(region.height) > layout.height)
+        {
+            throw std::runtime_error("Atlas layout has a region outside its page");
+        }
+
+        const uint32_t length = read();
+        if (length > size_t(end - p) / 2)
+            throw std::runtime_error("Atlas layout is damaged");
+
+        region.name.clear();
+        for (uint32_t i = 0; i < length; ++i, p += 2)
+        {
+            uint32_t unit = p[0] | (uint32_t(p[1]) << 8);
+            if (sizeof(wchar_t) != 2 && unit >= 0xD800 && unit < 0xDC00 && i + 1 < length)
+            {
+                uint32_t low = p[2] | (uint32_t(p[3]) << 8);
+                if (low >= 0xDC00 && low < 0xE000)
+                {
+                    unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                    ++i;
+                    p += 2;
+                }
+            }
+            region.name.push_back(wchar_t(unit));
+        }
+    }
+
+    if (p != end)
+        throw std::runtime_error("Atlas layout is damaged");
+
+    return true;
+}
+
+size_t DX::RemapToAtlas(ModelData& model, AtlasLayout const& layout)
+{
+    // Region of each material that could move, or c_Unmovable
+    std::vector<int32_t> regionOf(model.materials.size(), c_Unmovable);
+    for (size_t i = 0; i < model.materials.size(); ++i)
+    {
+        auto const& material = model.materials[i];
+        if (!material.specularTexture.empty() || !material.normalTexture.empty() || !material.emissiveTexture.empty()
+            || material.enableDualTexture)
+        {
+            continue;
+        }
+
+        if (auto region = layout.Find(material.diffuseTexture.c_str()))
+        {
+            regionOf[i] = int32_t(region - layout.regions.data());
+        }
+    }
+
+    if (std::all_of(regionOf.begin(), regionOf.end(), [](int32_t region) { return region == c_Unmovable; }))
+        return 0;
+
+    // Where each stream keeps its coordinates, or null if it has none the atlas can use
+    std::vector<const ModelData::VertexElement*> texcoords(model.vertexStreams.size(), nullptr);
+    for (size_t i = 0; i < model.vertexStreams.size(); ++i)
+    {
+        for (auto const& element : model.vertexStreams[i].elements)
+        {
+            if (!strcmp(element.semanticName, "TEXCOORD") && element.semanticIndex == 0
+                && ((element.format == ModelData::Format_R32G32_Float && element.offset + 8 <= model.vertexStreams[i].stride)
+                    || (element.format == ModelData::Format_R16G16_Float && element.offset + 4 <= model.vertexStreams[i].stride)))
+            {
+                texcoords[i] = &element;
+            }
+        }
+    }
+
+    // Calls visit(material, stream, vertex) for each vertex of each part, false for a part
+    // whose indices or vertices are out of range
+    auto forEachVertex = [&](auto&& visit)
+    {
+        for (auto const& mesh : model.meshes)
+        {
+            for (auto const& part : mesh.parts)
+            {
+                if (part.material >= model.materials.size())
+                    continue;
+
+                bool valid = part.vertexStream < model.vertexStreams.size() && part.indexStream < model.indexStreams.size();
+                if (valid)
+                {
+                    auto const& indices = model.indexStreams[part.indexStream];
+                    auto const& vertices = model.vertexStreams[part.vertexStream];
+                    const bool wide = indices.format == ModelData::Format_R32_UInt;
+                    const uint32_t restart = wide ? 0xFFFFFFFF : 0xFFFF;
+                    const bool strip = part.topology == ModelData::Topology_LineStrip || part.topology == ModelData::Topology_TriangleStrip
+                        || part.topology == ModelData::Topology_LineStripAdj || part.topology == ModelData::Topology_TriangleStripAdj;
+
+                    valid = uint64_t(part.startIndex) + part.indexCount <= indices.indexCount;
+                    for (uint32_t i = 0; valid && i < part.indexCount; ++i)
+                    {
+                        uint32_t index;
+                        if (wide)
+                        {
+                            memcpy(&index, indices.data + (size_t(part.startIndex) + i) * 4, 4);
+                        }
+                        else
+                        {
+                            uint16_t narrow;
+                            memcpy(&narrow, indices.data + (size_t(part.startIndex) + i) * 2, 2);
+                            index = narrow;
+                        }
+                        if (strip && index == restart)
+                            continue;
+
+                        int64_t vertex = int64_t(index) + part.vertexOffset;
+                        valid = vertex >= 0 && vertex < vertices.vertexCount;
+                        if (valid)
+                        {
+                            visit(part.material, part.vertexStream, uint32_t(vertex));
+                        }
+                    }
+                }
+
+                if (!valid)
+                {
+                    regionOf[part.material] = c_Unmovable;
+                }
+            }
+        }
+    };
+
+    // Drops materials until every vertex of the ones left is inside [0, 1] and moves with
+    // everything else that draws it
+    std::vector<std::vector<int32_t>> owners(model.vertexStreams.size());
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (size_t i = 0; i < owners.size(); ++i)
+        {
+            owners[i].assign(model.vertexStreams[i].vertexCount, c_NoRegion);
+        }
+
+        std::vector<int32_t> before = regionOf;
+        forEachVertex([&](uint32_t material, uint32_t stream, uint32_t vertex)
+        {
+            const int32_t region = regionOf[material];
+            auto& owner = owners[stream][vertex];
+
+            if (region != c_Unmovable)
+            {
+                auto const& vertices = model.vertexStreams[stream];
+                float uv[2] = { -1.0f, -1.0f };
+                if (texcoords[stream])
+                {
+                    ReadTexCoord(vertices.GetData() + size_t(vertex) * vertices.stride, *texcoords[stream], uv);
+                }
+                if (!(uv[0] >= -c_UVTolerance && uv[0] <= 1.0f + c_UVTolerance && uv[1] >= -c_UVTolerance && uv[1] <= 1.0f + c_UVTolerance))
+                {
+                    regionOf[material] = c_Unmovable;
+                }
+            }
+
+            if (owner == c_NoRegion)
+            {
+                owner = regionOf[material];
+            }
+            else if (owner != regionOf[material])
+            {
+                owner = c_Unmovable;
+            }
+        });
+
+        // A material with a vertex some other material pins, or moves elsewhere, stays put
+        forEachVertex([&](uint32_t material, uint32_t stream, uint32_t vertex)
+        {
+            if (regionOf[material] != c_Unmovable && owners[stream][vertex] != regionOf[material])
+            {
+                regionOf[material] = c_Unmovable;
+            }
+        });
+
+        changed = regionOf != before;
+    }
+
+    // Every vertex still owned by a region belongs only to materials moving there
+    for (size_t i = 0; i < owners.size(); ++i)
+    {
+        auto& stream = model.vertexStreams[i];
+        if (!texcoords[i] || std::none_of(owners[i].begin(), owners[i].end(), [](int32_t owner) { return owner >= 0; }))
+            continue;
+
+        if (stream.owned.empty())
+        {
+            stream.owned.assign(stream.data, stream.data + stream.size);
+        }
+
+        for (uint32_t vertex = 0; vertex < stream.vertexCount; ++vertex)
+        {
+            if (owners[i][vertex] < 0)
+                continue;
+
+            float transform[4];
+            layout.GetUVTransform(layout.regions[owners[i][vertex]], transform);
+
+            float uv[2];
+            uint8_t* texcoord = stream.owned.data() + size_t(vertex) * stream.stride;
+            ReadTexCoord(texcoord, *texcoords[i], uv);
+            uv[0] = std::min(std::max(uv[0], 0.0f), 1.0f) * transform[0] + transform[2];
+            uv[1] = std::min(std::max(uv[1], 0.0f), 1.0f) * transform[1] + transform[3];
+            WriteTexCoord(uv, *texcoords[i], texcoord);
+        }
+    }
+
+    // Only materials some part draws
+    std::vector<bool> used(model.materials.size(), false);
+    for (auto const& mesh : model.meshes)
+    {
+        for (auto const& part : mesh.parts)
+        {
+            if (part.material < used.size())
+                used[part.material] = true;
+        }
+    }
+
+    size_t moved = 0;
+    for (size_t i = 0; i < model.materials.size(); ++i)
+    {
+        if (regionOf[i] >= 0 && used[i])
+        {
+            model.materials[i].diffuseTexture = layout.name;
+            ++moved;
+        }
+    }
+    return moved;
+}
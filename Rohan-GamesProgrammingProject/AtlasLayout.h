@@ -0,0 +1,100 @@
+//
+// AtlasLayout.h - Packing small textures into one atlas page, and remapping models onto it
+//
+
+#pragma once
+
+#include "ModelData.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DX
+{
+    // One member texture's place in the page, in texels of the top level.
+    struct AtlasRegion
+    {
+        std::wstring    name;       // as listed in the atlas source
+        uint32_t        x;
+        uint32_t        y;
+        uint32_t        width;
+        uint32_t        height;
+    };
+
+    // An atlas collapses textures that would each be bound on their own into one page, so
+    // sprites and materials drawn from it no longer break batches or change effect textures.
+    //
+    // Every member gets a cell of its size rounded up to powers of two, and cells are placed
+    // by halving free power-of-two rectangles of the page, so each cell is aligned to its own
+    // size. A mip level then never filters one member into another for as long as the
+    // smallest cell is at least a texel across (four, when block compressed, so no block
+    // straddles two members), and mipCount stops there. The member sits at its cell's
+    // top-left corner and the rest of the cell repeats its last row and column, so sampling
+    // past its right and bottom edges reads the edge, as a clamp would.
+    //
+    // The source of an atlas is a text file listing the member files, one to a line and
+    // relative to it; '#' starts a comment. The asset cooker turns it into a DDS of the page
+    // with this layout appended (see AppendAtlasLayout), under the same name.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+    struct AtlasLayout
+    {
+        // The region of a member, by its file name, ignoring directories and case; null if the
+        // atlas does not hold it.
+        const AtlasRegion* Find(const wchar_t* fileName) const;
+
+        // Scale (x, y) then offset (z, w) taking the member's [0, 1] texture coordinates into the
+        // page's. The edges map to the centres of the member's outer texels at the top level.
+        void GetUVTransform(AtlasRegion const& region, float transform[4]) const;
+
+        std::wstring                name;       // of the atlas file; set by whoever loads it
+        uint32_t                    width;
+        uint32_t                    height;
+        uint32_t                    mipCount;
+        std::vector<AtlasRegion>    regions;
+    };
+
+    const uint32_t c_MaxAtlasSize = 4096;
+    const uint32_t c_MinAtlasCell = 4;
+
+    // The member file names an atlas source lists, in order. Malformed text throws
+    // std::runtime_error.
+    std::vector<std::wstring> ParseAtlasSource(const uint8_t* data, size_t size);
+
+    // Cell width or height for a member of this size.
+    uint32_t GetAtlasCellSize(uint32_t size);
+
+    // Places the members (name, width and height set), largest first, on the smallest page
+    // that takes them all; the regions keep their order. Throws std::runtime_error if they do
+    // not fit in c_MaxAtlasSize squared.
+    AtlasLayout PackAtlas(std::vector<AtlasRegion> members, bool blockCompressed);
+
+    // Fills the cell around a member already copied to its top-left corner, 'pixelBytes'
+    // wide texels in rows 'rowPitch' apart, by repeating its last column and row.
+    void PadAtlasCell(AtlasRegion const& region, uint8_t* cell, size_t rowPitch, size_t pixelBytes);
+
+    // The layout is stored after the page's DDS file, which DDS loaders ignore:
+    //
+    //   'ATLS' version width height mipCount regionCount
+    //   per region: x y width height nameLength, then the name as nameLength UTF-16 units
+    //   layout size in bytes (all of the above), then 'ATLS' again, ending the file
+    //
+    // all 32-bit little-endian.
+    const uint32_t c_AtlasMagic = 0x534C5441;    // "ATLS"
+    const uint32_t c_AtlasVersion = 1;
+
+    void AppendAtlasLayout(AtlasLayout const& layout, std::vector<uint8_t>& file);
+
+    // False if the file carries no layout; a damaged one throws std::runtime_error.
+    bool ReadAtlasLayout(const uint8_t* data, size_t size, AtlasLayout& layout);
+
+    // Points the materials whose only texture is a diffuse texture the atlas holds at the
+    // atlas instead, rewriting the texture coordinates of their vertices into its page.
+    // Only a material every one of whose vertices has R32G32_Float or R16G16_Float (packed,
+    // VertexPacking.h) TEXCOORD0 within [0, 1],
+    // and shares none with a material that is not moved to the same region, is moved;
+    // wrapping coordinates would sample neighbours in the page. Rewritten streams take a copy
+    // of their bytes. Returns the number of materials moved.
+    size_t RemapToAtlas(ModelData& model, AtlasLayout const& layout);
+}
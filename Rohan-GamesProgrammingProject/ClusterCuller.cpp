@@ -0,0 +1,151 @@
+//
+// ClusterCuller.cpp - Culls the clusters of model meshes each frame and compacts what is left into dynamic index buffers
+//
+
+#include "pch.h"
+#include "ClusterCuller.h"
+
+using namespace DirectX;
+using namespace DX;
+
+using Microsoft::WRL::ComPtr;
+
+ClusterCuller::ClusterCuller(ID3D11Device* device) :
+    m_device(device),
+    m_viewProjection{},
+    m_camera{},
+    m_rangesUsed(0),
+    m_narrowCapacity(0),
+    m_wideCapacity(0),
+    m_stats{}
+{
+}
+
+void XM_CALLCONV ClusterCuller::Begin(FXMMATRIX view, CXMMATRIX projection)
+{
+    XMStoreFloat4x4(&m_viewProjection, XMMatrixMultiply(view, projection));
+    XMStoreFloat3(&m_camera, XMMatrixInverse(nullptr, view).r[3]);
+
+    m_rangesUsed = 0;
+    m_narrowRanges.clear();
+    m_wideRanges.clear();
+    m_narrowIndices.clear();
+    m_wideIndices.clear();
+}
+
+const ModelPartLod* XM_CALLCONV ClusterCuller::Cull(const ModelMesh& mesh, const MeshClusters& clusters, FXMMATRIX world)
+{
+    if (m_rangesUsed == m_ranges.size())
+    {
+        m_ranges.emplace_back();
+    }
+    auto& ranges = m_ranges[m_rangesUsed++];
+    ranges.resize(mesh.meshParts.size());
+
+    // A mirroring transform turns the triangles the rasterizer culls the other way round
+    const bool mirrored = XMVectorGetX(XMMatrixDeterminant(world)) < 0.f;
+
+    ClusterView view;
+    if (!mirrored)
+    {
+        XMFLOAT4X4 modelToClip;
+        XMStoreFloat4x4(&modelToClip, XMMatrixMultiply(world, XMLoadFloat4x4(&m_viewProjection)));
+
+        XMFLOAT3 camera;
+        XMStoreFloat3(&camera, XMVector3TransformCoord(XMLoadFloat3(&m_camera), XMMatrixInverse(nullptr, world)));
+        MakeClusterView(&modelToClip._11, &camera.x, view);
+        ++m_stats.meshes;
+    }
+
+    uint32_t indexCount = 0;
+    for (size_t i = 0; i < mesh.meshParts.size(); ++i)
+    {
+        const auto& part = *mesh.meshParts[i];
+        auto& range = ranges[i];
+
+        const PartClusters* source = (i < clusters.parts.size()) ? &clusters.parts[i] : nullptr;
+        if (mirrored || !source || source->clusters.empty())
+        {
+            range.indexBuffer = part.indexBuffer;
+            range.indexFormat = part.indexFormat;
+            range.startIndex = part.startIndex;
+            range.indexCount = part.indexCount;
+        }
+        else if (source->wide)
+        {
+            const size_t start = m_wideIndices.size();
+            m_wideIndices.resize(start + source->indices.size());
+            m_wideIndices.resize(start + CullPartClusters(*source, view, &m_wideIndices[start], m_stats.culling));
+
+            range.indexFormat = DXGI_FORMAT_R32_UINT;
+            range.startIndex = uint32_t(start);
+            range.indexCount = uint32_t(m_wideIndices.size() - start);
+            m_wideRanges.push_back(&range);
+        }
+        else
+        {
+            const size_t start = m_narrowIndices.size();
+            m_narrowIndices.resize(start + source->indices.size());
+            m_narrowIndices.resize(start + CullPartClusters(*source, view, &m_narrowIndices[start], m_stats.culling));
+
+            range.indexFormat = DXGI_FORMAT_R16_UINT;
+            range.startIndex = uint32_t(start);
+            range.indexCount = uint32_t(m_narrowIndices.size() - start);
+            m_narrowRanges.push_back(&range);
+        }
+        indexCount += range.indexCount;
+    }
+
+    if (!indexCount)
+    {
+        ++m_stats.meshesHidden;
+        return nullptr;
+    }
+    return ranges.data();
+}
+
+void ClusterCuller::End(ID3D11DeviceContext* context)
+{
+    if (!m_narrowIndices.empty())
+    {
+        Upload(context, m_narrowIndices.data(), m_narrowIndices.size() * sizeof(uint16_t), m_narrowBuffer, m_narrowCapacity);
+    }
+    if (!m_wideIndices.empty())
+    {
+        Upload(context, m_wideIndices.data(), m_wideIndices.size() * sizeof(uint32_t), m_wideBuffer, m_wideCapacity);
+    }
+
+    // Ranges left empty are not drawn, so they need no buffer
+    for (auto range : m_narrowRanges)
+    {
+        range->indexBuffer = m_narrowBuffer;
+    }
+    for (auto range : m_wideRanges)
+    {
+        range->indexBuffer = m_wideBuffer;
+    }
+}
+
+void ClusterCuller::Upload(ID3D11DeviceContext* context, const void* indices, size_t bytes, ComPtr<ID3D11Buffer>& buffer,
+    size_t& capacity)
+{
+    if (bytes > capacity)
+    {
+        size_t grown = std::max<size_t>(capacity * 2, 64 * 1024);
+        while (grown < bytes)
+        {
+            grown *= 2;
+        }
+
+        CD3D11_BUFFER_DESC desc(UINT(grown), D3D11_BIND_INDEX_BUFFER, D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
+        DX::ThrowIfFailed(m_device->CreateBuffer(&desc, nullptr, buffer.ReleaseAndGetAddressOf()));
+        capacity = grown;
+    }
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    DX::ThrowIfFailed(context->Map(buffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+    memcpy(mapped.pData, indices, bytes);
+    context->Unmap(buffer.Get(), 0);
+
+    m_stats.indexBytes += bytes;
+}
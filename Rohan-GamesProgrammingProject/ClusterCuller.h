@@ -0,0 +1,78 @@
+//
+// ClusterCuller.h - Culls the clusters of model meshes each frame and compacts what is left into dynamic index buffers
+//
+
+#pragma once
+
+#include "MeshClusters.h"
+#include "ModelUpload.h"
+
+#include <Model.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace DX
+{
+    // Between Begin and End, Cull tests the clusters of a mesh drawn at full detail against the
+    // view (MeshClusters.h) and copies the indices of those that may show into one frame-wide
+    // list per index format. It returns a range per mesh part, as a level of detail has them,
+    // for RenderQueue::Add: clustered parts draw their surviving indices, the others their own.
+    // End writes the lists into dynamic index buffers and points the ranges at them, so it must
+    // run before the queue draws. Cull touches no device state and may run on any thread, one
+    // at a time; End runs on the context's.
+    class ClusterCuller
+    {
+    public:
+        // Totals since the last reset.
+        struct Statistics
+        {
+            uint64_t        meshes;         // tested cluster by cluster
+            uint64_t        meshesHidden;   // every cluster culled
+            ClusterCulling  culling;
+            uint64_t        indexBytes;     // written to the index buffers
+        };
+
+        explicit ClusterCuller(_In_ ID3D11Device* device);
+
+        ClusterCuller(ClusterCuller const&) = delete;
+        ClusterCuller& operator= (ClusterCuller const&) = delete;
+
+        void XM_CALLCONV Begin(DirectX::FXMMATRIX view, DirectX::CXMMATRIX projection);
+
+        // 'clusters' are those of the mesh's asset (ModelCache::Asset) and 'world' the world
+        // matrix of its model, without the positionTransform. Returns the mesh's ranges, valid
+        // until the next Begin, or null when nothing of it can show. Meshes whose world matrix
+        // mirrors them draw whole.
+        const ModelPartLod* XM_CALLCONV Cull(const DirectX::ModelMesh& mesh, const MeshClusters& clusters,
+            DirectX::FXMMATRIX world);
+
+        void End(_In_ ID3D11DeviceContext* context);
+
+        const Statistics& GetStatistics() const { return m_stats; }
+        void ResetStatistics() { m_stats = {}; }
+
+    private:
+        void Upload(_In_ ID3D11DeviceContext* context, const void* indices, size_t bytes,
+            Microsoft::WRL::ComPtr<ID3D11Buffer>& buffer, size_t& capacity);
+
+        Microsoft::WRL::ComPtr<ID3D11Device>        m_device;
+
+        DirectX::XMFLOAT4X4                         m_viewProjection;
+        DirectX::XMFLOAT3                           m_camera;       // in world space
+
+        std::vector<std::vector<ModelPartLod>>      m_ranges;       // by mesh culled, reused from frame to frame
+        size_t                                      m_rangesUsed;
+        std::vector<ModelPartLod*>                  m_narrowRanges; // drawing from the 16-bit list
+        std::vector<ModelPartLod*>                  m_wideRanges;   // and from the 32-bit one
+        std::vector<uint16_t>                       m_narrowIndices;
+        std::vector<uint32_t>                       m_wideIndices;
+
+        Microsoft::WRL::ComPtr<ID3D11Buffer>        m_narrowBuffer;
+        size_t                                      m_narrowCapacity;   // bytes
+        Microsoft::WRL::ComPtr<ID3D11Buffer>        m_wideBuffer;
+        size_t                                      m_wideCapacity;
+
+        Statistics                                  m_stats;
+    };
+}
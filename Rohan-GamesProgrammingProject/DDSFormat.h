@@ -0,0 +1,84 @@
+//
+// DDSFormat.h - On-disk structures of the DirectDraw Surface texture format
+//
+
+#pragma once
+
+#include <stdint.h>
+
+// The DDS header as DDSTextureLoader reads it, without the Windows headers, so the offline
+// texture cooker can write files the game's loaders take.
+namespace DDS
+{
+    const uint32_t c_Magic = 0x20534444;            // "DDS "
+
+    inline constexpr uint32_t MakeFourCC(char a, char b, char c, char d)
+    {
+        return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+    }
+
+    // Header::flags
+    const uint32_t c_FlagCaps           = 0x00000001;
+    const uint32_t c_FlagHeight         = 0x00000002;
+    const uint32_t c_FlagWidth          = 0x00000004;
+    const uint32_t c_FlagPitch          = 0x00000008;
+    const uint32_t c_FlagPixelFormat    = 0x00001000;
+    const uint32_t c_FlagMipMapCount    = 0x00020000;
+    const uint32_t c_FlagLinearSize     = 0x00080000;
+    const uint32_t c_FlagDepth          = 0x00800000;
+
+    // PixelFormat::flags
+    const uint32_t c_PixelAlpha         = 0x00000001;
+    const uint32_t c_PixelFourCC        = 0x00000004;
+    const uint32_t c_PixelRGB           = 0x00000040;
+    const uint32_t c_PixelLuminance     = 0x00020000;
+
+    // Header::caps
+    const uint32_t c_CapsComplex        = 0x00000008;
+    const uint32_t c_CapsTexture        = 0x00001000;
+    const uint32_t c_CapsMipMap         = 0x00400000;
+
+    struct PixelFormat
+    {
+        uint32_t    size;
+        uint32_t    flags;
+        uint32_t    fourCC;
+        uint32_t    RGBBitCount;
+        uint32_t    RBitMask;
+        uint32_t    GBitMask;
+        uint32_t    BBitMask;
+        uint32_t    ABitMask;
+    };
+
+    struct Header
+    {
+        uint32_t    size;
+        uint32_t    flags;
+        uint32_t    height;
+        uint32_t    width;
+        uint32_t    pitchOrLinearSize;
+        uint32_t    depth;
+        uint32_t    mipMapCount;
+        uint32_t    reserved1[11];
+        PixelFormat ddspf;
+        uint32_t    caps;
+        uint32_t    caps2;
+        uint32_t    caps3;
+        uint32_t    caps4;
+        uint32_t    reserved2;
+    };
+
+    // Follows Header when ddspf.fourCC is "DX10"
+    struct HeaderDXT10
+    {
+        uint32_t    dxgiFormat;
+        uint32_t    resourceDimension;
+        uint32_t    miscFlag;
+        uint32_t    arraySize;
+        uint32_t    miscFlags2;
+    };
+
+    static_assert(sizeof(PixelFormat) == 32, "DDS structure size incorrect");
+    static_assert(sizeof(Header) == 124, "DDS structure size incorrect");
+    static_assert(sizeof(HeaderDXT10) == 20, "DDS structure size incorrect");
+}
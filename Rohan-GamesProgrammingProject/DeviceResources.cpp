@@ -158,14 +158,50 @@ void DeviceResources::CreateDeviceResources()
     }
 
     ComPtr<IDXGIAdapter1> adapter;
-    GetHardwareAdapter(adapter.GetAddressOf());
+    if (!(m_options & c_Headless))
+    {
+        GetHardwareAdapter(adapter.GetAddressOf());
+    }
 
     // Create the Direct3D 11 API device object and a corresponding context.
     ComPtr<ID3D11Device> device;
     ComPtr<ID3D11DeviceContext> context;
 
     HRESULT hr = E_FAIL;
-    if (adapter)
+    if (m_options & c_Headless)
+    {
+        // The null driver accepts every call but never renders, so the frame costs only CPU time.
+        // It ships with the SDK layers, so fall back to WARP on machines without them.
+        hr = D3D11CreateDevice(
+            nullptr,
+            D3D_DRIVER_TYPE_NULL,
+            nullptr,
+            creationFlags,
+            s_featureLevels,
+            featLevelCount,
+            D3D11_SDK_VERSION,
+            device.GetAddressOf(),
+            &m_d3dFeatureLevel,
+            context.GetAddressOf()
+            );
+
+        if (FAILED(hr))
+        {
+            hr = D3D11CreateDevice(
+                nullptr,
+                D3D_DRIVER_TYPE_WARP,
+                nullptr,
+                creationFlags,
+                s_featureLevels,
+                featLevelCount,
+                D3D11_SDK_VERSION,
+                device.GetAddressOf(),
+                &m_d3dFeatureLevel,
+                context.GetAddressOf()
+                );
+        }
+    }
+    else if (adapter)
     {
         hr = D3D11CreateDevice(
             adapter.Get(),
@@ -238,13 +274,36 @@ void DeviceResources::CreateDeviceResources()
 
     ThrowIfFailed(device.As(&m_d3dDevice));
     ThrowIfFailed(context.As(&m_d3dContext));
-    ThrowIfFailed(context.As(&m_d3dAnnotation));
+
+    if (m_options & c_Headless)
+    {
+        // Annotations are optional on the null driver; PIX events become no-ops without them.
+        (void)context.As(&m_d3dAnnotation);
+    }
+    else
+    {
+        ThrowIfFailed(context.As(&m_d3dAnnotation));
+    }
+
+    if (m_options & (c_Headless | c_RecordCalls))
+    {
+        // Everything downstream (Game, SpriteBatch, Model, PrimitiveBatch) talks to the recorder.
+        m_recorder.Attach(new RecordingDeviceContext(m_d3dContext.Get(), (m_options & c_Headless) != 0));
+        m_d3dContext = m_recorder;
+    }
+
+    if (m_options & c_FilterState)
+    {
+        // In front of the recorder, so the recorder only sees bindings that reach the driver.
+        m_stateFilter.Attach(new StateFilteringDeviceContext(m_d3dContext.Get()));
+        m_d3dContext = m_stateFilter;
+    }
 }
 
 // These resources need to be recreated every time the window size is changed.
 void DeviceResources::CreateWindowSizeDependentResources()
 {
-    if (!m_window)
+    if (!m_window && !(m_options & c_Headless))
     {
         throw std::exception("Call SetWindow with a valid Win32 window handle");
     }
@@ -263,7 +322,25 @@ void DeviceResources::CreateWindowSizeDependentResources()
     UINT backBufferHeight = std::max<UINT>(static_cast<UINT>(m_outputSize.bottom - m_outputSize.top), 1u);
     DXGI_FORMAT backBufferFormat = (m_options & (c_FlipPresent | c_AllowTearing | c_EnableHDR)) ? NoSRGB(m_backBufferFormat) : m_backBufferFormat;
 
-    if (m_swapChain)
+    if (m_options & c_Headless)
+    {
+        // No window to present to: render into an offscreen texture shaped like a back buffer.
+        CD3D11_TEXTURE2D_DESC renderTargetDesc(
+            m_backBufferFormat,
+            backBufferWidth,
+            backBufferHeight,
+            1,
+            1,
+            D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE
+            );
+
+        ThrowIfFailed(m_d3dDevice->CreateTexture2D(
+            &renderTargetDesc,
+            nullptr,
+            m_renderTarget.ReleaseAndGetAddressOf()
+            ));
+    }
+    else if (m_swapChain)
     {
         // If the swap chain already exists, resize it.
         HRESULT hr = m_swapChain->ResizeBuffers(
@@ -325,11 +402,14 @@ void DeviceResources::CreateWindowSizeDependentResources()
         ThrowIfFailed(m_dxgiFactory->MakeWindowAssociation(m_window, DXGI_MWA_NO_ALT_ENTER));
     }
 
-    // Handle color space settings for HDR
-    UpdateColorSpace();
+    if (m_swapChain)
+    {
+        // Handle color space settings for HDR
+        UpdateColorSpace();
 
-    // Create a render target view of the swap chain back buffer.
-    ThrowIfFailed(m_swapChain->GetBuffer(0, IID_PPV_ARGS(m_renderTarget.ReleaseAndGetAddressOf())));
+        // Create a render target view of the swap chain back buffer.
+        ThrowIfFailed(m_swapChain->GetBuffer(0, IID_PPV_ARGS(m_renderTarget.ReleaseAndGetAddressOf())));
+    }
 
     CD3D11_RENDER_TARGET_VIEW_DESC renderTargetViewDesc(D3D11_RTV_DIMENSION_TEXTURE2D, m_backBufferFormat);
     ThrowIfFailed(m_d3dDevice->CreateRenderTargetView(
@@ -418,6 +498,8 @@ void DeviceResources::HandleDeviceLost()
     m_swapChain.Reset();
     m_d3dContext.Reset();
     m_d3dAnnotation.Reset();
+    m_recorder.Reset();
+    m_stateFilter.Reset();
 
 #ifdef _DEBUG
     {
@@ -444,6 +526,17 @@ void DeviceResources::HandleDeviceLost()
 // Present the contents of the swap chain to the screen.
 void DeviceResources::Present()
 {
+    if (m_options & c_Headless)
+    {
+        // Nothing to show; just close the recorded frame.
+        m_recorder->EndFrame();
+        if (m_stateFilter)
+        {
+            m_stateFilter->EndFrame();
+        }
+        return;
+    }
+
     HRESULT hr;
     if (m_options & c_AllowTearing)
     {
@@ -489,6 +582,16 @@ void DeviceResources::Present()
             // Output information is cached on the DXGI Factory. If it is stale we need to create a new factory.
             CreateFactory();
         }
+
+        if (m_recorder)
+        {
+            m_recorder->EndFrame();
+        }
+
+        if (m_stateFilter)
+        {
+            m_stateFilter->EndFrame();
+        }
     }
 }
 
@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include "RecordingDeviceContext.h"
+#include "StateFilteringDeviceContext.h"
+
 namespace DX
 {
     // Provides an interface for an application that owns DeviceResources to be notified of the device being lost or created.
@@ -23,6 +26,9 @@ namespace DX
         static const unsigned int c_FlipPresent     = 0x1;
         static const unsigned int c_AllowTearing    = 0x2;
         static const unsigned int c_EnableHDR       = 0x4;
+        static const unsigned int c_Headless        = 0x8;  // null driver, offscreen target, no swap chain
+        static const unsigned int c_RecordCalls     = 0x10; // count context calls on a real device
+        static const unsigned int c_FilterState     = 0x20; // drop bindings that set what is already bound
 
         DeviceResources(DXGI_FORMAT backBufferFormat = DXGI_FORMAT_B8G8R8A8_UNORM,
                         DXGI_FORMAT depthBufferFormat = DXGI_FORMAT_D32_FLOAT,
@@ -56,21 +62,31 @@ namespace DX
         UINT                    GetBackBufferCount() const              { return m_backBufferCount; }
         DXGI_COLOR_SPACE_TYPE   GetColorSpace() const                   { return m_colorSpace; }
         unsigned int            GetDeviceOptions() const                { return m_options; }
+        bool                    IsHeadless() const                      { return (m_options & c_Headless) != 0; }
+
+        // Call counters, available when created with c_Headless or c_RecordCalls.
+        RecordingDeviceContext* GetRecorder() const                     { return m_recorder.Get(); }
+
+        // Redundant binding counters, available when created with c_FilterState.
+        StateFilteringDeviceContext* GetStateFilter() const             { return m_stateFilter.Get(); }
 
         // Performance events
         void PIXBeginEvent(_In_z_ const wchar_t* name)
         {
-            m_d3dAnnotation->BeginEvent(name);
+            if (m_d3dAnnotation)
+                m_d3dAnnotation->BeginEvent(name);
         }
 
         void PIXEndEvent()
         {
-            m_d3dAnnotation->EndEvent();
+            if (m_d3dAnnotation)
+                m_d3dAnnotation->EndEvent();
         }
 
         void PIXSetMarker(_In_z_ const wchar_t* name)
         {
-            m_d3dAnnotation->SetMarker(name);
+            if (m_d3dAnnotation)
+                m_d3dAnnotation->SetMarker(name);
         }
 
     private:
@@ -84,6 +100,8 @@ namespace DX
         Microsoft::WRL::ComPtr<ID3D11DeviceContext1>        m_d3dContext;
         Microsoft::WRL::ComPtr<IDXGISwapChain1>             m_swapChain;
         Microsoft::WRL::ComPtr<ID3DUserDefinedAnnotation>   m_d3dAnnotation;
+        Microsoft::WRL::ComPtr<RecordingDeviceContext>      m_recorder;
+        Microsoft::WRL::ComPtr<StateFilteringDeviceContext> m_stateFilter;
 
         // Direct3D rendering objects. Required for 3D.
         Microsoft::WRL::ComPtr<ID3D11Texture2D>         m_renderTarget;
@@ -0,0 +1,246 @@
+//
+// FrustumCuller.cpp - Batched view-frustum culling of bounding spheres stored as structure-of-arrays
+//
+// Does not use the precompiled header, so the offline tools can build it.
+//
+
+#include "FrustumCuller.h"
+
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+using namespace DX;
+
+namespace
+{
+    FrustumSimdLevel GetSupportedLevel()
+    {
+#if defined(FRUSTUM_SSE2)
+        return FrustumSimdLevel::SSE2;
+#else
+        return FrustumSimdLevel::Scalar;
+#endif
+    }
+
+    std::atomic<int> g_frustumLevel(-1);
+}
+
+FrustumSimdLevel DX::GetFrustumSimdLevel()
+{
+    int level = g_frustumLevel.load(std::memory_order_relaxed);
+    return level < 0 ? GetSupportedLevel() : FrustumSimdLevel(level);
+}
+
+void DX::SetFrustumSimdLevel(FrustumSimdLevel level)
+{
+    g_frustumLevel.store(int(std::min(level, GetSupportedLevel())), std::memory_order_relaxed);
+}
+
+const char* DX::GetFrustumSimdLevelName(FrustumSimdLevel level)
+{
+    switch (level)
+    {
+    case FrustumSimdLevel::SSE2:    return "SSE2";
+    default:                        return "scalar";
+    }
+}
+
+FrustumCuller::FrustumCuller() noexcept :
+    m_count(0),
+    m_planes{}
+{
+}
+
+void FrustumCuller::Clear()
+{
+    m_count = 0;
+    m_x.clear();
+    m_y.clear();
+    m_z.clear();
+    m_radius.clear();
+    m_visible.clear();
+}
+
+void FrustumCuller::Reserve(size_t count)
+{
+    m_x.reserve(count);
+    m_y.reserve(count);
+    m_z.reserve(count);
+    m_radius.reserve(count);
+    m_visible.reserve(count);
+}
+
+uint32_t FrustumCuller::Add(float x, float y, float z, float radius)
+{
+    m_x.push_back(x);
+    m_y.push_back(y);
+    m_z.push_back(z);
+    m_radius.push_back(radius);
+    return uint32_t(m_count++);
+}
+
+void FrustumCuller::Resize(size_t count)
+{
+    m_count = count;
+    m_x.resize(count);
+    m_y.resize(count);
+    m_z.resize(count);
+    m_radius.resize(count);
+}
+
+void FrustumCuller::Set(size_t index, float x, float y, float z, float radius)
+{
+    m_x[index] = x;
+    m_y[index] = y;
+    m_z[index] = z;
+    m_radius[index] = radius;
+}
+
+void FrustumCuller::SetViewProjection(const float viewProjection[16])
+{
+    // Gribb/Hartmann plane extraction for row vectors and a 0..1 clip-space depth range:
+    // each plane is a sum or difference of the matrix columns.
+    static const float c_Signs[c_PlaneCount][2] =
+    {
+        { 1.f, 1.f },       // left: w + x
+        { 1.f, -1.f },      // right: w - x
+        { 1.f, 1.f },       // bottom: w + y
+        { 1.f, -1.f },      // top: w - y
+        { 0.f, 1.f },       // near: z
+        { 1.f, -1.f },      // far: w - z
+    };
+    static const int c_Columns[c_PlaneCount] = { 0, 0, 1, 1, 2, 2 };
+
+    for (size_t p = 0; p < c_PlaneCount; ++p)
+    {
+        float plane[4];
+        for (int row = 0; row < 4; ++row)
+        {
+            plane[row] = c_Signs[p][0] * viewProjection[row * 4 + 3] + c_Signs[p][1] * viewProjection[row * 4 + c_Columns[p]];
+        }
+
+        const float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        const float scale = length > 0.f ? 1.f / length : 0.f;
+        for (int i = 0; i < 4; ++i)
+        {
+            m_planes[p][i] = plane[i] * scale;
+        }
+    }
+}
+
+void FrustumCuller::SetPlanes(const float planes[c_PlaneCount][4])
+{
+    for (size_t p = 0; p < c_PlaneCount; ++p)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            m_planes[p][i] = planes[p][i];
+        }
+    }
+}
+
+size_t FrustumCuller::Cull()
+{
+    m_visible.resize(m_count);
+
+    size_t visible = 0;
+    size_t first = 0;
+
+#if defined(FRUSTUM_SSE2)
+    if (GetFrustumSimdLevel() == FrustumSimdLevel::SSE2)
+    {
+        first = m_count & ~size_t(3);
+        visible = Cull4(first);
+    }
+#endif
+
+    visible += CullScalar(first, visible);
+
+    m_visible.resize(visible);
+    return visible;
+}
+
+#if defined(FRUSTUM_SSE2)
+// Tests instances [0, count) four at a time; count must be a multiple of four.
+size_t FrustumCuller::Cull4(size_t count)
+{
+    __m128 planes[c_PlaneCount][4];
+    for (size_t p = 0; p < c_PlaneCount; ++p)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            planes[p][i] = _mm_set1_ps(m_planes[p][i]);
+        }
+    }
+
+    const float* xs = m_x.data();
+    const float* ys = m_y.data();
+    const float* zs = m_z.data();
+    const float* rs = m_radius.data();
+    uint32_t* out = m_visible.data();
+
+    size_t visible = 0;
+    for (size_t i = 0; i < count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(xs + i);
+        __m128 y = _mm_loadu_ps(ys + i);
+        __m128 z = _mm_loadu_ps(zs + i);
+        __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(rs + i));
+
+        // A sphere is outside if it lies entirely behind any one plane.
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (size_t p = 0; p < c_PlaneCount; ++p)
+        {
+            __m128 d = _mm_add_ps(_mm_mul_ps(planes[p][0], x), planes[p][3]);
+            d = _mm_add_ps(d, _mm_mul_ps(planes[p][1], y));
+            d = _mm_add_ps(d, _mm_mul_ps(planes[p][2], z));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negRadius));
+        }
+
+        // Compact the surviving lanes without branching on each one.
+        const int mask = _mm_movemask_ps(inside);
+        const auto base = uint32_t(i);
+        out[visible] = base;
+        visible += (mask & 1);
+        out[visible] = base + 1;
+        visible += (mask >> 1) & 1;
+        out[visible] = base + 2;
+        visible += (mask >> 2) & 1;
+        out[visible] = base + 3;
+        visible += (mask >> 3) & 1;
+    }
+
+    return visible;
+}
+#endif
+
+// Tests instances [first, m_count) one at a time, appending after the first `visible` results.
+size_t FrustumCuller::CullScalar(size_t first, size_t visible)
+{
+    const size_t start = visible;
+    for (size_t i = first; i < m_count; ++i)
+    {
+        const float negRadius = -m_radius[i];
+
+        bool inside = true;
+        for (size_t p = 0; p < c_PlaneCount && inside; ++p)
+        {
+            // Summed in the SSE path's order, so both round alike
+            const float* plane = m_planes[p];
+            inside = (plane[0] * m_x[i] + plane[3] + plane[1] * m_y[i] + plane[2] * m_z[i]) >= negRadius;
+        }
+
+        if (inside)
+        {
+            m_visible[visible++] = uint32_t(i);
+        }
+    }
+
+    return visible - start;
+}
@@ -0,0 +1,77 @@
+//
+// FrustumCuller.h - Batched view-frustum culling of bounding spheres stored as structure-of-arrays
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace DX
+{
+    // Spheres are tested four at a time with SSE2 where the build has it; SetFrustumSimdLevel
+    // drops to the scalar loop, for benchmarks. Every level gives the same results.
+    enum class FrustumSimdLevel
+    {
+        Scalar,
+        SSE2,
+    };
+
+    FrustumSimdLevel GetFrustumSimdLevel();
+    void SetFrustumSimdLevel(FrustumSimdLevel level);
+    const char* GetFrustumSimdLevelName(FrustumSimdLevel level);
+
+    // Instances are world-space bounding spheres kept in separate x/y/z/radius arrays so the
+    // SSE path can test four of them against each frustum plane with a handful of instructions.
+    // Cull() writes the indices of the instances that intersect the frustum, in ascending order.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+    class FrustumCuller
+    {
+    public:
+        static const size_t c_PlaneCount = 6;
+
+        FrustumCuller() noexcept;
+
+        FrustumCuller(FrustumCuller&&) = default;
+        FrustumCuller& operator= (FrustumCuller&&) = default;
+
+        FrustumCuller(FrustumCuller const&) = delete;
+        FrustumCuller& operator= (FrustumCuller const&) = delete;
+
+        // Instances
+        void Clear();
+        void Reserve(size_t count);
+        uint32_t Add(float x, float y, float z, float radius);
+        size_t GetCount() const { return m_count; }
+
+        // Sizes the instance arrays up front so Set can fill disjoint ranges from several threads.
+        void Resize(size_t count);
+        void Set(size_t index, float x, float y, float z, float radius);
+
+        // Frustum, either from a row-major D3D view * projection matrix (row vectors, as
+        // DirectXMath) or as six normalized planes (ax + by + cz + d >= 0 on the inside).
+        void SetViewProjection(const float viewProjection[16]);
+        void SetPlanes(const float planes[c_PlaneCount][4]);
+
+        // Tests every instance and returns the number visible.
+        size_t Cull();
+        const std::vector<uint32_t>& GetVisible() const { return m_visible; }
+
+    private:
+        size_t Cull4(size_t count);
+        size_t CullScalar(size_t first, size_t visible);
+
+        size_t                      m_count;
+
+        std::vector<float>          m_x;
+        std::vector<float>          m_y;
+        std::vector<float>          m_z;
+        std::vector<float>          m_radius;
+
+        float                       m_planes[c_PlaneCount][4];
+
+        std::vector<uint32_t>       m_visible;
+    };
+}
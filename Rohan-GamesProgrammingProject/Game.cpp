@@ -1,6 +1,8 @@
 #include "pch.h"
 #include "Game.h"
+#include "ReadContent.h"
 #include <iostream>
+#include <sstream>
 
 extern void ExitGame();
 
@@ -17,6 +19,16 @@ namespace
     const float ROTATION_GAIN = 0.01f;
     const float MOVEMENT_GAIN = 0.07f;
 
+    // The software occlusion buffer, coarse enough to fill on the CPU each frame, and the meshes
+    // drawn into it: only those whose bounding spheres are at least this many screen pixels in
+    // radius (about nine of the buffer's across at 900 lines), largest first, while they stay
+    // within the counts below
+    const uint32_t OCCLUSION_WIDTH = 256;
+    const uint32_t OCCLUSION_HEIGHT = 128;
+    const float MIN_OCCLUDER_PIXELS = 32.f;
+    const size_t MAX_OCCLUDERS = 16;
+    const size_t MAX_OCCLUDER_TRIANGLES = 32768;
+
     struct VS_BLOOM_PARAMETERS
     {
         float bloomThreshold;
@@ -120,16 +132,58 @@ namespace
     };
 }
 
-Game::Game() :
+Game::Game(GameOptions const& options) :
     m_pitch(0),
-    m_yaw(0)
+    m_yaw(0),
+    m_sceneFile(options.sceneFile),
+    m_mapModels(options.mapModels),
+    m_streamAssets(options.streamAssets),
+    m_textureBudget(options.textureBudget),
+    m_instanceModels(options.instanceModels),
+    m_cullClusters(options.cullClusters),
+    m_cullOccluded(options.cullOccluded),
+    m_occlusion(OCCLUSION_WIDTH, OCCLUSION_HEIGHT),
+    m_occlusionStats{},
+    m_lodStats{},
+    m_retryAudio(false)
 {
-    m_deviceResources = std::make_unique<DX::DeviceResources>();
+    unsigned int deviceOptions = DX::DeviceResources::c_FlipPresent;
+    if (options.headless)
+    {
+        deviceOptions |= DX::DeviceResources::c_Headless;
+    }
+    if (options.filterState)
+    {
+        deviceOptions |= DX::DeviceResources::c_FilterState;
+    }
+
+    m_deviceResources = std::make_unique<DX::DeviceResources>(DXGI_FORMAT_B8G8R8A8_UNORM,
+        DXGI_FORMAT_D32_FLOAT, 2, D3D_FEATURE_LEVEL_10_0, deviceOptions);
     m_deviceResources->RegisterDeviceNotify(this);
+
+    const int workerCount = options.workerCount;
+    m_jobs = std::make_unique<DX::JobSystem>((workerCount < 0) ? DX::JobSystem::DefaultWorkerCount() : unsigned(workerCount),
+        [](const char* name) { DX::Profiler::SetThreadName(name); });
+
+    // The pack is optional; without one everything loads loose, as before
+    if (!options.packFile.empty() && GetFileAttributesW(options.packFile.c_str()) != INVALID_FILE_ATTRIBUTES)
+    {
+        m_pack = std::make_unique<DX::PackFile>(options.packFile.c_str());
+        m_packParallelFor = [this](size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)
+        {
+            m_jobs->ParallelFor(count, grain, body);
+        };
+    }
 }
 
 Game::~Game()
 {
+    // Let any jobs still queued finish while everything they touch is alive; the streamers'
+    // decode and read jobs run on the job system too
+    m_streamer.reset();
+    m_textureStreamer.reset();
+    m_jobs.reset();
+
     if (m_audEngine)
     {
         m_audEngine->Suspend();
@@ -162,6 +216,25 @@ void Game::Initialize(HWND window, int width, int height)
 
     m_deviceResources->SetWindow(window, width, height);
 
+    InitializeDevice();
+}
+
+// Initialize without a window, audio or GPU: the device is the null driver behind a
+// RecordingDeviceContext so Tick() can run as a CPU-only frame benchmark.
+void Game::InitializeHeadless(int width, int height)
+{
+    m_keyboard = std::make_unique<Keyboard>();
+    m_mouse = std::make_unique<Mouse>();
+
+    m_deviceResources->SetWindow(nullptr, width, height);
+
+    InitializeDevice();
+}
+
+void Game::InitializeDevice()
+{
+    LoadScene();
+
     m_deviceResources->CreateDeviceResources();
 
     CreateDeviceDependentResources();
@@ -170,8 +243,7 @@ void Game::Initialize(HWND window, int width, int height)
     m_deviceResources->CreateWindowSizeDependentResources();
 
     // Obtain the backbuffer for this window which will be the final 3D rendertarget.
-    DX::ThrowIfFailed(m_deviceResources->GetSwapChain()->GetBuffer(0, __uuidof(ID3D11Texture2D),
-        &m_backBuffer));
+    m_backBuffer = m_deviceResources->GetRenderTarget();
 
     // Setting renderTargetView
     DX::ThrowIfFailed(m_deviceResources->GetD3DDevice()->CreateRenderTargetView(m_backBuffer.Get(), nullptr,
@@ -190,16 +262,22 @@ void Game::Initialize(HWND window, int width, int height)
 // Executes the basic game loop.
 void Game::Tick()
 {
+    ResolveSceneModels();
+
     m_timer.Tick([&]()
     {
         Update(m_timer);
     });
 
     Render();
+
+    DX::Profiler::EndFrame();
 }
 
 void Game::TakeInput()
 {
+    DX_PROFILE_SCOPE("TakeInput");
+
     // Mouse Input
     auto mouse = m_mouse->GetState();
 
@@ -279,6 +357,12 @@ void Game::TakeInput()
 }
 
 void Game::CalculateAudioProperties() {
+    DX_PROFILE_SCOPE("CalculateAudioProperties");
+
+    if (!m_audEngine) {
+        return;
+    }
+
     if (m_retryAudio) {
         m_retryAudio = false;
         if (m_audEngine->Reset()) {
@@ -310,12 +394,13 @@ void Game::CalculateAudioProperties() {
     }
 }
 
-// Updates the world.
+// Updates the world. The work is scheduled as jobs and finishes during Render:
+//   input (main thread) -> audio and sound animation
+//   rotation and reticle animation
+//   scene graph animation and world matrices
 void Game::Update(DX::StepTimer const& timer)
 {
-    CalculateAudioProperties();
-
-    TakeInput();
+    DX_PROFILE_SCOPE("Update");
 
     float elapsedTime = float(timer.GetElapsedSeconds());
     float totalTime = float(timer.GetTotalSeconds());
@@ -323,15 +408,47 @@ void Game::Update(DX::StepTimer const& timer)
     // TODO: Add your game logic here.
     //RotateSphere(totalTime);
 
+    // Another update in the same frame builds on this one
+    auto previous = m_updateJob;
+
+    // Mouse mode and quitting go through the window, so input stays on the main thread
+    m_inputJob = m_jobs->Submit([this]()
+    {
+        TakeInput();
+    }, { previous }, DX::JobSystem::Affinity_Main);
+
+    // The listener follows the camera
+    auto audioJob = m_jobs->Submit([this, totalTime]()
+    {
+        CalculateAudioProperties();
+        DoSoundAnimation(totalTime);
+    }, { m_inputJob });
+
     // Rotate factor to define render skulls
-    DoRotateAnimation();
-    DoReticleAnimation();
-    DoSoundAnimation(totalTime);
+    m_animationJob = m_jobs->Submit([this]()
+    {
+        DX_PROFILE_SCOPE("Animation");
+        DoRotateAnimation();
+        DoReticleAnimation();
+    }, { previous });
+
+    m_sceneJob = m_jobs->Submit([this]()
+    {
+        DX_PROFILE_SCOPE("SceneGraph");
+        m_scene->Animate();
+        m_scene->UpdateWorldMatrices();
+    }, { previous });
+
+    m_updateJob = m_jobs->Submit([]() {}, { m_inputJob, audioJob, m_animationJob, m_sceneJob });
 
     elapsedTime;
 }
 
 void Game::DoSoundAnimation(float totalTime) {
+    if (!sound_ambient_instance) {
+        return;
+    }
+
     // Do pitch blending
     sound_ambient_instance->SetPitch(cos(totalTime/2));
 }
@@ -375,11 +492,16 @@ void Game::Render()
         return;
     }
 
+    DX_PROFILE_SCOPE("Render");
+
+    // Clearing overlaps the update jobs; the camera is needed from here on
     Clear();
 
     m_deviceResources->PIXBeginEvent(L"Render");
     auto context = m_deviceResources->GetD3DDeviceContext();
 
+    m_jobs->Wait(m_inputJob);
+
     float y = sinf(m_pitch);
     float r = cosf(m_pitch);
     float z = r * cosf(m_yaw);
@@ -389,13 +511,16 @@ void Game::Render()
 
     m_view = XMMatrixLookAtRH(m_cameraPos, lookAt, Vector3::Up);
 
+    // Culling and sorting run on the workers while the background, ring and room are drawn
+    auto sceneReady = PrepareScene();
+
     // TODO: Add your rendering code here.
     RenderSpriteBatch(); // Create BackGround
+    m_jobs->Wait(m_animationJob);
     RenderShape(); // Render ring structure
     RenderRoom(); // Render Room
-    RenderBodys(); // Render body models
-    RenderShip(); // Render ship model
-    RenderSkulls(); // Render Skull models
+    m_jobs->Wait(sceneReady);
+    RenderScene(); // Render bodies, ship and skulls from the scene graph
 
     RenderAimReticle(); // Render Aiming Reticle
 
@@ -406,179 +531,483 @@ void Game::Render()
     //Do PostProcessing and apply to RenderTarget
     PostProcess();
 
+    m_jobs->Wait(m_updateJob);
+
     // Show the new frame.
-    m_deviceResources->Present();
+    {
+        DX_PROFILE_SCOPE("Present");
+        m_deviceResources->Present();
+    }
 }
 
 void Game::RenderSpriteBatch()
 {
+    DX_PROFILE_SCOPE("RenderSpriteBatch");
+
     m_spriteBatch->Begin();
-    m_spriteBatch->Draw(m_background.Get(), m_fullscreenRect);
+    m_spriteBatch->Draw(m_background->Get(), m_fullscreenRect);
     m_spriteBatch->End();
 }
 
 void Game::RenderShape()
 {
+    DX_PROFILE_SCOPE("RenderShape");
+
     m_world *= Matrix::CreateRotationY(rotationFactor * radiansFactor);
-    primitiveShape->Draw(m_world, m_view, m_proj, Colors::White, ring_texture.Get());
+    primitiveShape->Draw(m_world, m_view, m_proj, Colors::White, ring_texture->Get());
     m_world = Matrix::Identity;
 }
 
-void Game::RenderShip() {
-    Quaternion q = Quaternion::CreateFromYawPitchRoll(lightRotationFactor, 3.f, 0.f);
-    modelShip->UpdateEffects([&](IEffect* effect)
+// Scene preparation as jobs: bounds gathering (parallel over renderables) -> frustum and
+// occlusion culling -> queueing the visible meshes (styles depend on the camera and light animation) -> sorting.
+DX::JobSystem::Handle Game::PrepareScene()
+{
+    auto gatherJob = m_jobs->Submit([this]()
+    {
+        GatherSceneBounds();
+    }, { m_sceneJob });
+
+    auto cullJob = m_jobs->Submit([this]()
+    {
+        DX_PROFILE_SCOPE("Cull");
+        XMFLOAT4X4 viewProj;
+        XMStoreFloat4x4(&viewProj, m_view * m_proj);
+        m_culler.SetViewProjection(&viewProj._11);
+        m_culler.Cull();
+        OccludeSceneMeshes();
+    }, { gatherJob });
+
+    auto queueJob = m_jobs->Submit([this]()
+    {
+        QueueVisibleMeshes();
+    }, { cullJob, m_inputJob, m_animationJob });
+
+    return m_jobs->Submit([this]()
+    {
+        DX_PROFILE_SCOPE("SortQueue");
+        m_renderQueue.Sort();
+    }, { queueJob });
+}
+
+// Gathers the world-space bounds of every mesh in the scene so they can be culled as one batch
+void Game::GatherSceneBounds()
+{
+    DX_PROFILE_SCOPE("GatherSceneBounds");
+
+    const auto& renderables = m_scene->GetRenderables();
+
+    m_sceneMeshOffsets.resize(renderables.size());
+    uint32_t total = 0;
+    for (size_t i = 0; i < renderables.size(); ++i)
     {
-        auto lights = dynamic_cast<IEffectLights*>(effect);
-        if (lights)
+        m_sceneMeshOffsets[i] = total;
+        total += uint32_t(GetSceneModel(renderables[i]).meshes.size());
+    }
+
+    m_culler.Resize(total);
+    m_sceneMeshes.resize(total);
+    m_sceneMeshLods.resize(total);
+
+    m_jobs->ParallelFor(renderables.size(), 64, [&](size_t begin, size_t end)
+    {
+        for (size_t r = begin; r < end; ++r)
         {
-            lights->SetLightEnabled(0, true);
-            XMVECTOR dir = XMVector3Rotate(g_XMOne, q);
-            lights->SetLightDirection(0, dir);
-            lights->SetAmbientLightColor(Colors::Blue);
-            lights->SetLightDiffuseColor(0, Colors::LightBlue);
+            auto node = renderables[r];
+            auto& model = GetSceneModel(node);
+            XMMATRIX world = m_scene->GetWorld(node);
+
+            uint32_t offset = m_sceneMeshOffsets[r];
+            for (size_t i = 0; i < model.meshes.size(); ++i)
+            {
+                BoundingSphere sphere;
+                model.meshes[i]->boundingSphere.Transform(sphere, world);
+                m_culler.Set(offset + i, sphere.Center.x, sphere.Center.y, sphere.Center.z, sphere.Radius);
+                m_sceneMeshes[offset + i] = { node, uint32_t(i) };
+            }
         }
     });
-
-    m_world *= Matrix::CreateScale(0.005f);
-    m_world *= Matrix::CreateTranslation(0.0f, -5.0f, 1.0f);
-    m_world *= Matrix::CreateRotationY(45.f * radiansFactor);
-    modelShip->Draw(m_deviceResources->GetD3DDeviceContext(), *m_States, m_world, m_view, m_proj);
-    m_world = Matrix::Identity;
 }
 
-void Game::RenderSkulls()
+// Draws the largest meshes the frustum left into the occlusion buffer and keeps, in
+// m_sceneVisible, those whose boxes may show in front of them. Occluders are the meshes'
+// opaque triangles at full detail, whichever level they draw. The room is not one: the camera
+// never leaves it, so it hides nothing.
+void Game::OccludeSceneMeshes()
 {
-    Quaternion q = Quaternion::CreateFromYawPitchRoll(m_yaw, m_pitch, 0.f);
-    modelSkull1->UpdateEffects([&](IEffect* effect)
+    DX_PROFILE_SCOPE("OccludeSceneMeshes");
+
+    const auto& visible = m_culler.GetVisible();
+    m_sceneVisible.assign(visible.begin(), visible.end());
+    if (!m_cullOccluded)
+        return;
+
+    const auto output = m_deviceResources->GetOutputSize();
+    const float pixelsPerUnit = m_proj._22 * 0.5f * float(output.bottom - output.top);
+
+    m_sceneOccluders.clear();
+    for (uint32_t entry : visible)
     {
-        auto lights = dynamic_cast<IEffectLights*>(effect);
-        if (lights)
+        const auto& instance = m_sceneMeshes[entry];
+        const auto& occluders = m_sceneAssets[instance.node]->occluders;
+        if (instance.mesh >= occluders.size() || occluders[instance.mesh].indices.empty())
+            continue;
+
+        const auto& mesh = *GetSceneModel(instance.node).meshes[instance.mesh];
+        const float pixels = GetProjectedRadius(mesh, m_scene->GetWorld(instance.node), pixelsPerUnit);
+        if (pixels >= MIN_OCCLUDER_PIXELS)
         {
-            XMVECTOR dir = XMVector3Rotate(g_XMOne, q);
-            lights->SetLightDirection(0, dir / 2.f);
-            lights->SetAmbientLightColor(Colors::DarkGoldenrod);
+            m_sceneOccluders.push_back({ pixels, entry });
         }
-    });
+    }
+    if (m_sceneOccluders.empty())
+        return;
 
-    m_world *= Matrix::CreateTranslation(-5.0f, 2.0f, -5.0f);
-    m_world *= Matrix::CreateRotationY(rotationFactor * radiansFactor);
-    modelSkull1->Draw(m_deviceResources->GetD3DDeviceContext(), *m_States, m_world, m_view, m_proj);
-    m_world = Matrix::Identity;
+    std::sort(m_sceneOccluders.begin(), m_sceneOccluders.end(),
+        [](const SceneOccluder& a, const SceneOccluder& b) { return a.pixels > b.pixels; });
+
+    const XMMATRIX viewProj = m_view * m_proj;
+    m_occlusion.Clear();
+    size_t occluderCount = 0;
+    size_t triangles = 0;
+    for (size_t i = 0; i < m_sceneOccluders.size() && occluderCount < MAX_OCCLUDERS; ++i)
+    {
+        const auto& instance = m_sceneMeshes[m_sceneOccluders[i].entry];
+        const auto& occluder = m_sceneAssets[instance.node]->occluders[instance.mesh];
+        if (triangles + occluder.indices.size() / 3 > MAX_OCCLUDER_TRIANGLES)
+            continue;
+
+        triangles += occluder.indices.size() / 3;
+        ++occluderCount;
+        const XMMATRIX world = m_scene->GetWorld(instance.node);
+
+        // Winding as RenderQueue culls it; a mirroring world turns it round, so draw both sides
+        auto culling = occluder.counterClockwise ? DX::OccluderCulling::CounterClockwise : DX::OccluderCulling::Clockwise;
+        if (XMVectorGetX(XMMatrixDeterminant(world)) < 0.f)
+        {
+            culling = DX::OccluderCulling::None;
+        }
+
+        XMFLOAT4X4 modelToClip;
+        XMStoreFloat4x4(&modelToClip, world * viewProj);
+        m_occlusion.AddOccluder(occluder.positions.data(), uint32_t(occluder.positions.size() / 3), occluder.indices.data(),
+            occluder.indices.size(), &modelToClip._11, culling);
+    }
 
-    modelSkull1->UpdateEffects([&](IEffect* effect)
+    if (!occluderCount)
+        return;
+
+    m_occlusion.Render([this](size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)
+    {
+        m_jobs->ParallelFor(count, grain, body);
+    });
+
+    // Boxes in model units, as the occluders; each occluder is in front of its own box's
+    // nearest point, so it never hides itself
+    m_occlusionResults.resize(visible.size());
+    m_jobs->ParallelFor(visible.size(), 64, [&](size_t begin, size_t end)
     {
-        auto lights = dynamic_cast<IEffectLights*>(effect);
-        if (lights)
+        for (size_t i = begin; i < end; ++i)
         {
-            XMVECTOR dir = XMVector3Rotate(g_XMOne, q);
-            lights->SetLightDirection(0, dir / 2.f);
-            lights->SetAmbientLightColor(Colors::DarkGreen);
+            const auto& instance = m_sceneMeshes[visible[i]];
+            const auto& box = GetSceneModel(instance.node).meshes[instance.mesh]->boundingBox;
+            const float boxMin[3] = { box.Center.x - box.Extents.x, box.Center.y - box.Extents.y, box.Center.z - box.Extents.z };
+            const float boxMax[3] = { box.Center.x + box.Extents.x, box.Center.y + box.Extents.y, box.Center.z + box.Extents.z };
+
+            XMFLOAT4X4 modelToClip;
+            XMStoreFloat4x4(&modelToClip, m_scene->GetWorld(instance.node) * viewProj);
+            m_occlusionResults[i] = m_occlusion.IsVisible(boxMin, boxMax, &modelToClip._11) ? 1 : 0;
         }
     });
 
-    m_world *= Matrix::CreateTranslation(5.0f, 2.0f, -5.0f);
-    m_world *= Matrix::CreateRotationY(rotationFactor * radiansFactor);
-    modelSkull2->Draw(m_deviceResources->GetD3DDeviceContext(), *m_States, m_world, m_view, m_proj);
-    m_world = Matrix::Identity;
+    m_sceneVisible.clear();
+    for (size_t i = 0; i < visible.size(); ++i)
+    {
+        if (m_occlusionResults[i])
+        {
+            m_sceneVisible.push_back(visible[i]);
+        }
+    }
+    m_occlusionStats.meshesTested += visible.size();
+    m_occlusionStats.meshesOccluded += visible.size() - m_sceneVisible.size();
 }
 
-void Game::RenderBodys()
+void Game::QueueVisibleMeshes()
 {
-    Quaternion q = Quaternion::CreateFromYawPitchRoll(lightRotationFactor, 0, 0.f);
-
-    modelBody1->UpdateEffects([&](IEffect* effect)
+    DX_PROFILE_SCOPE("QueueVisibleMeshes");
+
+    // Visible meshes come back in submission order, and occlusion keeps it, so each node's
+    // meshes are contiguous.
+    // Their parts go into one frame-wide queue sorted by state and depth; instanced nodes
+    // are batched separately and drawn between the opaque and transparent passes. Each mesh
+    // draws the coarsest level of detail its projected size allows; at full detail, only the
+    // clusters that are in view and face the camera.
+    m_renderQueue.Begin(m_view);
+    m_instancedRenderer->Begin();
+    m_clusterCuller->Begin(m_view, m_proj);
+
+    const auto output = m_deviceResources->GetOutputSize();
+    const float pixelsPerUnit = m_proj._22 * 0.5f * float(output.bottom - output.top);
+
+    const auto& visible = m_sceneVisible;
+    for (size_t first = 0; first < visible.size(); )
     {
-        auto lights = dynamic_cast<IEffectLights*>(effect);
-        if (lights)
+        auto node = m_sceneMeshes[visible[first]].node;
+        size_t last = first + 1;
+        while (last < visible.size() && m_sceneMeshes[visible[last]].node == node)
         {
-            XMVECTOR dir = XMVector3Rotate(g_XMOne, q);
-            lights->SetLightEnabled(0, true);
-            lights->SetLightEnabled(1, false);
-            lights->SetLightDirection(0, dir / -2.f);
-            lights->SetAmbientLightColor(Colors::Gray);
-            lights->SetLightDiffuseColor(0, Colors::Green);
+            ++last;
         }
-        auto fog = dynamic_cast<IEffectFog*>(effect);
-        if (fog)
+
+        XMMATRIX world = m_scene->GetWorld(node);
+        DemandSceneTextures(node, first, last, world);
+
+        // Instances share their asset's meshes, so its levels fit either kind of node
+        const auto& lods = m_sceneAssets[node]->lods;
+        auto getLods = [&](uint32_t mesh) { return (mesh < lods.size()) ? &lods[mesh] : nullptr; };
+
+        if (m_scene->IsInstanced(node))
         {
-            fog->SetFogEnabled(true);
-            fog->SetFogStart(5); // assuming RH coordiantes
-            fog->SetFogEnd(12);
-            fog->SetFogColor(Colors::Blue);
+            const auto& model = *m_sceneAssets[node]->prototype;
+            for (size_t i = first; i < last; ++i)
+            {
+                const uint32_t mesh = m_sceneMeshes[visible[i]].mesh;
+                const uint32_t lod = SelectSceneLod(visible[i], *model.meshes[mesh], getLods(mesh), world, pixelsPerUnit);
+                m_instancedRenderer->Add(m_sceneAssets[node], mesh, world, m_scene->GetColor(node), lod);
+            }
+
+            first = last;
+            continue;
         }
-    });
 
-    m_world *= Matrix::CreateScale(0.01f);
-    m_world *= Matrix::CreateTranslation(-5.0f, -5.5f, 1.0f);
-    m_world *= Matrix::CreateRotationY(45.f * radiansFactor);
-    modelBody1->Draw(m_deviceResources->GetD3DDeviceContext(), *m_States, m_world, m_view, m_proj);
-    m_world = Matrix::Identity;
+        auto& model = *m_sceneModels[node];
+        const auto& clusters = m_sceneAssets[node]->clusters;
 
-    modelBody2->UpdateEffects([&](IEffect* effect)
-    {
-        auto lights = dynamic_cast<IEffectLights*>(effect);
-        if (lights)
+        auto style = m_scene->GetStyle(node);
+        ApplySceneStyle((style != DX::SceneGraph::c_None) ? m_sceneStyles[style] : SceneStyle::None, model);
+
+        for (size_t i = first; i < last; ++i)
         {
-            XMVECTOR dir = XMVector3Rotate(g_XMOne, q);
-            lights->SetAmbientLightColor(Colors::Gray);
-            lights->SetLightEnabled(0, true);
-            lights->SetLightEnabled(1, true);
-            lights->SetLightDirection(1, dir / 2.f);
-            lights->SetLightDirection(0, dir / -2.f);
-            lights->SetLightDiffuseColor(0, Colors::Red);
-            lights->SetLightDiffuseColor(1, Colors::Yellow);
+            const uint32_t mesh = m_sceneMeshes[visible[i]].mesh;
+            const auto meshLods = getLods(mesh);
+            const uint32_t lod = SelectSceneLod(visible[i], *model.meshes[mesh], meshLods, world, pixelsPerUnit);
+
+            const DX::ModelPartLod* parts = lod ? meshLods->GetParts(lod) : nullptr;
+            if (!lod && m_cullClusters && mesh < clusters.size() && !clusters[mesh].parts.empty())
+            {
+                parts = m_clusterCuller->Cull(*model.meshes[mesh], clusters[mesh], world);
+                if (!parts)
+                    continue;
+            }
+            m_renderQueue.Add(*model.meshes[mesh], world, parts, &m_sceneAssets[node]->positionTransforms[mesh]);
         }
-        auto fog = dynamic_cast<IEffectFog*>(effect);
-        if (fog)
+
+        first = last;
+    }
+}
+
+// Reports how many pixels across the node's visible meshes [first, last) are drawn to the
+// textures it samples, from the projected size of each mesh's bounding sphere.
+void XM_CALLCONV Game::DemandSceneTextures(DX::SceneGraph::NodeId node, size_t first, size_t last, FXMMATRIX world)
+{
+    const auto& textures = m_sceneTextures[node];
+    if (textures.empty())
+        return;
+
+    const auto output = m_deviceResources->GetOutputSize();
+    const float pixelsPerUnit = m_proj._22 * 0.5f * float(output.bottom - output.top);
+
+    const auto& visible = m_sceneVisible;
+    const auto& model = GetSceneModel(node);
+
+    float pixels = 0;
+    for (size_t i = first; i < last; ++i)
+    {
+        pixels = std::max(pixels, 2.f * GetProjectedRadius(*model.meshes[m_sceneMeshes[visible[i]].mesh], world, pixelsPerUnit));
+    }
+
+    for (const auto& texture : textures)
+    {
+        m_textureStreamer->Demand(*texture, pixels);
+    }
+}
+
+// Picks the level of detail for the scene mesh 'entry' (an index into m_sceneMeshes) from its
+// projected size and the level it drew last frame, and counts what it saves.
+uint32_t XM_CALLCONV Game::SelectSceneLod(uint32_t entry, const ModelMesh& mesh, const DX::ModelMeshLods* lods,
+    FXMMATRIX world, float pixelsPerUnit)
+{
+    uint32_t fullIndices = 0;
+    for (const auto& part : mesh.meshParts)
+    {
+        fullIndices += part->indexCount;
+    }
+
+    uint32_t lod = 0;
+    uint32_t indices = fullIndices;
+    if (lods && lods->GetCount())
+    {
+        lod = DX::SelectModelLod(lods->errors.data(), lods->GetCount(), GetProjectedRadius(mesh, world, pixelsPerUnit),
+            m_sceneMeshLods[entry]);
+        if (lod)
         {
-            fog->SetFogEnabled(true);
-            fog->SetFogStart(5); // assuming RH coordiantes
-            fog->SetFogEnd(12);
-            fog->SetFogColor(Colors::Yellow);
+            indices = 0;
+            const DX::ModelPartLod* parts = lods->GetParts(lod);
+            for (uint32_t i = 0; i < lods->partCount; ++i)
+            {
+                indices += parts[i].indexCount;
+            }
         }
-    });
+    }
+    m_sceneMeshLods[entry] = uint8_t(lod);
 
-    m_world *= Matrix::CreateScale(0.01f);
-    m_world *= Matrix::CreateRotationY(45.f * radiansFactor);
-    m_world *= Matrix::CreateTranslation(-2.0f, -5.5f, 1.0f);
-    m_world *= Matrix::CreateRotationY(135.f * radiansFactor);
-    modelBody2->Draw(m_deviceResources->GetD3DDeviceContext(), *m_States, m_world, m_view, m_proj);
-    m_world = Matrix::Identity;
+    ++m_lodStats.meshes[lod];
+    m_lodStats.triangles += indices / 3;
+    m_lodStats.fullTriangles += fullIndices / 3;
+    return lod;
+}
+
+// The radius in pixels of a mesh's bounding sphere at a world transform, or half the screen's
+// height once the camera is inside it. 'pixelsPerUnit' is _22 times half the height, as
+// clip space spans two units from the bottom of the screen to the top.
+float XM_CALLCONV Game::GetProjectedRadius(const ModelMesh& mesh, FXMMATRIX world, float pixelsPerUnit) const
+{
+    BoundingSphere sphere;
+    mesh.boundingSphere.Transform(sphere, world);
 
-    modelBody3->UpdateEffects([&](IEffect* effect)
+    const float depth = -XMVectorGetZ(XMVector3TransformCoord(XMLoadFloat3(&sphere.Center), m_view));
+    return sphere.Radius * pixelsPerUnit / std::max(depth, sphere.Radius);
+}
+
+// Draws what PrepareScene queued; only the D3D work is left for the main thread.
+void Game::RenderScene()
+{
+    DX_PROFILE_SCOPE("RenderScene");
+
+    auto context = m_deviceResources->GetD3DDeviceContext();
+
+    // The opaque pass draws the clusters' indices from the buffers this fills
+    m_clusterCuller->End(context);
+    m_renderQueue.Draw(context, *m_States, m_view, m_proj, DX::RenderQueue::Pass_Opaque);
+
+    Quaternion q = Quaternion::CreateFromYawPitchRoll(lightRotationFactor, 0, 0.f);
+    m_instancedRenderer->End(context, *m_States, m_view, m_proj,
+        XMVector3Rotate(g_XMNegativeOne, q), Colors::White);
+
+    m_renderQueue.Draw(context, *m_States, m_view, m_proj, DX::RenderQueue::Pass_Transparent);
+}
+
+// Nodes whose model is still streaming have no meshes yet
+const Model& Game::GetSceneModel(DX::SceneGraph::NodeId node) const
+{
+    if (m_scene->IsInstanced(node))
+        return m_sceneAssets[node] ? *m_sceneAssets[node]->prototype : m_emptyModel;
+
+    return m_sceneModels[node] ? *m_sceneModels[node] : m_emptyModel;
+}
+
+// Lighting presets referenced by name from the scene file. Every node has its own effects,
+// but the presets follow the camera and the light animation so they are reapplied each draw.
+void Game::ApplySceneStyle(SceneStyle style, Model& model)
+{
+    switch (style)
     {
-        auto lights = dynamic_cast<IEffectLights*>(effect);
-        if (lights)
+    case SceneStyle::Ship:
+    {
+        Quaternion q = Quaternion::CreateFromYawPitchRoll(lightRotationFactor, 3.f, 0.f);
+        model.UpdateEffects([&](IEffect* effect)
         {
-            XMVECTOR dir = XMVector3Rotate(g_XMOne, q);
-            lights->SetAmbientLightColor(Colors::Gray);
-            lights->SetLightEnabled(0, false);
-            lights->SetLightEnabled(1, false);
-        }
-        auto fog = dynamic_cast<IEffectFog*>(effect);
-        if (fog)
+            auto lights = dynamic_cast<IEffectLights*>(effect);
+            if (lights)
+            {
+                lights->SetLightEnabled(0, true);
+                XMVECTOR dir = XMVector3Rotate(g_XMOne, q);
+                lights->SetLightDirection(0, dir);
+                lights->SetAmbientLightColor(Colors::Blue);
+                lights->SetLightDiffuseColor(0, Colors::LightBlue);
+            }
+        });
+        break;
+    }
+
+    case SceneStyle::SkullGold:
+    case SceneStyle::SkullGreen:
+    {
+        Quaternion q = Quaternion::CreateFromYawPitchRoll(m_yaw, m_pitch, 0.f);
+        XMVECTOR ambient = (style == SceneStyle::SkullGold) ? Colors::DarkGoldenrod : Colors::DarkGreen;
+        model.UpdateEffects([&](IEffect* effect)
         {
-            fog->SetFogEnabled(true);
-            fog->SetFogStart(5); // assuming RH coordiantes
-            fog->SetFogEnd(12);
-            fog->SetFogColor(Colors::Yellow);
-        }
-    });
+            auto lights = dynamic_cast<IEffectLights*>(effect);
+            if (lights)
+            {
+                XMVECTOR dir = XMVector3Rotate(g_XMOne, q);
+                lights->SetLightDirection(0, dir / 2.f);
+                lights->SetAmbientLightColor(ambient);
+            }
+        });
+        break;
+    }
 
-    m_world *= Matrix::CreateScale(0.01f);
-    m_world *= Matrix::CreateRotationY(45.f * radiansFactor);
-    m_world *= Matrix::CreateTranslation(-6.5f, -5.5f, 1.0f);
-    m_world *= Matrix::CreateRotationY(90.f * radiansFactor);
-    modelBody3->Draw(m_deviceResources->GetD3DDeviceContext(), *m_States, m_world, m_view, m_proj);
-    m_world = Matrix::Identity;
+    case SceneStyle::BodyGreen:
+    case SceneStyle::BodyRedYellow:
+    case SceneStyle::BodyAmbient:
+    {
+        Quaternion q = Quaternion::CreateFromYawPitchRoll(lightRotationFactor, 0, 0.f);
+        model.UpdateEffects([&](IEffect* effect)
+        {
+            auto lights = dynamic_cast<IEffectLights*>(effect);
+            if (lights)
+            {
+                XMVECTOR dir = XMVector3Rotate(g_XMOne, q);
+                lights->SetAmbientLightColor(Colors::Gray);
+                if (style == SceneStyle::BodyGreen)
+                {
+                    lights->SetLightEnabled(0, true);
+                    lights->SetLightEnabled(1, false);
+                    lights->SetLightDirection(0, dir / -2.f);
+                    lights->SetLightDiffuseColor(0, Colors::Green);
+                }
+                else if (style == SceneStyle::BodyRedYellow)
+                {
+                    lights->SetLightEnabled(0, true);
+                    lights->SetLightEnabled(1, true);
+                    lights->SetLightDirection(1, dir / 2.f);
+                    lights->SetLightDirection(0, dir / -2.f);
+                    lights->SetLightDiffuseColor(0, Colors::Red);
+                    lights->SetLightDiffuseColor(1, Colors::Yellow);
+                }
+                else
+                {
+                    lights->SetLightEnabled(0, false);
+                    lights->SetLightEnabled(1, false);
+                }
+            }
+            auto fog = dynamic_cast<IEffectFog*>(effect);
+            if (fog)
+            {
+                fog->SetFogEnabled(true);
+                fog->SetFogStart(5); // assuming RH coordiantes
+                fog->SetFogEnd(12);
+                fog->SetFogColor((style == SceneStyle::BodyGreen) ? Colors::Blue : Colors::Yellow);
+            }
+        });
+        break;
+    }
+
+    default:
+        break;
+    }
 }
 
 void Game::RenderRoom()
 {
-    primitiveCube->Draw(Matrix::Identity, m_view, m_proj, Colors::White, room_texture.Get());
+    DX_PROFILE_SCOPE("RenderRoom");
+
+    primitiveCube->Draw(Matrix::Identity, m_view, m_proj, Colors::White, room_texture->Get());
 }
 
 void Game::RenderAimReticle() {
+    DX_PROFILE_SCOPE("RenderAimReticle");
+
     auto context = m_deviceResources->GetD3DDeviceContext();
 
     // Render polygon for aim reticle
@@ -629,6 +1058,8 @@ void Game::RenderAimReticle() {
 
 void Game::PostProcess()
 {
+    DX_PROFILE_SCOPE("PostProcess");
+
     auto device = m_deviceResources->GetD3DDevice();
     auto deviceContext = m_deviceResources->GetD3DDeviceContext();
 
@@ -697,6 +1128,8 @@ void Game::PostProcess()
 // Helper method to clear the back buffers.
 void Game::Clear()
 {
+    DX_PROFILE_SCOPE("Clear");
+
     m_deviceResources->PIXBeginEvent(L"Clear");
 
     // Clear the views.
@@ -714,23 +1147,12 @@ void Game::Clear()
 
     m_deviceResources->PIXEndEvent();
 }
+// Textures stream in behind a white placeholder; the background covers the screen, so it goes first.
 void Game::LoadTextures()
 {
-    auto device = m_deviceResources->GetD3DDevice();
-
-    DX::ThrowIfFailed(
-        CreateWICTextureFromFile(device,
-        L"Textures/sunset.jpg", nullptr,
-        m_background.ReleaseAndGetAddressOf()));
-
-    DX::ThrowIfFailed(
-        CreateDDSTextureFromFile(device, L"Textures/roomtexture.dds", nullptr,
-            room_texture.ReleaseAndGetAddressOf()));
-
-    DX::ThrowIfFailed(
-        CreateWICTextureFromFile(device, L"Textures/earth.bmp", nullptr,
-            ring_texture.ReleaseAndGetAddressOf()));
-
+    m_background = m_streamer->RequestTexture(L"Textures/sunset.jpg", DX::AssetStreamer::Priority_High);
+    room_texture = m_streamer->RequestTexture(L"Textures/roomtexture.dds", DX::AssetStreamer::Priority_High);
+    ring_texture = m_streamer->RequestTexture(L"Textures/earth.bmp");
 }
 #pragma endregion
 
@@ -748,13 +1170,19 @@ void Game::OnDeactivated()
 
 void Game::OnSuspending()
 {
-    m_audEngine->Suspend();
+    if (m_audEngine)
+    {
+        m_audEngine->Suspend();
+    }
     // TODO: Game is being power-suspended (or minimized).
 }
 
 void Game::OnResuming()
 {
-    m_audEngine->Resume();
+    if (m_audEngine)
+    {
+        m_audEngine->Resume();
+    }
     m_timer.ResetElapsedTime();
 
     // TODO: Game is being power-resumed (or returning from minimize).
@@ -822,11 +1250,16 @@ void Game::CreateDeviceDependentResources()
 
     // TODO:(CreateDevice)
     // Initialize device dependent objects here (independent of window size).x     
-    LoadTextures();
     ReadShaders();
 
     CreateEffects();
     Create3DModels();
+    LoadTextures();
+
+    if (!m_streamAssets)
+    {
+        FinishStreaming();
+    }
 
     AimReticleCreateBatch();
     
@@ -838,15 +1271,15 @@ void Game::ReadShaders() {
     auto device = m_deviceResources->GetD3DDevice();
 
     // Extract the shader files
-    auto blob = DX::ReadData(L"BloomExtract.cso");
+    auto blob = DX::ReadContent(m_pack.get(), L"BloomExtract.cso");
     DX::ThrowIfFailed(device->CreatePixelShader(blob.data(), blob.size(),
         nullptr, m_bloomExtractPS.ReleaseAndGetAddressOf()));
 
-    blob = DX::ReadData(L"BloomCombine.cso");
+    blob = DX::ReadContent(m_pack.get(), L"BloomCombine.cso");
     DX::ThrowIfFailed(device->CreatePixelShader(blob.data(), blob.size(),
         nullptr, m_bloomCombinePS.ReleaseAndGetAddressOf()));
 
-    blob = DX::ReadData(L"GaussianBlur.cso");
+    blob = DX::ReadContent(m_pack.get(), L"GaussianBlur.cso");
     DX::ThrowIfFailed(device->CreatePixelShader(blob.data(), blob.size(),
         nullptr, m_gaussianBlurPS.ReleaseAndGetAddressOf()));
 
@@ -879,8 +1312,12 @@ void Game::CreateEffects()
     m_ReticleEffect->SetVertexColorEnabled(true);
 
 
-    m_fxFactory1 = std::make_unique<EffectFactory>(device);
-    m_fxFactory2 = std::make_unique<EffectFactory>(device);
+    // Every loader shares textures and effects through the registry
+    m_registry = std::make_unique<DX::ResourceRegistry>();
+
+    // Model materials take their textures from the streamer, starting at their smallest mips
+    m_textureStreamer = std::make_unique<DX::TextureStreamer>(device, *m_jobs, *m_registry, m_pack.get(), m_textureBudget);
+    m_fxFactory1 = std::make_unique<DX::TextureStreamer::EffectFactory>(device, *m_textureStreamer);
 
     m_world = Matrix::Identity;
 }
@@ -974,23 +1411,153 @@ void Game::Create3DModels() {
         XMFLOAT3(ROOM_BOUNDS[0], ROOM_BOUNDS[1], ROOM_BOUNDS[2]),
         false, true);
 
-    modelBody1 = Model::CreateFromSDKMESH(device, L"Mesh/body.sdkmesh", *m_fxFactory1);
-    modelBody2 = Model::CreateFromSDKMESH(device, L"Mesh/body.sdkmesh", *m_fxFactory1);
-    modelBody3 = Model::CreateFromSDKMESH(device, L"Mesh/body.sdkmesh", *m_fxFactory1);
-    modelSkull1 = Model::CreateFromSDKMESH(device, L"Mesh/skull.sdkmesh", *m_fxFactory2);
-    modelSkull2 = Model::CreateFromSDKMESH(device, L"Mesh/skull.sdkmesh", *m_fxFactory2);
-    modelShip = Model::CreateFromSDKMESH(device, L"Mesh/spaceship.sdkmesh", *m_fxFactory2);
+    // Every renderable node gets its own instance; geometry is loaded once per file.
+    // Instanced nodes draw the shared prototype directly.
+    m_modelCache = std::make_unique<DX::ModelCache>(device, *m_fxFactory1, m_mapModels, m_pack.get(), m_packParallelFor);
+    m_streamer = std::make_unique<DX::AssetStreamer>(device, *m_modelCache, *m_jobs, *m_registry, m_pack.get());
+    m_instancedRenderer = std::make_unique<DX::InstancedRenderer>(device, *m_fxFactory1, m_pack.get(), m_textureStreamer.get());
+    m_clusterCuller = std::make_unique<DX::ClusterCuller>(device);
+
+    // Before any model is read, so the materials that can move onto an atlas do, and their
+    // effects take the page from the streamer under the atlas's name
+    m_atlases.clear();
+    for (const auto& fileName : m_scene->GetAtlasFiles())
+    {
+        auto atlas = std::make_unique<DX::TextureAtlas>(device, context, m_pack.get(), fileName.c_str());
+        m_modelCache->AddAtlas(atlas->GetLayout());
+        m_textureStreamer->Register(fileName.c_str(), atlas->Get(), atlas->GetResidentBytes());
+        m_atlases.push_back(std::move(atlas));
+    }
+
+    // Files stream in on the I/O threads and job system; a node draws nothing until its
+    // model is resident (see ResolveSceneModels).
+    m_sceneModelHandles.clear();
+    m_sceneModelHandles.resize(m_scene->GetModelCount());
+    for (auto node : m_scene->GetRenderables())
+    {
+        auto model = m_scene->GetModel(node);
+        if (!m_sceneModelHandles[model])
+        {
+            m_sceneModelHandles[model] = m_streamer->RequestModel(m_scene->GetModelFile(model).c_str());
+        }
+    }
+
+    m_sceneModels.clear();
+    m_sceneModels.resize(m_scene->GetNodeCount());
+    m_sceneAssets.clear();
+    m_sceneAssets.resize(m_scene->GetNodeCount());
+    m_sceneTextures.clear();
+    m_sceneTextures.resize(m_scene->GetNodeCount());
+    m_unresolvedNodes = m_scene->GetRenderables();
+}
+
+// Uploads what finished streaming, then gives each waiting node the shared asset (and its own
+// instance, unless instanced) once its model is resident, and notes the streamed textures it
+// samples. Last, texture mips stream in or out for the demand the previous frame reported.
+// Runs before the frame's jobs, which read the scene models.
+void Game::ResolveSceneModels()
+{
+    m_streamer->Update();
+
+    auto resolved = std::remove_if(m_unresolvedNodes.begin(), m_unresolvedNodes.end(), [&](DX::SceneGraph::NodeId node)
+    {
+        auto model = m_scene->GetModel(node);
+        if (!m_sceneModelHandles[model]->IsReady())
+            return false;
+
+        m_sceneAssets[node] = m_sceneModelHandles[model]->GetAsset();
+        if (!m_scene->IsInstanced(node))
+        {
+            m_sceneModels[node] = m_modelCache->CreateInstance(m_scene->GetModelFile(model).c_str());
+        }
+
+        auto& textures = m_sceneTextures[node];
+        for (const auto& mesh : GetSceneModel(node).meshes)
+        {
+            for (const auto& part : mesh->meshParts)
+            {
+                m_textureStreamer->GetTextures(part->effect.get(), textures);
+            }
+        }
+        std::sort(textures.begin(), textures.end());
+        textures.erase(std::unique(textures.begin(), textures.end()), textures.end());
+        return true;
+    });
+    m_unresolvedNodes.erase(resolved, m_unresolvedNodes.end());
+
+    m_textureStreamer->Update(m_deviceResources->GetD3DDeviceContext());
+}
+
+void Game::FinishStreaming()
+{
+    m_streamer->Flush();
+    ResolveSceneModels();
+    m_textureStreamer->Flush(m_deviceResources->GetD3DDeviceContext());
+}
+
+void Game::LoadScene()
+{
+    auto packed = m_pack ? m_pack->Find(m_sceneFile.c_str()) : nullptr;
+    if (packed)
+    {
+        auto text = m_pack->Read(*packed);
+        std::istringstream stream(std::string(text.cbegin(), text.cend()));
+        m_scene = DX::SceneGraph::Load(stream);
+    }
+    else
+    {
+        m_scene = DX::SceneGraph::LoadFromFile(m_sceneFile.c_str());
+    }
+
+    // Without instancing every node draws its own copy, as a baseline to compare against
+    if (!m_instanceModels)
+    {
+        for (DX::SceneGraph::NodeId node = 0; node < m_scene->GetNodeCount(); ++node)
+        {
+            m_scene->SetInstanced(node, false);
+        }
+    }
+
+    static const struct { const char* name; SceneStyle style; } s_styles[] =
+    {
+        { "bodyGreen",      SceneStyle::BodyGreen },
+        { "bodyRedYellow",  SceneStyle::BodyRedYellow },
+        { "bodyAmbient",    SceneStyle::BodyAmbient },
+        { "skullGold",      SceneStyle::SkullGold },
+        { "skullGreen",     SceneStyle::SkullGreen },
+        { "ship",           SceneStyle::Ship },
+    };
+
+    m_sceneStyles.clear();
+    for (uint32_t i = 0; i < m_scene->GetStyleCount(); ++i)
+    {
+        auto& name = m_scene->GetStyleName(i);
+        auto it = std::find_if(std::begin(s_styles), std::end(s_styles),
+            [&](auto& entry) { return name == entry.name; });
+        if (it == std::end(s_styles))
+        {
+            throw std::runtime_error("Unknown scene style '" + name + "'");
+        }
+        m_sceneStyles.push_back(it->style);
+    }
 }
 
 void Game::OnDeviceLost()
 {
     // TODO: Add Direct3D resource cleanup here.
-    modelBody1.reset();
-    modelBody2.reset();
-    modelBody3.reset();
-    modelSkull1.reset();
-    modelSkull2.reset();
-    modelShip.reset();
+    m_sceneModels.clear();
+    m_sceneAssets.clear();
+    m_sceneTextures.clear();
+    m_sceneModelHandles.clear();
+    m_unresolvedNodes.clear();
+    m_instancedRenderer.reset();
+    m_clusterCuller.reset();
+    m_streamer.reset();
+    m_modelCache.reset();
+    m_fxFactory1.reset();
+    m_textureStreamer.reset();
+    m_atlases.clear();
+    m_registry.reset();
 
     m_inputLayout.Reset();
     
@@ -1013,11 +1580,12 @@ void Game::OnDeviceLost()
 
     m_States.reset();
     m_spriteBatch.reset();
-    m_background.Reset();
+    m_background.reset();
 
     primitiveShape.reset();
     primitiveCube.reset();
-    room_texture.Reset();
+    room_texture.reset();
+    ring_texture.reset();
     body_colour_texture.Reset();
     body_normal_texture.Reset();
     body_emissive_texture.Reset();
@@ -4,8 +4,23 @@
 
 #pragma once
 
+#include "AssetStreamer.h"
+#include "ClusterCuller.h"
 #include "DeviceResources.h"
+#include "FrustumCuller.h"
+#include "InstancedRenderer.h"
+#include "JobSystem.h"
+#include "ModelCache.h"
+#include "ModelLod.h"
+#include "OcclusionBuffer.h"
+#include "PackFile.h"
+#include "Profiler.h"
+#include "RenderQueue.h"
+#include "ResourceRegistry.h"
+#include "SceneGraph.h"
 #include "StepTimer.h"
+#include "TextureAtlas.h"
+#include "TextureStreamer.h"
 
 #include <CommonStates.h>
 #include <PrimitiveBatch.h>
@@ -29,6 +44,22 @@ using namespace DirectX;
 using namespace DirectX::SimpleMath;
 
 
+// How a Game is set up; the defaults are the windowed game's.
+struct GameOptions
+{
+    bool headless = false;                          // null device recording every call
+    std::wstring sceneFile = L"Scenes/default.scene";
+    bool filterState = true;                        // drop redundant state bindings
+    int workerCount = -1;                           // job system workers; -1 for one per spare hardware thread
+    bool mapModels = true;                          // parse models from mapped views rather than heap copies
+    bool streamAssets = true;                       // load behind placeholders rather than before the first frame
+    std::wstring packFile = L"Content.pak";         // used when it exists (see Tools/AssetPacker); empty loads loose files
+    size_t textureBudget = DX::TextureStreamer::c_DefaultBudget;   // bytes of resident model texture mips
+    bool cullClusters = true;                       // cull the clusters of meshes drawn at full detail
+    bool cullOccluded = true;                       // skip meshes hidden behind the largest ones on screen
+    bool instanceModels = true;                     // draw "instanced" scene nodes through InstancedRenderer
+};
+
 // A basic game implementation that creates a D3D11 device and
 // provides a game loop.
 class Game final : public DX::IDeviceNotify
@@ -37,13 +68,14 @@ public:
     std::unique_ptr<DirectX::Keyboard> m_keyboard;
     std::unique_ptr<DirectX::Mouse> m_mouse;
 
-    Game() noexcept(false);
+    explicit Game(GameOptions const& options = GameOptions()) noexcept(false);
     ~Game();
 
     void InitializeSounds();
 
     // Initialization and management
     void Initialize(HWND window, int width, int height);
+    void InitializeHeadless(int width, int height);
 
     // Basic game loop
     void Tick();
@@ -62,10 +94,49 @@ public:
 
     // Properties
     void GetDefaultSize(int& width, int& height) const;
+    DX::RecordingDeviceContext* GetRecorder() const { return m_deviceResources->GetRecorder(); }
+    DX::StateFilteringDeviceContext* GetStateFilter() const { return m_deviceResources->GetStateFilter(); }
+    DX::JobSystem* GetJobSystem() const { return m_jobs.get(); }
+    const DX::ModelCache* GetModelCache() const { return m_modelCache.get(); }
+    const DX::AssetStreamer* GetAssetStreamer() const { return m_streamer.get(); }
+    const DX::TextureStreamer* GetTextureStreamer() const { return m_textureStreamer.get(); }
+    const DX::ResourceRegistry* GetResourceRegistry() const { return m_registry.get(); }
+    DX::ClusterCuller* GetClusterCuller() const { return m_clusterCuller.get(); }
+    DX::OcclusionBuffer* GetOcclusionBuffer() { return &m_occlusion; }
+    const DX::PackFile* GetPack() const { return m_pack.get(); }
+
+    // Blocks until every requested texture and model is resident, and every texture mip read
+    // in flight is uploaded.
+    void FinishStreaming();
+
+    // Scene meshes queued at each level of detail, and the triangles they drew against those
+    // the same meshes have at full detail, since the last reset.
+    struct LodStatistics
+    {
+        uint64_t meshes[DX::c_MaxModelLods + 1];
+        uint64_t triangles;
+        uint64_t fullTriangles;
+    };
+
+    const LodStatistics& GetLodStatistics() const { return m_lodStats; }
+    void ResetLodStatistics() { m_lodStats = {}; }
+
+    // Scene meshes left by the frustum that were tested against the occlusion buffer, and
+    // those it hid, since the last reset.
+    struct OcclusionStatistics
+    {
+        uint64_t meshesTested;
+        uint64_t meshesOccluded;
+    };
+
+    const OcclusionStatistics& GetOcclusionStatistics() const { return m_occlusionStats; }
+    void ResetOcclusionStatistics() { m_occlusionStats = {}; }
 
     void AimReticleCreateBatch();
 
 private:
+    void InitializeDevice();
+
     void TakeInput();
     void CalculateAudioProperties();
     void Update(DX::StepTimer const& timer);
@@ -81,10 +152,16 @@ private:
     void PostProcess();
     void RenderSpriteBatch();
     void RenderShape();
-    void RenderShip();
-    void RenderSkulls();
+    void RenderScene();
+    DX::JobSystem::Handle PrepareScene();
+    void GatherSceneBounds();
+    void OccludeSceneMeshes();
+    void QueueVisibleMeshes();
+    void XM_CALLCONV DemandSceneTextures(DX::SceneGraph::NodeId node, size_t first, size_t last, FXMMATRIX world);
+    uint32_t XM_CALLCONV SelectSceneLod(uint32_t entry, const DirectX::ModelMesh& mesh, _In_opt_ const DX::ModelMeshLods* lods,
+        FXMMATRIX world, float pixelsPerUnit);
+    float XM_CALLCONV GetProjectedRadius(const DirectX::ModelMesh& mesh, FXMMATRIX world, float pixelsPerUnit) const;
     void RenderRoom();
-    void RenderBodys();
     void RenderAimReticle();
 
     void Clear();
@@ -96,8 +173,22 @@ private:
     void ReadShaders();
     void CreateWindowSizeDependentResources();
     void Create3DModels();
+    void ResolveSceneModels();
+    void LoadScene();
     void CreateBlurParameters(float width, float height);
     void CreateRenderParameters(float width, float height);
+    // Frame jobs. Update schedules input, audio, animation and the scene graph; Render waits
+    // for the parts it needs and schedules the scene preparation on top of them.
+    std::unique_ptr<DX::JobSystem>          m_jobs;
+    DX::JobSystem::Handle                   m_inputJob;
+    DX::JobSystem::Handle                   m_animationJob;
+    DX::JobSystem::Handle                   m_sceneJob;
+    DX::JobSystem::Handle                   m_updateJob;
+
+    // Cooked content, if any; outlives everything that loads from it
+    std::unique_ptr<DX::PackFile>           m_pack;
+    DX::PackFile::ParallelFor               m_packParallelFor;
+
     // Device resources.
     std::unique_ptr<DX::DeviceResources>    m_deviceResources;
 
@@ -112,7 +203,6 @@ private:
     
 
     std::unique_ptr<DirectX::IEffectFactory> m_fxFactory1;
-    std::unique_ptr<DirectX::IEffectFactory> m_fxFactory2;
     std::unique_ptr<DirectX::BasicEffect> m_ReticleEffect;
 
     std::unique_ptr<PrimitiveBatch<VertexPositionColor>> m_batch;
@@ -150,13 +240,69 @@ private:
     Microsoft::WRL::ComPtr<ID3D11Buffer> m_blurParamsWidth;
     Microsoft::WRL::ComPtr<ID3D11Buffer> m_blurParamsHeight;
 
-    // Models
-    std::unique_ptr<DirectX::Model> modelBody1;
-    std::unique_ptr<DirectX::Model> modelBody2;
-    std::unique_ptr<DirectX::Model> modelBody3;
-    std::unique_ptr<DirectX::Model> modelSkull1;
-    std::unique_ptr<DirectX::Model> modelSkull2;
-    std::unique_ptr<DirectX::Model> modelShip;
+    // Scene
+    enum class SceneStyle
+    {
+        None,
+        BodyGreen,
+        BodyRedYellow,
+        BodyAmbient,
+        SkullGold,
+        SkullGreen,
+        Ship,
+    };
+
+    void ApplySceneStyle(SceneStyle style, DirectX::Model& model);
+    const DirectX::Model& GetSceneModel(DX::SceneGraph::NodeId node) const;
+
+    std::wstring m_sceneFile;
+    std::unique_ptr<DX::SceneGraph> m_scene;
+    std::vector<SceneStyle> m_sceneStyles;                      // indexed by scene style id
+    std::unique_ptr<DX::ModelCache> m_modelCache;
+    bool m_mapModels;
+    bool m_streamAssets;
+    std::unique_ptr<DX::AssetStreamer> m_streamer;
+    size_t m_textureBudget;
+    std::unique_ptr<DX::ResourceRegistry> m_registry;          // textures and effects, shared by every loader
+    std::unique_ptr<DX::TextureStreamer> m_textureStreamer;    // model textures, by mip
+    std::vector<std::unique_ptr<DX::TextureAtlas>> m_atlases;   // the scene's, which its models' materials may draw from
+    std::vector<DX::AssetStreamer::ModelHandle> m_sceneModelHandles; // indexed by scene model id
+    std::vector<DX::SceneGraph::NodeId> m_unresolvedNodes;      // renderables whose model is still streaming
+    DirectX::Model m_emptyModel;                                // stands in for those
+    std::vector<std::unique_ptr<DirectX::Model>> m_sceneModels; // indexed by node id, null for non-renderables
+    std::vector<std::shared_ptr<const DX::ModelCache::Asset>> m_sceneAssets; // indexed by node id, set once resolved
+    std::vector<std::vector<DX::TextureStreamer::TextureHandle>> m_sceneTextures; // indexed by node id, the streamed textures each samples
+    bool m_instanceModels;
+    std::unique_ptr<DX::InstancedRenderer> m_instancedRenderer;
+    bool m_cullClusters;
+    std::unique_ptr<DX::ClusterCuller> m_clusterCuller;         // non-instanced meshes at full detail
+
+    // One entry per mesh of every renderable node, parallel to the culler's instances
+    struct SceneMeshInstance
+    {
+        DX::SceneGraph::NodeId node;
+        uint32_t mesh;
+    };
+
+    // A mesh in view large enough to draw into the occlusion buffer: an entry of m_sceneMeshes
+    struct SceneOccluder
+    {
+        float pixels;
+        uint32_t entry;
+    };
+
+    DX::FrustumCuller m_culler;
+    bool m_cullOccluded;
+    DX::OcclusionBuffer m_occlusion;
+    std::vector<SceneOccluder> m_sceneOccluders;
+    std::vector<uint8_t> m_occlusionResults;                    // parallel to the culler's visible list
+    std::vector<uint32_t> m_sceneVisible;                       // entries of m_sceneMeshes left by both
+    OcclusionStatistics m_occlusionStats;
+    std::vector<SceneMeshInstance> m_sceneMeshes;
+    std::vector<uint32_t> m_sceneMeshOffsets;                   // first entry of each renderable in m_sceneMeshes
+    std::vector<uint8_t> m_sceneMeshLods;                       // parallel to m_sceneMeshes, the level each drew last
+    DX::RenderQueue m_renderQueue;
+    LodStatistics m_lodStats;
 
     //std::unique_ptr<DirectX::Model> modelPlanet;
     std::unique_ptr<DirectX::GeometricPrimitive> primitiveCube;
@@ -164,15 +310,15 @@ private:
 
 
     // Room Textures
-    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> room_texture;
-    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> ring_texture;
+    DX::AssetStreamer::TextureHandle room_texture;
+    DX::AssetStreamer::TextureHandle ring_texture;
 
     // Create Body Effect
     std::unique_ptr<DirectX::BasicEffect> body_effect;
     Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> body_colour_texture;
     Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> body_normal_texture;
     Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> body_emissive_texture;
-    Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> m_background;
+    DX::AssetStreamer::TextureHandle m_background;
 
     // Create Blooming Effect
     // Create a buffer to load to
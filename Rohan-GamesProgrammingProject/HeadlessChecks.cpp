@@ -0,0 +1,405 @@
+//
+// HeadlessChecks.cpp - Self-checks of the rendering paths against the recording device context
+//
+
+#include "pch.h"
+#include "HeadlessChecks.h"
+#include "Game.h"
+
+#include <random>
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+    // Frames ticked before measuring, and measured
+    const unsigned int CHECK_WARMUP_FRAMES = 10;
+    const unsigned int CHECK_FRAMES = 16;
+
+    // Scene animation steps once per Tick, so runs that tick alike draw alike. Everything loads
+    // before the first frame, so no run sees a mesh sooner than another; cluster culling is off,
+    // as the instanced path does not cull clusters.
+    DX::RenderStats DrawScene(const wchar_t* sceneFile, bool instanceModels)
+    {
+        GameOptions options;
+        options.headless = true;
+        options.sceneFile = sceneFile;
+        options.streamAssets = false;
+        options.cullClusters = false;
+        options.instanceModels = instanceModels;
+
+        auto game = std::make_unique<Game>(options);
+
+        int w, h;
+        game->GetDefaultSize(w, h);
+        game->InitializeHeadless(w, h);
+
+        for (unsigned int i = 0; i < CHECK_WARMUP_FRAMES; ++i)
+        {
+            game->Tick();
+        }
+        game->GetRecorder()->ResetStats();
+
+        for (unsigned int i = 0; i < CHECK_FRAMES; ++i)
+        {
+            game->Tick();
+        }
+        return game->GetRecorder()->GetTotalStats();
+    }
+
+    // Slot ranges bound at random in the trimming check
+    const unsigned int FILTER_ITERATIONS = 4000;
+    const UINT FILTER_SLOTS = 16;
+
+    // A state filter in front of a recorder on a device of its own. The recorder absorbs no
+    // work, so every binding it sees reaches the runtime and can be read back.
+    struct FilterRig
+    {
+        ComPtr<ID3D11Device>                        device;
+        ComPtr<ID3D11DeviceContext1>                context;
+        ComPtr<DX::RecordingDeviceContext>          recorder;
+        ComPtr<DX::StateFilteringDeviceContext>     filter;
+
+        FilterRig()
+        {
+            static const D3D_FEATURE_LEVEL featureLevels[] = { D3D_FEATURE_LEVEL_11_1, D3D_FEATURE_LEVEL_11_0 };
+
+            // As for -headless: the null driver if the SDK layers are installed, WARP otherwise
+            ComPtr<ID3D11DeviceContext> immediate;
+            HRESULT hr = E_FAIL;
+            for (auto driverType : { D3D_DRIVER_TYPE_NULL, D3D_DRIVER_TYPE_WARP })
+            {
+                hr = D3D11CreateDevice(nullptr, driverType, nullptr, 0, featureLevels, UINT(_countof(featureLevels)),
+                    D3D11_SDK_VERSION, device.ReleaseAndGetAddressOf(), nullptr, immediate.ReleaseAndGetAddressOf());
+                if (SUCCEEDED(hr))
+                    break;
+            }
+            DX::ThrowIfFailed(hr);
+            DX::ThrowIfFailed(immediate.As(&context));
+
+            recorder.Attach(new DX::RecordingDeviceContext(context.Get(), false));
+            filter.Attach(new DX::StateFilteringDeviceContext(recorder.Get()));
+        }
+
+        // Binding calls that reached the recorder since the last call
+        uint64_t Forwarded()
+        {
+            recorder->EndFrame();
+            return recorder->GetFrameStats().stateSets;
+        }
+    };
+
+    // Releases what a Get* call returned and says whether it was what the check bound.
+    template<typename T>
+    bool Bound(T* bound, T* expected)
+    {
+        const bool same = bound == expected;
+        if (bound)
+            bound->Release();
+        return same;
+    }
+
+    struct Views
+    {
+        ComPtr<ID3D11Texture2D>             texture;
+        ComPtr<ID3D11ShaderResourceView>    srv;
+        ComPtr<ID3D11RenderTargetView>      rtv;
+        ComPtr<ID3D11UnorderedAccessView>   uav;
+    };
+
+    Views CreateViews(ID3D11Device* device)
+    {
+        Views views;
+        CD3D11_TEXTURE2D_DESC desc(DXGI_FORMAT_R8G8B8A8_UNORM, 4, 4, 1, 1,
+            D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET | D3D11_BIND_UNORDERED_ACCESS);
+        DX::ThrowIfFailed(device->CreateTexture2D(&desc, nullptr, views.texture.GetAddressOf()));
+        DX::ThrowIfFailed(device->CreateShaderResourceView(views.texture.Get(), nullptr, views.srv.GetAddressOf()));
+        DX::ThrowIfFailed(device->CreateRenderTargetView(views.texture.Get(), nullptr, views.rtv.GetAddressOf()));
+        DX::ThrowIfFailed(device->CreateUnorderedAccessView(views.texture.Get(), nullptr, views.uav.GetAddressOf()));
+        return views;
+    }
+
+    // Binds a texture as an output through the filter, which unbinds its views as inputs, then
+    // clears the output behind the filter's back. Rebinding the view must reach the runtime.
+    unsigned int CheckOutputBinds(FilterRig& rig)
+    {
+        const Views views = CreateViews(rig.device.Get());
+        ID3D11ShaderResourceView* const srv = views.srv.Get();
+        ID3D11RenderTargetView* const rtv = views.rtv.Get();
+        ID3D11UnorderedAccessView* const uav = views.uav.Get();
+        ID3D11UnorderedAccessView* const noUav = nullptr;
+
+        unsigned int failures = 0;
+        for (int output = 0; output < 3; ++output)
+        {
+            const bool compute = output == 2;
+            if (compute)
+                rig.filter->CSSetShaderResources(0, 1, &srv);
+            else
+                rig.filter->PSSetShaderResources(0, 1, &srv);
+
+            switch (output)
+            {
+            case 0:
+                rig.filter->OMSetRenderTargets(1, &rtv, nullptr);
+                rig.context->OMSetRenderTargets(0, nullptr, nullptr);
+                break;
+            case 1:
+                rig.filter->OMSetRenderTargetsAndUnorderedAccessViews(0, nullptr, nullptr, 0, 1, &uav, nullptr);
+                rig.context->OMSetRenderTargetsAndUnorderedAccessViews(0, nullptr, nullptr, 0, 1, &noUav, nullptr);
+                break;
+            default:
+                rig.filter->CSSetUnorderedAccessViews(0, 1, &uav, nullptr);
+                rig.context->CSSetUnorderedAccessViews(0, 1, &noUav, nullptr);
+                break;
+            }
+
+            rig.Forwarded();
+            ID3D11ShaderResourceView* bound = nullptr;
+            if (compute)
+            {
+                rig.filter->CSSetShaderResources(0, 1, &srv);
+                rig.filter->CSGetShaderResources(0, 1, &bound);
+            }
+            else
+            {
+                rig.filter->PSSetShaderResources(0, 1, &srv);
+                rig.filter->PSGetShaderResources(0, 1, &bound);
+            }
+
+            if (rig.Forwarded() != 1 || !Bound(bound, srv))
+                ++failures;
+        }
+        return failures;
+    }
+
+    // Binds one of each kind of state, clears it all through the filter, and binds it again;
+    // every binding must be forwarded and end up bound.
+    unsigned int CheckClears(FilterRig& rig)
+    {
+        const Views views = CreateViews(rig.device.Get());
+        ID3D11ShaderResourceView* const srv = views.srv.Get();
+
+        ComPtr<ID3D11SamplerState> sampler;
+        ComPtr<ID3D11RasterizerState> rasterizer;
+        ComPtr<ID3D11Buffer> constants;
+        ComPtr<ID3D11Buffer> vertices;
+        const CD3D11_SAMPLER_DESC samplerDesc(D3D11_DEFAULT);
+        const CD3D11_RASTERIZER_DESC rasterizerDesc(D3D11_DEFAULT);
+        const CD3D11_BUFFER_DESC constantsDesc(256, D3D11_BIND_CONSTANT_BUFFER);
+        const CD3D11_BUFFER_DESC verticesDesc(256, D3D11_BIND_VERTEX_BUFFER);
+        DX::ThrowIfFailed(rig.device->CreateSamplerState(&samplerDesc, sampler.GetAddressOf()));
+        DX::ThrowIfFailed(rig.device->CreateRasterizerState(&rasterizerDesc, rasterizer.GetAddressOf()));
+        DX::ThrowIfFailed(rig.device->CreateBuffer(&constantsDesc, nullptr, constants.GetAddressOf()));
+        DX::ThrowIfFailed(rig.device->CreateBuffer(&verticesDesc, nullptr, vertices.GetAddressOf()));
+
+        ComPtr<ID3D11DeviceContext> deferred;
+        ComPtr<ID3D11CommandList> commandList;
+        DX::ThrowIfFailed(rig.device->CreateDeferredContext(0, deferred.GetAddressOf()));
+        DX::ThrowIfFailed(deferred->FinishCommandList(FALSE, commandList.GetAddressOf()));
+
+        ID3D11SamplerState* const samplers[] = { sampler.Get() };
+        ID3D11Buffer* const constantBuffers[] = { constants.Get() };
+        ID3D11Buffer* const vertexBuffers[] = { vertices.Get() };
+        const UINT stride = 16;
+        const UINT offset = 0;
+
+        auto bindAll = [&]()
+        {
+            rig.filter->PSSetShaderResources(0, 1, &srv);
+            rig.filter->PSSetSamplers(0, 1, samplers);
+            rig.filter->VSSetConstantBuffers(0, 1, constantBuffers);
+            rig.filter->RSSetState(rasterizer.Get());
+            rig.filter->IASetVertexBuffers(0, 1, vertexBuffers, &stride, &offset);
+        };
+        const uint64_t bindCount = 5;
+
+        unsigned int failures = 0;
+        for (int clear = 0; clear < 3; ++clear)
+        {
+            bindAll();
+            switch (clear)
+            {
+            case 0:  rig.filter->ClearState(); break;
+            case 1:  rig.filter->ExecuteCommandList(commandList.Get(), FALSE); break;
+            default: rig.filter->ExecuteCommandList(commandList.Get(), TRUE); break;
+            }
+
+            rig.Forwarded();
+            bindAll();
+            if (rig.Forwarded() != bindCount)
+                ++failures;
+
+            ID3D11ShaderResourceView* boundView = nullptr;
+            ID3D11SamplerState* boundSampler = nullptr;
+            ID3D11Buffer* boundConstants = nullptr;
+            ID3D11RasterizerState* boundRasterizer = nullptr;
+            ID3D11Buffer* boundVertices = nullptr;
+            UINT boundStride = 0;
+            UINT boundOffset = 0;
+            rig.filter->PSGetShaderResources(0, 1, &boundView);
+            rig.filter->PSGetSamplers(0, 1, &boundSampler);
+            rig.filter->VSGetConstantBuffers(0, 1, &boundConstants);
+            rig.filter->RSGetState(&boundRasterizer);
+            rig.filter->IAGetVertexBuffers(0, 1, &boundVertices, &boundStride, &boundOffset);
+
+            bool bound = Bound(boundView, srv);
+            bound &= Bound(boundSampler, sampler.Get());
+            bound &= Bound(boundConstants, constants.Get());
+            bound &= Bound(boundRasterizer, rasterizer.Get());
+            bound &= Bound(boundVertices, vertices.Get()) && boundStride == stride && boundOffset == offset;
+            if (!bound)
+                ++failures;
+        }
+        return failures;
+    }
+
+    // Binds random slot ranges, mostly rebinding what is already there so the filter drops and
+    // trims, and now and then forgetting everything. After every call the runtime must hold
+    // exactly what was asked for in every slot. Returns the slots that did not.
+    unsigned int CheckSlotRanges(FilterRig& rig)
+    {
+        const unsigned int objectCount = 4;
+        Views views[objectCount];
+        ComPtr<ID3D11Buffer> buffers[objectCount];
+        const CD3D11_BUFFER_DESC bufferDesc(256, D3D11_BIND_VERTEX_BUFFER);
+        for (unsigned int i = 0; i < objectCount; ++i)
+        {
+            views[i] = CreateViews(rig.device.Get());
+            DX::ThrowIfFailed(rig.device->CreateBuffer(&bufferDesc, nullptr, buffers[i].GetAddressOf()));
+        }
+
+        rig.filter->ClearState();
+
+        ID3D11ShaderResourceView* expectedViews[FILTER_SLOTS] = {};
+        ID3D11Buffer* expectedBuffers[FILTER_SLOTS] = {};
+        UINT expectedStrides[FILTER_SLOTS] = {};
+        UINT expectedOffsets[FILTER_SLOTS] = {};
+
+        std::mt19937 random(12345);
+        auto pick = [&](unsigned int count) { return unsigned(random() % count); };
+
+        unsigned int mismatches = 0;
+        for (unsigned int iteration = 0; iteration < FILTER_ITERATIONS; ++iteration)
+        {
+            if (pick(32) == 0)
+            {
+                rig.filter->OMSetRenderTargets(0, nullptr, nullptr);
+            }
+
+            const UINT start = pick(FILTER_SLOTS);
+            const UINT count = 1 + pick(FILTER_SLOTS - start);
+
+            ID3D11ShaderResourceView* newViews[FILTER_SLOTS];
+            ID3D11Buffer* newBuffers[FILTER_SLOTS];
+            UINT newStrides[FILTER_SLOTS];
+            UINT newOffsets[FILTER_SLOTS];
+            for (UINT i = 0; i < count; ++i)
+            {
+                const UINT slot = start + i;
+                const bool change = pick(4) == 0;
+
+                // Index objectCount stands for an empty slot
+                const unsigned int view = pick(objectCount + 1);
+                newViews[i] = change ? (view < objectCount ? views[view].srv.Get() : nullptr) : expectedViews[slot];
+
+                const unsigned int buffer = pick(objectCount + 1);
+                newBuffers[i] = change ? (buffer < objectCount ? buffers[buffer].Get() : nullptr) : expectedBuffers[slot];
+                newStrides[i] = change ? 16 * (1 + pick(2)) : expectedStrides[slot];
+                newOffsets[i] = change ? 16 * pick(2) : expectedOffsets[slot];
+            }
+
+            if (iteration & 1)
+            {
+                rig.filter->IASetVertexBuffers(start, count, newBuffers, newStrides, newOffsets);
+                for (UINT i = 0; i < count; ++i)
+                {
+                    expectedBuffers[start + i] = newBuffers[i];
+                    expectedStrides[start + i] = newStrides[i];
+                    expectedOffsets[start + i] = newOffsets[i];
+                }
+            }
+            else
+            {
+                rig.filter->PSSetShaderResources(start, count, newViews);
+                std::copy(newViews, newViews + count, expectedViews + start);
+            }
+
+            ID3D11ShaderResourceView* boundViews[FILTER_SLOTS] = {};
+            ID3D11Buffer* boundBuffers[FILTER_SLOTS] = {};
+            UINT boundStrides[FILTER_SLOTS] = {};
+            UINT boundOffsets[FILTER_SLOTS] = {};
+            rig.filter->PSGetShaderResources(0, FILTER_SLOTS, boundViews);
+            rig.filter->IAGetVertexBuffers(0, FILTER_SLOTS, boundBuffers, boundStrides, boundOffsets);
+
+            // The runtime keeps no stride or offset worth comparing for an empty slot
+            for (UINT slot = 0; slot < FILTER_SLOTS; ++slot)
+            {
+                if (!Bound(boundViews[slot], expectedViews[slot]))
+                    ++mismatches;
+
+                const bool empty = !expectedBuffers[slot];
+                if (!Bound(boundBuffers[slot], expectedBuffers[slot])
+                    || (!empty && (boundStrides[slot] != expectedStrides[slot] || boundOffsets[slot] != expectedOffsets[slot])))
+                    ++mismatches;
+            }
+        }
+        return mismatches;
+    }
+}
+
+bool CheckInstancing(const wchar_t* sceneFile, FILE* report)
+{
+    const DX::RenderStats instanced = DrawScene(sceneFile, true);
+    const DX::RenderStats plain = DrawScene(sceneFile, false);
+
+    // Plain draws submit one instance each, so the rest were carried by instanced draws
+    const uint64_t instancedDraws = instanced.instancedDrawCalls;
+    const uint64_t otherDraws = instanced.drawCalls - instancedDraws;
+    const uint64_t instances = instanced.instancesSubmitted - otherDraws;
+
+    const bool passed = instancedDraws > 0
+        && plain.instancedDrawCalls == 0
+        && plain.drawCalls == otherDraws + instances
+        && plain.primitivesSubmitted == instanced.primitivesSubmitted;
+
+    const double n = double(CHECK_FRAMES);
+    fprintf(report, "instancing draws/frame          %.1f\n", double(instanced.drawCalls) / n);
+    fprintf(report, "instancing instanced/frame      %.1f\n", double(instancedDraws) / n);
+    fprintf(report, "instancing instances/frame      %.1f\n", double(instances) / n);
+    fprintf(report, "instancing plain draws/frame    %.1f\n", double(plain.drawCalls) / n);
+    fprintf(report, "instancing draws per instanced  %.2f\n", instancedDraws ? double(instances) / double(instancedDraws) : 0.0);
+    fprintf(report, "instancing total draw ratio     %.2f\n",
+        instanced.drawCalls ? double(plain.drawCalls) / double(instanced.drawCalls) : 0.0);
+    fprintf(report, "instancing check                %s\n", passed ? "passed" : "FAILED");
+    return passed;
+}
+
+bool CheckStateFilter(FILE* report)
+{
+    FilterRig rig;
+
+    const unsigned int outputFailures = CheckOutputBinds(rig);
+    const unsigned int clearFailures = CheckClears(rig);
+
+    rig.filter->ResetStats();
+    const unsigned int mismatches = CheckSlotRanges(rig);
+    rig.filter->EndFrame();
+
+    // The random bindings must have given the filter something to drop and trim
+    const DX::StateFilterStats& stats = rig.filter->GetTotalStats();
+    const bool passed = outputFailures == 0
+        && clearFailures == 0
+        && mismatches == 0
+        && stats.filtered > 0
+        && stats.slotsTrimmed > 0;
+
+    fprintf(report, "state filter output binds       %u of 3 failed\n", outputFailures);
+    fprintf(report, "state filter clears             %u of 3 failed\n", clearFailures);
+    fprintf(report, "state filter slot mismatches    %u\n", mismatches);
+    fprintf(report, "state filter calls              %llu\n", static_cast<unsigned long long>(stats.calls));
+    fprintf(report, "state filter filtered           %llu\n", static_cast<unsigned long long>(stats.filtered));
+    fprintf(report, "state filter slots trimmed      %llu\n", static_cast<unsigned long long>(stats.slotsTrimmed));
+    fprintf(report, "state filter check              %s\n", passed ? "passed" : "FAILED");
+    return passed;
+}
@@ -0,0 +1,20 @@
+//
+// HeadlessChecks.h - Self-checks of the rendering paths against the recording device context
+//
+
+#pragma once
+
+#include <stdio.h>
+
+// Each check writes what it measured to 'report', one "name value" line at a time, and returns
+// whether it passed. Run by "-headless -check".
+
+// Draws the scene with and without instancing, the same frames on the recording context each
+// time. Instancing must replace every instanced mesh part's draw per instance with one draw
+// per part, drawing the same primitives, and leave every other draw as it was.
+bool CheckInstancing(_In_z_ const wchar_t* sceneFile, _In_ FILE* report);
+
+// Drives a state filter in front of a recorder on a device of its own. Rebinding a view after a
+// render target or UAV bind, ClearState or ExecuteCommandList must reach the runtime, and random
+// slot ranges, trimmed or not, must leave every slot holding what was asked for.
+bool CheckStateFilter(_In_ FILE* report);
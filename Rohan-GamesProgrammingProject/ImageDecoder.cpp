@@ -0,0 +1,500 @@
+//
+// ImageDecoder.cpp - Image format detection, BMP decoding and the SIMD pixel conversions
+//
+// Does not use the precompiled header, so the offline tools can build it.
+//
+
+#include "ImageDecoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IMG_X86 1
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMG_SSE2 1
+#endif
+#endif
+
+#if defined(IMG_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// GCC and clang only emit SSSE3 in functions marked for it; MSVC emits whatever intrinsics ask for
+#if defined(__GNUC__) || defined(__clang__)
+#define IMG_TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define IMG_TARGET_SSSE3
+#endif
+
+using namespace DX;
+
+namespace
+{
+    const uint8_t c_PNGSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+    uint32_t Load32(const uint8_t* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    void Store32(uint8_t* p, uint32_t value)
+    {
+        memcpy(p, &value, sizeof(value));
+    }
+
+    SwizzleLevel GetSupportedLevel()
+    {
+#if defined(IMG_SSE2)
+        static const SwizzleLevel s_supported = []()
+        {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 1);
+            return (info[2] & (1 << 9)) ? SwizzleLevel::SSSE3 : SwizzleLevel::SSE2;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("ssse3") ? SwizzleLevel::SSSE3 : SwizzleLevel::SSE2;
+#endif
+        }();
+        return s_supported;
+#else
+        return SwizzleLevel::Scalar;
+#endif
+    }
+
+    std::atomic<int> g_swizzleLevel(-1);
+
+    // Each conversion handles whole vectors of pixels and leaves the rest to the scalar loop,
+    // returning how many it did.
+
+    size_t SwizzleBGRAScalar(const uint8_t* source, uint8_t* destination, size_t pixels, uint32_t alpha)
+    {
+        for (size_t i = 0; i < pixels; ++i)
+        {
+            const uint32_t bgra = Load32(source + i * 4);
+            Store32(destination + i * 4, (bgra & 0xFF00FF00u) | ((bgra >> 16) & 0xFF) | ((bgra & 0xFF) << 16) | alpha);
+        }
+        return pixels;
+    }
+
+    void ExpandTripleScalar(const uint8_t* source, uint8_t* destination, size_t pixels, bool swap)
+    {
+        const unsigned r = swap ? 2 : 0;
+        for (size_t i = 0; i < pixels; ++i, source += 3, destination += 4)
+        {
+            destination[0] = source[r];
+            destination[1] = source[1];
+            destination[2] = source[2 - r];
+            destination[3] = 0xFF;
+        }
+    }
+
+#if defined(IMG_SSE2)
+    // Red and blue trade places by shifting the two 16-bit halves of each pixel past each other
+    size_t SwizzleBGRASSE2(const uint8_t* source, uint8_t* destination, size_t pixels, uint32_t alpha)
+    {
+        const __m128i greenAlpha = _mm_set1_epi32(int(0xFF00FF00u));
+        const __m128i redBlue = _mm_set1_epi32(0x00FF00FF);
+        const __m128i opaque = _mm_set1_epi32(int(alpha));
+
+        size_t i = 0;
+        for (; i + 4 <= pixels; i += 4)
+        {
+            const __m128i bgra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 4));
+            const __m128i rb = _mm_and_si128(bgra, redBlue);
+            const __m128i swapped = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+            const __m128i rgba = _mm_or_si128(_mm_or_si128(_mm_and_si128(bgra, greenAlpha), swapped), opaque);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 4), rgba);
+        }
+        return i;
+    }
+
+    size_t ExpandGraySSE2(const uint8_t* source, uint8_t* destination, size_t pixels)
+    {
+        const __m128i opaque = _mm_set1_epi32(int(0xFF000000u));
+
+        size_t i = 0;
+        for (; i + 16 <= pixels; i += 16)
+        {
+            const __m128i gray = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+            const __m128i pairsLow = _mm_unpacklo_epi8(gray, gray);
+            const __m128i pairsHigh = _mm_unpackhi_epi8(gray, gray);
+            __m128i* out = reinterpret_cast<__m128i*>(destination + i * 4);
+            _mm_storeu_si128(out + 0, _mm_or_si128(_mm_unpacklo_epi16(pairsLow, pairsLow), opaque));
+            _mm_storeu_si128(out + 1, _mm_or_si128(_mm_unpackhi_epi16(pairsLow, pairsLow), opaque));
+            _mm_storeu_si128(out + 2, _mm_or_si128(_mm_unpacklo_epi16(pairsHigh, pairsHigh), opaque));
+            _mm_storeu_si128(out + 3, _mm_or_si128(_mm_unpackhi_epi16(pairsHigh, pairsHigh), opaque));
+        }
+        return i;
+    }
+
+    // A grey-alpha pixel's 16 bits are already the top half of its RGBA; the bottom half is
+    // the grey twice.
+    size_t ExpandGrayAlphaSSE2(const uint8_t* source, uint8_t* destination, size_t pixels)
+    {
+        const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+
+        size_t i = 0;
+        for (; i + 8 <= pixels; i += 8)
+        {
+            const __m128i grayAlpha = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 2));
+            const __m128i gray = _mm_and_si128(grayAlpha, lowBytes);
+            const __m128i grayGray = _mm_or_si128(gray, _mm_slli_epi16(gray, 8));
+            __m128i* out = reinterpret_cast<__m128i*>(destination + i * 4);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(grayGray, grayAlpha));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(grayGray, grayAlpha));
+        }
+        return i;
+    }
+
+    IMG_TARGET_SSSE3 size_t SwizzleBGRASSSE3(const uint8_t* source, uint8_t* destination, size_t pixels, uint32_t alpha)
+    {
+        const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        const __m128i opaque = _mm_set1_epi32(int(alpha));
+
+        size_t i = 0;
+        for (; i + 4 <= pixels; i += 4)
+        {
+            const __m128i bgra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 4), _mm_or_si128(_mm_shuffle_epi8(bgra, shuffle), opaque));
+        }
+        return i;
+    }
+
+    // Sixteen 3-byte pixels are exactly three vectors; byte alignment lines each group of four
+    // up at the start of a vector, and one shuffle spreads them to four bytes each.
+    IMG_TARGET_SSSE3 size_t ExpandTripleSSSE3(const uint8_t* source, uint8_t* destination, size_t pixels, bool swap)
+    {
+        const __m128i shuffle = swap ?
+            _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1) :
+            _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i opaque = _mm_set1_epi32(int(0xFF000000u));
+
+        size_t i = 0;
+        for (; i + 16 <= pixels; i += 16)
+        {
+            const __m128i* in = reinterpret_cast<const __m128i*>(source + i * 3);
+            const __m128i a = _mm_loadu_si128(in + 0);
+            const __m128i b = _mm_loadu_si128(in + 1);
+            const __m128i c = _mm_loadu_si128(in + 2);
+
+            __m128i* out = reinterpret_cast<__m128i*>(destination + i * 4);
+            _mm_storeu_si128(out + 0, _mm_or_si128(_mm_shuffle_epi8(a, shuffle), opaque));
+            _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), shuffle), opaque));
+            _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), shuffle), opaque));
+            _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), shuffle), opaque));
+        }
+        return i;
+    }
+#endif
+
+    void SwizzleBGRA(const uint8_t* source, uint8_t* destination, size_t pixels, uint32_t alpha)
+    {
+        size_t done = 0;
+        switch (GetSwizzleLevel())
+        {
+#if defined(IMG_SSE2)
+        case SwizzleLevel::SSSE3:   done = SwizzleBGRASSSE3(source, destination, pixels, alpha); break;
+        case SwizzleLevel::SSE2:    done = SwizzleBGRASSE2(source, destination, pixels, alpha); break;
+#endif
+        default:                    break;
+        }
+        SwizzleBGRAScalar(source + done * 4, destination + done * 4, pixels - done, alpha);
+    }
+
+    void ExpandTriple(const uint8_t* source, uint8_t* destination, size_t pixels, bool swap)
+    {
+        size_t done = 0;
+#if defined(IMG_SSE2)
+        if (GetSwizzleLevel() == SwizzleLevel::SSSE3)
+            done = ExpandTripleSSSE3(source, destination, pixels, swap);
+#endif
+        ExpandTripleScalar(source + done * 3, destination + done * 4, pixels - done, swap);
+    }
+
+    // Windows bitmaps
+
+    struct BitField
+    {
+        uint32_t    mask = 0;
+        unsigned    shift = 0;
+        uint32_t    maximum = 0;    // of the field once shifted down
+
+        explicit BitField(uint32_t m) : mask(m)
+        {
+            if (!mask)
+                return;
+            while (!((mask >> shift) & 1))
+            {
+                ++shift;
+            }
+            maximum = mask >> shift;
+        }
+
+        // Scaled to eight bits, rounding; fields that are absent read as absent
+        uint8_t Extract(uint32_t pixel, uint8_t absent) const
+        {
+            if (!maximum)
+                return absent;
+            return uint8_t((uint64_t((pixel & mask) >> shift) * 255 + maximum / 2) / maximum);
+        }
+    };
+
+    template<typename T>
+    T ReadAt(const uint8_t* data, size_t size, size_t offset)
+    {
+        if (offset > size || sizeof(T) > size - offset)
+            throw std::runtime_error("BMP file is truncated");
+
+        T value;
+        memcpy(&value, data + offset, sizeof(T));
+        return value;
+    }
+}
+
+ImageFileFormat DX::DetectImageFormat(const uint8_t* data, size_t size)
+{
+    if (size >= sizeof(c_PNGSignature) && !memcmp(data, c_PNGSignature, sizeof(c_PNGSignature)))
+        return ImageFileFormat::PNG;
+    if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF)
+        return ImageFileFormat::JPEG;
+    if (size >= 2 && data[0] == 'B' && data[1] == 'M')
+        return ImageFileFormat::BMP;
+    return ImageFileFormat::Unknown;
+}
+
+void DX::DecodeImage(const uint8_t* data, size_t size, DecodedImage& image)
+{
+    switch (DetectImageFormat(data, size))
+    {
+    case ImageFileFormat::PNG:  DecodePNG(data, size, image); break;
+    case ImageFileFormat::JPEG: DecodeJPEG(data, size, image); break;
+    case ImageFileFormat::BMP:  DecodeBMP(data, size, image); break;
+    default:                    throw std::runtime_error("not a PNG, JPEG or BMP file");
+    }
+}
+
+void DX::DecodeBMP(const uint8_t* data, size_t size, DecodedImage& image)
+{
+    const size_t c_InfoHeaderOffset = 14;
+    const uint32_t c_RGB = 0;
+    const uint32_t c_BitFields = 3;
+    const uint32_t c_AlphaBitFields = 6;
+
+    if (DetectImageFormat(data, size) != ImageFileFormat::BMP)
+        throw std::runtime_error("not a BMP file");
+
+    const auto pixelOffset = ReadAt<uint32_t>(data, size, 10);
+    const auto infoSize = ReadAt<uint32_t>(data, size, c_InfoHeaderOffset);
+
+    // OS/2 bitmaps have 16-bit sizes and 3-byte palette entries
+    const bool core = infoSize == 12;
+    if (!core && infoSize < 40)
+        throw std::runtime_error("BMP header is damaged");
+
+    int64_t width, height;
+    uint32_t bitCount, compression = c_RGB, paletteSize = 0;
+    if (core)
+    {
+        width = ReadAt<uint16_t>(data, size, c_InfoHeaderOffset + 4);
+        height = ReadAt<uint16_t>(data, size, c_InfoHeaderOffset + 6);
+        bitCount = ReadAt<uint16_t>(data, size, c_InfoHeaderOffset + 10);
+    }
+    else
+    {
+        width = ReadAt<int32_t>(data, size, c_InfoHeaderOffset + 4);
+        height = ReadAt<int32_t>(data, size, c_InfoHeaderOffset + 8);
+        bitCount = ReadAt<uint16_t>(data, size, c_InfoHeaderOffset + 14);
+        compression = ReadAt<uint32_t>(data, size, c_InfoHeaderOffset + 16);
+        paletteSize = ReadAt<uint32_t>(data, size, c_InfoHeaderOffset + 32);
+    }
+
+    const bool bottomUp = height > 0;
+    const uint64_t w = uint64_t(width > 0 ? width : 0);
+    const uint64_t h = uint64_t(height < 0 ? -height : height);
+    if (!w || !h || w > c_MaxImageDimension || h > c_MaxImageDimension)
+        throw std::runtime_error("BMP size is out of range");
+
+    // Masks follow a plain BITMAPINFOHEADER, and are part of the later, larger headers
+    size_t tableOffset = c_InfoHeaderOffset + infoSize;
+    BitField red(0), green(0), blue(0), alpha(0);
+    if (compression == c_BitFields || compression == c_AlphaBitFields)
+    {
+        if (bitCount != 16 && bitCount != 32)
+            throw std::runtime_error("BMP bit fields need 16 or 32-bit pixels");
+
+        const size_t masks = infoSize >= 52 ? c_InfoHeaderOffset + 40 : tableOffset;
+        red = BitField(ReadAt<uint32_t>(data, size, masks + 0));
+        green = BitField(ReadAt<uint32_t>(data, size, masks + 4));
+        blue = BitField(ReadAt<uint32_t>(data, size, masks + 8));
+        if (infoSize >= 56 || compression == c_AlphaBitFields)
+            alpha = BitField(ReadAt<uint32_t>(data, size, masks + 12));
+        if (infoSize < 52)
+            tableOffset += compression == c_AlphaBitFields ? 16 : 12;
+    }
+    else if (compression != c_RGB)
+    {
+        throw std::runtime_error("compressed BMP files are not supported");
+    }
+    else if (bitCount == 16)
+    {
+        red = BitField(0x7C00);
+        green = BitField(0x03E0);
+        blue = BitField(0x001F);
+    }
+
+    uint32_t palette[256] = {};
+    if (bitCount <= 8)
+    {
+        if (bitCount != 1 && bitCount != 4 && bitCount != 8)
+            throw std::runtime_error("BMP bit depth is not supported");
+
+        const uint32_t maxEntries = 1u << bitCount;
+        const uint32_t entries = paletteSize && paletteSize < maxEntries ? paletteSize : maxEntries;
+        const size_t entrySize = core ? 3 : 4;
+        if (tableOffset > size || entries * entrySize > size - tableOffset)
+            throw std::runtime_error("BMP palette is truncated");
+
+        uint8_t bgrx[256 * 4];
+        for (uint32_t i = 0; i < entries; ++i)
+        {
+            memcpy(bgrx + i * 4, data + tableOffset + i * entrySize, 3);
+        }
+        SwizzleBGRXToRGBA(bgrx, reinterpret_cast<uint8_t*>(palette), entries);
+    }
+    else if (bitCount != 16 && bitCount != 24 && bitCount != 32)
+    {
+        throw std::runtime_error("BMP bit depth is not supported");
+    }
+
+    const uint64_t rowPitch = (w * bitCount + 31) / 32 * 4;
+    if (pixelOffset > size || rowPitch * h > size - pixelOffset)
+        throw std::runtime_error("BMP file is truncated");
+
+    // Standard 32-bit masks have a shuffle of their own
+    const bool bgra = bitCount == 32 && red.mask == 0x00FF0000 && green.mask == 0x0000FF00 && blue.mask == 0x000000FF;
+
+    image.width = uint32_t(w);
+    image.height = uint32_t(h);
+    image.sRGB = false;
+    image.pixels.resize(size_t(w * h * 4));
+    for (uint64_t y = 0; y < h; ++y)
+    {
+        const uint8_t* row = data + pixelOffset + (bottomUp ? h - 1 - y : y) * rowPitch;
+        uint8_t* out = image.pixels.data() + y * w * 4;
+
+        if (bitCount == 24)
+        {
+            ExpandBGRToRGBA(row, out, size_t(w));
+        }
+        else if (bitCount == 32 && (compression == c_RGB || (bgra && !alpha.mask)))
+        {
+            // The fourth byte of a BI_RGB pixel is unused, not alpha
+            SwizzleBGRXToRGBA(row, out, size_t(w));
+        }
+        else if (bgra && alpha.mask == 0xFF000000u)
+        {
+            SwizzleBGRAToRGBA(row, out, size_t(w));
+        }
+        else if (bitCount > 8)
+        {
+            const size_t bytes = bitCount / 8;
+            for (uint64_t x = 0; x < w; ++x)
+            {
+                uint32_t pixel = 0;
+                memcpy(&pixel, row + x * bytes, bytes);
+                out[x * 4 + 0] = red.Extract(pixel, 0);
+                out[x * 4 + 1] = green.Extract(pixel, 0);
+                out[x * 4 + 2] = blue.Extract(pixel, 0);
+                out[x * 4 + 3] = alpha.Extract(pixel, 0xFF);
+            }
+        }
+        else
+        {
+            // Pixels fill each byte from its top bit down
+            const unsigned perByte = 8 / bitCount;
+            const unsigned mask = (1u << bitCount) - 1;
+            for (uint64_t x = 0; x < w; ++x)
+            {
+                const unsigned shift = unsigned(perByte - 1 - x % perByte) * bitCount;
+                const unsigned index = (row[x / perByte] >> shift) & mask;
+                Store32(out + x * 4, palette[index]);
+            }
+        }
+    }
+}
+
+SwizzleLevel DX::GetSwizzleLevel()
+{
+    int level = g_swizzleLevel.load(std::memory_order_relaxed);
+    return level < 0 ? GetSupportedLevel() : SwizzleLevel(level);
+}
+
+void DX::SetSwizzleLevel(SwizzleLevel level)
+{
+    g_swizzleLevel.store(int(std::min(level, GetSupportedLevel())), std::memory_order_relaxed);
+}
+
+const char* DX::GetSwizzleLevelName(SwizzleLevel level)
+{
+    switch (level)
+    {
+    case SwizzleLevel::SSSE3:   return "SSSE3";
+    case SwizzleLevel::SSE2:    return "SSE2";
+    default:                    return "scalar";
+    }
+}
+
+void DX::SwizzleBGRAToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels)
+{
+    SwizzleBGRA(source, destination, pixels, 0);
+}
+
+void DX::SwizzleBGRXToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels)
+{
+    SwizzleBGRA(source, destination, pixels, 0xFF000000u);
+}
+
+void DX::ExpandRGBToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels)
+{
+    ExpandTriple(source, destination, pixels, false);
+}
+
+void DX::ExpandBGRToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels)
+{
+    ExpandTriple(source, destination, pixels, true);
+}
+
+void DX::ExpandGrayToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels)
+{
+    size_t done = 0;
+#if defined(IMG_SSE2)
+    if (GetSwizzleLevel() >= SwizzleLevel::SSE2)
+        done = ExpandGraySSE2(source, destination, pixels);
+#endif
+    for (size_t i = done; i < pixels; ++i)
+    {
+        Store32(destination + i * 4, source[i] * 0x00010101u | 0xFF000000u);
+    }
+}
+
+void DX::ExpandGrayAlphaToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels)
+{
+    size_t done = 0;
+#if defined(IMG_SSE2)
+    if (GetSwizzleLevel() >= SwizzleLevel::SSE2)
+        done = ExpandGrayAlphaSSE2(source, destination, pixels);
+#endif
+    for (size_t i = done; i < pixels; ++i)
+    {
+        Store32(destination + i * 4, source[i * 2] * 0x00010101u | uint32_t(source[i * 2 + 1]) << 24);
+    }
+}
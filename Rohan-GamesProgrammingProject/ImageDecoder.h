@@ -0,0 +1,82 @@
+//
+// ImageDecoder.h - Portable PNG, JPEG and BMP decoding to RGBA8
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace DX
+{
+    // Decoders for the image formats the game's content uses, in place of Windows Imaging
+    // Component, so images decode on any thread (WIC decoders are per-thread COM objects) and
+    // the offline tools read the same pixels the game does. Each decode is single-threaded and
+    // allocates only its output and scratch, so independent images decode concurrently on the
+    // job system. Everything is converted to 8-bit RGBA, as WICTextureLoader converts to
+    // 32bppRGBA:
+    //
+    //  - PNG: every colour type and bit depth, palettes, tRNS transparency and Adam7
+    //    interlacing. 16-bit channels keep their high byte.
+    //  - JPEG: baseline and progressive Huffman-coded, greyscale or YCbCr (or Adobe RGB) at any
+    //    subsampling, with restart intervals. The IDCT, upsampling and colour conversion are
+    //    those of libjpeg's defaults, so results match what other decoders give. Arithmetic
+    //    coding, 12-bit samples and CMYK are rejected.
+    //  - BMP: 1, 4, 8, 24 and 32-bit uncompressed, and 16 and 32-bit BI_BITFIELDS, bottom-up
+    //    or top-down. RLE is rejected.
+    //
+    // Damaged or unsupported files throw std::runtime_error; nothing is ever read or written
+    // out of range.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+
+    enum class ImageFileFormat
+    {
+        Unknown,
+        PNG,
+        JPEG,
+        BMP,
+    };
+
+    // Rows packed
+    struct DecodedImage
+    {
+        uint32_t                width = 0;
+        uint32_t                height = 0;
+        bool                    sRGB = false;   // the file says so: a PNG sRGB chunk or JPEG EXIF colour space
+        std::vector<uint8_t>    pixels;         // RGBA8
+    };
+
+    const uint32_t c_MaxImageDimension = 16384;
+
+    // By the file's magic number, not its name.
+    ImageFileFormat DetectImageFormat(const uint8_t* data, size_t size);
+
+    void DecodeImage(const uint8_t* data, size_t size, DecodedImage& image);
+    void DecodePNG(const uint8_t* data, size_t size, DecodedImage& image);
+    void DecodeJPEG(const uint8_t* data, size_t size, DecodedImage& image);
+    void DecodeBMP(const uint8_t* data, size_t size, DecodedImage& image);
+
+    // The pixel conversions the decoders finish with, vectorized with the widest instruction
+    // set the CPU has: SSSE3 byte shuffles, or SSE2 shifts and masks where a shuffle is not
+    // needed. SetSwizzleLevel lowers it, for benchmarks; levels the CPU lacks are ignored.
+    // Alpha is opaque wherever the source has none. Source and destination must not overlap.
+    enum class SwizzleLevel
+    {
+        Scalar,
+        SSE2,
+        SSSE3,
+    };
+
+    SwizzleLevel GetSwizzleLevel();
+    void SetSwizzleLevel(SwizzleLevel level);
+    const char* GetSwizzleLevelName(SwizzleLevel level);
+
+    void SwizzleBGRAToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels);
+    void SwizzleBGRXToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels);
+    void ExpandRGBToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels);
+    void ExpandBGRToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels);
+    void ExpandGrayToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels);
+    void ExpandGrayAlphaToRGBA(const uint8_t* source, uint8_t* destination, size_t pixels);
+}
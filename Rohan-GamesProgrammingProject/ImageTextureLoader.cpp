@@ -0,0 +1,169 @@
+//
+// ImageTextureLoader.cpp - Textures from PNG, JPEG and BMP files through ImageDecoder, in WICTextureLoader's shape
+//
+
+#include "pch.h"
+#include "ImageTextureLoader.h"
+
+#include <WICTextureLoader.h>
+
+using namespace DX;
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+    // As WICTextureLoader picks it
+    size_t GetMaxSize(ID3D11Device* device)
+    {
+        switch (device->GetFeatureLevel())
+        {
+        case D3D_FEATURE_LEVEL_9_1:
+        case D3D_FEATURE_LEVEL_9_2:
+            return 2048;
+
+        case D3D_FEATURE_LEVEL_9_3:
+            return 4096;
+
+        case D3D_FEATURE_LEVEL_10_0:
+        case D3D_FEATURE_LEVEL_10_1:
+            return 8192;
+
+        default:
+            return D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION;
+        }
+    }
+}
+
+HRESULT DX::CreateTextureFromImage(ID3D11Device* d3dDevice, ID3D11DeviceContext* d3dContext, DecodedImage const& image,
+    ID3D11Resource** texture, ID3D11ShaderResourceView** textureView, size_t maxsize) noexcept
+{
+    if (texture)
+    {
+        *texture = nullptr;
+    }
+    if (textureView)
+    {
+        *textureView = nullptr;
+    }
+
+    if (!d3dDevice || (!texture && !textureView) || image.pixels.size() != size_t(image.width) * image.height * 4)
+        return E_INVALIDARG;
+
+    if (!maxsize)
+    {
+        maxsize = GetMaxSize(d3dDevice);
+    }
+    if (!image.width || !image.height || image.width > maxsize || image.height > maxsize)
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+    const DXGI_FORMAT format = image.sRGB ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
+    const UINT rowPitch = image.width * 4;
+
+    UINT support = 0;
+    const bool autogen = d3dContext && textureView
+        && SUCCEEDED(d3dDevice->CheckFormatSupport(format, &support)) && (support & D3D11_FORMAT_SUPPORT_MIP_AUTOGEN);
+
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = image.width;
+    desc.Height = image.height;
+    desc.MipLevels = autogen ? 0 : 1;
+    desc.ArraySize = 1;
+    desc.Format = format;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = autogen ? D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET : D3D11_BIND_SHADER_RESOURCE;
+    desc.MiscFlags = autogen ? D3D11_RESOURCE_MISC_GENERATE_MIPS : 0;
+
+    D3D11_SUBRESOURCE_DATA initData = { image.pixels.data(), rowPitch, 0 };
+
+    ComPtr<ID3D11Texture2D> created;
+    HRESULT hr = d3dDevice->CreateTexture2D(&desc, autogen ? nullptr : &initData, created.GetAddressOf());
+    if (FAILED(hr))
+        return hr;
+
+    ComPtr<ID3D11ShaderResourceView> view;
+    if (textureView)
+    {
+        hr = d3dDevice->CreateShaderResourceView(created.Get(), nullptr, view.GetAddressOf());
+        if (FAILED(hr))
+            return hr;
+    }
+
+    if (autogen)
+    {
+        d3dContext->UpdateSubresource(created.Get(), 0, nullptr, image.pixels.data(), rowPitch, UINT(image.pixels.size()));
+        d3dContext->GenerateMips(view.Get());
+    }
+
+    if (texture)
+    {
+        *texture = created.Detach();
+    }
+    if (textureView)
+    {
+        *textureView = view.Detach();
+    }
+    return S_OK;
+}
+
+HRESULT DX::CreateImageTextureFromMemory(ID3D11Device* d3dDevice, ID3D11DeviceContext* d3dContext, const uint8_t* data, size_t dataSize,
+    ID3D11Resource** texture, ID3D11ShaderResourceView** textureView, size_t maxsize) noexcept
+{
+    if (!data || !dataSize)
+        return E_INVALIDARG;
+
+    if (DetectImageFormat(data, dataSize) == ImageFileFormat::Unknown)
+        return DirectX::CreateWICTextureFromMemory(d3dDevice, d3dContext, data, dataSize, texture, textureView, maxsize);
+
+    DecodedImage image;
+    try
+    {
+        DecodeImage(data, dataSize, image);
+    }
+    catch (std::bad_alloc const&)
+    {
+        return E_OUTOFMEMORY;
+    }
+    catch (...)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    return CreateTextureFromImage(d3dDevice, d3dContext, image, texture, textureView, maxsize);
+}
+
+HRESULT DX::CreateImageTextureFromFile(ID3D11Device* d3dDevice, ID3D11DeviceContext* d3dContext, const wchar_t* fileName,
+    ID3D11Resource** texture, ID3D11ShaderResourceView** textureView, size_t maxsize) noexcept
+{
+    if (!fileName)
+        return E_INVALIDARG;
+
+    std::vector<uint8_t> data;
+    try
+    {
+        data = DX::ReadData(fileName);
+    }
+    catch (std::bad_alloc const&)
+    {
+        return E_OUTOFMEMORY;
+    }
+    catch (...)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+    }
+
+    return CreateImageTextureFromMemory(d3dDevice, d3dContext, data.data(), data.size(), texture, textureView, maxsize);
+}
+
+HRESULT DX::CreateImageTextureFromMemory(ID3D11Device* d3dDevice, const uint8_t* data, size_t dataSize,
+    ID3D11Resource** texture, ID3D11ShaderResourceView** textureView, size_t maxsize) noexcept
+{
+    return CreateImageTextureFromMemory(d3dDevice, nullptr, data, dataSize, texture, textureView, maxsize);
+}
+
+HRESULT DX::CreateImageTextureFromFile(ID3D11Device* d3dDevice, const wchar_t* fileName,
+    ID3D11Resource** texture, ID3D11ShaderResourceView** textureView, size_t maxsize) noexcept
+{
+    return CreateImageTextureFromFile(d3dDevice, nullptr, fileName, texture, textureView, maxsize);
+}
@@ -0,0 +1,44 @@
+//
+// ImageTextureLoader.h - Textures from PNG, JPEG and BMP files through ImageDecoder, in WICTextureLoader's shape
+//
+
+#pragma once
+
+#include "ImageDecoder.h"
+
+namespace DX
+{
+    // Counterparts of DirectXTK's CreateWICTexture* functions, with the same defaults: one
+    // RGBA8 texture, sRGB when the file says so, and given a context (which, as there, must
+    // not be used by another thread meanwhile) a full mip chain generated on the GPU where the
+    // format allows. A maxsize of zero is the device's feature level's limit. Unlike WIC,
+    // oversized images fail with HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED) rather than being
+    // rescaled, and damaged ones with HRESULT_FROM_WIN32(ERROR_INVALID_DATA).
+    //
+    // Files in formats ImageDecoder does not read (TIFF, GIF, ...) are passed on to
+    // WICTextureLoader.
+    HRESULT CreateImageTextureFromMemory(_In_ ID3D11Device* d3dDevice,
+        _In_reads_bytes_(dataSize) const uint8_t* data, size_t dataSize,
+        _Outptr_opt_ ID3D11Resource** texture, _Outptr_opt_ ID3D11ShaderResourceView** textureView,
+        size_t maxsize = 0) noexcept;
+
+    HRESULT CreateImageTextureFromFile(_In_ ID3D11Device* d3dDevice, _In_z_ const wchar_t* fileName,
+        _Outptr_opt_ ID3D11Resource** texture, _Outptr_opt_ ID3D11ShaderResourceView** textureView,
+        size_t maxsize = 0) noexcept;
+
+    HRESULT CreateImageTextureFromMemory(_In_ ID3D11Device* d3dDevice, _In_opt_ ID3D11DeviceContext* d3dContext,
+        _In_reads_bytes_(dataSize) const uint8_t* data, size_t dataSize,
+        _Outptr_opt_ ID3D11Resource** texture, _Outptr_opt_ ID3D11ShaderResourceView** textureView,
+        size_t maxsize = 0) noexcept;
+
+    HRESULT CreateImageTextureFromFile(_In_ ID3D11Device* d3dDevice, _In_opt_ ID3D11DeviceContext* d3dContext,
+        _In_z_ const wchar_t* fileName,
+        _Outptr_opt_ ID3D11Resource** texture, _Outptr_opt_ ID3D11ShaderResourceView** textureView,
+        size_t maxsize = 0) noexcept;
+
+    // The upload half of the above, for an image decoded elsewhere, such as on a job.
+    HRESULT CreateTextureFromImage(_In_ ID3D11Device* d3dDevice, _In_opt_ ID3D11DeviceContext* d3dContext,
+        DecodedImage const& image,
+        _Outptr_opt_ ID3D11Resource** texture, _Outptr_opt_ ID3D11ShaderResourceView** textureView,
+        size_t maxsize = 0) noexcept;
+}
@@ -0,0 +1,389 @@
+//
+// Inflate.cpp - DEFLATE (zlib stream) decompression for PNG images
+//
+// Does not use the precompiled header, so the offline tools can build it.
+//
+
+#include "Inflate.h"
+
+#include <string.h>
+
+using namespace DX;
+
+namespace
+{
+    const unsigned c_FastBits = 9;
+    const unsigned c_MaxCodeBits = 15;
+    const unsigned c_EndOfBlock = 256;
+
+    const uint16_t c_LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67,
+        83, 99, 115, 131, 163, 195, 227, 258 };
+    const uint8_t c_LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5,
+        5, 5, 0 };
+    const uint16_t c_DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+        769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const uint8_t c_DistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+        11, 11, 12, 12, 13, 13 };
+
+    // The order code length code lengths are stored in, most used first
+    const uint8_t c_CodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    unsigned ReverseBits(unsigned code, unsigned bits)
+    {
+        unsigned reversed = 0;
+        for (unsigned i = 0; i < bits; ++i, code >>= 1)
+        {
+            reversed = (reversed << 1) | (code & 1);
+        }
+        return reversed;
+    }
+
+    // Bits come least significant first. Reads past the end of the input supply zeros, which
+    // is checked for once a block rather than on every bit.
+    class BitReader
+    {
+    public:
+        BitReader(const uint8_t* src, size_t srcSize) : m_next(src), m_end(src + srcSize), m_bits(0), m_count(0), m_padding(0) {}
+
+        // Afterwards at least 56 bits are buffered, enough for a length, a distance and their extra bits
+        void Refill()
+        {
+            if (m_end - m_next >= 8)
+            {
+                uint64_t word;
+                memcpy(&word, m_next, sizeof(word));    // little-endian, as every target is
+                m_bits |= word << m_count;
+                m_next += (63 - m_count) >> 3;
+                m_count |= 56;
+                return;
+            }
+            while (m_count <= 56)
+            {
+                if (m_next < m_end)
+                    m_bits |= uint64_t(*m_next++) << m_count;
+                else
+                    ++m_padding;
+                m_count += 8;
+            }
+        }
+
+        unsigned Peek(unsigned bits) const { return unsigned(m_bits & ((uint64_t(1) << bits) - 1)); }
+
+        void Consume(unsigned bits)
+        {
+            m_bits >>= bits;
+            m_count -= bits;
+        }
+
+        unsigned Read(unsigned bits)
+        {
+            unsigned value = Peek(bits);
+            Consume(bits);
+            return value;
+        }
+
+        // Stored blocks start on a byte boundary and are copied straight from the input
+        void AlignToByte() { Consume(m_count & 7); }
+
+        bool ReadStored(uint8_t* dst, size_t size)
+        {
+            // Whole bytes still buffered come first
+            while (size && m_count >= 8)
+            {
+                if (Overrun())
+                    return false;
+                *dst++ = uint8_t(Read(8));
+                --size;
+            }
+            if (Overrun() || size > size_t(m_end - m_next))
+                return false;
+            memcpy(dst, m_next, size);
+            m_next += size;
+
+            // Refill may have loaded the bytes just copied into the bits above m_count
+            if (!m_count)
+                m_bits = 0;
+            return true;
+        }
+
+        // Whether any of the zeros supplied past the end have been consumed
+        bool Overrun() const { return m_padding * 8 > m_count; }
+
+    private:
+        const uint8_t*  m_next;
+        const uint8_t*  m_end;
+        uint64_t        m_bits;
+        unsigned        m_count;
+        size_t          m_padding;
+    };
+
+    // Canonical Huffman code, decoded with a table of the codes up to c_FastBits long, indexed by
+    // their bit-reversed form (the stream stores codes most significant bit first), and for
+    // longer codes by comparing against the first code of each length.
+    struct Huffman
+    {
+        uint16_t    fast[1 << c_FastBits];      // (length << 9) | symbol; 0 when the code is longer
+        uint16_t    firstCode[c_MaxCodeBits + 1];
+        uint16_t    firstSymbol[c_MaxCodeBits + 1];
+        uint32_t    limit[c_MaxCodeBits + 2];   // first code of each length past the last, left-aligned to 16 bits
+        uint8_t     length[288];                // by sorted index
+        uint16_t    symbol[288];
+
+        bool Build(const uint8_t* lengths, unsigned count)
+        {
+            unsigned counts[c_MaxCodeBits + 1] = {};
+            for (unsigned i = 0; i < count; ++i)
+            {
+                ++counts[lengths[i]];
+            }
+            counts[0] = 0;
+
+            memset(fast, 0, sizeof(fast));
+            unsigned nextCode[c_MaxCodeBits + 1];
+            unsigned code = 0;
+            unsigned index = 0;
+            for (unsigned bits = 1; bits <= c_MaxCodeBits; ++bits)
+            {
+                nextCode[bits] = code;
+                firstCode[bits] = uint16_t(code);
+                firstSymbol[bits] = uint16_t(index);
+                code += counts[bits];
+                if (code > (1u << bits))
+                    return false;       // oversubscribed
+                limit[bits] = code << (16 - bits);
+                code <<= 1;
+                index += counts[bits];
+            }
+            limit[c_MaxCodeBits + 1] = 0x10000;
+
+            for (unsigned i = 0; i < count; ++i)
+            {
+                const unsigned bits = lengths[i];
+                if (!bits)
+                    continue;
+
+                const unsigned sorted = nextCode[bits] - firstCode[bits] + firstSymbol[bits];
+                length[sorted] = uint8_t(bits);
+                symbol[sorted] = uint16_t(i);
+                if (bits <= c_FastBits)
+                {
+                    const uint16_t entry = uint16_t((bits << 9) | i);
+                    for (unsigned j = ReverseBits(nextCode[bits], bits); j < (1u << c_FastBits); j += 1u << bits)
+                    {
+                        fast[j] = entry;
+                    }
+                }
+                ++nextCode[bits];
+            }
+            return true;
+        }
+
+        // Returns the symbol, or -1 for a code that is not in the table. At least 16 bits must be buffered.
+        int Decode(BitReader& reader) const
+        {
+            const unsigned entry = fast[reader.Peek(c_FastBits)];
+            if (entry)
+            {
+                reader.Consume(entry >> 9);
+                return int(entry & 511);
+            }
+
+            const unsigned code = ReverseBits(reader.Peek(16), 16);
+            unsigned bits = c_FastBits + 1;
+            while (code >= limit[bits])
+            {
+                ++bits;
+            }
+            if (bits > c_MaxCodeBits)
+                return -1;
+
+            const unsigned sorted = (code >> (16 - bits)) - firstCode[bits] + firstSymbol[bits];
+            if (sorted >= 288 || length[sorted] != bits)
+                return -1;
+            reader.Consume(bits);
+            return symbol[sorted];
+        }
+    };
+
+    bool ReadDynamicCodes(BitReader& reader, Huffman& literals, Huffman& distances)
+    {
+        reader.Refill();
+        const unsigned literalCount = reader.Read(5) + 257;
+        const unsigned distanceCount = reader.Read(5) + 1;
+        const unsigned codeLengthCount = reader.Read(4) + 4;
+        if (literalCount > 286 || distanceCount > 30)
+            return false;
+
+        uint8_t codeLengthLengths[19] = {};
+        for (unsigned i = 0; i < codeLengthCount; ++i)
+        {
+            if (i == 10)
+                reader.Refill();
+            codeLengthLengths[c_CodeLengthOrder[i]] = uint8_t(reader.Read(3));
+        }
+
+        Huffman codeLengths;
+        if (!codeLengths.Build(codeLengthLengths, 19))
+            return false;
+
+        // Literal and distance lengths are one sequence, and repeats may cross from one to the other
+        uint8_t lengths[286 + 30];
+        const unsigned total = literalCount + distanceCount;
+        for (unsigned n = 0; n < total; )
+        {
+            reader.Refill();
+            const int symbol = codeLengths.Decode(reader);
+            if (symbol < 0)
+                return false;
+
+            if (symbol < 16)
+            {
+                lengths[n++] = uint8_t(symbol);
+                continue;
+            }
+
+            unsigned repeat;
+            uint8_t value = 0;
+            if (symbol == 16)
+            {
+                if (!n)
+                    return false;
+                value = lengths[n - 1];
+                repeat = 3 + reader.Read(2);
+            }
+            else if (symbol == 17)
+            {
+                repeat = 3 + reader.Read(3);
+            }
+            else
+            {
+                repeat = 11 + reader.Read(7);
+            }
+            if (repeat > total - n)
+                return false;
+            memset(lengths + n, value, repeat);
+            n += repeat;
+        }
+
+        if (reader.Overrun() || !lengths[c_EndOfBlock])
+            return false;
+        return literals.Build(lengths, literalCount) && distances.Build(lengths + literalCount, distanceCount);
+    }
+
+    void BuildFixedCodes(Huffman& literals, Huffman& distances)
+    {
+        uint8_t lengths[288];
+        memset(lengths, 8, 144);
+        memset(lengths + 144, 9, 112);
+        memset(lengths + 256, 7, 24);
+        memset(lengths + 280, 8, 8);
+        literals.Build(lengths, 288);
+
+        memset(lengths, 5, 30);
+        distances.Build(lengths, 30);
+    }
+
+    bool InflateBlock(BitReader& reader, Huffman const& literals, Huffman const& distances,
+        uint8_t* dst, uint8_t*& out, uint8_t* outEnd)
+    {
+        for (;;)
+        {
+            reader.Refill();
+            const int symbol = literals.Decode(reader);
+            if (symbol < 0)
+                return false;
+
+            if (symbol < 256)
+            {
+                if (out == outEnd)
+                    return false;
+                *out++ = uint8_t(symbol);
+                continue;
+            }
+            if (symbol == c_EndOfBlock)
+                return !reader.Overrun();
+            if (symbol > 285)
+                return false;
+
+            const unsigned lengthCode = unsigned(symbol) - 257;
+            const size_t length = c_LengthBase[lengthCode] + reader.Read(c_LengthExtra[lengthCode]);
+
+            const int distanceCode = distances.Decode(reader);
+            if (distanceCode < 0 || distanceCode >= 30)
+                return false;
+            const size_t distance = c_DistanceBase[distanceCode] + reader.Read(c_DistanceExtra[distanceCode]);
+
+            if (distance > size_t(out - dst) || length > size_t(outEnd - out))
+                return false;
+
+            // Matches may overlap themselves, repeating the last distance bytes
+            const uint8_t* from = out - distance;
+            if (distance >= 8 && size_t(outEnd - out) >= length + 8)
+            {
+                uint8_t* end = out + length;
+                do
+                {
+                    memcpy(out, from, 8);
+                    out += 8;
+                    from += 8;
+                } while (out < end);
+                out = end;
+            }
+            else
+            {
+                for (size_t i = 0; i < length; ++i)
+                {
+                    out[i] = from[i];
+                }
+                out += length;
+            }
+        }
+    }
+}
+
+bool DX::ZlibDecompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+    // CMF and FLG: deflate with a window of at most 32 KB, no dictionary, and a check that
+    // makes the pair a multiple of 31
+    if (srcSize < 2)
+        return false;
+    const unsigned cmf = src[0];
+    const unsigned flg = src[1];
+    if ((cmf & 15) != 8 || (cmf >> 4) > 7 || (flg & 0x20) || ((cmf << 8) | flg) % 31)
+        return false;
+
+    BitReader reader(src + 2, srcSize - 2);
+    uint8_t* out = dst;
+    uint8_t* outEnd = dst + dstSize;
+
+    Huffman literals;
+    Huffman distances;
+    for (bool last = false; !last; )
+    {
+        reader.Refill();
+        last = reader.Read(1) != 0;
+        const unsigned type = reader.Read(2);
+
+        if (type == 0)
+        {
+            reader.AlignToByte();
+            const unsigned length = reader.Read(16);
+            const unsigned complement = reader.Read(16);
+            if ((length ^ 0xFFFF) != complement || length > size_t(outEnd - out))
+                return false;
+            if (!reader.ReadStored(out, length))
+                return false;
+            out += length;
+            continue;
+        }
+
+        if (type == 1)
+            BuildFixedCodes(literals, distances);
+        else if (type != 2 || !ReadDynamicCodes(reader, literals, distances))
+            return false;
+
+        if (!InflateBlock(reader, literals, distances, dst, out, outEnd))
+            return false;
+    }
+    return out == outEnd;
+}
@@ -0,0 +1,23 @@
+//
+// Inflate.h - DEFLATE (zlib stream) decompression for PNG images
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DX
+{
+    // A decoder for zlib streams (RFC 1950 around RFC 1951 DEFLATE data), as PNG stores its
+    // pixels. It decodes into a buffer whose size the caller already knows, which PNG's header
+    // gives, and is bounds-checked against both buffers like LZ4Decompress. Huffman codes up to
+    // nine bits long decode with one table lookup; longer ones fall back to a canonical search.
+    // Preset dictionaries are not supported, and the Adler-32 trailer is not checked.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+
+    // Decompresses exactly dstSize bytes. Returns false if the stream is malformed or does not
+    // decode to exactly dstSize bytes.
+    bool ZlibDecompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+}
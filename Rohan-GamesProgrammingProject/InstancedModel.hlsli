@@ -0,0 +1,16 @@
+cbuffer InstancedModelConstants : register(b0)
+{
+    float4x4 ViewProjection;
+    float4 LightDirection;      // xyz: direction the light travels
+    float4 LightColor;
+    float4 DiffuseColor;        // material diffuse and alpha
+    float4 TextureEnabled;      // x is 1 when the material has a diffuse texture
+}
+
+struct InstancedModelVSOutput
+{
+    float4 position : SV_Position;
+    float3 normal : NORMAL0;
+    float2 texCoord : TEXCOORD0;
+    float4 color : COLOR0;
+};
@@ -0,0 +1,22 @@
+Texture2D<float4> Texture : register(t0);
+sampler TextureSampler : register(s0);
+
+#include "InstancedModel.hlsli"
+
+float4 main(InstancedModelVSOutput pin) : SV_Target0
+{
+    float3 normal = normalize(pin.normal);
+    float diffuse = saturate(dot(normal, -LightDirection.xyz));
+
+    // The instance tint stands in for ambient light so each copy keeps its own colour
+    float4 color = DiffuseColor;
+    color.rgb *= pin.color.rgb + diffuse * LightColor.rgb;
+    color.a *= pin.color.a;
+
+    if (TextureEnabled.x > 0)
+    {
+        color *= Texture.Sample(TextureSampler, pin.texCoord);
+    }
+
+    return color;
+}
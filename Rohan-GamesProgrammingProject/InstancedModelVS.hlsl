@@ -0,0 +1,30 @@
+#include "InstancedModel.hlsli"
+
+struct VSInput
+{
+    float4 position : SV_Position;
+    float3 normal : NORMAL;
+    float2 texCoord : TEXCOORD0;
+
+    // Per-instance stream: the first three columns of the world matrix and a tint
+    float4 world0 : INSTANCE_TRANSFORM0;
+    float4 world1 : INSTANCE_TRANSFORM1;
+    float4 world2 : INSTANCE_TRANSFORM2;
+    float4 color : INSTANCE_COLOR0;
+};
+
+InstancedModelVSOutput main(VSInput vin)
+{
+    InstancedModelVSOutput vout;
+
+    float4 position = float4(vin.position.xyz, 1);
+    float3 worldPosition = float3(dot(position, vin.world0), dot(position, vin.world1), dot(position, vin.world2));
+    float3 worldNormal = float3(dot(vin.normal, vin.world0.xyz), dot(vin.normal, vin.world1.xyz), dot(vin.normal, vin.world2.xyz));
+
+    vout.position = mul(float4(worldPosition, 1), ViewProjection);
+    vout.normal = normalize(worldNormal);
+    vout.texCoord = vin.texCoord;
+    vout.color = vin.color;
+
+    return vout;
+}
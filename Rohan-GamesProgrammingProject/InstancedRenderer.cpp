@@ -0,0 +1,305 @@
+//
+// InstancedRenderer.cpp - Draws repeated cached models with one DrawIndexedInstanced per mesh part
+//
+
+#include "pch.h"
+#include "InstancedRenderer.h"
+#include "ReadContent.h"
+
+using namespace DirectX;
+using namespace DX;
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+    struct InstancedModelConstants
+    {
+        XMFLOAT4X4  viewProjection;
+        XMFLOAT4    lightDirection;
+        XMFLOAT4    lightColor;
+        XMFLOAT4    diffuseColor;
+        XMFLOAT4    textureEnabled;
+    };
+
+    static_assert(!(sizeof(InstancedModelConstants) % 16),
+        "InstancedModelConstants needs to be 16 bytes aligned");
+
+    const D3D11_INPUT_ELEMENT_DESC c_InstanceElements[] =
+    {
+        { "INSTANCE_TRANSFORM", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "INSTANCE_TRANSFORM", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "INSTANCE_TRANSFORM", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+        { "INSTANCE_COLOR",     0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    };
+
+    static_assert(sizeof(InstancedRenderer::Instance) == 64, "Instance must match c_InstanceElements");
+}
+
+// The IEffect ModelMeshPart::DrawInstanced applies: binds the instanced shaders, the
+// constants for the current part and its diffuse texture.
+class InstancedRenderer::InstancedEffect : public IEffect
+{
+public:
+    InstancedEffect(_In_ ID3D11Device* device, _In_opt_ const PackFile* pack) :
+        m_vertexShaderCode(DX::ReadContent(pack, L"InstancedModelVS.cso")),
+        m_constants{}
+    {
+        DX::ThrowIfFailed(device->CreateVertexShader(m_vertexShaderCode.data(), m_vertexShaderCode.size(),
+            nullptr, m_vertexShader.ReleaseAndGetAddressOf()));
+
+        auto blob = DX::ReadContent(pack, L"InstancedModelPS.cso");
+        DX::ThrowIfFailed(device->CreatePixelShader(blob.data(), blob.size(),
+            nullptr, m_pixelShader.ReleaseAndGetAddressOf()));
+
+        CD3D11_BUFFER_DESC cbDesc(sizeof(InstancedModelConstants), D3D11_BIND_CONSTANT_BUFFER);
+        DX::ThrowIfFailed(device->CreateBuffer(&cbDesc, nullptr,
+            m_constantBuffer.ReleaseAndGetAddressOf()));
+    }
+
+    void __cdecl Apply(_In_ ID3D11DeviceContext* context) override
+    {
+        context->UpdateSubresource(m_constantBuffer.Get(), 0, nullptr, &m_constants, sizeof(m_constants), 0);
+
+        context->VSSetShader(m_vertexShader.Get(), nullptr, 0);
+        context->PSSetShader(m_pixelShader.Get(), nullptr, 0);
+        context->VSSetConstantBuffers(0, 1, m_constantBuffer.GetAddressOf());
+        context->PSSetConstantBuffers(0, 1, m_constantBuffer.GetAddressOf());
+        context->PSSetShaderResources(0, 1, &m_texture);
+    }
+
+    void __cdecl GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _Out_ size_t* pByteCodeLength) override
+    {
+        *pShaderByteCode = m_vertexShaderCode.data();
+        *pByteCodeLength = m_vertexShaderCode.size();
+    }
+
+    void XM_CALLCONV SetFrame(FXMMATRIX viewProjection, FXMVECTOR lightDirection, FXMVECTOR lightColor)
+    {
+        XMStoreFloat4x4(&m_constants.viewProjection, XMMatrixTranspose(viewProjection));
+        XMStoreFloat4(&m_constants.lightDirection, XMVector3Normalize(lightDirection));
+        XMStoreFloat4(&m_constants.lightColor, lightColor);
+    }
+
+    void SetMaterial(const XMFLOAT3& diffuseColor, float alpha, ID3D11ShaderResourceView* texture)
+    {
+        m_constants.diffuseColor = XMFLOAT4(diffuseColor.x, diffuseColor.y, diffuseColor.z, alpha);
+        m_constants.textureEnabled = XMFLOAT4(texture ? 1.f : 0.f, 0.f, 0.f, 0.f);
+        m_texture = texture;
+    }
+
+private:
+    std::vector<uint8_t>                        m_vertexShaderCode;
+    ComPtr<ID3D11VertexShader>                  m_vertexShader;
+    ComPtr<ID3D11PixelShader>                   m_pixelShader;
+    ComPtr<ID3D11Buffer>                        m_constantBuffer;
+    InstancedModelConstants                     m_constants;
+    ID3D11ShaderResourceView*                   m_texture = nullptr;
+};
+
+InstancedRenderer::InstancedRenderer(ID3D11Device* device, IEffectFactory& fxFactory, const PackFile* pack,
+    TextureStreamer* textureStreamer) :
+    m_device(device),
+    m_fxFactory(fxFactory),
+    m_textureStreamer(textureStreamer),
+    m_instanceCapacity(0),
+    m_stats{}
+{
+    m_effect = std::make_unique<InstancedEffect>(device, pack);
+}
+
+InstancedRenderer::~InstancedRenderer()
+{
+}
+
+void InstancedRenderer::Begin()
+{
+    m_batches.clear();
+    m_batchLookup.clear();
+}
+
+void XM_CALLCONV InstancedRenderer::Add(std::shared_ptr<const ModelCache::Asset> const& asset, size_t meshIndex,
+    FXMMATRIX world, FXMVECTOR color, uint32_t lod)
+{
+    const ModelMesh* mesh = asset->prototype->meshes[meshIndex].get();
+    const ModelPartLod* lodParts = (lod > 0) ? asset->lods[meshIndex].GetParts(lod) : nullptr;
+
+    // A level's parts are unique to it, so they key its batch as the mesh keys its own
+    const void* key = lodParts ? static_cast<const void*>(lodParts) : mesh;
+    auto it = m_batchLookup.find(key);
+    if (it == m_batchLookup.end())
+    {
+        it = m_batchLookup.emplace(key, m_batches.size()).first;
+        m_batches.push_back({ asset, mesh, lodParts, {}, 0 });
+    }
+
+    Instance instance;
+    XMMATRIX columns = XMMatrixTranspose(XMLoadFloat4x4(&asset->positionTransforms[meshIndex]) * world);
+    XMStoreFloat4(&instance.world[0], columns.r[0]);
+    XMStoreFloat4(&instance.world[1], columns.r[1]);
+    XMStoreFloat4(&instance.world[2], columns.r[2]);
+    XMStoreFloat4(&instance.color, color);
+
+    m_batches[it->second].instances.push_back(instance);
+}
+
+void XM_CALLCONV InstancedRenderer::End(ID3D11DeviceContext* context, const CommonStates& states,
+    FXMMATRIX view, CXMMATRIX projection,
+    FXMVECTOR lightDirection, FXMVECTOR lightColor)
+{
+    m_stats = {};
+    if (m_batches.empty())
+        return;
+
+    // Lay every batch out back to back in the instance buffer
+    size_t total = 0;
+    for (auto& batch : m_batches)
+    {
+        batch.start = uint32_t(total);
+        total += batch.instances.size();
+    }
+
+    if (total > m_instanceCapacity)
+    {
+        size_t capacity = std::max<size_t>(m_instanceCapacity * 2, 256);
+        while (capacity < total)
+        {
+            capacity *= 2;
+        }
+
+        CD3D11_BUFFER_DESC desc(UINT(capacity * sizeof(Instance)), D3D11_BIND_VERTEX_BUFFER,
+            D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
+        DX::ThrowIfFailed(m_device->CreateBuffer(&desc, nullptr, m_instanceBuffer.ReleaseAndGetAddressOf()));
+        m_instanceCapacity = capacity;
+    }
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    DX::ThrowIfFailed(context->Map(m_instanceBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+    auto dest = static_cast<Instance*>(mapped.pData);
+    for (const auto& batch : m_batches)
+    {
+        memcpy(dest + batch.start, batch.instances.data(), batch.instances.size() * sizeof(Instance));
+    }
+    context->Unmap(m_instanceBuffer.Get(), 0);
+
+    UINT stride = sizeof(Instance);
+    UINT offset = 0;
+    context->IASetVertexBuffers(1, 1, m_instanceBuffer.GetAddressOf(), &stride, &offset);
+
+    m_effect->SetFrame(XMMatrixMultiply(view, projection), lightDirection, lightColor);
+
+    for (const auto& batch : m_batches)
+    {
+        DrawBatch(context, states, batch, false);
+    }
+
+    for (const auto& batch : m_batches)
+    {
+        DrawBatch(context, states, batch, true);
+    }
+
+    ID3D11Buffer* nullBuffer = nullptr;
+    context->IASetVertexBuffers(1, 1, &nullBuffer, &stride, &offset);
+
+    m_stats.instances = total;
+    m_stats.meshes = m_batches.size();
+}
+
+void InstancedRenderer::DrawBatch(ID3D11DeviceContext* context, const CommonStates& states, const Batch& batch, bool alpha)
+{
+    const auto instanceCount = uint32_t(batch.instances.size());
+
+    bool prepared = false;
+    for (size_t i = 0; i < batch.mesh->meshParts.size(); ++i)
+    {
+        const auto& part = batch.mesh->meshParts[i];
+        if (part->isAlpha != alpha)
+            continue;
+
+        if (!prepared)
+        {
+            batch.mesh->PrepareForRendering(context, states, alpha);
+            prepared = true;
+        }
+
+        auto material = batch.asset->FindMaterial(part->effect.get());
+        if (material)
+        {
+            m_effect->SetMaterial(material->info.diffuseColor, material->info.alpha, GetTexture(context, *material));
+        }
+        else
+        {
+            m_effect->SetMaterial(XMFLOAT3(1.f, 1.f, 1.f), 1.f, nullptr);
+        }
+
+        if (batch.lod)
+        {
+            // What ModelMeshPart::DrawInstanced binds, with the level's indices
+            const ModelPartLod& lod = batch.lod[i];
+            context->IASetInputLayout(GetInputLayout(*part));
+
+            UINT vbStride = part->vertexStride;
+            UINT vbOffset = 0;
+            context->IASetVertexBuffers(0, 1, part->vertexBuffer.GetAddressOf(), &vbStride, &vbOffset);
+            context->IASetIndexBuffer(lod.indexBuffer.Get(), lod.indexFormat, 0);
+
+            m_effect->Apply(context);
+
+            context->IASetPrimitiveTopology(part->primitiveType);
+            context->DrawIndexedInstanced(lod.indexCount, instanceCount, lod.startIndex, part->vertexOffset, batch.start);
+            m_stats.triangles += size_t(lod.indexCount / 3) * instanceCount;
+        }
+        else
+        {
+            part->DrawInstanced(context, m_effect.get(), GetInputLayout(*part), instanceCount, batch.start);
+            m_stats.triangles += size_t(part->indexCount / 3) * instanceCount;
+        }
+
+        ++m_stats.drawCalls;
+    }
+}
+
+ID3D11InputLayout* InstancedRenderer::GetInputLayout(const ModelMeshPart& part)
+{
+    auto& layout = m_inputLayouts[part.vbDecl.get()];
+    if (!layout)
+    {
+        if (!part.vbDecl || part.vbDecl->empty())
+            throw std::exception("InstancedRenderer: mesh part missing vertex buffer input elements data");
+
+        std::vector<D3D11_INPUT_ELEMENT_DESC> elements(*part.vbDecl);
+        elements.insert(elements.end(), std::begin(c_InstanceElements), std::end(c_InstanceElements));
+
+        void const* shaderByteCode;
+        size_t byteCodeLength;
+        m_effect->GetVertexShaderBytecode(&shaderByteCode, &byteCodeLength);
+
+        DX::ThrowIfFailed(m_device->CreateInputLayout(elements.data(), UINT(elements.size()),
+            shaderByteCode, byteCodeLength, layout.ReleaseAndGetAddressOf()));
+    }
+    return layout.Get();
+}
+
+ID3D11ShaderResourceView* InstancedRenderer::GetTexture(ID3D11DeviceContext* context, const ModelCache::Material& material)
+{
+    if (material.diffuseTexture.empty())
+        return nullptr;
+
+    // The streamer's view changes as mips come and go, so only the handle is kept
+    if (m_textureStreamer)
+    {
+        auto& streamed = m_streamedTextures[&material];
+        if (!streamed)
+        {
+            streamed = m_textureStreamer->Request(material.diffuseTexture.c_str());
+        }
+        return streamed->Get();
+    }
+
+    auto& texture = m_textures[&material];
+    if (!texture)
+    {
+        m_fxFactory.CreateTexture(material.diffuseTexture.c_str(), context, texture.ReleaseAndGetAddressOf());
+    }
+    return texture.Get();
+}
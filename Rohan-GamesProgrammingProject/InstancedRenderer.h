@@ -0,0 +1,95 @@
+//
+// InstancedRenderer.h - Draws repeated cached models with one DrawIndexedInstanced per mesh part
+//
+
+#pragma once
+
+#include "ModelCache.h"
+#include "TextureStreamer.h"
+
+#include <CommonStates.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace DX
+{
+    // Between Begin and End, Add queues a mesh of a cached asset at a world transform with a tint.
+    // End groups the queued instances by mesh, writes them all into one dynamic per-instance
+    // vertex buffer (bound to input slot 1) and draws each part of each mesh once, instanced.
+    // Parts use the InstancedModelVS/PS shaders with the material colour and diffuse texture
+    // the loader requested; the per-instance tint replaces the ambient term. Given a texture
+    // streamer, diffuse textures come from it and are bound at whatever mips are resident.
+    // Instances of a mesh at a coarser level of detail batch apart from those at its others.
+    class InstancedRenderer
+    {
+    public:
+        struct Instance
+        {
+            DirectX::XMFLOAT4   world[3];   // first three columns of the world matrix
+            DirectX::XMFLOAT4   color;
+        };
+
+        struct Statistics
+        {
+            size_t  instances;
+            size_t  meshes;         // distinct meshes and levels drawn
+            size_t  drawCalls;      // one per mesh part
+            size_t  triangles;
+        };
+
+        // The shaders come from the pack when it has them.
+        InstancedRenderer(_In_ ID3D11Device* device, DirectX::IEffectFactory& fxFactory, _In_opt_ const PackFile* pack = nullptr,
+            _In_opt_ TextureStreamer* textureStreamer = nullptr);
+
+        InstancedRenderer(InstancedRenderer const&) = delete;
+        InstancedRenderer& operator= (InstancedRenderer const&) = delete;
+
+        ~InstancedRenderer();
+
+        void Begin();
+        // 'lod' is a level of the asset's lods for the mesh, 0 drawing the mesh itself. The mesh's
+        // positionTransform is applied here, so 'world' is that of its model.
+        void XM_CALLCONV Add(std::shared_ptr<const ModelCache::Asset> const& asset, size_t meshIndex,
+            DirectX::FXMMATRIX world, DirectX::FXMVECTOR color, uint32_t lod = 0);
+        void XM_CALLCONV End(_In_ ID3D11DeviceContext* context, const DirectX::CommonStates& states,
+            DirectX::FXMMATRIX view, DirectX::CXMMATRIX projection,
+            DirectX::FXMVECTOR lightDirection, DirectX::FXMVECTOR lightColor);
+
+        // Counters for the last End()
+        const Statistics& GetStatistics() const { return m_stats; }
+
+    private:
+        class InstancedEffect;
+
+        struct Batch
+        {
+            std::shared_ptr<const ModelCache::Asset>    asset;
+            const DirectX::ModelMesh*                   mesh;
+            const ModelPartLod*                         lod;        // by part, or null at level 0
+            std::vector<Instance>                       instances;
+            uint32_t                                    start;
+        };
+
+        void DrawBatch(_In_ ID3D11DeviceContext* context, const DirectX::CommonStates& states, const Batch& batch, bool alpha);
+        ID3D11InputLayout* GetInputLayout(const DirectX::ModelMeshPart& part);
+        ID3D11ShaderResourceView* GetTexture(_In_ ID3D11DeviceContext* context, const ModelCache::Material& material);
+
+        Microsoft::WRL::ComPtr<ID3D11Device>                                            m_device;
+        DirectX::IEffectFactory&                                                        m_fxFactory;
+        TextureStreamer*                                                                m_textureStreamer;
+        std::unique_ptr<InstancedEffect>                                                m_effect;
+
+        Microsoft::WRL::ComPtr<ID3D11Buffer>                                            m_instanceBuffer;
+        size_t                                                                          m_instanceCapacity;
+
+        std::vector<Batch>                                                              m_batches;
+        std::unordered_map<const void*, size_t>                                         m_batchLookup;  // by mesh or level
+
+        std::unordered_map<const std::vector<D3D11_INPUT_ELEMENT_DESC>*, Microsoft::WRL::ComPtr<ID3D11InputLayout>> m_inputLayouts;
+        std::unordered_map<const ModelCache::Material*, Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>>        m_textures;
+        std::unordered_map<const ModelCache::Material*, TextureStreamer::TextureHandle>                         m_streamedTextures;
+
+        Statistics                                                                      m_stats;
+    };
+}
@@ -0,0 +1,1143 @@
+//
+// JPEGDecoder.cpp - Baseline and progressive JPEG decoding to RGBA8, declared in ImageDecoder.h
+//
+// Does not use the precompiled header, so the offline tools can build it.
+//
+
+#include "ImageDecoder.h"
+
+#include <algorithm>
+#include <limits.h>
+#include <stdexcept>
+#include <string.h>
+
+using namespace DX;
+
+namespace
+{
+    const unsigned c_FastBits = 9;
+    const unsigned c_MaxComponents = 3;
+
+    // Natural (row-major) position of each coefficient in zig-zag order. The extra entries let
+    // a damaged run step past the end without reading out of range.
+    const uint8_t c_ZigZag[64 + 16] =
+    {
+         0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+        12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+        35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+        58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+        63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63,
+    };
+
+    enum Marker
+    {
+        Marker_SOF0 = 0xC0,     // baseline
+        Marker_SOF1 = 0xC1,     // extended sequential, Huffman
+        Marker_SOF2 = 0xC2,     // progressive, Huffman
+        Marker_DHT = 0xC4,
+        Marker_JPG = 0xC8,      // reserved
+        Marker_DAC = 0xCC,      // arithmetic coding conditioning
+        Marker_SOF15 = 0xCF,
+        Marker_RST0 = 0xD0,
+        Marker_RST7 = 0xD7,
+        Marker_SOI = 0xD8,
+        Marker_EOI = 0xD9,
+        Marker_SOS = 0xDA,
+        Marker_DQT = 0xDB,
+        Marker_DRI = 0xDD,
+        Marker_APP0 = 0xE0,
+        Marker_APP1 = 0xE1,
+        Marker_APP14 = 0xEE,
+    };
+
+    [[noreturn]] void Damaged()
+    {
+        throw std::runtime_error("JPEG data is damaged");
+    }
+
+    unsigned ReadBE16(const uint8_t* p)
+    {
+        return (unsigned(p[0]) << 8) | p[1];
+    }
+
+    uint8_t Clamp(int64_t value)
+    {
+        return uint8_t(value < 0 ? 0 : value > 255 ? 255 : value);
+    }
+
+    // Entropy-coded data, most significant bit first, with the 0x00 stuffed after each 0xFF
+    // removed. At a marker it stops and supplies zeros, as libjpeg does, so a truncated scan
+    // decodes to flat blocks rather than failing.
+    class EntropyReader
+    {
+    public:
+        EntropyReader(const uint8_t* next, const uint8_t* end) : m_next(next), m_end(end), m_bits(0), m_count(0), m_atMarker(false) {}
+
+        // Afterwards at least 25 bits are buffered
+        void Fill()
+        {
+            while (m_count <= 24)
+            {
+                unsigned byte = 0;
+                if (!m_atMarker && m_next < m_end)
+                {
+                    byte = *m_next;
+                    if (byte == 0xFF)
+                    {
+                        const uint8_t* after = m_next + 1;
+                        while (after < m_end && *after == 0xFF)
+                        {
+                            ++after;    // fill bytes
+                        }
+                        if (after < m_end && *after == 0)
+                        {
+                            m_next = after + 1;
+                        }
+                        else
+                        {
+                            m_atMarker = true;
+                            byte = 0;
+                        }
+                    }
+                    else
+                    {
+                        ++m_next;
+                    }
+                }
+                m_bits |= uint32_t(byte) << (24 - m_count);
+                m_count += 8;
+            }
+        }
+
+        unsigned Peek(unsigned bits) const { return m_bits >> (32 - bits); }
+
+        void Consume(unsigned bits)
+        {
+            m_bits <<= bits;
+            m_count -= int(bits);
+        }
+
+        unsigned GetBits(unsigned bits)
+        {
+            if (!bits)
+                return 0;
+            if (m_count < int(bits))
+                Fill();
+            const unsigned value = Peek(bits);
+            Consume(bits);
+            return value;
+        }
+
+        // The JPEG sign convention: values below half the range are negative
+        int ReceiveExtend(unsigned bits)
+        {
+            const unsigned value = GetBits(bits);
+            return (bits && value < (1u << (bits - 1))) ? int(value) - int(1u << bits) + 1 : int(value);
+        }
+
+        // Forgets the buffered bits and steps past the restart marker that should come next.
+        // Any other marker stays put, and the rest of the scan reads as zeros.
+        void Restart()
+        {
+            m_bits = 0;
+            m_count = 0;
+            m_next = FindMarker();
+            m_atMarker = true;
+            if (m_end - m_next >= 2 && m_next[1] >= Marker_RST0 && m_next[1] <= Marker_RST7)
+            {
+                m_next += 2;
+                m_atMarker = false;
+            }
+        }
+
+        // The next marker, where the parser carries on once the scan is decoded
+        const uint8_t* FindMarker() const
+        {
+            const uint8_t* p = m_next;
+            while (m_end - p >= 2 && !(p[0] == 0xFF && p[1] != 0 && p[1] != 0xFF))
+            {
+                ++p;
+            }
+            return m_end - p >= 2 ? p : m_end;
+        }
+
+    private:
+        const uint8_t*  m_next;
+        const uint8_t*  m_end;
+        uint32_t        m_bits;
+        int             m_count;
+        bool            m_atMarker;
+    };
+
+    // Canonical Huffman code from a DHT segment; codes up to c_FastBits long decode with one
+    // lookup of the next bits, longer ones by comparing against the last code of each length.
+    struct HuffmanTable
+    {
+        bool        defined = false;
+        uint8_t     fast[1 << c_FastBits];      // index into values; 255 when the code is longer
+        uint8_t     sizes[257];
+        uint16_t    codes[256];
+        uint8_t     values[256];
+        uint32_t    limit[18];                  // left-aligned to 16 bits; past the last code of each length
+        int         delta[17];                  // values index minus code, per length
+
+        void Build(const uint8_t* counts, const uint8_t* symbols)
+        {
+            unsigned total = 0;
+            for (unsigned length = 1; length <= 16; ++length)
+            {
+                for (unsigned i = 0; i < counts[length - 1]; ++i)
+                {
+                    sizes[total++] = uint8_t(length);
+                }
+            }
+            sizes[total] = 0;
+            memcpy(values, symbols, total);
+
+            unsigned code = 0;
+            unsigned index = 0;
+            for (unsigned length = 1; length <= 16; ++length)
+            {
+                delta[length] = int(index) - int(code);
+                if (sizes[index] == length)
+                {
+                    while (sizes[index] == length)
+                    {
+                        codes[index++] = uint16_t(code++);
+                    }
+                    if (code - 1 >= (1u << length))
+                        Damaged();
+                }
+                limit[length] = code << (16 - length);
+                code <<= 1;
+            }
+            limit[17] = UINT_MAX;
+
+            memset(fast, 255, sizeof(fast));
+            for (unsigned i = 0; i < total; ++i)
+            {
+                const unsigned length = sizes[i];
+                if (length <= c_FastBits)
+                {
+                    const unsigned first = unsigned(codes[i]) << (c_FastBits - length);
+                    memset(fast + first, int(i), size_t(1) << (c_FastBits - length));
+                }
+            }
+            defined = true;
+        }
+
+        unsigned Decode(EntropyReader& reader) const
+        {
+            reader.Fill();
+            const unsigned index = fast[reader.Peek(c_FastBits)];
+            if (index < 255)
+            {
+                reader.Consume(sizes[index]);
+                return values[index];
+            }
+
+            const unsigned bits = reader.Peek(16);
+            unsigned length = c_FastBits + 1;
+            while (bits >= limit[length])
+            {
+                ++length;
+            }
+            if (length > 16)
+                Damaged();
+
+            const int sorted = int(bits >> (16 - length)) + delta[length];
+            if (sorted < 0 || sorted > 255)
+                Damaged();
+            reader.Consume(length);
+            return values[sorted];
+        }
+    };
+
+    struct Component
+    {
+        unsigned                id = 0;
+        unsigned                h = 1;                  // sampling factors
+        unsigned                v = 1;
+        unsigned                quantTable = 0;
+        unsigned                dcTable = 0;
+        unsigned                acTable = 0;
+        int                     dcPredictor = 0;        // wraps at 16 bits, as coefficients do
+
+        uint32_t                width = 0;              // samples, before upsampling
+        uint32_t                height = 0;
+        uint32_t                blocksWide = 0;         // padded to whole MCUs
+        uint32_t                blocksHigh = 0;
+        std::vector<uint8_t>    samples;                // blocksWide * 8 across
+        std::vector<int16_t>    coefficients;           // progressive only, 64 per block in natural order
+
+        size_t GetStride() const { return size_t(blocksWide) * 8; }
+    };
+
+    // libjpeg's fixed-point YCbCr to RGB tables (jdcolor.c)
+    struct ColorTables
+    {
+        int crR[256];
+        int cbB[256];
+        int crG[256];
+        int cbG[256];
+
+        ColorTables()
+        {
+            const int c_ScaleBits = 16;
+            const int c_Half = 1 << (c_ScaleBits - 1);
+            auto fix = [](double x) { return int(x * 65536.0 + 0.5); };
+            for (int i = 0; i < 256; ++i)
+            {
+                const int x = i - 128;
+                crR[i] = (fix(1.40200) * x + c_Half) >> c_ScaleBits;
+                cbB[i] = (fix(1.77200) * x + c_Half) >> c_ScaleBits;
+                crG[i] = -fix(0.71414) * x;
+                cbG[i] = -fix(0.34414) * x + c_Half;
+            }
+        }
+    };
+
+    // libjpeg's accurate integer IDCT (jidctint.c): 13-bit constants, two extra bits of
+    // precision between the passes. Columns whose AC terms are all zero take a shortcut. It
+    // works in 64 bits, which costs nothing on x64 and keeps damaged coefficients from
+    // overflowing.
+    void InverseDCT(const int64_t* in, uint8_t* out, size_t stride)
+    {
+        const int c_ConstBits = 13;
+        const int c_Pass1Bits = 2;
+
+        const int c_0_298631336 = 2446;
+        const int c_0_390180644 = 3196;
+        const int c_0_541196100 = 4433;
+        const int c_0_765366865 = 6270;
+        const int c_0_899976223 = 7373;
+        const int c_1_175875602 = 9633;
+        const int c_1_501321110 = 12299;
+        const int c_1_847759065 = 15137;
+        const int c_1_961570560 = 16069;
+        const int c_2_053119869 = 16819;
+        const int c_2_562915447 = 20995;
+        const int c_3_072711026 = 25172;
+
+        auto descale = [](int64_t x, int n) { return (x + (int64_t(1) << (n - 1))) >> n; };
+
+        int64_t workspace[64];
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                // Columns of the coefficients, then rows of the workspace
+                const int64_t* s = pass == 0 ? in + i : workspace + i * 8;
+                const int step = pass == 0 ? 8 : 1;
+                const int shift = pass == 0 ? c_ConstBits - c_Pass1Bits : c_ConstBits + c_Pass1Bits + 3;
+
+                int64_t result[8];
+                if (pass == 0 && !s[8] && !s[16] && !s[24] && !s[32] && !s[40] && !s[48] && !s[56])
+                {
+                    const int64_t dc = s[0] * (1 << c_Pass1Bits);
+                    std::fill(result, result + 8, dc);
+                }
+                else
+                {
+                    // Even part
+                    int64_t z2 = s[2 * step];
+                    int64_t z3 = s[6 * step];
+                    int64_t z1 = (z2 + z3) * c_0_541196100;
+                    int64_t tmp2 = z1 + z3 * -c_1_847759065;
+                    int64_t tmp3 = z1 + z2 * c_0_765366865;
+
+                    z2 = s[0];
+                    z3 = s[4 * step];
+                    if (pass == 1)
+                        z2 += 1 << (c_Pass1Bits + 2);   // rounding for the final descale, as libjpeg adds it
+                    int64_t tmp0 = (z2 + z3) * (1 << c_ConstBits);
+                    int64_t tmp1 = (z2 - z3) * (1 << c_ConstBits);
+
+                    const int64_t tmp10 = tmp0 + tmp3;
+                    const int64_t tmp13 = tmp0 - tmp3;
+                    const int64_t tmp11 = tmp1 + tmp2;
+                    const int64_t tmp12 = tmp1 - tmp2;
+
+                    // Odd part
+                    tmp0 = s[7 * step];
+                    tmp1 = s[5 * step];
+                    tmp2 = s[3 * step];
+                    tmp3 = s[1 * step];
+
+                    z1 = tmp0 + tmp3;
+                    z2 = tmp1 + tmp2;
+                    z3 = tmp0 + tmp2;
+                    int64_t z4 = tmp1 + tmp3;
+                    const int64_t z5 = (z3 + z4) * c_1_175875602;
+
+                    tmp0 *= c_0_298631336;
+                    tmp1 *= c_2_053119869;
+                    tmp2 *= c_3_072711026;
+                    tmp3 *= c_1_501321110;
+                    z1 *= -c_0_899976223;
+                    z2 *= -c_2_562915447;
+                    z3 = z3 * -c_1_961570560 + z5;
+                    z4 = z4 * -c_0_390180644 + z5;
+
+                    tmp0 += z1 + z3;
+                    tmp1 += z2 + z4;
+                    tmp2 += z2 + z3;
+                    tmp3 += z1 + z4;
+
+                    if (pass == 0)
+                    {
+                        result[0] = descale(tmp10 + tmp3, shift);
+                        result[7] = descale(tmp10 - tmp3, shift);
+                        result[1] = descale(tmp11 + tmp2, shift);
+                        result[6] = descale(tmp11 - tmp2, shift);
+                        result[2] = descale(tmp12 + tmp1, shift);
+                        result[5] = descale(tmp12 - tmp1, shift);
+                        result[3] = descale(tmp13 + tmp0, shift);
+                        result[4] = descale(tmp13 - tmp0, shift);
+                    }
+                    else
+                    {
+                        result[0] = (tmp10 + tmp3) >> shift;
+                        result[7] = (tmp10 - tmp3) >> shift;
+                        result[1] = (tmp11 + tmp2) >> shift;
+                        result[6] = (tmp11 - tmp2) >> shift;
+                        result[2] = (tmp12 + tmp1) >> shift;
+                        result[5] = (tmp12 - tmp1) >> shift;
+                        result[3] = (tmp13 + tmp0) >> shift;
+                        result[4] = (tmp13 - tmp0) >> shift;
+                    }
+                }
+
+                if (pass == 0)
+                {
+                    for (int k = 0; k < 8; ++k)
+                    {
+                        workspace[k * 8 + i] = result[k];
+                    }
+                }
+                else
+                {
+                    uint8_t* row = out + i * stride;
+                    for (int k = 0; k < 8; ++k)
+                    {
+                        row[k] = Clamp(result[k] + 128);
+                    }
+                }
+            }
+        }
+    }
+
+    class Decoder
+    {
+    public:
+        Decoder(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+        void Decode(DecodedImage& image);
+
+    private:
+        void ReadFrame(const uint8_t* segment, size_t length, bool progressive);
+        void ReadHuffmanTables(const uint8_t* segment, size_t length);
+        void ReadQuantTables(const uint8_t* segment, size_t length);
+        void ReadExif(const uint8_t* segment, size_t length);
+        size_t DecodeScan(const uint8_t* segment, size_t length, size_t dataOffset);
+        void DecodeBlock(EntropyReader& reader, Component& component, uint32_t bx, uint32_t by);
+        void DecodeDCFirst(EntropyReader& reader, Component& component, int16_t* block);
+        void DecodeACFirst(EntropyReader& reader, Component& component, int16_t* block);
+        void DecodeACRefine(EntropyReader& reader, Component& component, int16_t* block);
+        void FinishProgressive();
+        bool IsRGB() const;
+        void UpsampleRow(Component const& component, uint32_t y, uint8_t* out) const;
+        void WriteImage(DecodedImage& image) const;
+
+        const uint8_t*          m_data;
+        size_t                  m_size;
+
+        uint16_t                m_quant[4][64] = {};        // natural order
+        HuffmanTable            m_dc[4];
+        HuffmanTable            m_ac[4];
+        unsigned                m_restartInterval = 0;
+
+        uint32_t                m_width = 0;
+        uint32_t                m_height = 0;
+        bool                    m_progressive = false;
+        unsigned                m_componentCount = 0;
+        Component               m_components[c_MaxComponents];
+        unsigned                m_hMax = 1;
+        unsigned                m_vMax = 1;
+        uint32_t                m_mcusWide = 0;
+        uint32_t                m_mcusHigh = 0;
+
+        bool                    m_sawJFIF = false;
+        int                     m_adobeTransform = -1;      // from APP14; 0 is RGB, 1 YCbCr
+        bool                    m_sRGB = false;
+        bool                    m_scanned = false;
+
+        // The scan being decoded
+        unsigned                m_scanComponents[c_MaxComponents] = {};
+        unsigned                m_scanCount = 0;
+        unsigned                m_spectralStart = 0;
+        unsigned                m_spectralEnd = 63;
+        unsigned                m_approxHigh = 0;
+        unsigned                m_approxLow = 0;
+        uint32_t                m_endOfBandRun = 0;
+    };
+
+    void Decoder::ReadFrame(const uint8_t* segment, size_t length, bool progressive)
+    {
+        if (m_componentCount)
+            throw std::runtime_error("JPEG has more than one frame");
+        if (length < 6)
+            Damaged();
+        if (segment[0] != 8)
+            throw std::runtime_error("JPEG samples must be 8-bit");
+
+        m_progressive = progressive;
+        m_height = ReadBE16(segment + 1);
+        m_width = ReadBE16(segment + 3);
+        m_componentCount = segment[5];
+        if (!m_width || !m_height || m_width > c_MaxImageDimension || m_height > c_MaxImageDimension)
+            throw std::runtime_error("JPEG size is out of range");
+        if (m_componentCount != 1 && m_componentCount != 3)
+            throw std::runtime_error("JPEG must be greyscale or three-component colour");
+        if (length < 6 + m_componentCount * 3)
+            Damaged();
+
+        for (unsigned i = 0; i < m_componentCount; ++i)
+        {
+            auto& component = m_components[i];
+            component.id = segment[6 + i * 3];
+            component.h = segment[7 + i * 3] >> 4;
+            component.v = segment[7 + i * 3] & 15;
+            component.quantTable = segment[8 + i * 3];
+            if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4 || component.quantTable > 3)
+                Damaged();
+            m_hMax = std::max(m_hMax, component.h);
+            m_vMax = std::max(m_vMax, component.v);
+        }
+
+        m_mcusWide = (m_width + m_hMax * 8 - 1) / (m_hMax * 8);
+        m_mcusHigh = (m_height + m_vMax * 8 - 1) / (m_vMax * 8);
+        for (unsigned i = 0; i < m_componentCount; ++i)
+        {
+            auto& component = m_components[i];
+            if (m_hMax % component.h || m_vMax % component.v)
+                throw std::runtime_error("JPEG sampling factors are not supported");
+
+            component.width = (m_width * component.h + m_hMax - 1) / m_hMax;
+            component.height = (m_height * component.v + m_vMax - 1) / m_vMax;
+            component.blocksWide = m_mcusWide * component.h;
+            component.blocksHigh = m_mcusHigh * component.v;
+            component.samples.assign(component.GetStride() * component.blocksHigh * 8, 0);
+            if (progressive)
+                component.coefficients.assign(size_t(component.blocksWide) * component.blocksHigh * 64, 0);
+        }
+    }
+
+    void Decoder::ReadHuffmanTables(const uint8_t* segment, size_t length)
+    {
+        size_t offset = 0;
+        while (offset < length)
+        {
+            if (length - offset < 17)
+                Damaged();
+            const unsigned tableClass = segment[offset] >> 4;
+            const unsigned index = segment[offset] & 15;
+            if (tableClass > 1 || index > 3)
+                Damaged();
+
+            const uint8_t* counts = segment + offset + 1;
+            size_t total = 0;
+            for (unsigned i = 0; i < 16; ++i)
+            {
+                total += counts[i];
+            }
+            if (total > 256 || length - offset - 17 < total)
+                Damaged();
+
+            (tableClass ? m_ac : m_dc)[index].Build(counts, segment + offset + 17);
+            offset += 17 + total;
+        }
+    }
+
+    void Decoder::ReadQuantTables(const uint8_t* segment, size_t length)
+    {
+        size_t offset = 0;
+        while (offset < length)
+        {
+            const unsigned precision = segment[offset] >> 4;
+            const unsigned index = segment[offset] & 15;
+            const size_t tableSize = precision ? 128 : 64;
+            if (precision > 1 || index > 3 || length - offset - 1 < tableSize)
+                Damaged();
+
+            const uint8_t* values = segment + offset + 1;
+            for (unsigned i = 0; i < 64; ++i)
+            {
+                m_quant[index][c_ZigZag[i]] = uint16_t(precision ? ReadBE16(values + i * 2) : values[i]);
+            }
+            offset += 1 + tableSize;
+        }
+    }
+
+    // WIC reports System.Image.ColorSpace from the EXIF ColorSpace tag, which WICTextureLoader
+    // reads as sRGB when it is 1. It lives in the EXIF IFD, which IFD0 points to.
+    void Decoder::ReadExif(const uint8_t* segment, size_t length)
+    {
+        const unsigned c_ExifIFDTag = 0x8769;
+        const unsigned c_ColorSpaceTag = 0xA001;
+
+        if (length < 14 || memcmp(segment, "Exif\0\0", 6))
+            return;
+
+        const uint8_t* tiff = segment + 6;
+        const size_t size = length - 6;
+        const bool little = tiff[0] == 'I' && tiff[1] == 'I';
+        if (!little && !(tiff[0] == 'M' && tiff[1] == 'M'))
+            return;
+
+        auto read16 = [&](size_t offset) -> unsigned
+        {
+            return little ? unsigned(tiff[offset]) | (unsigned(tiff[offset + 1]) << 8) : ReadBE16(tiff + offset);
+        };
+        auto read32 = [&](size_t offset) -> uint32_t
+        {
+            return little ? read16(offset) | (uint32_t(read16(offset + 2)) << 16) : (uint32_t(read16(offset)) << 16) | read16(offset + 2);
+        };
+
+        // The value of a tag in an IFD, or 0 when it is missing
+        auto findTag = [&](uint32_t ifd, unsigned tag) -> uint32_t
+        {
+            if (ifd > size || size - ifd < 2)
+                return 0;
+            const unsigned entries = read16(ifd);
+            for (unsigned i = 0; i < entries; ++i)
+            {
+                const size_t entry = ifd + 2 + size_t(i) * 12;
+                if (entry + 12 > size)
+                    return 0;
+                if (read16(entry) == tag)
+                    return read16(entry + 2) == 3 ? read16(entry + 8) : read32(entry + 8);   // SHORT or LONG
+            }
+            return 0;
+        };
+
+        const uint32_t exifIFD = findTag(read32(4), c_ExifIFDTag);
+        if (exifIFD)
+            m_sRGB = findTag(exifIFD, c_ColorSpaceTag) == 1;
+    }
+
+    void Decoder::DecodeDCFirst(EntropyReader& reader, Component& component, int16_t* block)
+    {
+        const auto& table = m_dc[component.dcTable];
+        const unsigned bits = table.Decode(reader);
+        if (bits > 16)
+            Damaged();
+        component.dcPredictor = int16_t(component.dcPredictor + reader.ReceiveExtend(bits));
+        block[0] = int16_t(component.dcPredictor * (1 << m_approxLow));
+    }
+
+    void Decoder::DecodeACFirst(EntropyReader& reader, Component& component, int16_t* block)
+    {
+        if (m_endOfBandRun)
+        {
+            --m_endOfBandRun;
+            return;
+        }
+
+        const auto& table = m_ac[component.acTable];
+        for (unsigned k = m_spectralStart; k <= m_spectralEnd; )
+        {
+            const unsigned rs = table.Decode(reader);
+            const unsigned run = rs >> 4;
+            const unsigned bits = rs & 15;
+            if (!bits)
+            {
+                if (run < 15)
+                {
+                    m_endOfBandRun = (1u << run) - 1 + reader.GetBits(run);
+                    return;
+                }
+                k += 16;
+                continue;
+            }
+            k += run;
+            block[c_ZigZag[k]] = int16_t(reader.ReceiveExtend(bits) * (1 << m_approxLow));
+            ++k;
+        }
+    }
+
+    // Adds the next bit to coefficients already nonzero while it skips zero ones (jdphuff.c)
+    void Decoder::DecodeACRefine(EntropyReader& reader, Component& component, int16_t* block)
+    {
+        const int plus = 1 << m_approxLow;
+        const int minus = -plus;
+
+        auto refine = [&](int16_t& coefficient)
+        {
+            if (reader.GetBits(1) && !(coefficient & plus))
+                coefficient = int16_t(coefficient + (coefficient >= 0 ? plus : minus));
+        };
+
+        unsigned k = m_spectralStart;
+        if (!m_endOfBandRun)
+        {
+            const auto& table = m_ac[component.acTable];
+            for (; k <= m_spectralEnd; ++k)
+            {
+                const unsigned rs = table.Decode(reader);
+                int run = int(rs >> 4);
+                const unsigned bits = rs & 15;
+                int value = 0;
+                if (bits)
+                {
+                    if (bits != 1)
+                        Damaged();
+                    value = reader.GetBits(1) ? plus : minus;
+                }
+                else if (run != 15)
+                {
+                    m_endOfBandRun = (1u << run) + reader.GetBits(unsigned(run));
+                    break;
+                }
+
+                // Skip run zero coefficients, refining the nonzero ones on the way
+                for (; k <= m_spectralEnd; ++k)
+                {
+                    int16_t& coefficient = block[c_ZigZag[k]];
+                    if (coefficient)
+                        refine(coefficient);
+                    else if (--run < 0)
+                        break;
+                }
+                if (value && k <= m_spectralEnd)
+                    block[c_ZigZag[k]] = int16_t(value);
+            }
+        }
+
+        if (m_endOfBandRun)
+        {
+            for (; k <= m_spectralEnd; ++k)
+            {
+                int16_t& coefficient = block[c_ZigZag[k]];
+                if (coefficient)
+                    refine(coefficient);
+            }
+            --m_endOfBandRun;
+        }
+    }
+
+    void Decoder::DecodeBlock(EntropyReader& reader, Component& component, uint32_t bx, uint32_t by)
+    {
+        if (m_progressive)
+        {
+            int16_t* block = component.coefficients.data() + (size_t(by) * component.blocksWide + bx) * 64;
+            if (m_spectralStart == 0)
+            {
+                if (m_approxHigh == 0)
+                    DecodeDCFirst(reader, component, block);
+                else if (reader.GetBits(1))
+                    block[0] = int16_t(block[0] | (1 << m_approxLow));
+            }
+            else if (m_approxHigh == 0)
+            {
+                DecodeACFirst(reader, component, block);
+            }
+            else
+            {
+                DecodeACRefine(reader, component, block);
+            }
+            return;
+        }
+
+        // Baseline blocks are dequantized and transformed straight away
+        const uint16_t* quant = m_quant[component.quantTable];
+        int64_t coefficients[64] = {};
+
+        const unsigned dcBits = m_dc[component.dcTable].Decode(reader);
+        if (dcBits > 16)
+            Damaged();
+        component.dcPredictor = int16_t(component.dcPredictor + reader.ReceiveExtend(dcBits));
+        coefficients[0] = int64_t(component.dcPredictor) * quant[0];
+
+        const auto& table = m_ac[component.acTable];
+        for (unsigned k = 1; k < 64; )
+        {
+            const unsigned rs = table.Decode(reader);
+            const unsigned bits = rs & 15;
+            if (!bits)
+            {
+                if (rs != 0xF0)
+                    break;      // end of block
+                k += 16;
+                continue;
+            }
+            k += rs >> 4;
+            const unsigned n = c_ZigZag[k];
+            coefficients[n] = int64_t(reader.ReceiveExtend(bits)) * quant[n];
+            ++k;
+        }
+
+        InverseDCT(coefficients, component.samples.data() + size_t(by) * 8 * component.GetStride() + bx * 8, component.GetStride());
+    }
+
+    // Returns the offset of the marker after the scan's data
+    size_t Decoder::DecodeScan(const uint8_t* segment, size_t length, size_t dataOffset)
+    {
+        if (!m_componentCount)
+            throw std::runtime_error("JPEG scan comes before its frame");
+        if (length < 1 || length < 4 + size_t(segment[0]) * 2)
+            Damaged();
+
+        m_scanCount = segment[0];
+        if (!m_scanCount || m_scanCount > m_componentCount)
+            Damaged();
+        for (unsigned i = 0; i < m_scanCount; ++i)
+        {
+            const unsigned id = segment[1 + i * 2];
+            const unsigned tables = segment[2 + i * 2];
+            unsigned c = 0;
+            while (c < m_componentCount && m_components[c].id != id)
+            {
+                ++c;
+            }
+            if (c == m_componentCount)
+                Damaged();
+            m_scanComponents[i] = c;
+            m_components[c].dcTable = tables >> 4;
+            m_components[c].acTable = tables & 15;
+            if (m_components[c].dcTable > 3 || m_components[c].acTable > 3)
+                Damaged();
+        }
+
+        const uint8_t* spectral = segment + 1 + m_scanCount * 2;
+        m_spectralStart = spectral[0];
+        m_spectralEnd = spectral[1];
+        m_approxHigh = spectral[2] >> 4;
+        m_approxLow = spectral[2] & 15;
+        if (m_progressive)
+        {
+            if (m_spectralStart > m_spectralEnd || m_spectralEnd > 63 || m_approxLow > 13 ||
+                (m_spectralStart == 0 && m_spectralEnd != 0) || (m_spectralStart > 0 && m_scanCount != 1))
+                Damaged();
+        }
+        else
+        {
+            m_spectralStart = 0;
+            m_spectralEnd = 63;
+            m_approxHigh = m_approxLow = 0;
+        }
+
+        // Each scan must have the tables it decodes with
+        for (unsigned i = 0; i < m_scanCount; ++i)
+        {
+            auto const& component = m_components[m_scanComponents[i]];
+            const bool needsDC = m_spectralStart == 0 && m_approxHigh == 0;
+            const bool needsAC = m_spectralEnd > 0 && !(m_progressive && m_spectralStart == 0);
+            if ((needsDC && !m_dc[component.dcTable].defined) || (needsAC && !m_ac[component.acTable].defined))
+                throw std::runtime_error("JPEG Huffman table is missing");
+        }
+
+        for (auto& component : m_components)
+        {
+            component.dcPredictor = 0;
+        }
+        m_endOfBandRun = 0;
+        m_scanned = true;
+
+        // A scan of one component covers just its blocks in the image, one block an MCU;
+        // interleaved scans cover whole MCUs.
+        const bool single = m_scanCount == 1;
+        auto& first = m_components[m_scanComponents[0]];
+        const uint32_t mcusWide = single ? (first.width + 7) / 8 : m_mcusWide;
+        const uint32_t mcusHigh = single ? (first.height + 7) / 8 : m_mcusHigh;
+
+        EntropyReader reader(m_data + dataOffset, m_data + m_size);
+        unsigned untilRestart = m_restartInterval;
+        for (uint32_t my = 0; my < mcusHigh; ++my)
+        {
+            for (uint32_t mx = 0; mx < mcusWide; ++mx)
+            {
+                if (single)
+                {
+                    DecodeBlock(reader, first, mx, my);
+                }
+                else
+                {
+                    for (unsigned i = 0; i < m_scanCount; ++i)
+                    {
+                        auto& component = m_components[m_scanComponents[i]];
+                        for (unsigned by = 0; by < component.v; ++by)
+                        {
+                            for (unsigned bx = 0; bx < component.h; ++bx)
+                            {
+                                DecodeBlock(reader, component, mx * component.h + bx, my * component.v + by);
+                            }
+                        }
+                    }
+                }
+
+                const bool last = my + 1 == mcusHigh && mx + 1 == mcusWide;
+                if (m_restartInterval && !--untilRestart && !last)
+                {
+                    reader.Restart();
+                    for (auto& component : m_components)
+                    {
+                        component.dcPredictor = 0;
+                    }
+                    m_endOfBandRun = 0;
+                    untilRestart = m_restartInterval;
+                }
+            }
+        }
+        return size_t(reader.FindMarker() - m_data);
+    }
+
+    void Decoder::FinishProgressive()
+    {
+        for (unsigned c = 0; c < m_componentCount; ++c)
+        {
+            auto& component = m_components[c];
+            const uint16_t* quant = m_quant[component.quantTable];
+            for (uint32_t by = 0; by < component.blocksHigh; ++by)
+            {
+                for (uint32_t bx = 0; bx < component.blocksWide; ++bx)
+                {
+                    const int16_t* block = component.coefficients.data() + (size_t(by) * component.blocksWide + bx) * 64;
+                    int64_t coefficients[64];
+                    for (unsigned i = 0; i < 64; ++i)
+                    {
+                        coefficients[i] = int64_t(block[i]) * quant[i];
+                    }
+                    InverseDCT(coefficients, component.samples.data() + size_t(by) * 8 * component.GetStride() + bx * 8, component.GetStride());
+                }
+            }
+            std::vector<int16_t>().swap(component.coefficients);
+        }
+    }
+
+    // One row of a component at full resolution. 2:1 ratios use libjpeg's "fancy" triangle
+    // filters, which centre each chroma sample between the luma samples it covers; other
+    // ratios, and components too narrow for the filter, replicate samples as libjpeg does.
+    void Decoder::UpsampleRow(Component const& component, uint32_t y, uint8_t* out) const
+    {
+        const unsigned hScale = m_hMax / component.h;
+        const unsigned vScale = m_vMax / component.v;
+        const size_t stride = component.GetStride();
+        const uint32_t width = component.width;
+        const uint32_t sourceY = y / vScale;
+        const uint8_t* near = component.samples.data() + sourceY * stride;
+
+        const bool fancy = width > 2 && (hScale == 1 || hScale == 2) && (vScale == 1 || vScale == 2);
+        if (!fancy || (hScale == 1 && vScale == 1))
+        {
+            for (uint32_t x = 0; x < m_width; ++x)
+            {
+                out[x] = near[x / hScale];
+            }
+            return;
+        }
+
+        // Vertically the nearer row weighs 3 and the other 1; rows past the edges repeat it
+        const uint8_t* far = near;
+        bool upper = true;
+        if (vScale == 2)
+        {
+            upper = y % 2 == 0;
+            const uint32_t farY = upper ? (sourceY ? sourceY - 1 : 0) : std::min(sourceY + 1, component.height - 1);
+            far = component.samples.data() + farY * stride;
+        }
+
+        if (hScale == 1)
+        {
+            const int bias = upper ? 1 : 2;
+            for (uint32_t x = 0; x < m_width; ++x)
+            {
+                out[x] = uint8_t((near[x] * 3 + far[x] + bias) >> 2);
+            }
+            return;
+        }
+
+        uint8_t columns[2 * c_MaxImageDimension + 2];
+        if (vScale == 1)
+        {
+            columns[0] = near[0];
+            columns[1] = uint8_t((near[0] * 3 + near[1] + 2) >> 2);
+            for (uint32_t x = 1; x + 1 < width; ++x)
+            {
+                columns[x * 2] = uint8_t((near[x] * 3 + near[x - 1] + 1) >> 2);
+                columns[x * 2 + 1] = uint8_t((near[x] * 3 + near[x + 1] + 2) >> 2);
+            }
+            columns[width * 2 - 2] = uint8_t((near[width - 1] * 3 + near[width - 2] + 1) >> 2);
+            columns[width * 2 - 1] = near[width - 1];
+        }
+        else
+        {
+            auto sum = [&](uint32_t x) { return near[x] * 3 + far[x]; };
+            columns[0] = uint8_t((sum(0) * 4 + 8) >> 4);
+            columns[1] = uint8_t((sum(0) * 3 + sum(1) + 7) >> 4);
+            for (uint32_t x = 1; x + 1 < width; ++x)
+            {
+                columns[x * 2] = uint8_t((sum(x) * 3 + sum(x - 1) + 8) >> 4);
+                columns[x * 2 + 1] = uint8_t((sum(x) * 3 + sum(x + 1) + 7) >> 4);
+            }
+            columns[width * 2 - 2] = uint8_t((sum(width - 1) * 3 + sum(width - 2) + 8) >> 4);
+            columns[width * 2 - 1] = uint8_t((sum(width - 1) * 4 + 7) >> 4);
+        }
+        memcpy(out, columns, m_width);
+    }
+
+    // Three components are YCbCr unless Adobe's marker says otherwise, or, without it or a
+    // JFIF marker, their ids spell RGB; libjpeg guesses the same way.
+    bool Decoder::IsRGB() const
+    {
+        if (m_adobeTransform >= 0)
+            return m_adobeTransform == 0;
+        return !m_sawJFIF && m_components[0].id == 'R' && m_components[1].id == 'G' && m_components[2].id == 'B';
+    }
+
+    void Decoder::WriteImage(DecodedImage& image) const
+    {
+        static const ColorTables s_tables;
+
+        image.width = m_width;
+        image.height = m_height;
+        image.sRGB = m_sRGB;
+        image.pixels.resize(size_t(m_width) * m_height * 4);
+
+        const bool rgb = m_componentCount == 3 && IsRGB();
+        std::vector<uint8_t> rows(size_t(m_width) * m_componentCount);
+        for (uint32_t y = 0; y < m_height; ++y)
+        {
+            uint8_t* out = image.pixels.data() + size_t(y) * m_width * 4;
+            for (unsigned c = 0; c < m_componentCount; ++c)
+            {
+                UpsampleRow(m_components[c], y, rows.data() + size_t(c) * m_width);
+            }
+
+            const uint8_t* c0 = rows.data();
+            if (m_componentCount == 1)
+            {
+                ExpandGrayToRGBA(c0, out, m_width);
+                continue;
+            }
+
+            const uint8_t* c1 = c0 + m_width;
+            const uint8_t* c2 = c1 + m_width;
+            if (rgb)
+            {
+                for (uint32_t x = 0; x < m_width; ++x)
+                {
+                    out[x * 4 + 0] = c0[x];
+                    out[x * 4 + 1] = c1[x];
+                    out[x * 4 + 2] = c2[x];
+                    out[x * 4 + 3] = 0xFF;
+                }
+                continue;
+            }
+
+            for (uint32_t x = 0; x < m_width; ++x)
+            {
+                const int luma = c0[x];
+                out[x * 4 + 0] = Clamp(luma + s_tables.crR[c2[x]]);
+                out[x * 4 + 1] = Clamp(luma + ((s_tables.cbG[c1[x]] + s_tables.crG[c2[x]]) >> 16));
+                out[x * 4 + 2] = Clamp(luma + s_tables.cbB[c1[x]]);
+                out[x * 4 + 3] = 0xFF;
+            }
+        }
+    }
+
+    void Decoder::Decode(DecodedImage& image)
+    {
+        size_t offset = 2;
+        for (;;)
+        {
+            // A file that ends without its EOI still decodes, as far as its scans go
+            if (m_size - offset < 2)
+            {
+                if (!m_scanned)
+                    throw std::runtime_error("JPEG file is truncated");
+                break;
+            }
+            if (m_data[offset] != 0xFF)
+            {
+                ++offset;       // garbage between segments, which libjpeg skips too
+                continue;
+            }
+            const unsigned marker = m_data[offset + 1];
+            offset += 2;
+            if (marker == 0xFF)
+            {
+                --offset;       // fill byte
+                continue;
+            }
+            if (marker == Marker_EOI)
+                break;
+            if (marker == Marker_SOI || (marker >= Marker_RST0 && marker <= Marker_RST7) || marker == 0)
+                continue;
+
+            if (m_size - offset < 2)
+                Damaged();
+            const size_t length = ReadBE16(m_data + offset);
+            if (length < 2 || length > m_size - offset)
+                Damaged();
+            const uint8_t* segment = m_data + offset + 2;
+            const size_t segmentLength = length - 2;
+            offset += length;
+
+            switch (marker)
+            {
+            case Marker_SOF0:
+            case Marker_SOF1:
+                ReadFrame(segment, segmentLength, false);
+                break;
+            case Marker_SOF2:
+                ReadFrame(segment, segmentLength, true);
+                break;
+            case Marker_DHT:
+                ReadHuffmanTables(segment, segmentLength);
+                break;
+            case Marker_DQT:
+                ReadQuantTables(segment, segmentLength);
+                break;
+            case Marker_DRI:
+                if (segmentLength < 2)
+                    Damaged();
+                m_restartInterval = ReadBE16(segment);
+                break;
+            case Marker_SOS:
+                offset = DecodeScan(segment, segmentLength, offset);
+                break;
+            case Marker_APP0:
+                m_sawJFIF = m_sawJFIF || (segmentLength >= 5 && !memcmp(segment, "JFIF", 5));
+                break;
+            case Marker_APP1:
+                ReadExif(segment, segmentLength);
+                break;
+            case Marker_APP14:
+                if (segmentLength >= 12 && !memcmp(segment, "Adobe", 5))
+                    m_adobeTransform = segment[11];
+                break;
+            default:
+                // The other frame types are lossless, hierarchical or arithmetic coded
+                if (marker > Marker_SOF2 && marker <= Marker_SOF15 && marker != Marker_DHT && marker != Marker_JPG && marker != Marker_DAC)
+                    throw std::runtime_error("JPEG coding process is not supported");
+                break;     // other APPn, COM and the rest carry nothing the decoder needs
+            }
+        }
+
+        if (!m_scanned)
+            throw std::runtime_error("JPEG has no image data");
+        if (m_progressive)
+            FinishProgressive();
+        WriteImage(image);
+    }
+}
+
+void DX::DecodeJPEG(const uint8_t* data, size_t size, DecodedImage& image)
+{
+    if (DetectImageFormat(data, size) != ImageFileFormat::JPEG)
+        throw std::runtime_error("not a JPEG file");
+
+    Decoder decoder(data, size);
+    decoder.Decode(image);
+}
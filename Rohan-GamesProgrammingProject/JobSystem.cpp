@@ -0,0 +1,438 @@
+//
+// JobSystem.cpp - Work-stealing job scheduler with dependencies and main-thread jobs
+//
+// Does not use the precompiled header, so the offline tools can build it.
+//
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
+using namespace DX;
+
+class JobSystem::Job
+{
+public:
+    Job(std::function<void()>&& work, Affinity affinity) :
+        work(std::move(work)),
+        affinity(affinity),
+        pending(1),
+        done(false)
+    {
+    }
+
+    std::function<void()>   work;
+    Affinity                affinity;
+    std::atomic<int>        pending;        // unfinished dependencies, plus one while submitting
+    std::atomic<bool>       done;
+
+    std::mutex              mutex;          // guards dependents and error
+    std::vector<Handle>     dependents;
+    std::exception_ptr      error;
+};
+
+namespace
+{
+    // Which queue of which system the current thread owns.
+    thread_local const JobSystem*   t_system = nullptr;
+    thread_local size_t             t_queue = 0;
+
+    // For debuggers and tools such as perf; Linux allows 15 characters
+    void NameThread(const char* name)
+    {
+#if defined(__linux__)
+        pthread_setname_np(pthread_self(), name);
+#else
+        (void)name;
+#endif
+    }
+}
+
+unsigned JobSystem::DefaultWorkerCount()
+{
+    unsigned threads = std::thread::hardware_concurrency();
+    return (threads > 1) ? threads - 1 : 0;
+}
+
+JobSystem::JobSystem(unsigned workerCount, ThreadStart threadStart) :
+    m_mainThread(std::this_thread::get_id()),
+    m_threadStart(std::move(threadStart)),
+    m_queuedAny(0),
+    m_queuedMain(0),
+    m_sleeping(0),
+    m_stop(false),
+    m_executed(0),
+    m_stolen(0),
+    m_executedMain(0)
+{
+    for (unsigned i = 0; i <= workerCount; ++i)
+    {
+        m_queues.emplace_back(new Queue);
+    }
+
+    t_system = this;
+    t_queue = 0;
+
+    m_workers.reserve(workerCount);
+    for (unsigned i = 0; i < workerCount; ++i)
+    {
+        m_workers.emplace_back(&JobSystem::WorkerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+
+    if (t_system == this)
+    {
+        t_system = nullptr;
+    }
+}
+
+JobSystem::Handle JobSystem::Submit(std::function<void()> work, std::initializer_list<Handle> dependencies, Affinity affinity)
+{
+    return SubmitJob(std::move(work), dependencies.begin(), dependencies.size(), affinity);
+}
+
+JobSystem::Handle JobSystem::Submit(std::function<void()> work, std::vector<Handle> const& dependencies, Affinity affinity)
+{
+    return SubmitJob(std::move(work), dependencies.data(), dependencies.size(), affinity);
+}
+
+JobSystem::Handle JobSystem::SubmitJob(std::function<void()>&& work, const Handle* dependencies, size_t count, Affinity affinity)
+{
+    auto job = std::make_shared<Job>(std::move(work), affinity);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto& dependency = dependencies[i];
+        if (!dependency)
+            continue;
+
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (dependency->done)
+        {
+            // Failures propagate even when the dependency finished before this submission
+            if (dependency->error && !job->error)
+            {
+                job->error = dependency->error;
+            }
+        }
+        else
+        {
+            ++job->pending;
+            dependency->dependents.push_back(job);
+        }
+    }
+
+    // Drop the submission reference; the last finished dependency schedules it otherwise
+    if (--job->pending == 0)
+    {
+        Schedule(job);
+    }
+
+    return job;
+}
+
+void JobSystem::Schedule(Handle const& job)
+{
+    if (job->affinity == Affinity_Main)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mainOnly.mutex);
+            m_mainOnly.jobs.push_back(job);
+        }
+        ++m_queuedMain;
+    }
+    else
+    {
+        // Jobs queued from outside the system go to the main thread's deque, where workers steal them
+        auto& queue = *m_queues[(t_system == this) ? t_queue : 0];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(job);
+        }
+        ++m_queuedAny;
+    }
+
+    Wake();
+}
+
+void JobSystem::Wake()
+{
+    // Sleepers check their condition under the mutex, so taking it here means none can miss this
+    if (m_sleeping)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+        }
+        m_wake.notify_all();
+    }
+}
+
+bool JobSystem::TryRun()
+{
+    const bool mainThread = std::this_thread::get_id() == m_mainThread;
+    const size_t own = (t_system == this) ? t_queue : 0;
+
+    Handle job;
+
+    if (mainThread && m_queuedMain)
+    {
+        std::lock_guard<std::mutex> lock(m_mainOnly.mutex);
+        if (!m_mainOnly.jobs.empty())
+        {
+            job = std::move(m_mainOnly.jobs.front());
+            m_mainOnly.jobs.pop_front();
+            --m_queuedMain;
+        }
+    }
+
+    if (!job && m_queuedAny)
+    {
+        // Own work newest first, then the oldest work of everyone else
+        for (size_t i = 0; i < m_queues.size() && !job; ++i)
+        {
+            size_t index = (own + i) % m_queues.size();
+            auto& queue = *m_queues[index];
+
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty())
+                continue;
+
+            if (i == 0)
+            {
+                job = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+            }
+            else
+            {
+                job = std::move(queue.jobs.front());
+                queue.jobs.pop_front();
+                ++m_stolen;
+            }
+            --m_queuedAny;
+        }
+    }
+
+    if (!job)
+        return false;
+
+    if (mainThread)
+    {
+        ++m_executedMain;
+    }
+
+    Execute(job);
+    return true;
+}
+
+void JobSystem::Execute(Handle const& job)
+{
+    if (!job->error)
+    {
+        try
+        {
+            job->work();
+        }
+        catch (...)
+        {
+            job->error = std::current_exception();
+        }
+    }
+
+    // Release whatever the work captured as soon as it has run
+    job->work = nullptr;
+
+    // Counted before it is marked done, so the statistics include it once Wait returns
+    ++m_executed;
+
+    std::vector<Handle> dependents;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->done = true;
+        dependents.swap(job->dependents);
+    }
+
+    for (auto& dependent : dependents)
+    {
+        if (job->error)
+        {
+            std::lock_guard<std::mutex> lock(dependent->mutex);
+            if (!dependent->error)
+            {
+                dependent->error = job->error;
+            }
+        }
+
+        if (--dependent->pending == 0)
+        {
+            Schedule(dependent);
+        }
+    }
+
+    // Someone may be waiting for this job rather than for more work
+    Wake();
+}
+
+void JobSystem::WorkerLoop(unsigned index)
+{
+    t_system = this;
+    t_queue = index + 1;
+
+    char name[16];
+    snprintf(name, sizeof(name), "Worker %u", index);
+    NameThread(name);
+    if (m_threadStart)
+    {
+        m_threadStart(name);
+    }
+
+    for (;;)
+    {
+        if (TryRun())
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        ++m_sleeping;
+        m_wake.wait(lock, [&]() { return m_stop || m_queuedAny > 0; });
+        --m_sleeping;
+
+        if (m_stop && !m_queuedAny)
+            break;
+    }
+}
+
+void JobSystem::Wait(Handle const& job)
+{
+    if (!job)
+        return;
+
+    const bool mainThread = std::this_thread::get_id() == m_mainThread;
+
+    while (!job->done)
+    {
+        if (TryRun())
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        ++m_sleeping;
+        m_wake.wait(lock, [&]()
+        {
+            return job->done || m_queuedAny > 0 || (mainThread && m_queuedMain > 0);
+        });
+        --m_sleeping;
+    }
+
+    std::lock_guard<std::mutex> lock(job->mutex);
+    if (job->error)
+    {
+        std::rethrow_exception(job->error);
+    }
+}
+
+void JobSystem::ParallelFor(size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)
+{
+    if (!count)
+        return;
+
+    grain = std::max<size_t>(grain, 1);
+    const size_t ranges = (count + grain - 1) / grain;
+    if (ranges == 1 || m_workers.empty())
+    {
+        body(0, count);
+        return;
+    }
+
+    // The caller takes the first range itself
+    std::vector<Handle> jobs;
+    jobs.reserve(ranges - 1);
+    for (size_t begin = grain; begin < count; begin += grain)
+    {
+        size_t end = std::min(begin + grain, count);
+        jobs.push_back(Submit([&body, begin, end]() { body(begin, end); }));
+    }
+
+    std::exception_ptr error;
+    try
+    {
+        body(0, grain);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    // Every range has to finish before 'body' goes out of scope, even if one of them threw
+    for (auto& job : jobs)
+    {
+        try
+        {
+            Wait(job);
+        }
+        catch (...)
+        {
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void JobSystem::RunMainThreadJobs()
+{
+    while (m_queuedMain)
+    {
+        Handle job;
+        {
+            std::lock_guard<std::mutex> lock(m_mainOnly.mutex);
+            if (m_mainOnly.jobs.empty())
+                break;
+
+            job = std::move(m_mainOnly.jobs.front());
+            m_mainOnly.jobs.pop_front();
+            --m_queuedMain;
+        }
+
+        ++m_executedMain;
+        Execute(job);
+    }
+}
+
+bool JobSystem::IsDone(Handle const& job)
+{
+    return !job || job->done;
+}
+
+JobSystem::Statistics JobSystem::GetStatistics() const
+{
+    return { m_executed.load(), m_stolen.load(), m_executedMain.load() };
+}
+
+void JobSystem::ResetStatistics()
+{
+    m_executed = 0;
+    m_stolen = 0;
+    m_executedMain = 0;
+}
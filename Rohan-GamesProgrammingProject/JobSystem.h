@@ -0,0 +1,115 @@
+//
+// JobSystem.h - Work-stealing job scheduler with dependencies and main-thread jobs
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace DX
+{
+    // Every worker owns a deque: it pushes and pops its own jobs at the back and, when out of
+    // work, steals from the front of the others'. The thread that created the JobSystem is the
+    // main thread; it owns a deque too and runs jobs whenever it waits, so a system with no
+    // workers still completes every job (serially, inside Wait).
+    //
+    // A job runs once all of its dependencies have finished. Affinity_Main jobs only run on the
+    // main thread, inside Wait or RunMainThreadJobs; use it for anything that touches the D3D
+    // immediate context or the window. An exception thrown by a job is stored, skips the jobs
+    // that depend on it and is rethrown by Wait.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+    class JobSystem
+    {
+    public:
+        enum Affinity
+        {
+            Affinity_Any,
+            Affinity_Main,
+        };
+
+        class Job;
+        using Handle = std::shared_ptr<Job>;
+
+        struct Statistics
+        {
+            uint64_t    executed;
+            uint64_t    stolen;         // jobs run by a thread other than the one that queued them
+            uint64_t    mainThread;     // jobs run on the main thread
+        };
+
+        // Called on each worker as it starts, with its name, e.g. to name it in a profiler.
+        using ThreadStart = std::function<void(const char* name)>;
+
+        // Hardware threads minus one, for the main thread.
+        static unsigned DefaultWorkerCount();
+
+        explicit JobSystem(unsigned workerCount = DefaultWorkerCount(), ThreadStart threadStart = nullptr);
+        ~JobSystem();
+
+        JobSystem(JobSystem const&) = delete;
+        JobSystem& operator= (JobSystem const&) = delete;
+
+        // Null handles in the dependency list are ignored.
+        Handle Submit(std::function<void()> work, std::initializer_list<Handle> dependencies = {}, Affinity affinity = Affinity_Any);
+        Handle Submit(std::function<void()> work, std::vector<Handle> const& dependencies, Affinity affinity = Affinity_Any);
+
+        // Runs queued jobs until the given one has finished. A null handle returns at once.
+        void Wait(Handle const& job);
+
+        // Splits [0, count) into ranges of at most 'grain' and runs body(begin, end) on each,
+        // the calling thread included. Returns when every range is done.
+        void ParallelFor(size_t count, size_t grain, std::function<void(size_t, size_t)> const& body);
+
+        // Main thread only: runs the Affinity_Main jobs that are ready.
+        void RunMainThreadJobs();
+
+        static bool IsDone(Handle const& job);
+
+        unsigned GetWorkerCount() const { return unsigned(m_workers.size()); }
+        Statistics GetStatistics() const;
+        void ResetStatistics();
+
+    private:
+        struct Queue
+        {
+            std::mutex          mutex;
+            std::deque<Handle>  jobs;
+        };
+
+        Handle SubmitJob(std::function<void()>&& work, const Handle* dependencies, size_t count, Affinity affinity);
+        void Schedule(Handle const& job);
+        bool TryRun();
+        void Execute(Handle const& job);
+        void WorkerLoop(unsigned index);
+        void Wake();
+
+        // Queue 0 belongs to the main thread, queue i + 1 to worker i.
+        std::vector<std::unique_ptr<Queue>>     m_queues;
+        Queue                                   m_mainOnly;
+        std::vector<std::thread>                m_workers;
+        std::thread::id                         m_mainThread;
+        ThreadStart                             m_threadStart;
+
+        std::atomic<size_t>                     m_queuedAny;
+        std::atomic<size_t>                     m_queuedMain;
+        std::atomic<unsigned>                   m_sleeping;
+        std::mutex                              m_sleepMutex;
+        std::condition_variable                 m_wake;
+        bool                                    m_stop;
+
+        std::atomic<uint64_t>                   m_executed;
+        std::atomic<uint64_t>                   m_stolen;
+        std::atomic<uint64_t>                   m_executedMain;
+    };
+}
@@ -0,0 +1,226 @@
+//
+// LZ4Block.cpp - LZ4 block format compression for cooked asset chunks
+//
+// Does not use the precompiled header, so the offline tools can build it.
+//
+
+#include "LZ4Block.h"
+
+#include <algorithm>
+#include <string.h>
+
+using namespace DX;
+
+namespace
+{
+    const size_t c_MinMatch = 4;
+    const size_t c_LastLiterals = 5;        // the format requires a block to end in literals
+    const size_t c_MatchStartLimit = 12;    // and its last match to start this far from the end
+    const size_t c_MaxOffset = 65535;
+    const unsigned c_HashBits = 12;
+
+    uint32_t Read32(const uint8_t* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint32_t Hash(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - c_HashBits);
+    }
+
+    // Lengths of 15 or more continue in bytes of 255 until a smaller byte
+    bool WriteLength(uint8_t*& out, uint8_t* outEnd, size_t length)
+    {
+        for (; length >= 255; length -= 255)
+        {
+            if (out == outEnd)
+                return false;
+            *out++ = 255;
+        }
+        if (out == outEnd)
+            return false;
+        *out++ = uint8_t(length);
+        return true;
+    }
+
+    bool ReadLength(const uint8_t*& in, const uint8_t* inEnd, size_t& length)
+    {
+        uint8_t next;
+        do
+        {
+            if (in == inEnd)
+                return false;
+            next = *in++;
+            length += next;
+        } while (next == 255);
+        return true;
+    }
+
+    // Token, literals and (unless matchLength is zero) the match that follows them
+    bool WriteSequence(uint8_t*& out, uint8_t* outEnd, const uint8_t* literals, size_t literalLength,
+        size_t offset, size_t matchLength)
+    {
+        if (out == outEnd)
+            return false;
+
+        uint8_t* token = out++;
+        *token = uint8_t(std::min<size_t>(literalLength, 15) << 4);
+        if (literalLength >= 15 && !WriteLength(out, outEnd, literalLength - 15))
+            return false;
+
+        if (literalLength > size_t(outEnd - out))
+            return false;
+        if (literalLength)
+        {
+            memcpy(out, literals, literalLength);
+            out += literalLength;
+        }
+
+        if (!matchLength)
+            return true;
+
+        if (outEnd - out < 2)
+            return false;
+        *out++ = uint8_t(offset);
+        *out++ = uint8_t(offset >> 8);
+
+        size_t length = matchLength - c_MinMatch;
+        *token |= uint8_t(std::min<size_t>(length, 15));
+        return length < 15 || WriteLength(out, outEnd, length - 15);
+    }
+}
+
+size_t DX::LZ4CompressBound(size_t srcSize)
+{
+    return srcSize + srcSize / 255 + 16;
+}
+
+size_t DX::LZ4Compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity)
+{
+    uint8_t* out = dst;
+    uint8_t* outEnd = dst + dstCapacity;
+    const uint8_t* anchor = src;
+
+    if (srcSize > c_MatchStartLimit && srcSize <= UINT32_MAX)
+    {
+        const uint8_t* matchEnd = src + srcSize - c_LastLiterals;
+        const uint8_t* searchEnd = src + srcSize - c_MatchStartLimit;
+
+        // Position + 1 of the last occurrence of each hashed 4-byte sequence; 0 is empty
+        uint32_t table[1u << c_HashBits] = {};
+
+        const uint8_t* ip = src;
+        unsigned misses = 0;
+        while (ip <= searchEnd)
+        {
+            uint32_t sequence = Read32(ip);
+            uint32_t& slot = table[Hash(sequence)];
+            const uint8_t* match = slot ? src + slot - 1 : nullptr;
+            slot = uint32_t(ip - src) + 1;
+
+            if (!match || size_t(ip - match) > c_MaxOffset || Read32(match) != sequence)
+            {
+                // Step further through data that is not matching, as the reference encoder does
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            while (ip > anchor && match > src && ip[-1] == match[-1])
+            {
+                --ip;
+                --match;
+            }
+
+            size_t length = c_MinMatch;
+            while (ip + length < matchEnd && ip[length] == match[length])
+            {
+                ++length;
+            }
+
+            if (!WriteSequence(out, outEnd, anchor, size_t(ip - anchor), size_t(ip - match), length))
+                return 0;
+
+            ip += length;
+            anchor = ip;
+
+            // Seed the table inside the match so the next one can refer back into it
+            if (ip <= searchEnd)
+            {
+                table[Hash(Read32(ip - 2))] = uint32_t(ip - 2 - src) + 1;
+            }
+        }
+    }
+
+    if (!WriteSequence(out, outEnd, anchor, size_t(src + srcSize - anchor), 0, 0))
+        return 0;
+
+    return size_t(out - dst);
+}
+
+bool DX::LZ4Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+    const uint8_t* in = src;
+    const uint8_t* inEnd = src + srcSize;
+    uint8_t* out = dst;
+    uint8_t* outEnd = dst + dstSize;
+
+    for (;;)
+    {
+        if (in == inEnd)
+            return false;
+
+        unsigned token = *in++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !ReadLength(in, inEnd, literalLength))
+            return false;
+
+        if (literalLength > size_t(inEnd - in) || literalLength > size_t(outEnd - out))
+            return false;
+        if (literalLength)
+        {
+            memcpy(out, in, literalLength);
+            in += literalLength;
+            out += literalLength;
+        }
+
+        // The last sequence has no match
+        if (in == inEnd)
+            return out == outEnd;
+
+        if (inEnd - in < 2)
+            return false;
+        size_t offset = size_t(in[0]) | (size_t(in[1]) << 8);
+        in += 2;
+
+        if (!offset || offset > size_t(out - dst))
+            return false;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !ReadLength(in, inEnd, matchLength))
+            return false;
+        matchLength += c_MinMatch;
+
+        if (matchLength > size_t(outEnd - out))
+            return false;
+
+        const uint8_t* match = out - offset;
+        if (offset >= matchLength)
+        {
+            memcpy(out, match, matchLength);
+            out += matchLength;
+        }
+        else
+        {
+            // Overlapping copies repeat the last offset bytes, so they go one byte at a time
+            for (size_t i = 0; i < matchLength; ++i)
+            {
+                *out++ = *match++;
+            }
+        }
+    }
+}
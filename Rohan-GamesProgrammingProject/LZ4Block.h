@@ -0,0 +1,31 @@
+//
+// LZ4Block.h - LZ4 block format compression for cooked asset chunks
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DX
+{
+    // A self-contained encoder and decoder for the LZ4 block format (no frame header, no
+    // checksums), which the asset pack uses per chunk. The encoder is a single-pass greedy
+    // matcher that favours speed over ratio; the decoder is bounds-checked against both
+    // buffers, so a corrupt pack fails to load rather than reading or writing out of range.
+    //
+    // Offsets are 16-bit, so blocks compress independently and any block size works, but
+    // the pack keeps chunks small enough that several decompress in parallel per asset.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+
+    // The largest compressed size of srcSize bytes of incompressible data.
+    size_t LZ4CompressBound(size_t srcSize);
+
+    // Returns the compressed size, or 0 when the result would not fit in dstCapacity.
+    size_t LZ4Compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity);
+
+    // Decompresses exactly dstSize bytes. Returns false if the block is malformed or does not
+    // decode to exactly dstSize bytes.
+    bool LZ4Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+}
@@ -4,6 +4,9 @@
 
 #include "pch.h"
 #include "Game.h"
+#include "HeadlessChecks.h"
+
+#include <Psapi.h>
 
 
 
@@ -15,6 +18,10 @@ namespace GameComponents
 using namespace DirectX;
 
 LRESULT CALLBACK WndProc(HWND, UINT, WPARAM, LPARAM);
+int RunHeadless(_In_ LPWSTR lpCmdLine);
+int RunHeadlessChecks(_In_ LPWSTR lpCmdLine);
+std::wstring GetSceneFile(_In_opt_ LPCWSTR lpCmdLine);
+void WriteProfile();
 
 // Indicates to hybrid graphics systems to prefer the discrete part by default
 extern "C"
@@ -27,7 +34,6 @@ extern "C"
 int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR lpCmdLine, _In_ int nCmdShow)
 {
     UNREFERENCED_PARAMETER(hPrevInstance);
-    UNREFERENCED_PARAMETER(lpCmdLine);
 
     if (!XMVerifyCPUSupport())
         return 1;
@@ -36,7 +42,20 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
     if (FAILED(hr))
         return 1;
 
-    GameComponents::g_game = std::make_unique<Game>();
+    // "-profile" turns on the CPU zone timers; the trace and summary are written on exit.
+    DX::Profiler::SetThreadName("Main");
+    DX::Profiler::SetEnabled(lpCmdLine && wcsstr(lpCmdLine, L"-profile"));
+
+    if (lpCmdLine && wcsstr(lpCmdLine, L"-headless"))
+    {
+        int result = RunHeadless(lpCmdLine);
+        CoUninitialize();
+        return result;
+    }
+
+    GameOptions options;
+    options.sceneFile = GetSceneFile(lpCmdLine);
+    GameComponents::g_game = std::make_unique<Game>(options);
 
     // Register class and create window
     {
@@ -96,6 +115,8 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
         }
     }
 
+    WriteProfile();
+
     GameComponents::g_game.reset();
 
     static bool raw_input_initialized = false;
@@ -305,6 +326,318 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 }
 
 
+// "-scene <file>" selects the scene description to load.
+std::wstring GetSceneFile(_In_opt_ LPCWSTR lpCmdLine)
+{
+    if (lpCmdLine)
+    {
+        if (auto arg = wcsstr(lpCmdLine, L"-scene"))
+        {
+            arg += wcslen(L"-scene");
+            while (*arg == L' ')
+                ++arg;
+
+            auto end = arg;
+            while (*end && *end != L' ')
+                ++end;
+
+            if (end != arg)
+                return std::wstring(arg, end);
+        }
+    }
+
+    return L"Scenes/default.scene";
+}
+
+// Runs frames on the null device and writes their CPU cost and recorded API counts to
+// HeadlessFrameStats.txt, e.g. "-headless -frames 1000". Options:
+//   -frames N            frames to run (500)
+//   -scene FILE          scene to draw; Scenes/skullfield.scene shows instancing and LODs best
+//   -nofilter            no redundant state filter
+//   -workers N           job system worker threads; 0 runs every job on the main thread
+//   -readmodels          models read into heap copies instead of mapped
+//   -syncload            everything loaded before the first frame instead of streamed
+//   -loose               loose files even when there is a Content.pak
+//   -texturebudget MB    cap on the memory of resident texture mips
+//   -noclusters          full-detail meshes drawn whole instead of cluster culled
+//   -noocclusion         meshes drawn even when the occlusion buffer hides them
+//   -profile             the CPU zone trace and summary written as well
+//   -check               the self-checks in HeadlessChecks.h instead, to HeadlessChecks.txt
+int RunHeadless(_In_ LPWSTR lpCmdLine)
+{
+    if (wcsstr(lpCmdLine, L"-check"))
+        return RunHeadlessChecks(lpCmdLine);
+
+    unsigned int frames = 500;
+    if (auto arg = wcsstr(lpCmdLine, L"-frames"))
+    {
+        int count = _wtoi(arg + wcslen(L"-frames"));
+        if (count > 0)
+            frames = static_cast<unsigned int>(count);
+    }
+
+    try
+    {
+        GameOptions options;
+        options.headless = true;
+        options.sceneFile = GetSceneFile(lpCmdLine);
+        options.filterState = !wcsstr(lpCmdLine, L"-nofilter");
+        options.cullClusters = !wcsstr(lpCmdLine, L"-noclusters");
+        options.cullOccluded = !wcsstr(lpCmdLine, L"-noocclusion");
+
+        if (auto arg = wcsstr(lpCmdLine, L"-workers"))
+        {
+            options.workerCount = _wtoi(arg + wcslen(L"-workers"));
+        }
+
+        options.mapModels = !wcsstr(lpCmdLine, L"-readmodels");
+        options.streamAssets = !wcsstr(lpCmdLine, L"-syncload");
+        if (wcsstr(lpCmdLine, L"-loose"))
+        {
+            options.packFile.clear();
+        }
+
+        if (auto arg = wcsstr(lpCmdLine, L"-texturebudget"))
+        {
+            int megabytes = _wtoi(arg + wcslen(L"-texturebudget"));
+            if (megabytes > 0)
+                options.textureBudget = size_t(megabytes) * 1024 * 1024;
+        }
+
+        LARGE_INTEGER frequency, start, end;
+        QueryPerformanceFrequency(&frequency);
+        QueryPerformanceCounter(&start);
+
+        auto game = std::make_unique<Game>(options);
+
+        int w, h;
+        game->GetDefaultSize(w, h);
+        game->InitializeHeadless(w, h);
+
+        // The first Tick only updates; the one after it draws the first frame
+        game->Tick();
+        game->Tick();
+
+        QueryPerformanceCounter(&end);
+        double startupMs = double(end.QuadPart - start.QuadPart) * 1000.0 / double(frequency.QuadPart);
+
+        // Keep ticking until the streamer is done, then make sure before measuring
+        unsigned int streamFrames = 0;
+        while (game->GetAssetStreamer()->GetPendingCount() && streamFrames < 10000)
+        {
+            game->Tick();
+            ++streamFrames;
+        }
+        game->FinishStreaming();
+
+        QueryPerformanceCounter(&end);
+        double residentMs = double(end.QuadPart - start.QuadPart) * 1000.0 / double(frequency.QuadPart);
+
+        // Warm up caches and lazily created DirectXTK resources before measuring.
+        for (unsigned int i = 0; i < 10; ++i)
+        {
+            game->Tick();
+        }
+        game->GetRecorder()->ResetStats();
+        DX::Profiler::Reset();
+        game->GetJobSystem()->ResetStatistics();
+        game->ResetLodStatistics();
+        game->GetClusterCuller()->ResetStatistics();
+        game->ResetOcclusionStatistics();
+        game->GetOcclusionBuffer()->ResetStatistics();
+        if (game->GetStateFilter())
+        {
+            game->GetStateFilter()->ResetStats();
+        }
+
+        QueryPerformanceCounter(&start);
+
+        for (unsigned int i = 0; i < frames; ++i)
+        {
+            game->Tick();
+        }
+
+        QueryPerformanceCounter(&end);
+
+        const DX::RenderStats& total = game->GetRecorder()->GetTotalStats();
+        DX::StateFilterStats filter;
+        if (game->GetStateFilter())
+        {
+            filter = game->GetStateFilter()->GetTotalStats();
+        }
+        double n = double(std::max<uint64_t>(total.frames, 1));
+        double ms = double(end.QuadPart - start.QuadPart) * 1000.0 / double(frequency.QuadPart);
+
+        FILE* file = nullptr;
+        if (_wfopen_s(&file, L"HeadlessFrameStats.txt", L"w") || !file)
+            return 1;
+
+        const auto jobs = game->GetJobSystem()->GetStatistics();
+        const auto& models = game->GetModelCache()->GetStatistics();
+        const auto& streaming = game->GetAssetStreamer()->GetStatistics();
+        const auto textures = game->GetTextureStreamer()->GetStatistics();
+        const auto registry = game->GetResourceRegistry()->GetStatistics();
+        const auto& lods = game->GetLodStatistics();
+        const auto& clusters = game->GetClusterCuller()->GetStatistics();
+        const auto& occlusion = game->GetOcclusionStatistics();
+        const auto& occluders = game->GetOcclusionBuffer()->GetStatistics();
+
+        PROCESS_MEMORY_COUNTERS memory = {};
+        GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory));
+
+        fprintf(file, "startup ms           %.3f\n", startupMs);
+        fprintf(file, "resident ms          %.3f\n", residentMs);
+        fprintf(file, "streaming frames     %u\n", streamFrames);
+        fprintf(file, "frames               %llu\n", total.frames);
+        fprintf(file, "workers              %u\n", game->GetJobSystem()->GetWorkerCount());
+        fprintf(file, "content pack entries %zu\n", game->GetPack() ? game->GetPack()->GetEntryCount() : size_t(0));
+        fprintf(file, "cpu ms/frame         %.4f\n", ms / n);
+        fprintf(file, "jobs/frame           %.1f\n", double(jobs.executed) / n);
+        fprintf(file, "jobs stolen/frame    %.1f\n", double(jobs.stolen) / n);
+        fprintf(file, "main thread jobs/fr  %.1f\n", double(jobs.mainThread) / n);
+        fprintf(file, "draws/frame          %.1f\n", double(total.drawCalls) / n);
+        fprintf(file, "instanced/frame      %.1f\n", double(total.instancedDrawCalls) / n);
+        fprintf(file, "instances/frame      %.1f\n", double(total.instancesSubmitted) / n);
+        fprintf(file, "primitives/frame     %.1f\n", double(total.primitivesSubmitted) / n);
+        fprintf(file, "lod triangles/frame  %.1f\n", double(lods.triangles) / n);
+        fprintf(file, "full triangles/frame %.1f\n", double(lods.fullTriangles) / n);
+        for (uint32_t level = 0; level <= DX::c_MaxModelLods; ++level)
+        {
+            fprintf(file, "  lod %u meshes/frame %.1f\n", level, double(lods.meshes[level]) / n);
+        }
+        fprintf(file, "cluster meshes/frame %.1f\n", double(clusters.meshes) / n);
+        fprintf(file, "  hidden/frame       %.1f\n", double(clusters.meshesHidden) / n);
+        fprintf(file, "clusters/frame       %.1f\n", double(clusters.culling.clusters) / n);
+        fprintf(file, "  frustum/frame      %.1f\n", double(clusters.culling.frustumCulled) / n);
+        fprintf(file, "  backface/frame     %.1f\n", double(clusters.culling.backfaceCulled) / n);
+        fprintf(file, "cluster tris/frame   %.1f\n", double(clusters.culling.triangles) / n);
+        fprintf(file, "  culled/frame       %.1f\n", double(clusters.culling.trianglesCulled) / n);
+        fprintf(file, "cluster IB bytes/fr  %.1f\n", double(clusters.indexBytes) / n);
+        fprintf(file, "occluders/frame      %.1f\n", double(occluders.occluders) / n);
+        fprintf(file, "occluder tris/frame  %.1f\n", double(occluders.triangles) / n);
+        fprintf(file, "  drawn/frame        %.1f\n", double(occluders.trianglesDrawn) / n);
+        fprintf(file, "occluder tiles/frame %.1f\n", double(occluders.tilesUpdated) / n);
+        fprintf(file, "occlusion tested/fr  %.1f\n", double(occlusion.meshesTested) / n);
+        fprintf(file, "  occluded/frame     %.1f\n", double(occlusion.meshesOccluded) / n);
+        fprintf(file, "state sets/frame     %.1f\n", double(total.stateSets) / n);
+        fprintf(file, "shader sets/frame    %.1f\n", double(total.shaderSets) / n);
+        fprintf(file, "resource sets/frame  %.1f\n", double(total.resourceSets) / n);
+        fprintf(file, "clears/frame         %.1f\n", double(total.clears) / n);
+        fprintf(file, "copies/frame         %.1f\n", double(total.copies) / n);
+        fprintf(file, "maps/frame           %.1f\n", double(total.maps) / n);
+        fprintf(file, "bytes mapped/frame   %.1f\n", double(total.bytesMapped) / n);
+        fprintf(file, "bytes uploaded/frame %.1f\n", double(total.bytesUploaded) / n);
+        fprintf(file, "bind calls/frame     %.1f\n", double(filter.calls) / n);
+        fprintf(file, "filtered/frame       %.1f\n", double(filter.filtered) / n);
+        fprintf(file, "  shaders/frame      %.1f\n", double(filter.filteredShaders) / n);
+        fprintf(file, "  resources/frame    %.1f\n", double(filter.filteredResources) / n);
+        fprintf(file, "  states/frame       %.1f\n", double(filter.filteredStates) / n);
+        fprintf(file, "slots trimmed/frame  %.1f\n", double(filter.slotsTrimmed) / n);
+        fprintf(file, "model loads          %zu\n", models.loads);
+        fprintf(file, "model load ms        %.3f\n", models.loadMs);
+        fprintf(file, "model upload ms      %.3f\n", models.uploadMs);
+        fprintf(file, "model bytes read     %zu\n", models.bytesRead);
+        fprintf(file, "model bytes mapped   %zu\n", models.bytesMapped);
+        fprintf(file, "atlased materials    %zu\n", models.atlasedMaterials);
+        fprintf(file, "packed vertex bytes  %zu\n", models.packedVertexBytes);
+        fprintf(file, "model clusters       %zu\n", models.clusters);
+        fprintf(file, "assets streamed      %zu\n", streaming.completed);
+        fprintf(file, "asset read ms        %.3f\n", streaming.readMs);
+        fprintf(file, "asset decode ms      %.3f\n", streaming.decodeMs);
+        fprintf(file, "asset upload ms      %.3f\n", streaming.uploadMs);
+        fprintf(file, "asset bytes uploaded %zu\n", streaming.bytesUploaded);
+        fprintf(file, "budget-capped frames %zu\n", streaming.budgetFrames);
+        fprintf(file, "assets shared        %zu\n", streaming.shared);
+        fprintf(file, "textures             %zu\n", textures.textures);
+        fprintf(file, "  streamable         %zu\n", textures.streamable);
+        fprintf(file, "texture budget MB    %.2f\n", double(textures.budget) / (1024.0 * 1024.0));
+        fprintf(file, "texture resident MB  %.2f\n", double(textures.residentBytes) / (1024.0 * 1024.0));
+        fprintf(file, "texture peak MB      %.2f\n", double(textures.peakResidentBytes) / (1024.0 * 1024.0));
+        fprintf(file, "texture full MB      %.2f\n", double(textures.fullBytes) / (1024.0 * 1024.0));
+        fprintf(file, "mips loaded          %zu\n", textures.mipsLoaded);
+        fprintf(file, "mips evicted         %zu\n", textures.mipsEvicted);
+        fprintf(file, "mip loads pending    %zu\n", textures.loadsPending);
+        fprintf(file, "mip budget misses    %zu\n", textures.budgetMisses);
+        fprintf(file, "texture bytes read   %zu\n", textures.bytesRead);
+        fprintf(file, "texture read ms      %.3f\n", textures.readMs);
+        fprintf(file, "images decoded       %zu\n", textures.imagesDecoded);
+        fprintf(file, "image decode ms      %.3f\n", textures.decodeMs);
+        fprintf(file, "texture upload ms    %.3f\n", textures.uploadMs);
+        fprintf(file, "textures shared      %zu\n", textures.shared);
+        fprintf(file, "registry paths       %zu\n", registry.paths);
+        fprintf(file, "registry textures    %zu\n", registry.textures);
+        fprintf(file, "registry effects     %zu\n", registry.effects);
+        fprintf(file, "registry tex hits    %zu\n", registry.textureHits);
+        fprintf(file, "registry fx hits     %zu\n", registry.effectHits);
+        fprintf(file, "peak working set MB  %.2f\n", double(memory.PeakWorkingSetSize) / (1024.0 * 1024.0));
+        fprintf(file, "peak private MB      %.2f\n", double(memory.PeakPagefileUsage) / (1024.0 * 1024.0));
+
+        fclose(file);
+
+        WriteProfile();
+    }
+    catch (const std::exception& e)
+    {
+        OutputDebugStringA(e.what());
+        return 1;
+    }
+
+    return 0;
+}
+
+// Runs the checks in HeadlessChecks.h, on Scenes/skullfield.scene unless "-scene" names another,
+// and writes what they measured to HeadlessChecks.txt. Returns 1 if any fails.
+int RunHeadlessChecks(_In_ LPWSTR lpCmdLine)
+{
+    const std::wstring sceneFile = wcsstr(lpCmdLine, L"-scene") ? GetSceneFile(lpCmdLine) : L"Scenes/skullfield.scene";
+
+    FILE* file = nullptr;
+    if (_wfopen_s(&file, L"HeadlessChecks.txt", L"w") || !file)
+        return 1;
+
+    bool passed = false;
+    try
+    {
+        const bool instancing = CheckInstancing(sceneFile.c_str(), file);
+        const bool stateFilter = CheckStateFilter(file);
+        passed = instancing && stateFilter;
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(file, "error %s\n", e.what());
+        OutputDebugStringA(e.what());
+    }
+
+    fclose(file);
+    return passed ? 0 : 1;
+}
+
+
+// Writes ProfileTrace.json (for chrome://tracing) and ProfileSummary.txt when profiling is on.
+void WriteProfile()
+{
+    if (!DX::Profiler::IsEnabled())
+        return;
+
+    DX::Profiler::SetEnabled(false);
+
+    try
+    {
+        DX::Profiler::WriteChromeTrace(L"ProfileTrace.json");
+
+        FILE* file = nullptr;
+        if (!_wfopen_s(&file, L"ProfileSummary.txt", L"w") && file)
+        {
+            DX::Profiler::WriteSummary(file);
+            fclose(file);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        OutputDebugStringA(e.what());
+    }
+}
+
 // Exit helper
 void ExitGame()
 {
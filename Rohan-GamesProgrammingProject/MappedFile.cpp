@@ -0,0 +1,227 @@
+//
+// MappedFile.cpp - Read-only memory-mapped view of a whole file
+//
+// Does not use the precompiled header, so the offline tools can build it.
+//
+
+#include "MappedFile.h"
+
+#include <exception>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+#include <utility>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace DX;
+
+#if defined(_WIN32)
+
+namespace
+{
+    HANDLE OpenForMapping(const wchar_t* name)
+    {
+        return CreateFileW(name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    }
+}
+
+MappedFile::MappedFile(const wchar_t* name) :
+    m_data(nullptr),
+    m_size(0),
+    m_file(OpenForMapping(name)),
+    m_mapping(nullptr)
+{
+#if !defined(WINAPI_FAMILY) || (WINAPI_FAMILY == WINAPI_FAMILY_DESKTOP_APP)
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        wchar_t moduleName[_MAX_PATH];
+        if (!GetModuleFileNameW(nullptr, moduleName, _MAX_PATH))
+            throw std::exception("GetModuleFileName");
+
+        wchar_t drive[_MAX_DRIVE];
+        wchar_t path[_MAX_PATH];
+
+        if (_wsplitpath_s(moduleName, drive, _MAX_DRIVE, path, _MAX_PATH, nullptr, 0, nullptr, 0))
+            throw std::exception("_wsplitpath_s");
+
+        wchar_t filename[_MAX_PATH];
+        if (_wmakepath_s(filename, _MAX_PATH, drive, path, name, nullptr))
+            throw std::exception("_wmakepath_s");
+
+        m_file = OpenForMapping(filename);
+    }
+#endif
+
+    if (m_file == INVALID_HANDLE_VALUE)
+        throw std::exception("MappedFile");
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || uint64_t(size.QuadPart) > SIZE_MAX)
+    {
+        Close();
+        throw std::exception("MappedFile");
+    }
+
+    // A zero-length file cannot be mapped, and there is nothing to read anyway
+    if (!size.QuadPart)
+        return;
+
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping)
+    {
+        m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+
+    if (!m_data)
+    {
+        Close();
+        throw std::exception("MappedFile");
+    }
+
+    m_size = size_t(size.QuadPart);
+}
+
+void MappedFile::Close() noexcept
+{
+    if (m_data)
+    {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mapping)
+    {
+        CloseHandle(m_mapping);
+    }
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = nullptr;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept :
+    m_data(other.m_data),
+    m_size(other.m_size),
+    m_file(other.m_file),
+    m_mapping(other.m_mapping)
+{
+    other.m_data = nullptr;
+    other.m_size = 0;
+    other.m_file = INVALID_HANDLE_VALUE;
+    other.m_mapping = nullptr;
+}
+
+MappedFile& MappedFile::operator= (MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_file, other.m_file);
+        std::swap(m_mapping, other.m_mapping);
+    }
+    return *this;
+}
+
+#else
+
+MappedFile::MappedFile(const wchar_t* name) :
+    m_data(nullptr),
+    m_size(0),
+    m_file(-1)
+{
+    std::string path(wcstombs(nullptr, name, 0) + 1, '\0');
+    if (wcstombs(&path[0], name, path.size()) == size_t(-1))
+        throw std::runtime_error("MappedFile: unconvertible file name");
+
+    m_file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_file < 0)
+        throw std::runtime_error("MappedFile: unable to open " + std::string(path.c_str()));
+
+    struct stat info;
+    if (fstat(m_file, &info) || uint64_t(info.st_size) > SIZE_MAX)
+    {
+        Close();
+        throw std::runtime_error("MappedFile: unable to stat " + std::string(path.c_str()));
+    }
+
+    if (!info.st_size)
+        return;
+
+    void* view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, m_file, 0);
+    if (view == MAP_FAILED)
+    {
+        Close();
+        throw std::runtime_error("MappedFile: unable to map " + std::string(path.c_str()));
+    }
+
+    // Loaders walk the file front to back
+    madvise(view, size_t(info.st_size), MADV_SEQUENTIAL);
+
+    m_data = static_cast<const uint8_t*>(view);
+    m_size = size_t(info.st_size);
+}
+
+void MappedFile::Close() noexcept
+{
+    if (m_data)
+    {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+    if (m_file >= 0)
+    {
+        close(m_file);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+    m_file = -1;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept :
+    m_data(other.m_data),
+    m_size(other.m_size),
+    m_file(other.m_file)
+{
+    other.m_data = nullptr;
+    other.m_size = 0;
+    other.m_file = -1;
+}
+
+MappedFile& MappedFile::operator= (MappedFile&& other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_file, other.m_file);
+    }
+    return *this;
+}
+
+#endif
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
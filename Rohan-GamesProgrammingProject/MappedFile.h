@@ -0,0 +1,48 @@
+//
+// MappedFile.h - Read-only memory-mapped view of a whole file
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace DX
+{
+    // Maps a file for reading so loaders can parse it in place instead of copying it into a
+    // heap buffer first. Pages are faulted in from the file cache on first touch and are not
+    // charged to the process's private memory. Like ReadData, a file that is not found
+    // relative to the working directory is looked for next to the executable.
+    //
+    // The view is unmapped when the object is destroyed, so nothing may keep pointers into it.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const wchar_t* name);
+        ~MappedFile();
+
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator= (MappedFile&& other) noexcept;
+
+        MappedFile(MappedFile const&) = delete;
+        MappedFile& operator= (MappedFile const&) = delete;
+
+        // Null for an empty file.
+        const uint8_t* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        void Close() noexcept;
+
+        const uint8_t*  m_data;
+        size_t          m_size;
+#if defined(_WIN32)
+        void*           m_file;         // HANDLE
+        void*           m_mapping;
+#else
+        int             m_file;
+#endif
+    };
+}
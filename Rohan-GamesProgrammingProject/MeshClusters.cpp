@@ -0,0 +1,481 @@
+//
+// MeshClusters.cpp - Splitting model parts into small clusters, and culling them by frustum and facing
+//
+
+#include "MeshClusters.h"
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+using namespace DX;
+
+namespace
+{
+    const uint32_t c_NoTriangle = UINT32_MAX;
+
+    // How much a candidate's normal counts against the vertices it would add
+    const float c_NormalWeight = 0.5f;
+
+    float Dot(const float* a, const float* b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    bool Normalise(float* v)
+    {
+        const float length = sqrtf(Dot(v, v));
+        if (!(length > 0.f))
+            return false;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            v[i] /= length;
+        }
+        return true;
+    }
+
+    // The sphere around the cluster's vertices and the cone around its triangles' normals
+    void SetClusterBounds(MeshCluster& cluster, std::vector<uint32_t> const& vertices, const float* positions,
+        const uint32_t* triangles, const float* normals)
+    {
+        float minimum[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (uint32_t vertex : vertices)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                minimum[i] = std::min(minimum[i], positions[vertex * 3 + i]);
+                maximum[i] = std::max(maximum[i], positions[vertex * 3 + i]);
+            }
+        }
+
+        float radiusSquared = 0.f;
+        for (int i = 0; i < 3; ++i)
+        {
+            cluster.center[i] = (minimum[i] + maximum[i]) * 0.5f;
+        }
+        for (uint32_t vertex : vertices)
+        {
+            const float offset[3] = { positions[vertex * 3] - cluster.center[0], positions[vertex * 3 + 1] - cluster.center[1],
+                positions[vertex * 3 + 2] - cluster.center[2] };
+            radiusSquared = std::max(radiusSquared, Dot(offset, offset));
+        }
+
+        // Rounding must not leave a vertex outside
+        cluster.radius = sqrtf(radiusSquared) * (1.f + FLT_EPSILON * 4.f);
+
+        float axis[3] = {};
+        for (uint32_t t = 0; t < cluster.triangleCount; ++t)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                axis[i] += normals[triangles[t] * 3 + i];
+            }
+        }
+
+        cluster.coneCutoff = c_NoClusterCone;
+        std::fill(cluster.coneAxis, cluster.coneAxis + 3, 0.f);
+        if (!Normalise(axis))
+            return;
+
+        // Degenerate triangles, with no normal, show from neither side
+        float minimumDot = 1.f;
+        for (uint32_t t = 0; t < cluster.triangleCount; ++t)
+        {
+            const float* normal = &normals[triangles[t] * 3];
+            if (Dot(normal, normal) > 0.f)
+            {
+                minimumDot = std::min(minimumDot, Dot(normal, axis));
+            }
+        }
+
+        std::copy(axis, axis + 3, cluster.coneAxis);
+        if (minimumDot > 0.f)
+        {
+            cluster.coneCutoff = sqrtf(std::max(1.f - minimumDot * minimumDot, 0.f));
+        }
+    }
+
+    // A cluster faces away when every direction from the camera to a point of its sphere is
+    // within 90 degrees less the cone's angle of its axis. With v from the camera to the
+    // centre, that holds when dot(v, axis) - r >= sin(angle) * (|v| + r).
+    bool IsBackfacing(MeshCluster const& cluster, const float* camera)
+    {
+        if (cluster.coneCutoff > 1.f)
+            return false;
+
+        const float v[3] = { cluster.center[0] - camera[0], cluster.center[1] - camera[1], cluster.center[2] - camera[2] };
+        return Dot(v, cluster.coneAxis) >= cluster.coneCutoff * sqrtf(Dot(v, v)) + cluster.radius * (1.f + cluster.coneCutoff);
+    }
+
+    bool IsOutside(MeshCluster const& cluster, ClusterView const& view)
+    {
+        for (auto const& plane : view.planes)
+        {
+            if (Dot(plane, cluster.center) + plane[3] < -cluster.radius)
+                return true;
+        }
+        return false;
+    }
+
+    template<typename Index>
+    size_t CullClusters(PartClusters const& part, ClusterView const& view, Index* output, ClusterCulling& culling)
+    {
+        size_t count = 0;
+        for (auto const& cluster : part.clusters)
+        {
+            ++culling.clusters;
+            culling.triangles += cluster.triangleCount;
+
+            const ClusterVisibility visibility = ClassifyCluster(cluster, view);
+            if (visibility != Cluster_Visible)
+            {
+                ++((visibility == Cluster_OutsideFrustum) ? culling.frustumCulled : culling.backfaceCulled);
+                culling.trianglesCulled += cluster.triangleCount;
+                continue;
+            }
+
+            const uint32_t* indices = &part.indices[cluster.startIndex];
+            for (uint32_t i = 0; i < cluster.triangleCount * 3; ++i)
+            {
+                output[count++] = Index(indices[i]);
+            }
+        }
+        return count;
+    }
+
+    uint32_t ReadIndex(ModelData::IndexStream const& stream, size_t i)
+    {
+        if (stream.format == ModelData::Format_R32_UInt)
+        {
+            uint32_t index;
+            memcpy(&index, stream.data + i * sizeof(uint32_t), sizeof(index));
+            return index;
+        }
+
+        uint16_t index;
+        memcpy(&index, stream.data + i * sizeof(uint16_t), sizeof(index));
+        return index;
+    }
+}
+
+bool DX::ReadClusterPart(ModelData const& model, ModelData::Mesh const& mesh, ModelData::Part const& part,
+    std::vector<uint32_t>& indices, std::vector<float>& positions)
+{
+    if (part.topology != ModelData::Topology_TriangleList || part.isAlpha || !part.indexCount || part.indexCount % 3
+        || part.vertexStream >= model.vertexStreams.size() || part.indexStream >= model.indexStreams.size()
+        || part.vertexOffset < 0)
+        return false;
+
+    auto const& vertices = model.vertexStreams[part.vertexStream];
+    auto const& stream = model.indexStreams[part.indexStream];
+    if (part.startIndex > stream.indexCount || part.indexCount > stream.indexCount - part.startIndex)
+        return false;
+
+    const ModelData::VertexElement* position = nullptr;
+    for (auto const& element : vertices.elements)
+    {
+        if (!strcmp(element.semanticName, "SV_Position") && element.semanticIndex == 0
+            && (element.format == ModelData::Format_R32G32B32_Float || element.format == ModelData::Format_R32G32B32A32_Float
+                || element.format == ModelData::Format_R16G16B16A16_SNorm))
+        {
+            position = &element;
+        }
+    }
+    if (!position)
+        return false;
+
+    indices.resize(part.indexCount);
+    uint32_t last = 0;
+    for (uint32_t i = 0; i < part.indexCount; ++i)
+    {
+        indices[i] = ReadIndex(stream, size_t(part.startIndex) + i);
+        last = std::max(last, indices[i]);
+    }
+    if (uint64_t(part.vertexOffset) + last >= vertices.vertexCount)
+        return false;
+
+    positions.resize((size_t(last) + 1) * 3);
+    const uint8_t* source = vertices.GetData() + size_t(part.vertexOffset) * vertices.stride + position->offset;
+    for (uint32_t v = 0; v <= last; ++v)
+    {
+        const uint8_t* p = source + size_t(v) * vertices.stride;
+        if (position->format == ModelData::Format_R16G16B16A16_SNorm)
+        {
+            int16_t packed[3];
+            memcpy(packed, p, sizeof(packed));
+            UnpackPosition(packed, mesh.positionOffset, mesh.positionScale, &positions[size_t(v) * 3]);
+        }
+        else
+        {
+            memcpy(&positions[size_t(v) * 3], p, 3 * sizeof(float));
+        }
+    }
+    return true;
+}
+
+PartClusters DX::BuildPartClusters(const uint32_t* indices, size_t indexCount, const float* positions, uint32_t vertexCount,
+    bool counterClockwise, uint32_t maxVertices, uint32_t maxTriangles)
+{
+    PartClusters result = {};
+    const uint32_t triangleCount = uint32_t(indexCount / 3);
+
+    // Front-facing unit normals: clockwise triangles face along (b - a) x (c - a), as the
+    // renderer culls them
+    std::vector<float> normals(size_t(triangleCount) * 3);
+    for (uint32_t t = 0; t < triangleCount; ++t)
+    {
+        const float* a = &positions[size_t(indices[t * 3]) * 3];
+        const float* b = &positions[size_t(indices[t * 3 + 1]) * 3];
+        const float* c = &positions[size_t(indices[t * 3 + 2]) * 3];
+        const float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        const float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+        float* normal = &normals[size_t(t) * 3];
+        normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        if (counterClockwise)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                normal[i] = -normal[i];
+            }
+        }
+        if (!Normalise(normal))
+        {
+            std::fill(normal, normal + 3, 0.f);
+        }
+    }
+
+    // The triangles around each vertex
+    std::vector<uint32_t> offsets(size_t(vertexCount) + 1, 0);
+    for (size_t i = 0; i < size_t(triangleCount) * 3; ++i)
+    {
+        ++offsets[indices[i] + 1];
+    }
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        offsets[v + 1] += offsets[v];
+    }
+    std::vector<uint32_t> adjacency(size_t(triangleCount) * 3);
+    {
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < size_t(triangleCount) * 3; ++i)
+        {
+            adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+        }
+    }
+
+    // Stamps mark the vertices and candidates of the cluster being built
+    std::vector<bool> used(triangleCount, false);
+    std::vector<uint32_t> vertexStamps(vertexCount, UINT32_MAX);
+    std::vector<uint32_t> candidateStamps(triangleCount, UINT32_MAX);
+    std::vector<uint32_t> candidates, clusterVertices, clusterTriangles;
+
+    result.indices.reserve(size_t(triangleCount) * 3);
+    uint32_t seed = 0;
+    for (uint32_t stamp = 0;; ++stamp)
+    {
+        while (seed < triangleCount && used[seed])
+        {
+            ++seed;
+        }
+        if (seed == triangleCount)
+            break;
+
+        MeshCluster cluster = {};
+        cluster.startIndex = uint32_t(result.indices.size());
+        float normalSum[3] = {};
+        candidates.clear();
+        clusterVertices.clear();
+        clusterTriangles.clear();
+
+        auto newVertices = [&](uint32_t t)
+        {
+            uint32_t count = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                const uint32_t vertex = indices[t * 3 + k];
+                count += (vertexStamps[vertex] != stamp
+                    && (k < 1 || indices[t * 3] != vertex)
+                    && (k < 2 || indices[t * 3 + 1] != vertex)) ? 1 : 0;
+            }
+            return count;
+        };
+
+        for (uint32_t next = seed; next != c_NoTriangle;)
+        {
+            used[next] = true;
+            clusterTriangles.push_back(next);
+            for (int k = 0; k < 3; ++k)
+            {
+                const uint32_t vertex = indices[next * 3 + k];
+                result.indices.push_back(vertex);
+                if (vertexStamps[vertex] != stamp)
+                {
+                    vertexStamps[vertex] = stamp;
+                    clusterVertices.push_back(vertex);
+                }
+
+                for (uint32_t a = offsets[vertex]; a < offsets[vertex + 1]; ++a)
+                {
+                    const uint32_t neighbour = adjacency[a];
+                    if (!used[neighbour] && candidateStamps[neighbour] != stamp)
+                    {
+                        candidateStamps[neighbour] = stamp;
+                        candidates.push_back(neighbour);
+                    }
+                }
+            }
+            for (int i = 0; i < 3; ++i)
+            {
+                normalSum[i] += normals[size_t(next) * 3 + i];
+            }
+
+            if (++cluster.triangleCount == maxTriangles)
+                break;
+
+            float axis[3] = { normalSum[0], normalSum[1], normalSum[2] };
+            Normalise(axis);
+
+            // Candidates already taken drop out as the list is scanned
+            next = c_NoTriangle;
+            float bestScore = FLT_MAX;
+            size_t kept = 0;
+            for (uint32_t candidate : candidates)
+            {
+                if (used[candidate])
+                    continue;
+                candidates[kept++] = candidate;
+
+                const uint32_t extra = newVertices(candidate);
+                if (clusterVertices.size() + extra > maxVertices)
+                    continue;
+
+                const float score = float(extra) + c_NormalWeight * (1.f - Dot(&normals[size_t(candidate) * 3], axis));
+                if (score < bestScore)
+                {
+                    bestScore = score;
+                    next = candidate;
+                }
+            }
+            candidates.resize(kept);
+
+            // Nothing touches the cluster: take the next triangle in order, which the cache
+            // optimisation left near the last, if it fits
+            if (next == c_NoTriangle)
+            {
+                while (seed < triangleCount && used[seed])
+                {
+                    ++seed;
+                }
+                if (seed < triangleCount && clusterVertices.size() + newVertices(seed) <= maxVertices)
+                {
+                    next = seed;
+                }
+            }
+        }
+
+        SetClusterBounds(cluster, clusterVertices, positions, clusterTriangles.data(), normals.data());
+        result.clusters.push_back(cluster);
+    }
+
+    result.wide = std::any_of(result.indices.begin(), result.indices.end(), [](uint32_t index) { return index >= 0xFFFF; });
+    return result;
+}
+
+std::vector<MeshClusters> DX::BuildModelClusters(ModelData const& model)
+{
+    std::vector<MeshClusters> result(model.meshes.size());
+
+    std::vector<uint32_t> indices;
+    std::vector<float> positions;
+    for (size_t m = 0; m < model.meshes.size(); ++m)
+    {
+        auto const& mesh = model.meshes[m];
+        std::vector<PartClusters> parts(mesh.parts.size());
+
+        bool split = false;
+        for (size_t p = 0; p < mesh.parts.size(); ++p)
+        {
+            if (ReadClusterPart(model, mesh, mesh.parts[p], indices, positions))
+            {
+                parts[p] = BuildPartClusters(indices.data(), indices.size(), positions.data(),
+                    uint32_t(positions.size() / 3), mesh.ccw);
+                split = true;
+            }
+        }
+
+        if (split)
+        {
+            result[m].parts.swap(parts);
+        }
+    }
+    return result;
+}
+
+void DX::MakeClusterView(const float modelToClip[16], const float camera[3], ClusterView& view)
+{
+    // Gribb and Hartmann: with clip = p * M, each plane is a sum or difference of M's columns;
+    // Direct3D's depth runs from 0, so the near plane is the third column alone
+    auto column = [&](int c, float* result)
+    {
+        for (int r = 0; r < 4; ++r)
+        {
+            result[r] = modelToClip[r * 4 + c];
+        }
+    };
+
+    float x[4], y[4], z[4], w[4];
+    column(0, x);
+    column(1, y);
+    column(2, z);
+    column(3, w);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        view.planes[0][i] = w[i] + x[i];
+        view.planes[1][i] = w[i] - x[i];
+        view.planes[2][i] = w[i] + y[i];
+        view.planes[3][i] = w[i] - y[i];
+        view.planes[4][i] = z[i];
+        view.planes[5][i] = w[i] - z[i];
+    }
+
+    for (auto& plane : view.planes)
+    {
+        const float length = sqrtf(Dot(plane, plane));
+        if (length > 0.f)
+        {
+            for (float& value : plane)
+            {
+                value /= length;
+            }
+        }
+    }
+
+    std::copy(camera, camera + 3, view.camera);
+}
+
+ClusterVisibility DX::ClassifyCluster(MeshCluster const& cluster, ClusterView const& view)
+{
+    if (IsOutside(cluster, view))
+        return Cluster_OutsideFrustum;
+    if (IsBackfacing(cluster, view.camera))
+        return Cluster_Backfacing;
+    return Cluster_Visible;
+}
+
+size_t DX::CullPartClusters(PartClusters const& part, ClusterView const& view, uint16_t* output, ClusterCulling& culling)
+{
+    return CullClusters(part, view, output, culling);
+}
+
+size_t DX::CullPartClusters(PartClusters const& part, ClusterView const& view, uint32_t* output, ClusterCulling& culling)
+{
+    return CullClusters(part, view, output, culling);
+}
@@ -0,0 +1,106 @@
+//
+// MeshClusters.h - Splitting model parts into small clusters, and culling them by frustum and facing
+//
+
+#pragma once
+
+#include "ModelData.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace DX
+{
+    // A part's triangles are split into clusters of at most c_MaxClusterVertices vertices and
+    // c_MaxClusterTriangles triangles (meshlets), each with a bounding sphere and a cone that
+    // holds the normals of its triangles. A cluster outside the frustum, or one all of whose
+    // triangles face away from the camera, can be dropped before the draw, so a mesh that is
+    // half off screen, or seen from one side, draws only the triangles that can show.
+    //
+    // Everything is in model units and the culling happens in model space, with the planes of
+    // the whole model-to-clip transform: that is exact for any world matrix that does not
+    // mirror, whose triangles the rasterizer culls the other way round.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+    const uint32_t c_MaxClusterVertices = 64;
+    const uint32_t c_MaxClusterTriangles = 124;
+
+    // The cone cutoff of a cluster whose normals spread too far for it ever to face away.
+    const float c_NoClusterCone = 2.f;
+
+    struct MeshCluster
+    {
+        float       center[3];      // bounding sphere
+        float       radius;
+        float       coneAxis[3];    // the mean of the triangles' front-facing normals
+        float       coneCutoff;     // sine of the widest angle between a normal and the axis
+        uint32_t    startIndex;     // into PartClusters::indices
+        uint32_t    triangleCount;
+    };
+
+    // A part's triangles, cluster by cluster; the indices are the part's own, relative to its
+    // vertexOffset, so they draw with its vertex buffer as they are.
+    struct PartClusters
+    {
+        std::vector<MeshCluster>    clusters;
+        std::vector<uint32_t>       indices;
+        bool                        wide;       // some index does not fit in 16 bits
+    };
+
+    // By part of the mesh; a part with no clusters draws as it is.
+    struct MeshClusters
+    {
+        std::vector<PartClusters>   parts;
+    };
+
+    // Grows each cluster from a seed triangle over its neighbours, taking the one that adds the
+    // fewest vertices and, among those, the one whose normal is nearest the cluster's so far;
+    // a cluster stops when it is full or nothing next to it fits, and the next one starts at
+    // the first triangle left. 'positions' are three floats per vertex.
+    PartClusters BuildPartClusters(const uint32_t* indices, size_t indexCount, const float* positions, uint32_t vertexCount,
+        bool counterClockwise, uint32_t maxVertices = c_MaxClusterVertices, uint32_t maxTriangles = c_MaxClusterTriangles);
+
+    // The indices of an opaque triangle-list part and the positions of the vertices they use,
+    // three floats each in model units (unpacking packed positions, VertexPacking.h); false
+    // for a part that cannot be clustered.
+    bool ReadClusterPart(ModelData const& model, ModelData::Mesh const& mesh, ModelData::Part const& part,
+        std::vector<uint32_t>& indices, std::vector<float>& positions);
+
+    // Clusters for the opaque triangle-list parts of every mesh, by mesh; alpha parts keep their
+    // order, which they blend in, and meshes with no part split have no parts here at all.
+    std::vector<MeshClusters> BuildModelClusters(ModelData const& model);
+
+    // A view in a mesh's model space.
+    struct ClusterView
+    {
+        float       planes[6][4];   // pointing in, normalised
+        float       camera[3];
+    };
+
+    // 'modelToClip' is the row-major product of world, view and projection (row vectors, as
+    // DirectXMath), Direct3D clip space; 'camera' is the camera's position in model space.
+    void MakeClusterView(const float modelToClip[16], const float camera[3], ClusterView& view);
+
+    enum ClusterVisibility
+    {
+        Cluster_Visible,
+        Cluster_OutsideFrustum,     // wholly outside one of the planes
+        Cluster_Backfacing,         // every triangle faces away from the camera
+    };
+
+    ClusterVisibility ClassifyCluster(MeshCluster const& cluster, ClusterView const& view);
+
+    struct ClusterCulling
+    {
+        uint64_t    clusters;           // tested
+        uint64_t    frustumCulled;
+        uint64_t    backfaceCulled;
+        uint64_t    triangles;          // of the clusters tested
+        uint64_t    trianglesCulled;
+    };
+
+    // Writes the indices of the part's clusters that are at least partly in the frustum and may
+    // face the camera to 'output', which has room for all of the part's, and returns how many.
+    size_t CullPartClusters(PartClusters const& part, ClusterView const& view, uint16_t* output, ClusterCulling& culling);
+    size_t CullPartClusters(PartClusters const& part, ClusterView const& view, uint32_t* output, ClusterCulling& culling);
+}
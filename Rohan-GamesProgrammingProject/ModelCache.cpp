@@ -0,0 +1,535 @@
+//
+// ModelCache.cpp - Shares parsed model geometry between model instances
+//
+
+#include "pch.h"
+#include "ModelCache.h"
+#include "JobSystem.h"
+#include "MappedFile.h"
+#include "ModelUpload.h"
+#include "Profiler.h"
+#include "VertexPacking.h"
+
+using namespace DirectX;
+using namespace DX;
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+    // FNV-1a, 64-bit
+    uint64_t HashContents(const uint8_t* data, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= data[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::wstring CanonicalPath(const wchar_t* fileName)
+    {
+        wchar_t fullPath[MAX_PATH];
+        DWORD length = GetFullPathNameW(fileName, MAX_PATH, fullPath, nullptr);
+        if (!length || length >= MAX_PATH)
+        {
+            return std::wstring(fileName);
+        }
+
+        CharLowerBuffW(fullPath, length);
+        return std::wstring(fullPath, length);
+    }
+
+    const wchar_t* OptionalString(const std::wstring& value)
+    {
+        return value.empty() ? nullptr : value.c_str();
+    }
+}
+
+ModelCache::Material::Material(const IEffectFactory::EffectInfo& source) :
+    info(source),
+    diffuseTexture(source.diffuseTexture ? source.diffuseTexture : L""),
+    specularTexture(source.specularTexture ? source.specularTexture : L""),
+    normalTexture(source.normalTexture ? source.normalTexture : L""),
+    emissiveTexture(source.emissiveTexture ? source.emissiveTexture : L"")
+{
+    // The loader's strings do not outlive the CreateEffect call
+    info.name = nullptr;
+    info.diffuseTexture = info.specularTexture = info.normalTexture = info.emissiveTexture = nullptr;
+}
+
+IEffectFactory::EffectInfo ModelCache::Material::GetUnsharedInfo() const
+{
+    IEffectFactory::EffectInfo result = info;
+    result.diffuseTexture = OptionalString(diffuseTexture);
+    result.specularTexture = OptionalString(specularTexture);
+    result.normalTexture = OptionalString(normalTexture);
+    result.emissiveTexture = OptionalString(emissiveTexture);
+    return result;
+}
+
+const ModelCache::Material* ModelCache::Asset::FindMaterial(const IEffect* effect) const
+{
+    auto it = materials.find(effect);
+    return (it != materials.end()) ? &it->second : nullptr;
+}
+
+// Forwards to the game's factory and remembers which material produced each effect.
+class ModelCache::RecordingEffectFactory : public IEffectFactory
+{
+public:
+    RecordingEffectFactory(IEffectFactory& inner, Asset& asset) :
+        m_inner(inner),
+        m_asset(asset)
+    {
+    }
+
+    std::shared_ptr<IEffect> __cdecl CreateEffect(const EffectInfo& info, ID3D11DeviceContext* deviceContext) override
+    {
+        auto effect = m_inner.CreateEffect(info, deviceContext);
+        m_asset.materials.emplace(effect.get(), Material(info));
+        return effect;
+    }
+
+    void __cdecl CreateTexture(const wchar_t* name, ID3D11DeviceContext* deviceContext, ID3D11ShaderResourceView** textureView) override
+    {
+        m_inner.CreateTexture(name, deviceContext, textureView);
+    }
+
+private:
+    IEffectFactory& m_inner;
+    Asset&          m_asset;
+};
+
+ModelCache::ModelCache(ID3D11Device* device, IEffectFactory& fxFactory, bool mapFiles,
+    const PackFile* pack, PackFile::ParallelFor packParallelFor) :
+    m_device(device),
+    m_fxFactory(fxFactory),
+    m_mapFiles(mapFiles),
+    m_pack(pack),
+    m_packParallelFor(std::move(packParallelFor)),
+    m_stats{}
+{
+}
+
+ModelCache::~ModelCache()
+{
+}
+
+std::unique_ptr<Model> ModelCache::CreateInstance(const wchar_t* fileName)
+{
+    auto asset = Acquire(fileName);
+
+    auto model = std::make_unique<Model>();
+    model->name = asset->prototype->name;
+
+    // Parts that shared an effect in the prototype share one new effect in the instance
+    std::unordered_map<const IEffect*, std::shared_ptr<IEffect>> effects;
+
+    for (const auto& source : asset->prototype->meshes)
+    {
+        // The deleter holds the asset, which keeps the cache entry alive while instances exist
+        std::shared_ptr<ModelMesh> mesh(new ModelMesh(), [asset](ModelMesh* p) { delete p; });
+        mesh->boundingSphere = source->boundingSphere;
+        mesh->boundingBox = source->boundingBox;
+        mesh->name = source->name;
+        mesh->ccw = source->ccw;
+        mesh->pmalpha = source->pmalpha;
+
+        for (const auto& sourcePart : source->meshParts)
+        {
+            auto part = std::make_unique<ModelMeshPart>(*sourcePart);
+
+            auto& effect = effects[sourcePart->effect.get()];
+            if (!effect)
+            {
+                auto material = asset->FindMaterial(sourcePart->effect.get());
+                effect = material
+                    ? m_fxFactory.CreateEffect(material->GetUnsharedInfo(), nullptr)
+                    : sourcePart->effect;
+            }
+            part->effect = effect;
+
+            mesh->meshParts.emplace_back(std::move(part));
+        }
+
+        model->meshes.emplace_back(std::move(mesh));
+    }
+
+    ++m_stats.instances;
+    return model;
+}
+
+std::shared_ptr<ModelCache::Asset> ModelCache::Acquire(const wchar_t* fileName)
+{
+    auto path = CanonicalPath(fileName);
+
+    if (auto asset = FindByPath(path))
+        return asset;
+
+    DX_PROFILE_SCOPE("LoadModel");
+
+    LARGE_INTEGER start, parsed, end, frequency;
+    QueryPerformanceCounter(&start);
+
+    PendingLoad source;
+    source.fileName = fileName;
+    Open(source);
+    CountBytes(source);
+
+    auto asset = FindByContent(source.hash, source.size);
+    if (asset)
+    {
+        ++m_stats.contentHits;
+        QueryPerformanceCounter(&parsed);
+        end = parsed;
+    }
+    else
+    {
+        Parse(source);
+        QueryPerformanceCounter(&parsed);
+
+        asset = Upload(source);
+        QueryPerformanceCounter(&end);
+    }
+
+    m_byPath[path] = asset;
+
+    QueryPerformanceFrequency(&frequency);
+    m_stats.loadMs += double(parsed.QuadPart - start.QuadPart) * 1000.0 / double(frequency.QuadPart);
+    m_stats.uploadMs += double(end.QuadPart - parsed.QuadPart) * 1000.0 / double(frequency.QuadPart);
+
+    return asset;
+}
+
+std::vector<std::shared_ptr<const ModelCache::Asset>> ModelCache::Preload(std::vector<std::wstring> const& fileNames, JobSystem& jobs)
+{
+    DX_PROFILE_SCOPE("PreloadModels");
+
+    std::vector<std::shared_ptr<const Asset>> result;
+
+    // Distinct paths that are not already live
+    std::vector<std::wstring> paths;
+    std::vector<std::unique_ptr<PendingLoad>> sources;
+    for (const auto& fileName : fileNames)
+    {
+        auto path = CanonicalPath(fileName.c_str());
+        if (std::find(paths.begin(), paths.end(), path) != paths.end())
+            continue;
+
+        if (auto asset = FindByPath(path))
+        {
+            result.push_back(asset);
+            continue;
+        }
+
+        paths.push_back(path);
+        sources.push_back(std::make_unique<PendingLoad>());
+        sources.back()->fileName = fileName;
+    }
+
+    if (sources.empty())
+        return result;
+
+    LARGE_INTEGER start, parsed, end, frequency;
+    QueryPerformanceCounter(&start);
+
+    jobs.ParallelFor(sources.size(), 1, [&](size_t begin, size_t finish)
+    {
+        for (size_t i = begin; i < finish; ++i)
+        {
+            Open(*sources[i]);
+        }
+    });
+
+    for (const auto& source : sources)
+    {
+        CountBytes(*source);
+    }
+
+    // Only the first file with given contents is parsed, unless a live asset already has them
+    std::vector<std::shared_ptr<Asset>> assets(sources.size());
+    std::vector<size_t> first(sources.size());
+    std::vector<size_t> misses;
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        first[i] = i;
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (sources[j]->hash == sources[i]->hash && sources[j]->size == sources[i]->size)
+            {
+                first[i] = first[j];
+                break;
+            }
+        }
+
+        if (first[i] != i)
+        {
+            ++m_stats.contentHits;
+        }
+        else
+        {
+            assets[i] = FindByContent(sources[i]->hash, sources[i]->size);
+            if (assets[i])
+            {
+                ++m_stats.contentHits;
+            }
+            else
+            {
+                misses.push_back(i);
+            }
+        }
+    }
+
+    jobs.ParallelFor(misses.size(), 1, [&](size_t begin, size_t finish)
+    {
+        for (size_t i = begin; i < finish; ++i)
+        {
+            Parse(*sources[misses[i]]);
+        }
+    });
+    QueryPerformanceCounter(&parsed);
+
+    for (size_t i : misses)
+    {
+        assets[i] = Upload(*sources[i]);
+        sources[i].reset();
+    }
+    QueryPerformanceCounter(&end);
+
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        auto& asset = assets[first[i]];
+        m_byPath[paths[i]] = asset;
+        if (first[i] == i)
+        {
+            result.push_back(asset);
+        }
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    m_stats.loadMs += double(parsed.QuadPart - start.QuadPart) * 1000.0 / double(frequency.QuadPart);
+    m_stats.uploadMs += double(end.QuadPart - parsed.QuadPart) * 1000.0 / double(frequency.QuadPart);
+
+    return result;
+}
+
+std::unique_ptr<ModelCache::PendingLoad> ModelCache::Read(const wchar_t* fileName) const
+{
+    auto pending = std::make_unique<PendingLoad>();
+    pending->fileName = fileName;
+    Open(*pending);
+    return pending;
+}
+
+void ModelCache::Parse(PendingLoad& pending)
+{
+    DX_PROFILE_SCOPE("ParseModel");
+    pending.parsed = ModelData::Parse(pending.fileName.c_str(), pending.data, pending.size);
+
+    for (const auto& atlas : pending.atlases)
+    {
+        pending.atlasedMaterials += RemapToAtlas(*pending.parsed, *atlas);
+    }
+
+    // After the atlas, so coordinates it moved round to half precision only once
+    const auto packing = PackModelVertices(*pending.parsed);
+    pending.packedVertexBytes = size_t(packing.bytesBefore - packing.bytesAfter);
+
+    // From the packed positions, so the bounds hold what the vertex shader will see
+    pending.clusters = BuildModelClusters(*pending.parsed);
+    pending.occluders = BuildModelOccluders(*pending.parsed);
+}
+
+size_t ModelCache::GetUploadSize(PendingLoad const& pending)
+{
+    size_t bytes = 0;
+    if (pending.parsed)
+    {
+        for (const auto& stream : pending.parsed->vertexStreams)
+        {
+            bytes += stream.size;
+        }
+        for (const auto& stream : pending.parsed->indexStreams)
+        {
+            bytes += stream.size;
+        }
+    }
+    return bytes;
+}
+
+std::shared_ptr<const ModelCache::Asset> ModelCache::Complete(PendingLoad& pending)
+{
+    auto path = CanonicalPath(pending.fileName.c_str());
+
+    // Another load of the same path or contents may have finished first
+    if (auto asset = FindByPath(path))
+        return asset;
+
+    CountBytes(pending);
+
+    auto asset = FindByContent(pending.hash, pending.size);
+    if (asset)
+    {
+        ++m_stats.contentHits;
+    }
+    else
+    {
+        if (!pending.parsed)
+        {
+            Parse(pending);
+        }
+
+        LARGE_INTEGER start, end, frequency;
+        QueryPerformanceCounter(&start);
+
+        asset = Upload(pending);
+
+        QueryPerformanceCounter(&end);
+        QueryPerformanceFrequency(&frequency);
+        m_stats.uploadMs += double(end.QuadPart - start.QuadPart) * 1000.0 / double(frequency.QuadPart);
+    }
+
+    m_byPath[path] = asset;
+    return asset;
+}
+
+std::shared_ptr<const ModelCache::Asset> ModelCache::Find(const wchar_t* fileName)
+{
+    return FindByPath(CanonicalPath(fileName));
+}
+
+std::shared_ptr<ModelCache::Asset> ModelCache::FindByPath(const std::wstring& path)
+{
+    auto byPath = m_byPath.find(path);
+    if (byPath != m_byPath.end())
+    {
+        if (auto asset = byPath->second.lock())
+        {
+            ++m_stats.pathHits;
+            return asset;
+        }
+    }
+    return nullptr;
+}
+
+void ModelCache::Open(PendingLoad& pending) const
+{
+    auto packed = m_pack ? m_pack->Find(pending.fileName.c_str()) : nullptr;
+    if (packed)
+    {
+        pending.data = m_pack->GetStoredData(*packed);
+        if (!pending.data)
+        {
+            pending.copy = m_pack->Read(*packed, m_packParallelFor);
+            pending.data = pending.copy.data();
+        }
+        pending.size = size_t(packed->size);
+    }
+    else if (m_mapFiles)
+    {
+        pending.mapped = std::make_unique<MappedFile>(pending.fileName.c_str());
+        pending.data = pending.mapped->data();
+        pending.size = pending.mapped->size();
+    }
+    else
+    {
+        pending.copy = DX::ReadData(pending.fileName.c_str());
+        pending.data = pending.copy.data();
+        pending.size = pending.copy.size();
+    }
+
+    pending.hash = HashContents(pending.data, pending.size);
+    pending.atlases = m_atlases;
+}
+
+void ModelCache::CountBytes(PendingLoad const& pending)
+{
+    if (pending.copy.empty())
+    {
+        m_stats.bytesMapped += pending.size;
+    }
+    else
+    {
+        m_stats.bytesRead += pending.size;
+    }
+}
+
+std::shared_ptr<ModelCache::Asset> ModelCache::FindByContent(uint64_t hash, size_t size)
+{
+    auto byContent = m_byContent.find(hash);
+    if (byContent != m_byContent.end())
+    {
+        auto asset = byContent->second.lock();
+        if (asset && asset->size == size)
+        {
+            return asset;
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<ModelCache::Asset> ModelCache::Upload(PendingLoad& pending)
+{
+    DX_PROFILE_SCOPE("UploadModel");
+
+    const ModelData& data = *pending.parsed;
+    auto asset = std::make_shared<Asset>();
+    asset->hash = pending.hash;
+    asset->size = pending.size;
+
+    RecordingEffectFactory factory(m_fxFactory, *asset);
+    asset->prototype = UploadModel(m_device.Get(), data, factory, &asset->lods);
+
+    asset->positionTransforms.resize(data.meshes.size());
+    for (size_t i = 0; i < data.meshes.size(); ++i)
+    {
+        auto const& mesh = data.meshes[i];
+        XMStoreFloat4x4(&asset->positionTransforms[i],
+            XMMatrixScaling(mesh.positionScale, mesh.positionScale, mesh.positionScale)
+            * XMMatrixTranslation(mesh.positionOffset[0], mesh.positionOffset[1], mesh.positionOffset[2]));
+    }
+
+    asset->occluders = std::move(pending.occluders);
+    asset->clusters = std::move(pending.clusters);
+    for (auto const& mesh : asset->clusters)
+    {
+        for (auto const& part : mesh.parts)
+        {
+            m_stats.clusters += part.clusters.size();
+        }
+    }
+
+    m_byContent[asset->hash] = asset;
+
+    ++m_stats.loads;
+    m_stats.atlasedMaterials += pending.atlasedMaterials;
+    m_stats.packedVertexBytes += pending.packedVertexBytes;
+    return asset;
+}
+
+void ModelCache::AddAtlas(std::shared_ptr<const AtlasLayout> layout)
+{
+    m_atlases.push_back(std::move(layout));
+}
+
+void ModelCache::Clear()
+{
+    m_byPath.clear();
+    m_byContent.clear();
+}
+
+size_t ModelCache::GetLiveAssetCount() const
+{
+    size_t count = 0;
+    for (const auto& entry : m_byContent)
+    {
+        if (!entry.second.expired())
+        {
+            ++count;
+        }
+    }
+    return count;
+}
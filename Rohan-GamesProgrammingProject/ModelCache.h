@@ -0,0 +1,163 @@
+//
+// ModelCache.h - Shares parsed model geometry between model instances
+//
+
+#pragma once
+
+#include "AtlasLayout.h"
+#include "MappedFile.h"
+#include "MeshClusters.h"
+#include "ModelData.h"
+#include "ModelUpload.h"
+#include "OcclusionBuffer.h"
+#include "PackFile.h"
+
+#include <Model.h>
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace DX
+{
+    class JobSystem;
+
+    // Each distinct file is read, parsed (ModelData) and uploaded (UploadModel) once, keyed by
+    // canonical path and by a hash of its contents, so copies under other names are shared too.
+    // Instances share the asset's buffers but own fresh effects, so lighting and fog can be set
+    // per instance; the cache holds assets weakly, so an asset lives as long as its instances.
+    //
+    // Files are parsed in place from a mapped view or the pack's mapping, or from a heap copy
+    // with mapFiles false or a compressed pack entry. What else an asset keeps is described
+    // where it is built: levels of detail (ModelLod.h), packed vertices (VertexPacking.h),
+    // clusters (MeshClusters.h) and occluders (OcclusionBuffer.h).
+    class ModelCache
+    {
+    public:
+        // Deep copy of the EffectInfo the loader requested for one material.
+        struct Material
+        {
+            explicit Material(const DirectX::IEffectFactory::EffectInfo& source);
+
+            // Unnamed, so a sharing factory creates a new effect rather than returning the cached one.
+            DirectX::IEffectFactory::EffectInfo GetUnsharedInfo() const;
+
+            DirectX::IEffectFactory::EffectInfo  info;
+            std::wstring                        diffuseTexture;
+            std::wstring                        specularTexture;
+            std::wstring                        normalTexture;
+            std::wstring                        emissiveTexture;
+        };
+
+        // One parsed file. The prototype owns the GPU buffers every instance shares.
+        struct Asset
+        {
+            const Material* FindMaterial(const DirectX::IEffect* effect) const;
+
+            std::unique_ptr<DirectX::Model>                                 prototype;
+            std::vector<ModelMeshLods>                                      lods;       // by mesh of the prototype
+            std::vector<DirectX::XMFLOAT4X4>                                positionTransforms; // by mesh: stored positions to model units
+            std::vector<MeshClusters>                                       clusters;   // by mesh
+            std::vector<OccluderMesh>                                       occluders;  // by mesh
+            std::unordered_map<const DirectX::IEffect*, Material>           materials;
+            uint64_t                                                        hash;
+            size_t                                                          size;
+        };
+
+        struct Statistics
+        {
+            size_t  loads;          // files parsed and uploaded
+            size_t  pathHits;       // requests satisfied by canonical path
+            size_t  contentHits;    // requests for a new path whose contents were already loaded
+            size_t  instances;
+            size_t  bytesRead;      // copied or decompressed into heap buffers
+            size_t  bytesMapped;    // parsed in place from mapped views of files or the pack
+            size_t  atlasedMaterials;   // moved onto an atlas
+            size_t  packedVertexBytes;  // saved by packing float vertex streams as they loaded
+            size_t  clusters;       // built for the assets loaded
+            double  loadMs;         // reading, hashing and parsing misses (wall time for a preload)
+            double  uploadMs;       // creating buffers, effects and input layouts for misses
+        };
+
+        // The pack, when given, must outlive the cache.
+        ModelCache(_In_ ID3D11Device* device, DirectX::IEffectFactory& fxFactory, bool mapFiles = true,
+            _In_opt_ const PackFile* pack = nullptr, PackFile::ParallelFor packParallelFor = nullptr);
+
+        ModelCache(ModelCache const&) = delete;
+        ModelCache& operator= (ModelCache const&) = delete;
+
+        ~ModelCache();
+
+        std::unique_ptr<DirectX::Model> CreateInstance(_In_z_ const wchar_t* fileName);
+
+        // The shared asset itself, for render paths that draw the prototype geometry directly.
+        std::shared_ptr<const Asset> GetAsset(_In_z_ const wchar_t* fileName) { return Acquire(fileName); }
+
+        // Loads every file not already cached, parsing in parallel. The cache only holds assets
+        // weakly, so the caller keeps the returned references until it has made its instances.
+        std::vector<std::shared_ptr<const Asset>> Preload(std::vector<std::wstring> const& fileNames, JobSystem& jobs);
+
+        // One file on its way into the cache, for callers that schedule the steps themselves.
+        // Read and Parse touch neither the cache nor the device, so they may run on any thread;
+        // Complete uploads (unless the contents are already cached) on the cache's thread.
+        struct PendingLoad
+        {
+            std::wstring                    fileName;
+            std::unique_ptr<MappedFile>     mapped;     // at most one of these holds the file;
+            std::vector<uint8_t>            copy;       // neither does for a stored pack entry
+            const uint8_t*                  data = nullptr;
+            size_t                          size = 0;
+            uint64_t                        hash = 0;
+            std::vector<std::shared_ptr<const AtlasLayout>> atlases;
+            std::unique_ptr<ModelData>      parsed;
+            size_t                          atlasedMaterials = 0;
+            size_t                          packedVertexBytes = 0;
+            std::vector<MeshClusters>       clusters;
+            std::vector<OccluderMesh>       occluders;
+        };
+
+        std::unique_ptr<PendingLoad> Read(_In_z_ const wchar_t* fileName) const;
+        static void Parse(PendingLoad& pending);
+        std::shared_ptr<const Asset> Complete(PendingLoad& pending);
+
+        // Vertex and index bytes a parsed load will create buffers for.
+        static size_t GetUploadSize(PendingLoad const& pending);
+
+        // The live asset for a path, without loading it.
+        std::shared_ptr<const Asset> Find(_In_z_ const wchar_t* fileName);
+
+        // Files read from now on have their materials moved onto the atlas where they can.
+        // Assets already loaded keep their own textures.
+        void AddAtlas(std::shared_ptr<const AtlasLayout> layout);
+
+        // Forgets every asset. Existing instances stay valid.
+        void Clear();
+
+        size_t GetLiveAssetCount() const;
+        const Statistics& GetStatistics() const { return m_stats; }
+
+    private:
+        class RecordingEffectFactory;
+
+        std::shared_ptr<Asset> Acquire(const wchar_t* fileName);
+        std::shared_ptr<Asset> FindByContent(uint64_t hash, size_t size);
+        std::shared_ptr<Asset> Upload(PendingLoad& pending);
+        std::shared_ptr<Asset> FindByPath(const std::wstring& path);
+        void Open(PendingLoad& pending) const;
+        void CountBytes(PendingLoad const& pending);
+
+        Microsoft::WRL::ComPtr<ID3D11Device>                    m_device;
+        DirectX::IEffectFactory&                                m_fxFactory;
+        bool                                                    m_mapFiles;
+        const PackFile*                                         m_pack;
+        PackFile::ParallelFor                                   m_packParallelFor;
+
+        std::unordered_map<std::wstring, std::weak_ptr<Asset>>  m_byPath;
+        std::unordered_map<uint64_t, std::weak_ptr<Asset>>      m_byContent;
+
+        std::vector<std::shared_ptr<const AtlasLayout>>         m_atlases;
+
+        Statistics                                              m_stats;
+    };
+}
@@ -0,0 +1,1097 @@
+//
+// ModelData.cpp - Device-independent parse of SDKMESH, CMO and VBO model files
+//
+// Deliberately does not use the precompiled header, which pulls in Windows and Direct3D.
+//
+
+#include "ModelData.h"
+#include "ModelLod.h"
+#include "SDKMeshFormat.h"
+
+#include <algorithm>
+#include <iterator>
+#include <math.h>
+#include <stdexcept>
+#include <string.h>
+#include <wctype.h>
+
+using namespace DX;
+
+namespace
+{
+    // D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM, for buffers without Loader_AllowLargeModels
+    const uint64_t c_MaxBufferBytes = 128u * 1024u * 1024u;
+
+    void CheckBufferSize(uint64_t bytes, uint32_t flags, const char* what)
+    {
+        if (bytes > UINT32_MAX
+            || (!(flags & ModelData::Loader_AllowLargeModels) && bytes > c_MaxBufferBytes))
+        {
+            throw std::runtime_error(std::string(what) + " too large for Direct3D 11");
+        }
+    }
+
+    void AppendCodePoint(std::wstring& result, uint32_t codePoint)
+    {
+        if (sizeof(wchar_t) == 2 && codePoint > 0xFFFF)
+        {
+            codePoint -= 0x10000;
+            result.push_back(wchar_t(0xD800 + (codePoint >> 10)));
+            result.push_back(wchar_t(0xDC00 + (codePoint & 0x3FF)));
+        }
+        else
+        {
+            result.push_back(wchar_t(codePoint));
+        }
+    }
+
+    // Fixed-size, null-terminated UTF-8 field. Malformed sequences become U+FFFD.
+    std::wstring FromUtf8(const char* text, size_t capacity)
+    {
+        std::wstring result;
+        size_t length = strnlen(text, capacity);
+
+        for (size_t i = 0; i < length;)
+        {
+            uint8_t lead = uint8_t(text[i++]);
+
+            uint32_t codePoint;
+            size_t extra;
+            if (lead < 0x80)                { codePoint = lead; extra = 0; }
+            else if ((lead & 0xE0) == 0xC0) { codePoint = lead & 0x1F; extra = 1; }
+            else if ((lead & 0xF0) == 0xE0) { codePoint = lead & 0x0F; extra = 2; }
+            else if ((lead & 0xF8) == 0xF0) { codePoint = lead & 0x07; extra = 3; }
+            else                            { codePoint = 0xFFFD; extra = 0; }
+
+            for (; extra && i < length && (uint8_t(text[i]) & 0xC0) == 0x80; --extra)
+            {
+                codePoint = (codePoint << 6) | (uint8_t(text[i++]) & 0x3F);
+            }
+            if (extra)
+            {
+                codePoint = 0xFFFD;
+            }
+
+            AppendCodePoint(result, codePoint);
+        }
+
+        return result;
+    }
+
+    // Bounds-checked reads of a little-endian file whose fields need not be aligned.
+    class Reader
+    {
+    public:
+        Reader(const uint8_t* data, size_t size) :
+            m_data(data),
+            m_size(size),
+            m_offset(0)
+        {
+        }
+
+        size_t Remaining() const { return m_size - m_offset; }
+
+        const uint8_t* Take(uint64_t bytes)
+        {
+            if (bytes > m_size - m_offset)
+                throw std::runtime_error("Unexpected end of model file");
+
+            const uint8_t* result = m_data + m_offset;
+            m_offset += size_t(bytes);
+            return result;
+        }
+
+        template<typename T>
+        T Read()
+        {
+            T value;
+            memcpy(&value, Take(sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        // CMO strings: a character count, then that many UTF-16 code units.
+        std::wstring ReadString()
+        {
+            uint32_t length = Read<uint32_t>();
+            const uint8_t* units = Take(uint64_t(length) * 2);
+
+            std::wstring result;
+            result.reserve(length);
+            for (uint32_t i = 0; i < length; ++i)
+            {
+                uint32_t unit = units[i * 2] | (uint32_t(units[i * 2 + 1]) << 8);
+                if (sizeof(wchar_t) != 2 && unit >= 0xD800 && unit < 0xDC00 && i + 1 < length)
+                {
+                    uint32_t low = units[i * 2 + 2] | (uint32_t(units[i * 2 + 3]) << 8);
+                    if (low >= 0xDC00 && low < 0xE000)
+                    {
+                        unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                        ++i;
+                    }
+                }
+                AppendCodePoint(result, unit);
+            }
+            return result;
+        }
+
+    private:
+        const uint8_t*  m_data;
+        size_t          m_size;
+        size_t          m_offset;
+    };
+
+    float SRGBToLinear(float value)
+    {
+        return (value <= 0.04045f) ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+    }
+
+    void SetColor(float (&color)[3], float r, float g, float b, bool srgb)
+    {
+        color[0] = srgb ? SRGBToLinear(r) : r;
+        color[1] = srgb ? SRGBToLinear(g) : g;
+        color[2] = srgb ? SRGBToLinear(b) : b;
+    }
+
+    ModelData::Material DefaultMaterial()
+    {
+        ModelData::Material material = {};
+        material.alpha = 1.f;
+        return material;
+    }
+
+    void SetBoundsFromBox(ModelData::Mesh& mesh, const float center[3], const float extents[3])
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            mesh.boxCenter[i] = center[i];
+            mesh.boxExtents[i] = extents[i];
+            mesh.sphereCenter[i] = center[i];
+        }
+        mesh.sphereRadius = sqrtf(extents[0] * extents[0] + extents[1] * extents[1] + extents[2] * extents[2]);
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// SDKMESH
+//--------------------------------------------------------------------------------------
+
+namespace SDKMESH
+{
+    // What a vertex declaration implies for the material, as in ModelLoadSDKMESH.cpp
+    enum : uint32_t
+    {
+        PerVertexColor = 0x1,
+        Skinning = 0x2,
+        DualTexture = 0x4,
+        NormalMaps = 0x8,
+        BiasedVertexNormals = 0x10,
+    };
+
+    // Direct3D 9 vertex declaration to input elements. Decoding stops at the first element it
+    // does not understand, which the Model loader does too.
+    uint32_t DecodeDeclaration(const DeclElement (&decl)[c_MaxVertexElements], std::vector<ModelData::VertexElement>& elements)
+    {
+        uint32_t offset = 0;
+        uint32_t texcoords = 0;
+        uint32_t flags = 0;
+        bool position = false;
+
+        for (uint32_t index = 0; index < c_MaxVertexElements; ++index)
+        {
+            const auto& element = decl[index];
+
+            if (element.usage == 0xFF || element.type == DeclType_Unused || element.offset != offset)
+                break;
+
+            ModelData::VertexElement desc = { nullptr, 0, ModelData::Format_R32G32B32_Float, offset };
+            uint32_t size = 0;
+
+            switch (element.usage)
+            {
+            case DeclUsage_Position:
+                // Short4N only as the cooker packs it (VertexPacking.h), against the mesh's box
+                if (element.type == DeclType_Float3 || element.type == DeclType_Short4N)
+                {
+                    desc.semanticName = "SV_Position";
+                    if (element.type == DeclType_Short4N)
+                    {
+                        desc.format = ModelData::Format_R16G16B16A16_SNorm;
+                        size = 8;
+                    }
+                    else
+                    {
+                        size = 12;
+                    }
+                    position = true;
+                }
+                break;
+
+            case DeclUsage_Normal:
+            case DeclUsage_Tangent:
+            case DeclUsage_Binormal:
+                desc.semanticName = (element.usage == DeclUsage_Normal) ? "NORMAL"
+                    : (element.usage == DeclUsage_Tangent) ? "TANGENT" : "BINORMAL";
+                switch (element.type)
+                {
+                case DeclType_Float3:               size = 12; break;
+                case DeclType_UByte4N:              desc.format = ModelData::Format_R8G8B8A8_UNorm; flags |= BiasedVertexNormals; size = 4; break;
+                case DeclType_Short4N:              desc.format = ModelData::Format_R16G16B16A16_SNorm; size = 8; break;
+                case DeclType_Float16_4:            desc.format = ModelData::Format_R16G16B16A16_Float; size = 8; break;
+                case DeclType_R10G10B10A2_UNorm:    desc.format = ModelData::Format_R10G10B10A2_UNorm; flags |= BiasedVertexNormals; size = 4; break;
+                case DeclType_R11G11B10_Float:      desc.format = ModelData::Format_R11G11B10_Float; flags |= BiasedVertexNormals; size = 4; break;
+                case DeclType_R8G8B8A8_SNorm:       desc.format = ModelData::Format_R8G8B8A8_SNorm; size = 4; break;
+                case DeclType_Dec3N:                desc.format = ModelData::Format_R10G10B10A2_UNorm; size = 4; break;
+                }
+                if (size && element.usage == DeclUsage_Tangent)
+                {
+                    flags |= NormalMaps;
+                }
+                break;
+
+            case DeclUsage_Color:
+                desc.semanticName = "COLOR";
+                switch (element.type)
+                {
+                case DeclType_Float4:               desc.format = ModelData::Format_R32G32B32A32_Float; size = 16; break;
+                case DeclType_D3DColor:             desc.format = ModelData::Format_B8G8R8A8_UNorm; size = 4; break;
+                case DeclType_UByte4N:              desc.format = ModelData::Format_R8G8B8A8_UNorm; size = 4; break;
+                case DeclType_Float16_4:            desc.format = ModelData::Format_R16G16B16A16_Float; size = 8; break;
+                case DeclType_R10G10B10A2_UNorm:    desc.format = ModelData::Format_R10G10B10A2_UNorm; size = 4; break;
+                case DeclType_R11G11B10_Float:      desc.format = ModelData::Format_R11G11B10_Float; size = 4; break;
+                }
+                if (size)
+                {
+                    flags |= PerVertexColor;
+                }
+                break;
+
+            case DeclUsage_TexCoord:
+                desc.semanticName = "TEXCOORD";
+                desc.semanticIndex = element.usageIndex;
+                switch (element.type)
+                {
+                case DeclType_Float1:               desc.format = ModelData::Format_R32_Float; size = 4; break;
+                case DeclType_Float2:               desc.format = ModelData::Format_R32G32_Float; size = 8; break;
+                case DeclType_Float3:               desc.format = ModelData::Format_R32G32B32_Float; size = 12; break;
+                case DeclType_Float4:               desc.format = ModelData::Format_R32G32B32A32_Float; size = 16; break;
+                case DeclType_Float16_2:            desc.format = ModelData::Format_R16G16_Float; size = 4; break;
+                case DeclType_Float16_4:            desc.format = ModelData::Format_R16G16B16A16_Float; size = 8; break;
+                }
+                if (size)
+                {
+                    ++texcoords;
+                }
+                break;
+
+            case DeclUsage_BlendIndices:
+                if (element.type == DeclType_UByte4)
+                {
+                    desc.semanticName = "BLENDINDICES";
+                    desc.format = ModelData::Format_R8G8B8A8_UInt;
+                    flags |= Skinning;
+                    size = 4;
+                }
+                break;
+
+            case DeclUsage_BlendWeight:
+                if (element.type == DeclType_UByte4N)
+                {
+                    desc.semanticName = "BLENDWEIGHT";
+                    desc.format = ModelData::Format_R8G8B8A8_UNorm;
+                    flags |= Skinning;
+                    size = 4;
+                }
+                break;
+            }
+
+            if (!size)
+                break;
+
+            elements.push_back(desc);
+            offset += size;
+        }
+
+        if (!position)
+            throw std::runtime_error("SDKMESH vertex buffer has no float3 or packed position");
+
+        if (texcoords == 2)
+        {
+            flags |= DualTexture;
+        }
+
+        return flags;
+    }
+
+    ModelData::Material DecodeMaterial(const MaterialHeader& source, uint32_t flags, bool srgb)
+    {
+        ModelData::Material material = DefaultMaterial();
+        material.name = FromUtf8(source.name, c_MaxName);
+        material.diffuseTexture = FromUtf8(source.diffuseTexture, c_MaxPath);
+        material.specularTexture = FromUtf8(source.specularTexture, c_MaxPath);
+        material.normalTexture = FromUtf8(source.normalTexture, c_MaxPath);
+
+        if ((flags & DualTexture) && !source.specularTexture[0])
+        {
+            flags &= ~uint32_t(DualTexture);
+        }
+
+        // A normal map is only usable with tangents, and tangents only with a normal map
+        if (!(flags & NormalMaps) || !source.normalTexture[0])
+        {
+            flags &= ~uint32_t(NormalMaps);
+            material.normalTexture.clear();
+        }
+
+        material.perVertexColor = (flags & PerVertexColor) != 0;
+        material.enableSkinning = (flags & Skinning) != 0;
+        material.enableDualTexture = (flags & DualTexture) != 0;
+        material.enableNormalMaps = (flags & NormalMaps) != 0;
+        material.biasedVertexNormals = (flags & BiasedVertexNormals) != 0;
+
+        bool uninitialized = true;
+        for (int i = 0; i < 4; ++i)
+        {
+            uninitialized = uninitialized && source.ambient[i] == 0 && source.diffuse[i] == 0;
+        }
+
+        if (uninitialized)
+        {
+            // The color block was never written; assume defaults
+            SetColor(material.diffuseColor, 1.f, 1.f, 1.f, false);
+        }
+        else
+        {
+            SetColor(material.ambientColor, source.ambient[0], source.ambient[1], source.ambient[2], srgb);
+            SetColor(material.diffuseColor, source.diffuse[0], source.diffuse[1], source.diffuse[2], srgb);
+            SetColor(material.emissiveColor, source.emissive[0], source.emissive[1], source.emissive[2], srgb);
+
+            material.alpha = (source.diffuse[3] != 1.f && source.diffuse[3] != 0.f) ? source.diffuse[3] : 1.f;
+
+            if (source.power > 0)
+            {
+                material.specularPower = source.power;
+                SetColor(material.specularColor, source.specular[0], source.specular[1], source.specular[2], false);
+            }
+        }
+
+        return material;
+    }
+
+    ModelData::Material DecodeMaterial(const MaterialHeaderV2& source, uint32_t flags)
+    {
+        ModelData::Material material = DefaultMaterial();
+        material.name = FromUtf8(source.name, c_MaxName);
+        material.diffuseTexture = FromUtf8(source.albedoTexture, c_MaxPath);
+        material.specularTexture = FromUtf8(source.rmaTexture, c_MaxPath);
+        material.normalTexture = FromUtf8(source.normalTexture, c_MaxPath);
+        material.emissiveTexture = FromUtf8(source.emissiveTexture, c_MaxPath);
+        material.enableNormalMaps = true;
+        material.biasedVertexNormals = (flags & BiasedVertexNormals) != 0;
+        material.alpha = (source.alpha == 0.f) ? 1.f : source.alpha;
+        return material;
+    }
+
+    bool InRange(uint64_t size, uint64_t offset, uint64_t count, uint64_t elementSize)
+    {
+        return offset <= size && count <= (size - offset) / elementSize;
+    }
+
+    // Headers are copied out, since a file is free to place them at unaligned offsets.
+    template<typename T>
+    T ReadAt(const uint8_t* data, uint64_t offset, uint32_t index)
+    {
+        T value;
+        memcpy(&value, data + offset + uint64_t(index) * sizeof(T), sizeof(T));
+        return value;
+    }
+}
+
+std::unique_ptr<ModelData> ModelData::ParseSDKMESH(const uint8_t* data, size_t size, uint32_t flags)
+{
+    using namespace SDKMESH;
+
+    if (!data)
+        throw std::runtime_error("SDKMESH data cannot be null");
+
+    if (size < sizeof(Header))
+        throw std::runtime_error("SDKMESH file is truncated");
+
+    Header header;
+    memcpy(&header, data, sizeof(header));
+
+    if (header.headerSize != sizeof(Header)
+        + uint64_t(header.numVertexBuffers) * sizeof(VertexBufferHeader)
+        + uint64_t(header.numIndexBuffers) * sizeof(IndexBufferHeader))
+        throw std::runtime_error("Not a valid SDKMESH file");
+
+    if (size < header.headerSize)
+        throw std::runtime_error("SDKMESH file is truncated");
+
+    if (header.version != c_FileVersion && header.version != c_FileVersionV2)
+        throw std::runtime_error("Not a supported SDKMESH version");
+
+    if (header.isBigEndian)
+        throw std::runtime_error("Big-endian SDKMESH files are not supported");
+
+    if (!header.numMeshes || !header.numVertexBuffers || !header.numIndexBuffers
+        || !header.numTotalSubsets || !header.numMaterials)
+        throw std::runtime_error("SDKMESH file has no meshes, buffers, subsets or materials");
+
+    if (!InRange(size, header.vertexStreamHeadersOffset, header.numVertexBuffers, sizeof(VertexBufferHeader))
+        || !InRange(size, header.indexStreamHeadersOffset, header.numIndexBuffers, sizeof(IndexBufferHeader))
+        || !InRange(size, header.meshDataOffset, header.numMeshes, sizeof(MeshHeader))
+        || !InRange(size, header.subsetDataOffset, header.numTotalSubsets, sizeof(SubsetHeader))
+        || !InRange(size, header.frameDataOffset, header.numFrames, sizeof(FrameHeader))
+        || !InRange(size, header.materialDataOffset, header.numMaterials, sizeof(MaterialHeader)))
+        throw std::runtime_error("SDKMESH file is truncated");
+
+    uint64_t bufferDataOffset = header.headerSize + header.nonBufferDataSize;
+    if (bufferDataOffset > size || header.bufferDataSize > size - bufferDataOffset)
+        throw std::runtime_error("SDKMESH file is truncated");
+
+    auto model = std::make_unique<ModelData>();
+
+    // Vertex and index streams stay in the file
+    std::vector<uint32_t> streamFlags(header.numVertexBuffers);
+    model->vertexStreams.resize(header.numVertexBuffers);
+    for (uint32_t j = 0; j < header.numVertexBuffers; ++j)
+    {
+        auto vh = ReadAt<VertexBufferHeader>(data, header.vertexStreamHeadersOffset, j);
+
+        CheckBufferSize(vh.sizeBytes, flags, "SDKMESH vertex buffer");
+        if (!InRange(size, vh.dataOffset, vh.sizeBytes, 1))
+            throw std::runtime_error("SDKMESH file is truncated");
+
+        auto& stream = model->vertexStreams[j];
+        streamFlags[j] = DecodeDeclaration(vh.decl, stream.elements);
+        stream.stride = uint32_t(vh.strideBytes);
+        stream.vertexCount = uint32_t(vh.numVertices);
+        stream.data = data + vh.dataOffset;
+        stream.size = size_t(vh.sizeBytes);
+    }
+
+    model->indexStreams.resize(header.numIndexBuffers);
+    for (uint32_t j = 0; j < header.numIndexBuffers; ++j)
+    {
+        auto ih = ReadAt<IndexBufferHeader>(data, header.indexStreamHeadersOffset, j);
+
+        CheckBufferSize(ih.sizeBytes, flags, "SDKMESH index buffer");
+        if (!InRange(size, ih.dataOffset, ih.sizeBytes, 1))
+            throw std::runtime_error("SDKMESH file is truncated");
+
+        if (ih.indexType > c_Index32)
+            throw std::runtime_error("Invalid SDKMESH index buffer type");
+
+        auto& stream = model->indexStreams[j];
+        stream.format = (ih.indexType == c_Index32) ? Format_R32_UInt : Format_R16_UInt;
+        stream.indexCount = uint32_t(ih.numIndices);
+        stream.data = data + ih.dataOffset;
+        stream.size = size_t(ih.sizeBytes);
+    }
+
+    // A material takes the vertex flags of the first mesh that uses it, as in the Model loader
+    model->materials.resize(header.numMaterials, DefaultMaterial());
+    std::vector<bool> decoded(header.numMaterials);
+
+    auto decodeMaterial = [&](uint32_t index, uint32_t vertexFlags)
+    {
+        if (decoded[index])
+            return;
+
+        model->materials[index] = (header.version == c_FileVersionV2)
+            ? DecodeMaterial(ReadAt<MaterialHeaderV2>(data, header.materialDataOffset, index), vertexFlags)
+            : DecodeMaterial(ReadAt<MaterialHeader>(data, header.materialDataOffset, index), vertexFlags,
+                (flags & Loader_MaterialColorsSRGB) != 0);
+        decoded[index] = true;
+    };
+
+    model->meshes.resize(header.numMeshes);
+    for (uint32_t meshIndex = 0; meshIndex < header.numMeshes; ++meshIndex)
+    {
+        auto mh = ReadAt<MeshHeader>(data, header.meshDataOffset, meshIndex);
+
+        // mh.numVertexBuffers is sometimes not what you'd expect, so it is not validated
+        if (!mh.numSubsets
+            || !mh.numVertexBuffers
+            || mh.indexBuffer >= header.numIndexBuffers
+            || mh.vertexBuffers[0] >= header.numVertexBuffers)
+            throw std::runtime_error("Invalid SDKMESH mesh");
+
+        if (!InRange(size, mh.subsetOffset, mh.numSubsets, sizeof(uint32_t))
+            || (mh.numFrameInfluences && !InRange(size, mh.frameInfluenceOffset, mh.numFrameInfluences, sizeof(uint32_t))))
+            throw std::runtime_error("SDKMESH file is truncated");
+
+        const uint32_t vertexStream = mh.vertexBuffers[0];
+
+        auto& mesh = model->meshes[meshIndex];
+        mesh.name = FromUtf8(mh.name, c_MaxName);
+        mesh.ccw = (flags & Loader_CounterClockwise) != 0;
+        mesh.pmalpha = (flags & Loader_PremultipliedAlpha) != 0;
+        SetBoundsFromBox(mesh, mh.boundingBoxCenter, mh.boundingBoxExtents);
+
+        auto const& elements = model->vertexStreams[vertexStream].elements;
+        if (std::any_of(elements.begin(), elements.end(), [](VertexElement const& element)
+            { return !strcmp(element.semanticName, "SV_Position") && element.format == Format_R16G16B16A16_SNorm; }))
+        {
+            std::copy(mh.boundingBoxCenter, mh.boundingBoxCenter + 3, mesh.positionOffset);
+            mesh.positionScale = std::max(std::max(mh.boundingBoxExtents[0], mh.boundingBoxExtents[1]), mh.boundingBoxExtents[2]);
+        }
+
+        mesh.parts.reserve(mh.numSubsets);
+        for (uint32_t j = 0; j < mh.numSubsets; ++j)
+        {
+            auto subsetIndex = ReadAt<uint32_t>(data, mh.subsetOffset, j);
+            if (subsetIndex >= header.numTotalSubsets)
+                throw std::runtime_error("Invalid SDKMESH mesh");
+
+            auto subset = ReadAt<SubsetHeader>(data, header.subsetDataOffset, subsetIndex);
+
+            Topology topology;
+            switch (subset.primitiveType)
+            {
+            case PT_TriangleList:       topology = Topology_TriangleList;       break;
+            case PT_TriangleStrip:      topology = Topology_TriangleStrip;      break;
+            case PT_LineList:           topology = Topology_LineList;           break;
+            case PT_LineStrip:          topology = Topology_LineStrip;          break;
+            case PT_PointList:          topology = Topology_PointList;          break;
+            case PT_TriangleListAdj:    topology = Topology_TriangleListAdj;    break;
+            case PT_TriangleStripAdj:   topology = Topology_TriangleStripAdj;   break;
+            case PT_LineListAdj:        topology = Topology_LineListAdj;        break;
+            case PT_LineStripAdj:       topology = Topology_LineStripAdj;       break;
+
+            case PT_QuadPatchList:
+            case PT_TrianglePatchList:
+                throw std::runtime_error("Direct3D 9 era tessellation is not supported");
+
+            default:
+                throw std::runtime_error("Unknown SDKMESH primitive type");
+            }
+
+            if (subset.materialID >= header.numMaterials)
+                throw std::runtime_error("Invalid SDKMESH mesh");
+
+            decodeMaterial(subset.materialID, streamFlags[vertexStream]);
+
+            Part part;
+            part.vertexStream = vertexStream;
+            part.indexStream = mh.indexBuffer;
+            part.material = subset.materialID;
+            part.startIndex = uint32_t(subset.indexStart);
+            part.indexCount = uint32_t(subset.indexCount);
+            part.vertexOffset = int32_t(subset.vertexStart);
+            part.topology = topology;
+            part.isAlpha = model->materials[subset.materialID].alpha < 1.f;
+            mesh.parts.push_back(part);
+        }
+    }
+
+    return model;
+}
+
+
+//--------------------------------------------------------------------------------------
+// CMO (Visual Studio starter kit)
+//--------------------------------------------------------------------------------------
+
+namespace CMO
+{
+#pragma pack(push, 1)
+    struct MaterialSettings
+    {
+        float       ambient[4];
+        float       diffuse[4];
+        float       specular[4];
+        float       specularPower;
+        float       emissive[4];
+        float       uvTransform[16];
+    };
+
+    struct SubMesh
+    {
+        uint32_t    materialIndex;
+        uint32_t    indexBufferIndex;
+        uint32_t    vertexBufferIndex;
+        uint32_t    startIndex;
+        uint32_t    primCount;
+    };
+
+    struct SkinningVertex
+    {
+        uint32_t    boneIndex[4];
+        float       boneWeight[4];
+    };
+
+    struct MeshExtents
+    {
+        float       center[3];
+        float       radius;
+        float       min[3];
+        float       max[3];
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(MaterialSettings) == 132, "CMO structure size incorrect");
+    static_assert(sizeof(SubMesh) == 20, "CMO structure size incorrect");
+    static_assert(sizeof(SkinningVertex) == 32, "CMO structure size incorrect");
+    static_assert(sizeof(MeshExtents) == 40, "CMO structure size incorrect");
+
+    const uint32_t c_MaxTextures = 8;
+
+    // VertexPositionNormalTangentColorTexture, and the same with packed bone indices and weights
+    const uint32_t c_VertexStride = 52;
+    const uint32_t c_SkinnedVertexStride = 60;
+    const uint32_t c_TexCoordOffset = 44;
+
+    // An unnamed material with no shader or textures: name, settings, shader and eight texture lengths
+    const size_t c_MinMaterialSize = sizeof(uint32_t) + sizeof(MaterialSettings) + sizeof(uint32_t) + c_MaxTextures * sizeof(uint32_t);
+
+    const ModelData::VertexElement c_Elements[] =
+    {
+        { "SV_Position",  0, ModelData::Format_R32G32B32_Float,    0 },
+        { "NORMAL",       0, ModelData::Format_R32G32B32_Float,    12 },
+        { "TANGENT",      0, ModelData::Format_R32G32B32A32_Float, 24 },
+        { "COLOR",        0, ModelData::Format_R8G8B8A8_UNorm,     40 },
+        { "TEXCOORD",     0, ModelData::Format_R32G32_Float,       44 },
+        { "BLENDINDICES", 0, ModelData::Format_R8G8B8A8_UInt,      52 },
+        { "BLENDWEIGHT",  0, ModelData::Format_R8G8B8A8_UNorm,     56 },
+    };
+
+    const MaterialSettings c_DefaultMaterial =
+    {
+        { 0.2f, 0.2f, 0.2f, 1.f },
+        { 0.8f, 0.8f, 0.8f, 1.f },
+        { 0.0f, 0.0f, 0.0f, 1.f },
+        1.f,
+        { 0.0f, 0.0f, 0.0f, 1.0f },
+        { 1.f, 0.f, 0.f, 0.f,
+          0.f, 1.f, 0.f, 0.f,
+          0.f, 0.f, 1.f, 0.f,
+          0.f, 0.f, 0.f, 1.f },
+    };
+
+    bool IsIdentity(const float (&m)[16])
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            if (m[i] != ((i % 5) ? 0.f : 1.f))
+                return false;
+        }
+        return true;
+    }
+
+    struct MaterialRecord
+    {
+        MaterialSettings settings;
+        std::wstring    name;
+        std::wstring    texture[c_MaxTextures];
+    };
+}
+
+std::unique_ptr<ModelData> ModelData::ParseCMO(const uint8_t* data, size_t size, uint32_t flags)
+{
+    using namespace CMO;
+
+    if (!data)
+        throw std::runtime_error("CMO data cannot be null");
+
+    Reader reader(data, size);
+
+    uint32_t meshCount = reader.Read<uint32_t>();
+    if (!meshCount)
+        throw std::runtime_error("CMO file has no meshes");
+
+    const bool srgb = (flags & Loader_MaterialColorsSRGB) != 0;
+
+    auto model = std::make_unique<ModelData>();
+
+    // Counts are not trusted to size anything until the bytes behind them have been seen
+    for (uint32_t meshIndex = 0; meshIndex < meshCount; ++meshIndex)
+    {
+        model->meshes.emplace_back();
+        auto& mesh = model->meshes.back();
+
+        mesh.name = reader.ReadString();
+        mesh.ccw = (flags & Loader_CounterClockwise) != 0;
+        mesh.pmalpha = (flags & Loader_PremultipliedAlpha) != 0;
+
+        // Materials
+        uint32_t materialCount = reader.Read<uint32_t>();
+        if (materialCount > reader.Remaining() / c_MinMaterialSize)
+            throw std::runtime_error("Unexpected end of model file");
+
+        std::vector<MaterialRecord> materials(materialCount);
+        for (auto& material : materials)
+        {
+            material.name = reader.ReadString();
+            material.settings = reader.Read<MaterialSettings>();
+            reader.ReadString();    // DGSL pixel shader, unused by the standard effects
+            for (auto& texture : material.texture)
+            {
+                texture = reader.ReadString();
+            }
+        }
+
+        if (materials.empty())
+        {
+            materials.resize(1);
+            materials[0].settings = c_DefaultMaterial;
+            materials[0].name = L"Default";
+        }
+
+        reader.Read<uint8_t>();     // skeleton present; the animation data after the extents is not loaded
+
+        // Submeshes
+        uint32_t subMeshCount = reader.Read<uint32_t>();
+        if (!subMeshCount)
+            throw std::runtime_error("CMO mesh has no submeshes");
+
+        const uint8_t* subMeshData = reader.Take(uint64_t(subMeshCount) * sizeof(SubMesh));
+        std::vector<SubMesh> subMeshes(subMeshCount);
+        memcpy(subMeshes.data(), subMeshData, subMeshCount * sizeof(SubMesh));
+
+        // Index buffers, 16-bit
+        const size_t firstIndexStream = model->indexStreams.size();
+        uint32_t ibCount = reader.Read<uint32_t>();
+        if (!ibCount)
+            throw std::runtime_error("CMO mesh has no index buffers");
+
+        for (uint32_t j = 0; j < ibCount; ++j)
+        {
+            uint32_t indexCount = reader.Read<uint32_t>();
+            if (!indexCount)
+                throw std::runtime_error("Empty CMO index buffer");
+
+            uint64_t bytes = uint64_t(indexCount) * sizeof(uint16_t);
+            CheckBufferSize(bytes, flags, "CMO index buffer");
+
+            IndexStream stream;
+            stream.format = Format_R16_UInt;
+            stream.indexCount = indexCount;
+            stream.data = reader.Take(bytes);
+            stream.size = size_t(bytes);
+            model->indexStreams.push_back(stream);
+        }
+
+        // Vertex buffers
+        const size_t firstVertexStream = model->vertexStreams.size();
+        uint32_t vbCount = reader.Read<uint32_t>();
+        if (!vbCount)
+            throw std::runtime_error("CMO mesh has no vertex buffers");
+
+        for (uint32_t j = 0; j < vbCount; ++j)
+        {
+            uint32_t vertexCount = reader.Read<uint32_t>();
+            if (!vertexCount)
+                throw std::runtime_error("Empty CMO vertex buffer");
+
+            uint64_t bytes = uint64_t(vertexCount) * c_VertexStride;
+            CheckBufferSize(bytes, flags, "CMO vertex buffer");
+
+            VertexStream stream;
+            stream.stride = c_VertexStride;
+            stream.vertexCount = vertexCount;
+            stream.data = reader.Take(bytes);
+            stream.size = size_t(bytes);
+            model->vertexStreams.push_back(std::move(stream));
+        }
+
+        // Skinning vertex buffers are a second stream; the effects want them interleaved
+        std::vector<const uint8_t*> skinning;
+        uint32_t skinCount = reader.Read<uint32_t>();
+        if (skinCount && skinCount != vbCount)
+            throw std::runtime_error("CMO mesh has a different number of skinning and vertex buffers");
+
+        for (uint32_t j = 0; j < skinCount; ++j)
+        {
+            uint32_t vertexCount = reader.Read<uint32_t>();
+            if (vertexCount != model->vertexStreams[firstVertexStream + j].vertexCount)
+                throw std::runtime_error("CMO skinning buffer does not match its vertex buffer");
+
+            skinning.push_back(reader.Take(uint64_t(vertexCount) * sizeof(SkinningVertex)));
+        }
+
+        const bool enableSkinning = skinCount != 0;
+
+        // Extents
+        auto extents = reader.Read<MeshExtents>();
+        for (int i = 0; i < 3; ++i)
+        {
+            mesh.sphereCenter[i] = extents.center[i];
+            mesh.boxCenter[i] = (extents.min[i] + extents.max[i]) * 0.5f;
+            mesh.boxExtents[i] = (extents.max[i] - extents.min[i]) * 0.5f;
+        }
+        mesh.sphereRadius = extents.radius;
+
+        for (const auto& subMesh : subMeshes)
+        {
+            if (subMesh.indexBufferIndex >= ibCount
+                || subMesh.vertexBufferIndex >= vbCount
+                || subMesh.materialIndex >= materials.size())
+                throw std::runtime_error("Invalid CMO submesh");
+        }
+
+        // Vertices are rewritten only for skinning or a UV transform, which the standard effects lack
+        for (uint32_t j = 0; j < vbCount; ++j)
+        {
+            auto& stream = model->vertexStreams[firstVertexStream + j];
+
+            bool transformUVs = false;
+            for (const auto& subMesh : subMeshes)
+            {
+                if (subMesh.vertexBufferIndex == j && !IsIdentity(materials[subMesh.materialIndex].settings.uvTransform))
+                {
+                    transformUVs = true;
+                }
+            }
+
+            const uint32_t stride = enableSkinning ? c_SkinnedVertexStride : c_VertexStride;
+            stream.elements.assign(c_Elements, c_Elements + (enableSkinning ? 7 : 5));
+
+            if (!enableSkinning && !transformUVs)
+                continue;
+
+            CheckBufferSize(uint64_t(stream.vertexCount) * stride, flags, "CMO vertex buffer");
+
+            stream.owned.resize(size_t(stream.vertexCount) * stride);
+            for (uint32_t v = 0; v < stream.vertexCount; ++v)
+            {
+                uint8_t* target = stream.owned.data() + size_t(v) * stride;
+                memcpy(target, stream.data + size_t(v) * c_VertexStride, c_VertexStride);
+
+                if (enableSkinning)
+                {
+                    SkinningVertex skin;
+                    memcpy(&skin, skinning[j] + size_t(v) * sizeof(SkinningVertex), sizeof(skin));
+
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        float weight = std::min(std::max(skin.boneWeight[k], 0.f), 1.f);
+                        target[c_VertexStride + k] = uint8_t(std::min<uint32_t>(skin.boneIndex[k], 255));
+                        target[c_VertexStride + 4 + k] = uint8_t(weight * 255.f + 0.5f);
+                    }
+                }
+            }
+
+            stream.stride = stride;
+            stream.data = nullptr;
+            stream.size = stream.owned.size();
+
+            if (!transformUVs)
+                continue;
+
+            // Each vertex takes the transform of the first submesh that references it
+            std::vector<bool> visited(stream.vertexCount);
+            for (const auto& subMesh : subMeshes)
+            {
+                if (subMesh.vertexBufferIndex != j)
+                    continue;
+
+                const auto& uv = materials[subMesh.materialIndex].settings.uvTransform;
+                const auto& indices = model->indexStreams[firstIndexStream + subMesh.indexBufferIndex];
+
+                for (uint32_t q = 0; q < indices.indexCount; ++q)
+                {
+                    uint32_t v = indices.data[q * 2] | (uint32_t(indices.data[q * 2 + 1]) << 8);
+                    if (v >= stream.vertexCount)
+                        throw std::runtime_error("Invalid CMO index");
+
+                    if (visited[v])
+                        continue;
+                    visited[v] = true;
+
+                    float texcoord[2];
+                    uint8_t* target = stream.owned.data() + size_t(v) * stride + c_TexCoordOffset;
+                    memcpy(texcoord, target, sizeof(texcoord));
+
+                    float u = texcoord[0] * uv[0] + texcoord[1] * uv[4] + uv[12];
+                    float w = texcoord[0] * uv[1] + texcoord[1] * uv[5] + uv[13];
+                    texcoord[0] = u;
+                    texcoord[1] = w;
+                    memcpy(target, texcoord, sizeof(texcoord));
+                }
+            }
+        }
+
+        // Materials and parts
+        const size_t firstMaterial = model->materials.size();
+        for (const auto& record : materials)
+        {
+            const auto& settings = record.settings;
+
+            Material material = DefaultMaterial();
+            material.name = record.name;
+            material.perVertexColor = true;
+            material.enableSkinning = enableSkinning;
+            material.specularPower = settings.specularPower;
+            material.alpha = settings.diffuse[3];
+            SetColor(material.ambientColor, settings.ambient[0], settings.ambient[1], settings.ambient[2], srgb);
+            SetColor(material.diffuseColor, settings.diffuse[0], settings.diffuse[1], settings.diffuse[2], srgb);
+            SetColor(material.specularColor, settings.specular[0], settings.specular[1], settings.specular[2], srgb);
+            SetColor(material.emissiveColor, settings.emissive[0], settings.emissive[1], settings.emissive[2], srgb);
+            material.diffuseTexture = record.texture[0];
+            model->materials.push_back(std::move(material));
+        }
+
+        for (const auto& subMesh : subMeshes)
+        {
+            Part part;
+            part.vertexStream = uint32_t(firstVertexStream + subMesh.vertexBufferIndex);
+            part.indexStream = uint32_t(firstIndexStream + subMesh.indexBufferIndex);
+            part.material = uint32_t(firstMaterial + subMesh.materialIndex);
+            part.startIndex = subMesh.startIndex;
+            part.indexCount = subMesh.primCount * 3;
+            part.vertexOffset = 0;
+            part.topology = Topology_TriangleList;
+            part.isAlpha = materials[subMesh.materialIndex].settings.diffuse[3] < 1.f;
+            mesh.parts.push_back(part);
+        }
+    }
+
+    return model;
+}
+
+
+//--------------------------------------------------------------------------------------
+// VBO
+//--------------------------------------------------------------------------------------
+
+std::unique_ptr<ModelData> ModelData::ParseVBO(const uint8_t* data, size_t size, uint32_t flags)
+{
+    // VertexPositionNormalTexture
+    static const VertexElement s_elements[] =
+    {
+        { "SV_Position", 0, Format_R32G32B32_Float, 0 },
+        { "NORMAL",      0, Format_R32G32B32_Float, 12 },
+        { "TEXCOORD",    0, Format_R32G32_Float,    24 },
+    };
+    const uint32_t stride = 32;
+
+    if (!data)
+        throw std::runtime_error("VBO data cannot be null");
+
+    Reader reader(data, size);
+
+    uint32_t vertexCount = reader.Read<uint32_t>();
+    uint32_t indexCount = reader.Read<uint32_t>();
+    if (!vertexCount || !indexCount)
+        throw std::runtime_error("VBO file has no vertices or indices");
+
+    uint64_t vertexBytes = uint64_t(vertexCount) * stride;
+    uint64_t indexBytes = uint64_t(indexCount) * sizeof(uint16_t);
+    CheckBufferSize(vertexBytes, flags, "VBO vertex buffer");
+    CheckBufferSize(indexBytes, flags, "VBO index buffer");
+
+    auto model = std::make_unique<ModelData>();
+
+    VertexStream vertices;
+    vertices.elements.assign(std::begin(s_elements), std::end(s_elements));
+    vertices.stride = stride;
+    vertices.vertexCount = vertexCount;
+    vertices.data = reader.Take(vertexBytes);
+    vertices.size = size_t(vertexBytes);
+    model->vertexStreams.push_back(std::move(vertices));
+
+    IndexStream indices;
+    indices.format = Format_R16_UInt;
+    indices.indexCount = indexCount;
+    indices.data = reader.Take(indexBytes);
+    indices.size = size_t(indexBytes);
+    model->indexStreams.push_back(indices);
+
+    // The Model loader's default: a lit BasicEffect
+    Material material = DefaultMaterial();
+    SetColor(material.diffuseColor, 1.f, 1.f, 1.f, false);
+    model->materials.push_back(material);
+
+    Mesh mesh;
+    mesh.ccw = (flags & Loader_CounterClockwise) != 0;
+    mesh.pmalpha = (flags & Loader_PremultipliedAlpha) != 0;
+
+    // Bounds from the positions: an exact box and a Ritter sphere
+    const uint8_t* positions = model->vertexStreams[0].data;
+    auto position = [&](uint32_t v, float (&p)[3])
+    {
+        memcpy(p, positions + size_t(v) * stride, sizeof(p));
+    };
+
+    float p[3], lo[3], hi[3];
+    position(0, p);
+    std::copy(p, p + 3, lo);
+    std::copy(p, p + 3, hi);
+    for (uint32_t v = 1; v < vertexCount; ++v)
+    {
+        position(v, p);
+        for (int i = 0; i < 3; ++i)
+        {
+            lo[i] = std::min(lo[i], p[i]);
+            hi[i] = std::max(hi[i], p[i]);
+        }
+    }
+
+    float center[3], extents[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        center[i] = (lo[i] + hi[i]) * 0.5f;
+        extents[i] = (hi[i] - lo[i]) * 0.5f;
+    }
+    SetBoundsFromBox(mesh, center, extents);
+
+    // Start from the box center and grow only as far as the farthest point needs
+    float radiusSq = 0;
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        position(v, p);
+        float dx = p[0] - center[0], dy = p[1] - center[1], dz = p[2] - center[2];
+        radiusSq = std::max(radiusSq, dx * dx + dy * dy + dz * dz);
+    }
+    mesh.sphereRadius = sqrtf(radiusSq);
+
+    Part part;
+    part.vertexStream = 0;
+    part.indexStream = 0;
+    part.material = 0;
+    part.startIndex = 0;
+    part.indexCount = indexCount;
+    part.vertexOffset = 0;
+    part.topology = Topology_TriangleList;
+    part.isAlpha = false;
+    mesh.parts.push_back(part);
+
+    model->meshes.push_back(std::move(mesh));
+    return model;
+}
+
+
+//--------------------------------------------------------------------------------------
+
+std::unique_ptr<ModelData> ModelData::Parse(const wchar_t* fileName, const uint8_t* data, size_t size)
+{
+    std::wstring extension(fileName);
+    size_t dot = extension.find_last_of(L'.');
+    extension = (dot == std::wstring::npos) ? std::wstring() : extension.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](wchar_t c) { return wchar_t(towlower(c)); });
+
+    std::unique_ptr<ModelData> model;
+    if (extension == L"sdkmesh")
+    {
+        model = ParseSDKMESH(data, size);
+    }
+    else if (extension == L"cmo")
+    {
+        model = ParseCMO(data, size);
+    }
+    else if (extension == L"vbo")
+    {
+        model = ParseVBO(data, size);
+    }
+    else
+    {
+        throw std::runtime_error("Unknown model file extension");
+    }
+
+    ReadModelLods(data, size, *model);
+
+    model->name = fileName;
+    return model;
+}
@@ -0,0 +1,174 @@
+//
+// ModelData.h - Device-independent parse of SDKMESH, CMO and VBO model files
+//
+
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DX
+{
+    // The first half of model loading: validates a file and decodes its vertex declarations,
+    // streams, parts, materials and bounds into plain CPU data. Nothing here needs Windows or
+    // Direct3D headers (nor the precompiled header), so parsing can run on worker threads, in
+    // tools and on other platforms; UploadModel (ModelUpload.h) turns the result into a Model.
+    //
+    // The results match what DirectX::Model::CreateFrom* would build from the same bytes.
+    // Streams the file stores in their final layout point into the parsed bytes rather than
+    // copying them, so the source must outlive the ModelData (or at least the upload). The
+    // few streams that have to be rewritten, such as CMO skinning data, own their bytes.
+    struct ModelData
+    {
+        // Same values as DirectX::ModelLoaderFlags.
+        enum LoaderFlags : uint32_t
+        {
+            Loader_Clockwise            = 0x0,
+            Loader_CounterClockwise     = 0x1,
+            Loader_PremultipliedAlpha   = 0x2,
+            Loader_MaterialColorsSRGB   = 0x4,
+            Loader_AllowLargeModels     = 0x8,
+        };
+
+        // The DXGI_FORMAT values the loaders produce.
+        enum Format : uint32_t
+        {
+            Format_R32G32B32A32_Float   = 2,
+            Format_R32G32B32_Float      = 6,
+            Format_R16G16B16A16_Float   = 10,
+            Format_R16G16B16A16_SNorm   = 13,
+            Format_R32G32_Float         = 16,
+            Format_R10G10B10A2_UNorm    = 24,
+            Format_R11G11B10_Float      = 26,
+            Format_R8G8B8A8_UNorm       = 28,
+            Format_R8G8B8A8_UInt        = 30,
+            Format_R8G8B8A8_SNorm       = 31,
+            Format_R16G16_Float         = 34,
+            Format_R32_Float            = 41,
+            Format_R32_UInt             = 42,
+            Format_R16_UInt             = 57,
+            Format_B8G8R8A8_UNorm       = 87,
+        };
+
+        // The D3D11_PRIMITIVE_TOPOLOGY values the loaders produce.
+        enum Topology : uint32_t
+        {
+            Topology_PointList          = 1,
+            Topology_LineList           = 2,
+            Topology_LineStrip          = 3,
+            Topology_TriangleList       = 4,
+            Topology_TriangleStrip      = 5,
+            Topology_LineListAdj        = 10,
+            Topology_LineStripAdj       = 11,
+            Topology_TriangleListAdj    = 12,
+            Topology_TriangleStripAdj   = 13,
+        };
+
+        struct VertexElement
+        {
+            const char*         semanticName;   // static string
+            uint32_t            semanticIndex;
+            Format              format;
+            uint32_t            offset;
+        };
+
+        struct VertexStream
+        {
+            const uint8_t* GetData() const { return owned.empty() ? data : owned.data(); }
+
+            std::vector<VertexElement>  elements;
+            uint32_t                    stride;
+            uint32_t                    vertexCount;
+            const uint8_t*              data;       // into the source, unless 'owned' is in use
+            size_t                      size;
+            std::vector<uint8_t>        owned;
+        };
+
+        struct IndexStream
+        {
+            Format                      format;     // Format_R16_UInt or Format_R32_UInt
+            uint32_t                    indexCount;
+            const uint8_t*              data;       // into the source
+            size_t                      size;
+        };
+
+        // Mirrors DirectX::IEffectFactory::EffectInfo; empty strings mean none.
+        struct Material
+        {
+            std::wstring                name;
+            bool                        perVertexColor;
+            bool                        enableSkinning;
+            bool                        enableDualTexture;
+            bool                        enableNormalMaps;
+            bool                        biasedVertexNormals;
+            float                       specularPower;
+            float                       alpha;
+            float                       ambientColor[3];
+            float                       diffuseColor[3];
+            float                       specularColor[3];
+            float                       emissiveColor[3];
+            std::wstring                diffuseTexture;
+            std::wstring                specularTexture;
+            std::wstring                normalTexture;
+            std::wstring                emissiveTexture;
+        };
+
+        // A simplified level of detail of a part: the same vertices, drawn with fewer indices.
+        struct PartLod
+        {
+            uint32_t                    indexStream;
+            uint32_t                    startIndex;
+            uint32_t                    indexCount;
+        };
+
+        struct Part
+        {
+            uint32_t                    vertexStream;
+            uint32_t                    indexStream;
+            uint32_t                    material;
+            uint32_t                    startIndex;
+            uint32_t                    indexCount;
+            int32_t                     vertexOffset;
+            Topology                    topology;
+            bool                        isAlpha;
+            std::vector<PartLod>        lods;       // coarser in turn; empty unless the mesh has levels
+        };
+
+        struct Mesh
+        {
+            std::wstring                name;
+            float                       sphereCenter[3];
+            float                       sphereRadius;
+            float                       boxCenter[3];
+            float                       boxExtents[3];
+            bool                        ccw;
+            bool                        pmalpha;
+            std::vector<Part>           parts;
+
+            // Positions packed as 16-bit signed normalised values (VertexPacking.h) are these in
+            // model units; the renderer folds the mapping into the world matrix.
+            float                       positionOffset[3] = {};
+            float                       positionScale = 1.f;
+
+            // Each level's error, as a fraction of sphereRadius; every part has one PartLod per level.
+            std::vector<float>          lodErrors;
+        };
+
+        // Malformed files throw std::runtime_error. Default flags match the Model loaders'.
+        static std::unique_ptr<ModelData> ParseSDKMESH(const uint8_t* data, size_t size, uint32_t flags = Loader_Clockwise);
+        static std::unique_ptr<ModelData> ParseCMO(const uint8_t* data, size_t size, uint32_t flags = Loader_CounterClockwise);
+        static std::unique_ptr<ModelData> ParseVBO(const uint8_t* data, size_t size, uint32_t flags = Loader_Clockwise);
+
+        // Picks the parser from the file extension and names the result after the file. Levels
+        // of detail the cooker appended (ModelLod.h) are read as well, into one more index stream.
+        static std::unique_ptr<ModelData> Parse(const wchar_t* fileName, const uint8_t* data, size_t size);
+
+        std::wstring                    name;
+        std::vector<VertexStream>       vertexStreams;
+        std::vector<IndexStream>        indexStreams;
+        std::vector<Material>           materials;
+        std::vector<Mesh>               meshes;
+    };
+}
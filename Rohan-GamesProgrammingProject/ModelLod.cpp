@@ -0,0 +1,185 @@
+//
+// ModelLod.cpp - Simplified levels of detail stored with a model, and choosing between them
+//
+
+#include "ModelLod.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdexcept>
+#include <string.h>
+
+using namespace DX;
+
+namespace
+{
+    void AppendUInt32(std::vector<uint8_t>& file, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            file.push_back(uint8_t(value >> (8 * i)));
+        }
+    }
+
+    uint32_t ReadUInt32(const uint8_t* p)
+    {
+        return p[0] | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+}
+
+void DX::AppendModelLods(ModelData const& model, std::vector<uint32_t> const& indices, std::vector<uint8_t>& file)
+{
+    const size_t start = file.size();
+
+    AppendUInt32(file, c_ModelLodMagic);
+    AppendUInt32(file, c_ModelLodVersion);
+    AppendUInt32(file, uint32_t(model.meshes.size()));
+
+    for (auto const& mesh : model.meshes)
+    {
+        const uint32_t levels = uint32_t(mesh.lodErrors.size());
+        AppendUInt32(file, levels);
+        AppendUInt32(file, uint32_t(mesh.parts.size()));
+
+        for (float error : mesh.lodErrors)
+        {
+            uint32_t bits;
+            memcpy(&bits, &error, sizeof(bits));
+            AppendUInt32(file, bits);
+        }
+
+        for (uint32_t level = 0; level < levels; ++level)
+        {
+            for (auto const& part : mesh.parts)
+            {
+                AppendUInt32(file, part.lods[level].startIndex);
+                AppendUInt32(file, part.lods[level].indexCount);
+            }
+        }
+    }
+
+    const bool wide = std::any_of(indices.begin(), indices.end(), [](uint32_t index) { return index > UINT16_MAX; });
+    AppendUInt32(file, wide ? 32 : 16);
+    AppendUInt32(file, uint32_t(indices.size()));
+    for (uint32_t index : indices)
+    {
+        file.push_back(uint8_t(index));
+        file.push_back(uint8_t(index >> 8));
+        if (wide)
+        {
+            file.push_back(uint8_t(index >> 16));
+            file.push_back(uint8_t(index >> 24));
+        }
+    }
+    file.resize((file.size() + 3) & ~size_t(3), 0);
+
+    AppendUInt32(file, uint32_t(file.size() - start));
+    AppendUInt32(file, c_ModelLodMagic);
+}
+
+bool DX::ReadModelLods(const uint8_t* data, size_t size, ModelData& model)
+{
+    if (size < 8 || ReadUInt32(data + size - 4) != c_ModelLodMagic)
+        return false;
+
+    const size_t lodBytes = ReadUInt32(data + size - 8);
+    if (lodBytes < 20 || lodBytes > size - 8)
+        throw std::runtime_error("Model levels of detail are damaged");
+
+    const uint8_t* p = data + size - 8 - lodBytes;
+    const uint8_t* end = data + size - 8;
+    auto read = [&]() -> uint32_t
+    {
+        if (end - p < 4)
+            throw std::runtime_error("Model levels of detail are damaged");
+        uint32_t value = ReadUInt32(p);
+        p += 4;
+        return value;
+    };
+
+    if (read() != c_ModelLodMagic || read() != c_ModelLodVersion)
+        throw std::runtime_error("Model levels of detail are damaged or from another version");
+
+    if (read() != model.meshes.size())
+        throw std::runtime_error("Model levels of detail do not match its meshes");
+
+    // Ranges are checked once the index count is known
+    const uint32_t stream = uint32_t(model.indexStreams.size());
+    for (auto& mesh : model.meshes)
+    {
+        const uint32_t levels = read();
+        if (levels > c_MaxModelLods || read() != mesh.parts.size())
+            throw std::runtime_error("Model levels of detail do not match its meshes");
+
+        mesh.lodErrors.resize(levels);
+        for (float& error : mesh.lodErrors)
+        {
+            const uint32_t bits = read();
+            memcpy(&error, &bits, sizeof(error));
+            if (!(error >= 0.f) || !isfinite(error))
+                throw std::runtime_error("Model levels of detail are damaged");
+        }
+
+        for (auto& part : mesh.parts)
+        {
+            part.lods.resize(levels);
+        }
+        for (uint32_t level = 0; level < levels; ++level)
+        {
+            for (auto& part : mesh.parts)
+            {
+                part.lods[level].indexStream = stream;
+                part.lods[level].startIndex = read();
+                part.lods[level].indexCount = read();
+            }
+        }
+    }
+
+    const uint32_t indexBits = read();
+    const uint32_t indexCount = read();
+    if ((indexBits != 16 && indexBits != 32) || indexCount > size_t(end - p) / (indexBits / 8))
+        throw std::runtime_error("Model levels of detail are damaged");
+
+    ModelData::IndexStream indices;
+    indices.format = (indexBits == 32) ? ModelData::Format_R32_UInt : ModelData::Format_R16_UInt;
+    indices.indexCount = indexCount;
+    indices.data = p;
+    indices.size = size_t(indexCount) * (indexBits / 8);
+
+    if (size_t(end - p) - indices.size >= 4)
+        throw std::runtime_error("Model levels of detail are damaged");
+
+    for (auto const& mesh : model.meshes)
+    {
+        for (auto const& part : mesh.parts)
+        {
+            for (auto const& lod : part.lods)
+            {
+                if (lod.startIndex > indexCount || lod.indexCount > indexCount - lod.startIndex || lod.indexCount % 3)
+                    throw std::runtime_error("Model levels of detail are damaged");
+            }
+        }
+    }
+
+    model.indexStreams.push_back(indices);
+    return true;
+}
+
+uint32_t DX::SelectModelLod(const float* errors, uint32_t lodCount, float radiusPixels, uint32_t current,
+    float maxPixelError, float hysteresis)
+{
+    current = std::min(current, lodCount);
+
+    // Finer while the current level shows, then coarser while the next one clearly would not
+    while (current > 0 && errors[current - 1] * radiusPixels > maxPixelError)
+    {
+        --current;
+    }
+
+    const float coarser = maxPixelError * (1.f - hysteresis);
+    while (current < lodCount && errors[current] * radiusPixels <= coarser)
+    {
+        ++current;
+    }
+    return current;
+}
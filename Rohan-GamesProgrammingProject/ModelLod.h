@@ -0,0 +1,57 @@
+//
+// ModelLod.h - Simplified levels of detail stored with a model, and choosing between them
+//
+
+#pragma once
+
+#include "ModelData.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace DX
+{
+    // The asset cooker simplifies every triangle-list mesh into up to c_MaxModelLods coarser
+    // levels (MeshSimplifier.h in the cooker) and appends them to the model file, which the
+    // model loaders ignore. A level keeps the mesh's vertices and only replaces each part's
+    // indices, so it costs an index range and nothing else; the game draws the coarsest level
+    // whose error, projected to the screen, stays under c_LodPixelError.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+    const uint32_t c_MaxModelLods = 4;
+
+    // Screen-space error a level may have, in pixels, before a finer one is drawn instead.
+    const float c_LodPixelError = 1.0f;
+
+    // A mesh moves to a coarser level only once that level's error is this fraction below
+    // c_LodPixelError, so one sitting at a boundary does not switch back and forth.
+    const float c_LodHysteresis = 0.25f;
+
+    // The levels are stored after the model file:
+    //
+    //   'LODS' version meshCount
+    //   per mesh: levelCount partCount, levelCount errors (floats, fractions of the mesh's
+    //     bounding sphere radius), then per level and per part: startIndex indexCount
+    //   indexBits (16 or 32) indexCount, then the indices, padded to four bytes
+    //   levels size in bytes (all of the above), then 'LODS' again, ending the file
+    //
+    // all 32-bit little-endian. Indices are relative to their part's vertexOffset, as the
+    // part's own are.
+    const uint32_t c_ModelLodMagic = 0x53444F4C;     // "LODS"
+    const uint32_t c_ModelLodVersion = 1;
+
+    // Writes the lodErrors of every mesh and the lods of every part, whose ranges are into
+    // 'indices' (their indexStream is ignored).
+    void AppendModelLods(ModelData const& model, std::vector<uint32_t> const& indices, std::vector<uint8_t>& file);
+
+    // Fills in lodErrors and lods from the levels stored after the file, adding one index
+    // stream (pointing into the file) that they all draw from. False if the file carries none;
+    // damaged levels, or levels that do not match the model, throw std::runtime_error.
+    bool ReadModelLods(const uint8_t* data, size_t size, ModelData& model);
+
+    // The level to draw, 0 being the mesh itself, for a mesh whose bounding sphere projects to
+    // 'radiusPixels' on screen and drew 'current' last frame. 'errors' are the mesh's
+    // lodErrors, so level n has errors[n - 1] and 'lodCount' levels follow the mesh itself.
+    uint32_t SelectModelLod(const float* errors, uint32_t lodCount, float radiusPixels, uint32_t current,
+        float maxPixelError = c_LodPixelError, float hysteresis = c_LodHysteresis);
+}
@@ -0,0 +1,182 @@
+//
+// ModelUpload.cpp - Creates a Model from parsed ModelData
+//
+
+#include "pch.h"
+#include "ModelUpload.h"
+
+#include <map>
+
+using namespace DirectX;
+using namespace DX;
+
+using Microsoft::WRL::ComPtr;
+
+static_assert(ModelData::Format_R32G32B32_Float == DXGI_FORMAT_R32G32B32_FLOAT, "ModelData formats must match DXGI");
+static_assert(ModelData::Format_R8G8B8A8_UNorm == DXGI_FORMAT_R8G8B8A8_UNORM, "ModelData formats must match DXGI");
+static_assert(ModelData::Format_R16_UInt == DXGI_FORMAT_R16_UINT, "ModelData formats must match DXGI");
+static_assert(ModelData::Format_R32_UInt == DXGI_FORMAT_R32_UINT, "ModelData formats must match DXGI");
+static_assert(ModelData::Format_B8G8R8A8_UNorm == DXGI_FORMAT_B8G8R8A8_UNORM, "ModelData formats must match DXGI");
+static_assert(ModelData::Topology_TriangleList == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, "ModelData topologies must match D3D11");
+static_assert(ModelData::Topology_TriangleStripAdj == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP_ADJ, "ModelData topologies must match D3D11");
+
+namespace
+{
+    ComPtr<ID3D11Buffer> CreateBuffer(ID3D11Device* device, const uint8_t* data, size_t size, UINT bindFlags)
+    {
+        D3D11_BUFFER_DESC desc = {};
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.ByteWidth = static_cast<UINT>(size);
+        desc.BindFlags = bindFlags;
+
+        D3D11_SUBRESOURCE_DATA initData = {};
+        initData.pSysMem = data;
+
+        ComPtr<ID3D11Buffer> buffer;
+        DX::ThrowIfFailed(device->CreateBuffer(&desc, &initData, buffer.GetAddressOf()));
+        return buffer;
+    }
+
+    const wchar_t* OptionalString(const std::wstring& value)
+    {
+        return value.empty() ? nullptr : value.c_str();
+    }
+
+    IEffectFactory::EffectInfo GetEffectInfo(const ModelData::Material& material)
+    {
+        IEffectFactory::EffectInfo info;
+        info.name = OptionalString(material.name);
+        info.perVertexColor = material.perVertexColor;
+        info.enableSkinning = material.enableSkinning;
+        info.enableDualTexture = material.enableDualTexture;
+        info.enableNormalMaps = material.enableNormalMaps;
+        info.biasedVertexNormals = material.biasedVertexNormals;
+        info.specularPower = material.specularPower;
+        info.alpha = material.alpha;
+        info.ambientColor = XMFLOAT3(material.ambientColor);
+        info.diffuseColor = XMFLOAT3(material.diffuseColor);
+        info.specularColor = XMFLOAT3(material.specularColor);
+        info.emissiveColor = XMFLOAT3(material.emissiveColor);
+        info.diffuseTexture = OptionalString(material.diffuseTexture);
+        info.specularTexture = OptionalString(material.specularTexture);
+        info.normalTexture = OptionalString(material.normalTexture);
+        info.emissiveTexture = OptionalString(material.emissiveTexture);
+        return info;
+    }
+}
+
+std::unique_ptr<Model> DX::UploadModel(ID3D11Device* device, const ModelData& data, IEffectFactory& fxFactory,
+    std::vector<ModelMeshLods>* lods)
+{
+    std::vector<ComPtr<ID3D11Buffer>> vertexBuffers;
+    std::vector<std::shared_ptr<std::vector<D3D11_INPUT_ELEMENT_DESC>>> vertexDecls;
+    vertexBuffers.reserve(data.vertexStreams.size());
+    vertexDecls.reserve(data.vertexStreams.size());
+
+    for (const auto& stream : data.vertexStreams)
+    {
+        vertexBuffers.push_back(CreateBuffer(device, stream.GetData(), stream.size, D3D11_BIND_VERTEX_BUFFER));
+
+        auto decl = std::make_shared<std::vector<D3D11_INPUT_ELEMENT_DESC>>();
+        decl->reserve(stream.elements.size());
+        for (const auto& element : stream.elements)
+        {
+            decl->push_back({ element.semanticName, element.semanticIndex, static_cast<DXGI_FORMAT>(element.format),
+                0, element.offset, D3D11_INPUT_PER_VERTEX_DATA, 0 });
+        }
+        vertexDecls.push_back(std::move(decl));
+    }
+
+    std::vector<ComPtr<ID3D11Buffer>> indexBuffers;
+    indexBuffers.reserve(data.indexStreams.size());
+
+    for (const auto& stream : data.indexStreams)
+    {
+        indexBuffers.push_back(CreateBuffer(device, stream.data, stream.size, D3D11_BIND_INDEX_BUFFER));
+    }
+
+    // Materials no part uses never reach the factory, as with the Model loaders
+    std::vector<std::shared_ptr<IEffect>> effects(data.materials.size());
+    std::map<std::pair<uint32_t, uint32_t>, ComPtr<ID3D11InputLayout>> inputLayouts;
+
+    auto model = std::make_unique<Model>();
+    model->name = data.name;
+    model->meshes.reserve(data.meshes.size());
+
+    for (const auto& source : data.meshes)
+    {
+        auto mesh = std::make_shared<ModelMesh>();
+        mesh->name = source.name;
+        mesh->ccw = source.ccw;
+        mesh->pmalpha = source.pmalpha;
+        mesh->boundingSphere = BoundingSphere(XMFLOAT3(source.sphereCenter), source.sphereRadius);
+        mesh->boundingBox = BoundingBox(XMFLOAT3(source.boxCenter), XMFLOAT3(source.boxExtents));
+
+        mesh->meshParts.reserve(source.parts.size());
+        for (const auto& sourcePart : source.parts)
+        {
+            auto& effect = effects[sourcePart.material];
+            if (!effect)
+            {
+                effect = fxFactory.CreateEffect(GetEffectInfo(data.materials[sourcePart.material]), nullptr);
+            }
+
+            auto& inputLayout = inputLayouts[std::make_pair(sourcePart.material, sourcePart.vertexStream)];
+            if (!inputLayout)
+            {
+                const auto& decl = *vertexDecls[sourcePart.vertexStream];
+
+                void const* shaderByteCode;
+                size_t byteCodeLength;
+                effect->GetVertexShaderBytecode(&shaderByteCode, &byteCodeLength);
+
+                DX::ThrowIfFailed(device->CreateInputLayout(decl.data(), static_cast<UINT>(decl.size()),
+                    shaderByteCode, byteCodeLength, inputLayout.GetAddressOf()));
+            }
+
+            auto part = std::make_unique<ModelMeshPart>();
+            part->indexCount = sourcePart.indexCount;
+            part->startIndex = sourcePart.startIndex;
+            part->vertexOffset = sourcePart.vertexOffset;
+            part->vertexStride = data.vertexStreams[sourcePart.vertexStream].stride;
+            part->primitiveType = static_cast<D3D_PRIMITIVE_TOPOLOGY>(sourcePart.topology);
+            part->indexFormat = static_cast<DXGI_FORMAT>(data.indexStreams[sourcePart.indexStream].format);
+            part->inputLayout = inputLayout;
+            part->indexBuffer = indexBuffers[sourcePart.indexStream];
+            part->vertexBuffer = vertexBuffers[sourcePart.vertexStream];
+            part->effect = effect;
+            part->vbDecl = vertexDecls[sourcePart.vertexStream];
+            part->isAlpha = sourcePart.isAlpha;
+
+            mesh->meshParts.emplace_back(std::move(part));
+        }
+
+        model->meshes.emplace_back(std::move(mesh));
+    }
+
+    if (lods)
+    {
+        lods->clear();
+        lods->resize(data.meshes.size());
+        for (size_t m = 0; m < data.meshes.size(); ++m)
+        {
+            const auto& source = data.meshes[m];
+            auto& mesh = (*lods)[m];
+            mesh.errors = source.lodErrors;
+            mesh.partCount = uint32_t(source.parts.size());
+            mesh.parts.reserve(source.lodErrors.size() * source.parts.size());
+
+            for (uint32_t level = 0; level < source.lodErrors.size(); ++level)
+            {
+                for (const auto& sourcePart : source.parts)
+                {
+                    const auto& lod = sourcePart.lods[level];
+                    mesh.parts.push_back({ indexBuffers[lod.indexStream],
+                        static_cast<DXGI_FORMAT>(data.indexStreams[lod.indexStream].format), lod.startIndex, lod.indexCount });
+                }
+            }
+        }
+    }
+
+    return model;
+}
@@ -0,0 +1,47 @@
+//
+// ModelUpload.h - Creates a Model from parsed ModelData
+//
+
+#pragma once
+
+#include "ModelData.h"
+
+#include <Model.h>
+
+namespace DX
+{
+    // One part's indices at a coarser level of detail (ModelLod.h). The level draws with the
+    // part's own vertex buffer, input layout and effect; only the index range differs.
+    struct ModelPartLod
+    {
+        Microsoft::WRL::ComPtr<ID3D11Buffer>    indexBuffer;
+        DXGI_FORMAT                             indexFormat;
+        uint32_t                                startIndex;
+        uint32_t                                indexCount;
+    };
+
+    // A mesh's levels after the first, as ModelData::Mesh has them.
+    struct ModelMeshLods
+    {
+        uint32_t GetCount() const { return uint32_t(errors.size()); }
+
+        // The parts of level 1 to GetCount(), in the mesh's part order.
+        const ModelPartLod* GetParts(uint32_t level) const { return &parts[(level - 1) * partCount]; }
+
+        std::vector<float>          errors;     // fractions of the bounding sphere radius
+        std::vector<ModelPartLod>   parts;
+        uint32_t                    partCount;
+    };
+
+    // The second half of model loading: creates the vertex and index buffers, effects and input
+    // layouts for parsed model data. Must run on the thread that owns effect creation; the
+    // ModelData (and whatever bytes it points into) can be released as soon as this returns.
+    //
+    // Effects are requested once per material that a part actually uses, and input layouts are
+    // created once per material and vertex stream rather than once per part.
+    //
+    // A Model has nowhere to keep levels of detail, so when 'lods' is given it receives one
+    // entry per mesh, empty for meshes without them; their indices share the model's buffers.
+    std::unique_ptr<DirectX::Model> UploadModel(_In_ ID3D11Device* device, const ModelData& data, DirectX::IEffectFactory& fxFactory,
+        _Out_opt_ std::vector<ModelMeshLods>* lods = nullptr);
+}
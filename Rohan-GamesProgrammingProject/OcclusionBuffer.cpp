@@ -0,0 +1,613 @@
+//
+// OcclusionBuffer.cpp - Masked software occlusion culling in a small tiled depth buffer
+//
+// Does not use the precompiled header, so the offline tools can build it.
+//
+
+#include "OcclusionBuffer.h"
+#include "MeshClusters.h"
+
+#include <algorithm>
+#include <atomic>
+#include <float.h>
+#include <math.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define OCC_X86 1
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCC_SSE2 1
+#endif
+#endif
+
+#if defined(OCC_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// GCC and clang only emit AVX2 in functions marked for it; MSVC emits whatever intrinsics ask for
+#if defined(__GNUC__) || defined(__clang__)
+#define OCC_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define OCC_TARGET_AVX2
+#endif
+
+using namespace DX;
+
+namespace
+{
+    const uint32_t c_FullMask = 0xFFFFFFFFu;
+
+    // Tile rows each job of Render fills
+    const size_t c_RowsPerBand = 2;
+
+    // Occluders are transformed, clipped and set up this many to a job
+    const size_t c_OccludersPerJob = 1;
+
+    // The planes a clipped polygon keeps to, as distances that are negative outside:
+    // w + x, w - x, w + y, w - y, z and w - z
+    const int c_ClipPlanes = 6;
+    const int c_MaxClippedVertices = 3 + c_ClipPlanes;
+
+    struct ClipVertex
+    {
+        float   v[4];
+    };
+
+    float PlaneDistance(ClipVertex const& vertex, int plane)
+    {
+        const float* v = vertex.v;
+        switch (plane)
+        {
+        case 0:     return v[3] + v[0];
+        case 1:     return v[3] - v[0];
+        case 2:     return v[3] + v[1];
+        case 3:     return v[3] - v[1];
+        case 4:     return v[2];
+        default:    return v[3] - v[2];
+        }
+    }
+
+    // Sutherland-Hodgman against one plane; returns the new vertex count
+    int ClipPolygon(const ClipVertex* input, int count, int plane, ClipVertex* output)
+    {
+        int written = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            ClipVertex const& a = input[i];
+            ClipVertex const& b = input[(i + 1) % count];
+            const float da = PlaneDistance(a, plane);
+            const float db = PlaneDistance(b, plane);
+
+            if (da >= 0.f)
+            {
+                output[written++] = a;
+            }
+            if ((da >= 0.f) != (db >= 0.f))
+            {
+                const float t = da / (da - db);
+                ClipVertex& v = output[written++];
+                for (int k = 0; k < 4; ++k)
+                {
+                    v.v[k] = a.v[k] + t * (b.v[k] - a.v[k]);
+                }
+            }
+        }
+        return written;
+    }
+
+    void UpdateTile(float& far, float& maskFar, uint32_t& mask, uint32_t covered, float depth, uint64_t& tilesUpdated)
+    {
+        if (!covered || depth >= far)
+            return;
+
+        // A triangle much nearer than the pixels already in the mask would only be lost among
+        // them: start the mask over from it
+        if (mask && maskFar - depth > far - maskFar)
+        {
+            mask = 0;
+            maskFar = 0.f;
+        }
+
+        maskFar = std::max(maskFar, depth);
+        mask |= covered;
+        if (mask == c_FullMask)
+        {
+            far = maskFar;
+            mask = 0;
+            maskFar = 0.f;
+        }
+        ++tilesUpdated;
+    }
+
+    // The triangle's farthest depth over the tile's pixel centres: a plane is farthest at a corner
+    float GetTileDepth(OcclusionBuffer::Triangle const& triangle, int32_t x0, int32_t y0)
+    {
+        const float* plane = triangle.depth;
+        const float depth = plane[0] * float(x0) + plane[1] * float(y0) + plane[2]
+            + std::max(plane[0] * float(OcclusionBuffer::c_TileWidth - 1), 0.f)
+            + std::max(plane[1] * float(OcclusionBuffer::c_TileHeight - 1), 0.f);
+        return std::min(depth, triangle.farthest);
+    }
+
+    // The pixels of each tile in a row of them that the triangle covers, for tiles tileX0 to
+    // tileX1. Both levels take each edge at a row's first pixel and add a times the pixel's
+    // offset, in that order, so they round alike.
+    void CoverRowScalar(OcclusionBuffer::Triangle const& triangle, int32_t ty, uint32_t* masks)
+    {
+        const int32_t y0 = ty * int32_t(OcclusionBuffer::c_TileHeight);
+        for (int32_t tx = triangle.tileX0; tx <= triangle.tileX1; ++tx)
+        {
+            const int32_t x0 = tx * int32_t(OcclusionBuffer::c_TileWidth);
+
+            uint32_t covered = 0;
+            for (uint32_t r = 0; r < OcclusionBuffer::c_TileHeight; ++r)
+            {
+                const float y = float(y0 + int32_t(r));
+                float start[3];
+                for (int e = 0; e < 3; ++e)
+                {
+                    start[e] = triangle.edges[e][0] * float(x0) + (triangle.edges[e][1] * y + triangle.edges[e][2]);
+                }
+
+                for (uint32_t lane = 0; lane < OcclusionBuffer::c_TileWidth; ++lane)
+                {
+                    uint32_t inside = 1;
+                    for (int e = 0; e < 3; ++e)
+                    {
+                        inside &= uint32_t(start[e] + triangle.edges[e][0] * float(lane) > 0.f);
+                    }
+                    covered |= inside << (r * OcclusionBuffer::c_TileWidth + lane);
+                }
+            }
+            masks[tx - triangle.tileX0] = covered;
+        }
+    }
+
+    bool IsRectVisibleScalar(const float* far, uint32_t pitch, int32_t tx0, int32_t ty0, int32_t tx1, int32_t ty1,
+        float nearestDepth)
+    {
+        for (int32_t ty = ty0; ty <= ty1; ++ty)
+        {
+            const float* row = far + size_t(ty) * pitch;
+            for (int32_t tx = tx0; tx <= tx1; ++tx)
+            {
+                if (!(nearestDepth > row[tx]))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+#if defined(OCC_SSE2)
+    // A tile row of eight pixels is one vector. Kept apart from the merge, which only calls
+    // out to code built without AVX.
+    OCC_TARGET_AVX2 void CoverRowAVX2(OcclusionBuffer::Triangle const& triangle, int32_t ty, uint32_t* masks)
+    {
+        const __m256 lanes = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+        const __m256 zero = _mm256_setzero_ps();
+        __m256 steps[3];
+        for (int e = 0; e < 3; ++e)
+        {
+            steps[e] = _mm256_mul_ps(_mm256_set1_ps(triangle.edges[e][0]), lanes);
+        }
+
+        const int32_t y0 = ty * int32_t(OcclusionBuffer::c_TileHeight);
+        for (int32_t tx = triangle.tileX0; tx <= triangle.tileX1; ++tx)
+        {
+            const int32_t x0 = tx * int32_t(OcclusionBuffer::c_TileWidth);
+
+            uint32_t covered = 0;
+            for (uint32_t r = 0; r < OcclusionBuffer::c_TileHeight; ++r)
+            {
+                const float y = float(y0 + int32_t(r));
+                __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+                for (int e = 0; e < 3; ++e)
+                {
+                    const float start = triangle.edges[e][0] * float(x0) + (triangle.edges[e][1] * y + triangle.edges[e][2]);
+                    const __m256 value = _mm256_add_ps(_mm256_set1_ps(start), steps[e]);
+                    inside = _mm256_and_ps(inside, _mm256_cmp_ps(value, zero, _CMP_GT_OQ));
+                }
+                covered |= uint32_t(_mm256_movemask_ps(inside)) << (r * OcclusionBuffer::c_TileWidth);
+            }
+            masks[tx - triangle.tileX0] = covered;
+        }
+    }
+
+    // Eight tiles of a row at a time; rows are padded so the last load stays in the buffer
+    OCC_TARGET_AVX2 bool IsRectVisibleAVX2(const float* far, uint32_t pitch, int32_t tx0, int32_t ty0, int32_t tx1, int32_t ty1,
+        float nearestDepth)
+    {
+        const __m256 nearest = _mm256_set1_ps(nearestDepth);
+        for (int32_t ty = ty0; ty <= ty1; ++ty)
+        {
+            const float* row = far + size_t(ty) * pitch;
+            for (int32_t tx = tx0; tx <= tx1; tx += 8)
+            {
+                const int lanes = std::min(tx1 - tx + 1, 8);
+                const int visible = _mm256_movemask_ps(_mm256_cmp_ps(nearest, _mm256_loadu_ps(row + tx), _CMP_NGT_UQ));
+                if (visible & ((1 << lanes) - 1))
+                    return true;
+            }
+        }
+        return false;
+    }
+#endif
+
+    OcclusionSimdLevel GetSupportedLevel()
+    {
+#if defined(OCC_SSE2)
+        static const OcclusionSimdLevel s_supported = []()
+        {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return OcclusionSimdLevel::Scalar;
+
+            // AVX needs the OS to save the YMM registers
+            __cpuid(info, 1);
+            const bool osSavesYMM = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+            __cpuidex(info, 7, 0);
+            return (osSavesYMM && (info[1] & (1 << 5))) ? OcclusionSimdLevel::AVX2 : OcclusionSimdLevel::Scalar;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? OcclusionSimdLevel::AVX2 : OcclusionSimdLevel::Scalar;
+#endif
+        }();
+        return s_supported;
+#else
+        return OcclusionSimdLevel::Scalar;
+#endif
+    }
+
+    std::atomic<int> g_occlusionLevel(-1);
+
+    using CoverFunction = void (*)(OcclusionBuffer::Triangle const&, int32_t, uint32_t*);
+    using RectFunction = bool (*)(const float*, uint32_t, int32_t, int32_t, int32_t, int32_t, float);
+
+    CoverFunction GetCoverRow()
+    {
+#if defined(OCC_SSE2)
+        if (GetOcclusionSimdLevel() == OcclusionSimdLevel::AVX2)
+            return CoverRowAVX2;
+#endif
+        return CoverRowScalar;
+    }
+
+    RectFunction GetRectTest()
+    {
+#if defined(OCC_SSE2)
+        if (GetOcclusionSimdLevel() == OcclusionSimdLevel::AVX2)
+            return IsRectVisibleAVX2;
+#endif
+        return IsRectVisibleScalar;
+    }
+}
+
+OcclusionSimdLevel DX::GetOcclusionSimdLevel()
+{
+    int level = g_occlusionLevel.load(std::memory_order_relaxed);
+    return level < 0 ? GetSupportedLevel() : OcclusionSimdLevel(level);
+}
+
+void DX::SetOcclusionSimdLevel(OcclusionSimdLevel level)
+{
+    g_occlusionLevel.store(int(std::min(level, GetSupportedLevel())), std::memory_order_relaxed);
+}
+
+const char* DX::GetOcclusionSimdLevelName(OcclusionSimdLevel level)
+{
+    switch (level)
+    {
+    case OcclusionSimdLevel::AVX2:  return "AVX2";
+    default:                        return "scalar";
+    }
+}
+
+OcclusionBuffer::OcclusionBuffer(uint32_t width, uint32_t height) :
+    m_tilesWide((std::max(width, 1u) + c_TileWidth - 1) / c_TileWidth),
+    m_tilesHigh((std::max(height, 1u) + c_TileHeight - 1) / c_TileHeight),
+    m_occluderCount(0),
+    m_stats{}
+{
+    m_width = m_tilesWide * c_TileWidth;
+    m_height = m_tilesHigh * c_TileHeight;
+    m_rowPitch = (m_tilesWide + 7) & ~7u;
+
+    // A vector load may start at the last tile of the last row
+    const size_t tiles = size_t(m_rowPitch) * m_tilesHigh + 8;
+    m_far.resize(tiles);
+    m_maskFar.resize(tiles);
+    m_mask.resize(tiles);
+    Clear();
+}
+
+void OcclusionBuffer::Clear()
+{
+    std::fill(m_far.begin(), m_far.end(), 1.f);
+    std::fill(m_maskFar.begin(), m_maskFar.end(), 0.f);
+    std::fill(m_mask.begin(), m_mask.end(), 0u);
+    m_occluderCount = 0;
+}
+
+void OcclusionBuffer::AddOccluder(const float* positions, uint32_t vertexCount, const uint32_t* indices, size_t indexCount,
+    const float modelToClip[16], OccluderCulling culling)
+{
+    // Occluders are kept from frame to frame, so their triangle lists keep their capacity
+    if (m_occluderCount == m_occluders.size())
+    {
+        m_occluders.emplace_back();
+    }
+
+    auto& occluder = m_occluders[m_occluderCount++];
+    occluder.positions = positions;
+    occluder.vertexCount = vertexCount;
+    occluder.indices = indices;
+    occluder.indexCount = indexCount;
+    std::copy(modelToClip, modelToClip + 16, occluder.modelToClip);
+    occluder.culling = culling;
+}
+
+void OcclusionBuffer::SetUp(Occluder& occluder) const
+{
+    occluder.triangles.clear();
+
+    std::vector<ClipVertex> clip(occluder.vertexCount);
+    const float* m = occluder.modelToClip;
+    for (uint32_t i = 0; i < occluder.vertexCount; ++i)
+    {
+        const float* p = &occluder.positions[size_t(i) * 3];
+        for (int c = 0; c < 4; ++c)
+        {
+            clip[i].v[c] = p[0] * m[c] + p[1] * m[4 + c] + p[2] * m[8 + c] + m[12 + c];
+        }
+    }
+
+    // Pixel centres fall on whole numbers
+    const float halfWidth = float(m_width) * 0.5f;
+    const float halfHeight = float(m_height) * 0.5f;
+    auto emit = [&](ClipVertex const& v0, ClipVertex const& v1, ClipVertex const& v2)
+    {
+        float x[3], y[3], z[3];
+        const ClipVertex* corners[3] = { &v0, &v1, &v2 };
+        for (int k = 0; k < 3; ++k)
+        {
+            const float* v = corners[k]->v;
+            x[k] = (v[0] / v[3] + 1.f) * halfWidth - 0.5f;
+            y[k] = (1.f - v[1] / v[3]) * halfHeight - 0.5f;
+            z[k] = v[2] / v[3];
+        }
+
+        // With y down, a triangle that winds clockwise on screen has a positive area
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (!(area != 0.f)
+            || (occluder.culling == OccluderCulling::Clockwise && area > 0.f)
+            || (occluder.culling == OccluderCulling::CounterClockwise && area < 0.f))
+            return;
+
+        if (area < 0.f)
+        {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(z[1], z[2]);
+            area = -area;
+        }
+
+        Triangle triangle;
+        const int32_t px0 = int32_t(std::max(ceilf(std::min({ x[0], x[1], x[2] })), 0.f));
+        const int32_t py0 = int32_t(std::max(ceilf(std::min({ y[0], y[1], y[2] })), 0.f));
+        const int32_t px1 = int32_t(std::min(floorf(std::max({ x[0], x[1], x[2] })), float(m_width - 1)));
+        const int32_t py1 = int32_t(std::min(floorf(std::max({ y[0], y[1], y[2] })), float(m_height - 1)));
+        if (px0 > px1 || py0 > py1)
+            return;
+
+        triangle.tileX0 = px0 / int32_t(c_TileWidth);
+        triangle.tileY0 = py0 / int32_t(c_TileHeight);
+        triangle.tileX1 = px1 / int32_t(c_TileWidth);
+        triangle.tileY1 = py1 / int32_t(c_TileHeight);
+
+        for (int e = 0; e < 3; ++e)
+        {
+            const int n = (e + 1) % 3;
+            const float a = y[e] - y[n];
+            const float b = x[n] - x[e];
+            triangle.edges[e][0] = a;
+            triangle.edges[e][1] = b;
+            triangle.edges[e][2] = -(a * x[e] + b * y[e]);
+        }
+
+        const float dx1 = x[1] - x[0], dy1 = y[1] - y[0], dz1 = z[1] - z[0];
+        const float dx2 = x[2] - x[0], dy2 = y[2] - y[0], dz2 = z[2] - z[0];
+        triangle.depth[0] = (dz1 * dy2 - dz2 * dy1) / area;
+        triangle.depth[1] = (dz2 * dx1 - dz1 * dx2) / area;
+        triangle.depth[2] = z[0] - triangle.depth[0] * x[0] - triangle.depth[1] * y[0];
+        triangle.farthest = std::max({ z[0], z[1], z[2] });
+
+        occluder.triangles.push_back(triangle);
+    };
+
+    ClipVertex polygon[2][c_MaxClippedVertices];
+    for (size_t i = 0; i + 2 < occluder.indexCount; i += 3)
+    {
+        const uint32_t* triangle = &occluder.indices[i];
+        if (triangle[0] >= occluder.vertexCount || triangle[1] >= occluder.vertexCount || triangle[2] >= occluder.vertexCount)
+            continue;
+
+        // Most triangles are wholly inside or wholly outside one plane
+        unsigned outside[3] = {};
+        for (int k = 0; k < 3; ++k)
+        {
+            for (int plane = 0; plane < c_ClipPlanes; ++plane)
+            {
+                outside[k] |= (PlaneDistance(clip[triangle[k]], plane) < 0.f) ? (1u << plane) : 0u;
+            }
+        }
+        if (outside[0] & outside[1] & outside[2])
+            continue;
+
+        if (!(outside[0] | outside[1] | outside[2]))
+        {
+            emit(clip[triangle[0]], clip[triangle[1]], clip[triangle[2]]);
+            continue;
+        }
+
+        int count = 3;
+        for (int k = 0; k < 3; ++k)
+        {
+            polygon[0][k] = clip[triangle[k]];
+        }
+
+        int current = 0;
+        for (int plane = 0; plane < c_ClipPlanes && count >= 3; ++plane)
+        {
+            if ((outside[0] | outside[1] | outside[2]) & (1u << plane))
+            {
+                count = ClipPolygon(polygon[current], count, plane, polygon[current ^ 1]);
+                current ^= 1;
+            }
+        }
+
+        for (int k = 2; k < count; ++k)
+        {
+            emit(polygon[current][0], polygon[current][k - 1], polygon[current][k]);
+        }
+    }
+}
+
+void OcclusionBuffer::Render(ParallelFor const& parallelFor)
+{
+    auto run = [&](size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)
+    {
+        if (parallelFor)
+            parallelFor(count, grain, body);
+        else
+            body(0, count);
+    };
+
+    run(m_occluderCount, c_OccludersPerJob, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            SetUp(m_occluders[i]);
+        }
+    });
+
+    std::atomic<uint64_t> tilesUpdated(0);
+    run(m_tilesHigh, c_RowsPerBand, [&](size_t begin, size_t end)
+    {
+        uint64_t updated = 0;
+        RenderRows(uint32_t(begin), uint32_t(end), updated);
+        tilesUpdated += updated;
+    });
+
+    m_stats.occluders += m_occluderCount;
+    for (size_t i = 0; i < m_occluderCount; ++i)
+    {
+        m_stats.triangles += m_occluders[i].indexCount / 3;
+        m_stats.trianglesDrawn += m_occluders[i].triangles.size();
+    }
+    m_stats.tilesUpdated += tilesUpdated;
+}
+
+void OcclusionBuffer::RenderRows(uint32_t firstRow, uint32_t endRow, uint64_t& tilesUpdated)
+{
+    const CoverFunction coverRow = GetCoverRow();
+    std::vector<uint32_t> masks(m_tilesWide);
+    const int32_t first = int32_t(firstRow);
+    const int32_t last = int32_t(endRow) - 1;
+
+    // In the order they were added, so every band merges the same triangles alike
+    for (size_t i = 0; i < m_occluderCount; ++i)
+    {
+        for (auto const& triangle : m_occluders[i].triangles)
+        {
+            if (triangle.tileY1 < first || triangle.tileY0 > last)
+                continue;
+
+            for (int32_t ty = std::max(triangle.tileY0, first); ty <= std::min(triangle.tileY1, last); ++ty)
+            {
+                coverRow(triangle, ty, masks.data());
+
+                const int32_t y0 = ty * int32_t(c_TileHeight);
+                const size_t row = size_t(ty) * m_rowPitch;
+                for (int32_t tx = triangle.tileX0; tx <= triangle.tileX1; ++tx)
+                {
+                    const size_t tile = row + size_t(tx);
+                    UpdateTile(m_far[tile], m_maskFar[tile], m_mask[tile], masks[tx - triangle.tileX0],
+                        GetTileDepth(triangle, tx * int32_t(c_TileWidth), y0), tilesUpdated);
+                }
+            }
+        }
+    }
+}
+
+bool OcclusionBuffer::IsVisible(const float boxMin[3], const float boxMax[3], const float modelToClip[16]) const
+{
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = FLT_MAX;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        const float p[3] = { (corner & 1) ? boxMax[0] : boxMin[0], (corner & 2) ? boxMax[1] : boxMin[1],
+            (corner & 4) ? boxMax[2] : boxMin[2] };
+
+        float clip[4];
+        for (int c = 0; c < 4; ++c)
+        {
+            clip[c] = p[0] * modelToClip[c] + p[1] * modelToClip[4 + c] + p[2] * modelToClip[8 + c] + modelToClip[12 + c];
+        }
+        if (!(clip[2] > 0.f) || !(clip[3] > 0.f))
+            return true;
+
+        const float x = (clip[0] / clip[3] + 1.f) * 0.5f * float(m_width);
+        const float y = (1.f - clip[1] / clip[3]) * 0.5f * float(m_height);
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearest = std::min(nearest, clip[2] / clip[3]);
+    }
+    return IsRectVisible(minX, minY, maxX, maxY, nearest);
+}
+
+bool OcclusionBuffer::IsRectVisible(float minX, float minY, float maxX, float maxY, float nearestDepth) const
+{
+    if (!(maxX >= 0.f && maxY >= 0.f && minX < float(m_width) && minY < float(m_height)))
+        return false;
+
+    // Every tile the rectangle touches, including those it only grazes
+    const int32_t tx0 = int32_t(std::max(minX, 0.f)) / int32_t(c_TileWidth);
+    const int32_t ty0 = int32_t(std::max(minY, 0.f)) / int32_t(c_TileHeight);
+    const int32_t tx1 = std::min(int32_t(maxX) / int32_t(c_TileWidth), int32_t(m_tilesWide) - 1);
+    const int32_t ty1 = std::min(int32_t(maxY) / int32_t(c_TileHeight), int32_t(m_tilesHigh) - 1);
+    return GetRectTest()(m_far.data(), m_rowPitch, tx0, ty0, tx1, ty1, nearestDepth);
+}
+
+std::vector<OccluderMesh> DX::BuildModelOccluders(ModelData const& model)
+{
+    std::vector<OccluderMesh> result(model.meshes.size());
+
+    std::vector<uint32_t> indices;
+    std::vector<float> positions;
+    for (size_t m = 0; m < model.meshes.size(); ++m)
+    {
+        auto const& mesh = model.meshes[m];
+        auto& occluder = result[m];
+        occluder.counterClockwise = mesh.ccw;
+
+        // Parts share the mesh's vertices only through their offsets, so each brings its own
+        for (auto const& part : mesh.parts)
+        {
+            if (!ReadClusterPart(model, mesh, part, indices, positions))
+                continue;
+
+            const uint32_t base = uint32_t(occluder.positions.size() / 3);
+            occluder.positions.insert(occluder.positions.end(), positions.begin(), positions.end());
+            for (uint32_t index : indices)
+            {
+                occluder.indices.push_back(base + index);
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,154 @@
+//
+// OcclusionBuffer.h - Masked software occlusion culling in a small tiled depth buffer
+//
+
+#pragma once
+
+#include "ModelData.h"
+
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+namespace DX
+{
+    // Rows of eight pixels, the raster loop's vector width, are tested and filled with the
+    // widest instruction set the CPU has; SetOcclusionSimdLevel lowers it, for benchmarks.
+    // Levels the CPU lacks are ignored. Every level gives the same results.
+    enum class OcclusionSimdLevel
+    {
+        Scalar,
+        AVX2,
+    };
+
+    OcclusionSimdLevel GetOcclusionSimdLevel();
+    void SetOcclusionSimdLevel(OcclusionSimdLevel level);
+    const char* GetOcclusionSimdLevelName(OcclusionSimdLevel level);
+
+    // The triangles an occluder drops by their winding on screen, as the rasterizer's cull modes
+    enum class OccluderCulling
+    {
+        None,
+        Clockwise,
+        CounterClockwise,
+    };
+
+    // A low-resolution depth buffer of occluders for testing bounding boxes against on the CPU
+    // (Hasselgren, Andersson and Akenine-Möller, "Masked Software Occlusion Culling", 2016).
+    // The buffer is split into tiles of 8x4 pixels, and a tile keeps no depth per pixel: only
+    // the farthest depth of the whole tile, a mask of the pixels covered since, and the
+    // farthest depth of those. When the mask fills, that depth becomes the tile's; a triangle
+    // much nearer than what the mask holds starts the mask over. A box is hidden when it is
+    // farther than every tile its rectangle on screen touches.
+    //
+    // Occluders are sampled at pixel centres, as the GPU samples them, but the buffer is far
+    // coarser than the screen, so a box that shows by less than one of its pixels past an
+    // occluder's edge may be hidden with it. Depth is Direct3D's, 0 at the near plane.
+    //
+    // AddOccluder only records the geometry. Render transforms and clips each occluder in
+    // parallel, then fills bands of tile rows in parallel, each band taking every triangle
+    // that touches it, so no two threads write the same tile. IsVisible may be called from
+    // any number of threads once Render has returned.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+    class OcclusionBuffer
+    {
+    public:
+        static const uint32_t c_TileWidth = 8;
+        static const uint32_t c_TileHeight = 4;
+
+        // Matches JobSystem::ParallelFor, as PackFile's does.
+        using ParallelFor = std::function<void(size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)>;
+
+        // Totals since the last reset.
+        struct Statistics
+        {
+            uint64_t    occluders;
+            uint64_t    triangles;          // submitted
+            uint64_t    trianglesDrawn;     // left after culling and clipping, each clipped piece counted
+            uint64_t    tilesUpdated;
+        };
+
+        // Sizes are rounded up to whole tiles.
+        OcclusionBuffer(uint32_t width, uint32_t height);
+
+        OcclusionBuffer(OcclusionBuffer const&) = delete;
+        OcclusionBuffer& operator= (OcclusionBuffer const&) = delete;
+
+        uint32_t GetWidth() const { return m_width; }
+        uint32_t GetHeight() const { return m_height; }
+
+        // Empties the buffer and forgets the occluders.
+        void Clear();
+
+        // Queues a triangle list. 'positions' are three floats per vertex and 'modelToClip' the
+        // row-major product of world, view and projection (row vectors, as DirectXMath). Both
+        // arrays must stay alive until Render returns; the matrix is copied.
+        void AddOccluder(const float* positions, uint32_t vertexCount, const uint32_t* indices, size_t indexCount,
+            const float modelToClip[16], OccluderCulling culling);
+
+        // Draws the queued occluders into the buffer; parallelFor, when given, spreads the work.
+        void Render(ParallelFor const& parallelFor = nullptr);
+
+        // Whether any of a box, given in model space by its corners, may show in front of the
+        // occluders. Boxes that reach the near plane always may; boxes wholly off screen never do.
+        bool IsVisible(const float boxMin[3], const float boxMax[3], const float modelToClip[16]) const;
+
+        // The same for a rectangle in pixels, (0, 0) at the top left, at its nearest depth.
+        bool IsRectVisible(float minX, float minY, float maxX, float maxY, float nearestDepth) const;
+
+        const Statistics& GetStatistics() const { return m_stats; }
+        void ResetStatistics() { m_stats = {}; }
+
+        // In pixel units, pixel centres at whole numbers: inside where every edge is positive.
+        struct Triangle
+        {
+            float       edges[3][3];    // a, b and c of a x + b y + c
+            float       depth[3];       // the depth plane, likewise
+            float       farthest;       // of its corners
+            int32_t     tileX0, tileY0, tileX1, tileY1;
+        };
+
+    private:
+        struct Occluder
+        {
+            const float*            positions;
+            uint32_t                vertexCount;
+            const uint32_t*         indices;
+            size_t                  indexCount;
+            float                   modelToClip[16];
+            OccluderCulling         culling;
+            std::vector<Triangle>   triangles;  // set up by Render
+        };
+
+        void SetUp(Occluder& occluder) const;
+        void RenderRows(uint32_t firstRow, uint32_t endRow, uint64_t& tilesUpdated);
+
+        uint32_t                m_width;
+        uint32_t                m_height;
+        uint32_t                m_tilesWide;
+        uint32_t                m_tilesHigh;
+        uint32_t                m_rowPitch;     // tiles, a whole number of vectors
+
+        // By tile
+        std::vector<float>      m_far;          // the farthest depth of the whole tile
+        std::vector<float>      m_maskFar;      // and of the pixels in the mask
+        std::vector<uint32_t>   m_mask;         // a bit per pixel, row by row
+
+        std::vector<Occluder>   m_occluders;
+        size_t                  m_occluderCount;
+
+        Statistics              m_stats;
+    };
+
+    // The triangles of a mesh's opaque triangle-list parts, for an OcclusionBuffer.
+    struct OccluderMesh
+    {
+        std::vector<float>      positions;      // three floats per vertex, in model units
+        std::vector<uint32_t>   indices;
+        bool                    counterClockwise;
+    };
+
+    // By mesh; meshes with nothing opaque to draw are left empty.
+    std::vector<OccluderMesh> BuildModelOccluders(ModelData const& model);
+}
@@ -0,0 +1,412 @@
+//
+// PNGDecoder.cpp - PNG decoding to RGBA8, declared in ImageDecoder.h
+//
+// Does not use the precompiled header, so the offline tools can build it.
+//
+
+#include "ImageDecoder.h"
+#include "Inflate.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace DX;
+
+namespace
+{
+    enum ColorType
+    {
+        ColorType_Gray = 0,
+        ColorType_RGB = 2,
+        ColorType_Palette = 3,
+        ColorType_GrayAlpha = 4,
+        ColorType_RGBA = 6,
+    };
+
+    // Adam7 passes: the first pixel of each and the step between pixels
+    const uint8_t c_PassX[7] = { 0, 4, 0, 2, 0, 1, 0 };
+    const uint8_t c_PassY[7] = { 0, 0, 4, 0, 2, 0, 1 };
+    const uint8_t c_PassStepX[7] = { 8, 8, 4, 4, 2, 2, 1 };
+    const uint8_t c_PassStepY[7] = { 8, 8, 8, 4, 4, 2, 2 };
+
+    uint32_t ReadBE32(const uint8_t* p)
+    {
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+    }
+
+    struct PNG
+    {
+        uint32_t    width = 0;
+        uint32_t    height = 0;
+        unsigned    bitDepth = 0;
+        unsigned    colorType = 0;
+        bool        interlaced = false;
+        unsigned    channels = 0;
+
+        uint32_t    palette[256];           // RGBA, with tRNS alpha
+        unsigned    paletteSize = 0;
+        bool        hasColorKey = false;    // tRNS for grey and RGB: this sample value is transparent
+        uint16_t    colorKey[3] = {};
+
+        // Bytes in a row of this many pixels, without the filter byte
+        size_t GetRowBytes(uint32_t pixels) const
+        {
+            return (size_t(pixels) * channels * bitDepth + 7) / 8;
+        }
+
+        // Unfiltering works in whole pixels, or whole bytes below eight bits a pixel
+        unsigned GetFilterStride() const
+        {
+            return std::max(1u, channels * bitDepth / 8);
+        }
+
+        // A sample at the file's bit depth
+        unsigned GetSample(const uint8_t* row, size_t index) const
+        {
+            switch (bitDepth)
+            {
+            case 16:    return (unsigned(row[index * 2]) << 8) | row[index * 2 + 1];
+            case 8:     return row[index];
+            default:
+            {
+                const size_t bit = index * bitDepth;
+                return (row[bit / 8] >> (8 - bitDepth - bit % 8)) & ((1u << bitDepth) - 1);
+            }
+            }
+        }
+    };
+
+    void ReadHeader(const uint8_t* chunk, uint32_t length, PNG& png)
+    {
+        if (length != 13)
+            throw std::runtime_error("PNG header is damaged");
+
+        png.width = ReadBE32(chunk);
+        png.height = ReadBE32(chunk + 4);
+        png.bitDepth = chunk[8];
+        png.colorType = chunk[9];
+        png.interlaced = chunk[12] == 1;
+        if (chunk[10] != 0 || chunk[11] != 0 || chunk[12] > 1)
+            throw std::runtime_error("PNG compression, filter or interlace method is not supported");
+        if (!png.width || !png.height || png.width > c_MaxImageDimension || png.height > c_MaxImageDimension)
+            throw std::runtime_error("PNG size is out of range");
+
+        bool validDepth;
+        switch (png.colorType)
+        {
+        case ColorType_Gray:
+            png.channels = 1;
+            validDepth = png.bitDepth == 1 || png.bitDepth == 2 || png.bitDepth == 4 || png.bitDepth == 8 || png.bitDepth == 16;
+            break;
+        case ColorType_Palette:
+            png.channels = 1;
+            validDepth = png.bitDepth == 1 || png.bitDepth == 2 || png.bitDepth == 4 || png.bitDepth == 8;
+            break;
+        case ColorType_RGB:
+            png.channels = 3;
+            validDepth = png.bitDepth == 8 || png.bitDepth == 16;
+            break;
+        case ColorType_GrayAlpha:
+            png.channels = 2;
+            validDepth = png.bitDepth == 8 || png.bitDepth == 16;
+            break;
+        case ColorType_RGBA:
+            png.channels = 4;
+            validDepth = png.bitDepth == 8 || png.bitDepth == 16;
+            break;
+        default:
+            validDepth = false;
+            break;
+        }
+        if (!validDepth)
+            throw std::runtime_error("PNG colour type or bit depth is not valid");
+
+        // Opaque black, for indices past the end of the palette
+        std::fill(png.palette, png.palette + 256, 0xFF000000u);
+    }
+
+    void ReadPalette(const uint8_t* chunk, uint32_t length, PNG& png)
+    {
+        if (length % 3 || length / 3 > 256 || !length)
+            throw std::runtime_error("PNG palette is damaged");
+
+        png.paletteSize = length / 3;
+        ExpandRGBToRGBA(chunk, reinterpret_cast<uint8_t*>(png.palette), png.paletteSize);
+    }
+
+    void ReadTransparency(const uint8_t* chunk, uint32_t length, PNG& png)
+    {
+        switch (png.colorType)
+        {
+        case ColorType_Palette:
+            for (uint32_t i = 0; i < std::min<uint32_t>(length, 256); ++i)
+            {
+                png.palette[i] = (png.palette[i] & 0x00FFFFFFu) | (uint32_t(chunk[i]) << 24);
+            }
+            break;
+        case ColorType_Gray:
+        case ColorType_RGB:
+            if (length != png.channels * 2)
+                throw std::runtime_error("PNG transparency is damaged");
+            for (unsigned c = 0; c < png.channels; ++c)
+            {
+                png.colorKey[c] = uint16_t((chunk[c * 2] << 8) | chunk[c * 2 + 1]);
+            }
+            png.hasColorKey = true;
+            break;
+        default:
+            break;  // the image has alpha of its own
+        }
+    }
+
+    uint8_t Paeth(int a, int b, int c)
+    {
+        const int p = a + b - c;
+        const int pa = abs(p - a);
+        const int pb = abs(p - b);
+        const int pc = abs(p - c);
+        if (pa <= pb && pa <= pc)
+            return uint8_t(a);
+        return uint8_t(pb <= pc ? b : c);
+    }
+
+    // In place, from the row above; the first row's is zeros
+    void Unfilter(unsigned filter, uint8_t* row, const uint8_t* above, size_t rowBytes, unsigned stride)
+    {
+        switch (filter)
+        {
+        case 0:
+            break;
+        case 1:     // Sub
+            for (size_t i = stride; i < rowBytes; ++i)
+            {
+                row[i] = uint8_t(row[i] + row[i - stride]);
+            }
+            break;
+        case 2:     // Up
+            for (size_t i = 0; i < rowBytes; ++i)
+            {
+                row[i] = uint8_t(row[i] + above[i]);
+            }
+            break;
+        case 3:     // Average
+            for (size_t i = 0; i < stride; ++i)
+            {
+                row[i] = uint8_t(row[i] + (above[i] >> 1));
+            }
+            for (size_t i = stride; i < rowBytes; ++i)
+            {
+                row[i] = uint8_t(row[i] + ((row[i - stride] + above[i]) >> 1));
+            }
+            break;
+        case 4:     // Paeth
+            for (size_t i = 0; i < stride; ++i)
+            {
+                row[i] = uint8_t(row[i] + above[i]);
+            }
+            for (size_t i = stride; i < rowBytes; ++i)
+            {
+                row[i] = uint8_t(row[i] + Paeth(row[i - stride], above[i], above[i - stride]));
+            }
+            break;
+        default:
+            throw std::runtime_error("PNG filter type is not valid");
+        }
+    }
+
+    // One unfiltered row to RGBA8. Depths other than eight go through samples, a row of
+    // eight-bit samples (palette indices stay indices).
+    void ConvertRow(PNG const& png, const uint8_t* row, uint32_t width, uint8_t* samples, uint8_t* out)
+    {
+        const size_t count = size_t(width) * png.channels;
+        const uint8_t* eight = row;
+        if (png.bitDepth == 16)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                samples[i] = row[i * 2];
+            }
+            eight = samples;
+        }
+        else if (png.bitDepth < 8)
+        {
+            const unsigned scale = png.colorType == ColorType_Palette ? 1 : 255 / ((1u << png.bitDepth) - 1);
+            for (size_t i = 0; i < count; ++i)
+            {
+                samples[i] = uint8_t(png.GetSample(row, i) * scale);
+            }
+            eight = samples;
+        }
+
+        switch (png.colorType)
+        {
+        case ColorType_Gray:        ExpandGrayToRGBA(eight, out, width); break;
+        case ColorType_RGB:         ExpandRGBToRGBA(eight, out, width); break;
+        case ColorType_GrayAlpha:   ExpandGrayAlphaToRGBA(eight, out, width); break;
+        case ColorType_RGBA:        memcpy(out, eight, size_t(width) * 4); break;
+        default:
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                memcpy(out + x * 4, &png.palette[eight[x]], 4);
+            }
+            break;
+        }
+
+        // The key is compared at the file's depth, so 16-bit keys compare all their bits
+        if (png.hasColorKey)
+        {
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                bool match = true;
+                for (unsigned c = 0; c < png.channels; ++c)
+                {
+                    match = match && png.GetSample(row, size_t(x) * png.channels + c) == png.colorKey[c];
+                }
+                if (match)
+                    out[x * 4 + 3] = 0;
+            }
+        }
+    }
+}
+
+void DX::DecodePNG(const uint8_t* data, size_t size, DecodedImage& image)
+{
+    if (DetectImageFormat(data, size) != ImageFileFormat::PNG)
+        throw std::runtime_error("not a PNG file");
+
+    PNG png;
+    bool sRGB = false;
+    bool ended = false;
+
+    // Image data may be split over any number of IDAT chunks, which must be consecutive
+    std::vector<std::pair<const uint8_t*, uint32_t>> imageData;
+    size_t imageDataSize = 0;
+
+    for (size_t offset = 8; !ended; )
+    {
+        if (size - offset < 12)
+            throw std::runtime_error("PNG file is truncated");
+
+        const uint32_t length = ReadBE32(data + offset);
+        const uint8_t* type = data + offset + 4;
+        const uint8_t* chunk = data + offset + 8;
+        if (length > size - offset - 12)
+            throw std::runtime_error("PNG file is truncated");
+        offset += size_t(length) + 12;      // CRCs are not checked
+
+        if (!png.width && memcmp(type, "IHDR", 4))
+            throw std::runtime_error("PNG header is missing");
+
+        if (!memcmp(type, "IHDR", 4))
+        {
+            if (png.width)
+                throw std::runtime_error("PNG header is repeated");
+            ReadHeader(chunk, length, png);
+        }
+        else if (!memcmp(type, "PLTE", 4))
+        {
+            ReadPalette(chunk, length, png);
+        }
+        else if (!memcmp(type, "tRNS", 4))
+        {
+            ReadTransparency(chunk, length, png);
+        }
+        else if (!memcmp(type, "sRGB", 4))
+        {
+            sRGB = true;
+        }
+        else if (!memcmp(type, "IDAT", 4))
+        {
+            imageData.emplace_back(chunk, length);
+            imageDataSize += length;
+        }
+        else if (!memcmp(type, "IEND", 4))
+        {
+            ended = true;
+        }
+        else if (!(type[0] & 0x20))
+        {
+            // Ancillary chunks have a lower case first letter; others cannot be ignored
+            throw std::runtime_error("PNG has a critical chunk this decoder does not know");
+        }
+    }
+
+    if (imageData.empty())
+        throw std::runtime_error("PNG has no image data");
+    if (png.colorType == ColorType_Palette && !png.paletteSize)
+        throw std::runtime_error("PNG palette is missing");
+
+    std::vector<uint8_t> joined;
+    const uint8_t* compressed = imageData[0].first;
+    if (imageData.size() > 1)
+    {
+        joined.reserve(imageDataSize);
+        for (auto const& part : imageData)
+        {
+            joined.insert(joined.end(), part.first, part.first + part.second);
+        }
+        compressed = joined.data();
+    }
+
+    // Each pass is a small image of its own, every row led by its filter type
+    uint32_t passWidth[7], passHeight[7];
+    const unsigned passCount = png.interlaced ? 7 : 1;
+    size_t filteredSize = 0;
+    for (unsigned pass = 0; pass < passCount; ++pass)
+    {
+        passWidth[pass] = png.width;
+        passHeight[pass] = png.height;
+        if (png.interlaced)
+        {
+            passWidth[pass] = png.width > c_PassX[pass] ? (png.width - c_PassX[pass] + c_PassStepX[pass] - 1) / c_PassStepX[pass] : 0;
+            passHeight[pass] = png.height > c_PassY[pass] ? (png.height - c_PassY[pass] + c_PassStepY[pass] - 1) / c_PassStepY[pass] : 0;
+        }
+        if (passWidth[pass] && passHeight[pass])
+            filteredSize += (png.GetRowBytes(passWidth[pass]) + 1) * passHeight[pass];
+    }
+
+    std::vector<uint8_t> filtered(filteredSize);
+    if (!ZlibDecompress(compressed, imageDataSize, filtered.data(), filtered.size()))
+        throw std::runtime_error("PNG image data is damaged");
+
+    image.width = png.width;
+    image.height = png.height;
+    image.sRGB = sRGB;
+    image.pixels.resize(size_t(png.width) * png.height * 4);
+
+    const unsigned stride = png.GetFilterStride();
+    const std::vector<uint8_t> zeros(png.GetRowBytes(png.width));
+    std::vector<uint8_t> samples(size_t(png.width) * png.channels);
+    std::vector<uint8_t> passRow(png.interlaced ? size_t(png.width) * 4 : 0);
+
+    uint8_t* row = filtered.data();
+    for (unsigned pass = 0; pass < passCount; ++pass)
+    {
+        if (!passWidth[pass] || !passHeight[pass])
+            continue;
+
+        const size_t rowBytes = png.GetRowBytes(passWidth[pass]);
+        const uint8_t* above = zeros.data();
+        for (uint32_t y = 0; y < passHeight[pass]; ++y)
+        {
+            Unfilter(row[0], row + 1, above, rowBytes, stride);
+            if (!png.interlaced)
+            {
+                ConvertRow(png, row + 1, png.width, samples.data(), image.pixels.data() + size_t(y) * png.width * 4);
+            }
+            else
+            {
+                ConvertRow(png, row + 1, passWidth[pass], samples.data(), passRow.data());
+                uint8_t* out = image.pixels.data() + (size_t(c_PassY[pass]) + size_t(y) * c_PassStepY[pass]) * png.width * 4;
+                for (uint32_t x = 0; x < passWidth[pass]; ++x)
+                {
+                    memcpy(out + (c_PassX[pass] + size_t(x) * c_PassStepX[pass]) * 4, passRow.data() + x * 4, 4);
+                }
+            }
+            above = row + 1;
+            row += rowBytes + 1;
+        }
+    }
+}
@@ -0,0 +1,286 @@
+//
+// PackFile.cpp - Cooked asset pack with a hashed table of contents
+//
+// Does not use the precompiled header, so the offline tools can build it.
+//
+
+#include "PackFile.h"
+#include "LZ4Block.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+using namespace DX;
+
+static_assert(sizeof(PackFile::Header) == 64, "PackFile::Header is part of the file format");
+static_assert(sizeof(PackFile::Entry) == 48, "PackFile::Entry is part of the file format");
+static_assert(sizeof(PackFile::Chunk) == 16, "PackFile::Chunk is part of the file format");
+
+namespace
+{
+    void AppendUtf8(std::string& result, uint32_t codePoint)
+    {
+        if (codePoint < 0x80)
+        {
+            result.push_back(char(codePoint));
+        }
+        else if (codePoint < 0x800)
+        {
+            result.push_back(char(0xC0 | (codePoint >> 6)));
+            result.push_back(char(0x80 | (codePoint & 0x3F)));
+        }
+        else if (codePoint < 0x10000)
+        {
+            result.push_back(char(0xE0 | (codePoint >> 12)));
+            result.push_back(char(0x80 | ((codePoint >> 6) & 0x3F)));
+            result.push_back(char(0x80 | (codePoint & 0x3F)));
+        }
+        else
+        {
+            result.push_back(char(0xF0 | (codePoint >> 18)));
+            result.push_back(char(0x80 | ((codePoint >> 12) & 0x3F)));
+            result.push_back(char(0x80 | ((codePoint >> 6) & 0x3F)));
+            result.push_back(char(0x80 | (codePoint & 0x3F)));
+        }
+    }
+
+    bool InRange(uint64_t offset, uint64_t size, uint64_t limit)
+    {
+        return offset <= limit && size <= limit - offset;
+    }
+
+    [[noreturn]] void ThrowCorrupt(const char* what)
+    {
+        throw std::runtime_error(std::string("PackFile: corrupt pack (") + what + ")");
+    }
+}
+
+std::string PackFile::NormalizeName(const wchar_t* name)
+{
+    std::string result;
+    for (; *name; ++name)
+    {
+        uint32_t codePoint = uint32_t(*name);
+
+        // wchar_t is UTF-16 on Windows
+        if (codePoint >= 0xD800 && codePoint < 0xDC00 && name[1] >= 0xDC00 && name[1] < 0xE000)
+        {
+            codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (uint32_t(name[1]) - 0xDC00);
+            ++name;
+        }
+
+        if (codePoint == '\\')
+        {
+            codePoint = '/';
+        }
+        else if (codePoint >= 'A' && codePoint <= 'Z')
+        {
+            codePoint += 'a' - 'A';
+        }
+
+        AppendUtf8(result, codePoint);
+    }
+
+    while (result.compare(0, 2, "./") == 0)
+    {
+        result.erase(0, 2);
+    }
+
+    return result;
+}
+
+uint64_t PackFile::HashName(std::string const& normalizedName)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : normalizedName)
+    {
+        hash ^= uint8_t(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+PackFile::PackFile(const wchar_t* fileName) :
+    m_file(fileName),
+    m_header{},
+    m_entries(nullptr),
+    m_chunks(nullptr),
+    m_names(nullptr)
+{
+    if (m_file.size() < sizeof(Header))
+        ThrowCorrupt("header");
+
+    memcpy(&m_header, m_file.data(), sizeof(Header));
+    ValidateHeader();
+
+    m_entries = reinterpret_cast<const Entry*>(m_file.data() + m_header.entriesOffset);
+    m_chunks = reinterpret_cast<const Chunk*>(m_file.data() + m_header.chunksOffset);
+    m_names = reinterpret_cast<const char*>(m_file.data() + m_header.namesOffset);
+
+    for (uint32_t i = 0; i < m_header.entryCount; ++i)
+    {
+        const auto& entry = m_entries[i];
+
+        if (i > 0 && m_entries[i - 1].nameHash > entry.nameHash)
+            ThrowCorrupt("table of contents order");
+        if (!InRange(entry.nameOffset, entry.nameLength, m_header.namesSize))
+            ThrowCorrupt("name");
+        if (!InRange(entry.offset, entry.storedSize, m_header.fileSize) || entry.size > SIZE_MAX)
+            ThrowCorrupt("payload");
+
+        if (!entry.chunkCount)
+        {
+            if (entry.storedSize != entry.size)
+                ThrowCorrupt("stored entry size");
+            continue;
+        }
+
+        if (!InRange(entry.firstChunk, entry.chunkCount, m_header.chunkCount)
+            || entry.size / m_header.chunkSize + (entry.size % m_header.chunkSize != 0) != entry.chunkCount)
+        {
+            ThrowCorrupt("chunk range");
+        }
+
+        // Each chunk must fill its own slice of the output and come from inside the payload
+        uint64_t remaining = entry.size;
+        for (uint32_t c = 0; c < entry.chunkCount; ++c)
+        {
+            const auto& chunk = m_chunks[entry.firstChunk + c];
+            if (chunk.size != std::min<uint64_t>(remaining, m_header.chunkSize)
+                || chunk.storedSize > chunk.size
+                || chunk.offset < entry.offset
+                || !InRange(chunk.offset - entry.offset, chunk.storedSize, entry.storedSize))
+            {
+                ThrowCorrupt("chunk");
+            }
+            remaining -= chunk.size;
+        }
+    }
+}
+
+void PackFile::ValidateHeader() const
+{
+    if (m_header.magic != c_Magic)
+        throw std::runtime_error("PackFile: not a pack file");
+    if (m_header.version != c_Version)
+        throw std::runtime_error("PackFile: unsupported pack version");
+
+    if (m_header.fileSize != m_file.size())
+        ThrowCorrupt("file size");
+    if (!m_header.chunkSize || !m_header.alignment)
+        ThrowCorrupt("header");
+
+    if (m_header.entriesOffset % alignof(Entry) || m_header.chunksOffset % alignof(Chunk)
+        || !InRange(m_header.entriesOffset, uint64_t(m_header.entryCount) * sizeof(Entry), m_header.fileSize)
+        || !InRange(m_header.chunksOffset, uint64_t(m_header.chunkCount) * sizeof(Chunk), m_header.fileSize)
+        || !InRange(m_header.namesOffset, m_header.namesSize, m_header.fileSize))
+    {
+        ThrowCorrupt("tables");
+    }
+}
+
+const PackFile::Entry* PackFile::Find(const wchar_t* name) const
+{
+    const std::string normalized = NormalizeName(name);
+    const uint64_t hash = HashName(normalized);
+
+    auto first = std::lower_bound(m_entries, m_entries + m_header.entryCount, hash,
+        [](const Entry& entry, uint64_t value) { return entry.nameHash < value; });
+
+    for (auto it = first; it != m_entries + m_header.entryCount && it->nameHash == hash; ++it)
+    {
+        if (it->nameLength == normalized.size()
+            && !memcmp(m_names + it->nameOffset, normalized.data(), normalized.size()))
+        {
+            return it;
+        }
+    }
+    return nullptr;
+}
+
+const uint8_t* PackFile::GetStoredData(const Entry& entry) const
+{
+    return entry.chunkCount ? nullptr : m_file.data() + entry.offset;
+}
+
+void PackFile::Read(const Entry& entry, uint8_t* destination, ParallelFor const& parallelFor) const
+{
+    ReadRange(entry, 0, size_t(entry.size), destination, parallelFor);
+}
+
+void PackFile::ReadRange(const Entry& entry, uint64_t offset, size_t size, uint8_t* destination,
+    ParallelFor const& parallelFor) const
+{
+    if (offset > entry.size || size > entry.size - offset)
+        throw std::out_of_range("PackFile: read past the end of " + GetName(entry));
+
+    if (!size)
+        return;
+
+    if (!entry.chunkCount)
+    {
+        memcpy(destination, m_file.data() + entry.offset + offset, size);
+        return;
+    }
+
+    const uint64_t chunkSize = m_header.chunkSize;
+    const size_t first = size_t(offset / chunkSize);
+    const size_t count = size_t((offset + size - 1) / chunkSize) + 1 - first;
+
+    auto decompress = [&](size_t begin, size_t end)
+    {
+        std::vector<uint8_t> partial;
+        for (size_t c = first + begin; c < first + end; ++c)
+        {
+            const auto& chunk = m_chunks[entry.firstChunk + c];
+            const uint8_t* source = m_file.data() + chunk.offset;
+            const uint64_t chunkStart = c * chunkSize;
+            const uint64_t copyStart = std::max(offset, chunkStart);
+            const uint64_t copyEnd = std::min(offset + size, chunkStart + chunk.size);
+            uint8_t* target = destination + (copyStart - offset);
+
+            if (chunk.storedSize == chunk.size)
+            {
+                memcpy(target, source + (copyStart - chunkStart), size_t(copyEnd - copyStart));
+                continue;
+            }
+
+            // A chunk the range only partly covers is decompressed aside, then the part copied
+            const bool whole = copyStart == chunkStart && copyEnd == chunkStart + chunk.size;
+            if (!whole)
+            {
+                partial.resize(chunk.size);
+            }
+            if (!LZ4Decompress(source, chunk.storedSize, whole ? target : partial.data(), chunk.size))
+            {
+                throw std::runtime_error("PackFile: corrupt chunk in " + GetName(entry));
+            }
+            if (!whole)
+            {
+                memcpy(target, partial.data() + (copyStart - chunkStart), size_t(copyEnd - copyStart));
+            }
+        }
+    };
+
+    if (parallelFor && count > 1)
+    {
+        parallelFor(count, 1, decompress);
+    }
+    else
+    {
+        decompress(0, count);
+    }
+}
+
+std::vector<uint8_t> PackFile::Read(const Entry& entry, ParallelFor const& parallelFor) const
+{
+    std::vector<uint8_t> result(size_t(entry.size));
+    Read(entry, result.data(), parallelFor);
+    return result;
+}
+
+std::string PackFile::GetName(const Entry& entry) const
+{
+    return std::string(m_names + entry.nameOffset, entry.nameLength);
+}
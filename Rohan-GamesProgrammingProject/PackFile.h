@@ -0,0 +1,117 @@
+//
+// PackFile.h - Cooked asset pack with a hashed table of contents
+//
+
+#pragma once
+
+#include "MappedFile.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace DX
+{
+    // One file holding many assets, so loading opens and maps a single file instead of one per
+    // asset. Layout, all little-endian:
+    //
+    //   Header
+    //   payloads, each starting on a Header::alignment (page) boundary
+    //   chunk table, entry table, name strings
+    //
+    // Entries are sorted by the 64-bit FNV-1a hash of their normalised name (UTF-8, lower-case
+    // ASCII, '/' separators), so a lookup is a binary search. An entry is either stored, and
+    // can be used in place straight from the mapping, or split into fixed-size chunks that are
+    // each LZ4 compressed (or kept raw when that does not help) and decompress independently.
+    //
+    // Every offset and size is checked when the pack is opened, so a truncated or corrupt pack
+    // throws then rather than reading out of range later.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+    class PackFile
+    {
+    public:
+        static const uint32_t c_Magic = 0x4B415043;     // "CPAK"
+        static const uint32_t c_Version = 1;
+        static const uint32_t c_DefaultAlignment = 4096;
+        static const uint32_t c_DefaultChunkSize = 64 * 1024;
+
+        struct Header
+        {
+            uint32_t    magic;
+            uint32_t    version;
+            uint32_t    entryCount;
+            uint32_t    chunkCount;
+            uint32_t    alignment;
+            uint32_t    chunkSize;          // every chunk but an entry's last holds this many bytes
+            uint64_t    chunksOffset;
+            uint64_t    entriesOffset;
+            uint64_t    namesOffset;
+            uint64_t    namesSize;
+            uint64_t    fileSize;
+        };
+
+        struct Entry
+        {
+            uint64_t    nameHash;
+            uint64_t    offset;             // of the payload
+            uint64_t    size;               // once decompressed
+            uint64_t    storedSize;         // of the payload
+            uint32_t    nameOffset;         // into the name strings, which are not terminated
+            uint32_t    nameLength;
+            uint32_t    firstChunk;
+            uint32_t    chunkCount;         // zero for a stored entry
+        };
+
+        struct Chunk
+        {
+            uint64_t    offset;
+            uint32_t    storedSize;         // equal to size for a chunk kept raw
+            uint32_t    size;
+        };
+
+        // Matches JobSystem::ParallelFor, so the game can hand the pack its job system and the
+        // tools a plain thread pool.
+        using ParallelFor = std::function<void(size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)>;
+
+        static std::string NormalizeName(const wchar_t* name);
+        static uint64_t HashName(std::string const& normalizedName);
+
+        explicit PackFile(const wchar_t* fileName);
+
+        PackFile(PackFile const&) = delete;
+        PackFile& operator= (PackFile const&) = delete;
+
+        // Null when the pack has no such file. Names are normalised first, so "Mesh\\Skull.sdkmesh"
+        // finds "mesh/skull.sdkmesh".
+        const Entry* Find(const wchar_t* name) const;
+
+        // The payload in place for a stored entry, valid while the pack is open; null for an
+        // entry that has to be decompressed.
+        const uint8_t* GetStoredData(const Entry& entry) const;
+
+        // Copies or decompresses an entry into entry.size bytes at destination. Chunks are
+        // spread over parallelFor when one is given.
+        void Read(const Entry& entry, uint8_t* destination, ParallelFor const& parallelFor = nullptr) const;
+        std::vector<uint8_t> Read(const Entry& entry, ParallelFor const& parallelFor = nullptr) const;
+
+        // Bytes [offset, offset + size) of an entry, decompressing only the chunks that hold them,
+        // so a loader can take one piece of a large file. A range past the end throws.
+        void ReadRange(const Entry& entry, uint64_t offset, size_t size, uint8_t* destination,
+            ParallelFor const& parallelFor = nullptr) const;
+
+        size_t GetEntryCount() const { return m_header.entryCount; }
+        const Entry& GetEntry(size_t index) const { return m_entries[index]; }
+        std::string GetName(const Entry& entry) const;
+        const Header& GetHeader() const { return m_header; }
+
+    private:
+        void ValidateHeader() const;
+
+        MappedFile      m_file;
+        Header          m_header;
+        const Entry*    m_entries;
+        const Chunk*    m_chunks;
+        const char*     m_names;
+    };
+}
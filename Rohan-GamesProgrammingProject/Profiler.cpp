@@ -0,0 +1,366 @@
+//
+// Profiler.cpp - Scoped CPU timers with per-thread ring buffers and Chrome trace export
+//
+
+#include "pch.h"
+#include "Profiler.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace DX;
+
+namespace
+{
+    const size_t c_EventMask = Profiler::c_EventsPerThread - 1;
+
+    static_assert(!(Profiler::c_EventsPerThread & c_EventMask), "c_EventsPerThread must be a power of two");
+
+    // Written only by its own thread; EndFrame and the exporters read up to 'written'.
+    struct ThreadBuffer
+    {
+        ThreadBuffer() :
+            id(GetCurrentThreadId()),
+            events(new Profiler::Event[Profiler::c_EventsPerThread]),
+            written(0),
+            depth(0),
+            folded(0),
+            traceStart(0)
+        {
+        }
+
+        uint32_t                            id;
+        std::string                         name;
+        std::unique_ptr<Profiler::Event[]>  events;
+        std::atomic<uint64_t>               written;
+        uint32_t                            depth;
+
+        // Owned by the reader side (under the profiler mutex).
+        uint64_t                            folded;
+        uint64_t                            traceStart;
+    };
+
+    struct Zone
+    {
+        const char*             name;
+        uint32_t                depth;
+        int64_t                 firstBegin;     // orders the summary by call order rather than completion
+        int64_t                 frameTicks;
+        uint32_t                frameCalls;
+        std::vector<double>     historyMs;
+        std::vector<uint32_t>   historyCalls;
+        size_t                  historyNext;
+    };
+
+    struct ProfilerState
+    {
+        ProfilerState() :
+            lastFrame(0)
+        {
+            LARGE_INTEGER value;
+            QueryPerformanceFrequency(&value);
+            frequency = value.QuadPart;
+            QueryPerformanceCounter(&value);
+            origin = value.QuadPart;
+
+            ResetZones();
+        }
+
+        void ResetZones()
+        {
+            zones.clear();
+            zoneLookup.clear();
+            FindZone("Frame", 0, 0);
+        }
+
+        // Zones are merged by name, since equal literals in different files may not share an address.
+        Zone& FindZone(const char* name, uint32_t depth, int64_t begin)
+        {
+            auto it = zoneLookup.find(name);
+            if (it == zoneLookup.end())
+            {
+                size_t index = zones.size();
+                for (size_t i = 0; i < zones.size(); ++i)
+                {
+                    if (!strcmp(zones[i].name, name))
+                    {
+                        index = i;
+                        break;
+                    }
+                }
+
+                if (index == zones.size())
+                {
+                    zones.push_back({ name, depth, begin, 0, 0, {}, {}, 0 });
+                }
+                it = zoneLookup.emplace(name, index).first;
+            }
+
+            Zone& zone = zones[it->second];
+            zone.depth = std::min(zone.depth, depth);
+            return zone;
+        }
+
+        double ToMilliseconds(int64_t ticks) const
+        {
+            return double(ticks) * 1000.0 / double(frequency);
+        }
+
+        std::mutex                                  mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>>  threads;
+        std::vector<Zone>                           zones;
+        std::unordered_map<const char*, size_t>     zoneLookup;
+        int64_t                                     frequency;
+        int64_t                                     origin;
+        int64_t                                     lastFrame;
+    };
+
+    ProfilerState& GetState()
+    {
+        static ProfilerState s_state;
+        return s_state;
+    }
+
+    thread_local ThreadBuffer* t_buffer = nullptr;
+
+    ThreadBuffer& GetThreadBuffer()
+    {
+        if (!t_buffer)
+        {
+            auto& state = GetState();
+            std::lock_guard<std::mutex> lock(state.mutex);
+
+            state.threads.emplace_back(new ThreadBuffer);
+            t_buffer = state.threads.back().get();
+        }
+        return *t_buffer;
+    }
+
+    void WriteJsonString(FILE* file, const char* text)
+    {
+        fputc('"', file);
+        for (; *text; ++text)
+        {
+            if (*text == '"' || *text == '\\')
+            {
+                fputc('\\', file);
+            }
+            fputc(*text, file);
+        }
+        fputc('"', file);
+    }
+}
+
+std::atomic<bool> Profiler::s_enabled(false);
+
+void Profiler::SetThreadName(const char* name)
+{
+    auto& buffer = GetThreadBuffer();
+
+    std::lock_guard<std::mutex> lock(GetState().mutex);
+    buffer.name = name;
+}
+
+uint32_t Profiler::Enter() noexcept
+{
+    return GetThreadBuffer().depth++;
+}
+
+void Profiler::Leave(const char* name, int64_t begin, uint32_t depth) noexcept
+{
+    int64_t end = Now();
+
+    auto& buffer = *t_buffer;
+    buffer.depth = depth;
+
+    uint64_t index = buffer.written.load(std::memory_order_relaxed);
+    buffer.events[index & c_EventMask] = { name, begin, end, depth };
+    buffer.written.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::EndFrame()
+{
+    auto& state = GetState();
+    int64_t now = Now();
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    for (auto& thread : state.threads)
+    {
+        uint64_t written = thread->written.load(std::memory_order_acquire);
+
+        // Anything older than one ring has been overwritten already
+        uint64_t first = std::max<uint64_t>(thread->folded,
+            written > c_EventsPerThread ? written - c_EventsPerThread : 0);
+
+        for (uint64_t i = first; i < written; ++i)
+        {
+            const Event& event = thread->events[i & c_EventMask];
+
+            Zone& zone = state.FindZone(event.name, event.depth + 1, event.begin);
+            zone.frameTicks += event.end - event.begin;
+            ++zone.frameCalls;
+        }
+
+        thread->folded = written;
+    }
+
+    if (state.lastFrame)
+    {
+        Zone& frame = state.zones[0];
+        frame.frameTicks = now - state.lastFrame;
+        frame.frameCalls = 1;
+    }
+    state.lastFrame = now;
+
+    for (auto& zone : state.zones)
+    {
+        if (!zone.frameCalls)
+            continue;
+
+        double ms = state.ToMilliseconds(zone.frameTicks);
+        if (zone.historyMs.size() < c_HistoryFrames)
+        {
+            zone.historyMs.push_back(ms);
+            zone.historyCalls.push_back(zone.frameCalls);
+        }
+        else
+        {
+            zone.historyMs[zone.historyNext] = ms;
+            zone.historyCalls[zone.historyNext] = zone.frameCalls;
+        }
+        zone.historyNext = (zone.historyNext + 1) % c_HistoryFrames;
+
+        zone.frameTicks = 0;
+        zone.frameCalls = 0;
+    }
+}
+
+std::vector<Profiler::ZoneSummary> Profiler::GetSummary()
+{
+    auto& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    std::vector<const Zone*> zones;
+    for (const auto& zone : state.zones)
+    {
+        zones.push_back(&zone);
+    }
+    std::stable_sort(zones.begin(), zones.end(), [](const Zone* a, const Zone* b)
+    {
+        return a->firstBegin < b->firstBegin;
+    });
+
+    std::vector<ZoneSummary> summary;
+    summary.reserve(zones.size());
+
+    std::vector<double> sorted;
+    for (const Zone* zone : zones)
+    {
+        if (zone->historyMs.empty())
+            continue;
+
+        sorted = zone->historyMs;
+        std::sort(sorted.begin(), sorted.end());
+
+        double total = 0;
+        for (double ms : sorted)
+        {
+            total += ms;
+        }
+
+        uint64_t calls = 0;
+        for (uint32_t count : zone->historyCalls)
+        {
+            calls += count;
+        }
+
+        const size_t frames = sorted.size();
+        const size_t p99 = std::min(frames - 1, (frames * 99 + 99) / 100 - 1);
+
+        summary.push_back({ zone->name, zone->depth, frames,
+            sorted.front(), total / double(frames), sorted[p99], sorted.back(),
+            double(calls) / double(frames) });
+    }
+
+    return summary;
+}
+
+void Profiler::WriteSummary(FILE* file)
+{
+    fprintf(file, "%-32s %7s %9s %9s %9s %9s %8s\n", "zone", "frames", "min ms", "avg ms", "p99 ms", "max ms", "calls");
+
+    for (const auto& zone : GetSummary())
+    {
+        char label[64];
+        int indent = int(std::min<uint32_t>(zone.depth, 8)) * 2;
+        sprintf_s(label, "%*s%s", indent, "", zone.name);
+
+        fprintf(file, "%-32s %7zu %9.3f %9.3f %9.3f %9.3f %8.1f\n", label, zone.frames,
+            zone.minMs, zone.avgMs, zone.p99Ms, zone.maxMs, zone.callsPerFrame);
+    }
+}
+
+void Profiler::WriteChromeTrace(const wchar_t* fileName)
+{
+    FILE* file = nullptr;
+    if (_wfopen_s(&file, fileName, L"w") || !file)
+        throw std::exception("Profiler: unable to create trace file");
+
+    auto& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    const double ticksToMicroseconds = 1000000.0 / double(state.frequency);
+    bool first = true;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    for (const auto& thread : state.threads)
+    {
+        if (!thread->name.empty())
+        {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                first ? "" : ",\n", thread->id);
+            WriteJsonString(file, thread->name.c_str());
+            fprintf(file, "}}");
+            first = false;
+        }
+
+        uint64_t written = thread->written.load(std::memory_order_acquire);
+        uint64_t start = std::max<uint64_t>(thread->traceStart,
+            written > c_EventsPerThread ? written - c_EventsPerThread : 0);
+
+        for (uint64_t i = start; i < written; ++i)
+        {
+            const Event& event = thread->events[i & c_EventMask];
+
+            fprintf(file, "%s{\"name\":", first ? "" : ",\n");
+            WriteJsonString(file, event.name);
+            fprintf(file, ",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                thread->id,
+                double(event.begin - state.origin) * ticksToMicroseconds,
+                double(event.end - event.begin) * ticksToMicroseconds);
+            first = false;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
+
+void Profiler::Reset()
+{
+    auto& state = GetState();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    for (auto& thread : state.threads)
+    {
+        uint64_t written = thread->written.load(std::memory_order_acquire);
+        thread->folded = written;
+        thread->traceStart = written;
+    }
+
+    state.ResetZones();
+    state.lastFrame = 0;
+}
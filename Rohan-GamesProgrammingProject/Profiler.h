@@ -0,0 +1,126 @@
+//
+// Profiler.h - Scoped CPU timers with per-thread ring buffers and Chrome trace export
+//
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace DX
+{
+    // Zones are opened with DX_PROFILE_SCOPE("Name") and close at the end of the enclosing
+    // block, so nesting follows the call stack. Each thread writes completed zones into its
+    // own ring buffer with no locking; when the profiler is disabled a zone costs one relaxed
+    // load and a branch. Defining DX_DISABLE_PROFILER compiles the zones out entirely.
+    //
+    // EndFrame, called once per frame on the main thread, folds the zones completed since the
+    // previous call into per-zone totals for that frame and keeps the last c_HistoryFrames
+    // of them. Names must be string literals (or otherwise outlive the profiler).
+    class Profiler
+    {
+    public:
+        static const size_t c_EventsPerThread = 1 << 16;
+        static const size_t c_HistoryFrames = 240;
+
+        struct Event
+        {
+            const char* name;
+            int64_t     begin;      // QueryPerformanceCounter ticks
+            int64_t     end;
+            uint32_t    depth;
+        };
+
+        // Per-frame time spent in one zone (summed over calls and threads), over the frames
+        // in the history window in which the zone ran.
+        struct ZoneSummary
+        {
+            const char* name;
+            uint32_t    depth;      // shallowest nesting level seen
+            size_t      frames;
+            double      minMs;
+            double      avgMs;
+            double      p99Ms;
+            double      maxMs;
+            double      callsPerFrame;
+        };
+
+        static void SetEnabled(bool enabled) noexcept { s_enabled.store(enabled, std::memory_order_relaxed); }
+        static bool IsEnabled() noexcept              { return s_enabled.load(std::memory_order_relaxed); }
+
+        // Names the calling thread in the trace.
+        static void SetThreadName(_In_z_ const char* name);
+
+        static void EndFrame();
+
+        // Zone statistics over the history window, in call order; "Frame" is the time
+        // between EndFrame calls.
+        static std::vector<ZoneSummary> GetSummary();
+        static void WriteSummary(_In_ FILE* file);
+
+        // Writes every event still held in the ring buffers as Chrome trace JSON
+        // (chrome://tracing or ui.perfetto.dev). Call while no other thread is recording.
+        static void WriteChromeTrace(_In_z_ const wchar_t* fileName);
+
+        // Drops all recorded events and history.
+        static void Reset();
+
+        // Used by ProfileScope.
+        static int64_t Now() noexcept
+        {
+            LARGE_INTEGER counter;
+            QueryPerformanceCounter(&counter);
+            return counter.QuadPart;
+        }
+
+        static uint32_t Enter() noexcept;
+        static void Leave(const char* name, int64_t begin, uint32_t depth) noexcept;
+
+    private:
+        static std::atomic<bool> s_enabled;
+    };
+
+    class ProfileScope
+    {
+    public:
+        explicit ProfileScope(const char* name) noexcept :
+            m_name(nullptr),
+            m_begin(0),
+            m_depth(0)
+        {
+            if (Profiler::IsEnabled())
+            {
+                m_name = name;
+                m_depth = Profiler::Enter();
+                m_begin = Profiler::Now();
+            }
+        }
+
+        ~ProfileScope()
+        {
+            if (m_name)
+            {
+                Profiler::Leave(m_name, m_begin, m_depth);
+            }
+        }
+
+        ProfileScope(ProfileScope const&) = delete;
+        ProfileScope& operator= (ProfileScope const&) = delete;
+
+    private:
+        const char* m_name;
+        int64_t     m_begin;
+        uint32_t    m_depth;
+    };
+}
+
+#define DX_PROFILE_CONCAT_INNER(a, b) a##b
+#define DX_PROFILE_CONCAT(a, b) DX_PROFILE_CONCAT_INNER(a, b)
+
+#if defined(DX_DISABLE_PROFILER)
+#define DX_PROFILE_SCOPE(name) ((void)0)
+#else
+#define DX_PROFILE_SCOPE(name) DX::ProfileScope DX_PROFILE_CONCAT(profileScope_, __LINE__)(name)
+#endif
@@ -0,0 +1,25 @@
+//
+// ReadContent.h - Loads a content file from the asset pack, or loose from disk
+//
+
+#pragma once
+
+#include "PackFile.h"
+#include "ReadData.h"
+
+namespace DX
+{
+    // ReadData for content that may be cooked: a file the pack holds is read (and decompressed)
+    // from it, anything else is read loose, so a pack that lags behind the content still works.
+    // The pack may be null.
+    inline std::vector<uint8_t> ReadContent(_In_opt_ const PackFile* pack, _In_z_ const wchar_t* name,
+        PackFile::ParallelFor const& parallelFor = nullptr)
+    {
+        if (pack)
+        {
+            if (auto entry = pack->Find(name))
+                return pack->Read(*entry, parallelFor);
+        }
+        return ReadData(name);
+    }
+}
@@ -0,0 +1,340 @@
+//
+// RecordingDeviceContext.cpp - A pass-through ID3D11DeviceContext1 that counts the work submitted to it
+//
+
+#include "pch.h"
+#include "RecordingDeviceContext.h"
+
+using namespace DX;
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+    // Size in bytes of a whole buffer, or 0 if the resource is not a buffer.
+    inline UINT BufferByteWidth(ID3D11Resource* resource)
+    {
+        D3D11_RESOURCE_DIMENSION dimension = D3D11_RESOURCE_DIMENSION_UNKNOWN;
+        resource->GetType(&dimension);
+        if (dimension != D3D11_RESOURCE_DIMENSION_BUFFER)
+            return 0;
+
+        D3D11_BUFFER_DESC desc = {};
+        static_cast<ID3D11Buffer*>(resource)->GetDesc(&desc);
+        return desc.ByteWidth;
+    }
+
+    // Number of rows in a given mip of a 2D texture, or 1 for anything else.
+    inline UINT SubresourceRows(ID3D11Resource* resource, UINT subresource)
+    {
+        D3D11_RESOURCE_DIMENSION dimension = D3D11_RESOURCE_DIMENSION_UNKNOWN;
+        resource->GetType(&dimension);
+        if (dimension != D3D11_RESOURCE_DIMENSION_TEXTURE2D)
+            return 1;
+
+        D3D11_TEXTURE2D_DESC desc = {};
+        static_cast<ID3D11Texture2D*>(resource)->GetDesc(&desc);
+        UINT mip = subresource % std::max<UINT>(desc.MipLevels, 1u);
+        return std::max<UINT>(desc.Height >> mip, 1u);
+    }
+}
+
+RecordingDeviceContext::RecordingDeviceContext(ID3D11DeviceContext1* inner, bool absorbWork) noexcept :
+    m_refCount(1),
+    m_inner(inner),
+    m_absorbWork(absorbWork)
+{
+}
+
+void RecordingDeviceContext::EndFrame() noexcept
+{
+    m_frame.frames = 1;
+    m_lastFrame = m_frame;
+    m_total += m_frame;
+    m_frame.Reset();
+}
+
+void RecordingDeviceContext::ResetStats() noexcept
+{
+    m_frame.Reset();
+    m_lastFrame.Reset();
+    m_total.Reset();
+}
+
+#pragma region IUnknown
+HRESULT RecordingDeviceContext::QueryInterface(REFIID riid, void** ppvObject)
+{
+    if (!ppvObject)
+        return E_POINTER;
+
+    if (riid == __uuidof(IUnknown)
+        || riid == __uuidof(ID3D11DeviceChild)
+        || riid == __uuidof(ID3D11DeviceContext)
+        || riid == __uuidof(ID3D11DeviceContext1))
+    {
+        *ppvObject = static_cast<ID3D11DeviceContext1*>(this);
+        AddRef();
+        return S_OK;
+    }
+
+    // Anything else (annotations, multithread, ...) is served by the real context.
+    return m_inner->QueryInterface(riid, ppvObject);
+}
+
+ULONG RecordingDeviceContext::AddRef()
+{
+    return ++m_refCount;
+}
+
+ULONG RecordingDeviceContext::Release()
+{
+    ULONG count = --m_refCount;
+    if (!count)
+    {
+        delete this;
+    }
+    return count;
+}
+#pragma endregion
+
+#pragma region Work submission
+void RecordingDeviceContext::RecordDraw(uint64_t primitives, uint64_t instances) noexcept
+{
+    ++m_frame.drawCalls;
+    m_frame.primitivesSubmitted += primitives * instances;
+    m_frame.instancesSubmitted += instances;
+}
+
+void RecordingDeviceContext::RecordUpload(ID3D11Resource* resource, UINT subresource, const D3D11_BOX* box, UINT rowPitch, UINT depthPitch) noexcept
+{
+    if (!resource)
+        return;
+
+    uint64_t bytes = 0;
+    UINT byteWidth = BufferByteWidth(resource);
+    if (byteWidth)
+    {
+        bytes = box ? (box->right - box->left) : byteWidth;
+    }
+    else if (box)
+    {
+        bytes = uint64_t(rowPitch) * (box->bottom - box->top) * std::max<UINT>(box->back - box->front, 1u);
+    }
+    else
+    {
+        bytes = depthPitch ? depthPitch : uint64_t(rowPitch) * SubresourceRows(resource, subresource);
+    }
+
+    m_frame.bytesUploaded += bytes;
+}
+
+void RecordingDeviceContext::Draw(UINT VertexCount, UINT StartVertexLocation)
+{
+    RecordDraw(VertexCount, 1);
+    if (!m_absorbWork)
+        m_inner->Draw(VertexCount, StartVertexLocation);
+}
+
+void RecordingDeviceContext::DrawIndexed(UINT IndexCount, UINT StartIndexLocation, INT BaseVertexLocation)
+{
+    RecordDraw(IndexCount, 1);
+    if (!m_absorbWork)
+        m_inner->DrawIndexed(IndexCount, StartIndexLocation, BaseVertexLocation);
+}
+
+void RecordingDeviceContext::DrawInstanced(UINT VertexCountPerInstance, UINT InstanceCount, UINT StartVertexLocation, UINT StartInstanceLocation)
+{
+    RecordDraw(VertexCountPerInstance, InstanceCount);
+    ++m_frame.instancedDrawCalls;
+    if (!m_absorbWork)
+        m_inner->DrawInstanced(VertexCountPerInstance, InstanceCount, StartVertexLocation, StartInstanceLocation);
+}
+
+void RecordingDeviceContext::DrawIndexedInstanced(UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation, INT BaseVertexLocation, UINT StartInstanceLocation)
+{
+    RecordDraw(IndexCountPerInstance, InstanceCount);
+    ++m_frame.instancedDrawCalls;
+    if (!m_absorbWork)
+        m_inner->DrawIndexedInstanced(IndexCountPerInstance, InstanceCount, StartIndexLocation, BaseVertexLocation, StartInstanceLocation);
+}
+
+void RecordingDeviceContext::DrawAuto()
+{
+    RecordDraw(0, 1);
+    if (!m_absorbWork)
+        m_inner->DrawAuto();
+}
+
+void RecordingDeviceContext::DrawIndexedInstancedIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs)
+{
+    RecordDraw(0, 0);
+    ++m_frame.indirectDrawCalls;
+    if (!m_absorbWork)
+        m_inner->DrawIndexedInstancedIndirect(pBufferForArgs, AlignedByteOffsetForArgs);
+}
+
+void RecordingDeviceContext::DrawInstancedIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs)
+{
+    RecordDraw(0, 0);
+    ++m_frame.indirectDrawCalls;
+    if (!m_absorbWork)
+        m_inner->DrawInstancedIndirect(pBufferForArgs, AlignedByteOffsetForArgs);
+}
+
+void RecordingDeviceContext::Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ)
+{
+    ++m_frame.dispatchCalls;
+    if (!m_absorbWork)
+        m_inner->Dispatch(ThreadGroupCountX, ThreadGroupCountY, ThreadGroupCountZ);
+}
+
+void RecordingDeviceContext::DispatchIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs)
+{
+    ++m_frame.dispatchCalls;
+    if (!m_absorbWork)
+        m_inner->DispatchIndirect(pBufferForArgs, AlignedByteOffsetForArgs);
+}
+
+HRESULT RecordingDeviceContext::Map(ID3D11Resource* pResource, UINT Subresource, D3D11_MAP MapType, UINT MapFlags, D3D11_MAPPED_SUBRESOURCE* pMappedResource)
+{
+    if (!pResource || !pMappedResource)
+        return E_INVALIDARG;
+
+    ++m_frame.maps;
+
+    UINT byteWidth = BufferByteWidth(pResource);
+    if (MapType != D3D11_MAP_READ)
+    {
+        m_frame.bytesMapped += byteWidth;
+
+        // NO_OVERWRITE appends into a ring, so only a full rewrite counts as uploaded bytes.
+        if (MapType != D3D11_MAP_WRITE_NO_OVERWRITE)
+        {
+            m_frame.bytesUploaded += byteWidth;
+        }
+    }
+
+    if (m_absorbWork && byteWidth)
+    {
+        // Keep a persistent block per buffer so NO_OVERWRITE ring buffers behave as expected.
+        auto& scratch = m_scratch[pResource];
+        if (scratch.size() < byteWidth)
+        {
+            scratch.resize(byteWidth);
+        }
+
+        pMappedResource->pData = scratch.data();
+        pMappedResource->RowPitch = byteWidth;
+        pMappedResource->DepthPitch = byteWidth;
+        return S_OK;
+    }
+
+    return m_inner->Map(pResource, Subresource, MapType, MapFlags, pMappedResource);
+}
+
+void RecordingDeviceContext::Unmap(ID3D11Resource* pResource, UINT Subresource)
+{
+    if (m_absorbWork && BufferByteWidth(pResource))
+        return;
+
+    m_inner->Unmap(pResource, Subresource);
+}
+
+void RecordingDeviceContext::CopySubresourceRegion(ID3D11Resource* pDstResource, UINT DstSubresource, UINT DstX, UINT DstY, UINT DstZ, ID3D11Resource* pSrcResource, UINT SrcSubresource, const D3D11_BOX* pSrcBox)
+{
+    ++m_frame.copies;
+    if (!m_absorbWork)
+        m_inner->CopySubresourceRegion(pDstResource, DstSubresource, DstX, DstY, DstZ, pSrcResource, SrcSubresource, pSrcBox);
+}
+
+void RecordingDeviceContext::CopySubresourceRegion1(ID3D11Resource* pDstResource, UINT DstSubresource, UINT DstX, UINT DstY, UINT DstZ, ID3D11Resource* pSrcResource, UINT SrcSubresource, const D3D11_BOX* pSrcBox, UINT CopyFlags)
+{
+    ++m_frame.copies;
+    if (!m_absorbWork)
+        m_inner->CopySubresourceRegion1(pDstResource, DstSubresource, DstX, DstY, DstZ, pSrcResource, SrcSubresource, pSrcBox, CopyFlags);
+}
+
+void RecordingDeviceContext::CopyResource(ID3D11Resource* pDstResource, ID3D11Resource* pSrcResource)
+{
+    ++m_frame.copies;
+    if (!m_absorbWork)
+        m_inner->CopyResource(pDstResource, pSrcResource);
+}
+
+void RecordingDeviceContext::CopyStructureCount(ID3D11Buffer* pDstBuffer, UINT DstAlignedByteOffset, ID3D11UnorderedAccessView* pSrcView)
+{
+    ++m_frame.copies;
+    if (!m_absorbWork)
+        m_inner->CopyStructureCount(pDstBuffer, DstAlignedByteOffset, pSrcView);
+}
+
+void RecordingDeviceContext::UpdateSubresource(ID3D11Resource* pDstResource, UINT DstSubresource, const D3D11_BOX* pDstBox, const void* pSrcData, UINT SrcRowPitch, UINT SrcDepthPitch)
+{
+    RecordUpload(pDstResource, DstSubresource, pDstBox, SrcRowPitch, SrcDepthPitch);
+    if (!m_absorbWork)
+        m_inner->UpdateSubresource(pDstResource, DstSubresource, pDstBox, pSrcData, SrcRowPitch, SrcDepthPitch);
+}
+
+void RecordingDeviceContext::UpdateSubresource1(ID3D11Resource* pDstResource, UINT DstSubresource, const D3D11_BOX* pDstBox, const void* pSrcData, UINT SrcRowPitch, UINT SrcDepthPitch, UINT CopyFlags)
+{
+    RecordUpload(pDstResource, DstSubresource, pDstBox, SrcRowPitch, SrcDepthPitch);
+    if (!m_absorbWork)
+        m_inner->UpdateSubresource1(pDstResource, DstSubresource, pDstBox, pSrcData, SrcRowPitch, SrcDepthPitch, CopyFlags);
+}
+
+void RecordingDeviceContext::ClearRenderTargetView(ID3D11RenderTargetView* pRenderTargetView, const FLOAT ColorRGBA[4])
+{
+    ++m_frame.clears;
+    if (!m_absorbWork)
+        m_inner->ClearRenderTargetView(pRenderTargetView, ColorRGBA);
+}
+
+void RecordingDeviceContext::ClearUnorderedAccessViewUint(ID3D11UnorderedAccessView* pUnorderedAccessView, const UINT Values[4])
+{
+    ++m_frame.clears;
+    if (!m_absorbWork)
+        m_inner->ClearUnorderedAccessViewUint(pUnorderedAccessView, Values);
+}
+
+void RecordingDeviceContext::ClearUnorderedAccessViewFloat(ID3D11UnorderedAccessView* pUnorderedAccessView, const FLOAT Values[4])
+{
+    ++m_frame.clears;
+    if (!m_absorbWork)
+        m_inner->ClearUnorderedAccessViewFloat(pUnorderedAccessView, Values);
+}
+
+void RecordingDeviceContext::ClearDepthStencilView(ID3D11DepthStencilView* pDepthStencilView, UINT ClearFlags, FLOAT Depth, UINT8 Stencil)
+{
+    ++m_frame.clears;
+    if (!m_absorbWork)
+        m_inner->ClearDepthStencilView(pDepthStencilView, ClearFlags, Depth, Stencil);
+}
+
+void RecordingDeviceContext::ClearView(ID3D11View* pView, const FLOAT Color[4], const D3D11_RECT* pRect, UINT NumRects)
+{
+    ++m_frame.clears;
+    if (!m_absorbWork)
+        m_inner->ClearView(pView, Color, pRect, NumRects);
+}
+
+void RecordingDeviceContext::GenerateMips(ID3D11ShaderResourceView* pShaderResourceView)
+{
+    ++m_frame.dispatchCalls;
+    if (!m_absorbWork)
+        m_inner->GenerateMips(pShaderResourceView);
+}
+
+void RecordingDeviceContext::ResolveSubresource(ID3D11Resource* pDstResource, UINT DstSubresource, ID3D11Resource* pSrcResource, UINT SrcSubresource, DXGI_FORMAT Format)
+{
+    ++m_frame.copies;
+    if (!m_absorbWork)
+        m_inner->ResolveSubresource(pDstResource, DstSubresource, pSrcResource, SrcSubresource, Format);
+}
+
+void RecordingDeviceContext::ExecuteCommandList(ID3D11CommandList* pCommandList, BOOL RestoreContextState)
+{
+    ++m_frame.drawCalls;
+    if (!m_absorbWork)
+        m_inner->ExecuteCommandList(pCommandList, RestoreContextState);
+}
+#pragma endregion
@@ -0,0 +1,268 @@
+//
+// RecordingDeviceContext.h - A pass-through ID3D11DeviceContext1 that counts the work submitted to it
+//
+
+#pragma once
+
+#include <atomic>
+#include <string.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace DX
+{
+    // Counters gathered by RecordingDeviceContext, either for a single frame or accumulated.
+    struct RenderStats
+    {
+        uint64_t frames;
+        uint64_t drawCalls;
+        uint64_t instancedDrawCalls;
+        uint64_t indirectDrawCalls;
+        uint64_t dispatchCalls;
+        uint64_t primitivesSubmitted;   // vertex/index count per instance, summed over draws
+        uint64_t instancesSubmitted;
+        uint64_t stateSets;             // every IA/VS/PS/.../RS/OM binding call
+        uint64_t shaderSets;
+        uint64_t resourceSets;          // shader resource views, samplers and constant buffers
+        uint64_t clears;
+        uint64_t maps;
+        uint64_t copies;
+        uint64_t bytesMapped;
+        uint64_t bytesUploaded;         // UpdateSubresource + full-buffer Map payloads
+
+        RenderStats() noexcept { Reset(); }
+
+        void Reset() noexcept { memset(this, 0, sizeof(RenderStats)); }
+
+        RenderStats& operator+= (const RenderStats& other) noexcept
+        {
+            frames += other.frames;
+            drawCalls += other.drawCalls;
+            instancedDrawCalls += other.instancedDrawCalls;
+            indirectDrawCalls += other.indirectDrawCalls;
+            dispatchCalls += other.dispatchCalls;
+            primitivesSubmitted += other.primitivesSubmitted;
+            instancesSubmitted += other.instancesSubmitted;
+            stateSets += other.stateSets;
+            shaderSets += other.shaderSets;
+            resourceSets += other.resourceSets;
+            clears += other.clears;
+            maps += other.maps;
+            copies += other.copies;
+            bytesMapped += other.bytesMapped;
+            bytesUploaded += other.bytesUploaded;
+            return *this;
+        }
+    };
+
+    // Wraps the immediate context and forwards every call to it while recording counts.
+    // When 'absorbWork' is set the wrapper becomes a null backend: state is still forwarded
+    // (so Get* queries stay coherent) but draws, dispatches, clears, copies and uploads are
+    // swallowed, and Map on buffers is served from CPU scratch memory. That lets the whole
+    // frame run on the D3D null driver to measure CPU cost without a GPU.
+    class RecordingDeviceContext final : public ID3D11DeviceContext1
+    {
+    public:
+        RecordingDeviceContext(_In_ ID3D11DeviceContext1* inner, bool absorbWork) noexcept;
+
+        RecordingDeviceContext(RecordingDeviceContext const&) = delete;
+        RecordingDeviceContext& operator= (RecordingDeviceContext const&) = delete;
+
+        // Frame bookkeeping.
+        void EndFrame() noexcept;
+        void ResetStats() noexcept;
+
+        const RenderStats& GetFrameStats() const noexcept      { return m_lastFrame; }
+        const RenderStats& GetTotalStats() const noexcept      { return m_total; }
+        ID3D11DeviceContext1* GetInnerContext() const noexcept { return m_inner.Get(); }
+        bool IsAbsorbingWork() const noexcept                  { return m_absorbWork; }
+
+        // IUnknown
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, _COM_Outptr_ void** ppvObject) override;
+        ULONG STDMETHODCALLTYPE AddRef() override;
+        ULONG STDMETHODCALLTYPE Release() override;
+
+        // ID3D11DeviceChild
+        void STDMETHODCALLTYPE GetDevice(ID3D11Device** ppDevice) override                                      { m_inner->GetDevice(ppDevice); }
+        HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID guid, UINT* pDataSize, void* pData) override           { return m_inner->GetPrivateData(guid, pDataSize, pData); }
+        HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID guid, UINT DataSize, const void* pData) override       { return m_inner->SetPrivateData(guid, DataSize, pData); }
+        HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID guid, const IUnknown* pData) override         { return m_inner->SetPrivateDataInterface(guid, pData); }
+
+        // Work submission (recorded, absorbed in null mode).
+        void STDMETHODCALLTYPE Draw(UINT VertexCount, UINT StartVertexLocation) override;
+        void STDMETHODCALLTYPE DrawIndexed(UINT IndexCount, UINT StartIndexLocation, INT BaseVertexLocation) override;
+        void STDMETHODCALLTYPE DrawInstanced(UINT VertexCountPerInstance, UINT InstanceCount, UINT StartVertexLocation, UINT StartInstanceLocation) override;
+        void STDMETHODCALLTYPE DrawIndexedInstanced(UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation, INT BaseVertexLocation, UINT StartInstanceLocation) override;
+        void STDMETHODCALLTYPE DrawAuto() override;
+        void STDMETHODCALLTYPE DrawIndexedInstancedIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs) override;
+        void STDMETHODCALLTYPE DrawInstancedIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs) override;
+        void STDMETHODCALLTYPE Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ) override;
+        void STDMETHODCALLTYPE DispatchIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs) override;
+
+        HRESULT STDMETHODCALLTYPE Map(ID3D11Resource* pResource, UINT Subresource, D3D11_MAP MapType, UINT MapFlags, D3D11_MAPPED_SUBRESOURCE* pMappedResource) override;
+        void STDMETHODCALLTYPE Unmap(ID3D11Resource* pResource, UINT Subresource) override;
+
+        void STDMETHODCALLTYPE CopySubresourceRegion(ID3D11Resource* pDstResource, UINT DstSubresource, UINT DstX, UINT DstY, UINT DstZ, ID3D11Resource* pSrcResource, UINT SrcSubresource, const D3D11_BOX* pSrcBox) override;
+        void STDMETHODCALLTYPE CopyResource(ID3D11Resource* pDstResource, ID3D11Resource* pSrcResource) override;
+        void STDMETHODCALLTYPE UpdateSubresource(ID3D11Resource* pDstResource, UINT DstSubresource, const D3D11_BOX* pDstBox, const void* pSrcData, UINT SrcRowPitch, UINT SrcDepthPitch) override;
+        void STDMETHODCALLTYPE CopyStructureCount(ID3D11Buffer* pDstBuffer, UINT DstAlignedByteOffset, ID3D11UnorderedAccessView* pSrcView) override;
+        void STDMETHODCALLTYPE ClearRenderTargetView(ID3D11RenderTargetView* pRenderTargetView, const FLOAT ColorRGBA[4]) override;
+        void STDMETHODCALLTYPE ClearUnorderedAccessViewUint(ID3D11UnorderedAccessView* pUnorderedAccessView, const UINT Values[4]) override;
+        void STDMETHODCALLTYPE ClearUnorderedAccessViewFloat(ID3D11UnorderedAccessView* pUnorderedAccessView, const FLOAT Values[4]) override;
+        void STDMETHODCALLTYPE ClearDepthStencilView(ID3D11DepthStencilView* pDepthStencilView, UINT ClearFlags, FLOAT Depth, UINT8 Stencil) override;
+        void STDMETHODCALLTYPE GenerateMips(ID3D11ShaderResourceView* pShaderResourceView) override;
+        void STDMETHODCALLTYPE ResolveSubresource(ID3D11Resource* pDstResource, UINT DstSubresource, ID3D11Resource* pSrcResource, UINT SrcSubresource, DXGI_FORMAT Format) override;
+        void STDMETHODCALLTYPE ExecuteCommandList(ID3D11CommandList* pCommandList, BOOL RestoreContextState) override;
+
+        void STDMETHODCALLTYPE CopySubresourceRegion1(ID3D11Resource* pDstResource, UINT DstSubresource, UINT DstX, UINT DstY, UINT DstZ, ID3D11Resource* pSrcResource, UINT SrcSubresource, const D3D11_BOX* pSrcBox, UINT CopyFlags) override;
+        void STDMETHODCALLTYPE UpdateSubresource1(ID3D11Resource* pDstResource, UINT DstSubresource, const D3D11_BOX* pDstBox, const void* pSrcData, UINT SrcRowPitch, UINT SrcDepthPitch, UINT CopyFlags) override;
+        void STDMETHODCALLTYPE ClearView(ID3D11View* pView, const FLOAT Color[4], const D3D11_RECT* pRect, UINT NumRects) override;
+
+        // Pipeline state (recorded and always forwarded).
+        void STDMETHODCALLTYPE IASetInputLayout(ID3D11InputLayout* pInputLayout) override                                                                                           { ++m_frame.stateSets; m_inner->IASetInputLayout(pInputLayout); }
+        void STDMETHODCALLTYPE IASetVertexBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppVertexBuffers, const UINT* pStrides, const UINT* pOffsets) override     { ++m_frame.stateSets; m_inner->IASetVertexBuffers(StartSlot, NumBuffers, ppVertexBuffers, pStrides, pOffsets); }
+        void STDMETHODCALLTYPE IASetIndexBuffer(ID3D11Buffer* pIndexBuffer, DXGI_FORMAT Format, UINT Offset) override                                                               { ++m_frame.stateSets; m_inner->IASetIndexBuffer(pIndexBuffer, Format, Offset); }
+        void STDMETHODCALLTYPE IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY Topology) override                                                                                   { ++m_frame.stateSets; m_inner->IASetPrimitiveTopology(Topology); }
+
+        void STDMETHODCALLTYPE VSSetShader(ID3D11VertexShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override                             { RecordShader(); m_inner->VSSetShader(pShader, ppClassInstances, NumClassInstances); }
+        void STDMETHODCALLTYPE PSSetShader(ID3D11PixelShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override                              { RecordShader(); m_inner->PSSetShader(pShader, ppClassInstances, NumClassInstances); }
+        void STDMETHODCALLTYPE GSSetShader(ID3D11GeometryShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override                           { RecordShader(); m_inner->GSSetShader(pShader, ppClassInstances, NumClassInstances); }
+        void STDMETHODCALLTYPE HSSetShader(ID3D11HullShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override                               { RecordShader(); m_inner->HSSetShader(pShader, ppClassInstances, NumClassInstances); }
+        void STDMETHODCALLTYPE DSSetShader(ID3D11DomainShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override                             { RecordShader(); m_inner->DSSetShader(pShader, ppClassInstances, NumClassInstances); }
+        void STDMETHODCALLTYPE CSSetShader(ID3D11ComputeShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override                            { RecordShader(); m_inner->CSSetShader(pShader, ppClassInstances, NumClassInstances); }
+
+        void STDMETHODCALLTYPE VSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override                               { RecordResource(); m_inner->VSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE PSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override                               { RecordResource(); m_inner->PSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE GSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override                               { RecordResource(); m_inner->GSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE HSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override                               { RecordResource(); m_inner->HSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE DSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override                               { RecordResource(); m_inner->DSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE CSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override                               { RecordResource(); m_inner->CSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+
+        void STDMETHODCALLTYPE VSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                                    { RecordResource(); m_inner->VSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE PSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                                    { RecordResource(); m_inner->PSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE GSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                                    { RecordResource(); m_inner->GSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE HSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                                    { RecordResource(); m_inner->HSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE DSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                                    { RecordResource(); m_inner->DSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE CSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                                    { RecordResource(); m_inner->CSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+
+        void STDMETHODCALLTYPE VSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                                             { RecordResource(); m_inner->VSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE PSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                                             { RecordResource(); m_inner->PSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE GSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                                             { RecordResource(); m_inner->GSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE HSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                                             { RecordResource(); m_inner->HSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE DSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                                             { RecordResource(); m_inner->DSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE CSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                                             { RecordResource(); m_inner->CSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+
+        void STDMETHODCALLTYPE VSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { RecordResource(); m_inner->VSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE PSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { RecordResource(); m_inner->PSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE GSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { RecordResource(); m_inner->GSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE HSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { RecordResource(); m_inner->HSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE DSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { RecordResource(); m_inner->DSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE CSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { RecordResource(); m_inner->CSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+
+        void STDMETHODCALLTYPE CSSetUnorderedAccessViews(UINT StartSlot, UINT NumUAVs, ID3D11UnorderedAccessView* const* ppUnorderedAccessViews, const UINT* pUAVInitialCounts) override { RecordResource(); m_inner->CSSetUnorderedAccessViews(StartSlot, NumUAVs, ppUnorderedAccessViews, pUAVInitialCounts); }
+
+        void STDMETHODCALLTYPE RSSetState(ID3D11RasterizerState* pRasterizerState) override                                                                                        { ++m_frame.stateSets; m_inner->RSSetState(pRasterizerState); }
+        void STDMETHODCALLTYPE RSSetViewports(UINT NumViewports, const D3D11_VIEWPORT* pViewports) override                                                                        { ++m_frame.stateSets; m_inner->RSSetViewports(NumViewports, pViewports); }
+        void STDMETHODCALLTYPE RSSetScissorRects(UINT NumRects, const D3D11_RECT* pRects) override                                                                                 { ++m_frame.stateSets; m_inner->RSSetScissorRects(NumRects, pRects); }
+
+        void STDMETHODCALLTYPE OMSetRenderTargets(UINT NumViews, ID3D11RenderTargetView* const* ppRenderTargetViews, ID3D11DepthStencilView* pDepthStencilView) override          { ++m_frame.stateSets; m_inner->OMSetRenderTargets(NumViews, ppRenderTargetViews, pDepthStencilView); }
+        void STDMETHODCALLTYPE OMSetRenderTargetsAndUnorderedAccessViews(UINT NumRTVs, ID3D11RenderTargetView* const* ppRenderTargetViews, ID3D11DepthStencilView* pDepthStencilView, UINT UAVStartSlot, UINT NumUAVs, ID3D11UnorderedAccessView* const* ppUnorderedAccessViews, const UINT* pUAVInitialCounts) override
+        {
+            ++m_frame.stateSets;
+            m_inner->OMSetRenderTargetsAndUnorderedAccessViews(NumRTVs, ppRenderTargetViews, pDepthStencilView, UAVStartSlot, NumUAVs, ppUnorderedAccessViews, pUAVInitialCounts);
+        }
+        void STDMETHODCALLTYPE OMSetBlendState(ID3D11BlendState* pBlendState, const FLOAT BlendFactor[4], UINT SampleMask) override                                                { ++m_frame.stateSets; m_inner->OMSetBlendState(pBlendState, BlendFactor, SampleMask); }
+        void STDMETHODCALLTYPE OMSetDepthStencilState(ID3D11DepthStencilState* pDepthStencilState, UINT StencilRef) override                                                       { ++m_frame.stateSets; m_inner->OMSetDepthStencilState(pDepthStencilState, StencilRef); }
+        void STDMETHODCALLTYPE SOSetTargets(UINT NumBuffers, ID3D11Buffer* const* ppSOTargets, const UINT* pOffsets) override                                                      { ++m_frame.stateSets; m_inner->SOSetTargets(NumBuffers, ppSOTargets, pOffsets); }
+        void STDMETHODCALLTYPE SetPredication(ID3D11Predicate* pPredicate, BOOL PredicateValue) override                                                                           { ++m_frame.stateSets; m_inner->SetPredication(pPredicate, PredicateValue); }
+        void STDMETHODCALLTYPE SetResourceMinLOD(ID3D11Resource* pResource, FLOAT MinLOD) override                                                                                 { ++m_frame.stateSets; m_inner->SetResourceMinLOD(pResource, MinLOD); }
+
+        // Queries and getters (forwarded untouched).
+        void STDMETHODCALLTYPE Begin(ID3D11Asynchronous* pAsync) override                                                                      { m_inner->Begin(pAsync); }
+        void STDMETHODCALLTYPE End(ID3D11Asynchronous* pAsync) override                                                                        { m_inner->End(pAsync); }
+        HRESULT STDMETHODCALLTYPE GetData(ID3D11Asynchronous* pAsync, void* pData, UINT DataSize, UINT GetDataFlags) override                  { return m_inner->GetData(pAsync, pData, DataSize, GetDataFlags); }
+        FLOAT STDMETHODCALLTYPE GetResourceMinLOD(ID3D11Resource* pResource) override                                                          { return m_inner->GetResourceMinLOD(pResource); }
+
+        void STDMETHODCALLTYPE VSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->VSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE PSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->PSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE GSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->GSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE HSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->HSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE DSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->DSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE CSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->CSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+
+        void STDMETHODCALLTYPE VSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->VSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE PSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->PSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE GSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->GSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE HSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->HSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE DSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->DSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE CSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->CSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+
+        void STDMETHODCALLTYPE VSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->VSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE PSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->PSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE GSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->GSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE HSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->HSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE DSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->DSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE CSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->CSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+
+        void STDMETHODCALLTYPE VSGetShader(ID3D11VertexShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override    { m_inner->VSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+        void STDMETHODCALLTYPE PSGetShader(ID3D11PixelShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override     { m_inner->PSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+        void STDMETHODCALLTYPE GSGetShader(ID3D11GeometryShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override  { m_inner->GSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+        void STDMETHODCALLTYPE HSGetShader(ID3D11HullShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override      { m_inner->HSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+        void STDMETHODCALLTYPE DSGetShader(ID3D11DomainShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override    { m_inner->DSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+        void STDMETHODCALLTYPE CSGetShader(ID3D11ComputeShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override   { m_inner->CSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+
+        void STDMETHODCALLTYPE VSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->VSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE PSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->PSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE GSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->GSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE HSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->HSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE DSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->DSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE CSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->CSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+
+        void STDMETHODCALLTYPE IAGetInputLayout(ID3D11InputLayout** ppInputLayout) override                                                                { m_inner->IAGetInputLayout(ppInputLayout); }
+        void STDMETHODCALLTYPE IAGetVertexBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppVertexBuffers, UINT* pStrides, UINT* pOffsets) override { m_inner->IAGetVertexBuffers(StartSlot, NumBuffers, ppVertexBuffers, pStrides, pOffsets); }
+        void STDMETHODCALLTYPE IAGetIndexBuffer(ID3D11Buffer** pIndexBuffer, DXGI_FORMAT* Format, UINT* Offset) override                                   { m_inner->IAGetIndexBuffer(pIndexBuffer, Format, Offset); }
+        void STDMETHODCALLTYPE IAGetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY* pTopology) override                                                         { m_inner->IAGetPrimitiveTopology(pTopology); }
+        void STDMETHODCALLTYPE GetPredication(ID3D11Predicate** ppPredicate, BOOL* pPredicateValue) override                                                { m_inner->GetPredication(ppPredicate, pPredicateValue); }
+        void STDMETHODCALLTYPE OMGetRenderTargets(UINT NumViews, ID3D11RenderTargetView** ppRenderTargetViews, ID3D11DepthStencilView** ppDepthStencilView) override { m_inner->OMGetRenderTargets(NumViews, ppRenderTargetViews, ppDepthStencilView); }
+        void STDMETHODCALLTYPE OMGetRenderTargetsAndUnorderedAccessViews(UINT NumRTVs, ID3D11RenderTargetView** ppRenderTargetViews, ID3D11DepthStencilView** ppDepthStencilView, UINT UAVStartSlot, UINT NumUAVs, ID3D11UnorderedAccessView** ppUnorderedAccessViews) override
+        {
+            m_inner->OMGetRenderTargetsAndUnorderedAccessViews(NumRTVs, ppRenderTargetViews, ppDepthStencilView, UAVStartSlot, NumUAVs, ppUnorderedAccessViews);
+        }
+        void STDMETHODCALLTYPE OMGetBlendState(ID3D11BlendState** ppBlendState, FLOAT BlendFactor[4], UINT* pSampleMask) override                          { m_inner->OMGetBlendState(ppBlendState, BlendFactor, pSampleMask); }
+        void STDMETHODCALLTYPE OMGetDepthStencilState(ID3D11DepthStencilState** ppDepthStencilState, UINT* pStencilRef) override                            { m_inner->OMGetDepthStencilState(ppDepthStencilState, pStencilRef); }
+        void STDMETHODCALLTYPE SOGetTargets(UINT NumBuffers, ID3D11Buffer** ppSOTargets) override                                                           { m_inner->SOGetTargets(NumBuffers, ppSOTargets); }
+        void STDMETHODCALLTYPE RSGetState(ID3D11RasterizerState** ppRasterizerState) override                                                              { m_inner->RSGetState(ppRasterizerState); }
+        void STDMETHODCALLTYPE RSGetViewports(UINT* pNumViewports, D3D11_VIEWPORT* pViewports) override                                                    { m_inner->RSGetViewports(pNumViewports, pViewports); }
+        void STDMETHODCALLTYPE RSGetScissorRects(UINT* pNumRects, D3D11_RECT* pRects) override                                                             { m_inner->RSGetScissorRects(pNumRects, pRects); }
+        void STDMETHODCALLTYPE CSGetUnorderedAccessViews(UINT StartSlot, UINT NumUAVs, ID3D11UnorderedAccessView** ppUnorderedAccessViews) override        { m_inner->CSGetUnorderedAccessViews(StartSlot, NumUAVs, ppUnorderedAccessViews); }
+
+        // Context management.
+        void STDMETHODCALLTYPE ClearState() override                                                                                       { ++m_frame.stateSets; m_inner->ClearState(); }
+        void STDMETHODCALLTYPE Flush() override                                                                                            { m_inner->Flush(); }
+        D3D11_DEVICE_CONTEXT_TYPE STDMETHODCALLTYPE GetType() override                                                                     { return m_inner->GetType(); }
+        UINT STDMETHODCALLTYPE GetContextFlags() override                                                                                  { return m_inner->GetContextFlags(); }
+        HRESULT STDMETHODCALLTYPE FinishCommandList(BOOL RestoreDeferredContextState, ID3D11CommandList** ppCommandList) override           { return m_inner->FinishCommandList(RestoreDeferredContextState, ppCommandList); }
+        void STDMETHODCALLTYPE DiscardResource(ID3D11Resource* pResource) override                                                         { if (!m_absorbWork) m_inner->DiscardResource(pResource); }
+        void STDMETHODCALLTYPE DiscardView(ID3D11View* pResourceView) override                                                             { if (!m_absorbWork) m_inner->DiscardView(pResourceView); }
+        void STDMETHODCALLTYPE DiscardView1(ID3D11View* pResourceView, const D3D11_RECT* pRects, UINT NumRects) override                   { if (!m_absorbWork) m_inner->DiscardView1(pResourceView, pRects, NumRects); }
+        void STDMETHODCALLTYPE SwapDeviceContextState(ID3DDeviceContextState* pState, ID3DDeviceContextState** ppPreviousState) override   { ++m_frame.stateSets; m_inner->SwapDeviceContextState(pState, ppPreviousState); }
+
+    private:
+        void RecordShader() noexcept    { ++m_frame.stateSets; ++m_frame.shaderSets; }
+        void RecordResource() noexcept  { ++m_frame.stateSets; ++m_frame.resourceSets; }
+        void RecordDraw(uint64_t primitives, uint64_t instances) noexcept;
+        void RecordUpload(ID3D11Resource* resource, UINT subresource, const D3D11_BOX* box, UINT rowPitch, UINT depthPitch) noexcept;
+
+        std::atomic<ULONG>                                          m_refCount;
+        Microsoft::WRL::ComPtr<ID3D11DeviceContext1>                m_inner;
+        bool                                                        m_absorbWork;
+
+        RenderStats                                                 m_frame;
+        RenderStats                                                 m_lastFrame;
+        RenderStats                                                 m_total;
+
+        // CPU backing store for buffers mapped while absorbing work.
+        std::unordered_map<ID3D11Resource*, std::vector<uint8_t>>   m_scratch;
+    };
+}
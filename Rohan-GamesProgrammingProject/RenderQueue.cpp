@@ -0,0 +1,281 @@
+//
+// RenderQueue.cpp - Frame-wide, sort-key ordered submission of model mesh parts
+//
+
+#include "pch.h"
+#include "RenderQueue.h"
+
+using namespace DirectX;
+using namespace DX;
+
+namespace
+{
+    const unsigned c_DepthBits = 29;
+    const uint64_t c_DepthMask = (uint64_t(1) << c_DepthBits) - 1;
+
+    // Non-negative floats order the same as their bit patterns; dropping the sign bit and the
+    // lowest two mantissa bits leaves 29 bits.
+    uint64_t QuantizeDepth(float depth)
+    {
+        if (!(depth > 0.f))
+            return 0;
+
+        uint32_t bits;
+        memcpy(&bits, &depth, sizeof(bits));
+        return (bits >> 2) & c_DepthMask;
+    }
+
+    // LSD radix sort on 8-bit digits. Passes where every key has the same digit are skipped,
+    // which is most of them when only a few effects and buffers are in play.
+    template<typename T>
+    void RadixSort(std::vector<T>& entries, std::vector<T>& scratch)
+    {
+        const size_t count = entries.size();
+        if (count < 2)
+            return;
+
+        scratch.resize(count);
+
+        T* src = entries.data();
+        T* dst = scratch.data();
+
+        for (unsigned shift = 0; shift < 64; shift += 8)
+        {
+            size_t histogram[256] = {};
+            for (size_t i = 0; i < count; ++i)
+            {
+                ++histogram[(src[i].key >> shift) & 0xFF];
+            }
+
+            if (histogram[(src[0].key >> shift) & 0xFF] == count)
+                continue;
+
+            size_t offset = 0;
+            for (size_t& bucket : histogram)
+            {
+                size_t n = bucket;
+                bucket = offset;
+                offset += n;
+            }
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+            }
+
+            std::swap(src, dst);
+        }
+
+        if (src != entries.data())
+        {
+            entries.swap(scratch);
+        }
+    }
+}
+
+RenderQueue::RenderQueue() noexcept :
+    m_view{},
+    m_firstTransparent(0),
+    m_stats{}
+{
+}
+
+void XM_CALLCONV RenderQueue::Begin(FXMMATRIX view)
+{
+    XMStoreFloat4x4(&m_view, view);
+
+    m_items.clear();
+    m_worlds.clear();
+    m_entries.clear();
+    m_effectIds.clear();
+    m_geometryIds.clear();
+    m_firstTransparent = 0;
+    m_stats = {};
+}
+
+uint16_t RenderQueue::GetId(std::unordered_map<const void*, uint16_t>& ids, const void* object)
+{
+    auto it = ids.find(object);
+    if (it != ids.end())
+        return it->second;
+
+    auto id = uint16_t(std::min<size_t>(ids.size(), UINT16_MAX));
+    ids.emplace(object, id);
+    return id;
+}
+
+void XM_CALLCONV RenderQueue::Add(const ModelMesh& mesh, FXMMATRIX world, const ModelPartLod* lod,
+    const XMFLOAT4X4* positionTransform)
+{
+    auto worldIndex = uint32_t(m_worlds.size());
+    m_worlds.emplace_back();
+    XMStoreFloat4x4(&m_worlds.back(), positionTransform ? XMLoadFloat4x4(positionTransform) * world : world);
+
+    // Right-handed view space looks down -z
+    XMVECTOR center = XMVector3TransformCoord(XMLoadFloat3(&mesh.boundingSphere.Center), world);
+    float viewZ = XMVectorGetZ(XMVector3TransformCoord(center, XMLoadFloat4x4(&m_view)));
+    const uint64_t depth = QuantizeDepth(-viewZ);
+
+    const uint64_t raster = (mesh.ccw ? 1u : 0u) | (mesh.pmalpha ? 2u : 0u);
+
+    for (size_t i = 0; i < mesh.meshParts.size(); ++i)
+    {
+        const auto& part = mesh.meshParts[i];
+        if (lod && !lod[i].indexCount)
+            continue;
+
+        const uint64_t effect = GetId(m_effectIds, part->effect.get());
+        const uint64_t geometry = GetId(m_geometryIds, part->vertexBuffer.Get());
+
+        uint64_t key;
+        if (part->isAlpha)
+        {
+            key = (uint64_t(Pass_Transparent) << 63)
+                | ((c_DepthMask - depth) << 34)
+                | (raster << 32)
+                | (effect << 16)
+                | geometry;
+        }
+        else
+        {
+            key = (uint64_t(Pass_Opaque) << 63)
+                | (raster << 61)
+                | (effect << 45)
+                | (geometry << 29)
+                | depth;
+        }
+
+        auto itemIndex = uint32_t(m_items.size());
+        m_items.push_back({ &mesh, part.get(), lod ? &lod[i] : nullptr, dynamic_cast<IEffectMatrices*>(part->effect.get()), worldIndex });
+        m_entries.push_back({ key, itemIndex });
+    }
+}
+
+void RenderQueue::Sort()
+{
+    RadixSort(m_entries, m_scratch);
+
+    m_firstTransparent = m_entries.size();
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        if (m_entries[i].key >> 63)
+        {
+            m_firstTransparent = i;
+            break;
+        }
+    }
+
+    m_stats.items = m_entries.size();
+}
+
+void XM_CALLCONV RenderQueue::Draw(ID3D11DeviceContext* context, const CommonStates& states,
+    FXMMATRIX view, CXMMATRIX projection, Pass pass)
+{
+    const size_t first = (pass == Pass_Opaque) ? 0 : m_firstTransparent;
+    const size_t last = (pass == Pass_Opaque) ? m_firstTransparent : m_entries.size();
+    if (first == last)
+        return;
+
+    // Whatever was bound before the queue is unknown, so the first part binds everything
+    ID3D11BlendState* blendState = nullptr;
+    ID3D11DepthStencilState* depthState = nullptr;
+    ID3D11RasterizerState* rasterState = nullptr;
+    ID3D11InputLayout* inputLayout = nullptr;
+    ID3D11Buffer* vertexBuffer = nullptr;
+    ID3D11Buffer* indexBuffer = nullptr;
+    DXGI_FORMAT indexFormat = DXGI_FORMAT_UNKNOWN;
+    D3D_PRIMITIVE_TOPOLOGY topology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+    bool firstBind = true;
+
+    auto bind = [&](bool changed)
+    {
+        changed ? ++m_stats.stateSets : ++m_stats.redundantSkipped;
+        return changed;
+    };
+
+    ID3D11SamplerState* samplers[] = { states.LinearWrap(), states.LinearWrap() };
+    context->PSSetSamplers(0, 2, samplers);
+    ++m_stats.stateSets;
+
+    for (size_t i = first; i < last; ++i)
+    {
+        const Item& item = m_items[m_entries[i].item];
+        const ModelMesh& mesh = *item.mesh;
+        const ModelMeshPart& part = *item.part;
+
+        ID3D11BlendState* blend;
+        ID3D11DepthStencilState* depth;
+        if (pass == Pass_Transparent)
+        {
+            blend = mesh.pmalpha ? states.AlphaBlend() : states.NonPremultiplied();
+            depth = states.DepthRead();
+        }
+        else
+        {
+            blend = states.Opaque();
+            depth = states.DepthDefault();
+        }
+        ID3D11RasterizerState* raster = mesh.ccw ? states.CullCounterClockwise() : states.CullClockwise();
+
+        if (bind(firstBind || blend != blendState))
+        {
+            context->OMSetBlendState(blend, nullptr, 0xFFFFFFFF);
+            blendState = blend;
+        }
+
+        if (bind(firstBind || depth != depthState))
+        {
+            context->OMSetDepthStencilState(depth, 0);
+            depthState = depth;
+        }
+
+        if (bind(firstBind || raster != rasterState))
+        {
+            context->RSSetState(raster);
+            rasterState = raster;
+        }
+
+        if (bind(firstBind || part.inputLayout.Get() != inputLayout))
+        {
+            inputLayout = part.inputLayout.Get();
+            context->IASetInputLayout(inputLayout);
+        }
+
+        if (bind(firstBind || part.vertexBuffer.Get() != vertexBuffer))
+        {
+            vertexBuffer = part.vertexBuffer.Get();
+            UINT vbStride = part.vertexStride;
+            UINT vbOffset = 0;
+            context->IASetVertexBuffers(0, 1, &vertexBuffer, &vbStride, &vbOffset);
+        }
+
+        ID3D11Buffer* partIndexBuffer = item.lod ? item.lod->indexBuffer.Get() : part.indexBuffer.Get();
+        DXGI_FORMAT partIndexFormat = item.lod ? item.lod->indexFormat : part.indexFormat;
+        if (bind(firstBind || partIndexBuffer != indexBuffer || partIndexFormat != indexFormat))
+        {
+            indexBuffer = partIndexBuffer;
+            indexFormat = partIndexFormat;
+            context->IASetIndexBuffer(indexBuffer, indexFormat, 0);
+        }
+
+        if (bind(firstBind || part.primitiveType != topology))
+        {
+            topology = part.primitiveType;
+            context->IASetPrimitiveTopology(topology);
+        }
+
+        firstBind = false;
+
+        // Effects carry the world matrix, so they are applied for every part
+        if (item.matrices)
+        {
+            item.matrices->SetMatrices(XMLoadFloat4x4(&m_worlds[item.world]), view, projection);
+        }
+        part.effect->Apply(context);
+
+        const uint32_t indexCount = item.lod ? item.lod->indexCount : part.indexCount;
+        context->DrawIndexed(indexCount, item.lod ? item.lod->startIndex : part.startIndex, part.vertexOffset);
+        m_stats.triangles += indexCount / 3;
+        ++m_stats.draws;
+    }
+}
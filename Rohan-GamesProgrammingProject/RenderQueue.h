@@ -0,0 +1,98 @@
+//
+// RenderQueue.h - Frame-wide, sort-key ordered submission of model mesh parts
+//
+
+#pragma once
+
+#include "ModelUpload.h"
+
+#include <CommonStates.h>
+#include <Model.h>
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace DX
+{
+    // Every mesh part drawn in a frame is queued with a 64-bit key, the queue is radix sorted
+    // once, and Draw walks it binding only the state that differs from the previous part.
+    //
+    // Key layout, most significant bits first:
+    //   opaque:       pass(1) | raster(2) | effect(16) | geometry(16) | depth(29)     front to back
+    //   transparent:  pass(1) | ~depth(29) | raster(2) | effect(16) | geometry(16)   back to front
+    //
+    // Effects and geometry (vertex buffers) are numbered in the order first seen each frame.
+    class RenderQueue
+    {
+    public:
+        enum Pass : uint32_t
+        {
+            Pass_Opaque = 0,
+            Pass_Transparent = 1,
+        };
+
+        struct Statistics
+        {
+            size_t  items;
+            size_t  draws;
+            size_t  stateSets;          // pipeline and input-assembler bindings actually made
+            size_t  redundantSkipped;   // bindings skipped because the same object was bound
+            size_t  triangles;
+        };
+
+        RenderQueue() noexcept;
+
+        RenderQueue(RenderQueue const&) = delete;
+        RenderQueue& operator= (RenderQueue const&) = delete;
+
+        // Starts a frame; the view matrix is used for depth keys.
+        void XM_CALLCONV Begin(DirectX::FXMMATRIX view);
+
+        // Queues every part of a mesh at a world transform. Given a level of detail's parts (one
+        // per mesh part, ModelMeshLods::GetParts, or the ranges a ClusterCuller left), each part
+        // draws those indices, and a part left none is not queued. A mesh with packed positions
+        // passes its asset's positionTransform, which goes before 'world'.
+        void XM_CALLCONV Add(const DirectX::ModelMesh& mesh, DirectX::FXMMATRIX world, _In_opt_ const ModelPartLod* lod = nullptr,
+            _In_opt_ const DirectX::XMFLOAT4X4* positionTransform = nullptr);
+
+        void Sort();
+
+        // Draws the queued parts of one pass, in key order.
+        void XM_CALLCONV Draw(_In_ ID3D11DeviceContext* context, const DirectX::CommonStates& states,
+            DirectX::FXMMATRIX view, DirectX::CXMMATRIX projection, Pass pass);
+
+        const Statistics& GetStatistics() const { return m_stats; }
+
+    private:
+        struct Item
+        {
+            const DirectX::ModelMesh*       mesh;
+            const DirectX::ModelMeshPart*   part;
+            const ModelPartLod*             lod;
+            DirectX::IEffectMatrices*       matrices;
+            uint32_t                        world;
+        };
+
+        struct SortEntry
+        {
+            uint64_t    key;
+            uint32_t    item;
+        };
+
+        uint16_t GetId(std::unordered_map<const void*, uint16_t>& ids, const void* object);
+
+        DirectX::XMFLOAT4X4                         m_view;
+
+        std::vector<Item>                           m_items;
+        std::vector<DirectX::XMFLOAT4X4>            m_worlds;
+        std::vector<SortEntry>                      m_entries;
+        std::vector<SortEntry>                      m_scratch;
+        size_t                                      m_firstTransparent;
+
+        std::unordered_map<const void*, uint16_t>   m_effectIds;
+        std::unordered_map<const void*, uint16_t>   m_geometryIds;
+
+        Statistics                                  m_stats;
+    };
+}
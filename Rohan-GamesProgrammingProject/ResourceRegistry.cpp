@@ -0,0 +1,310 @@
+//
+// ResourceRegistry.cpp - Interned content paths, and the textures and effects loaded for them
+//
+
+#include "pch.h"
+#include "ResourceRegistry.h"
+
+#include <mutex>
+
+using namespace DirectX;
+using namespace DX;
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+    const size_t c_InitialSlots = 64;
+
+    enum EffectKind : uint32_t
+    {
+        EffectKind_Basic,
+        EffectKind_Skinned,
+        EffectKind_DualTexture,
+        EffectKind_NormalMap,
+    };
+
+    // FNV-1a, 64-bit, over the UTF-16 code units
+    uint64_t HashString(const wchar_t* text, size_t length)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < length; ++i)
+        {
+            hash ^= uint16_t(text[i]);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // Spreads keys that differ only in their low bits, such as consecutive ids, over the table
+    size_t MixKey(uint64_t key)
+    {
+        key ^= key >> 33;
+        key *= 0xFF51AFD7ED558CCDull;
+        key ^= key >> 33;
+        return size_t(key);
+    }
+
+    std::wstring NormalisePath(const wchar_t* path)
+    {
+        std::wstring result;
+        for (const wchar_t* c = path; *c; ++c)
+        {
+            wchar_t ch = (*c == L'\\') ? L'/' : *c;
+            if (ch >= L'A' && ch <= L'Z')
+            {
+                ch = wchar_t(ch - L'A' + L'a');
+            }
+            if (ch == L'/' && !result.empty() && result.back() == L'/')
+                continue;
+
+            result.push_back(ch);
+        }
+
+        while (result.compare(0, 2, L"./") == 0)
+        {
+            result.erase(0, 2);
+        }
+        return result;
+    }
+}
+
+template<typename Value>
+template<typename Match>
+const Value* ResourceRegistry::Table<Value>::Find(uint64_t key, Match const& match) const
+{
+    if (m_slots.empty())
+        return nullptr;
+
+    const size_t mask = m_slots.size() - 1;
+    for (size_t i = MixKey(key) & mask;; i = (i + 1) & mask)
+    {
+        auto const& slot = m_slots[i];
+        if (!slot.used)
+            return nullptr;
+
+        if (slot.key == key && match(slot.value))
+            return &slot.value;
+    }
+}
+
+template<typename Value>
+void ResourceRegistry::Table<Value>::Insert(uint64_t key, Value value)
+{
+    if ((m_count + 1) * 2 > m_slots.size())
+    {
+        Grow();
+    }
+
+    const size_t mask = m_slots.size() - 1;
+    size_t i = MixKey(key) & mask;
+    while (m_slots[i].used)
+    {
+        i = (i + 1) & mask;
+    }
+
+    m_slots[i].key = key;
+    m_slots[i].value = std::move(value);
+    m_slots[i].used = true;
+    ++m_count;
+}
+
+template<typename Value>
+void ResourceRegistry::Table<Value>::Grow()
+{
+    std::vector<Slot> slots(std::max(m_slots.size() * 2, c_InitialSlots));
+    slots.swap(m_slots);
+
+    const size_t mask = m_slots.size() - 1;
+    for (auto& slot : slots)
+    {
+        if (!slot.used)
+            continue;
+
+        size_t i = MixKey(slot.key) & mask;
+        while (m_slots[i].used)
+        {
+            i = (i + 1) & mask;
+        }
+        m_slots[i] = std::move(slot);
+    }
+}
+
+template<typename Value>
+void ResourceRegistry::Table<Value>::Clear()
+{
+    m_slots.clear();
+    m_count = 0;
+}
+
+ResourceRegistry::ResourceRegistry() :
+    m_textureHits(0),
+    m_effectHits(0)
+{
+}
+
+ResourceRegistry::PathId ResourceRegistry::Intern(const wchar_t* path)
+{
+    auto normalised = NormalisePath(path);
+    const uint64_t hash = HashString(normalised.c_str(), normalised.size());
+    auto sameName = [&](PathId id) { return m_paths[id] == normalised; };
+
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+        if (auto id = m_pathIds.Find(hash, sameName))
+            return *id;
+    }
+
+    std::unique_lock<std::shared_timed_mutex> lock(m_mutex);
+
+    // Another thread may have added it meanwhile
+    if (auto id = m_pathIds.Find(hash, sameName))
+        return *id;
+
+    const PathId id = PathId(m_paths.size());
+    m_paths.push_back(std::move(normalised));
+    m_pathIds.Insert(hash, id);
+    return id;
+}
+
+ResourceRegistry::PathId ResourceRegistry::Find(const wchar_t* path) const
+{
+    auto normalised = NormalisePath(path);
+    const uint64_t hash = HashString(normalised.c_str(), normalised.size());
+
+    std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+    auto id = m_pathIds.Find(hash, [&](PathId candidate) { return m_paths[candidate] == normalised; });
+    return id ? *id : c_NoPath;
+}
+
+const std::wstring& ResourceRegistry::GetPath(PathId id) const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+    if (id >= m_paths.size())
+        throw std::out_of_range("ResourceRegistry::GetPath");
+
+    return m_paths[id];
+}
+
+ComPtr<ID3D11ShaderResourceView> ResourceRegistry::FindTexture(PathId id) const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+    auto texture = m_textures.Find(id, [](ComPtr<ID3D11ShaderResourceView> const&) { return true; });
+    if (!texture)
+        return nullptr;
+
+    ++m_textureHits;
+    return *texture;
+}
+
+ComPtr<ID3D11ShaderResourceView> ResourceRegistry::AddTexture(PathId id, ID3D11ShaderResourceView* view)
+{
+    std::unique_lock<std::shared_timed_mutex> lock(m_mutex);
+    if (auto texture = m_textures.Find(id, [](ComPtr<ID3D11ShaderResourceView> const&) { return true; }))
+        return *texture;
+
+    m_textures.Insert(id, view);
+    return view;
+}
+
+// As DirectXTK's EffectFactory picks the effect, and so its cache
+uint32_t ResourceRegistry::GetEffectKind(IEffectFactory::EffectInfo const& info)
+{
+    if (info.enableSkinning)
+        return EffectKind_Skinned;
+    if (info.enableDualTexture)
+        return EffectKind_DualTexture;
+    if (info.enableNormalMaps)
+        return EffectKind_NormalMap;
+    return EffectKind_Basic;
+}
+
+uint64_t ResourceRegistry::GetEffectKey(const wchar_t* name, uint32_t kind)
+{
+    return HashString(name, wcslen(name)) ^ (uint64_t(kind) << 60);
+}
+
+std::shared_ptr<IEffect> ResourceRegistry::FindEffect(IEffectFactory::EffectInfo const& info) const
+{
+    if (!info.name || !*info.name)
+        return nullptr;
+
+    const uint32_t kind = GetEffectKind(info);
+    auto sameEffect = [&](SharedEffect const& shared) { return shared.kind == kind && shared.name == info.name; };
+
+    std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+    auto shared = m_effects.Find(GetEffectKey(info.name, kind), sameEffect);
+    if (!shared)
+        return nullptr;
+
+    ++m_effectHits;
+    return shared->effect;
+}
+
+std::shared_ptr<IEffect> ResourceRegistry::AddEffect(IEffectFactory::EffectInfo const& info, std::shared_ptr<IEffect> const& effect)
+{
+    if (!info.name || !*info.name)
+        return effect;
+
+    const uint32_t kind = GetEffectKind(info);
+    const uint64_t key = GetEffectKey(info.name, kind);
+    auto sameEffect = [&](SharedEffect const& shared) { return shared.kind == kind && shared.name == info.name; };
+
+    std::unique_lock<std::shared_timed_mutex> lock(m_mutex);
+    if (auto shared = m_effects.Find(key, sameEffect))
+        return shared->effect;
+
+    m_effects.Insert(key, SharedEffect{ info.name, kind, effect });
+    return effect;
+}
+
+void ResourceRegistry::Clear()
+{
+    std::unique_lock<std::shared_timed_mutex> lock(m_mutex);
+    m_textures.Clear();
+    m_effects.Clear();
+}
+
+ResourceRegistry::Statistics ResourceRegistry::GetStatistics() const
+{
+    std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+
+    Statistics stats;
+    stats.paths = m_paths.size();
+    stats.textures = m_textures.GetCount();
+    stats.effects = m_effects.GetCount();
+    stats.textureHits = m_textureHits;
+    stats.effectHits = m_effectHits;
+    return stats;
+}
+
+ResourceRegistry::EffectFactory::EffectFactory(ID3D11Device* device, ResourceRegistry& registry) :
+    DirectX::EffectFactory(device),
+    m_registry(registry)
+{
+    // The registry shares them instead
+    SetSharing(false);
+}
+
+std::shared_ptr<IEffect> ResourceRegistry::EffectFactory::CreateEffect(const EffectInfo& info, ID3D11DeviceContext* deviceContext)
+{
+    if (auto effect = m_registry.FindEffect(info))
+        return effect;
+
+    return m_registry.AddEffect(info, DirectX::EffectFactory::CreateEffect(info, deviceContext));
+}
+
+void ResourceRegistry::EffectFactory::CreateTexture(const wchar_t* name, ID3D11DeviceContext* deviceContext, ID3D11ShaderResourceView** textureView)
+{
+    if (!name || !textureView)
+        throw std::exception("invalid arguments");
+
+    const PathId id = m_registry.Intern(name);
+    auto view = m_registry.FindTexture(id);
+    if (!view)
+    {
+        DirectX::EffectFactory::CreateTexture(name, deviceContext, view.GetAddressOf());
+        view = m_registry.AddTexture(id, view.Get());
+    }
+    *textureView = view.Detach();
+}
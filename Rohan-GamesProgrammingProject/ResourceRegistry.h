@@ -0,0 +1,138 @@
+//
+// ResourceRegistry.h - Interned content paths, and the textures and effects loaded for them
+//
+
+#pragma once
+
+#include <Effects.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+namespace DX
+{
+    // One registry is shared by everything that loads textures or creates effects, so a file
+    // loaded by one (the texture streamer, the asset streamer) is found by the others instead
+    // of being loaded again, and every effect factory shares one effect cache.
+    //
+    // Content paths are interned once into small integer ids; texture lookups after that hash
+    // an integer rather than compare strings. Paths are normalised first, as the asset pack does
+    // (lower-case ASCII, '/' separators, no leading "./"), so differently spelt names of a file
+    // get the same id.
+    //
+    // All three tables use open addressing with linear probing at most half full, and are read
+    // under a shared lock, so loaders on any thread resolve paths, textures and effects
+    // concurrently; only adding an entry takes the lock exclusively.
+    class ResourceRegistry
+    {
+    public:
+        using PathId = uint32_t;
+        static const PathId c_NoPath = UINT32_MAX;
+
+        struct Statistics
+        {
+            size_t  paths;
+            size_t  textures;
+            size_t  effects;
+            size_t  textureHits;    // textures a loader found here instead of loading
+            size_t  effectHits;
+        };
+
+        ResourceRegistry();
+
+        ResourceRegistry(ResourceRegistry const&) = delete;
+        ResourceRegistry& operator= (ResourceRegistry const&) = delete;
+
+        // Any thread. The id of the normalised path, added if it is new.
+        PathId Intern(_In_z_ const wchar_t* path);
+
+        // Any thread. c_NoPath for a path never interned.
+        PathId Find(_In_z_ const wchar_t* path) const;
+
+        // The normalised path; the reference stays valid for the registry's lifetime.
+        const std::wstring& GetPath(PathId id) const;
+
+        // Any thread. A texture loaded whole for the path, or null. Textures whose view changes,
+        // such as those streaming mips, are not registered.
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> FindTexture(PathId id) const;
+
+        // Any thread. The first view registered for a path wins and is returned.
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> AddTexture(PathId id, _In_ ID3D11ShaderResourceView* view);
+
+        // Effects are shared by material name and kind, as DirectXTK's EffectFactory shares them;
+        // unnamed materials are never shared.
+        std::shared_ptr<DirectX::IEffect> FindEffect(DirectX::IEffectFactory::EffectInfo const& info) const;
+        std::shared_ptr<DirectX::IEffect> AddEffect(DirectX::IEffectFactory::EffectInfo const& info,
+            std::shared_ptr<DirectX::IEffect> const& effect);
+
+        // Drops every texture and effect; ids stay valid.
+        void Clear();
+
+        Statistics GetStatistics() const;
+
+        // An EffectFactory whose shared effects live in a registry rather than in the factory,
+        // so any number of factories share them. Textures it creates itself are registered too.
+        class EffectFactory : public DirectX::EffectFactory
+        {
+        public:
+            EffectFactory(_In_ ID3D11Device* device, ResourceRegistry& registry);
+
+            std::shared_ptr<DirectX::IEffect> __cdecl CreateEffect(_In_ const EffectInfo& info,
+                _In_opt_ ID3D11DeviceContext* deviceContext) override;
+            void __cdecl CreateTexture(_In_z_ const wchar_t* name, _In_opt_ ID3D11DeviceContext* deviceContext,
+                _Outptr_ ID3D11ShaderResourceView** textureView) override;
+
+        protected:
+            ResourceRegistry& m_registry;
+        };
+
+    private:
+        // Open addressing on a 64-bit key; the caller's match resolves keys that collide.
+        template<typename Value>
+        class Table
+        {
+        public:
+            template<typename Match>
+            const Value* Find(uint64_t key, Match const& match) const;
+            void Insert(uint64_t key, Value value);
+            size_t GetCount() const { return m_count; }
+            void Clear();
+
+        private:
+            struct Slot
+            {
+                uint64_t    key = 0;
+                Value       value = {};
+                bool        used = false;
+            };
+
+            void Grow();
+
+            std::vector<Slot>   m_slots;
+            size_t              m_count = 0;
+        };
+
+        struct SharedEffect
+        {
+            std::wstring                        name;
+            uint32_t                            kind;
+            std::shared_ptr<DirectX::IEffect>   effect;
+        };
+
+        static uint32_t GetEffectKind(DirectX::IEffectFactory::EffectInfo const& info);
+        static uint64_t GetEffectKey(const wchar_t* name, uint32_t kind);
+
+        mutable std::shared_timed_mutex                                 m_mutex;
+        std::deque<std::wstring>                                        m_paths;    // by id
+        Table<PathId>                                                   m_pathIds;  // by hash of the path
+        Table<Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>>         m_textures; // by id
+        Table<SharedEffect>                                             m_effects;  // by hash of the name and kind
+
+        mutable std::atomic<size_t>                                     m_textureHits;
+        mutable std::atomic<size_t>                                     m_effectHits;
+    };
+}
@@ -0,0 +1,202 @@
+//
+// SDKMeshFormat.h - On-disk structures of the DXUT SDKMESH model format
+//
+
+#pragma once
+
+#include "ModelData.h"
+
+#include <stdint.h>
+
+// Shared by ModelData's parser and the offline mesh cooker, which writes the format.
+namespace SDKMESH
+{
+    // File layout from DXUT; the pointer unions of the original are always 64-bit offsets on disk.
+    enum DeclUsage : uint8_t
+    {
+        DeclUsage_Position = 0,
+        DeclUsage_BlendWeight = 1,
+        DeclUsage_BlendIndices = 2,
+        DeclUsage_Normal = 3,
+        DeclUsage_TexCoord = 5,
+        DeclUsage_Tangent = 6,
+        DeclUsage_Binormal = 7,
+        DeclUsage_Color = 10,
+    };
+
+    enum DeclType : uint8_t
+    {
+        DeclType_Float1 = 0,
+        DeclType_Float2 = 1,
+        DeclType_Float3 = 2,
+        DeclType_Float4 = 3,
+        DeclType_D3DColor = 4,
+        DeclType_UByte4 = 5,
+        DeclType_UByte4N = 8,
+        DeclType_Short4N = 10,
+        DeclType_Dec3N = 14,
+        DeclType_Float16_2 = 15,
+        DeclType_Float16_4 = 16,
+        DeclType_Unused = 17,
+        DeclType_R10G10B10A2_UNorm = 32 + DX::ModelData::Format_R10G10B10A2_UNorm,
+        DeclType_R11G11B10_Float = 32 + DX::ModelData::Format_R11G11B10_Float,
+        DeclType_R8G8B8A8_SNorm = 32 + DX::ModelData::Format_R8G8B8A8_SNorm,
+    };
+
+    const uint32_t c_FileVersion = 101;
+    const uint32_t c_FileVersionV2 = 200;
+    const uint32_t c_MaxVertexElements = 32;
+    const uint32_t c_MaxVertexStreams = 16;
+    const uint32_t c_MaxName = 100;
+    const uint32_t c_MaxPath = 260;
+
+    enum PrimitiveType : uint32_t
+    {
+        PT_TriangleList = 0,
+        PT_TriangleStrip,
+        PT_LineList,
+        PT_LineStrip,
+        PT_PointList,
+        PT_TriangleListAdj,
+        PT_TriangleStripAdj,
+        PT_LineListAdj,
+        PT_LineStripAdj,
+        PT_QuadPatchList,
+        PT_TrianglePatchList,
+    };
+
+    const uint32_t c_Index32 = 1;
+
+#pragma pack(push, 4)
+    struct DeclElement
+    {
+        uint16_t    stream;
+        uint16_t    offset;
+        uint8_t     type;
+        uint8_t     method;
+        uint8_t     usage;
+        uint8_t     usageIndex;
+    };
+#pragma pack(pop)
+
+#pragma pack(push, 8)
+    struct Header
+    {
+        uint32_t    version;
+        uint8_t     isBigEndian;
+        uint64_t    headerSize;
+        uint64_t    nonBufferDataSize;
+        uint64_t    bufferDataSize;
+
+        uint32_t    numVertexBuffers;
+        uint32_t    numIndexBuffers;
+        uint32_t    numMeshes;
+        uint32_t    numTotalSubsets;
+        uint32_t    numFrames;
+        uint32_t    numMaterials;
+
+        uint64_t    vertexStreamHeadersOffset;
+        uint64_t    indexStreamHeadersOffset;
+        uint64_t    meshDataOffset;
+        uint64_t    subsetDataOffset;
+        uint64_t    frameDataOffset;
+        uint64_t    materialDataOffset;
+    };
+
+    struct VertexBufferHeader
+    {
+        uint64_t        numVertices;
+        uint64_t        sizeBytes;
+        uint64_t        strideBytes;
+        DeclElement     decl[c_MaxVertexElements];
+        uint64_t        dataOffset;
+    };
+
+    struct IndexBufferHeader
+    {
+        uint64_t    numIndices;
+        uint64_t    sizeBytes;
+        uint32_t    indexType;
+        uint64_t    dataOffset;
+    };
+
+    struct MeshHeader
+    {
+        char        name[c_MaxName];
+        uint8_t     numVertexBuffers;
+        uint32_t    vertexBuffers[c_MaxVertexStreams];
+        uint32_t    indexBuffer;
+        uint32_t    numSubsets;
+        uint32_t    numFrameInfluences;
+
+        float       boundingBoxCenter[3];
+        float       boundingBoxExtents[3];
+
+        uint64_t    subsetOffset;
+        uint64_t    frameInfluenceOffset;
+    };
+
+    struct SubsetHeader
+    {
+        char        name[c_MaxName];
+        uint32_t    materialID;
+        uint32_t    primitiveType;
+        uint64_t    indexStart;
+        uint64_t    indexCount;
+        uint64_t    vertexStart;
+        uint64_t    vertexCount;
+    };
+
+    struct FrameHeader
+    {
+        char        name[c_MaxName];
+        uint32_t    mesh;
+        uint32_t    parentFrame;
+        uint32_t    childFrame;
+        uint32_t    siblingFrame;
+        float       matrix[16];
+        uint32_t    animationDataIndex;
+    };
+
+    struct MaterialHeader
+    {
+        char        name[c_MaxName];
+        char        materialInstancePath[c_MaxPath];
+        char        diffuseTexture[c_MaxPath];
+        char        normalTexture[c_MaxPath];
+        char        specularTexture[c_MaxPath];
+
+        float       diffuse[4];
+        float       ambient[4];
+        float       specular[4];
+        float       emissive[4];
+        float       power;
+
+        uint64_t    force64[6];
+    };
+
+    struct MaterialHeaderV2
+    {
+        char        name[c_MaxName];
+        char        rmaTexture[c_MaxPath];
+        char        albedoTexture[c_MaxPath];
+        char        normalTexture[c_MaxPath];
+        char        emissiveTexture[c_MaxPath];
+
+        float       alpha;
+        char        reserved[60];
+
+        uint64_t    force64[6];
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(DeclElement) == 8, "SDKMESH structure size incorrect");
+    static_assert(sizeof(Header) == 104, "SDKMESH structure size incorrect");
+    static_assert(sizeof(VertexBufferHeader) == 288, "SDKMESH structure size incorrect");
+    static_assert(sizeof(IndexBufferHeader) == 32, "SDKMESH structure size incorrect");
+    static_assert(sizeof(MeshHeader) == 224, "SDKMESH structure size incorrect");
+    static_assert(sizeof(SubsetHeader) == 144, "SDKMESH structure size incorrect");
+    static_assert(sizeof(FrameHeader) == 184, "SDKMESH structure size incorrect");
+    static_assert(sizeof(MaterialHeader) == 1256, "SDKMESH structure size incorrect");
+    static_assert(sizeof(MaterialHeaderV2) == sizeof(MaterialHeader), "SDKMESH structure size incorrect");
+}
@@ -0,0 +1,315 @@
+//
+// SceneGraph.cpp - A data-driven transform hierarchy stored as structure-of-arrays
+//
+
+#include "pch.h"
+#include "SceneGraph.h"
+
+#include <fstream>
+#include <sstream>
+
+using namespace DirectX;
+using namespace DX;
+
+namespace
+{
+    uint32_t FindName(const std::vector<std::string>& names, const std::string& name)
+    {
+        auto it = std::find(names.cbegin(), names.cend(), name);
+        return (it != names.cend()) ? uint32_t(it - names.cbegin()) : SceneGraph::c_None;
+    }
+
+    [[noreturn]] void ThrowParseError(unsigned lineNumber, const std::string& message)
+    {
+        throw std::runtime_error("SceneGraph line " + std::to_string(lineNumber) + ": " + message);
+    }
+}
+
+std::unique_ptr<SceneGraph> SceneGraph::LoadFromFile(const wchar_t* fileName)
+{
+    std::ifstream file(fileName);
+    if (!file)
+    {
+        throw std::exception("SceneGraph::LoadFromFile");
+    }
+
+    return Load(file);
+}
+
+std::unique_ptr<SceneGraph> SceneGraph::Load(std::istream& stream)
+{
+    auto scene = std::make_unique<SceneGraph>();
+
+    std::string line;
+    unsigned lineNumber = 0;
+    while (std::getline(stream, line))
+    {
+        ++lineNumber;
+
+        auto comment = line.find('#');
+        if (comment != std::string::npos)
+        {
+            line.erase(comment);
+        }
+
+        std::istringstream in(line);
+        std::string keyword;
+        if (!(in >> keyword))
+            continue;
+
+        if (keyword == "model")
+        {
+            // model <name> <file>
+            std::string name, path;
+            if (!(in >> name >> path))
+                ThrowParseError(lineNumber, "expected 'model <name> <file>'");
+
+            if (FindName(scene->m_modelNames, name) != c_None)
+                ThrowParseError(lineNumber, "model '" + name + "' declared twice");
+
+            scene->AddModel(name, std::wstring(path.cbegin(), path.cend()));
+        }
+        else if (keyword == "atlas")
+        {
+            // atlas <file>
+            std::string path;
+            if (!(in >> path))
+                ThrowParseError(lineNumber, "expected 'atlas <file>'");
+
+            scene->AddAtlas(std::wstring(path.cbegin(), path.cend()));
+        }
+        else if (keyword == "node")
+        {
+            // node <name> <parent|-> <model|-> <style|-> <scale> <yaw> <pitch> <roll> <x> <y> <z> [options]
+            std::string name, parentName, modelName, styleName;
+            float scale, yaw, pitch, roll, x, y, z;
+            if (!(in >> name >> parentName >> modelName >> styleName >> scale >> yaw >> pitch >> roll >> x >> y >> z))
+                ThrowParseError(lineNumber, "expected 'node <name> <parent> <model> <style> <scale> <yaw> <pitch> <roll> <x> <y> <z>'");
+
+            if (scene->FindNode(name) != c_None)
+                ThrowParseError(lineNumber, "node '" + name + "' declared twice");
+
+            NodeId parent = c_NoParent;
+            if (parentName != "-")
+            {
+                parent = scene->FindNode(parentName);
+                if (parent == c_None)
+                    ThrowParseError(lineNumber, "parent '" + parentName + "' must be declared before '" + name + "'");
+            }
+
+            uint32_t model = c_None;
+            if (modelName != "-")
+            {
+                model = FindName(scene->m_modelNames, modelName);
+                if (model == c_None)
+                    ThrowParseError(lineNumber, "unknown model '" + modelName + "'");
+            }
+
+            uint32_t style = (styleName != "-") ? scene->AddStyle(styleName) : c_None;
+
+            XMVECTOR rotation = XMQuaternionRotationRollPitchYaw(
+                XMConvertToRadians(pitch), XMConvertToRadians(yaw), XMConvertToRadians(roll));
+
+            NodeId node = scene->AddNode(name, parent,
+                XMVectorReplicate(scale), rotation, XMVectorSet(x, y, z, 0.f),
+                model, style);
+
+            std::string option;
+            while (in >> option)
+            {
+                if (option == "spin")
+                {
+                    float degrees;
+                    if (!(in >> degrees))
+                        ThrowParseError(lineNumber, "expected 'spin <degrees per update>'");
+
+                    scene->SetSpin(node, degrees);
+                }
+                else if (option == "instanced")
+                {
+                    scene->SetInstanced(node, true);
+                }
+                else if (option == "color")
+                {
+                    float r, g, b, a;
+                    if (!(in >> r >> g >> b >> a))
+                        ThrowParseError(lineNumber, "expected 'color <r> <g> <b> <a>'");
+
+                    scene->SetColor(node, XMVectorSet(r, g, b, a));
+                }
+                else
+                {
+                    ThrowParseError(lineNumber, "unknown node option '" + option + "'");
+                }
+            }
+        }
+        else
+        {
+            ThrowParseError(lineNumber, "unknown keyword '" + keyword + "'");
+        }
+    }
+
+    scene->UpdateWorldMatrices();
+
+    return scene;
+}
+
+uint32_t SceneGraph::AddModel(const std::string& name, const std::wstring& fileName)
+{
+    m_modelNames.push_back(name);
+    m_modelFiles.push_back(fileName);
+    return uint32_t(m_modelNames.size() - 1);
+}
+
+void SceneGraph::AddAtlas(const std::wstring& fileName)
+{
+    m_atlasFiles.push_back(fileName);
+}
+
+uint32_t SceneGraph::AddStyle(const std::string& name)
+{
+    uint32_t style = FindName(m_styleNames, name);
+    if (style == c_None)
+    {
+        m_styleNames.push_back(name);
+        style = uint32_t(m_styleNames.size() - 1);
+    }
+    return style;
+}
+
+SceneGraph::NodeId SceneGraph::AddNode(const std::string& name, NodeId parent,
+    FXMVECTOR scale, FXMVECTOR rotation, FXMVECTOR translation,
+    uint32_t model, uint32_t style)
+{
+    auto node = NodeId(m_parent.size());
+    if (parent != c_NoParent && parent >= node)
+    {
+        throw std::out_of_range("SceneGraph::AddNode parent");
+    }
+
+    m_parent.push_back(parent);
+
+    XMFLOAT3 s, t;
+    XMFLOAT4 r;
+    XMStoreFloat3(&s, scale);
+    XMStoreFloat4(&r, rotation);
+    XMStoreFloat3(&t, translation);
+    m_scale.push_back(s);
+    m_rotation.push_back(r);
+    m_translation.push_back(t);
+
+    XMFLOAT4X4 identity;
+    XMStoreFloat4x4(&identity, XMMatrixIdentity());
+    m_world.push_back(identity);
+    m_dirty.push_back(1);
+    m_anyDirty = true;
+
+    m_model.push_back(model);
+    m_style.push_back(style);
+    m_instanced.push_back(0);
+    m_color.push_back(XMFLOAT4(1.f, 1.f, 1.f, 1.f));
+    m_name.push_back(name);
+    m_nodeLookup.emplace(name, node);
+
+    if (model != c_None)
+    {
+        m_renderables.push_back(node);
+    }
+
+    return node;
+}
+
+void SceneGraph::SetSpin(NodeId node, float degreesPerUpdate)
+{
+    for (auto& spinner : m_spinners)
+    {
+        if (spinner.node == node)
+        {
+            spinner.degreesPerUpdate = degreesPerUpdate;
+            return;
+        }
+    }
+
+    m_spinners.push_back({ node, degreesPerUpdate, 0.f, m_rotation[node] });
+}
+
+void SceneGraph::SetScale(NodeId node, FXMVECTOR scale)
+{
+    XMStoreFloat3(&m_scale[node], scale);
+    m_dirty[node] = 1;
+    m_anyDirty = true;
+}
+
+void SceneGraph::SetRotation(NodeId node, FXMVECTOR rotation)
+{
+    XMStoreFloat4(&m_rotation[node], rotation);
+    m_dirty[node] = 1;
+    m_anyDirty = true;
+}
+
+void SceneGraph::SetTranslation(NodeId node, FXMVECTOR translation)
+{
+    XMStoreFloat3(&m_translation[node], translation);
+    m_dirty[node] = 1;
+    m_anyDirty = true;
+}
+
+void SceneGraph::Animate()
+{
+    for (auto& spinner : m_spinners)
+    {
+        spinner.angle += spinner.degreesPerUpdate;
+        if (spinner.angle >= 360.f)
+        {
+            spinner.angle -= 360.f;
+        }
+        else if (spinner.angle < 0.f)
+        {
+            spinner.angle += 360.f;
+        }
+
+        XMVECTOR spin = XMQuaternionRotationRollPitchYaw(0.f, XMConvertToRadians(spinner.angle), 0.f);
+        SetRotation(spinner.node, XMQuaternionMultiply(XMLoadFloat4(&spinner.rest), spin));
+    }
+}
+
+void SceneGraph::UpdateWorldMatrices()
+{
+    if (!m_anyDirty)
+        return;
+
+    const size_t count = m_parent.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const NodeId parent = m_parent[i];
+
+        // Parents precede children, so a parent's flag is final by the time we reach it.
+        if (parent != c_NoParent && m_dirty[parent])
+        {
+            m_dirty[i] = 1;
+        }
+
+        if (!m_dirty[i])
+            continue;
+
+        XMMATRIX local = XMMatrixScalingFromVector(XMLoadFloat3(&m_scale[i]));
+        local = XMMatrixMultiply(local, XMMatrixRotationQuaternion(XMLoadFloat4(&m_rotation[i])));
+        local.r[3] = XMVectorSelect(g_XMIdentityR3, XMLoadFloat3(&m_translation[i]), g_XMSelect1110);
+
+        if (parent != c_NoParent)
+        {
+            local = XMMatrixMultiply(local, XMLoadFloat4x4(&m_world[parent]));
+        }
+
+        XMStoreFloat4x4(&m_world[i], local);
+    }
+
+    std::fill(m_dirty.begin(), m_dirty.end(), uint8_t(0));
+    m_anyDirty = false;
+}
+
+SceneGraph::NodeId SceneGraph::FindNode(const std::string& name) const
+{
+    auto it = m_nodeLookup.find(name);
+    return (it != m_nodeLookup.cend()) ? it->second : c_None;
+}
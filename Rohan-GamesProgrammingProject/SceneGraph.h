@@ -0,0 +1,116 @@
+//
+// SceneGraph.h - A data-driven transform hierarchy stored as structure-of-arrays
+//
+
+#pragma once
+
+#include <iosfwd>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace DX
+{
+    // Nodes are stored in parallel arrays in the order they are added. A parent is always
+    // added before its children, so world matrices can be resolved front to back in one pass.
+    class SceneGraph
+    {
+    public:
+        using NodeId = uint32_t;
+
+        static const NodeId c_NoParent = UINT32_MAX;
+        static const uint32_t c_None = UINT32_MAX;
+
+        SceneGraph() = default;
+
+        SceneGraph(SceneGraph&&) = default;
+        SceneGraph& operator= (SceneGraph&&) = default;
+
+        SceneGraph(SceneGraph const&) = delete;
+        SceneGraph& operator= (SceneGraph const&) = delete;
+
+        // Reads a scene description (see Scenes/default.scene for the format).
+        static std::unique_ptr<SceneGraph> LoadFromFile(const wchar_t* fileName);
+        static std::unique_ptr<SceneGraph> Load(std::istream& stream);
+
+        // Building
+        uint32_t AddModel(const std::string& name, const std::wstring& fileName);
+        uint32_t AddStyle(const std::string& name);
+        void AddAtlas(const std::wstring& fileName);
+        NodeId AddNode(const std::string& name, NodeId parent,
+            DirectX::FXMVECTOR scale, DirectX::FXMVECTOR rotation, DirectX::FXMVECTOR translation,
+            uint32_t model = c_None, uint32_t style = c_None);
+        void SetSpin(NodeId node, float degreesPerUpdate);
+        void SetInstanced(NodeId node, bool instanced) { m_instanced[node] = instanced ? 1 : 0; }
+        void XM_CALLCONV SetColor(NodeId node, DirectX::FXMVECTOR color) { DirectX::XMStoreFloat4(&m_color[node], color); }
+
+        // Local transforms; each setter marks the node (and so its subtree) dirty.
+        void SetScale(NodeId node, DirectX::FXMVECTOR scale);
+        void SetRotation(NodeId node, DirectX::FXMVECTOR rotation);
+        void SetTranslation(NodeId node, DirectX::FXMVECTOR translation);
+
+        // Advances every spinning node by one update step.
+        void Animate();
+
+        // Recomputes world matrices for dirty nodes and their descendants, then clears the flags.
+        void UpdateWorldMatrices();
+
+        // Queries
+        size_t GetNodeCount() const { return m_parent.size(); }
+        NodeId FindNode(const std::string& name) const;     // c_None if there is no such node
+        NodeId GetParent(NodeId node) const { return m_parent[node]; }
+        const std::string& GetName(NodeId node) const { return m_name[node]; }
+        DirectX::XMMATRIX XM_CALLCONV GetWorld(NodeId node) const { return DirectX::XMLoadFloat4x4(&m_world[node]); }
+        const DirectX::XMFLOAT4X4* GetWorldMatrices() const { return m_world.data(); }
+
+        // Nodes that reference a model, in the order they were declared.
+        const std::vector<NodeId>& GetRenderables() const { return m_renderables; }
+        uint32_t GetModel(NodeId node) const { return m_model[node]; }
+        uint32_t GetStyle(NodeId node) const { return m_style[node]; }
+        bool IsInstanced(NodeId node) const { return m_instanced[node] != 0; }
+        DirectX::XMVECTOR XM_CALLCONV GetColor(NodeId node) const { return DirectX::XMLoadFloat4(&m_color[node]); }
+
+        size_t GetModelCount() const { return m_modelNames.size(); }
+        const std::string& GetModelName(uint32_t model) const { return m_modelNames[model]; }
+        const std::wstring& GetModelFile(uint32_t model) const { return m_modelFiles[model]; }
+
+        size_t GetStyleCount() const { return m_styleNames.size(); }
+        const std::string& GetStyleName(uint32_t style) const { return m_styleNames[style]; }
+
+        // Loaded before the models, which draw from them where they can.
+        const std::vector<std::wstring>& GetAtlasFiles() const { return m_atlasFiles; }
+
+    private:
+        struct Spinner
+        {
+            NodeId              node;
+            float               degreesPerUpdate;
+            float               angle;
+            DirectX::XMFLOAT4   rest;
+        };
+
+        // Per-node arrays, all indexed by NodeId.
+        std::vector<NodeId>                 m_parent;
+        std::vector<DirectX::XMFLOAT3>      m_scale;
+        std::vector<DirectX::XMFLOAT4>      m_rotation;
+        std::vector<DirectX::XMFLOAT3>      m_translation;
+        std::vector<DirectX::XMFLOAT4X4>    m_world;
+        std::vector<uint8_t>                m_dirty;
+        std::vector<uint32_t>               m_model;
+        std::vector<uint32_t>               m_style;
+        std::vector<uint8_t>                m_instanced;
+        std::vector<DirectX::XMFLOAT4>      m_color;
+        std::vector<std::string>            m_name;
+        std::unordered_map<std::string, NodeId> m_nodeLookup;
+
+        std::vector<NodeId>                 m_renderables;
+        std::vector<Spinner>                m_spinners;
+        bool                                m_anyDirty = false;
+
+        std::vector<std::string>            m_modelNames;
+        std::vector<std::wstring>           m_modelFiles;
+        std::vector<std::string>            m_styleNames;
+        std::vector<std::wstring>           m_atlasFiles;
+    };
+}
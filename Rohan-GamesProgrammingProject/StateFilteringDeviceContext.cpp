@@ -0,0 +1,343 @@
+//
+// StateFilteringDeviceContext.cpp - An ID3D11DeviceContext1 that drops bindings which would not change anything
+//
+
+#include "pch.h"
+#include "StateFilteringDeviceContext.h"
+
+using namespace DX;
+
+namespace
+{
+    // A null blend factor means opaque white.
+    inline void GetBlendFactor(const FLOAT* blendFactor, FLOAT result[4])
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            result[i] = blendFactor ? blendFactor[i] : 1.f;
+        }
+    }
+}
+
+StateFilteringDeviceContext::StateFilteringDeviceContext(ID3D11DeviceContext1* inner) noexcept :
+    m_refCount(1),
+    m_inner(inner)
+{
+    Invalidate();
+}
+
+void StateFilteringDeviceContext::Invalidate() noexcept
+{
+    for (auto& stage : m_stages)
+    {
+        stage.shader = UnknownBinding<const void>();
+        ForgetSlots(stage.constantBuffers, 0, UINT(_countof(stage.constantBuffers)));
+        ForgetSlots(stage.views, 0, UINT(_countof(stage.views)));
+        ForgetSlots(stage.samplers, 0, UINT(_countof(stage.samplers)));
+    }
+
+    m_inputLayout = UnknownBinding<ID3D11InputLayout>();
+    ForgetSlots(m_vertexBuffers, 0, UINT(_countof(m_vertexBuffers)));
+    memset(m_vertexStrides, 0, sizeof(m_vertexStrides));
+    memset(m_vertexOffsets, 0, sizeof(m_vertexOffsets));
+    m_indexBuffer = UnknownBinding<ID3D11Buffer>();
+    m_indexFormat = DXGI_FORMAT_UNKNOWN;
+    m_indexOffset = 0;
+    m_topology = D3D11_PRIMITIVE_TOPOLOGY(-1);
+
+    m_rasterizerState = UnknownBinding<ID3D11RasterizerState>();
+    m_viewportCount = UINT_MAX;
+    memset(m_viewports, 0, sizeof(m_viewports));
+
+    m_blendState = UnknownBinding<ID3D11BlendState>();
+    GetBlendFactor(nullptr, m_blendFactor);
+    m_sampleMask = 0;
+    m_depthStencilState = UnknownBinding<ID3D11DepthStencilState>();
+    m_stencilRef = 0;
+}
+
+void StateFilteringDeviceContext::EndFrame() noexcept
+{
+    m_frame.frames = 1;
+    m_lastFrame = m_frame;
+    m_total += m_frame;
+    m_frame.Reset();
+}
+
+void StateFilteringDeviceContext::ResetStats() noexcept
+{
+    m_frame.Reset();
+    m_lastFrame.Reset();
+    m_total.Reset();
+}
+
+#pragma region IUnknown
+HRESULT StateFilteringDeviceContext::QueryInterface(REFIID riid, void** ppvObject)
+{
+    if (!ppvObject)
+        return E_POINTER;
+
+    if (riid == __uuidof(IUnknown)
+        || riid == __uuidof(ID3D11DeviceChild)
+        || riid == __uuidof(ID3D11DeviceContext)
+        || riid == __uuidof(ID3D11DeviceContext1))
+    {
+        *ppvObject = static_cast<ID3D11DeviceContext1*>(this);
+        AddRef();
+        return S_OK;
+    }
+
+    return m_inner->QueryInterface(riid, ppvObject);
+}
+
+ULONG StateFilteringDeviceContext::AddRef()
+{
+    return ++m_refCount;
+}
+
+ULONG StateFilteringDeviceContext::Release()
+{
+    ULONG count = --m_refCount;
+    if (!count)
+    {
+        delete this;
+    }
+    return count;
+}
+#pragma endregion
+
+#pragma region Filtering
+bool StateFilteringDeviceContext::FilterShader(Stage stage, const void* shader, UINT numClassInstances) noexcept
+{
+    ++m_frame.calls;
+
+    // Class linkage instances are not tracked, so such bindings always go through
+    if (numClassInstances)
+    {
+        m_stages[stage].shader = UnknownBinding<const void>();
+        return true;
+    }
+
+    if (m_stages[stage].shader == shader)
+    {
+        ++m_frame.filtered;
+        ++m_frame.filteredShaders;
+        return false;
+    }
+
+    m_stages[stage].shader = shader;
+    return true;
+}
+
+bool StateFilteringDeviceContext::FilterState(bool unchanged, uint64_t& category) noexcept
+{
+    ++m_frame.calls;
+
+    if (unchanged)
+    {
+        ++m_frame.filtered;
+        ++category;
+        return false;
+    }
+
+    return true;
+}
+
+void StateFilteringDeviceContext::ForgetShaderResources() noexcept
+{
+    for (auto& stage : m_stages)
+    {
+        ForgetSlots(stage.views, 0, UINT(_countof(stage.views)));
+    }
+}
+#pragma endregion
+
+#pragma region Input assembler
+void StateFilteringDeviceContext::IASetInputLayout(ID3D11InputLayout* pInputLayout)
+{
+    if (!FilterState(pInputLayout == m_inputLayout, m_frame.filteredStates))
+        return;
+
+    m_inputLayout = pInputLayout;
+    m_inner->IASetInputLayout(pInputLayout);
+}
+
+void StateFilteringDeviceContext::IASetVertexBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppVertexBuffers, const UINT* pStrides, const UINT* pOffsets)
+{
+    const UINT slotCount = UINT(_countof(m_vertexBuffers));
+    if (!ppVertexBuffers || !pStrides || !pOffsets || StartSlot >= slotCount || NumBuffers > slotCount - StartSlot)
+    {
+        ++m_frame.calls;
+        ForgetSlots(m_vertexBuffers, StartSlot, NumBuffers);
+        m_inner->IASetVertexBuffers(StartSlot, NumBuffers, ppVertexBuffers, pStrides, pOffsets);
+        return;
+    }
+
+    auto same = [&](UINT i)
+    {
+        UINT slot = StartSlot + i;
+        return m_vertexBuffers[slot] == ppVertexBuffers[i]
+            && m_vertexStrides[slot] == pStrides[i]
+            && m_vertexOffsets[slot] == pOffsets[i];
+    };
+
+    UINT first = 0;
+    UINT last = NumBuffers;
+    while (first < last && same(first))
+    {
+        ++first;
+    }
+
+    if (!FilterState(first == last, m_frame.filteredStates))
+        return;
+
+    while (same(last - 1))
+    {
+        --last;
+    }
+
+    for (UINT i = first; i < last; ++i)
+    {
+        UINT slot = StartSlot + i;
+        m_vertexBuffers[slot] = ppVertexBuffers[i];
+        m_vertexStrides[slot] = pStrides[i];
+        m_vertexOffsets[slot] = pOffsets[i];
+    }
+
+    m_frame.slotsTrimmed += NumBuffers - (last - first);
+    m_inner->IASetVertexBuffers(StartSlot + first, last - first, ppVertexBuffers + first, pStrides + first, pOffsets + first);
+}
+
+void StateFilteringDeviceContext::IASetIndexBuffer(ID3D11Buffer* pIndexBuffer, DXGI_FORMAT Format, UINT Offset)
+{
+    if (!FilterState(pIndexBuffer == m_indexBuffer && Format == m_indexFormat && Offset == m_indexOffset, m_frame.filteredStates))
+        return;
+
+    m_indexBuffer = pIndexBuffer;
+    m_indexFormat = Format;
+    m_indexOffset = Offset;
+    m_inner->IASetIndexBuffer(pIndexBuffer, Format, Offset);
+}
+
+void StateFilteringDeviceContext::IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY Topology)
+{
+    if (!FilterState(Topology == m_topology, m_frame.filteredStates))
+        return;
+
+    m_topology = Topology;
+    m_inner->IASetPrimitiveTopology(Topology);
+}
+#pragma endregion
+
+#pragma region Rasterizer and output merger
+void StateFilteringDeviceContext::RSSetState(ID3D11RasterizerState* pRasterizerState)
+{
+    if (!FilterState(pRasterizerState == m_rasterizerState, m_frame.filteredStates))
+        return;
+
+    m_rasterizerState = pRasterizerState;
+    m_inner->RSSetState(pRasterizerState);
+}
+
+void StateFilteringDeviceContext::RSSetViewports(UINT NumViewports, const D3D11_VIEWPORT* pViewports)
+{
+    if (NumViewports > _countof(m_viewports) || (NumViewports && !pViewports))
+    {
+        ++m_frame.calls;
+        m_viewportCount = UINT_MAX;
+        m_inner->RSSetViewports(NumViewports, pViewports);
+        return;
+    }
+
+    bool unchanged = NumViewports == m_viewportCount
+        && (!NumViewports || !memcmp(pViewports, m_viewports, NumViewports * sizeof(D3D11_VIEWPORT)));
+    if (!FilterState(unchanged, m_frame.filteredStates))
+        return;
+
+    m_viewportCount = NumViewports;
+    if (NumViewports)
+    {
+        memcpy(m_viewports, pViewports, NumViewports * sizeof(D3D11_VIEWPORT));
+    }
+    m_inner->RSSetViewports(NumViewports, pViewports);
+}
+
+void StateFilteringDeviceContext::OMSetBlendState(ID3D11BlendState* pBlendState, const FLOAT BlendFactor[4], UINT SampleMask)
+{
+    FLOAT blendFactor[4];
+    GetBlendFactor(BlendFactor, blendFactor);
+
+    bool unchanged = pBlendState == m_blendState
+        && SampleMask == m_sampleMask
+        && !memcmp(blendFactor, m_blendFactor, sizeof(blendFactor));
+    if (!FilterState(unchanged, m_frame.filteredStates))
+        return;
+
+    m_blendState = pBlendState;
+    m_sampleMask = SampleMask;
+    memcpy(m_blendFactor, blendFactor, sizeof(blendFactor));
+    m_inner->OMSetBlendState(pBlendState, BlendFactor, SampleMask);
+}
+
+void StateFilteringDeviceContext::OMSetDepthStencilState(ID3D11DepthStencilState* pDepthStencilState, UINT StencilRef)
+{
+    if (!FilterState(pDepthStencilState == m_depthStencilState && StencilRef == m_stencilRef, m_frame.filteredStates))
+        return;
+
+    m_depthStencilState = pDepthStencilState;
+    m_stencilRef = StencilRef;
+    m_inner->OMSetDepthStencilState(pDepthStencilState, StencilRef);
+}
+#pragma endregion
+
+#pragma region Bindings the runtime can override
+// Binding outputs makes the runtime unbind any shader resource view of the same resource,
+// so the cached views can no longer be trusted.
+void StateFilteringDeviceContext::OMSetRenderTargets(UINT NumViews, ID3D11RenderTargetView* const* ppRenderTargetViews, ID3D11DepthStencilView* pDepthStencilView)
+{
+    ForgetShaderResources();
+    ++m_frame.invalidations;
+    m_inner->OMSetRenderTargets(NumViews, ppRenderTargetViews, pDepthStencilView);
+}
+
+void StateFilteringDeviceContext::OMSetRenderTargetsAndUnorderedAccessViews(UINT NumRTVs, ID3D11RenderTargetView* const* ppRenderTargetViews, ID3D11DepthStencilView* pDepthStencilView, UINT UAVStartSlot, UINT NumUAVs, ID3D11UnorderedAccessView* const* ppUnorderedAccessViews, const UINT* pUAVInitialCounts)
+{
+    ForgetShaderResources();
+    ++m_frame.invalidations;
+    m_inner->OMSetRenderTargetsAndUnorderedAccessViews(NumRTVs, ppRenderTargetViews, pDepthStencilView, UAVStartSlot, NumUAVs, ppUnorderedAccessViews, pUAVInitialCounts);
+}
+
+void StateFilteringDeviceContext::CSSetUnorderedAccessViews(UINT StartSlot, UINT NumUAVs, ID3D11UnorderedAccessView* const* ppUnorderedAccessViews, const UINT* pUAVInitialCounts)
+{
+    ForgetShaderResources();
+    ++m_frame.invalidations;
+    m_inner->CSSetUnorderedAccessViews(StartSlot, NumUAVs, ppUnorderedAccessViews, pUAVInitialCounts);
+}
+
+// Stream output targets alias vertex buffers the same way.
+void StateFilteringDeviceContext::SOSetTargets(UINT NumBuffers, ID3D11Buffer* const* ppSOTargets, const UINT* pOffsets)
+{
+    ForgetSlots(m_vertexBuffers, 0, UINT(_countof(m_vertexBuffers)));
+    ++m_frame.invalidations;
+    m_inner->SOSetTargets(NumBuffers, ppSOTargets, pOffsets);
+}
+
+void StateFilteringDeviceContext::ExecuteCommandList(ID3D11CommandList* pCommandList, BOOL RestoreContextState)
+{
+    // Without restore the context is left cleared; with it the state is as before, but the
+    // runtime may still have unbound hazards while the list ran.
+    Invalidate();
+    ++m_frame.invalidations;
+    m_inner->ExecuteCommandList(pCommandList, RestoreContextState);
+}
+
+HRESULT StateFilteringDeviceContext::FinishCommandList(BOOL RestoreDeferredContextState, ID3D11CommandList** ppCommandList)
+{
+    if (!RestoreDeferredContextState)
+    {
+        Invalidate();
+        ++m_frame.invalidations;
+    }
+    return m_inner->FinishCommandList(RestoreDeferredContextState, ppCommandList);
+}
+#pragma endregion
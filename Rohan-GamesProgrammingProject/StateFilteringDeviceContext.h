@@ -0,0 +1,373 @@
+//
+// StateFilteringDeviceContext.h - An ID3D11DeviceContext1 that drops bindings which would not change anything
+//
+
+#pragma once
+
+#include <atomic>
+#include <string.h>
+#include <stdint.h>
+
+namespace DX
+{
+    // Counters gathered by StateFilteringDeviceContext, either for a single frame or accumulated.
+    struct StateFilterStats
+    {
+        uint64_t frames;
+        uint64_t calls;                 // binding calls seen
+        uint64_t filtered;              // binding calls dropped entirely
+        uint64_t filteredShaders;
+        uint64_t filteredResources;     // shader resource views, samplers and constant buffers
+        uint64_t filteredStates;        // IA, RS and OM bindings
+        uint64_t slotsTrimmed;          // unchanged slots cut from the ends of forwarded slot ranges
+        uint64_t invalidations;         // calls that left the bound state unknown
+
+        StateFilterStats() noexcept { Reset(); }
+
+        void Reset() noexcept { memset(this, 0, sizeof(StateFilterStats)); }
+
+        StateFilterStats& operator+= (const StateFilterStats& other) noexcept
+        {
+            frames += other.frames;
+            calls += other.calls;
+            filtered += other.filtered;
+            filteredShaders += other.filteredShaders;
+            filteredResources += other.filteredResources;
+            filteredStates += other.filteredStates;
+            slotsTrimmed += other.slotsTrimmed;
+            invalidations += other.invalidations;
+            return *this;
+        }
+    };
+
+    // Sits in front of another context and remembers what is bound to every pipeline slot.
+    // Binding calls that would set exactly what is already bound are not forwarded, and slot
+    // ranges are trimmed to the slots that actually change. Everything else passes straight
+    // through, so any ID3D11DeviceContext1 can be the inner context; with a RecordingDeviceContext
+    // behind it, the recorder's counters show what reaches the driver and these show what was saved.
+    //
+    // Slots start out unknown and return to unknown after anything that changes bindings behind
+    // the wrapper's back: ClearState, SwapDeviceContextState, ExecuteCommandList, and binding
+    // render targets or UAVs (the runtime unbinds shader resource views that alias outputs).
+    // The cache holds no references; a bound object is kept alive by the runtime.
+    class StateFilteringDeviceContext final : public ID3D11DeviceContext1
+    {
+    public:
+        explicit StateFilteringDeviceContext(_In_ ID3D11DeviceContext1* inner) noexcept;
+
+        StateFilteringDeviceContext(StateFilteringDeviceContext const&) = delete;
+        StateFilteringDeviceContext& operator= (StateFilteringDeviceContext const&) = delete;
+
+        // Forgets everything bound, e.g. after the inner context was used directly.
+        void Invalidate() noexcept;
+
+        // Frame bookkeeping.
+        void EndFrame() noexcept;
+        void ResetStats() noexcept;
+
+        const StateFilterStats& GetFrameStats() const noexcept  { return m_lastFrame; }
+        const StateFilterStats& GetTotalStats() const noexcept  { return m_total; }
+        ID3D11DeviceContext1* GetInnerContext() const noexcept  { return m_inner.Get(); }
+
+        // IUnknown
+        HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, _COM_Outptr_ void** ppvObject) override;
+        ULONG STDMETHODCALLTYPE AddRef() override;
+        ULONG STDMETHODCALLTYPE Release() override;
+
+        // ID3D11DeviceChild
+        void STDMETHODCALLTYPE GetDevice(ID3D11Device** ppDevice) override                                      { m_inner->GetDevice(ppDevice); }
+        HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID guid, UINT* pDataSize, void* pData) override           { return m_inner->GetPrivateData(guid, pDataSize, pData); }
+        HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID guid, UINT DataSize, const void* pData) override       { return m_inner->SetPrivateData(guid, DataSize, pData); }
+        HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID guid, const IUnknown* pData) override         { return m_inner->SetPrivateDataInterface(guid, pData); }
+
+        // Work submission (forwarded untouched).
+        void STDMETHODCALLTYPE Draw(UINT VertexCount, UINT StartVertexLocation) override                                                                                                        { m_inner->Draw(VertexCount, StartVertexLocation); }
+        void STDMETHODCALLTYPE DrawIndexed(UINT IndexCount, UINT StartIndexLocation, INT BaseVertexLocation) override                                                                           { m_inner->DrawIndexed(IndexCount, StartIndexLocation, BaseVertexLocation); }
+        void STDMETHODCALLTYPE DrawInstanced(UINT VertexCountPerInstance, UINT InstanceCount, UINT StartVertexLocation, UINT StartInstanceLocation) override                                   { m_inner->DrawInstanced(VertexCountPerInstance, InstanceCount, StartVertexLocation, StartInstanceLocation); }
+        void STDMETHODCALLTYPE DrawIndexedInstanced(UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation, INT BaseVertexLocation, UINT StartInstanceLocation) override      { m_inner->DrawIndexedInstanced(IndexCountPerInstance, InstanceCount, StartIndexLocation, BaseVertexLocation, StartInstanceLocation); }
+        void STDMETHODCALLTYPE DrawAuto() override                                                                                                                                              { m_inner->DrawAuto(); }
+        void STDMETHODCALLTYPE DrawIndexedInstancedIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs) override                                                               { m_inner->DrawIndexedInstancedIndirect(pBufferForArgs, AlignedByteOffsetForArgs); }
+        void STDMETHODCALLTYPE DrawInstancedIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs) override                                                                      { m_inner->DrawInstancedIndirect(pBufferForArgs, AlignedByteOffsetForArgs); }
+        void STDMETHODCALLTYPE Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ) override                                                                        { m_inner->Dispatch(ThreadGroupCountX, ThreadGroupCountY, ThreadGroupCountZ); }
+        void STDMETHODCALLTYPE DispatchIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs) override                                                                           { m_inner->DispatchIndirect(pBufferForArgs, AlignedByteOffsetForArgs); }
+
+        HRESULT STDMETHODCALLTYPE Map(ID3D11Resource* pResource, UINT Subresource, D3D11_MAP MapType, UINT MapFlags, D3D11_MAPPED_SUBRESOURCE* pMappedResource) override                        { return m_inner->Map(pResource, Subresource, MapType, MapFlags, pMappedResource); }
+        void STDMETHODCALLTYPE Unmap(ID3D11Resource* pResource, UINT Subresource) override                                                                                                      { m_inner->Unmap(pResource, Subresource); }
+
+        void STDMETHODCALLTYPE CopySubresourceRegion(ID3D11Resource* pDstResource, UINT DstSubresource, UINT DstX, UINT DstY, UINT DstZ, ID3D11Resource* pSrcResource, UINT SrcSubresource, const D3D11_BOX* pSrcBox) override
+        {
+            m_inner->CopySubresourceRegion(pDstResource, DstSubresource, DstX, DstY, DstZ, pSrcResource, SrcSubresource, pSrcBox);
+        }
+        void STDMETHODCALLTYPE CopyResource(ID3D11Resource* pDstResource, ID3D11Resource* pSrcResource) override                                                                                { m_inner->CopyResource(pDstResource, pSrcResource); }
+        void STDMETHODCALLTYPE UpdateSubresource(ID3D11Resource* pDstResource, UINT DstSubresource, const D3D11_BOX* pDstBox, const void* pSrcData, UINT SrcRowPitch, UINT SrcDepthPitch) override
+        {
+            m_inner->UpdateSubresource(pDstResource, DstSubresource, pDstBox, pSrcData, SrcRowPitch, SrcDepthPitch);
+        }
+        void STDMETHODCALLTYPE CopyStructureCount(ID3D11Buffer* pDstBuffer, UINT DstAlignedByteOffset, ID3D11UnorderedAccessView* pSrcView) override                                            { m_inner->CopyStructureCount(pDstBuffer, DstAlignedByteOffset, pSrcView); }
+        void STDMETHODCALLTYPE ClearRenderTargetView(ID3D11RenderTargetView* pRenderTargetView, const FLOAT ColorRGBA[4]) override                                                              { m_inner->ClearRenderTargetView(pRenderTargetView, ColorRGBA); }
+        void STDMETHODCALLTYPE ClearUnorderedAccessViewUint(ID3D11UnorderedAccessView* pUnorderedAccessView, const UINT Values[4]) override                                                     { m_inner->ClearUnorderedAccessViewUint(pUnorderedAccessView, Values); }
+        void STDMETHODCALLTYPE ClearUnorderedAccessViewFloat(ID3D11UnorderedAccessView* pUnorderedAccessView, const FLOAT Values[4]) override                                                   { m_inner->ClearUnorderedAccessViewFloat(pUnorderedAccessView, Values); }
+        void STDMETHODCALLTYPE ClearDepthStencilView(ID3D11DepthStencilView* pDepthStencilView, UINT ClearFlags, FLOAT Depth, UINT8 Stencil) override                                          { m_inner->ClearDepthStencilView(pDepthStencilView, ClearFlags, Depth, Stencil); }
+        void STDMETHODCALLTYPE GenerateMips(ID3D11ShaderResourceView* pShaderResourceView) override                                                                                             { m_inner->GenerateMips(pShaderResourceView); }
+        void STDMETHODCALLTYPE ResolveSubresource(ID3D11Resource* pDstResource, UINT DstSubresource, ID3D11Resource* pSrcResource, UINT SrcSubresource, DXGI_FORMAT Format) override           { m_inner->ResolveSubresource(pDstResource, DstSubresource, pSrcResource, SrcSubresource, Format); }
+        void STDMETHODCALLTYPE ExecuteCommandList(ID3D11CommandList* pCommandList, BOOL RestoreContextState) override;
+
+        void STDMETHODCALLTYPE CopySubresourceRegion1(ID3D11Resource* pDstResource, UINT DstSubresource, UINT DstX, UINT DstY, UINT DstZ, ID3D11Resource* pSrcResource, UINT SrcSubresource, const D3D11_BOX* pSrcBox, UINT CopyFlags) override
+        {
+            m_inner->CopySubresourceRegion1(pDstResource, DstSubresource, DstX, DstY, DstZ, pSrcResource, SrcSubresource, pSrcBox, CopyFlags);
+        }
+        void STDMETHODCALLTYPE UpdateSubresource1(ID3D11Resource* pDstResource, UINT DstSubresource, const D3D11_BOX* pDstBox, const void* pSrcData, UINT SrcRowPitch, UINT SrcDepthPitch, UINT CopyFlags) override
+        {
+            m_inner->UpdateSubresource1(pDstResource, DstSubresource, pDstBox, pSrcData, SrcRowPitch, SrcDepthPitch, CopyFlags);
+        }
+        void STDMETHODCALLTYPE ClearView(ID3D11View* pView, const FLOAT Color[4], const D3D11_RECT* pRect, UINT NumRects) override                                                              { m_inner->ClearView(pView, Color, pRect, NumRects); }
+
+        // Pipeline state (filtered against the cache).
+        void STDMETHODCALLTYPE IASetInputLayout(ID3D11InputLayout* pInputLayout) override;
+        void STDMETHODCALLTYPE IASetVertexBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppVertexBuffers, const UINT* pStrides, const UINT* pOffsets) override;
+        void STDMETHODCALLTYPE IASetIndexBuffer(ID3D11Buffer* pIndexBuffer, DXGI_FORMAT Format, UINT Offset) override;
+        void STDMETHODCALLTYPE IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY Topology) override;
+
+        void STDMETHODCALLTYPE VSSetShader(ID3D11VertexShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override         { if (FilterShader(Stage_VS, pShader, NumClassInstances)) m_inner->VSSetShader(pShader, ppClassInstances, NumClassInstances); }
+        void STDMETHODCALLTYPE PSSetShader(ID3D11PixelShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override          { if (FilterShader(Stage_PS, pShader, NumClassInstances)) m_inner->PSSetShader(pShader, ppClassInstances, NumClassInstances); }
+        void STDMETHODCALLTYPE GSSetShader(ID3D11GeometryShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override       { if (FilterShader(Stage_GS, pShader, NumClassInstances)) m_inner->GSSetShader(pShader, ppClassInstances, NumClassInstances); }
+        void STDMETHODCALLTYPE HSSetShader(ID3D11HullShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override           { if (FilterShader(Stage_HS, pShader, NumClassInstances)) m_inner->HSSetShader(pShader, ppClassInstances, NumClassInstances); }
+        void STDMETHODCALLTYPE DSSetShader(ID3D11DomainShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override         { if (FilterShader(Stage_DS, pShader, NumClassInstances)) m_inner->DSSetShader(pShader, ppClassInstances, NumClassInstances); }
+        void STDMETHODCALLTYPE CSSetShader(ID3D11ComputeShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override        { if (FilterShader(Stage_CS, pShader, NumClassInstances)) m_inner->CSSetShader(pShader, ppClassInstances, NumClassInstances); }
+
+        void STDMETHODCALLTYPE VSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override           { if (FilterSlots(m_stages[Stage_VS].views, StartSlot, NumViews, ppShaderResourceViews)) m_inner->VSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE PSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override           { if (FilterSlots(m_stages[Stage_PS].views, StartSlot, NumViews, ppShaderResourceViews)) m_inner->PSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE GSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override           { if (FilterSlots(m_stages[Stage_GS].views, StartSlot, NumViews, ppShaderResourceViews)) m_inner->GSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE HSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override           { if (FilterSlots(m_stages[Stage_HS].views, StartSlot, NumViews, ppShaderResourceViews)) m_inner->HSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE DSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override           { if (FilterSlots(m_stages[Stage_DS].views, StartSlot, NumViews, ppShaderResourceViews)) m_inner->DSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE CSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override           { if (FilterSlots(m_stages[Stage_CS].views, StartSlot, NumViews, ppShaderResourceViews)) m_inner->CSSetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+
+        void STDMETHODCALLTYPE VSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                { if (FilterSlots(m_stages[Stage_VS].samplers, StartSlot, NumSamplers, ppSamplers)) m_inner->VSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE PSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                { if (FilterSlots(m_stages[Stage_PS].samplers, StartSlot, NumSamplers, ppSamplers)) m_inner->PSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE GSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                { if (FilterSlots(m_stages[Stage_GS].samplers, StartSlot, NumSamplers, ppSamplers)) m_inner->GSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE HSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                { if (FilterSlots(m_stages[Stage_HS].samplers, StartSlot, NumSamplers, ppSamplers)) m_inner->HSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE DSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                { if (FilterSlots(m_stages[Stage_DS].samplers, StartSlot, NumSamplers, ppSamplers)) m_inner->DSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE CSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override                                { if (FilterSlots(m_stages[Stage_CS].samplers, StartSlot, NumSamplers, ppSamplers)) m_inner->CSSetSamplers(StartSlot, NumSamplers, ppSamplers); }
+
+        void STDMETHODCALLTYPE VSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                         { if (FilterSlots(m_stages[Stage_VS].constantBuffers, StartSlot, NumBuffers, ppConstantBuffers)) m_inner->VSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE PSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                         { if (FilterSlots(m_stages[Stage_PS].constantBuffers, StartSlot, NumBuffers, ppConstantBuffers)) m_inner->PSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE GSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                         { if (FilterSlots(m_stages[Stage_GS].constantBuffers, StartSlot, NumBuffers, ppConstantBuffers)) m_inner->GSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE HSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                         { if (FilterSlots(m_stages[Stage_HS].constantBuffers, StartSlot, NumBuffers, ppConstantBuffers)) m_inner->HSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE DSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                         { if (FilterSlots(m_stages[Stage_DS].constantBuffers, StartSlot, NumBuffers, ppConstantBuffers)) m_inner->DSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE CSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override                         { if (FilterSlots(m_stages[Stage_CS].constantBuffers, StartSlot, NumBuffers, ppConstantBuffers)) m_inner->CSSetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+
+        // Constant buffer ranges are not compared; the slots become unknown and the call is forwarded.
+        void STDMETHODCALLTYPE VSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { ForgetSlots(m_stages[Stage_VS].constantBuffers, StartSlot, NumBuffers); m_inner->VSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE PSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { ForgetSlots(m_stages[Stage_PS].constantBuffers, StartSlot, NumBuffers); m_inner->PSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE GSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { ForgetSlots(m_stages[Stage_GS].constantBuffers, StartSlot, NumBuffers); m_inner->GSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE HSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { ForgetSlots(m_stages[Stage_HS].constantBuffers, StartSlot, NumBuffers); m_inner->HSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE DSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { ForgetSlots(m_stages[Stage_DS].constantBuffers, StartSlot, NumBuffers); m_inner->DSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE CSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override { ForgetSlots(m_stages[Stage_CS].constantBuffers, StartSlot, NumBuffers); m_inner->CSSetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+
+        void STDMETHODCALLTYPE CSSetUnorderedAccessViews(UINT StartSlot, UINT NumUAVs, ID3D11UnorderedAccessView* const* ppUnorderedAccessViews, const UINT* pUAVInitialCounts) override;
+
+        void STDMETHODCALLTYPE RSSetState(ID3D11RasterizerState* pRasterizerState) override;
+        void STDMETHODCALLTYPE RSSetViewports(UINT NumViewports, const D3D11_VIEWPORT* pViewports) override;
+        void STDMETHODCALLTYPE RSSetScissorRects(UINT NumRects, const D3D11_RECT* pRects) override                                                                                 { m_inner->RSSetScissorRects(NumRects, pRects); }
+
+        void STDMETHODCALLTYPE OMSetRenderTargets(UINT NumViews, ID3D11RenderTargetView* const* ppRenderTargetViews, ID3D11DepthStencilView* pDepthStencilView) override;
+        void STDMETHODCALLTYPE OMSetRenderTargetsAndUnorderedAccessViews(UINT NumRTVs, ID3D11RenderTargetView* const* ppRenderTargetViews, ID3D11DepthStencilView* pDepthStencilView, UINT UAVStartSlot, UINT NumUAVs, ID3D11UnorderedAccessView* const* ppUnorderedAccessViews, const UINT* pUAVInitialCounts) override;
+        void STDMETHODCALLTYPE OMSetBlendState(ID3D11BlendState* pBlendState, const FLOAT BlendFactor[4], UINT SampleMask) override;
+        void STDMETHODCALLTYPE OMSetDepthStencilState(ID3D11DepthStencilState* pDepthStencilState, UINT StencilRef) override;
+        void STDMETHODCALLTYPE SOSetTargets(UINT NumBuffers, ID3D11Buffer* const* ppSOTargets, const UINT* pOffsets) override;
+        void STDMETHODCALLTYPE SetPredication(ID3D11Predicate* pPredicate, BOOL PredicateValue) override                                                                           { m_inner->SetPredication(pPredicate, PredicateValue); }
+        void STDMETHODCALLTYPE SetResourceMinLOD(ID3D11Resource* pResource, FLOAT MinLOD) override                                                                                 { m_inner->SetResourceMinLOD(pResource, MinLOD); }
+
+        // Queries and getters (forwarded untouched).
+        void STDMETHODCALLTYPE Begin(ID3D11Asynchronous* pAsync) override                                                                      { m_inner->Begin(pAsync); }
+        void STDMETHODCALLTYPE End(ID3D11Asynchronous* pAsync) override                                                                        { m_inner->End(pAsync); }
+        HRESULT STDMETHODCALLTYPE GetData(ID3D11Asynchronous* pAsync, void* pData, UINT DataSize, UINT GetDataFlags) override                  { return m_inner->GetData(pAsync, pData, DataSize, GetDataFlags); }
+        FLOAT STDMETHODCALLTYPE GetResourceMinLOD(ID3D11Resource* pResource) override                                                          { return m_inner->GetResourceMinLOD(pResource); }
+
+        void STDMETHODCALLTYPE VSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->VSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE PSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->PSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE GSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->GSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE HSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->HSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE DSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->DSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+        void STDMETHODCALLTYPE CSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override                { m_inner->CSGetConstantBuffers(StartSlot, NumBuffers, ppConstantBuffers); }
+
+        void STDMETHODCALLTYPE VSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->VSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE PSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->PSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE GSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->GSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE HSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->HSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE DSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->DSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+        void STDMETHODCALLTYPE CSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override  { m_inner->CSGetShaderResources(StartSlot, NumViews, ppShaderResourceViews); }
+
+        void STDMETHODCALLTYPE VSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->VSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE PSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->PSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE GSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->GSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE HSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->HSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE DSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->DSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+        void STDMETHODCALLTYPE CSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override                       { m_inner->CSGetSamplers(StartSlot, NumSamplers, ppSamplers); }
+
+        void STDMETHODCALLTYPE VSGetShader(ID3D11VertexShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override    { m_inner->VSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+        void STDMETHODCALLTYPE PSGetShader(ID3D11PixelShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override     { m_inner->PSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+        void STDMETHODCALLTYPE GSGetShader(ID3D11GeometryShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override  { m_inner->GSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+        void STDMETHODCALLTYPE HSGetShader(ID3D11HullShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override      { m_inner->HSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+        void STDMETHODCALLTYPE DSGetShader(ID3D11DomainShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override    { m_inner->DSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+        void STDMETHODCALLTYPE CSGetShader(ID3D11ComputeShader** ppShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override   { m_inner->CSGetShader(ppShader, ppClassInstances, pNumClassInstances); }
+
+        void STDMETHODCALLTYPE VSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->VSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE PSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->PSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE GSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->GSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE HSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->HSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE DSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->DSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+        void STDMETHODCALLTYPE CSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override { m_inner->CSGetConstantBuffers1(StartSlot, NumBuffers, ppConstantBuffers, pFirstConstant, pNumConstants); }
+
+        void STDMETHODCALLTYPE IAGetInputLayout(ID3D11InputLayout** ppInputLayout) override                                                                { m_inner->IAGetInputLayout(ppInputLayout); }
+        void STDMETHODCALLTYPE IAGetVertexBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppVertexBuffers, UINT* pStrides, UINT* pOffsets) override { m_inner->IAGetVertexBuffers(StartSlot, NumBuffers, ppVertexBuffers, pStrides, pOffsets); }
+        void STDMETHODCALLTYPE IAGetIndexBuffer(ID3D11Buffer** pIndexBuffer, DXGI_FORMAT* Format, UINT* Offset) override                                   { m_inner->IAGetIndexBuffer(pIndexBuffer, Format, Offset); }
+        void STDMETHODCALLTYPE IAGetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY* pTopology) override                                                         { m_inner->IAGetPrimitiveTopology(pTopology); }
+        void STDMETHODCALLTYPE GetPredication(ID3D11Predicate** ppPredicate, BOOL* pPredicateValue) override                                                { m_inner->GetPredication(ppPredicate, pPredicateValue); }
+        void STDMETHODCALLTYPE OMGetRenderTargets(UINT NumViews, ID3D11RenderTargetView** ppRenderTargetViews, ID3D11DepthStencilView** ppDepthStencilView) override { m_inner->OMGetRenderTargets(NumViews, ppRenderTargetViews, ppDepthStencilView); }
+        void STDMETHODCALLTYPE OMGetRenderTargetsAndUnorderedAccessViews(UINT NumRTVs, ID3D11RenderTargetView** ppRenderTargetViews, ID3D11DepthStencilView** ppDepthStencilView, UINT UAVStartSlot, UINT NumUAVs, ID3D11UnorderedAccessView** ppUnorderedAccessViews) override
+        {
+            m_inner->OMGetRenderTargetsAndUnorderedAccessViews(NumRTVs, ppRenderTargetViews, ppDepthStencilView, UAVStartSlot, NumUAVs, ppUnorderedAccessViews);
+        }
+        void STDMETHODCALLTYPE OMGetBlendState(ID3D11BlendState** ppBlendState, FLOAT BlendFactor[4], UINT* pSampleMask) override                          { m_inner->OMGetBlendState(ppBlendState, BlendFactor, pSampleMask); }
+        void STDMETHODCALLTYPE OMGetDepthStencilState(ID3D11DepthStencilState** ppDepthStencilState, UINT* pStencilRef) override                            { m_inner->OMGetDepthStencilState(ppDepthStencilState, pStencilRef); }
+        void STDMETHODCALLTYPE SOGetTargets(UINT NumBuffers, ID3D11Buffer** ppSOTargets) override                                                           { m_inner->SOGetTargets(NumBuffers, ppSOTargets); }
+        void STDMETHODCALLTYPE RSGetState(ID3D11RasterizerState** ppRasterizerState) override                                                              { m_inner->RSGetState(ppRasterizerState); }
+        void STDMETHODCALLTYPE RSGetViewports(UINT* pNumViewports, D3D11_VIEWPORT* pViewports) override                                                    { m_inner->RSGetViewports(pNumViewports, pViewports); }
+        void STDMETHODCALLTYPE RSGetScissorRects(UINT* pNumRects, D3D11_RECT* pRects) override                                                             { m_inner->RSGetScissorRects(pNumRects, pRects); }
+        void STDMETHODCALLTYPE CSGetUnorderedAccessViews(UINT StartSlot, UINT NumUAVs, ID3D11UnorderedAccessView** ppUnorderedAccessViews) override        { m_inner->CSGetUnorderedAccessViews(StartSlot, NumUAVs, ppUnorderedAccessViews); }
+
+        // Context management.
+        void STDMETHODCALLTYPE ClearState() override                                                                                       { Invalidate(); ++m_frame.invalidations; m_inner->ClearState(); }
+        void STDMETHODCALLTYPE Flush() override                                                                                            { m_inner->Flush(); }
+        D3D11_DEVICE_CONTEXT_TYPE STDMETHODCALLTYPE GetType() override                                                                     { return m_inner->GetType(); }
+        UINT STDMETHODCALLTYPE GetContextFlags() override                                                                                  { return m_inner->GetContextFlags(); }
+        HRESULT STDMETHODCALLTYPE FinishCommandList(BOOL RestoreDeferredContextState, ID3D11CommandList** ppCommandList) override;
+        void STDMETHODCALLTYPE DiscardResource(ID3D11Resource* pResource) override                                                         { m_inner->DiscardResource(pResource); }
+        void STDMETHODCALLTYPE DiscardView(ID3D11View* pResourceView) override                                                             { m_inner->DiscardView(pResourceView); }
+        void STDMETHODCALLTYPE DiscardView1(ID3D11View* pResourceView, const D3D11_RECT* pRects, UINT NumRects) override                   { m_inner->DiscardView1(pResourceView, pRects, NumRects); }
+        void STDMETHODCALLTYPE SwapDeviceContextState(ID3DDeviceContextState* pState, ID3DDeviceContextState** ppPreviousState) override   { Invalidate(); ++m_frame.invalidations; m_inner->SwapDeviceContextState(pState, ppPreviousState); }
+
+    private:
+        enum Stage
+        {
+            Stage_VS,
+            Stage_PS,
+            Stage_GS,
+            Stage_HS,
+            Stage_DS,
+            Stage_CS,
+            Stage_Count
+        };
+
+        struct StageState
+        {
+            const void*                 shader;
+            ID3D11Buffer*               constantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+            ID3D11ShaderResourceView*   views[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+            ID3D11SamplerState*         samplers[D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT];
+        };
+
+        // Returns true if the call has to be forwarded.
+        bool FilterShader(Stage stage, const void* shader, UINT numClassInstances) noexcept;
+        bool FilterState(bool unchanged, uint64_t& category) noexcept;
+
+        // Returns true if the call has to be forwarded. StartSlot and NumSlots are narrowed to
+        // the range that changes, so the caller forwards its (updated) arguments.
+        template<typename T, size_t N>
+        bool FilterSlots(T* (&cache)[N], UINT& StartSlot, UINT& NumSlots, T* const*& ppObjects) noexcept;
+
+        template<typename T, size_t N>
+        static void ForgetSlots(T* (&cache)[N], UINT StartSlot, UINT NumSlots) noexcept;
+
+        void ForgetShaderResources() noexcept;
+
+        // Never a valid interface pointer, so it compares unequal to anything bound.
+        static const uintptr_t c_UnknownBinding = ~uintptr_t(0);
+
+        template<typename T>
+        static T* UnknownBinding() noexcept { return reinterpret_cast<T*>(c_UnknownBinding); }
+
+        std::atomic<ULONG>                              m_refCount;
+        Microsoft::WRL::ComPtr<ID3D11DeviceContext1>    m_inner;
+
+        // Pipeline state as last forwarded. Unknown slots hold c_UnknownBinding.
+        StageState                                      m_stages[Stage_Count];
+
+        ID3D11InputLayout*                              m_inputLayout;
+        ID3D11Buffer*                                   m_vertexBuffers[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+        UINT                                            m_vertexStrides[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+        UINT                                            m_vertexOffsets[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+        ID3D11Buffer*                                   m_indexBuffer;
+        DXGI_FORMAT                                     m_indexFormat;
+        UINT                                            m_indexOffset;
+        D3D11_PRIMITIVE_TOPOLOGY                        m_topology;
+
+        ID3D11RasterizerState*                          m_rasterizerState;
+        UINT                                            m_viewportCount;    // UINT_MAX when unknown
+        D3D11_VIEWPORT                                  m_viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+
+        ID3D11BlendState*                               m_blendState;
+        FLOAT                                           m_blendFactor[4];
+        UINT                                            m_sampleMask;
+        ID3D11DepthStencilState*                        m_depthStencilState;
+        UINT                                            m_stencilRef;
+
+        StateFilterStats                                m_frame;
+        StateFilterStats                                m_lastFrame;
+        StateFilterStats                                m_total;
+    };
+    template<typename T, size_t N>
+    inline bool StateFilteringDeviceContext::FilterSlots(T* (&cache)[N], UINT& StartSlot, UINT& NumSlots, T* const*& ppObjects) noexcept
+    {
+        ++m_frame.calls;
+
+        // Out of range or missing arrays are for the runtime to report
+        if (!ppObjects || StartSlot >= N || NumSlots > N - StartSlot)
+        {
+            ForgetSlots(cache, StartSlot, NumSlots);
+            return true;
+        }
+
+        T** bound = cache + StartSlot;
+
+        UINT first = 0;
+        UINT last = NumSlots;
+        while (first < last && bound[first] == ppObjects[first])
+        {
+            ++first;
+        }
+
+        if (first == last)
+        {
+            ++m_frame.filtered;
+            ++m_frame.filteredResources;
+            return false;
+        }
+
+        while (bound[last - 1] == ppObjects[last - 1])
+        {
+            --last;
+        }
+
+        for (UINT i = first; i < last; ++i)
+        {
+            bound[i] = ppObjects[i];
+        }
+
+        m_frame.slotsTrimmed += NumSlots - (last - first);
+        StartSlot += first;
+        NumSlots = last - first;
+        ppObjects += first;
+        return true;
+    }
+
+    template<typename T, size_t N>
+    inline void StateFilteringDeviceContext::ForgetSlots(T* (&cache)[N], UINT StartSlot, UINT NumSlots) noexcept
+    {
+        for (UINT i = StartSlot; i < N && i - StartSlot < NumSlots; ++i)
+        {
+            cache[i] = UnknownBinding<T>();
+        }
+    }
+}
@@ -0,0 +1,132 @@
+//
+// TextureAtlas.cpp - One texture holding many small ones, for sprites and model materials
+//
+
+#include "pch.h"
+#include "TextureAtlas.h"
+#include "ImageDecoder.h"
+#include "Profiler.h"
+#include "ReadContent.h"
+
+#include <DDSTextureLoader.h>
+
+using namespace DirectX;
+using namespace DX;
+
+using Microsoft::WRL::ComPtr;
+
+TextureAtlas::TextureAtlas(ID3D11Device* device, ID3D11DeviceContext* context, const PackFile* pack, const wchar_t* fileName) :
+    m_residentBytes(0)
+{
+    DX_PROFILE_SCOPE("LoadAtlas");
+
+    auto bytes = DX::ReadContent(pack, fileName);
+
+    AtlasLayout layout;
+    if (ReadAtlasLayout(bytes.data(), bytes.size(), layout))
+    {
+        DX::ThrowIfFailed(
+            CreateDDSTextureFromMemory(device, bytes.data(), bytes.size(), nullptr, m_view.ReleaseAndGetAddressOf()));
+
+        // The page's file less its layout
+        uint32_t layoutBytes;
+        memcpy(&layoutBytes, bytes.data() + bytes.size() - 8, sizeof(layoutBytes));
+        m_residentBytes = bytes.size() - 8 - layoutBytes;
+    }
+    else
+    {
+        CreateFromSource(device, context, pack, fileName, bytes, layout);
+    }
+
+    layout.name = fileName;
+    m_layout = std::make_shared<const AtlasLayout>(std::move(layout));
+}
+
+// Members are read relative to the list, as the cooker reads them
+void TextureAtlas::CreateFromSource(ID3D11Device* device, ID3D11DeviceContext* context, const PackFile* pack,
+    std::wstring const& fileName, std::vector<uint8_t> const& source, AtlasLayout& layout)
+{
+    auto names = ParseAtlasSource(source.data(), source.size());
+    auto directory = fileName.substr(0, fileName.find_last_of(L"/\\") + 1);
+
+    std::vector<DecodedImage> images(names.size());
+    std::vector<AtlasRegion> members(names.size());
+    bool sRGB = true;
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        auto bytes = DX::ReadContent(pack, (directory + names[i]).c_str());
+        if (DetectImageFormat(bytes.data(), bytes.size()) == ImageFileFormat::Unknown)
+            throw std::exception("TextureAtlas: uncooked atlas members must be PNG, JPEG or BMP");
+
+        DecodeImage(bytes.data(), bytes.size(), images[i]);
+        members[i].name = names[i];
+        members[i].width = images[i].width;
+        members[i].height = images[i].height;
+        sRGB = sRGB && images[i].sRGB;
+    }
+
+    layout = PackAtlas(std::move(members), false);
+
+    const UINT rowPitch = layout.width * 4;
+    std::vector<uint8_t> page(size_t(rowPitch) * layout.height);
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        auto const& region = layout.regions[i];
+        uint8_t* cell = page.data() + size_t(region.y) * rowPitch + size_t(region.x) * 4;
+        for (uint32_t y = 0; y < region.height; ++y)
+        {
+            memcpy(cell + size_t(y) * rowPitch, images[i].pixels.data() + size_t(y) * region.width * 4, size_t(region.width) * 4);
+        }
+        PadAtlasCell(region, cell, rowPitch, 4);
+    }
+
+    const DXGI_FORMAT format = sRGB ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
+
+    UINT support = 0;
+    const bool autogen = SUCCEEDED(device->CheckFormatSupport(format, &support)) && (support & D3D11_FORMAT_SUPPORT_MIP_AUTOGEN);
+    const UINT mipLevels = autogen ? layout.mipCount : 1;
+
+    CD3D11_TEXTURE2D_DESC desc(format, layout.width, layout.height, 1, mipLevels,
+        autogen ? D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET : D3D11_BIND_SHADER_RESOURCE,
+        D3D11_USAGE_DEFAULT, 0, 1, 0, autogen ? D3D11_RESOURCE_MISC_GENERATE_MIPS : 0);
+
+    D3D11_SUBRESOURCE_DATA initData = { page.data(), rowPitch, 0 };
+
+    ComPtr<ID3D11Texture2D> texture;
+    DX::ThrowIfFailed(device->CreateTexture2D(&desc, autogen ? nullptr : &initData, texture.GetAddressOf()));
+    DX::ThrowIfFailed(device->CreateShaderResourceView(texture.Get(), nullptr, m_view.ReleaseAndGetAddressOf()));
+
+    if (autogen)
+    {
+        context->UpdateSubresource(texture.Get(), 0, nullptr, page.data(), rowPitch, UINT(page.size()));
+        context->GenerateMips(m_view.Get());
+    }
+
+    layout.mipCount = mipLevels;
+    for (UINT level = 0; level < mipLevels; ++level)
+    {
+        m_residentBytes += size_t(std::max(layout.width >> level, 1u)) * std::max(layout.height >> level, 1u) * 4;
+    }
+}
+
+RECT TextureAtlas::GetSourceRect(AtlasRegion const& region)
+{
+    RECT rect;
+    rect.left = LONG(region.x);
+    rect.top = LONG(region.y);
+    rect.right = LONG(region.x + region.width);
+    rect.bottom = LONG(region.y + region.height);
+    return rect;
+}
+
+void XM_CALLCONV TextureAtlas::Draw(SpriteBatch& batch, AtlasRegion const& region, RECT const& destination, FXMVECTOR color) const
+{
+    auto source = GetSourceRect(region);
+    batch.Draw(m_view.Get(), destination, &source, color);
+}
+
+void XM_CALLCONV TextureAtlas::Draw(SpriteBatch& batch, AtlasRegion const& region, XMFLOAT2 const& position, FXMVECTOR color) const
+{
+    auto source = GetSourceRect(region);
+    batch.Draw(m_view.Get(), position, &source, color);
+}
@@ -0,0 +1,64 @@
+//
+// TextureAtlas.h - One texture holding many small ones, for sprites and model materials
+//
+
+#pragma once
+
+#include "AtlasLayout.h"
+#include "PackFile.h"
+
+#include <SpriteBatch.h>
+
+#include <memory>
+
+namespace DX
+{
+    // Loads an atlas (AtlasLayout.h): the cooked page, a DDS file with the layout after it,
+    // or, when the content is not cooked, the source list, whose members are decoded with
+    // ImageDecoder and packed the same way. The packed page is RGBA8 (sRGB when every member
+    // is) with its mips, as far as the layout allows, generated on the GPU; as the cells are
+    // aligned to their size, the box filter there never mixes members either.
+    //
+    // SpriteBatch draws from any region without breaking its batch, since the texture stays
+    // the same. Models use the atlas through ModelCache::AddAtlas, which moves the materials
+    // that can onto it, and TextureStreamer::Register, which gives it to their effects.
+    class TextureAtlas
+    {
+    public:
+        // The context, as for WICTextureLoader, is used for the mips of a source list and must
+        // not be used by another thread meanwhile. Throws if the file or a member is missing or
+        // damaged, or the members do not fit.
+        TextureAtlas(_In_ ID3D11Device* device, _In_ ID3D11DeviceContext* context, _In_opt_ const PackFile* pack,
+            _In_z_ const wchar_t* fileName);
+
+        TextureAtlas(TextureAtlas const&) = delete;
+        TextureAtlas& operator= (TextureAtlas const&) = delete;
+
+        ID3D11ShaderResourceView* Get() const { return m_view.Get(); }
+
+        // Named after the atlas file, as materials moved onto it refer to it
+        std::shared_ptr<const AtlasLayout> const& GetLayout() const { return m_layout; }
+
+        const AtlasRegion* Find(_In_z_ const wchar_t* fileName) const { return m_layout->Find(fileName); }
+
+        // All of its mips
+        size_t GetResidentBytes() const { return m_residentBytes; }
+
+        // The member's texels in the page, as SpriteBatch's source rectangle.
+        static RECT GetSourceRect(AtlasRegion const& region);
+
+        // SpriteBatch::Draw of the whole member, between the batch's Begin and End.
+        void XM_CALLCONV Draw(DirectX::SpriteBatch& batch, AtlasRegion const& region, RECT const& destination,
+            DirectX::FXMVECTOR color = DirectX::Colors::White) const;
+        void XM_CALLCONV Draw(DirectX::SpriteBatch& batch, AtlasRegion const& region, DirectX::XMFLOAT2 const& position,
+            DirectX::FXMVECTOR color = DirectX::Colors::White) const;
+
+    private:
+        void CreateFromSource(_In_ ID3D11Device* device, _In_ ID3D11DeviceContext* context, _In_opt_ const PackFile* pack,
+            std::wstring const& fileName, std::vector<uint8_t> const& source, AtlasLayout& layout);
+
+        std::shared_ptr<const AtlasLayout>                  m_layout;
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>    m_view;
+        size_t                                              m_residentBytes;
+    };
+}
@@ -0,0 +1,989 @@
+//
+// TextureStreamer.cpp - DDS textures that start at their smallest mips and stream the rest on demand
+//
+
+#include "pch.h"
+#include "TextureStreamer.h"
+#include "DDSFormat.h"
+#include "ImageTextureLoader.h"
+#include "Profiler.h"
+#include "ReadContent.h"
+
+#include <DDSTextureLoader.h>
+#include <WICTextureLoader.h>
+
+using namespace DirectX;
+using namespace DX;
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+    const uint32_t c_Caps2Cubemap = 0x00000200;
+    const uint32_t c_Caps2Volume = 0x00200000;
+    const uint32_t c_ResourceDimensionTexture2D = 3;
+    const uint32_t c_MiscTextureCube = 0x4;
+
+    double MillisecondsSince(const LARGE_INTEGER& start)
+    {
+        LARGE_INTEGER end, frequency;
+        QueryPerformanceCounter(&end);
+        QueryPerformanceFrequency(&frequency);
+        return double(end.QuadPart - start.QuadPart) * 1000.0 / double(frequency.QuadPart);
+    }
+
+    bool IsDDS(const std::vector<uint8_t>& bytes)
+    {
+        return bytes.size() >= 4 && memcmp(bytes.data(), "DDS ", 4) == 0;
+    }
+
+    // The formats DDSTextureLoader gives legacy headers, for the ones the streamer handles
+    DXGI_FORMAT GetLegacyFormat(const DDS::PixelFormat& format)
+    {
+        if (format.flags & DDS::c_PixelFourCC)
+        {
+            switch (format.fourCC)
+            {
+            case DDS::MakeFourCC('D', 'X', 'T', '1'):   return DXGI_FORMAT_BC1_UNORM;
+            case DDS::MakeFourCC('D', 'X', 'T', '2'):
+            case DDS::MakeFourCC('D', 'X', 'T', '3'):   return DXGI_FORMAT_BC2_UNORM;
+            case DDS::MakeFourCC('D', 'X', 'T', '4'):
+            case DDS::MakeFourCC('D', 'X', 'T', '5'):   return DXGI_FORMAT_BC3_UNORM;
+            case DDS::MakeFourCC('A', 'T', 'I', '1'):
+            case DDS::MakeFourCC('B', 'C', '4', 'U'):   return DXGI_FORMAT_BC4_UNORM;
+            case DDS::MakeFourCC('A', 'T', 'I', '2'):
+            case DDS::MakeFourCC('B', 'C', '5', 'U'):   return DXGI_FORMAT_BC5_UNORM;
+            case 113:                                   return DXGI_FORMAT_R16G16B16A16_FLOAT;
+            default:                                    break;
+            }
+        }
+        else if ((format.flags & DDS::c_PixelRGB) && format.RGBBitCount == 32)
+        {
+            if (format.RBitMask == 0x000000FF && format.GBitMask == 0x0000FF00 && format.BBitMask == 0x00FF0000 && format.ABitMask == 0xFF000000)
+                return DXGI_FORMAT_R8G8B8A8_UNORM;
+            if (format.RBitMask == 0x00FF0000 && format.GBitMask == 0x0000FF00 && format.BBitMask == 0x000000FF)
+                return format.ABitMask == 0xFF000000 ? DXGI_FORMAT_B8G8R8A8_UNORM : DXGI_FORMAT_B8G8R8X8_UNORM;
+        }
+        return DXGI_FORMAT_UNKNOWN;
+    }
+
+    // Bytes per 4x4 block, or per texel when not block-compressed; zero for formats the
+    // streamer leaves to DDSTextureLoader
+    UINT GetElementBytes(DXGI_FORMAT format, bool& compressed)
+    {
+        compressed = true;
+        switch (format)
+        {
+        case DXGI_FORMAT_BC1_UNORM:
+        case DXGI_FORMAT_BC1_UNORM_SRGB:
+        case DXGI_FORMAT_BC4_UNORM:
+        case DXGI_FORMAT_BC4_SNORM:
+            return 8;
+
+        case DXGI_FORMAT_BC2_UNORM:
+        case DXGI_FORMAT_BC2_UNORM_SRGB:
+        case DXGI_FORMAT_BC3_UNORM:
+        case DXGI_FORMAT_BC3_UNORM_SRGB:
+        case DXGI_FORMAT_BC5_UNORM:
+        case DXGI_FORMAT_BC5_SNORM:
+        case DXGI_FORMAT_BC6H_UF16:
+        case DXGI_FORMAT_BC6H_SF16:
+        case DXGI_FORMAT_BC7_UNORM:
+        case DXGI_FORMAT_BC7_UNORM_SRGB:
+            return 16;
+
+        default:
+            break;
+        }
+
+        compressed = false;
+        switch (format)
+        {
+        case DXGI_FORMAT_R8_UNORM:
+            return 1;
+
+        case DXGI_FORMAT_R8G8_UNORM:
+            return 2;
+
+        case DXGI_FORMAT_R8G8B8A8_UNORM:
+        case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+        case DXGI_FORMAT_B8G8R8A8_UNORM:
+        case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+        case DXGI_FORMAT_B8G8R8X8_UNORM:
+        case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+        case DXGI_FORMAT_R10G10B10A2_UNORM:
+            return 4;
+
+        case DXGI_FORMAT_R16G16B16A16_FLOAT:
+            return 8;
+
+        default:
+            return 0;
+        }
+    }
+
+    D3D11_TEXTURE2D_DESC GetDesc(DXGI_FORMAT format, UINT width, UINT height, UINT mipLevels)
+    {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = width;
+        desc.Height = height;
+        desc.MipLevels = mipLevels;
+        desc.ArraySize = 1;
+        desc.Format = format;
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        return desc;
+    }
+
+    // Whether a view loaded elsewhere may stand in for a texture the streamer would stream: a 2D
+    // texture only with every mip, as the streamer would give it, and anything else as it is.
+    bool HasMipChain(ID3D11ShaderResourceView* view)
+    {
+        ComPtr<ID3D11Resource> resource;
+        view->GetResource(resource.GetAddressOf());
+
+        ComPtr<ID3D11Texture2D> texture2D;
+        if (FAILED(resource.As(&texture2D)))
+            return true;
+
+        D3D11_TEXTURE2D_DESC desc;
+        texture2D->GetDesc(&desc);
+
+        UINT levels = 1;
+        for (UINT size = std::max(desc.Width, desc.Height); size > 1; size >>= 1)
+        {
+            ++levels;
+        }
+        return desc.MipLevels >= levels;
+    }
+}
+
+TextureStreamer::TextureStreamer(ID3D11Device* device, JobSystem& jobs, ResourceRegistry& registry, const PackFile* pack,
+    size_t budget, size_t uploadBudget) :
+    m_device(device),
+    m_jobs(jobs),
+    m_registry(registry),
+    m_pack(pack),
+    m_budget(budget),
+    m_uploadBudget(uploadBudget),
+    m_frame(0),
+    m_residentBytes(0),
+    m_reservedBytes(0),
+    m_stats{}
+{
+    m_parallelFor = [this](size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)
+    {
+        m_jobs.ParallelFor(count, grain, body);
+    };
+
+    // Opaque white, as AssetStreamer's, so a textured draw shows the material colour meanwhile
+    static const uint32_t s_white = 0xFFFFFFFF;
+
+    auto desc = GetDesc(DXGI_FORMAT_R8G8B8A8_UNORM, 1, 1, 1);
+    desc.Usage = D3D11_USAGE_IMMUTABLE;
+
+    D3D11_SUBRESOURCE_DATA initData = { &s_white, sizeof(uint32_t), 0 };
+
+    ComPtr<ID3D11Texture2D> texture;
+    DX::ThrowIfFailed(m_device->CreateTexture2D(&desc, &initData, texture.GetAddressOf()));
+    DX::ThrowIfFailed(m_device->CreateShaderResourceView(texture.Get(), nullptr, m_placeholder.GetAddressOf()));
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    // Read and decode jobs still point back here
+    for (auto& job : m_readJobs)
+    {
+        m_jobs.Wait(job);
+    }
+}
+
+TextureStreamer::TextureHandle TextureStreamer::Request(const wchar_t* fileName)
+{
+    const auto path = m_registry.Intern(fileName);
+    auto it = m_textures.find(path);
+    if (it != m_textures.end())
+        return it->second;
+
+    DX_PROFILE_SCOPE("RequestTexture");
+
+    auto texture = std::make_shared<Texture>();
+    texture->m_name = fileName;
+    texture->m_path = path;
+    texture->m_lastUsed = m_frame;
+
+    auto shared = m_registry.FindTexture(path);
+    if (shared && HasMipChain(shared.Get()))
+    {
+        // Its memory is the loader's that created it
+        texture->m_view = shared;
+        ++m_stats.shared;
+    }
+    else if (CreateTail(*texture))
+    {
+        ++m_stats.streamable;
+        m_stats.fullBytes += GetLevelBytes(*texture, 0, texture->GetMipCount());
+    }
+    else
+    {
+        // Zero for an image until it is decoded
+        CreateWhole(texture);
+        m_stats.fullBytes += texture->m_residentBytes;
+    }
+    ++m_stats.textures;
+
+    m_textures.emplace(path, texture);
+    return texture;
+}
+
+TextureStreamer::TextureHandle TextureStreamer::Register(const wchar_t* fileName, ID3D11ShaderResourceView* view, size_t residentBytes)
+{
+    const auto path = m_registry.Intern(fileName);
+    if (m_textures.find(path) != m_textures.end())
+        throw std::exception("TextureStreamer: texture registered after it was requested");
+
+    auto texture = std::make_shared<Texture>();
+    texture->m_name = fileName;
+    texture->m_path = path;
+    texture->m_lastUsed = m_frame;
+    texture->m_view = view;
+    SetResidency(*texture, 0, residentBytes);
+    Publish(*texture);
+
+    m_stats.fullBytes += residentBytes;
+    ++m_stats.textures;
+
+    m_textures.emplace(path, texture);
+    return texture;
+}
+
+// Cooked textures keep their source's name, so DDS files are told apart by their magic number
+bool TextureStreamer::CreateTail(Texture& texture)
+{
+    if (m_pack)
+    {
+        texture.m_entry = m_pack->Find(texture.m_name.c_str());
+    }
+    if (!texture.m_entry)
+    {
+        texture.m_file = std::make_unique<MappedFile>(texture.m_name.c_str());
+    }
+
+    if (!ReadLayout(texture))
+    {
+        texture.m_entry = nullptr;
+        texture.m_file.reset();
+        texture.m_mips.clear();
+        return false;
+    }
+
+    const uint32_t tail = texture.m_tailMip;
+    const uint32_t count = texture.GetMipCount();
+    const size_t bytes = GetLevelBytes(texture, tail, count);
+
+    std::vector<uint8_t> data(bytes);
+    ReadSource(texture, texture.m_mips[tail].offset, bytes, data.data());
+    m_stats.bytesRead += bytes;
+
+    std::vector<D3D11_SUBRESOURCE_DATA> initData(count - tail);
+    const uint8_t* source = data.data();
+    for (uint32_t level = tail; level < count; ++level)
+    {
+        initData[level - tail] = { source, texture.m_mips[level].rowPitch, 0 };
+        source += texture.m_mips[level].size;
+    }
+
+    auto& top = texture.m_mips[tail];
+    auto desc = GetDesc(texture.m_format, top.width, top.height, count - tail);
+    DX::ThrowIfFailed(m_device->CreateTexture2D(&desc, initData.data(), texture.m_texture.ReleaseAndGetAddressOf()));
+    DX::ThrowIfFailed(m_device->CreateShaderResourceView(texture.m_texture.Get(), nullptr, texture.m_view.ReleaseAndGetAddressOf()));
+
+    SetResidency(texture, tail, bytes);
+    return true;
+}
+
+// Fills in the format and where each level lies in the file. False for anything the streamer
+// leaves to DDSTextureLoader, including headers that loader would reject.
+bool TextureStreamer::ReadLayout(Texture& texture)
+{
+    const uint64_t fileSize = texture.m_entry ? texture.m_entry->size : texture.m_file->size();
+
+    uint8_t header[sizeof(uint32_t) + sizeof(DDS::Header) + sizeof(DDS::HeaderDXT10)] = {};
+    const size_t headerSize = size_t(std::min<uint64_t>(sizeof(header), fileSize));
+    ReadSource(texture, 0, headerSize, header);
+    m_stats.bytesRead += headerSize;
+
+    uint32_t magic;
+    DDS::Header dds;
+    memcpy(&magic, header, sizeof(magic));
+    memcpy(&dds, header + sizeof(magic), sizeof(dds));
+
+    if (headerSize < sizeof(magic) + sizeof(dds) || magic != DDS::c_Magic
+        || dds.size != sizeof(DDS::Header) || dds.ddspf.size != sizeof(DDS::PixelFormat))
+        return false;
+
+    if ((dds.caps2 & (c_Caps2Cubemap | c_Caps2Volume)) || ((dds.flags & DDS::c_FlagDepth) && dds.depth > 1))
+        return false;
+
+    uint64_t offset = sizeof(magic) + sizeof(dds);
+    DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+    if ((dds.ddspf.flags & DDS::c_PixelFourCC) && dds.ddspf.fourCC == DDS::MakeFourCC('D', 'X', '1', '0'))
+    {
+        if (headerSize < sizeof(header))
+            return false;
+
+        DDS::HeaderDXT10 dx10;
+        memcpy(&dx10, header + offset, sizeof(dx10));
+        if (dx10.resourceDimension != c_ResourceDimensionTexture2D || dx10.arraySize != 1 || (dx10.miscFlag & c_MiscTextureCube))
+            return false;
+
+        format = DXGI_FORMAT(dx10.dxgiFormat);
+        offset += sizeof(dx10);
+    }
+    else
+    {
+        format = GetLegacyFormat(dds.ddspf);
+    }
+
+    bool compressed;
+    const UINT elementBytes = GetElementBytes(format, compressed);
+    const uint32_t mipCount = std::max(dds.mipMapCount, 1u);
+    if (!elementBytes || !dds.width || !dds.height
+        || dds.width > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION || dds.height > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION
+        || mipCount > D3D11_REQ_MIP_LEVELS)
+        return false;
+
+    texture.m_format = format;
+    texture.m_mips.clear();
+
+    UINT width = dds.width;
+    UINT height = dds.height;
+    for (uint32_t level = 0; level < mipCount; ++level)
+    {
+        Texture::Mip mip;
+        mip.offset = offset;
+        mip.width = width;
+        mip.height = height;
+
+        UINT rows;
+        if (compressed)
+        {
+            mip.rowPitch = std::max(1u, (width + 3) / 4) * elementBytes;
+            rows = std::max(1u, (height + 3) / 4);
+            mip.canBeTop = !level || (width % 4 == 0 && height % 4 == 0);
+        }
+        else
+        {
+            mip.rowPitch = width * elementBytes;
+            rows = height;
+            mip.canBeTop = true;
+        }
+        mip.size = size_t(mip.rowPitch) * rows;
+
+        texture.m_mips.push_back(mip);
+        offset += mip.size;
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+    }
+
+    if (offset > fileSize)
+        throw std::exception("TextureStreamer: DDS file is truncated");
+
+    // The tail is the sharpest level small enough; a texture that is all tail, or has no
+    // small enough level, is simply loaded whole
+    uint32_t tail = 0;
+    while (tail < mipCount
+        && (!texture.m_mips[tail].canBeTop || std::max(texture.m_mips[tail].width, texture.m_mips[tail].height) > c_TailSize))
+    {
+        ++tail;
+    }
+    if (tail == 0 || tail == mipCount)
+        return false;
+
+    texture.m_tailMip = tail;
+    return true;
+}
+
+void TextureStreamer::CreateWhole(TexturePtr const& texture)
+{
+    auto bytes = DX::ReadContent(m_pack, texture->m_name.c_str(), m_parallelFor);
+    m_stats.bytesRead += bytes.size();
+
+    if (!IsDDS(bytes) && DetectImageFormat(bytes.data(), bytes.size()) != ImageFileFormat::Unknown)
+    {
+        StartDecode(texture, std::move(bytes));
+        return;
+    }
+
+    ComPtr<ID3D11Resource> resource;
+    size_t residentBytes = bytes.size();
+    if (IsDDS(bytes))
+    {
+        DX::ThrowIfFailed(
+            CreateDDSTextureFromMemory(m_device.Get(), bytes.data(), bytes.size(),
+                resource.GetAddressOf(), texture->m_view.ReleaseAndGetAddressOf()));
+    }
+    else
+    {
+        // TIFF, GIF and the rest of what WIC decodes
+        DX::ThrowIfFailed(
+            CreateWICTextureFromMemory(m_device.Get(), bytes.data(), bytes.size(),
+                resource.GetAddressOf(), texture->m_view.ReleaseAndGetAddressOf()));
+
+        // Estimated: WICTextureLoader converts to one level of 32-bit texels for most images
+        ComPtr<ID3D11Texture2D> texture2D;
+        if (SUCCEEDED(resource.As(&texture2D)))
+        {
+            D3D11_TEXTURE2D_DESC desc;
+            texture2D->GetDesc(&desc);
+            residentBytes = size_t(desc.Width) * desc.Height * 4;
+        }
+    }
+
+    SetResidency(*texture, 0, residentBytes);
+    Publish(*texture);
+}
+
+// Only views that never change are shared; a streaming texture's is replaced with its mips
+void TextureStreamer::Publish(Texture const& texture)
+{
+    m_registry.AddTexture(texture.m_path, texture.m_view.Get());
+}
+
+// The texture shows the placeholder until UploadFinished creates it from the decoded image.
+// Nothing is reserved against the budget, as images are never evicted.
+void TextureStreamer::StartDecode(TexturePtr const& texture, std::vector<uint8_t>&& bytes)
+{
+    auto load = std::make_shared<Load>();
+    load->texture = texture;
+    load->top = 0;
+    load->size = 0;
+    load->bytes = std::move(bytes);
+    load->image = std::make_unique<DecodedImage>();
+
+    texture->m_view = m_placeholder;
+    texture->m_loading = true;
+    ++m_stats.loadsPending;
+
+    m_readJobs.push_back(m_jobs.Submit([this, load]()
+    {
+        DX_PROFILE_SCOPE("DecodeTexture");
+
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+
+        try
+        {
+            DecodeImage(load->bytes.data(), load->bytes.size(), *load->image);
+            load->size = load->image->pixels.size();
+        }
+        catch (...)
+        {
+            load->error = std::current_exception();
+        }
+        std::vector<uint8_t>().swap(load->bytes);
+        load->readMs = MillisecondsSince(start);
+
+        std::lock_guard<std::mutex> lock(m_finishedMutex);
+        m_finished.push_back(load);
+    }));
+}
+
+// With its mips generated on the GPU, as WICTextureLoader creates textures given a context
+void TextureStreamer::CreateFromImage(ID3D11DeviceContext* context, Texture& texture, DecodedImage const& image)
+{
+    ComPtr<ID3D11Resource> resource;
+    ComPtr<ID3D11ShaderResourceView> view;
+    DX::ThrowIfFailed(CreateTextureFromImage(m_device.Get(), context, image, resource.GetAddressOf(), view.GetAddressOf()));
+
+    ComPtr<ID3D11Texture2D> created;
+    DX::ThrowIfFailed(resource.As(&created));
+
+    D3D11_TEXTURE2D_DESC desc;
+    created->GetDesc(&desc);
+
+    size_t bytes = 0;
+    for (UINT level = 0; level < desc.MipLevels; ++level)
+    {
+        bytes += size_t(std::max(desc.Width >> level, 1u)) * std::max(desc.Height >> level, 1u) * 4;
+    }
+
+    texture.m_texture.Swap(created);
+    texture.m_view.Swap(view);
+    ++texture.m_version;
+
+    SetResidency(texture, 0, bytes);
+    Publish(texture);
+}
+
+void TextureStreamer::ReadSource(Texture const& texture, uint64_t offset, size_t size, uint8_t* destination) const
+{
+    if (texture.m_entry)
+    {
+        m_pack->ReadRange(*texture.m_entry, offset, size, destination, m_parallelFor);
+        return;
+    }
+
+    const size_t fileSize = texture.m_file->size();
+    if (offset > fileSize || size > fileSize - offset)
+        throw std::exception("TextureStreamer: read past the end of a file");
+
+    if (size)
+    {
+        memcpy(destination, texture.m_file->data() + offset, size);
+    }
+}
+
+size_t TextureStreamer::GetLevelBytes(Texture const& texture, uint32_t first, uint32_t last)
+{
+    size_t bytes = 0;
+    for (uint32_t level = first; level < last; ++level)
+    {
+        bytes += texture.m_mips[level].size;
+    }
+    return bytes;
+}
+
+// Replaces the texture with one holding levels [top, end). Levels it gains are uploaded from
+// newLevels, in file order; levels it keeps are copied on the GPU.
+void TextureStreamer::Recreate(ID3D11DeviceContext* context, Texture& texture, uint32_t top, const uint8_t* newLevels)
+{
+    const uint32_t count = texture.GetMipCount();
+    const uint32_t oldTop = texture.m_residentMip;
+
+    auto desc = GetDesc(texture.m_format, texture.m_mips[top].width, texture.m_mips[top].height, count - top);
+    ComPtr<ID3D11Texture2D> replacement;
+    DX::ThrowIfFailed(m_device->CreateTexture2D(&desc, nullptr, replacement.GetAddressOf()));
+
+    const uint8_t* source = newLevels;
+    for (uint32_t level = top; level < count; ++level)
+    {
+        if (level < oldTop)
+        {
+            context->UpdateSubresource(replacement.Get(), level - top, nullptr, source, texture.m_mips[level].rowPitch, 0);
+            source += texture.m_mips[level].size;
+        }
+        else
+        {
+            context->CopySubresourceRegion(replacement.Get(), level - top, 0, 0, 0, texture.m_texture.Get(), level - oldTop, nullptr);
+        }
+    }
+
+    ComPtr<ID3D11ShaderResourceView> view;
+    DX::ThrowIfFailed(m_device->CreateShaderResourceView(replacement.Get(), nullptr, view.GetAddressOf()));
+
+    texture.m_texture.Swap(replacement);
+    texture.m_view.Swap(view);
+    ++texture.m_version;
+
+    SetResidency(texture, top, GetLevelBytes(texture, top, count));
+}
+
+void TextureStreamer::SetResidency(Texture& texture, uint32_t top, size_t bytes)
+{
+    m_residentBytes = m_residentBytes - texture.m_residentBytes + bytes;
+    m_stats.peakResidentBytes = std::max(m_stats.peakResidentBytes, m_residentBytes);
+
+    texture.m_residentMip = top;
+    texture.m_residentBytes = bytes;
+}
+
+// The smallest level still at least 'pixels' across, so the sampler never magnifies it;
+// the tail when the texture was not drawn at all.
+uint32_t TextureStreamer::GetMipForPixels(Texture const& texture, uint32_t pixels) const
+{
+    uint32_t level = 0;
+    while (level < texture.m_tailMip)
+    {
+        auto& next = texture.m_mips[level + 1];
+        if (std::max(next.width, next.height) < pixels)
+            break;
+        ++level;
+    }
+
+    while (!texture.m_mips[level].canBeTop)
+    {
+        --level;
+    }
+    return level;
+}
+
+void TextureStreamer::Demand(Texture const& texture, float pixels) const
+{
+    // Any report, however small, marks the texture used this frame
+    const uint32_t value = (pixels > 1.f) ? uint32_t(std::min(pixels, 65536.f)) : 1u;
+
+    uint32_t current = texture.m_demand.load(std::memory_order_relaxed);
+    while (current < value && !texture.m_demand.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+void TextureStreamer::Update(ID3D11DeviceContext* context)
+{
+    DX_PROFILE_SCOPE("StreamTextures");
+
+    ++m_frame;
+    UploadFinished(context, m_uploadBudget);
+    StartLoads(context);
+    RefreshBindings();
+}
+
+void TextureStreamer::Flush(ID3D11DeviceContext* context)
+{
+    DX_PROFILE_SCOPE("FlushTextures");
+
+    while (m_stats.loadsPending)
+    {
+        auto jobs = m_readJobs;
+        for (auto& job : jobs)
+        {
+            m_jobs.Wait(job);
+        }
+        UploadFinished(context, SIZE_MAX);
+    }
+    RefreshBindings();
+}
+
+void TextureStreamer::StartLoads(ID3D11DeviceContext* context)
+{
+    // The demand reported since the last update decides the level each texture should have
+    std::vector<TexturePtr> wanting;
+    for (auto& pair : m_textures)
+    {
+        auto& texture = *pair.second;
+        const uint32_t demand = texture.m_demand.exchange(0, std::memory_order_relaxed);
+        if (!texture.IsStreamable())
+            continue;
+
+        if (demand)
+        {
+            texture.m_lastUsed = m_frame;
+        }
+        texture.m_wantedMip = GetMipForPixels(texture, demand);
+
+        if (!texture.m_loading && texture.m_wantedMip < texture.m_residentMip)
+        {
+            wanting.push_back(pair.second);
+        }
+    }
+
+    // Blurriest first, by the levels each is missing
+    std::sort(wanting.begin(), wanting.end(), [](TexturePtr const& a, TexturePtr const& b)
+    {
+        return a->m_residentMip - a->m_wantedMip > b->m_residentMip - b->m_wantedMip;
+    });
+
+    for (auto& texture : wanting)
+    {
+        const uint32_t top = texture->m_wantedMip;
+        const size_t size = GetLevelBytes(*texture, top, texture->m_residentMip);
+        if (!MakeRoom(context, size))
+        {
+            ++m_stats.budgetMisses;
+            continue;
+        }
+
+        auto load = std::make_shared<Load>();
+        load->texture = texture;
+        load->top = top;
+        load->size = size;
+
+        texture->m_loading = true;
+        m_reservedBytes += size;
+        ++m_stats.loadsPending;
+
+        m_readJobs.push_back(m_jobs.Submit([this, load]()
+        {
+            DX_PROFILE_SCOPE("ReadTextureMips");
+
+            LARGE_INTEGER start;
+            QueryPerformanceCounter(&start);
+
+            try
+            {
+                auto& source = *load->texture;
+                load->bytes.resize(load->size);
+                ReadSource(source, source.m_mips[load->top].offset, load->size, load->bytes.data());
+            }
+            catch (...)
+            {
+                load->error = std::current_exception();
+            }
+            load->readMs = MillisecondsSince(start);
+
+            std::lock_guard<std::mutex> lock(m_finishedMutex);
+            m_finished.push_back(load);
+        }));
+    }
+}
+
+// Evicts levels until 'bytes' more fit in the budget, or returns false, evicting nothing, when
+// they cannot. Victims are textures holding levels sharper than they are drawn at (every level
+// above the tail, for those not drawn this frame), least recently used first.
+bool TextureStreamer::MakeRoom(ID3D11DeviceContext* context, size_t bytes)
+{
+    if (m_residentBytes + m_reservedBytes + bytes <= m_budget)
+        return true;
+
+    std::vector<Texture*> victims;
+    size_t freeable = 0;
+    for (auto& pair : m_textures)
+    {
+        auto& texture = *pair.second;
+        if (texture.IsStreamable() && !texture.m_loading && texture.m_residentMip < texture.m_wantedMip)
+        {
+            victims.push_back(&texture);
+            freeable += GetLevelBytes(texture, texture.m_residentMip, texture.m_wantedMip);
+        }
+    }
+
+    if (m_residentBytes + m_reservedBytes + bytes > m_budget + freeable)
+        return false;
+
+    std::sort(victims.begin(), victims.end(), [](const Texture* a, const Texture* b)
+    {
+        return a->m_lastUsed < b->m_lastUsed;
+    });
+
+    for (auto victim : victims)
+    {
+        m_stats.mipsEvicted += victim->m_wantedMip - victim->m_residentMip;
+        Recreate(context, *victim, victim->m_wantedMip, nullptr);
+
+        if (m_residentBytes + m_reservedBytes + bytes <= m_budget)
+            break;
+    }
+    return true;
+}
+
+bool TextureStreamer::UploadFinished(ID3D11DeviceContext* context, size_t budget)
+{
+    std::vector<std::shared_ptr<Load>> finished;
+    {
+        std::lock_guard<std::mutex> lock(m_finishedMutex);
+        finished.swap(m_finished);
+    }
+    m_readJobs.erase(std::remove_if(m_readJobs.begin(), m_readJobs.end(), JobSystem::IsDone), m_readJobs.end());
+
+    if (finished.empty())
+        return false;
+
+    DX_PROFILE_SCOPE("UploadTextureMips");
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    size_t spent = 0;
+    size_t uploaded = 0;
+    try
+    {
+        while (uploaded < finished.size())
+        {
+            auto& load = *finished[uploaded];
+            if (spent && spent + load.size > budget)
+                break;
+
+            spent += load.size;
+            ++uploaded;
+
+            // Uploaded or failed, it no longer holds its reservation
+            auto& texture = *load.texture;
+            texture.m_loading = false;
+            if (!load.image)
+            {
+                m_reservedBytes -= load.size;
+            }
+            --m_stats.loadsPending;
+            if (load.error)
+            {
+                std::rethrow_exception(load.error);
+            }
+
+            if (load.image)
+            {
+                ++m_stats.imagesDecoded;
+                m_stats.decodeMs += load.readMs;
+                CreateFromImage(context, texture, *load.image);
+                m_stats.fullBytes += texture.m_residentBytes;
+                continue;
+            }
+
+            m_stats.mipsLoaded += texture.m_residentMip - load.top;
+            m_stats.bytesRead += load.size;
+            m_stats.readMs += load.readMs;
+            Recreate(context, texture, load.top, load.bytes.data());
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(m_finishedMutex);
+        m_finished.insert(m_finished.end(), finished.begin() + uploaded, finished.end());
+        throw;
+    }
+
+    if (uploaded < finished.size())
+    {
+        std::lock_guard<std::mutex> lock(m_finishedMutex);
+        m_finished.insert(m_finished.end(), finished.begin() + uploaded, finished.end());
+    }
+
+    m_stats.uploadMs += MillisecondsSince(start);
+    return true;
+}
+
+TextureStreamer::Statistics TextureStreamer::GetStatistics() const
+{
+    auto stats = m_stats;
+    stats.residentBytes = m_residentBytes;
+    stats.budget = m_budget;
+    return stats;
+}
+
+// The textures DirectXTK's EffectFactory gives each kind of effect it makes
+void TextureStreamer::Bind(std::shared_ptr<IEffect> const& effect, IEffectFactory::EffectInfo const& info)
+{
+    EffectBinding binding;
+    binding.effect = effect;
+
+    auto bind = [&](const wchar_t* name, Slot slot)
+    {
+        if (!name || !*name)
+            return;
+
+        auto texture = Request(name);
+
+        // Images still decoding will replace their placeholder too
+        if (texture->IsStreamable() || texture->m_loading)
+        {
+            // A shared effect may come from the factory's cache holding an older view
+            SetEffectTexture(effect.get(), slot, texture->Get());
+            binding.textures.push_back({ slot, texture, texture->GetVersion() });
+        }
+    };
+
+    bind(info.diffuseTexture, Slot_Diffuse);
+    if (dynamic_cast<NormalMapEffect*>(effect.get()))
+    {
+        bind(info.specularTexture, Slot_Specular);
+        bind(info.normalTexture, Slot_Normal);
+    }
+    else if (dynamic_cast<DualTextureEffect*>(effect.get()))
+    {
+        bind((info.emissiveTexture && *info.emissiveTexture) ? info.emissiveTexture : info.specularTexture, Slot_Texture2);
+    }
+
+    if (binding.textures.empty())
+    {
+        m_bindings.erase(effect.get());
+    }
+    else
+    {
+        m_bindings[effect.get()] = std::move(binding);
+    }
+}
+
+void TextureStreamer::RefreshBindings()
+{
+    for (auto it = m_bindings.begin(); it != m_bindings.end();)
+    {
+        auto effect = it->second.effect.lock();
+        if (!effect)
+        {
+            it = m_bindings.erase(it);
+            continue;
+        }
+
+        for (auto& bound : it->second.textures)
+        {
+            if (bound.version != bound.texture->GetVersion())
+            {
+                SetEffectTexture(effect.get(), bound.slot, bound.texture->Get());
+                bound.version = bound.texture->GetVersion();
+            }
+        }
+        ++it;
+    }
+}
+
+void TextureStreamer::GetTextures(const IEffect* effect, std::vector<TextureHandle>& textures) const
+{
+    auto it = m_bindings.find(effect);
+    if (it == m_bindings.end())
+        return;
+
+    for (auto& bound : it->second.textures)
+    {
+        textures.push_back(bound.texture);
+    }
+}
+
+void TextureStreamer::SetEffectTexture(IEffect* effect, Slot slot, ID3D11ShaderResourceView* view)
+{
+    switch (slot)
+    {
+    case Slot_Diffuse:
+        if (auto normalMap = dynamic_cast<NormalMapEffect*>(effect))
+        {
+            normalMap->SetTexture(view);
+        }
+        else if (auto dual = dynamic_cast<DualTextureEffect*>(effect))
+        {
+            dual->SetTexture(view);
+        }
+        else if (auto skinned = dynamic_cast<SkinnedEffect*>(effect))
+        {
+            skinned->SetTexture(view);
+        }
+        else if (auto basic = dynamic_cast<BasicEffect*>(effect))
+        {
+            basic->SetTexture(view);
+        }
+        break;
+
+    case Slot_Normal:
+        if (auto normalMap = dynamic_cast<NormalMapEffect*>(effect))
+        {
+            normalMap->SetNormalTexture(view);
+        }
+        break;
+
+    case Slot_Specular:
+        if (auto normalMap = dynamic_cast<NormalMapEffect*>(effect))
+        {
+            normalMap->SetSpecularTexture(view);
+        }
+        break;
+
+    case Slot_Texture2:
+        if (auto dual = dynamic_cast<DualTextureEffect*>(effect))
+        {
+            dual->SetTexture2(view);
+        }
+        break;
+    }
+}
+
+TextureStreamer::EffectFactory::EffectFactory(ID3D11Device* device, TextureStreamer& streamer) :
+    ResourceRegistry::EffectFactory(device, streamer.m_registry),
+    m_streamer(streamer)
+{
+}
+
+std::shared_ptr<IEffect> TextureStreamer::EffectFactory::CreateEffect(const EffectInfo& info, ID3D11DeviceContext* deviceContext)
+{
+    auto effect = ResourceRegistry::EffectFactory::CreateEffect(info, deviceContext);
+    m_streamer.Bind(effect, info);
+    return effect;
+}
+
+void TextureStreamer::EffectFactory::CreateTexture(const wchar_t* name, ID3D11DeviceContext*, ID3D11ShaderResourceView** textureView)
+{
+    if (!name || !textureView)
+        throw std::exception("invalid arguments");
+
+    auto view = m_streamer.Request(name)->Get();
+    view->AddRef();
+    *textureView = view;
+}
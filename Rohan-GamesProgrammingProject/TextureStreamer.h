@@ -0,0 +1,257 @@
+//
+// TextureStreamer.h - DDS textures that start at their smallest mips and stream the rest on demand
+//
+
+#pragma once
+
+#include "ImageDecoder.h"
+#include "JobSystem.h"
+#include "MappedFile.h"
+#include "PackFile.h"
+#include "ResourceRegistry.h"
+
+#include <Effects.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace DX
+{
+    // A 2D DDS texture is created with only its mip tail, the levels c_TailSize texels across
+    // or smaller, which is a few KB however large the texture is. Each frame the game reports
+    // how many pixels across each texture is drawn (Demand, from any thread, typically from the
+    // screen size of the bounds of the meshes using it). Update then reads the sharper mips a
+    // texture is missing on the job system, straight from the pack or a mapped file, and once
+    // they are read recreates the texture with them, copying the levels it already had on the
+    // GPU. Uploads per frame are capped by a byte budget, as in AssetStreamer.
+    //
+    // Every resident mip counts against one VRAM budget. A load that would exceed it first
+    // evicts the top mips of the textures used least recently (those not drawn this frame, or
+    // sharper than they are now drawn), never below their tail; if that is not enough, the load
+    // waits, and the texture is drawn blurrier meanwhile.
+    //
+    // A texture's view changes whenever its resident mips do, so holders either call Get() each
+    // time they bind it or rebind when GetVersion() moves on; effects made by the streamer's
+    // EffectFactory are rebound by the streamer itself.
+    //
+    // PNG, JPEG and BMP images are decoded by ImageDecoder as jobs, so several decode at once
+    // and none on the main thread; until its upload the texture is a 1x1 white placeholder,
+    // and the upload generates its mips. Anything else (other image formats, cube maps, arrays,
+    // formats the streamer does not know) is loaded whole by DirectXTK when requested. Neither
+    // kind streams: both count against the budget but are never evicted.
+    //
+    // Textures are keyed by their path's id in the resource registry, and those loaded whole
+    // are added to it, so other loaders share them. A file the registry already holds loaded
+    // whole with its mips, by another loader, is used as it is, and is counted against that
+    // loader rather than this budget.
+    class TextureStreamer
+    {
+    public:
+        class Texture
+        {
+        public:
+            ID3D11ShaderResourceView* Get() const { return m_view.Get(); }
+            uint32_t GetVersion() const { return m_version; }
+
+            // The sharpest resident level, 0 when the whole chain is.
+            uint32_t GetResidentMip() const { return m_residentMip; }
+            uint32_t GetMipCount() const { return uint32_t(m_mips.size()); }   // zero when it does not stream
+            bool IsStreamable() const { return m_tailMip > 0; }
+
+        private:
+            friend class TextureStreamer;
+
+            struct Mip
+            {
+                uint64_t    offset;         // into the file
+                size_t      size;
+                UINT        width;
+                UINT        height;
+                UINT        rowPitch;
+                bool        canBeTop;       // block-compressed tops must be whole blocks
+            };
+
+            std::wstring                                        m_name;
+            ResourceRegistry::PathId                            m_path = ResourceRegistry::c_NoPath;
+            const PackFile::Entry*                              m_entry = nullptr;
+            std::unique_ptr<MappedFile>                         m_file;
+            DXGI_FORMAT                                         m_format = DXGI_FORMAT_UNKNOWN;
+            std::vector<Mip>                                    m_mips;
+            uint32_t                                            m_tailMip = 0;
+
+            Microsoft::WRL::ComPtr<ID3D11Texture2D>             m_texture;
+            Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>    m_view;
+            uint32_t                                            m_version = 0;
+            uint32_t                                            m_residentMip = 0;
+            size_t                                              m_residentBytes = 0;
+
+            mutable std::atomic<uint32_t>                       m_demand{ 0 };  // pixels across, this frame
+            uint32_t                                            m_wantedMip = 0;
+            uint64_t                                            m_lastUsed = 0; // frame
+            bool                                                m_loading = false;  // or decoding
+        };
+
+        using TextureHandle = std::shared_ptr<const Texture>;
+
+        struct Statistics
+        {
+            size_t  textures;
+            size_t  streamable;
+            size_t  residentBytes;
+            size_t  peakResidentBytes;
+            size_t  fullBytes;          // were every mip of every texture resident
+            size_t  budget;
+            size_t  mipsLoaded;
+            size_t  mipsEvicted;
+            size_t  bytesRead;
+            size_t  loadsPending;
+            size_t  budgetMisses;       // loads put off because nothing more could be evicted
+            size_t  imagesDecoded;
+            size_t  shared;             // found in the resource registry, loaded by another
+            double  readMs;             // summed over the read jobs
+            double  decodeMs;           // summed over the decode jobs
+            double  uploadMs;
+        };
+
+        static const UINT c_TailSize = 64;
+        static const size_t c_DefaultBudget = 64 * 1024 * 1024;
+        static const size_t c_DefaultUploadBudget = 8 * 1024 * 1024;
+
+        // The registry, and the pack when given, must outlive the streamer.
+        TextureStreamer(_In_ ID3D11Device* device, JobSystem& jobs, ResourceRegistry& registry, _In_opt_ const PackFile* pack = nullptr,
+            size_t budget = c_DefaultBudget, size_t uploadBudget = c_DefaultUploadBudget);
+        ~TextureStreamer();
+
+        TextureStreamer(TextureStreamer const&) = delete;
+        TextureStreamer& operator= (TextureStreamer const&) = delete;
+
+        // Main thread. Creates the texture with its tail (or whole, if it cannot stream) before
+        // returning, or for an image the placeholder, starting its decode; requests for a file
+        // already requested return the same handle. Throws if the file is missing or damaged,
+        // or for an image, from the Update that would have uploaded it.
+        TextureHandle Request(_In_z_ const wchar_t* fileName);
+
+        // Main thread: makes requests for the file name return this view, for textures the game
+        // creates itself, such as an atlas. It counts against the budget but is never evicted.
+        // Throws if the name was already requested.
+        TextureHandle Register(_In_z_ const wchar_t* fileName, _In_ ID3D11ShaderResourceView* view, size_t residentBytes);
+
+        // Any thread: the texture is drawn this frame at about this many pixels across. The
+        // largest report of the frame wins.
+        void Demand(Texture const& texture, float pixels) const;
+
+        // Main thread, once a frame: uploads finished reads within the upload budget, then
+        // starts reads for textures drawn sharper than they are resident, evicting as needed.
+        void Update(_In_ ID3D11DeviceContext* context);
+
+        // Main thread: waits for every read and decode in flight and uploads it, ignoring the
+        // upload budget.
+        void Flush(_In_ ID3D11DeviceContext* context);
+
+        Statistics GetStatistics() const;
+
+        // Main thread: appends the streamable textures an effect made by the EffectFactory below
+        // samples, for the game to report demand for.
+        void GetTextures(_In_ const DirectX::IEffect* effect, std::vector<TextureHandle>& textures) const;
+
+        // An EffectFactory that takes its textures from the streamer, so a model's materials
+        // start at their tails, and shares its effects through the streamer's registry. The
+        // streamer remembers which textures each effect it made samples, and rebinds them in
+        // Update whenever their resident mips change.
+        class EffectFactory : public ResourceRegistry::EffectFactory
+        {
+        public:
+            EffectFactory(_In_ ID3D11Device* device, TextureStreamer& streamer);
+
+            std::shared_ptr<DirectX::IEffect> __cdecl CreateEffect(_In_ const EffectInfo& info,
+                _In_opt_ ID3D11DeviceContext* deviceContext) override;
+            void __cdecl CreateTexture(_In_z_ const wchar_t* name, _In_opt_ ID3D11DeviceContext* deviceContext,
+                _Outptr_ ID3D11ShaderResourceView** textureView) override;
+
+        private:
+            TextureStreamer& m_streamer;
+        };
+
+    private:
+        using TexturePtr = std::shared_ptr<Texture>;
+
+        struct Load
+        {
+            TexturePtr                      texture;
+            uint32_t                        top;            // reading levels [top, the texture's resident mip)
+            size_t                          size;
+            std::vector<uint8_t>            bytes;
+            std::unique_ptr<DecodedImage>   image;          // set instead for a whole image, decoded from bytes
+            double                          readMs = 0;     // or to decode, for an image
+            std::exception_ptr              error;
+        };
+
+        enum Slot
+        {
+            Slot_Diffuse,
+            Slot_Normal,
+            Slot_Specular,
+            Slot_Texture2,      // DualTextureEffect's second texture
+        };
+
+        struct BoundTexture
+        {
+            Slot            slot;
+            TextureHandle   texture;
+            uint32_t        version;                // of the view the effect holds
+        };
+
+        struct EffectBinding
+        {
+            std::weak_ptr<DirectX::IEffect> effect;
+            std::vector<BoundTexture>       textures;
+        };
+
+        // Mips [first, last) lie back to back in a DDS file, so this is also the size of one read
+        static size_t GetLevelBytes(Texture const& texture, uint32_t first, uint32_t last);
+        static void SetEffectTexture(_In_ DirectX::IEffect* effect, Slot slot, _In_opt_ ID3D11ShaderResourceView* view);
+
+        bool CreateTail(Texture& texture);
+        bool ReadLayout(Texture& texture);
+        void CreateWhole(TexturePtr const& texture);
+        void Publish(Texture const& texture);
+        void StartDecode(TexturePtr const& texture, std::vector<uint8_t>&& bytes);
+        void CreateFromImage(_In_ ID3D11DeviceContext* context, Texture& texture, DecodedImage const& image);
+        void ReadSource(Texture const& texture, uint64_t offset, size_t size, uint8_t* destination) const;
+        void Recreate(_In_ ID3D11DeviceContext* context, Texture& texture, uint32_t top, _In_opt_ const uint8_t* newLevels);
+        void SetResidency(Texture& texture, uint32_t top, size_t bytes);
+        uint32_t GetMipForPixels(Texture const& texture, uint32_t pixels) const;
+        void StartLoads(_In_ ID3D11DeviceContext* context);
+        bool MakeRoom(_In_ ID3D11DeviceContext* context, size_t bytes);
+        bool UploadFinished(_In_ ID3D11DeviceContext* context, size_t budget);
+        void Bind(std::shared_ptr<DirectX::IEffect> const& effect, DirectX::IEffectFactory::EffectInfo const& info);
+        void RefreshBindings();
+
+        Microsoft::WRL::ComPtr<ID3D11Device>                    m_device;
+        JobSystem&                                              m_jobs;
+        ResourceRegistry&                                       m_registry;
+        const PackFile*                                         m_pack;
+        PackFile::ParallelFor                                   m_parallelFor;
+        size_t                                                  m_budget;
+        size_t                                                  m_uploadBudget;
+
+        std::unordered_map<ResourceRegistry::PathId, TexturePtr> m_textures;
+        std::unordered_map<const DirectX::IEffect*, EffectBinding> m_bindings;
+        uint64_t                                                m_frame;
+        size_t                                                  m_residentBytes;
+        size_t                                                  m_reservedBytes;    // by reads in flight
+
+        // Reads and decodes in flight (main thread only), and those finished but not yet uploaded
+        std::vector<JobSystem::Handle>                          m_readJobs;
+        std::mutex                                              m_finishedMutex;
+        std::vector<std::shared_ptr<Load>>                      m_finished;
+
+        Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>        m_placeholder;  // images being decoded
+
+        Statistics                                              m_stats;
+    };
+}
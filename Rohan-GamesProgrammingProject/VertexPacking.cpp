@@ -0,0 +1,481 @@
+//
+// VertexPacking.cpp - Compact vertex formats that the stock effects read unchanged
+//
+
+#include "VertexPacking.h"
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <numeric>
+#include <string.h>
+
+using namespace DX;
+
+namespace
+{
+    const float c_DegreesPerRadian = 57.2957795f;
+
+    enum ElementKind
+    {
+        Kind_Copy,
+        Kind_Position,
+        Kind_Direction,
+        Kind_TexCoord,
+    };
+
+    uint32_t GetFormatSize(ModelData::Format format)
+    {
+        switch (format)
+        {
+        case ModelData::Format_R32G32B32A32_Float:  return 16;
+        case ModelData::Format_R32G32B32_Float:     return 12;
+        case ModelData::Format_R16G16B16A16_Float:
+        case ModelData::Format_R16G16B16A16_SNorm:
+        case ModelData::Format_R32G32_Float:        return 8;
+        default:                                    return 4;
+        }
+    }
+
+    bool IsDirection(const char* semanticName)
+    {
+        return !strcmp(semanticName, "NORMAL") || !strcmp(semanticName, "TANGENT") || !strcmp(semanticName, "BINORMAL");
+    }
+
+    // The float position an element holds, if the stream can be packed at all: its elements
+    // must follow one another and fill the stride, so nothing is lost when it shrinks
+    const ModelData::VertexElement* FindPackablePosition(ModelData::VertexStream const& stream)
+    {
+        const ModelData::VertexElement* position = nullptr;
+        uint32_t offset = 0;
+        for (auto const& element : stream.elements)
+        {
+            if (element.offset != offset)
+                return nullptr;
+            offset += GetFormatSize(element.format);
+
+            if (!strcmp(element.semanticName, "SV_Position") && element.format == ModelData::Format_R32G32B32_Float)
+            {
+                position = &element;
+            }
+        }
+
+        if (offset != stream.stride || stream.size < size_t(stream.stride) * stream.vertexCount)
+            return nullptr;
+        return position;
+    }
+
+    float ReadFloat(const uint8_t* p)
+    {
+        float value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    int16_t PackSNorm16(float value)
+    {
+        return int16_t(lrintf(std::min(std::max(value, -1.f), 1.f) * 32767.f));
+    }
+
+    float UnpackSNorm(int value, float range)
+    {
+        return std::max(float(value) / range, -1.f);
+    }
+
+    float Length(const float* v)
+    {
+        return sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    }
+
+    // Union-find over the vertex streams
+    uint32_t FindGroup(std::vector<uint32_t>& groups, uint32_t stream)
+    {
+        while (groups[stream] != stream)
+        {
+            groups[stream] = groups[groups[stream]];
+            stream = groups[stream];
+        }
+        return stream;
+    }
+
+    struct Box
+    {
+        void Add(const float* point)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                minimum[i] = std::min(minimum[i], point[i]);
+                maximum[i] = std::max(maximum[i], point[i]);
+            }
+        }
+
+        float   minimum[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float   maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        bool    packable = true;
+    };
+}
+
+uint16_t DX::FloatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t magnitude = bits & 0x7FFFFFFF;
+
+    // NaN stays NaN; infinity, and anything rounding past 65504, is infinity
+    if (magnitude > 0x7F800000)
+        return uint16_t(sign | 0x7E00);
+    if (magnitude >= 0x477FF000)
+        return uint16_t(sign | 0x7C00);
+
+    uint32_t mantissa, shift, half;
+    if (magnitude < 0x38800000)
+    {
+        // Denormal: the value in units of 2^-24, from the mantissa with its implicit bit
+        shift = 126 - (magnitude >> 23);
+        if (shift > 24)
+            return uint16_t(sign);
+        mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+        half = mantissa >> shift;
+    }
+    else
+    {
+        shift = 13;
+        mantissa = magnitude;
+        half = ((magnitude >> 13) & 0x3FF) | (((magnitude >> 23) - 112) << 10);
+    }
+
+    // To nearest, ties to even; a carry out of the mantissa moves up an exponent, as it should
+    const uint32_t remainder = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half & 1)))
+    {
+        ++half;
+    }
+    return uint16_t(sign | half);
+}
+
+float DX::HalfToFloat(uint16_t value)
+{
+    const uint32_t sign = uint32_t(value & 0x8000) << 16;
+    const uint32_t exponent = (value >> 10) & 0x1F;
+    const uint32_t mantissa = value & 0x3FF;
+
+    float result;
+    if (exponent == 0)
+    {
+        result = ldexpf(float(mantissa), -24);
+        return sign ? -result : result;
+    }
+
+    const uint32_t bits = sign | ((exponent == 0x1F) ? (0xFFu << 23) : ((exponent + 112) << 23)) | (mantissa << 13);
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+void DX::PackDirection(const float* vector, int8_t* packed)
+{
+    const float length = Length(vector);
+    if (!(length > 0.f))
+    {
+        packed[0] = packed[1] = packed[2] = 0;
+        return;
+    }
+
+    // The lattice points around the direction, rounding each component down or up
+    float floors[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        floors[i] = floorf(vector[i] / length * 127.f);
+    }
+
+    float best = -2.f;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        float candidate[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            candidate[i] = std::min(std::max(floors[i] + float((corner >> i) & 1), -127.f), 127.f);
+        }
+
+        const float candidateLength = Length(candidate);
+        if (!(candidateLength > 0.f))
+            continue;
+
+        const float cosine = (candidate[0] * vector[0] + candidate[1] * vector[1] + candidate[2] * vector[2])
+            / (candidateLength * length);
+        if (cosine > best)
+        {
+            best = cosine;
+            for (int i = 0; i < 3; ++i)
+            {
+                packed[i] = int8_t(candidate[i]);
+            }
+        }
+    }
+}
+
+void DX::UnpackPosition(const int16_t* packed, const float offset[3], float scale, float* position)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        position[i] = offset[i] + scale * UnpackSNorm(packed[i], 32767.f);
+    }
+}
+
+VertexPacking DX::PackModelVertices(ModelData& model)
+{
+    VertexPacking packing = {};
+    const uint32_t streamCount = uint32_t(model.vertexStreams.size());
+
+    // A mesh's parts may draw from several streams, which must then share one box
+    std::vector<uint32_t> groups(streamCount);
+    std::iota(groups.begin(), groups.end(), 0u);
+    for (auto const& mesh : model.meshes)
+    {
+        for (auto const& part : mesh.parts)
+        {
+            if (part.vertexStream < streamCount && mesh.parts[0].vertexStream < streamCount)
+            {
+                groups[FindGroup(groups, part.vertexStream)] = FindGroup(groups, mesh.parts[0].vertexStream);
+            }
+        }
+    }
+
+    std::vector<Box> boxes(streamCount);
+    for (uint32_t s = 0; s < streamCount; ++s)
+    {
+        auto const& stream = model.vertexStreams[s];
+        auto& box = boxes[FindGroup(groups, s)];
+
+        const auto position = FindPackablePosition(stream);
+        if (!position)
+        {
+            box.packable = false;
+            continue;
+        }
+
+        for (uint32_t v = 0; v < stream.vertexCount; ++v)
+        {
+            const uint8_t* p = stream.GetData() + size_t(v) * stream.stride + position->offset;
+            const float point[3] = { ReadFloat(p), ReadFloat(p + 4), ReadFloat(p + 8) };
+            box.Add(point);
+        }
+    }
+
+    for (auto const& mesh : model.meshes)
+    {
+        for (auto const& part : mesh.parts)
+        {
+            if (part.vertexStream >= streamCount)
+                continue;
+
+            auto& box = boxes[FindGroup(groups, part.vertexStream)];
+            for (int corner = 0; corner < 2; ++corner)
+            {
+                float point[3];
+                for (int i = 0; i < 3; ++i)
+                {
+                    point[i] = mesh.boxCenter[i] + (corner ? mesh.boxExtents[i] : -mesh.boxExtents[i]);
+                }
+                box.Add(point);
+            }
+        }
+    }
+
+    // Each group's box as the offset and scale its positions are stored against
+    std::vector<float> scales(streamCount, 0.f);
+    std::vector<float> offsets(size_t(streamCount) * 3);
+    for (uint32_t s = 0; s < streamCount; ++s)
+    {
+        auto const& box = boxes[s];
+        if (FindGroup(groups, s) != s || !box.packable)
+            continue;
+
+        float scale = 0.f;
+        for (int i = 0; i < 3; ++i)
+        {
+            offsets[s * 3 + i] = (box.minimum[i] + box.maximum[i]) * 0.5f;
+            scale = std::max(scale, (box.maximum[i] - box.minimum[i]) * 0.5f);
+        }
+        if (scale > 0.f && scale < FLT_MAX)
+        {
+            scales[s] = scale;
+        }
+    }
+
+    for (uint32_t s = 0; s < streamCount; ++s)
+    {
+        auto& stream = model.vertexStreams[s];
+        const uint32_t group = FindGroup(groups, s);
+        const float scale = scales[group];
+        const float* offset = &offsets[group * 3];
+        if (!(scale > 0.f))
+        {
+            ++packing.streamsSkipped;
+            continue;
+        }
+
+        const uint8_t* source = stream.GetData();
+
+        // The new layout, in the same element order; texture coordinates only halve when
+        // every value survives it
+        std::vector<ModelData::VertexElement> elements(stream.elements);
+        std::vector<ElementKind> kinds(elements.size(), Kind_Copy);
+        uint32_t stride = 0;
+        for (size_t e = 0; e < elements.size(); ++e)
+        {
+            auto& element = elements[e];
+            const uint32_t sourceOffset = element.offset;
+            element.offset = stride;
+
+            if (!strcmp(element.semanticName, "SV_Position") && element.format == ModelData::Format_R32G32B32_Float)
+            {
+                kinds[e] = Kind_Position;
+                element.format = ModelData::Format_R16G16B16A16_SNorm;
+            }
+            else if (IsDirection(element.semanticName)
+                && (element.format == ModelData::Format_R32G32B32_Float || element.format == ModelData::Format_R32G32B32A32_Float))
+            {
+                kinds[e] = Kind_Direction;
+                element.format = ModelData::Format_R8G8B8A8_SNorm;
+            }
+            else if (!strcmp(element.semanticName, "TEXCOORD") && element.format == ModelData::Format_R32G32_Float)
+            {
+                float error = 0.f;
+                for (uint32_t v = 0; v < stream.vertexCount && error <= c_MaxTexCoordError; ++v)
+                {
+                    const uint8_t* p = source + size_t(v) * stream.stride + sourceOffset;
+                    for (int i = 0; i < 2; ++i)
+                    {
+                        const float value = ReadFloat(p + i * 4);
+                        error = std::max(error, fabsf(HalfToFloat(FloatToHalf(value)) - value));
+                    }
+                }
+
+                if (error <= c_MaxTexCoordError)
+                {
+                    kinds[e] = Kind_TexCoord;
+                    element.format = ModelData::Format_R16G16_Float;
+                    packing.maxTexCoordError = std::max(packing.maxTexCoordError, error);
+                }
+                else
+                {
+                    ++packing.texCoordsKept;
+                }
+            }
+            stride += GetFormatSize(element.format);
+        }
+
+        std::vector<uint8_t> packed(size_t(stride) * stream.vertexCount);
+        for (uint32_t v = 0; v < stream.vertexCount; ++v)
+        {
+            const uint8_t* vertex = source + size_t(v) * stream.stride;
+            uint8_t* destination = packed.data() + size_t(v) * stride;
+
+            for (size_t e = 0; e < elements.size(); ++e)
+            {
+                const uint8_t* from = vertex + stream.elements[e].offset;
+                uint8_t* to = destination + elements[e].offset;
+
+                switch (kinds[e])
+                {
+                case Kind_Position:
+                {
+                    int16_t values[4];
+                    float point[3], unpacked[3];
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        point[i] = ReadFloat(from + i * 4);
+                        values[i] = PackSNorm16((point[i] - offset[i]) / scale);
+                    }
+                    values[3] = 32767;
+                    memcpy(to, values, sizeof(values));
+
+                    UnpackPosition(values, offset, scale, unpacked);
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        packing.maxPositionError = std::max(packing.maxPositionError, fabsf(unpacked[i] - point[i]) / scale);
+                    }
+                    break;
+                }
+
+                case Kind_Direction:
+                {
+                    // A four-float tangent keeps the sign of its handedness in w
+                    const float direction[3] = { ReadFloat(from), ReadFloat(from + 4), ReadFloat(from + 8) };
+                    int8_t values[4];
+                    PackDirection(direction, values);
+                    values[3] = (stream.elements[e].format == ModelData::Format_R32G32B32A32_Float && ReadFloat(from + 12) < 0.f)
+                        ? -127 : 127;
+                    memcpy(to, values, sizeof(values));
+
+                    const float unpacked[3] = { UnpackSNorm(values[0], 127.f), UnpackSNorm(values[1], 127.f), UnpackSNorm(values[2], 127.f) };
+                    const float lengths = Length(direction) * Length(unpacked);
+                    if (lengths > 0.f)
+                    {
+                        const float cosine = (direction[0] * unpacked[0] + direction[1] * unpacked[1] + direction[2] * unpacked[2]) / lengths;
+                        packing.maxDirectionError = std::max(packing.maxDirectionError,
+                            acosf(std::min(std::max(cosine, -1.f), 1.f)) * c_DegreesPerRadian);
+                    }
+                    break;
+                }
+
+                case Kind_TexCoord:
+                {
+                    const uint16_t values[2] = { FloatToHalf(ReadFloat(from)), FloatToHalf(ReadFloat(from + 4)) };
+                    memcpy(to, values, sizeof(values));
+                    break;
+                }
+
+                default:
+                    memcpy(to, from, GetFormatSize(elements[e].format));
+                    break;
+                }
+            }
+        }
+
+        packing.bytesBefore += uint64_t(stream.stride) * stream.vertexCount;
+        packing.bytesAfter += packed.size();
+        ++packing.streamsPacked;
+
+        stream.elements.swap(elements);
+        stream.stride = stride;
+        stream.owned.swap(packed);
+        stream.data = nullptr;
+        stream.size = stream.owned.size();
+    }
+
+    for (auto& mesh : model.meshes)
+    {
+        if (mesh.parts.empty() || mesh.parts[0].vertexStream >= streamCount)
+            continue;
+
+        const uint32_t group = FindGroup(groups, mesh.parts[0].vertexStream);
+        if (!(scales[group] > 0.f))
+            continue;
+
+        auto const& box = boxes[group];
+        bool grown = false;
+        for (int i = 0; i < 3; ++i)
+        {
+            const float center = (box.minimum[i] + box.maximum[i]) * 0.5f;
+            const float extent = (box.maximum[i] - box.minimum[i]) * 0.5f;
+            grown |= (center != mesh.boxCenter[i] || extent != mesh.boxExtents[i]);
+            mesh.boxCenter[i] = center;
+            mesh.boxExtents[i] = extent;
+            mesh.positionOffset[i] = offsets[group * 3 + i];
+        }
+        mesh.positionScale = scales[group];
+
+        // As an SDKMESH file's bounds are read, so the cooked file loads with these
+        if (grown)
+        {
+            std::copy(mesh.boxCenter, mesh.boxCenter + 3, mesh.sphereCenter);
+            mesh.sphereRadius = Length(mesh.boxExtents);
+        }
+    }
+
+    return packing;
+}
@@ -0,0 +1,65 @@
+//
+// VertexPacking.h - Compact vertex formats that the stock effects read unchanged
+//
+
+#pragma once
+
+#include "ModelData.h"
+
+#include <stdint.h>
+
+namespace DX
+{
+    // Vertex streams of float positions, normals, tangents and texture coordinates pack into
+    // formats the input assembler expands back into floats, so BasicEffect, NormalMapEffect
+    // and the other DirectXTK effects (prebuilt, from the NuGet package) draw them as they are:
+    //
+    //   position                       R16G16B16A16_SNORM  8 bytes, relative to a box (below)
+    //   normal, tangent, binormal      R8G8B8A8_SNORM      4 bytes
+    //   texture coordinates            R16G16_FLOAT        4 bytes, where half precision holds them
+    //
+    // so a VertexPositionNormalTexture goes from 32 bytes to 16, and a VertexPositionNormal from
+    // 24 to 12. Octahedral normals would take the same four bytes but need every effect's vertex
+    // shader to decode them; instead each direction is rounded to the 8-bit lattice point nearest
+    // it in angle, at most about half a degree off.
+    //
+    // Positions are quantised within a box, with one scale for all three axes: model units are
+    // ModelData::Mesh::positionOffset + positionScale * p. A uniform scale leaves normals alone,
+    // so the whole mapping folds into the world matrix. An SDKMESH file stores no more than the
+    // packed position declaration: the box is the mesh's bounding box, its centre the offset
+    // and its largest extent the scale.
+    //
+    // Does not depend on the precompiled header, so the offline tools can share it.
+
+    // Texture coordinates stay float unless every one of a set rounds to half precision within
+    // this, half a texel of a 1024 texture (which holds for coordinates between -2 and 2).
+    const float c_MaxTexCoordError = 1.f / 2048.f;
+
+    uint16_t FloatToHalf(float value);  // round to nearest even
+    float HalfToFloat(uint16_t value);
+
+    // The three 8-bit signed normalised components closest in angle to the direction 'vector'.
+    void PackDirection(const float* vector, int8_t* packed);
+
+    // Three floats, in model units, from a packed position.
+    void UnpackPosition(const int16_t* packed, const float offset[3], float scale, float* position);
+
+    struct VertexPacking
+    {
+        uint32_t    streamsPacked;
+        uint32_t    streamsSkipped;     // without float positions, or with bytes their elements do not describe
+        uint32_t    texCoordsKept;      // texture coordinate sets left as floats
+        uint64_t    bytesBefore;        // of the packed streams
+        uint64_t    bytesAfter;
+        float       maxPositionError;   // as a fraction of the box's largest extent
+        float       maxDirectionError;  // in degrees
+        float       maxTexCoordError;
+    };
+
+    // Packs every vertex stream with float positions whose elements cover its stride, into
+    // bytes the stream then owns. Streams one mesh draws together share a box, which takes in
+    // their positions and the bounds of every mesh drawing them; those meshes get it as their
+    // position mapping and, when it is larger than their own, as their bounds. Elements of other
+    // kinds are copied as they are. Measures the largest error of what it packed.
+    VertexPacking PackModelVertices(ModelData& model);
+}
@@ -0,0 +1,504 @@
+//
+// AssetCooker.cpp - Converts the loose content into the forms the game loads fastest, incrementally
+//
+// Builds with Visual Studio (AssetCooker.vcxproj) or, on Linux, with
+//
+//   g++ -std=c++17 -O2 -pthread -I../../Rohan-GamesProgrammingProject *.cpp
+//       ../../Rohan-GamesProgrammingProject/{ModelData,ModelLod,VertexPacking,ImageDecoder,Inflate,PNGDecoder,JPEGDecoder,AtlasLayout,MeshClusters,OcclusionBuffer,FrustumCuller,JobSystem,MappedFile}.cpp
+//       -o AssetCooker
+//
+// Usage, from the game's content directory: AssetCooker [options] [files or dirs...]
+//
+//   -o DIR              output directory (Cooked), packable as it is (AssetPacker -cooked Cooked)
+//   -threads N          threads to cook or measure on (all of them)
+//   -quality fast|high  BC7 for colour at high (TextureCooker.h)
+//   -mips box|kaiser    mip filter (MipChain.h)
+//   -force              cook everything, not only what changed (CookManifest.h)
+//   -v                  list the assets that were up to date as well
+//   -bench              time and compare texture compression instead (TextureCooker.h)
+//   -decodebench        time the image decoders instead (TextureCooker.h)
+//   -meshstats          report vertex cache efficiency instead (MeshOptimiser.h)
+//   -lodstats           report levels of detail instead (MeshSimplifier.h)
+//   -vertexstats        report vertex packing instead (VertexPacker.h)
+//   -clusterstats       check and time cluster culling instead (ClusterBench.h)
+//   -occlusionbench     check and time occlusion culling instead (OcclusionBench.h)
+//   -cullbench          check and time frustum culling instead (CullBench.h)
+//   -jobbench           check and time the job system with 1 to N workers instead (JobBench.h)
+//   -loadbench          time mapped against copied model loading instead (LoadBench.h)
+//   -parsebench N       time parsing every model N times instead (LoadBench.h)
+//
+// Directories are searched recursively. With none given, Textures, Mesh and Sounds are cooked,
+// the texture benches read Textures and the model ones Mesh. What each cooker does is in Cooker.h.
+//
+
+#include "ClusterBench.h"
+#include "Cooker.h"
+#include "CookManifest.h"
+#include "CullBench.h"
+#include "JobBench.h"
+#include "LoadBench.h"
+#include "MeshOptimiser.h"
+#include "MeshSimplifier.h"
+#include "OcclusionBench.h"
+#include "TextureCooker.h"
+#include "VertexPacker.h"
+#include "JobSystem.h"
+#include "../Common/FileIO.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string.h>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const char* const c_DefaultInputs[] = { "Textures", "Mesh", "Sounds" };
+    const char c_ManifestName[] = "Cook.manifest";
+
+    struct Options
+    {
+        fs::path                output = "Cooked";
+        unsigned                threads = std::max(1u, std::thread::hardware_concurrency());
+        bool                    highQuality = false;
+        MipFilter               mipFilter = MipFilter::Kaiser;
+        bool                    force = false;
+        bool                    verbose = false;
+        bool                    bench = false;
+        bool                    decodeBench = false;
+        bool                    meshStats = false;
+        bool                    lodStats = false;
+        bool                    vertexStats = false;
+        bool                    clusterStats = false;
+        bool                    occlusionBench = false;
+        bool                    cullBench = false;
+        bool                    jobBench = false;
+        bool                    loadBench = false;
+        unsigned                parseRepeats = 0;
+        std::vector<fs::path>   inputs;
+    };
+
+    Options ParseOptions(int argc, char** argv)
+    {
+        Options options;
+        for (int i = 1; i < argc; ++i)
+        {
+            if (!strcmp(argv[i], "-o") && i + 1 < argc)
+                options.output = argv[++i];
+            else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+                options.threads = unsigned(std::max(1, atoi(argv[++i])));
+            else if (!strcmp(argv[i], "-quality") && i + 1 < argc)
+            {
+                const char* quality = argv[++i];
+                if (strcmp(quality, "fast") && strcmp(quality, "high"))
+                    throw std::runtime_error(std::string("unknown quality ") + quality);
+                options.highQuality = !strcmp(quality, "high");
+            }
+            else if (!strcmp(argv[i], "-mips") && i + 1 < argc)
+            {
+                const char* filter = argv[++i];
+                if (strcmp(filter, "box") && strcmp(filter, "kaiser"))
+                    throw std::runtime_error(std::string("unknown mip filter ") + filter);
+                options.mipFilter = !strcmp(filter, "box") ? MipFilter::Box : MipFilter::Kaiser;
+            }
+            else if (!strcmp(argv[i], "-bench"))
+                options.bench = true;
+            else if (!strcmp(argv[i], "-decodebench"))
+                options.decodeBench = true;
+            else if (!strcmp(argv[i], "-meshstats"))
+                options.meshStats = true;
+            else if (!strcmp(argv[i], "-lodstats"))
+                options.lodStats = true;
+            else if (!strcmp(argv[i], "-vertexstats"))
+                options.vertexStats = true;
+            else if (!strcmp(argv[i], "-clusterstats"))
+                options.clusterStats = true;
+            else if (!strcmp(argv[i], "-occlusionbench"))
+                options.occlusionBench = true;
+            else if (!strcmp(argv[i], "-cullbench"))
+                options.cullBench = true;
+            else if (!strcmp(argv[i], "-jobbench"))
+                options.jobBench = true;
+            else if (!strcmp(argv[i], "-loadbench"))
+                options.loadBench = true;
+            else if (!strcmp(argv[i], "-parsebench") && i + 1 < argc)
+                options.parseRepeats = unsigned(std::max(1, atoi(argv[++i])));
+            else if (!strcmp(argv[i], "-force"))
+                options.force = true;
+            else if (!strcmp(argv[i], "-v"))
+                options.verbose = true;
+            else if (argv[i][0] == '-')
+                throw std::runtime_error(std::string("unknown option ") + argv[i]);
+            else
+                options.inputs.push_back(argv[i]);
+        }
+
+        if (options.inputs.empty() && (options.bench || options.decodeBench))
+        {
+            options.inputs.push_back("Textures");
+        }
+        else if (options.inputs.empty() && (options.meshStats || options.lodStats || options.vertexStats
+            || options.clusterStats || options.loadBench || options.parseRepeats))
+        {
+            options.inputs.push_back("Mesh");
+        }
+        else if (options.inputs.empty())
+        {
+            for (auto input : c_DefaultInputs)
+            {
+                if (fs::is_directory(input))
+                    options.inputs.push_back(input);
+            }
+        }
+        return options;
+    }
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::string ToKey(fs::path const& path)
+    {
+        return path.lexically_normal().generic_u8string();
+    }
+
+    struct Job
+    {
+        enum State
+        {
+            UpToDate,
+            Refreshed,      // unchanged, but an input's time moved, so the manifest changes
+            Cooked,
+            Failed,
+        };
+
+        fs::path                source;
+        std::string             key;
+        const Cooker*           cooker;
+        std::string             output;
+        State                   state;
+        CookManifest::Record    record;
+        std::string             error;
+    };
+
+    // Sources by their output name, one cooker each. Where two sources would write the same
+    // output, the one converted from another format wins, as an .obj does over an .sdkmesh.
+    std::vector<Job> CollectJobs(Options const& options, std::vector<std::unique_ptr<Cooker>> const& cookers,
+        std::set<std::string>& superseded, size_t& skipped)
+    {
+        std::vector<fs::path> sources;
+        const auto outputDirectory = fs::absolute(options.output).lexically_normal();
+        for (auto const& input : options.inputs)
+        {
+            if (fs::is_directory(input))
+            {
+                for (auto it = fs::recursive_directory_iterator(input); it != fs::recursive_directory_iterator(); ++it)
+                {
+                    if (it->is_directory() && fs::absolute(it->path()).lexically_normal() == outputDirectory)
+                        it.disable_recursion_pending();
+                    else if (it->is_regular_file())
+                        sources.push_back(it->path());
+                }
+            }
+            else if (fs::is_regular_file(input))
+            {
+                sources.push_back(input);
+            }
+            else
+            {
+                throw std::runtime_error("no such file or directory: " + input.string());
+            }
+        }
+
+        std::map<std::string, Job> byOutput;
+        for (auto const& source : sources)
+        {
+            auto cooker = std::find_if(cookers.begin(), cookers.end(), [&](auto const& c) { return c->Accepts(source); });
+            if (cooker == cookers.end())
+            {
+                ++skipped;      // material libraries, tools and the like
+                continue;
+            }
+
+            Job job = {};
+            job.source = source;
+            job.key = ToKey(source);
+            job.cooker = cooker->get();
+            job.output = ToKey((*cooker)->GetOutputName(source));
+
+            auto found = byOutput.find(job.output);
+            if (found == byOutput.end())
+            {
+                byOutput.emplace(job.output, std::move(job));
+                continue;
+            }
+            if (found->second.key == job.key)
+                continue;
+
+            const bool converted = job.output != job.key;
+            const bool otherConverted = found->second.output != found->second.key;
+            if (converted == otherConverted)
+                throw std::runtime_error(job.key + " and " + found->second.key + " both cook to " + job.output);
+
+            if (converted)
+                std::swap(found->second, job);
+            superseded.insert(job.key);
+        }
+
+        std::vector<Job> jobs;
+        for (auto& entry : byOutput)
+        {
+            jobs.push_back(std::move(entry.second));
+        }
+        return jobs;
+    }
+
+    // Whether nothing the asset was built from has changed. An input whose size and time are
+    // as recorded is taken as unchanged; one with only a new time is hashed, and if its
+    // contents are the same its record is refreshed so it is not hashed again next time.
+    bool IsUpToDate(Job& job, fs::path const& outputDirectory)
+    {
+        auto& record = job.record;
+        if (record.cooker != job.cooker->GetName() || record.cookerVersion != job.cooker->GetVersion()
+            || record.output != job.output || record.inputs.empty() || record.inputs[0].path != job.key)
+            return false;
+
+        std::error_code error;
+        auto outputSize = fs::file_size(outputDirectory / fs::u8path(record.output), error);
+        if (error || outputSize != record.outputSize || record.settings != job.cooker->GetSettings())
+            return false;
+
+        for (auto& input : record.inputs)
+        {
+            const auto path = fs::u8path(input.path);
+            auto size = fs::file_size(path, error);
+            if (error || size != input.size)
+                return false;
+
+            auto modified = fs::last_write_time(path, error);
+            if (error)
+                return false;
+            if (int64_t(modified.time_since_epoch().count()) == input.modified)
+                continue;
+
+            auto current = CookManifest::Describe(path);
+            if (current.hash != input.hash)
+                return false;
+
+            input = current;
+            job.state = Job::Refreshed;
+        }
+        return true;
+    }
+
+    void Cook(Job& job, fs::path const& outputDirectory)
+    {
+        auto data = ReadFile(job.source);
+
+        std::vector<fs::path> dependencies;
+        auto output = job.cooker->Cook(job.source, data, dependencies);
+
+        CookManifest::Record record;
+        record.cooker = job.cooker->GetName();
+        record.cookerVersion = job.cooker->GetVersion();
+        record.settings = job.cooker->GetSettings();
+        record.output = job.output;
+        record.outputSize = output.size();
+        record.inputs.push_back(CookManifest::Describe(job.source, &data));
+        for (auto const& dependency : dependencies)
+        {
+            record.inputs.push_back(CookManifest::Describe(dependency));
+        }
+
+        WriteFileAtomically(outputDirectory / fs::u8path(job.output), output);
+
+        job.record = std::move(record);
+        job.state = Job::Cooked;
+    }
+
+    std::vector<fs::path> CollectFiles(std::vector<fs::path> const& inputs)
+    {
+        std::vector<fs::path> files;
+        for (auto const& input : inputs)
+        {
+            if (!fs::is_directory(input))
+            {
+                files.push_back(input);
+                continue;
+            }
+            for (auto const& entry : fs::recursive_directory_iterator(input))
+            {
+                if (entry.is_regular_file())
+                    files.push_back(entry.path());
+            }
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+
+    int Run(Options const& options)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        // Before the job system starts its threads, as the bench forks
+        if (options.loadBench)
+            return BenchmarkModelLoading(CollectFiles(options.inputs));
+
+        // The game's job system runs the assets and, nested inside them, the blocks and mips
+        // of each texture; a thread waiting for its blocks runs other jobs meanwhile.
+        JobSystem jobSystem(options.threads - 1);
+        ParallelFor parallelFor = [&](size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)
+        {
+            jobSystem.ParallelFor(count, grain, body);
+        };
+
+        if (options.bench)
+            return BenchmarkTextures(CollectFiles(options.inputs), options.threads, parallelFor);
+        if (options.decodeBench)
+            return BenchmarkDecode(CollectFiles(options.inputs), options.threads, parallelFor);
+        if (options.meshStats)
+            return ReportMeshOptimisation(CollectFiles(options.inputs));
+        if (options.lodStats)
+            return ReportModelLods(CollectFiles(options.inputs));
+        if (options.vertexStats)
+            return ReportVertexPacking(CollectFiles(options.inputs));
+        if (options.clusterStats)
+            return BenchmarkClusters(CollectFiles(options.inputs));
+        if (options.occlusionBench)
+            return BenchmarkOcclusion(options.threads, parallelFor);
+        if (options.cullBench)
+            return BenchmarkFrustumCulling();
+        if (options.jobBench)
+            return BenchmarkJobSystem(options.threads);
+        if (options.parseRepeats)
+            return BenchmarkModelParsing(CollectFiles(options.inputs), options.parseRepeats, jobSystem);
+
+        std::vector<std::unique_ptr<Cooker>> cookers;
+        cookers.push_back(CreateTextureCooker(options.highQuality, options.mipFilter, parallelFor));
+        cookers.push_back(CreateAtlasCooker(options.highQuality, options.mipFilter, parallelFor));
+        cookers.push_back(CreateMeshCooker());
+        cookers.push_back(CreateSoundCooker());
+        cookers.push_back(CreateCopyCooker());
+
+        std::set<std::string> superseded;
+        size_t skipped = 0;
+        auto jobs = CollectJobs(options, cookers, superseded, skipped);
+
+        const auto manifestPath = options.output / c_ManifestName;
+        CookManifest manifest;
+        manifest.Load(manifestPath);
+
+        for (auto& job : jobs)
+        {
+            if (auto record = manifest.Find(job.key))
+                job.record = *record;
+        }
+
+        // Biggest first, so one large asset does not start last and leave the other threads idle
+        std::vector<size_t> order(jobs.size());
+        std::vector<uintmax_t> sizes(jobs.size());
+        for (size_t i = 0; i < jobs.size(); ++i)
+        {
+            std::error_code error;
+            order[i] = i;
+            sizes[i] = fs::file_size(jobs[i].source, error);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+
+        std::mutex printMutex;
+        jobSystem.ParallelFor(jobs.size(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                auto& job = jobs[order[i]];
+                try
+                {
+                    job.state = Job::UpToDate;
+                    if (!options.force && IsUpToDate(job, options.output))
+                        continue;
+
+                    Cook(job, options.output);
+
+                    std::lock_guard<std::mutex> lock(printMutex);
+                    printf("cooked %s -> %s (%s, %llu bytes)\n", job.key.c_str(), job.output.c_str(),
+                        job.cooker->GetName(), (unsigned long long)job.record.outputSize);
+                }
+                catch (std::exception const& e)
+                {
+                    job.state = Job::Failed;
+                    job.error = e.what();
+                }
+            }
+        });
+
+        size_t counts[4] = {};
+        std::set<std::string> liveOutputs;
+        for (auto& job : jobs)
+        {
+            ++counts[job.state];
+            liveOutputs.insert(job.output);
+
+            if (job.state == Job::Failed)
+            {
+                // Dropping the record makes the next run try again, whatever it finds on disk
+                fprintf(stderr, "AssetCooker: %s: %s\n", job.key.c_str(), job.error.c_str());
+                manifest.Remove(job.key);
+            }
+            else if (job.state != Job::UpToDate)
+            {
+                manifest.Set(job.key, std::move(job.record));
+            }
+            else if (options.verbose)
+            {
+                printf("up to date %s\n", job.key.c_str());
+            }
+        }
+
+        // Outputs of deleted or superseded sources would otherwise be packed forever
+        std::vector<std::string> stale;
+        for (auto const& entry : manifest.GetRecords())
+        {
+            if (superseded.count(entry.first) || !fs::exists(fs::u8path(entry.first)))
+                stale.push_back(entry.first);
+        }
+        for (auto const& key : stale)
+        {
+            auto const& output = manifest.Find(key)->output;
+            if (!liveOutputs.count(output))
+            {
+                std::error_code error;
+                fs::remove(options.output / fs::u8path(output), error);
+                printf("removed %s\n", output.c_str());
+            }
+            manifest.Remove(key);
+        }
+
+        manifest.Save(manifestPath);
+
+        printf("%zu assets: %zu cooked, %zu up to date, %zu failed, %zu removed, %zu files skipped, %u threads, %.0f ms\n",
+            jobs.size(), counts[Job::Cooked], counts[Job::UpToDate] + counts[Job::Refreshed], counts[Job::Failed],
+            stale.size(), skipped, options.threads, MillisecondsSince(start));
+        return counts[Job::Failed] ? 1 : 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        return Run(ParseOptions(argc, argv));
+    }
+    catch (std::exception const& e)
+    {
+        fprintf(stderr, "AssetCooker: %s\n", e.what());
+        return 1;
+    }
+}
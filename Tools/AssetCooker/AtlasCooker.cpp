@@ -0,0 +1,140 @@
+//
+// AtlasCooker.cpp - Packs the textures an .atlas file lists into one block-compressed page
+//
+
+#include "Cooker.h"
+#include "TextureCooker.h"
+#include "AtlasLayout.h"
+#include "../Common/FileIO.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const char* const c_AtlasExtensions[] = { ".atlas", nullptr };
+
+    // The page is a DDS file the game loads whole, with the layout after it (AtlasLayout.h);
+    // the output keeps the source's name, which the scene asks for.
+    //
+    // Each member's mips are built from its own padded cell, with the texture cooker's filter,
+    // so even the Kaiser filter never reaches into a neighbour, and the levels are then copied
+    // into the page's. The page is BC1, BC3 if any member has alpha, or BC7 at high quality,
+    // and sRGB when every member is tagged so.
+    class AtlasCooker : public Cooker
+    {
+    public:
+        AtlasCooker(bool highQuality, MipFilter mipFilter, ParallelFor parallelFor) :
+            m_highQuality(highQuality),
+            m_mipFilter(mipFilter),
+            m_parallelFor(std::move(parallelFor))
+        {
+        }
+
+        const char* GetName() const override { return "atlas"; }
+        uint32_t GetVersion() const override { return 1; }
+
+        std::string GetSettings() const override
+        {
+            return std::string(m_highQuality ? "bc7" : "bc1") + (m_mipFilter == MipFilter::Kaiser ? " kaiser" : " box");
+        }
+
+        bool Accepts(fs::path const& source) const override
+        {
+            return HasExtension(source, c_AtlasExtensions);
+        }
+
+        std::vector<uint8_t> Cook(fs::path const& source, std::vector<uint8_t> const& data, std::vector<fs::path>& dependencies) const override
+        {
+            auto names = ParseAtlasSource(data.data(), data.size());
+
+            std::vector<Image> images(names.size());
+            std::vector<AtlasRegion> members(names.size());
+            bool sRGB = true;
+            bool alpha = false;
+            for (size_t i = 0; i < names.size(); ++i)
+            {
+                auto path = source.parent_path() / fs::path(names[i]);
+                dependencies.push_back(path);
+
+                auto& image = images[i];
+                if (!DecodeTexture(ReadFile(path), image) || image.format != ImageFormat::RGBA8)
+                    throw std::runtime_error(path.string() + ": atlas members must be 8-bit PNG, JPEG, BMP or DDS");
+
+                members[i].name = names[i];
+                members[i].width = image.width;
+                members[i].height = image.height;
+
+                sRGB = sRGB && image.sRGB;
+                for (size_t p = 3; p < image.pixels.size() && !alpha; p += 4)
+                {
+                    alpha = image.pixels[p] != 0xFF;
+                }
+            }
+
+            auto layout = PackAtlas(std::move(members), true);
+
+            std::vector<Image> page(layout.mipCount);
+            for (uint32_t level = 0; level < layout.mipCount; ++level)
+            {
+                page[level].width = std::max(layout.width >> level, 1u);
+                page[level].height = std::max(layout.height >> level, 1u);
+                page[level].sRGB = sRGB;
+                page[level].pixels.resize(page[level].GetRowPitch() * page[level].height);
+            }
+
+            MipSettings settings;
+            settings.content = MipContent::sRGB;
+            settings.filter = m_mipFilter;
+
+            for (size_t i = 0; i < images.size(); ++i)
+            {
+                auto const& region = layout.regions[i];
+
+                Image cell;
+                cell.width = GetAtlasCellSize(region.width);
+                cell.height = GetAtlasCellSize(region.height);
+                cell.pixels.resize(cell.GetRowPitch() * cell.height);
+                for (uint32_t y = 0; y < region.height; ++y)
+                {
+                    memcpy(cell.pixels.data() + y * cell.GetRowPitch(), images[i].pixels.data() + y * images[i].GetRowPitch(),
+                        images[i].GetRowPitch());
+                }
+                PadAtlasCell(region, cell.pixels.data(), cell.GetRowPitch(), cell.GetPixelBytes());
+                std::vector<uint8_t>().swap(images[i].pixels);
+
+                auto chain = BuildMipChain(cell, settings, m_parallelFor);
+                for (uint32_t level = 0; level < layout.mipCount; ++level)
+                {
+                    auto const& from = chain[level];
+                    auto& to = page[level];
+                    for (uint32_t y = 0; y < from.height; ++y)
+                    {
+                        memcpy(to.pixels.data() + ((region.y >> level) + y) * to.GetRowPitch() + size_t(region.x >> level) * 4,
+                            from.pixels.data() + y * from.GetRowPitch(), from.GetRowPitch());
+                    }
+                }
+            }
+
+            const auto format = m_highQuality ? BlockFormat::BC7 : alpha ? BlockFormat::BC3 : BlockFormat::BC1;
+            auto file = WriteTexture(page, format, sRGB, m_parallelFor);
+            AppendAtlasLayout(layout, file);
+            return file;
+        }
+
+    private:
+        bool            m_highQuality;
+        MipFilter       m_mipFilter;
+        ParallelFor     m_parallelFor;
+    };
+}
+
+std::unique_ptr<Cooker> DX::CreateAtlasCooker(bool highQuality, MipFilter mipFilter, ParallelFor parallelFor)
+{
+    return std::make_unique<AtlasCooker>(highQuality, mipFilter, std::move(parallelFor));
+}
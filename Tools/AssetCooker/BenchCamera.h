@@ -0,0 +1,83 @@
+//
+// BenchCamera.h - Views and projections for the benchmarks, built as the game builds them
+//
+
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+
+namespace DX
+{
+    inline float Dot(const float* a, const float* b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    inline void Cross(const float* a, const float* b, float* result)
+    {
+        result[0] = a[1] * b[2] - a[2] * b[1];
+        result[1] = a[2] * b[0] - a[0] * b[2];
+        result[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    inline void Normalise(float* v)
+    {
+        const float length = sqrtf(Dot(v, v));
+        for (int i = 0; i < 3; ++i)
+        {
+            v[i] /= length;
+        }
+    }
+
+    // Row-major, row vectors, as XMMatrixLookAtRH and XMMatrixPerspectiveFovRH build them
+    inline void LookAt(const float* eye, const float* target, const float* up, float* result)
+    {
+        float z[3] = { eye[0] - target[0], eye[1] - target[1], eye[2] - target[2] };
+        Normalise(z);
+        float x[3];
+        Cross(up, z, x);
+        Normalise(x);
+        float y[3];
+        Cross(z, x, y);
+
+        const float matrix[16] =
+        {
+            x[0], y[0], z[0], 0.f,
+            x[1], y[1], z[1], 0.f,
+            x[2], y[2], z[2], 0.f,
+            -Dot(x, eye), -Dot(y, eye), -Dot(z, eye), 1.f,
+        };
+        std::copy(matrix, matrix + 16, result);
+    }
+
+    inline void Perspective(float fieldOfView, float aspectRatio, float nearPlane, float farPlane, float* result)
+    {
+        const float height = 1.f / tanf(fieldOfView * 0.5f);
+        const float range = farPlane / (nearPlane - farPlane);
+        const float matrix[16] =
+        {
+            height / aspectRatio, 0.f, 0.f, 0.f,
+            0.f, height, 0.f, 0.f,
+            0.f, 0.f, range, -1.f,
+            0.f, 0.f, range * nearPlane, 0.f,
+        };
+        std::copy(matrix, matrix + 16, result);
+    }
+
+    inline void Multiply(const float* a, const float* b, float* result)
+    {
+        for (int r = 0; r < 4; ++r)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                float sum = 0.f;
+                for (int k = 0; k < 4; ++k)
+                {
+                    sum += a[r * 4 + k] * b[k * 4 + c];
+                }
+                result[r * 4 + c] = sum;
+            }
+        }
+    }
+}
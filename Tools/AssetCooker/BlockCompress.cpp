@@ -0,0 +1,943 @@
+//
+// BlockCompress.cpp - BC1/BC3/BC4/BC5/BC7 texture block encoders
+//
+
+#include "BlockCompress.h"
+
+#include <algorithm>
+#include <atomic>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BC_X86 1
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BC_SSE2 1
+#endif
+#endif
+
+#if defined(BC_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// GCC and clang only emit AVX2 in functions marked for it; MSVC emits whatever intrinsics ask for
+#if defined(__GNUC__) || defined(__clang__)
+#define BC_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define BC_TARGET_AVX2
+#endif
+
+using namespace DX;
+
+namespace
+{
+    // A block's texels and a palette, as floats in channel-major order so the search
+    // vectorizes across texels. Palettes hold up to 16 entries (BC7 4-bit indices).
+    struct Texels
+    {
+        alignas(32) float c[4][16];
+    };
+
+    struct Palette
+    {
+        alignas(32) float c[4][16];
+        int count;
+    };
+
+    //----------------------------------------------------------------------------------------
+    // Nearest palette entry for each texel, by weighted squared distance; returns the total.
+    // Every version sums in the same order, so all of them choose the same blocks.
+
+    using FindIndicesFunction = float (*)(Texels const&, Palette const&, const float weights[4], uint8_t indices[16]);
+
+    float FindIndicesScalar(Texels const& texels, Palette const& palette, const float weights[4], uint8_t indices[16])
+    {
+        float total = 0.f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float best = FLT_MAX;
+            int bestIndex = 0;
+            for (int p = 0; p < palette.count; ++p)
+            {
+                float dr = texels.c[0][i] - palette.c[0][p];
+                float dg = texels.c[1][i] - palette.c[1][p];
+                float db = texels.c[2][i] - palette.c[2][p];
+                float da = texels.c[3][i] - palette.c[3][p];
+                float distance = weights[0] * (dr * dr) + weights[1] * (dg * dg) + weights[2] * (db * db) + weights[3] * (da * da);
+                if (distance < best)
+                {
+                    best = distance;
+                    bestIndex = p;
+                }
+            }
+            indices[i] = uint8_t(bestIndex);
+            total += best;
+        }
+        return total;
+    }
+
+#if defined(BC_SSE2)
+    float FindIndicesSSE2(Texels const& texels, Palette const& palette, const float weights[4], uint8_t indices[16])
+    {
+        const __m128 w0 = _mm_set1_ps(weights[0]);
+        const __m128 w1 = _mm_set1_ps(weights[1]);
+        const __m128 w2 = _mm_set1_ps(weights[2]);
+        const __m128 w3 = _mm_set1_ps(weights[3]);
+
+        alignas(16) float best[16];
+        alignas(16) int32_t bestIndex[16];
+        for (int i = 0; i < 16; i += 4)
+        {
+            const __m128 r = _mm_load_ps(&texels.c[0][i]);
+            const __m128 g = _mm_load_ps(&texels.c[1][i]);
+            const __m128 b = _mm_load_ps(&texels.c[2][i]);
+            const __m128 a = _mm_load_ps(&texels.c[3][i]);
+
+            __m128 nearest = _mm_set1_ps(FLT_MAX);
+            __m128i nearestIndex = _mm_setzero_si128();
+            for (int p = 0; p < palette.count; ++p)
+            {
+                __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette.c[0][p]));
+                __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette.c[1][p]));
+                __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette.c[2][p]));
+                __m128 da = _mm_sub_ps(a, _mm_set1_ps(palette.c[3][p]));
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(w0, _mm_mul_ps(dr, dr)), _mm_mul_ps(w1, _mm_mul_ps(dg, dg))),
+                    _mm_mul_ps(w2, _mm_mul_ps(db, db))), _mm_mul_ps(w3, _mm_mul_ps(da, da)));
+
+                __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, nearest));
+                nearest = _mm_min_ps(distance, nearest);
+                nearestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, nearestIndex));
+            }
+            _mm_store_ps(best + i, nearest);
+            _mm_store_si128(reinterpret_cast<__m128i*>(bestIndex + i), nearestIndex);
+        }
+
+        float total = 0.f;
+        for (int i = 0; i < 16; ++i)
+        {
+            indices[i] = uint8_t(bestIndex[i]);
+            total += best[i];
+        }
+        return total;
+    }
+
+    BC_TARGET_AVX2 float FindIndicesAVX2(Texels const& texels, Palette const& palette, const float weights[4], uint8_t indices[16])
+    {
+        const __m256 w0 = _mm256_set1_ps(weights[0]);
+        const __m256 w1 = _mm256_set1_ps(weights[1]);
+        const __m256 w2 = _mm256_set1_ps(weights[2]);
+        const __m256 w3 = _mm256_set1_ps(weights[3]);
+
+        alignas(32) float best[16];
+        alignas(32) int32_t bestIndex[16];
+        for (int i = 0; i < 16; i += 8)
+        {
+            const __m256 r = _mm256_load_ps(&texels.c[0][i]);
+            const __m256 g = _mm256_load_ps(&texels.c[1][i]);
+            const __m256 b = _mm256_load_ps(&texels.c[2][i]);
+            const __m256 a = _mm256_load_ps(&texels.c[3][i]);
+
+            __m256 nearest = _mm256_set1_ps(FLT_MAX);
+            __m256i nearestIndex = _mm256_setzero_si256();
+            for (int p = 0; p < palette.count; ++p)
+            {
+                __m256 dr = _mm256_sub_ps(r, _mm256_set1_ps(palette.c[0][p]));
+                __m256 dg = _mm256_sub_ps(g, _mm256_set1_ps(palette.c[1][p]));
+                __m256 db = _mm256_sub_ps(b, _mm256_set1_ps(palette.c[2][p]));
+                __m256 da = _mm256_sub_ps(a, _mm256_set1_ps(palette.c[3][p]));
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                    _mm256_mul_ps(w0, _mm256_mul_ps(dr, dr)), _mm256_mul_ps(w1, _mm256_mul_ps(dg, dg))),
+                    _mm256_mul_ps(w2, _mm256_mul_ps(db, db))), _mm256_mul_ps(w3, _mm256_mul_ps(da, da)));
+
+                __m256 closer = _mm256_cmp_ps(distance, nearest, _CMP_LT_OQ);
+                nearest = _mm256_min_ps(distance, nearest);
+                nearestIndex = _mm256_blendv_epi8(nearestIndex, _mm256_set1_epi32(p), _mm256_castps_si256(closer));
+            }
+            _mm256_store_ps(best + i, nearest);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(bestIndex + i), nearestIndex);
+        }
+
+        float total = 0.f;
+        for (int i = 0; i < 16; ++i)
+        {
+            indices[i] = uint8_t(bestIndex[i]);
+            total += best[i];
+        }
+        return total;
+    }
+#endif
+
+    SimdLevel GetSupportedLevel()
+    {
+#if defined(BC_SSE2)
+        static const SimdLevel s_supported = []()
+        {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return SimdLevel::SSE2;
+
+            // AVX needs the OS to save the YMM registers
+            __cpuid(info, 1);
+            const bool osSavesYMM = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+            __cpuidex(info, 7, 0);
+            return (osSavesYMM && (info[1] & (1 << 5))) ? SimdLevel::AVX2 : SimdLevel::SSE2;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? SimdLevel::AVX2 : SimdLevel::SSE2;
+#endif
+        }();
+        return s_supported;
+#else
+        return SimdLevel::Scalar;
+#endif
+    }
+
+    std::atomic<int> g_simdLevel(-1);
+
+    FindIndicesFunction GetFindIndices()
+    {
+        switch (GetSimdLevel())
+        {
+#if defined(BC_SSE2)
+        case SimdLevel::AVX2:   return FindIndicesAVX2;
+        case SimdLevel::SSE2:   return FindIndicesSSE2;
+#endif
+        default:                return FindIndicesScalar;
+        }
+    }
+
+    //----------------------------------------------------------------------------------------
+    // Endpoint fitting shared by the encoders
+
+    void LoadTexels(const uint8_t rgba[64], Texels& texels)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                texels.c[c][i] = rgba[i * 4 + c];
+            }
+        }
+    }
+
+    // Endpoints along the texels' principal axis (power iteration on the covariance) through
+    // their extremes, over the first 'channels' channels
+    void FitLine(Texels const& texels, int channels, float start[4], float end[4])
+    {
+        float mean[4] = {};
+        for (int c = 0; c < channels; ++c)
+        {
+            for (int i = 0; i < 16; ++i)
+            {
+                mean[c] += texels.c[c][i];
+            }
+            mean[c] /= 16.f;
+        }
+
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int a = 0; a < channels; ++a)
+            {
+                for (int b = a; b < channels; ++b)
+                {
+                    covariance[a][b] += (texels.c[a][i] - mean[a]) * (texels.c[b][i] - mean[b]);
+                }
+            }
+        }
+        for (int a = 0; a < channels; ++a)
+        {
+            for (int b = 0; b < a; ++b)
+            {
+                covariance[a][b] = covariance[b][a];
+            }
+        }
+
+        // Start from the channel that varies most, which converges fastest
+        int widest = 0;
+        for (int c = 1; c < channels; ++c)
+        {
+            if (covariance[c][c] > covariance[widest][widest])
+                widest = c;
+        }
+
+        float axis[4] = {};
+        for (int c = 0; c < channels; ++c)
+        {
+            axis[c] = covariance[widest][c];
+        }
+
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            float next[4] = {};
+            float length = 0.f;
+            for (int a = 0; a < channels; ++a)
+            {
+                for (int b = 0; b < channels; ++b)
+                {
+                    next[a] += covariance[a][b] * axis[b];
+                }
+                length = std::max(length, fabsf(next[a]));
+            }
+            if (length < 1e-12f)
+                break;
+            for (int c = 0; c < channels; ++c)
+            {
+                axis[c] = next[c] / length;
+            }
+        }
+
+        float squared = 0.f;
+        for (int c = 0; c < channels; ++c)
+        {
+            squared += axis[c] * axis[c];
+        }
+        if (squared < 1e-12f)
+        {
+            // Every texel is the same
+            for (int c = 0; c < 4; ++c)
+            {
+                start[c] = end[c] = c < channels ? mean[c] : 0.f;
+            }
+            return;
+        }
+
+        float lowest = FLT_MAX, highest = -FLT_MAX;
+        for (int i = 0; i < 16; ++i)
+        {
+            float t = 0.f;
+            for (int c = 0; c < channels; ++c)
+            {
+                t += (texels.c[c][i] - mean[c]) * axis[c];
+            }
+            lowest = std::min(lowest, t);
+            highest = std::max(highest, t);
+        }
+
+        for (int c = 0; c < 4; ++c)
+        {
+            start[c] = c < channels ? mean[c] + axis[c] * lowest / squared : 0.f;
+            end[c] = c < channels ? mean[c] + axis[c] * highest / squared : 0.f;
+        }
+    }
+
+    // Least-squares endpoints for the chosen indices, where 'fractions' gives how far along
+    // from start to end each index lies. Returns false when the indices cannot fix a line.
+    bool RefitLine(Texels const& texels, int channels, const uint8_t indices[16], const float* fractions,
+        float start[4], float end[4])
+    {
+        float aa = 0.f, ab = 0.f, bb = 0.f;
+        float xa[4] = {}, xb[4] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            const float b = fractions[indices[i]];
+            const float a = 1.f - b;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < channels; ++c)
+            {
+                xa[c] += a * texels.c[c][i];
+                xb[c] += b * texels.c[c][i];
+            }
+        }
+
+        const float determinant = aa * bb - ab * ab;
+        if (fabsf(determinant) < 1e-6f)
+            return false;
+
+        for (int c = 0; c < channels; ++c)
+        {
+            start[c] = std::min(255.f, std::max(0.f, (bb * xa[c] - ab * xb[c]) / determinant));
+            end[c] = std::min(255.f, std::max(0.f, (aa * xb[c] - ab * xa[c]) / determinant));
+        }
+        return true;
+    }
+
+    uint8_t ToByte(float value)
+    {
+        return uint8_t(std::min(255.f, std::max(0.f, value + 0.5f)));
+    }
+
+    //----------------------------------------------------------------------------------------
+    // BC1 colour, also the colour half of BC3; always in four-colour mode
+
+    const float c_BC1Fractions[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+
+    uint16_t To565(const float color[4])
+    {
+        uint32_t r = uint32_t(std::min(31.f, std::max(0.f, color[0] * 31.f / 255.f + 0.5f)));
+        uint32_t g = uint32_t(std::min(63.f, std::max(0.f, color[1] * 63.f / 255.f + 0.5f)));
+        uint32_t b = uint32_t(std::min(31.f, std::max(0.f, color[2] * 31.f / 255.f + 0.5f)));
+        return uint16_t((r << 11) | (g << 5) | b);
+    }
+
+    void From565(uint16_t color, uint32_t rgb[3])
+    {
+        uint32_t r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    void BC1Palette(uint16_t color0, uint16_t color1, uint32_t palette[4][3])
+    {
+        From565(color0, palette[0]);
+        From565(color1, palette[1]);
+        for (int c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+        }
+    }
+
+    struct BC1Candidate
+    {
+        uint16_t    color0;
+        uint16_t    color1;
+        uint8_t     indices[16];
+        float       error;
+    };
+
+    void EvaluateBC1(Texels const& texels, FindIndicesFunction find, float const start[4], float const end[4], BC1Candidate& best)
+    {
+        static const float c_Weights[4] = { 1.f, 1.f, 1.f, 0.f };
+
+        BC1Candidate candidate;
+        candidate.color0 = To565(start);
+        candidate.color1 = To565(end);
+
+        // Four-colour mode needs color0 > color1
+        if (candidate.color0 < candidate.color1)
+            std::swap(candidate.color0, candidate.color1);
+
+        uint32_t colors[4][3];
+        BC1Palette(candidate.color0, candidate.color1, colors);
+
+        Palette palette = {};
+        palette.count = (candidate.color0 == candidate.color1) ? 1 : 4;
+        for (int p = 0; p < palette.count; ++p)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                palette.c[c][p] = float(colors[p][c]);
+            }
+        }
+
+        candidate.error = find(texels, palette, c_Weights, candidate.indices);
+        if (candidate.error < best.error)
+            best = candidate;
+    }
+
+    void CompressBC1(const uint8_t rgba[64], uint8_t* block)
+    {
+        const auto find = GetFindIndices();
+
+        Texels texels;
+        LoadTexels(rgba, texels);
+
+        float start[4], end[4];
+        FitLine(texels, 3, start, end);
+
+        BC1Candidate best;
+        best.error = FLT_MAX;
+        EvaluateBC1(texels, find, start, end, best);
+
+        for (int iteration = 0; iteration < 2 && best.error > 0.f; ++iteration)
+        {
+            // Indices are relative to the stored order, which may be the reverse of start/end
+            float first[4] = {}, second[4] = {};
+            if (!RefitLine(texels, 3, best.indices, c_BC1Fractions, first, second))
+                break;
+
+            const float previous = best.error;
+            EvaluateBC1(texels, find, first, second, best);
+            if (best.error >= previous)
+                break;
+        }
+
+        memcpy(block, &best.color0, 2);
+        memcpy(block + 2, &best.color1, 2);
+        uint32_t bits = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            bits |= uint32_t(best.indices[i]) << (i * 2);
+        }
+        memcpy(block + 4, &bits, 4);
+    }
+
+    void DecompressBC1(const uint8_t* block, uint8_t rgba[64], bool alwaysFourColors)
+    {
+        uint16_t color0, color1;
+        memcpy(&color0, block, 2);
+        memcpy(&color1, block + 2, 2);
+        uint32_t bits;
+        memcpy(&bits, block + 4, 4);
+
+        uint32_t palette[4][3];
+        BC1Palette(color0, color1, palette);
+        uint8_t alpha[4] = { 255, 255, 255, 255 };
+        if (!alwaysFourColors && color0 <= color1)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                palette[3][c] = 0;
+            }
+            alpha[3] = 0;
+        }
+
+        for (int i = 0; i < 16; ++i)
+        {
+            uint32_t index = (bits >> (i * 2)) & 3;
+            for (int c = 0; c < 3; ++c)
+            {
+                rgba[i * 4 + c] = uint8_t(palette[index][c]);
+            }
+            rgba[i * 4 + 3] = alpha[index];
+        }
+    }
+
+    //----------------------------------------------------------------------------------------
+    // BC4 single channel, also BC3's alpha and each half of BC5
+
+    const float c_BC4Fractions8[8] = { 0.f, 1.f, 1.f / 7, 2.f / 7, 3.f / 7, 4.f / 7, 5.f / 7, 6.f / 7 };
+
+    void BC4Palette(uint32_t value0, uint32_t value1, uint32_t palette[8])
+    {
+        palette[0] = value0;
+        palette[1] = value1;
+        if (value0 > value1)
+        {
+            for (uint32_t k = 2; k < 8; ++k)
+            {
+                palette[k] = ((8 - k) * value0 + (k - 1) * value1 + 3) / 7;
+            }
+        }
+        else
+        {
+            for (uint32_t k = 2; k < 6; ++k)
+            {
+                palette[k] = ((6 - k) * value0 + (k - 1) * value1 + 2) / 5;
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+
+    struct BC4Candidate
+    {
+        uint8_t     value0;
+        uint8_t     value1;
+        uint8_t     indices[16];
+        float       error;
+    };
+
+    void EvaluateBC4(Texels const& texels, FindIndicesFunction find, uint8_t value0, uint8_t value1, BC4Candidate& best)
+    {
+        static const float c_Weights[4] = { 1.f, 0.f, 0.f, 0.f };
+
+        uint32_t values[8];
+        BC4Palette(value0, value1, values);
+
+        Palette palette = {};
+        palette.count = 8;
+        for (int p = 0; p < 8; ++p)
+        {
+            palette.c[0][p] = float(values[p]);
+        }
+
+        BC4Candidate candidate;
+        candidate.value0 = value0;
+        candidate.value1 = value1;
+        candidate.error = find(texels, palette, c_Weights, candidate.indices);
+        if (candidate.error < best.error)
+            best = candidate;
+    }
+
+    void CompressBC4(const uint8_t rgba[64], int channel, uint8_t* block)
+    {
+        const auto find = GetFindIndices();
+
+        Texels texels = {};
+        uint8_t lowest = 255, highest = 0;
+        uint8_t innerLowest = 255, innerHighest = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            uint8_t value = rgba[i * 4 + channel];
+            texels.c[0][i] = value;
+            lowest = std::min(lowest, value);
+            highest = std::max(highest, value);
+            if (value != 0 && value != 255)
+            {
+                innerLowest = std::min(innerLowest, value);
+                innerHighest = std::max(innerHighest, value);
+            }
+        }
+
+        BC4Candidate best;
+        best.error = FLT_MAX;
+
+        // Eight interpolated values between the extremes
+        if (highest > lowest)
+        {
+            EvaluateBC4(texels, find, highest, lowest, best);
+
+            for (int iteration = 0; iteration < 2 && best.error > 0.f; ++iteration)
+            {
+                float start[4], end[4];
+                if (!RefitLine(texels, 1, best.indices, c_BC4Fractions8, start, end))
+                    break;
+
+                uint8_t value0 = ToByte(start[0]), value1 = ToByte(end[0]);
+                if (value0 <= value1)
+                    break;
+
+                const float previous = best.error;
+                EvaluateBC4(texels, find, value0, value1, best);
+                if (best.error >= previous)
+                    break;
+            }
+        }
+
+        // Six between the values other than 0 and 255, which are exact in this mode
+        if (innerLowest <= innerHighest)
+            EvaluateBC4(texels, find, innerLowest, innerHighest, best);
+        else
+            EvaluateBC4(texels, find, lowest, lowest, best);
+
+        block[0] = best.value0;
+        block[1] = best.value1;
+        uint64_t bits = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            bits |= uint64_t(best.indices[i]) << (i * 3);
+        }
+        for (int b = 0; b < 6; ++b)
+        {
+            block[2 + b] = uint8_t(bits >> (b * 8));
+        }
+    }
+
+    void DecompressBC4(const uint8_t* block, int channel, uint8_t rgba[64])
+    {
+        uint32_t palette[8];
+        BC4Palette(block[0], block[1], palette);
+
+        uint64_t bits = 0;
+        for (int b = 0; b < 6; ++b)
+        {
+            bits |= uint64_t(block[2 + b]) << (b * 8);
+        }
+        for (int i = 0; i < 16; ++i)
+        {
+            rgba[i * 4 + channel] = uint8_t(palette[(bits >> (i * 3)) & 7]);
+        }
+    }
+
+    //----------------------------------------------------------------------------------------
+    // BC7 mode 6: one subset, 7-bit RGBA endpoints with a shared bit each, 4-bit indices
+
+    const uint32_t c_BC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    const float c_BC7Fractions[16] =
+    {
+        0 / 64.f, 4 / 64.f, 9 / 64.f, 13 / 64.f, 17 / 64.f, 21 / 64.f, 26 / 64.f, 30 / 64.f,
+        34 / 64.f, 38 / 64.f, 43 / 64.f, 47 / 64.f, 51 / 64.f, 55 / 64.f, 60 / 64.f, 64 / 64.f,
+    };
+
+    struct BC7Candidate
+    {
+        uint8_t     endpoint[2][4];     // 7-bit
+        uint8_t     pbit[2];
+        uint8_t     indices[16];
+        float       error;
+    };
+
+    uint32_t BC7Interpolate(uint32_t value0, uint32_t value1, uint32_t weight)
+    {
+        return ((64 - weight) * value0 + weight * value1 + 32) >> 6;
+    }
+
+    void EvaluateBC7(Texels const& texels, FindIndicesFunction find, float const start[4], float const end[4], BC7Candidate& best)
+    {
+        static const float c_Weights[4] = { 1.f, 1.f, 1.f, 1.f };
+
+        // Each pair of shared bits moves the endpoints' lattice; try them all
+        for (uint8_t bits = 0; bits < 4; ++bits)
+        {
+            BC7Candidate candidate;
+            candidate.pbit[0] = bits & 1;
+            candidate.pbit[1] = bits >> 1;
+
+            uint32_t value[2][4];
+            for (int c = 0; c < 4; ++c)
+            {
+                const float* source[2] = { start, end };
+                for (int e = 0; e < 2; ++e)
+                {
+                    float quantized = (source[e][c] - candidate.pbit[e]) * 0.5f + 0.5f;
+                    candidate.endpoint[e][c] = uint8_t(std::min(127.f, std::max(0.f, quantized)));
+                    value[e][c] = (uint32_t(candidate.endpoint[e][c]) << 1) | candidate.pbit[e];
+                }
+            }
+
+            Palette palette = {};
+            palette.count = 16;
+            for (int p = 0; p < 16; ++p)
+            {
+                for (int c = 0; c < 4; ++c)
+                {
+                    palette.c[c][p] = float(BC7Interpolate(value[0][c], value[1][c], c_BC7Weights4[p]));
+                }
+            }
+
+            candidate.error = find(texels, palette, c_Weights, candidate.indices);
+            if (candidate.error < best.error)
+                best = candidate;
+        }
+    }
+
+    void PutBits(uint8_t* block, uint32_t& position, uint32_t value, uint32_t count)
+    {
+        for (uint32_t b = 0; b < count; ++b, ++position)
+        {
+            if (value & (1u << b))
+                block[position >> 3] |= uint8_t(1u << (position & 7));
+        }
+    }
+
+    uint32_t GetBits(const uint8_t* block, uint32_t& position, uint32_t count)
+    {
+        uint32_t value = 0;
+        for (uint32_t b = 0; b < count; ++b, ++position)
+        {
+            value |= uint32_t((block[position >> 3] >> (position & 7)) & 1) << b;
+        }
+        return value;
+    }
+
+    void CompressBC7(const uint8_t rgba[64], uint8_t* block)
+    {
+        const auto find = GetFindIndices();
+
+        Texels texels;
+        LoadTexels(rgba, texels);
+
+        float start[4], end[4];
+        FitLine(texels, 4, start, end);
+
+        BC7Candidate best;
+        best.error = FLT_MAX;
+        EvaluateBC7(texels, find, start, end, best);
+
+        for (int iteration = 0; iteration < 2 && best.error > 0.f; ++iteration)
+        {
+            if (!RefitLine(texels, 4, best.indices, c_BC7Fractions, start, end))
+                break;
+
+            const float previous = best.error;
+            EvaluateBC7(texels, find, start, end, best);
+            if (best.error >= previous)
+                break;
+        }
+
+        // The first texel's index is stored without its top bit, so it must be below 8
+        if (best.indices[0] >= 8)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                std::swap(best.endpoint[0][c], best.endpoint[1][c]);
+            }
+            std::swap(best.pbit[0], best.pbit[1]);
+            for (auto& index : best.indices)
+            {
+                index = uint8_t(15 - index);
+            }
+        }
+
+        memset(block, 0, 16);
+        uint32_t position = 0;
+        PutBits(block, position, 1u << 6, 7);
+        for (int c = 0; c < 4; ++c)
+        {
+            PutBits(block, position, best.endpoint[0][c], 7);
+            PutBits(block, position, best.endpoint[1][c], 7);
+        }
+        PutBits(block, position, best.pbit[0], 1);
+        PutBits(block, position, best.pbit[1], 1);
+        for (int i = 0; i < 16; ++i)
+        {
+            PutBits(block, position, best.indices[i], i == 0 ? 3 : 4);
+        }
+    }
+
+    void DecompressBC7(const uint8_t* block, uint8_t rgba[64])
+    {
+        if ((block[0] & 0x7F) != 0x40)
+        {
+            // Not mode 6: flag it rather than guess
+            for (int i = 0; i < 16; ++i)
+            {
+                rgba[i * 4 + 0] = 255;
+                rgba[i * 4 + 1] = 0;
+                rgba[i * 4 + 2] = 255;
+                rgba[i * 4 + 3] = 255;
+            }
+            return;
+        }
+
+        uint32_t position = 7;
+        uint32_t endpoint[2][4];
+        for (int c = 0; c < 4; ++c)
+        {
+            endpoint[0][c] = GetBits(block, position, 7);
+            endpoint[1][c] = GetBits(block, position, 7);
+        }
+        uint32_t pbit0 = GetBits(block, position, 1);
+        uint32_t pbit1 = GetBits(block, position, 1);
+        for (int c = 0; c < 4; ++c)
+        {
+            endpoint[0][c] = (endpoint[0][c] << 1) | pbit0;
+            endpoint[1][c] = (endpoint[1][c] << 1) | pbit1;
+        }
+
+        for (int i = 0; i < 16; ++i)
+        {
+            uint32_t index = GetBits(block, position, i == 0 ? 3 : 4);
+            for (int c = 0; c < 4; ++c)
+            {
+                rgba[i * 4 + c] = uint8_t(BC7Interpolate(endpoint[0][c], endpoint[1][c], c_BC7Weights4[index]));
+            }
+        }
+    }
+}
+
+SimdLevel DX::GetSimdLevel()
+{
+    int level = g_simdLevel.load(std::memory_order_relaxed);
+    return level < 0 ? GetSupportedLevel() : SimdLevel(level);
+}
+
+void DX::SetSimdLevel(SimdLevel level)
+{
+    g_simdLevel.store(int(std::min(level, GetSupportedLevel())), std::memory_order_relaxed);
+}
+
+const char* DX::GetSimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::AVX2:   return "AVX2";
+    case SimdLevel::SSE2:   return "SSE2";
+    default:                return "scalar";
+    }
+}
+
+uint32_t DX::GetBlockBytes(BlockFormat format)
+{
+    return (format == BlockFormat::BC1 || format == BlockFormat::BC4) ? 8 : 16;
+}
+
+void DX::CompressBlock(BlockFormat format, const uint8_t rgba[64], uint8_t* block)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1:
+        CompressBC1(rgba, block);
+        break;
+
+    case BlockFormat::BC3:
+        CompressBC4(rgba, 3, block);
+        CompressBC1(rgba, block + 8);
+        break;
+
+    case BlockFormat::BC4:
+        CompressBC4(rgba, 0, block);
+        break;
+
+    case BlockFormat::BC5:
+        CompressBC4(rgba, 0, block);
+        CompressBC4(rgba, 1, block + 8);
+        break;
+
+    case BlockFormat::BC7:
+        CompressBC7(rgba, block);
+        break;
+    }
+}
+
+void DX::DecompressBlock(BlockFormat format, const uint8_t* block, uint8_t rgba[64])
+{
+    switch (format)
+    {
+    case BlockFormat::BC1:
+        DecompressBC1(block, rgba, false);
+        break;
+
+    case BlockFormat::BC3:
+        DecompressBC1(block + 8, rgba, true);
+        DecompressBC4(block, 3, rgba);
+        break;
+
+    case BlockFormat::BC4:
+    case BlockFormat::BC5:
+        for (int i = 0; i < 16; ++i)
+        {
+            rgba[i * 4 + 1] = rgba[i * 4 + 2] = 0;
+            rgba[i * 4 + 3] = 255;
+        }
+        DecompressBC4(block, 0, rgba);
+        if (format == BlockFormat::BC5)
+            DecompressBC4(block + 8, 1, rgba);
+        break;
+
+    case BlockFormat::BC7:
+        DecompressBC7(block, rgba);
+        break;
+    }
+}
+
+void DX::CompressImage(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, size_t rowPitch,
+    uint8_t* blocks, ParallelFor const& parallelFor)
+{
+    const uint32_t blocksWide = (width + 3) / 4;
+    const uint32_t blocksHigh = (height + 3) / 4;
+    const uint32_t blockBytes = GetBlockBytes(format);
+
+    auto compressRows = [&](size_t begin, size_t end)
+    {
+        uint8_t texels[64];
+        for (size_t by = begin; by < end; ++by)
+        {
+            for (uint32_t bx = 0; bx < blocksWide; ++bx)
+            {
+                for (uint32_t y = 0; y < 4; ++y)
+                {
+                    const uint32_t sy = std::min(uint32_t(by) * 4 + y, height - 1);
+                    for (uint32_t x = 0; x < 4; ++x)
+                    {
+                        const uint32_t sx = std::min(bx * 4 + x, width - 1);
+                        memcpy(texels + (y * 4 + x) * 4, rgba + sy * rowPitch + sx * 4, 4);
+                    }
+                }
+                CompressBlock(format, texels, blocks + (by * blocksWide + bx) * blockBytes);
+            }
+        }
+    };
+
+    if (parallelFor)
+    {
+        parallelFor(blocksHigh, 1, compressRows);
+    }
+    else
+    {
+        compressRows(0, blocksHigh);
+    }
+}
@@ -0,0 +1,49 @@
+//
+// BlockCompress.h - BC1/BC3/BC4/BC5/BC7 texture block encoders
+//
+
+#pragma once
+
+#include "../Common/ParallelFor.h"
+
+#include <stdint.h>
+
+namespace DX
+{
+    enum class BlockFormat
+    {
+        BC1,        // RGB, 4 bpp
+        BC3,        // RGB + interpolated alpha, 8 bpp
+        BC4,        // one channel (red), 4 bpp
+        BC5,        // two channels (red, green), 8 bpp
+        BC7,        // RGBA at higher quality, 8 bpp; written as mode 6 only
+    };
+
+    // The distance search the encoders spend their time in runs with the widest instruction
+    // set the CPU has; SetSimdLevel lowers it, for benchmarks. Levels the CPU lacks are ignored.
+    enum class SimdLevel
+    {
+        Scalar,
+        SSE2,
+        AVX2,
+    };
+
+    SimdLevel GetSimdLevel();
+    void SetSimdLevel(SimdLevel level);
+    const char* GetSimdLevelName(SimdLevel level);
+
+    uint32_t GetBlockBytes(BlockFormat format);
+
+    // One 4x4 block of RGBA8 texels, in rows
+    void CompressBlock(BlockFormat format, const uint8_t rgba[64], uint8_t* block);
+
+    // For measuring quality. BC7 decodes mode 6 only, which is all CompressBlock writes; BC4
+    // and BC5 put their channels in red and green, with blue 0 and alpha 255.
+    void DecompressBlock(BlockFormat format, const uint8_t* block, uint8_t rgba[64]);
+
+    // Compresses an RGBA8 image into rows of blocks, (width + 3) / 4 blocks per row. Edge
+    // blocks of sizes that are not multiples of four repeat the last row and column. Rows of
+    // blocks are spread over parallelFor when one is given.
+    void CompressImage(BlockFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, size_t rowPitch,
+        uint8_t* blocks, ParallelFor const& parallelFor = nullptr);
+}
@@ -0,0 +1,315 @@
+//
+// ClusterBench.cpp - Speed and correctness of the game's cluster culling on real models
+//
+
+#include "ClusterBench.h"
+#include "BenchCamera.h"
+#include "Cooker.h"
+#include "MeshClusters.h"
+#include "ModelData.h"
+#include "VertexPacking.h"
+#include "../Common/FileIO.h"
+
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const char* const c_ModelExtensions[] = { ".sdkmesh", ".cmo", ".vbo", nullptr };
+
+    // Views on a spiral all round the model, alternately far enough to see all of it and
+    // near and looking off to one side of it, so that the frustum cuts it
+    const unsigned c_Views = 64;
+    const float c_FarDistance = 2.5f;
+    const float c_NearDistance = 1.25f;
+    const float c_NearAimOffset = 1.5f;
+    const float c_FieldOfView = 1.2217305f;     // 70 degrees, as the game's
+    const float c_AspectRatio = 16.f / 9.f;
+
+    // Culling is timed over repeated sweeps of every view until this much time has passed
+    const double c_MinBenchMs = 50.0;
+
+    // Slack for rounding in the triangle checks, relative to the values compared
+    const float c_Tolerance = 1e-4f;
+
+    struct ClusteredPart
+    {
+        PartClusters const*     clusters;
+        std::vector<float>      positions;
+        bool                    counterClockwise;
+    };
+
+    struct ClusterBenchResult
+    {
+        uint64_t        clusters;
+        uint64_t        triangles;
+        double          buildMs;
+        ClusterCulling  culling;        // of one sweep
+        double          cullMs;         // per sweep
+        uint64_t        wronglyCulled;
+    };
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    struct BenchView
+    {
+        ClusterView     view;
+        float           modelToClip[16];
+    };
+
+    std::vector<BenchView> MakeViews(const float* center, float radius)
+    {
+        std::vector<BenchView> views(c_Views);
+        for (unsigned i = 0; i < c_Views; ++i)
+        {
+            // A Fibonacci spiral spreads the directions evenly over the sphere
+            const float y = 1.f - 2.f * (float(i) + 0.5f) / float(c_Views);
+            const float ring = sqrtf(std::max(1.f - y * y, 0.f));
+            const float angle = 2.3999632f * float(i);
+            const float direction[3] = { ring * cosf(angle), y, ring * sinf(angle) };
+
+            const bool isNear = (i & 1) != 0;
+            const float distance = radius * (isNear ? c_NearDistance : c_FarDistance);
+            const float eye[3] = { center[0] + direction[0] * distance, center[1] + direction[1] * distance,
+                center[2] + direction[2] * distance };
+            const float up[3] = { 0.f, fabsf(y) > 0.99f ? 0.f : 1.f, fabsf(y) > 0.99f ? 1.f : 0.f };
+
+            float side[3];
+            Cross(direction, up, side);
+            Normalise(side);
+            const float offset = isNear ? radius * c_NearAimOffset : 0.f;
+            const float target[3] = { center[0] + side[0] * offset, center[1] + side[1] * offset,
+                center[2] + side[2] * offset };
+
+            float view[16], projection[16];
+            LookAt(eye, target, up, view);
+            Perspective(c_FieldOfView, c_AspectRatio, radius * 0.01f, radius * 10.f, projection);
+            Multiply(view, projection, views[i].modelToClip);
+            MakeClusterView(views[i].modelToClip, eye, views[i].view);
+        }
+        return views;
+    }
+
+    // Whether the triangle could show in the view: not wholly outside one side of clip space
+    // and not facing away from the camera. Checked in clip space and by the triangle's own
+    // normal, not through the cluster's bounds.
+    bool CouldShow(ClusteredPart const& part, const uint32_t* triangle, BenchView const& view)
+    {
+        float clip[3][4];
+        const float* corners[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            corners[k] = &part.positions[size_t(triangle[k]) * 3];
+            for (int c = 0; c < 4; ++c)
+            {
+                clip[k][c] = corners[k][0] * view.modelToClip[c] + corners[k][1] * view.modelToClip[4 + c]
+                    + corners[k][2] * view.modelToClip[8 + c] + view.modelToClip[12 + c];
+            }
+        }
+
+        // Each side as a distance that is negative outside: w + x, w - x, w + y, w - y, z, w - z
+        for (int side = 0; side < 6; ++side)
+        {
+            bool outside = true;
+            for (int k = 0; k < 3 && outside; ++k)
+            {
+                const float w = clip[k][3];
+                const float axis = clip[k][side / 2];
+                const float distance = (side < 4) ? w + ((side & 1) ? -axis : axis) : ((side == 4) ? axis : w - axis);
+                outside = distance < -c_Tolerance * (fabsf(w) + fabsf(axis));
+            }
+            if (outside)
+                return false;
+        }
+
+        const float e1[3] = { corners[1][0] - corners[0][0], corners[1][1] - corners[0][1], corners[1][2] - corners[0][2] };
+        const float e2[3] = { corners[2][0] - corners[0][0], corners[2][1] - corners[0][1], corners[2][2] - corners[0][2] };
+        float normal[3];
+        Cross(e1, e2, normal);
+        if (part.counterClockwise)
+        {
+            for (float& value : normal)
+            {
+                value = -value;
+            }
+        }
+
+        const float* camera = view.view.camera;
+        const float toCorner[3] = { corners[0][0] - camera[0], corners[0][1] - camera[1], corners[0][2] - camera[2] };
+        return Dot(normal, toCorner) < -c_Tolerance * sqrtf(Dot(normal, normal) * Dot(toCorner, toCorner));
+    }
+
+    ClusterBenchResult BenchmarkModel(fs::path const& file)
+    {
+        ClusterBenchResult result = {};
+
+        auto data = ReadFile(file);
+        auto model = ModelData::Parse(file.wstring().c_str(), data.data(), data.size());
+        PackModelVertices(*model);
+
+        auto start = std::chrono::steady_clock::now();
+        auto clusters = BuildModelClusters(*model);
+        result.buildMs = MillisecondsSince(start);
+
+        std::vector<ClusteredPart> parts;
+        std::vector<uint32_t> indices;
+        float minimum[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+        float maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        size_t largestPart = 0;
+        for (size_t m = 0; m < clusters.size(); ++m)
+        {
+            auto const& mesh = model->meshes[m];
+            for (size_t p = 0; p < clusters[m].parts.size(); ++p)
+            {
+                auto const& part = clusters[m].parts[p];
+                if (part.clusters.empty())
+                    continue;
+
+                ClusteredPart clustered = { &part, {}, mesh.ccw };
+                ReadClusterPart(*model, mesh, mesh.parts[p], indices, clustered.positions);
+                parts.push_back(std::move(clustered));
+
+                for (auto const& cluster : part.clusters)
+                {
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        minimum[i] = std::min(minimum[i], cluster.center[i] - cluster.radius);
+                        maximum[i] = std::max(maximum[i], cluster.center[i] + cluster.radius);
+                    }
+                    result.triangles += cluster.triangleCount;
+                }
+                result.clusters += part.clusters.size();
+                largestPart = std::max(largestPart, part.indices.size());
+            }
+        }
+        if (parts.empty())
+            return result;
+
+        const float center[3] = { (minimum[0] + maximum[0]) * 0.5f, (minimum[1] + maximum[1]) * 0.5f,
+            (minimum[2] + maximum[2]) * 0.5f };
+        const float extent[3] = { maximum[0] - center[0], maximum[1] - center[1], maximum[2] - center[2] };
+        const auto views = MakeViews(center, std::max(sqrtf(Dot(extent, extent)), FLT_MIN));
+
+        // The game draws each part from the narrowest index buffer that holds it
+        std::vector<uint16_t> narrow(largestPart);
+        std::vector<uint32_t> wide(largestPart);
+        auto sweep = [&](ClusterCulling& culling)
+        {
+            for (auto const& view : views)
+            {
+                for (auto const& part : parts)
+                {
+                    if (part.clusters->wide)
+                        CullPartClusters(*part.clusters, view.view, wide.data(), culling);
+                    else
+                        CullPartClusters(*part.clusters, view.view, narrow.data(), culling);
+                }
+            }
+        };
+
+        sweep(result.culling);
+
+        unsigned sweeps = 0;
+        ClusterCulling discard = {};
+        start = std::chrono::steady_clock::now();
+        double elapsed;
+        do
+        {
+            sweep(discard);
+            ++sweeps;
+            elapsed = MillisecondsSince(start);
+        } while (elapsed < c_MinBenchMs);
+        result.cullMs = elapsed / sweeps;
+
+        for (auto const& view : views)
+        {
+            for (auto const& part : parts)
+            {
+                for (auto const& cluster : part.clusters->clusters)
+                {
+                    if (ClassifyCluster(cluster, view.view) == Cluster_Visible)
+                        continue;
+
+                    const uint32_t* triangles = &part.clusters->indices[cluster.startIndex];
+                    for (uint32_t t = 0; t < cluster.triangleCount; ++t)
+                    {
+                        result.wronglyCulled += CouldShow(part, &triangles[t * 3], view) ? 1 : 0;
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    double Percent(uint64_t part, uint64_t whole)
+    {
+        return whole ? 100.0 * double(part) / double(whole) : 0.0;
+    }
+}
+
+int DX::BenchmarkClusters(std::vector<fs::path> const& files)
+{
+    size_t measured = 0;
+    ClusterBenchResult total = {};
+
+    printf("%-40s %8s %9s %6s %8s %8s %8s %8s %8s %10s %7s\n", "model", "clusters", "triangles", "tris/c",
+        "build ms", "frustum", "backface", "culled", "sweep ms", "tris/ms", "wrong");
+    for (auto const& file : files)
+    {
+        if (!HasExtension(file, c_ModelExtensions))
+            continue;
+
+        ClusterBenchResult result;
+        try
+        {
+            result = BenchmarkModel(file);
+        }
+        catch (std::exception const& e)
+        {
+            fprintf(stderr, "AssetCooker: %s: %s\n", file.generic_u8string().c_str(), e.what());
+            continue;
+        }
+
+        auto const& culling = result.culling;
+        printf("%-40s %8llu %9llu %6.1f %8.2f %7.1f%% %7.1f%% %7.1f%% %8.3f %10.0f %7llu\n", file.generic_u8string().c_str(),
+            (unsigned long long)result.clusters, (unsigned long long)result.triangles,
+            result.clusters ? double(result.triangles) / double(result.clusters) : 0.0, result.buildMs,
+            Percent(culling.frustumCulled, culling.clusters), Percent(culling.backfaceCulled, culling.clusters),
+            Percent(culling.trianglesCulled, culling.triangles), result.cullMs,
+            result.cullMs > 0.0 ? double(culling.trianglesCulled) / result.cullMs : 0.0,
+            (unsigned long long)result.wronglyCulled);
+
+        total.clusters += result.clusters;
+        total.triangles += result.triangles;
+        total.buildMs += result.buildMs;
+        total.culling.clusters += culling.clusters;
+        total.culling.frustumCulled += culling.frustumCulled;
+        total.culling.backfaceCulled += culling.backfaceCulled;
+        total.culling.triangles += culling.triangles;
+        total.culling.trianglesCulled += culling.trianglesCulled;
+        total.cullMs += result.cullMs;
+        total.wronglyCulled += result.wronglyCulled;
+        ++measured;
+    }
+
+    // Percentages are of the clusters and triangles tested over all the views
+    printf("%zu models: %llu clusters of %.1f triangles, built in %.2f ms; over %u views each, %.1f%% of clusters "
+        "outside the frustum, %.1f%% facing away, %.1f%% of triangles culled, %.0f triangles rejected per ms, "
+        "%llu wrongly culled\n", measured, (unsigned long long)total.clusters,
+        total.clusters ? double(total.triangles) / double(total.clusters) : 0.0, total.buildMs, c_Views,
+        Percent(total.culling.frustumCulled, total.culling.clusters), Percent(total.culling.backfaceCulled, total.culling.clusters),
+        Percent(total.culling.trianglesCulled, total.culling.triangles),
+        total.cullMs > 0.0 ? double(total.culling.trianglesCulled) / total.cullMs : 0.0,
+        (unsigned long long)total.wronglyCulled);
+    return (measured && !total.wronglyCulled) ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+//
+// ClusterBench.h - Speed and correctness of the game's cluster culling on real models
+//
+
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+namespace DX
+{
+    // Splits every model's meshes into clusters as the game does when it loads them
+    // (MeshClusters.h), after packing its vertices, then culls them from views all round each
+    // model, near and far, and reports the clusters and triangles culled by the frustum and by
+    // their cones and how many triangles the culling rejects each millisecond. Every triangle
+    // of a culled cluster is checked against the view it was culled from; any that could have
+    // shown are counted, and fail the run.
+    int BenchmarkClusters(std::vector<std::filesystem::path> const& files);
+}
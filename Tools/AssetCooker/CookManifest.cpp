@@ -0,0 +1,178 @@
+//
+// CookManifest.cpp - Record of what each cooked asset was built from
+//
+
+#include "CookManifest.h"
+#include "../Common/FileIO.h"
+
+#include <fstream>
+#include <inttypes.h>
+#include <sstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const char c_Signature[] = "AssetCooker manifest";
+
+    std::vector<std::string> SplitTabs(std::string const& line)
+    {
+        std::vector<std::string> fields;
+        size_t begin = 0;
+        for (;;)
+        {
+            size_t end = line.find('\t', begin);
+            fields.push_back(line.substr(begin, end - begin));
+            if (end == std::string::npos)
+                return fields;
+            begin = end + 1;
+        }
+    }
+
+    uint64_t ParseUnsigned(std::string const& text, int base = 10)
+    {
+        size_t used = 0;
+        uint64_t value = 0;
+        try
+        {
+            value = std::stoull(text, &used, base);
+        }
+        catch (std::exception const&)
+        {
+            used = 0;
+        }
+        if (text.empty() || used != text.size() || text[0] == '-')
+            throw std::runtime_error("damaged cook manifest: bad number " + text);
+        return value;
+    }
+
+    int64_t ParseSigned(std::string const& text)
+    {
+        size_t used = 0;
+        int64_t value = 0;
+        try
+        {
+            value = std::stoll(text, &used);
+        }
+        catch (std::exception const&)
+        {
+            used = 0;
+        }
+        if (text.empty() || used != text.size())
+            throw std::runtime_error("damaged cook manifest: bad number " + text);
+        return value;
+    }
+}
+
+void CookManifest::Load(fs::path const& path)
+{
+    m_records.clear();
+
+    std::ifstream file(path);
+    if (!file)
+        return;
+
+    std::string line;
+    if (!std::getline(file, line))
+        return;
+
+    auto header = SplitTabs(line);
+    if (header.size() != 2 || header[0] != c_Signature || header[1] != std::to_string(c_Version))
+        return;
+
+    Record* current = nullptr;
+    while (std::getline(file, line))
+    {
+        if (line.empty())
+            continue;
+
+        auto fields = SplitTabs(line);
+        if (fields[0] == "asset" && fields.size() == 7)
+        {
+            Record record;
+            record.cooker = fields[2];
+            record.cookerVersion = uint32_t(ParseUnsigned(fields[3]));
+            record.settings = fields[4];
+            record.output = fields[5];
+            record.outputSize = ParseUnsigned(fields[6]);
+            current = &(m_records[fields[1]] = std::move(record));
+        }
+        else if (fields[0] == "input" && fields.size() == 5 && current)
+        {
+            Input input;
+            input.size = ParseUnsigned(fields[1]);
+            input.modified = ParseSigned(fields[2]);
+            input.hash = ParseUnsigned(fields[3], 16);
+            input.path = fields[4];
+            current->inputs.push_back(std::move(input));
+        }
+        else
+        {
+            throw std::runtime_error("damaged cook manifest: " + line);
+        }
+    }
+}
+
+void CookManifest::Save(fs::path const& path) const
+{
+    std::ostringstream text;
+    text << c_Signature << '\t' << c_Version << '\n';
+
+    char hash[32];
+    for (auto const& entry : m_records)
+    {
+        auto const& record = entry.second;
+        text << "asset\t" << entry.first << '\t' << record.cooker << '\t' << record.cookerVersion << '\t'
+            << record.settings << '\t' << record.output << '\t' << record.outputSize << '\n';
+
+        for (auto const& input : record.inputs)
+        {
+            snprintf(hash, sizeof(hash), "%016" PRIx64, input.hash);
+            text << "input\t" << input.size << '\t' << input.modified << '\t' << hash << '\t' << input.path << '\n';
+        }
+    }
+
+    auto bytes = text.str();
+    WriteFileAtomically(path, reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+}
+
+const CookManifest::Record* CookManifest::Find(std::string const& source) const
+{
+    auto found = m_records.find(source);
+    return found != m_records.end() ? &found->second : nullptr;
+}
+
+void CookManifest::Set(std::string const& source, Record record)
+{
+    m_records[source] = std::move(record);
+}
+
+void CookManifest::Remove(std::string const& source)
+{
+    m_records.erase(source);
+}
+
+CookManifest::Input CookManifest::Describe(fs::path const& path, const std::vector<uint8_t>* data)
+{
+    Input input;
+    input.path = path.lexically_normal().generic_u8string();
+    input.modified = int64_t(fs::last_write_time(path).time_since_epoch().count());
+
+    if (data)
+    {
+        input.size = data->size();
+        input.hash = HashBytes(data->data(), data->size());
+    }
+    else
+    {
+        auto contents = ReadFile(path);
+        input.size = contents.size();
+        input.hash = HashBytes(contents.data(), contents.size());
+    }
+    return input;
+}
@@ -0,0 +1,60 @@
+//
+// CookManifest.h - Record of what each cooked asset was built from
+//
+
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DX
+{
+    // One record per source asset: the cooker and version that built it, the output it wrote,
+    // and every input it read with the size, modification time and content hash it had then.
+    // Stored as tab-separated text beside the cooked files, so it diffs and reads easily. An
+    // asset is cooked again only when its cooker's version, its output or an input's contents
+    // changed; inputs whose size and time are unchanged are not even read.
+    class CookManifest
+    {
+    public:
+        static const uint32_t c_Version = 2;
+
+        struct Input
+        {
+            std::string     path;           // UTF-8, '/' separated, relative to the content directory
+            uint64_t        size;
+            int64_t         modified;       // file clock ticks; only compared for equality
+            uint64_t        hash;
+        };
+
+        struct Record
+        {
+            std::string         cooker;
+            uint32_t            cookerVersion;
+            std::string         settings;
+            std::string         output;     // relative to the cooked directory
+            uint64_t            outputSize;
+            std::vector<Input>  inputs;     // the source first
+        };
+
+        // A missing manifest, or one written by another version of the tool, loads empty, which
+        // rebuilds everything; a damaged one throws std::runtime_error.
+        void Load(std::filesystem::path const& path);
+        void Save(std::filesystem::path const& path) const;
+
+        const Record* Find(std::string const& source) const;
+        void Set(std::string const& source, Record record);
+        void Remove(std::string const& source);
+
+        std::map<std::string, Record> const& GetRecords() const { return m_records; }
+
+        // Describes a file as it is now; reads and hashes it unless 'data' already holds it.
+        static Input Describe(std::filesystem::path const& path, const std::vector<uint8_t>* data = nullptr);
+
+    private:
+        std::map<std::string, Record>   m_records;  // by source path, kept sorted for stable output
+    };
+}
@@ -0,0 +1,57 @@
+//
+// Cooker.cpp - Shared cooker helpers, and the cooker for content used as it is
+//
+
+#include "Cooker.h"
+
+#include <string>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const char* const c_CopiedExtensions[] = { ".scene", ".spritefont", ".cso", nullptr };
+
+    // Content the game reads unchanged still goes through the cook, so the cooked directory is
+    // complete on its own and can be packed by itself.
+    class CopyCooker : public Cooker
+    {
+    public:
+        const char* GetName() const override { return "copy"; }
+        uint32_t GetVersion() const override { return 1; }
+
+        bool Accepts(fs::path const& source) const override
+        {
+            return HasExtension(source, c_CopiedExtensions);
+        }
+
+        std::vector<uint8_t> Cook(fs::path const&, std::vector<uint8_t> const& data, std::vector<fs::path>&) const override
+        {
+            return data;
+        }
+    };
+}
+
+bool DX::HasExtension(fs::path const& path, const char* const* extensions)
+{
+    std::string extension = path.extension().string();
+    for (auto& c : extension)
+    {
+        if (c >= 'A' && c <= 'Z')
+            c = char(c - 'A' + 'a');
+    }
+
+    for (; *extensions; ++extensions)
+    {
+        if (extension == *extensions)
+            return true;
+    }
+    return false;
+}
+
+std::unique_ptr<Cooker> DX::CreateCopyCooker()
+{
+    return std::make_unique<CopyCooker>();
+}
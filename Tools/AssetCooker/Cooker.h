@@ -0,0 +1,62 @@
+//
+// Cooker.h - Converts one kind of source asset into the form the game loads
+//
+
+#pragma once
+
+#include "../Common/ParallelFor.h"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include <vector>
+
+namespace DX
+{
+    enum class MipFilter;
+
+    // A cooker is stateless, so one instance cooks many assets at once on the tool's threads.
+    // Bump a cooker's version whenever its output for the same input changes; the manifest
+    // records it, and every asset the old version cooked is rebuilt on the next run.
+    class Cooker
+    {
+    public:
+        virtual ~Cooker() = default;
+
+        virtual const char* GetName() const = 0;
+        virtual uint32_t GetVersion() const = 0;
+
+        // Options that change the output, recorded with the version; empty when there are none.
+        virtual std::string GetSettings() const { return std::string(); }
+
+        virtual bool Accepts(std::filesystem::path const& source) const = 0;
+
+        // Cooked assets keep their source's name, and so their place in the pack and the name the
+        // game asks for, unless the cooker converts to another file type.
+        virtual std::filesystem::path GetOutputName(std::filesystem::path const& source) const { return source; }
+
+        // Returns the cooked bytes; failures throw std::runtime_error. Any other file the result
+        // was built from is added to 'dependencies', so a change to it also dirties the asset.
+        virtual std::vector<uint8_t> Cook(std::filesystem::path const& source, std::vector<uint8_t> const& data,
+            std::vector<std::filesystem::path>& dependencies) const = 0;
+    };
+
+    // Block compresses the textures it can decode, with full mip chains (TextureCooker.h,
+    // MipChain.h); half-float DDS files get mips but stay uncompressed.
+    std::unique_ptr<Cooker> CreateTextureCooker(bool highQuality, MipFilter mipFilter, ParallelFor parallelFor);
+
+    // Cooks an .atlas file, a list of small textures, to one page holding them all.
+    std::unique_ptr<Cooker> CreateAtlasCooker(bool highQuality, MipFilter mipFilter, ParallelFor parallelFor);
+
+    // Converts a Wavefront .obj to .sdkmesh, in place of a hand-converted one beside it. Every
+    // model is then optimised (MeshOptimiser.h), its vertices packed (VertexPacker.h) and levels
+    // of detail appended (MeshSimplifier.h).
+    std::unique_ptr<Cooker> CreateMeshCooker();
+
+    std::unique_ptr<Cooker> CreateSoundCooker();
+    std::unique_ptr<Cooker> CreateCopyCooker();
+
+    // Extension match, ignoring case; 'extensions' is a null-terminated list of ".ext" strings.
+    bool HasExtension(std::filesystem::path const& path, const char* const* extensions);
+}
@@ -0,0 +1,139 @@
+//
+// CullBench.cpp - Speed and correctness of the game's batched frustum culling
+//
+
+#include "CullBench.h"
+#include "BenchCamera.h"
+#include "FrustumCuller.h"
+
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+using namespace DX;
+
+namespace
+{
+    const size_t c_Counts[] = { 10000, 100000, 1000000 };
+
+    // Spheres fill a cube round the camera, so a view sees about a sixth of them; some are
+    // big enough to straddle several planes at once
+    const float c_Extent = 200.f;
+    const float c_MinRadius = 0.05f;
+    const float c_MaxRadius = 8.f;
+    const unsigned c_Seed = 1;
+
+    // The game's field of view and depth range
+    const unsigned c_Views = 16;
+    const float c_FieldOfView = 1.2217305f;     // 70 degrees
+    const float c_AspectRatio = 16.f / 9.f;
+    const float c_NearPlane = 0.1f;
+    const float c_FarPlane = 150.f;
+
+    // Each view is culled repeatedly until this much time has passed
+    const double c_MinBenchMs = 50.0;
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Turned round the vertical axis and tipped up and down in turn
+    void GetViewProjection(unsigned view, float* viewProjection)
+    {
+        const float yaw = 6.2831853f * float(view) / float(c_Views);
+        const float pitch = (view & 1) ? 0.4f : -0.3f;
+        const float eye[3] = { 0.f, 0.f, 0.f };
+        const float target[3] = { sinf(yaw) * cosf(pitch), sinf(pitch), cosf(yaw) * cosf(pitch) };
+        const float up[3] = { 0.f, 1.f, 0.f };
+
+        float lookAt[16];
+        float projection[16];
+        LookAt(eye, target, up, lookAt);
+        Perspective(c_FieldOfView, c_AspectRatio, c_NearPlane, c_FarPlane, projection);
+        Multiply(lookAt, projection, viewProjection);
+    }
+
+    struct LevelResult
+    {
+        uint64_t    tested;
+        uint64_t    visible;
+        double      ms;
+    };
+
+    LevelResult TimeViews(FrustumCuller& culler)
+    {
+        LevelResult result = {};
+        auto start = std::chrono::steady_clock::now();
+        do
+        {
+            for (unsigned view = 0; view < c_Views; ++view)
+            {
+                float viewProjection[16];
+                GetViewProjection(view, viewProjection);
+                culler.SetViewProjection(viewProjection);
+                result.visible += culler.Cull();
+                result.tested += culler.GetCount();
+            }
+            result.ms = MillisecondsSince(start);
+        } while (result.ms < c_MinBenchMs);
+        return result;
+    }
+}
+
+int DX::BenchmarkFrustumCulling()
+{
+    const auto widest = GetFrustumSimdLevel();
+    uint64_t mismatches = 0;
+
+    printf("%10s %-6s %10s %10s %14s\n", "spheres", "level", "visible", "ms/cull", "spheres/ms");
+    for (size_t count : c_Counts)
+    {
+        std::mt19937 random(c_Seed);
+        std::uniform_real_distribution<float> position(-c_Extent, c_Extent);
+        std::uniform_real_distribution<float> radius(c_MinRadius, c_MaxRadius);
+
+        FrustumCuller culler;
+        culler.Reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const float x = position(random);
+            const float y = position(random);
+            const float z = position(random);
+            culler.Add(x, y, z, radius(random));
+        }
+
+        // Every level's list must match the scalar loop's, view by view
+        std::vector<std::vector<uint32_t>> expected(c_Views);
+        for (int level = 0; level <= int(widest); ++level)
+        {
+            SetFrustumSimdLevel(FrustumSimdLevel(level));
+            for (unsigned view = 0; view < c_Views; ++view)
+            {
+                float viewProjection[16];
+                GetViewProjection(view, viewProjection);
+                culler.SetViewProjection(viewProjection);
+                culler.Cull();
+                if (level == 0)
+                    expected[view] = culler.GetVisible();
+                else if (culler.GetVisible() != expected[view])
+                    ++mismatches;
+            }
+        }
+
+        for (int level = 0; level <= int(widest); ++level)
+        {
+            SetFrustumSimdLevel(FrustumSimdLevel(level));
+            auto result = TimeViews(culler);
+            printf("%10zu %-6s %9.1f%% %10.3f %14.0f\n", count, GetFrustumSimdLevelName(FrustumSimdLevel(level)),
+                100.0 * double(result.visible) / double(result.tested), result.ms / double(result.tested / count),
+                double(result.tested) / result.ms);
+        }
+    }
+    SetFrustumSimdLevel(widest);
+
+    printf("%u views of each set, %s widest, %llu views whose visible lists differ between levels\n", c_Views,
+        GetFrustumSimdLevelName(widest), (unsigned long long)mismatches);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,229 @@
+//
+// JobBench.cpp - Speed and correctness of the game's work-stealing job system
+//
+
+#include "JobBench.h"
+#include "JobSystem.h"
+
+#include <chrono>
+#include <stdio.h>
+
+using namespace DX;
+
+namespace
+{
+    // ParallelFor: a sum of squares, in ranges about as small as the game's
+    const size_t c_ForCount = 1 << 20;
+    const size_t c_ForGrain = 256;
+
+    // Dependencies: chains of jobs, each a little work long, and one job waiting on every chain
+    const size_t c_Chains = 64;
+    const size_t c_ChainLength = 64;
+
+    // Stealing: the main thread queues parents, and each parent queues children on its own
+    // thread's deque
+    const size_t c_Parents = 256;
+    const size_t c_Children = 16;
+
+    // Spins of busy work in each chained or stolen job, about a microsecond
+    const unsigned c_JobWork = 256;
+
+    // Each test repeats until this much time has passed
+    const double c_MinBenchMs = 50.0;
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    uint32_t Work(uint32_t seed)
+    {
+        for (unsigned i = 0; i < c_JobWork; ++i)
+        {
+            seed = seed * 1664525u + 1013904223u;
+        }
+        return seed;
+    }
+
+    struct TestResult
+    {
+        uint64_t    items;      // ranges or jobs
+        uint64_t    stolen;
+        uint64_t    failures;
+        double      ms;
+    };
+
+    // Every index is counted once, and the sum is the closed form's
+    bool RunParallelFor(JobSystem& jobs, std::vector<uint8_t>& hits)
+    {
+        std::fill(hits.begin(), hits.end(), uint8_t(0));
+        std::atomic<uint64_t> sum(0);
+        jobs.ParallelFor(c_ForCount, c_ForGrain, [&](size_t begin, size_t end)
+        {
+            uint64_t partial = 0;
+            for (size_t i = begin; i < end; ++i)
+            {
+                partial += uint64_t(i) * i;
+                ++hits[i];
+            }
+            sum += partial;
+        });
+
+        const uint64_t n = c_ForCount - 1;
+        bool correct = sum == n * (n + 1) * (2 * n + 1) / 6;
+        for (size_t i = 0; i < c_ForCount && correct; ++i)
+        {
+            correct = hits[i] == 1;
+        }
+        return correct;
+    }
+
+    // Each job finds its chain as far along as its place in it, and the join finds every
+    // chain complete
+    bool RunChains(JobSystem& jobs)
+    {
+        std::vector<std::atomic<size_t>> progress(c_Chains);
+        std::atomic<size_t> outOfOrder(0);
+        std::atomic<uint32_t> sink(0);
+
+        std::vector<JobSystem::Handle> tails;
+        for (size_t c = 0; c < c_Chains; ++c)
+        {
+            progress[c] = 0;
+            JobSystem::Handle previous;
+            for (size_t k = 0; k < c_ChainLength; ++k)
+            {
+                previous = jobs.Submit([&, c, k]()
+                {
+                    sink += Work(uint32_t(k));
+                    if (progress[c].load() != k)
+                        ++outOfOrder;
+                    progress[c] = k + 1;
+                }, { previous });
+            }
+            tails.push_back(previous);
+        }
+
+        bool joined = false;
+        auto join = jobs.Submit([&]()
+        {
+            joined = true;
+            for (auto& chain : progress)
+            {
+                joined &= chain.load() == c_ChainLength;
+            }
+        }, tails);
+        jobs.Wait(join);
+
+        return joined && !outOfOrder;
+    }
+
+    // Records which thread queued and which ran every job; the system's stolen count must
+    // equal the jobs that ran elsewhere
+    bool RunStealing(JobSystem& jobs, uint64_t& stolen)
+    {
+        struct Record
+        {
+            std::thread::id queuedOn;
+            std::thread::id ranOn;
+            std::atomic<int> runs;
+        };
+        std::vector<Record> records(c_Parents * (c_Children + 1));
+        std::atomic<uint32_t> sink(0);
+
+        jobs.ResetStatistics();
+
+        std::vector<JobSystem::Handle> parents;
+        for (size_t p = 0; p < c_Parents; ++p)
+        {
+            Record& parent = records[p * (c_Children + 1)];
+            parent.queuedOn = std::this_thread::get_id();
+            parent.runs = 0;
+            parents.push_back(jobs.Submit([&, p]()
+            {
+                Record& self = records[p * (c_Children + 1)];
+                self.ranOn = std::this_thread::get_id();
+                ++self.runs;
+
+                std::vector<JobSystem::Handle> children;
+                for (size_t c = 1; c <= c_Children; ++c)
+                {
+                    Record& child = records[p * (c_Children + 1) + c];
+                    child.queuedOn = std::this_thread::get_id();
+                    child.runs = 0;
+                    children.push_back(jobs.Submit([&child, &sink, c]()
+                    {
+                        child.ranOn = std::this_thread::get_id();
+                        ++child.runs;
+                        sink += Work(uint32_t(c));
+                    }));
+                }
+                for (auto& child : children)
+                {
+                    jobs.Wait(child);
+                }
+            }));
+        }
+        for (auto& parent : parents)
+        {
+            jobs.Wait(parent);
+        }
+
+        uint64_t elsewhere = 0;
+        bool correct = true;
+        for (auto& record : records)
+        {
+            correct &= record.runs == 1;
+            elsewhere += record.ranOn != record.queuedOn;
+        }
+
+        const auto statistics = jobs.GetStatistics();
+        stolen = statistics.stolen;
+        return correct && statistics.executed == records.size() && statistics.stolen == elsewhere;
+    }
+
+    template <typename Test>
+    TestResult Repeat(uint64_t itemsPerRun, Test const& test)
+    {
+        TestResult result = {};
+        auto start = std::chrono::steady_clock::now();
+        do
+        {
+            uint64_t stolen = 0;
+            if (!test(stolen))
+                ++result.failures;
+            result.items += itemsPerRun;
+            result.stolen += stolen;
+            result.ms = MillisecondsSince(start);
+        } while (result.ms < c_MinBenchMs);
+        return result;
+    }
+}
+
+int DX::BenchmarkJobSystem(unsigned maxWorkers)
+{
+    uint64_t failures = 0;
+    std::vector<uint8_t> hits(c_ForCount);
+
+    printf("%7s %14s %14s %14s %8s %8s\n", "workers", "ranges/ms", "chained/ms", "stealing/ms", "stolen", "failed");
+    for (unsigned workers = 1; workers <= maxWorkers; ++workers)
+    {
+        JobSystem jobs(workers);
+
+        auto parallelFor = Repeat((c_ForCount + c_ForGrain - 1) / c_ForGrain,
+            [&](uint64_t&) { return RunParallelFor(jobs, hits); });
+        auto chains = Repeat(c_Chains * c_ChainLength + 1,
+            [&](uint64_t&) { return RunChains(jobs); });
+        auto stealing = Repeat(c_Parents * (c_Children + 1),
+            [&](uint64_t& stolen) { return RunStealing(jobs, stolen); });
+
+        const uint64_t failed = parallelFor.failures + chains.failures + stealing.failures;
+        printf("%7u %14.0f %14.0f %14.0f %7.1f%% %8llu\n", workers, double(parallelFor.items) / parallelFor.ms,
+            double(chains.items) / chains.ms, double(stealing.items) / stealing.ms,
+            100.0 * double(stealing.stolen) / double(stealing.items), (unsigned long long)failed);
+        failures += failed;
+    }
+
+    printf("1 to %u workers: %llu runs failed their checks\n", maxWorkers, (unsigned long long)failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+//
+// JobBench.h - Speed and correctness of the game's work-stealing job system
+//
+
+#pragma once
+
+namespace DX
+{
+    // Runs a JobSystem with 1 to 'maxWorkers' workers through the three kinds of work the game
+    // gives it: a ParallelFor over many small ranges, chains of dependent jobs joined at the
+    // end, and jobs that queue more jobs for other threads to steal. Every range must run
+    // exactly once, every job after the jobs it depends on, and the stolen count must match
+    // the jobs run off the thread that queued them; anything else fails the run. Reports the
+    // ranges and jobs run each millisecond and the share of jobs stolen.
+    int BenchmarkJobSystem(unsigned maxWorkers);
+}
@@ -0,0 +1,304 @@
+//
+// LoadBench.cpp - Speed and memory of the game's model loading, mapped and copied, and of its parser
+//
+
+#include "LoadBench.h"
+#include "Cooker.h"
+#include "JobSystem.h"
+#include "MappedFile.h"
+#include "ModelData.h"
+#include "../Common/FileIO.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const char* const c_MeshExtensions[] = { ".sdkmesh", nullptr };
+    const char* const c_ModelExtensions[] = { ".sdkmesh", ".cmo", ".vbo", nullptr };
+
+    // Models parsed in each job
+    const size_t c_ParseGrain = 4;
+
+    // Each way repeats whole passes until this much time has passed
+    const double c_MinBenchMs = 50.0;
+
+    struct LoadResult
+    {
+        uint64_t    parts;
+        uint64_t    bytes;          // of vertex and index data read
+        uint64_t    checksum;
+        unsigned    passes;
+        double      ms;             // per pass
+        double      startMB;        // resident before the first pass
+        double      peakMB;         // resident at most
+    };
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // The largest resident set so far; zero where it cannot be had
+    double PeakResidentMB()
+    {
+#if defined(_WIN32)
+        return 0.0;
+#else
+        rusage usage = {};
+        if (getrusage(RUSAGE_SELF, &usage))
+            return 0.0;
+#if defined(__APPLE__)
+        return double(usage.ru_maxrss) / (1024.0 * 1024.0);     // bytes
+#else
+        return double(usage.ru_maxrss) / 1024.0;                // kilobytes
+#endif
+#endif
+    }
+
+    // Sums the data in 8-byte words, standing in for the upload, which reads every byte
+    uint64_t Checksum(const uint8_t* data, size_t size)
+    {
+        uint64_t sum = 0;
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            sum += word;
+        }
+        for (; i < size; ++i)
+        {
+            sum += data[i];
+        }
+        return sum;
+    }
+
+    // One pass: every model is loaded and kept, with its source, until all are
+    LoadResult LoadAll(std::vector<fs::path> const& files, bool map)
+    {
+        LoadResult result = {};
+
+        std::vector<MappedFile> views;
+        std::vector<std::vector<uint8_t>> copies;
+        std::vector<std::unique_ptr<ModelData>> models;
+        views.reserve(files.size());
+        copies.reserve(files.size());
+        models.reserve(files.size());
+
+        for (auto const& file : files)
+        {
+            const uint8_t* data;
+            size_t size;
+            if (map)
+            {
+                views.emplace_back(file.wstring().c_str());
+                data = views.back().data();
+                size = views.back().size();
+            }
+            else
+            {
+                copies.push_back(ReadFile(file));
+                data = copies.back().data();
+                size = copies.back().size();
+            }
+
+            models.push_back(ModelData::Parse(file.wstring().c_str(), data, size));
+            auto const& model = *models.back();
+            for (auto const& mesh : model.meshes)
+            {
+                result.parts += mesh.parts.size();
+            }
+            for (auto const& stream : model.vertexStreams)
+            {
+                result.checksum += Checksum(stream.GetData(), stream.size);
+                result.bytes += stream.size;
+            }
+            for (auto const& stream : model.indexStreams)
+            {
+                result.checksum += Checksum(stream.data, stream.size);
+                result.bytes += stream.size;
+            }
+        }
+        return result;
+    }
+
+    LoadResult Measure(std::vector<fs::path> const& files, bool map)
+    {
+        const double startMB = PeakResidentMB();
+
+        LoadResult result = {};
+        unsigned passes = 0;
+        auto start = std::chrono::steady_clock::now();
+        double ms = 0.0;
+        do
+        {
+            result = LoadAll(files, map);
+            ++passes;
+            ms = MillisecondsSince(start);
+        } while (ms < c_MinBenchMs);
+
+        result.passes = passes;
+        result.ms = ms / passes;
+        result.startMB = startMB;
+        result.peakMB = PeakResidentMB();
+        return result;
+    }
+
+    // Runs the way in a child process, so the peak is its own, and reads back its result
+    LoadResult MeasureApart(std::vector<fs::path> const& files, bool map)
+    {
+#if defined(_WIN32)
+        return Measure(files, map);
+#else
+        int channel[2];
+        if (pipe(channel))
+            throw std::runtime_error("unable to create a pipe");
+
+        fflush(stdout);
+        pid_t child = fork();
+        if (child < 0)
+        {
+            close(channel[0]);
+            close(channel[1]);
+            throw std::runtime_error("unable to start a process");
+        }
+
+        if (!child)
+        {
+            close(channel[0]);
+            int status = 1;
+            try
+            {
+                LoadResult result = Measure(files, map);
+                if (write(channel[1], &result, sizeof(result)) == ssize_t(sizeof(result)))
+                    status = 0;
+            }
+            catch (std::exception const& e)
+            {
+                fprintf(stderr, "AssetCooker: %s\n", e.what());
+            }
+            _exit(status);
+        }
+
+        close(channel[1]);
+        LoadResult result = {};
+        const ssize_t received = read(channel[0], &result, sizeof(result));
+        close(channel[0]);
+
+        int status = 0;
+        waitpid(child, &status, 0);
+        if (received != ssize_t(sizeof(result)) || !WIFEXITED(status) || WEXITSTATUS(status))
+            throw std::runtime_error(std::string(map ? "mapped" : "copied") + " loading failed");
+        return result;
+#endif
+    }
+
+    void PrintResult(const char* name, LoadResult const& result, uint64_t fileBytes)
+    {
+        printf("%-8s %8u %10.3f %10.1f %10.2f %10.2f %10.2f\n", name, result.passes, result.ms,
+            result.ms > 0.0 ? double(fileBytes) / (1024.0 * 1024.0) / (result.ms / 1000.0) : 0.0,
+            result.startMB, result.peakMB, result.peakMB - result.startMB);
+    }
+}
+
+int DX::BenchmarkModelLoading(std::vector<fs::path> const& files)
+{
+    std::vector<fs::path> meshes;
+    uint64_t fileBytes = 0;
+    for (auto const& file : files)
+    {
+        if (HasExtension(file, c_MeshExtensions))
+        {
+            meshes.push_back(file);
+            fileBytes += fs::file_size(file);
+        }
+    }
+    if (meshes.empty())
+    {
+        fprintf(stderr, "AssetCooker: no .sdkmesh files to load\n");
+        return 1;
+    }
+
+    // Both ways read from the file cache, as the game does on every run after the first
+    for (auto const& mesh : meshes)
+    {
+        (void)ReadFile(mesh);
+    }
+
+    const LoadResult mapped = MeasureApart(meshes, true);
+    const LoadResult copied = MeasureApart(meshes, false);
+
+    printf("%-8s %8s %10s %10s %10s %10s %10s\n", "loading", "passes", "pass ms", "MB/s", "start MB", "peak MB", "growth MB");
+    PrintResult("mapped", mapped, fileBytes);
+    PrintResult("copied", copied, fileBytes);
+
+    const bool same = mapped.parts == copied.parts && mapped.bytes == copied.bytes && mapped.checksum == copied.checksum;
+    printf("%zu models, %.2f MB: %llu parts, %.2f MB of vertices and indices; mapped loading took %.2fx the time of "
+        "copied and grew the resident set by %.2f MB against %.2f MB; %s\n", meshes.size(),
+        double(fileBytes) / (1024.0 * 1024.0), (unsigned long long)mapped.parts, double(mapped.bytes) / (1024.0 * 1024.0),
+        copied.ms > 0.0 ? mapped.ms / copied.ms : 0.0, mapped.peakMB - mapped.startMB, copied.peakMB - copied.startMB,
+        same ? "both read the same data" : "the two ways read different data");
+    return same ? 0 : 1;
+}
+
+int DX::BenchmarkModelParsing(std::vector<fs::path> const& files, unsigned repeats, JobSystem& jobs)
+{
+    std::vector<std::wstring> names;
+    std::vector<MappedFile> sources;
+    uint64_t bytes = 0;
+    for (auto const& file : files)
+    {
+        if (!HasExtension(file, c_ModelExtensions))
+            continue;
+
+        names.push_back(file.wstring());
+        sources.emplace_back(names.back().c_str());
+        bytes += sources.back().size();
+    }
+    if (sources.empty())
+    {
+        fprintf(stderr, "AssetCooker: no models to parse\n");
+        return 1;
+    }
+
+    // Only the parse is timed; the files are mapped already
+    const size_t count = sources.size() * repeats;
+    std::atomic<uint64_t> parts(0);
+    auto start = std::chrono::steady_clock::now();
+
+    jobs.ParallelFor(count, c_ParseGrain, [&](size_t begin, size_t end)
+    {
+        uint64_t local = 0;
+        for (size_t i = begin; i < end; ++i)
+        {
+            auto const& source = sources[i % sources.size()];
+            auto model = ModelData::Parse(names[i % sources.size()].c_str(), source.data(), source.size());
+            for (auto const& mesh : model->meshes)
+            {
+                local += mesh.parts.size();
+            }
+        }
+        parts += local;
+    });
+
+    const double ms = MillisecondsSince(start);
+    printf("%zu models parsed %u times on %u threads: %zu parses, %llu parts, %.3f ms, %.1f MB/s\n", sources.size(),
+        repeats, jobs.GetWorkerCount() + 1, count, (unsigned long long)parts.load(), ms,
+        ms > 0.0 ? double(bytes) * repeats / (1024.0 * 1024.0) / (ms / 1000.0) : 0.0);
+    return 0;
+}
@@ -0,0 +1,27 @@
+//
+// LoadBench.h - Speed and memory of the game's model loading, mapped and copied, and of its parser
+//
+
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+namespace DX
+{
+    class JobSystem;
+
+    // Loads every SDKMESH the way the game's model cache does, once parsing mapped views in
+    // place (MappedFile.h) and once parsing heap copies (the game's -readmodels), keeping every
+    // model and its source until the pass ends and reading every vertex and index as the upload
+    // would. Reports each way's wall time per pass and its peak resident memory (getrusage's
+    // ru_maxrss); each way runs in a process of its own, so neither peak includes the other.
+    // Both ways must read the same parts and data, or the run fails. Windows has no fork or
+    // getrusage, so there both run in this process and no peak is reported.
+    int BenchmarkModelLoading(std::vector<std::filesystem::path> const& files);
+
+    // Maps every model and parses each 'repeats' times across the job system, as the game's
+    // loading jobs would, with nothing else in the way. Reports the models and parts parsed,
+    // the time taken and the megabytes parsed each second.
+    int BenchmarkModelParsing(std::vector<std::filesystem::path> const& files, unsigned repeats, JobSystem& jobs);
+}
@@ -0,0 +1,430 @@
+//
+// MeshCooker.cpp - Converts Wavefront OBJ models to SDKMESH, and optimises the runtime formats
+//
+
+#include "Cooker.h"
+#include "MeshOptimiser.h"
+#include "MeshSimplifier.h"
+#include "ModelData.h"
+#include "SDKMeshWriter.h"
+#include "VertexPacker.h"
+#include "../Common/FileIO.h"
+
+#include <algorithm>
+#include <array>
+#include <float.h>
+#include <map>
+#include <math.h>
+#include <sstream>
+#include <stdexcept>
+#include <string.h>
+#include <tuple>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const char* const c_ModelExtensions[] = { ".sdkmesh", ".cmo", ".vbo", nullptr };
+    const char* const c_ObjExtensions[] = { ".obj", nullptr };
+
+    struct Vertex
+    {
+        float   position[3];
+        float   normal[3];
+        float   texcoord[2];
+    };
+
+    static_assert(sizeof(Vertex) == 32, "Vertex layout must match the declaration");
+
+    struct ObjMaterial
+    {
+        SDKMeshDesc::Material   material;
+        bool                    specular;
+    };
+
+    // Texture references keep only the file name, as meshconvert does; the game finds textures
+    // beside the model or through its texture path.
+    std::string FileNameOf(std::string const& path)
+    {
+        auto slash = path.find_last_of("/\\");
+        return slash == std::string::npos ? path : path.substr(slash + 1);
+    }
+
+    ObjMaterial DefaultMaterial(std::string const& name)
+    {
+        ObjMaterial result = {};
+        auto& material = result.material;
+        material.name = name;
+        std::fill(material.diffuse, material.diffuse + 3, 0.8f);
+        material.diffuse[3] = 1.f;
+        std::fill(material.ambient, material.ambient + 3, 0.2f);
+        material.ambient[3] = 1.f;
+        material.power = 1.f;
+        return result;
+    }
+
+    // The subset of MTL that SDKMESH materials can hold
+    std::map<std::string, ObjMaterial> ReadMaterialLibrary(std::vector<uint8_t> const& data)
+    {
+        std::map<std::string, ObjMaterial> materials;
+        ObjMaterial* current = nullptr;
+
+        std::istringstream text(std::string(data.begin(), data.end()));
+        std::string line;
+        while (std::getline(text, line))
+        {
+            std::istringstream fields(line);
+            std::string keyword;
+            if (!(fields >> keyword) || keyword[0] == '#')
+                continue;
+
+            if (keyword == "newmtl")
+            {
+                std::string name;
+                fields >> name;
+                current = &(materials[name] = DefaultMaterial(name));
+                continue;
+            }
+            if (!current)
+                continue;
+
+            auto& material = current->material;
+            auto readColor = [&](float* color) { fields >> color[0] >> color[1] >> color[2]; };
+            auto readTexture = [&](std::string& texture)
+            {
+                std::string rest;
+                std::getline(fields >> std::ws, rest);
+                while (!rest.empty() && (rest.back() == '\r' || rest.back() == ' '))
+                {
+                    rest.pop_back();
+                }
+                texture = FileNameOf(rest);
+            };
+
+            if (keyword == "Ka")
+                readColor(material.ambient);
+            else if (keyword == "Kd")
+                readColor(material.diffuse);
+            else if (keyword == "Ks")
+                readColor(material.specular);
+            else if (keyword == "Ke")
+                readColor(material.emissive);
+            else if (keyword == "d")
+                fields >> material.diffuse[3];
+            else if (keyword == "Tr")
+            {
+                float transparency = 0.f;
+                fields >> transparency;
+                material.diffuse[3] = 1.f - transparency;
+            }
+            else if (keyword == "Ns")
+            {
+                // meshconvert reads the shininess as an integer
+                float power = 0.f;
+                fields >> power;
+                material.power = float(uint32_t(std::max(power, 0.f)));
+            }
+            else if (keyword == "illum")
+            {
+                int model = 0;
+                fields >> model;
+                current->specular = (model == 2);
+            }
+            else if (keyword == "map_Kd")
+                readTexture(material.diffuseTexture);
+            else if (keyword == "map_Ks")
+                readTexture(material.specularTexture);
+            else if (keyword == "map_Kn" || keyword == "norm" || keyword == "map_bump" || keyword == "bump")
+                readTexture(material.normalTexture);
+        }
+
+        // Only illumination model 2 is lit with highlights, as in meshconvert's reader
+        for (auto& entry : materials)
+        {
+            auto& material = entry.second.material;
+            if (!entry.second.specular)
+            {
+                std::fill(material.specular, material.specular + 4, 0.f);
+                material.power = 1.f;
+            }
+            material.ambient[3] = 1.f;
+            material.specular[3] = 0.f;
+            material.emissive[3] = 0.f;
+        }
+        return materials;
+    }
+
+    // OBJ indices are 1-based, or negative to count back from the latest element
+    uint32_t ResolveIndex(long index, size_t count)
+    {
+        long long resolved = index < 0 ? (long long)count + index : (long long)index - 1;
+        if (index == 0 || resolved < 0 || resolved >= (long long)count)
+            throw std::runtime_error("OBJ face refers to a missing vertex");
+        return uint32_t(resolved);
+    }
+
+    // Every model, converted or not, leaves with its triangles in cache and overdraw order, its
+    // vertices in fetch order and, for SDKMESH, 16-bit indices wherever they fit (MeshOptimiser.h)
+    // and packed vertices (VertexPacker.h), then with its levels of detail appended
+    // (MeshSimplifier.h).
+    class MeshCooker : public Cooker
+    {
+    public:
+        const char* GetName() const override { return "mesh"; }
+        uint32_t GetVersion() const override { return 4; }
+
+        bool Accepts(fs::path const& source) const override
+        {
+            return HasExtension(source, c_ObjExtensions) || HasExtension(source, c_ModelExtensions);
+        }
+
+        fs::path GetOutputName(fs::path const& source) const override
+        {
+            if (!HasExtension(source, c_ObjExtensions))
+                return source;
+
+            auto output = source;
+            return output.replace_extension(".sdkmesh");
+        }
+
+        std::vector<uint8_t> Cook(fs::path const& source, std::vector<uint8_t> const& data,
+            std::vector<fs::path>& dependencies) const override
+        {
+            // Damaged models are rejected here, when they are parsed, rather than by the game
+            MeshOptimisation optimisation;
+            VertexPacking packing;
+            ModelLodGeneration lods;
+            if (!HasExtension(source, c_ObjExtensions))
+                return GenerateModelLods(source, PackModelFile(source, OptimiseModelFile(source, data, optimisation), packing), lods);
+
+            auto desc = ReadObj(source, data, dependencies);
+            auto output = GetOutputName(source);
+            return GenerateModelLods(output, PackModelFile(output, OptimiseModelFile(output, WriteSDKMESH(desc), optimisation), packing), lods);
+        }
+
+    private:
+        static SDKMeshDesc ReadObj(fs::path const& source, std::vector<uint8_t> const& data, std::vector<fs::path>& dependencies)
+        {
+            std::vector<float> positions, normals, texcoords;
+
+            // Vertices are shared by their position/texcoord/normal triple, numbered in order
+            // of first use; triangles are grouped by material, keeping file order within one
+            std::map<std::tuple<uint32_t, uint32_t, uint32_t>, uint32_t> vertexIndices;
+            std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> vertexKeys;
+            std::vector<std::vector<uint32_t>> triangles(1);         // per material, 0 is the default
+            std::vector<std::string> materialNames(1, "default");
+            std::map<std::string, ObjMaterial> library;
+            uint32_t currentMaterial = 0;
+
+            std::istringstream text(std::string(data.begin(), data.end()));
+            std::string line;
+            std::vector<uint32_t> polygon;
+            while (std::getline(text, line))
+            {
+                std::istringstream fields(line);
+                std::string keyword;
+                if (!(fields >> keyword) || keyword[0] == '#')
+                    continue;
+
+                if (keyword == "v" || keyword == "vn")
+                {
+                    float x = 0.f, y = 0.f, z = 0.f;
+                    if (!(fields >> x >> y >> z))
+                        throw std::runtime_error("OBJ has a malformed " + keyword + " line");
+                    auto& target = (keyword == "v") ? positions : normals;
+                    target.insert(target.end(), { x, y, z });
+                }
+                else if (keyword == "vt")
+                {
+                    float u = 0.f, v = 0.f;
+                    if (!(fields >> u))
+                        throw std::runtime_error("OBJ has a malformed vt line");
+                    fields >> v;
+                    texcoords.insert(texcoords.end(), { u, v });
+                }
+                else if (keyword == "f")
+                {
+                    polygon.clear();
+                    std::string corner;
+                    while (fields >> corner)
+                    {
+                        long p = 0, t = 0, n = 0;
+                        const char* cursor = corner.c_str();
+                        char* end = nullptr;
+                        p = strtol(cursor, &end, 10);
+                        if (*end == '/')
+                        {
+                            cursor = end + 1;
+                            if (*cursor != '/')
+                                t = strtol(cursor, &end, 10);
+                            if (*end == '/')
+                                n = strtol(end + 1, &end, 10);
+                        }
+
+                        auto key = std::make_tuple(ResolveIndex(p, positions.size() / 3),
+                            t ? ResolveIndex(t, texcoords.size() / 2) : UINT32_MAX,
+                            n ? ResolveIndex(n, normals.size() / 3) : UINT32_MAX);
+
+                        auto found = vertexIndices.emplace(key, uint32_t(vertexKeys.size()));
+                        if (found.second)
+                            vertexKeys.push_back(key);
+                        polygon.push_back(found.first->second);
+                    }
+
+                    if (polygon.size() < 3)
+                        throw std::runtime_error("OBJ face has fewer than three corners");
+
+                    // Polygons are fanned from their first corner
+                    auto& list = triangles[currentMaterial];
+                    for (size_t i = 2; i < polygon.size(); ++i)
+                    {
+                        list.insert(list.end(), { polygon[0], polygon[i - 1], polygon[i] });
+                    }
+                }
+                else if (keyword == "usemtl")
+                {
+                    std::string name;
+                    fields >> name;
+                    auto found = std::find(materialNames.begin() + 1, materialNames.end(), name);
+                    currentMaterial = uint32_t(found - materialNames.begin());
+                    if (found == materialNames.end())
+                    {
+                        materialNames.push_back(name);
+                        triangles.emplace_back();
+                    }
+                }
+                else if (keyword == "mtllib")
+                {
+                    std::string name;
+                    std::getline(fields >> std::ws, name);
+                    while (!name.empty() && (name.back() == '\r' || name.back() == ' '))
+                    {
+                        name.pop_back();
+                    }
+
+                    auto path = source.parent_path() / fs::u8path(name);
+                    dependencies.push_back(path);
+                    for (auto& entry : ReadMaterialLibrary(ReadFile(path)))
+                    {
+                        library.insert(std::move(entry));
+                    }
+                }
+            }
+
+            if (vertexKeys.empty())
+                throw std::runtime_error("OBJ has no faces");
+
+            SDKMeshDesc desc = {};
+            desc.declaration =
+            {
+                { 0, 0,  SDKMESH::DeclType_Float3, 0, SDKMESH::DeclUsage_Position, 0 },
+                { 0, 12, SDKMESH::DeclType_Float3, 0, SDKMESH::DeclUsage_Normal, 0 },
+                { 0, 24, SDKMESH::DeclType_Float2, 0, SDKMESH::DeclUsage_TexCoord, 0 },
+            };
+            desc.vertexStride = sizeof(Vertex);
+            desc.vertexCount = uint32_t(vertexKeys.size());
+
+            std::vector<Vertex> vertices(vertexKeys.size());
+            bool missingNormals = false;
+            for (size_t i = 0; i < vertexKeys.size(); ++i)
+            {
+                auto& vertex = vertices[i];
+                memcpy(vertex.position, &positions[std::get<0>(vertexKeys[i]) * 3], sizeof(vertex.position));
+
+                auto t = std::get<1>(vertexKeys[i]);
+                if (t != UINT32_MAX)
+                    memcpy(vertex.texcoord, &texcoords[t * 2], sizeof(vertex.texcoord));
+
+                auto n = std::get<2>(vertexKeys[i]);
+                if (n != UINT32_MAX)
+                    memcpy(vertex.normal, &normals[n * 3], sizeof(vertex.normal));
+                else
+                    missingNormals = true;
+            }
+
+            for (uint32_t material = 0; material < triangles.size(); ++material)
+            {
+                if (triangles[material].empty())
+                    continue;
+
+                desc.subsets.push_back({ material, uint32_t(desc.indices.size()), uint32_t(triangles[material].size()) });
+                desc.indices.insert(desc.indices.end(), triangles[material].begin(), triangles[material].end());
+            }
+
+            if (missingNormals)
+                GenerateNormals(vertexKeys, desc.indices, vertices);
+
+            for (auto const& name : materialNames)
+            {
+                auto found = library.find(name);
+                desc.materials.push_back(found != library.end() ? found->second.material : DefaultMaterial(name).material);
+            }
+
+            float lower[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+            float upper[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for (auto const& vertex : vertices)
+            {
+                for (int a = 0; a < 3; ++a)
+                {
+                    lower[a] = std::min(lower[a], vertex.position[a]);
+                    upper[a] = std::max(upper[a], vertex.position[a]);
+                }
+            }
+            for (int a = 0; a < 3; ++a)
+            {
+                desc.boxCenter[a] = (lower[a] + upper[a]) * 0.5f;
+                desc.boxExtents[a] = (upper[a] - lower[a]) * 0.5f;
+            }
+
+            desc.vertices.resize(vertices.size() * sizeof(Vertex));
+            memcpy(desc.vertices.data(), vertices.data(), desc.vertices.size());
+            return desc;
+        }
+
+        // Area-weighted face normals, summed over every vertex at the same position, for the
+        // vertices the file gives no normal
+        static void GenerateNormals(std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> const& keys,
+            std::vector<uint32_t> const& indices, std::vector<Vertex>& vertices)
+        {
+            std::map<uint32_t, std::array<float, 3>> sums;
+            for (size_t i = 0; i + 2 < indices.size(); i += 3)
+            {
+                const float* a = vertices[indices[i]].position;
+                const float* b = vertices[indices[i + 1]].position;
+                const float* c = vertices[indices[i + 2]].position;
+                float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+                float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+                float normal[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+
+                for (size_t k = 0; k < 3; ++k)
+                {
+                    auto& sum = sums[std::get<0>(keys[indices[i + k]])];
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        sum[axis] += normal[axis];
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < vertices.size(); ++i)
+            {
+                if (std::get<2>(keys[i]) != UINT32_MAX)
+                    continue;
+
+                auto const& sum = sums[std::get<0>(keys[i])];
+                float length = sqrtf(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+                for (int a = 0; a < 3; ++a)
+                {
+                    vertices[i].normal[a] = length > 0.f ? sum[a] / length : (a == 1 ? 1.f : 0.f);
+                }
+            }
+        }
+    };
+}
+
+std::unique_ptr<Cooker> DX::CreateMeshCooker()
+{
+    return std::make_unique<MeshCooker>();
+}
@@ -0,0 +1,655 @@
+//
+// MeshOptimiser.cpp - Triangle and vertex reordering for the post-transform cache, overdraw and fetch
+//
+
+#include "MeshOptimiser.h"
+#include "Cooker.h"
+#include "SDKMeshWriter.h"
+#include "../Common/FileIO.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const uint32_t c_NoVertex = UINT32_MAX;
+    const char* const c_SDKMeshExtensions[] = { ".sdkmesh", nullptr };
+    const char* const c_ModelExtensions[] = { ".sdkmesh", ".cmo", ".vbo", nullptr };
+
+    // A FIFO cache by timestamps, as in Tipsify: a vertex is resident while fewer than the
+    // cache's size of misses have happened since its own.
+    class CacheModel
+    {
+    public:
+        CacheModel(uint32_t vertexCount, uint32_t cacheSize) :
+            m_stamps(vertexCount, 0),
+            m_time(cacheSize + 1),
+            m_cacheSize(cacheSize)
+        {
+        }
+
+        bool IsResident(uint32_t vertex) const { return m_time - m_stamps[vertex] <= m_cacheSize; }
+        uint32_t GetAge(uint32_t vertex) const { return m_time - m_stamps[vertex]; }
+
+        // Whether the vertex missed
+        bool Use(uint32_t vertex)
+        {
+            if (IsResident(vertex))
+                return false;
+
+            m_stamps[vertex] = m_time++;
+            return true;
+        }
+
+        uint32_t UseTriangle(const uint32_t* corners)
+        {
+            return uint32_t(Use(corners[0])) + uint32_t(Use(corners[1])) + uint32_t(Use(corners[2]));
+        }
+
+        void Flush() { m_time += m_cacheSize + 1; }
+
+    private:
+        std::vector<uint32_t>   m_stamps;
+        uint32_t                m_time;
+        uint32_t                m_cacheSize;
+    };
+
+    struct Float3
+    {
+        float x, y, z;
+    };
+
+    Float3 ReadPosition(const uint8_t* positions, uint32_t stride, uint32_t vertex)
+    {
+        Float3 result;
+        memcpy(&result, positions + size_t(vertex) * stride, sizeof(result));
+        return result;
+    }
+
+    std::vector<uint32_t> ReadIndices(ModelData::IndexStream const& stream)
+    {
+        std::vector<uint32_t> indices(stream.indexCount);
+        if (stream.format == ModelData::Format_R32_UInt)
+        {
+            memcpy(indices.data(), stream.data, indices.size() * sizeof(uint32_t));
+        }
+        else
+        {
+            for (size_t i = 0; i < indices.size(); ++i)
+            {
+                uint16_t index;
+                memcpy(&index, stream.data + i * sizeof(uint16_t), sizeof(index));
+                indices[i] = index;
+            }
+        }
+        return indices;
+    }
+
+    void WriteIndices(ModelData::IndexStream const& stream, std::vector<uint32_t> const& indices, uint8_t* destination)
+    {
+        if (stream.format == ModelData::Format_R32_UInt)
+        {
+            memcpy(destination, indices.data(), indices.size() * sizeof(uint32_t));
+            return;
+        }
+
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            const uint16_t index = uint16_t(indices[i]);
+            memcpy(destination + i * sizeof(uint16_t), &index, sizeof(index));
+        }
+    }
+
+    // Three floats, as the overdraw order needs; null when the stream has none
+    const uint8_t* FindPositions(ModelData::VertexStream const& stream)
+    {
+        for (auto const& element : stream.elements)
+        {
+            if (!strcmp(element.semanticName, "SV_Position") && element.semanticIndex == 0
+                && (element.format == ModelData::Format_R32G32B32_Float || element.format == ModelData::Format_R32G32B32A32_Float))
+                return stream.GetData() + element.offset;
+        }
+        return nullptr;
+    }
+
+    uint64_t GetIndexBytes(ModelData const& model)
+    {
+        uint64_t bytes = 0;
+        for (auto const& stream : model.indexStreams)
+        {
+            bytes += stream.size;
+        }
+        return bytes;
+    }
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+VertexCacheStatistics& VertexCacheStatistics::operator+= (VertexCacheStatistics const& other)
+{
+    triangles += other.triangles;
+    vertices += other.vertices;
+    misses += other.misses;
+    return *this;
+}
+
+VertexCacheStatistics DX::AnalyseVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+{
+    VertexCacheStatistics stats = {};
+    stats.triangles = indexCount / 3;
+
+    CacheModel cache(vertexCount, cacheSize);
+    std::vector<bool> used(vertexCount);
+    for (size_t i = 0; i < stats.triangles * 3; ++i)
+    {
+        const uint32_t vertex = indices[i];
+        if (!used[vertex])
+        {
+            used[vertex] = true;
+            ++stats.vertices;
+        }
+        stats.misses += cache.Use(vertex);
+    }
+    return stats;
+}
+
+void DX::OptimiseVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount, uint32_t cacheSize)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+        return;
+
+    // Each vertex's triangles, and how many of them are still to be emitted
+    std::vector<uint32_t> live(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+    {
+        ++live[indices[i]];
+    }
+
+    std::vector<uint32_t> first(size_t(vertexCount) + 1, 0);
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        first[v + 1] = first[v] + live[v];
+    }
+
+    std::vector<uint32_t> adjacency(triangleCount * 3);
+    std::vector<uint32_t> filled(first.begin(), first.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; ++i)
+    {
+        adjacency[filled[indices[i]]++] = uint32_t(i / 3);
+    }
+
+    std::vector<uint32_t> order;
+    order.reserve(triangleCount * 3);
+    std::vector<bool> emitted(triangleCount);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    CacheModel cache(vertexCount, cacheSize);
+
+    uint32_t cursor = 0;
+    auto nextLive = [&]()
+    {
+        while (cursor < vertexCount && !live[cursor])
+        {
+            ++cursor;
+        }
+        return cursor < vertexCount ? cursor : c_NoVertex;
+    };
+
+    for (uint32_t fan = nextLive(); fan != c_NoVertex;)
+    {
+        candidates.clear();
+        for (uint32_t a = first[fan]; a < first[fan + 1]; ++a)
+        {
+            const uint32_t triangle = adjacency[a];
+            if (emitted[triangle])
+                continue;
+
+            emitted[triangle] = true;
+            for (uint32_t k = 0; k < 3; ++k)
+            {
+                const uint32_t vertex = indices[triangle * 3 + k];
+                order.push_back(vertex);
+                deadEnds.push_back(vertex);
+                candidates.push_back(vertex);
+                --live[vertex];
+                cache.Use(vertex);
+            }
+        }
+
+        // The oldest candidate still in the cache whose remaining triangles can be fanned before
+        // it leaves; one that would not fit still beats nothing
+        fan = c_NoVertex;
+        int64_t best = -1;
+        for (auto vertex : candidates)
+        {
+            if (!live[vertex])
+                continue;
+
+            int64_t priority = 0;
+            if (cache.GetAge(vertex) + 2 * live[vertex] <= cacheSize)
+            {
+                priority = cache.GetAge(vertex);
+            }
+            if (priority > best)
+            {
+                best = priority;
+                fan = vertex;
+            }
+        }
+
+        // A dead end: the most recently used vertex with triangles left, or else the next in order
+        while (fan == c_NoVertex && !deadEnds.empty())
+        {
+            const uint32_t vertex = deadEnds.back();
+            deadEnds.pop_back();
+            if (live[vertex])
+                fan = vertex;
+        }
+        if (fan == c_NoVertex)
+        {
+            fan = nextLive();
+        }
+    }
+
+    std::copy(order.begin(), order.end(), indices);
+}
+
+void DX::OptimiseOverdraw(uint32_t* indices, size_t indexCount, const uint8_t* positions, uint32_t stride,
+    uint32_t vertexCount, float threshold, uint32_t cacheSize)
+{
+    const size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2)
+        return;
+
+    CacheModel cache(vertexCount, cacheSize);
+
+    // Where the cache order restarts: every corner missing means a patch apart from the last
+    std::vector<size_t> hard;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        if (cache.UseTriangle(indices + t * 3) == 3 || t == 0)
+            hard.push_back(t);
+    }
+    hard.push_back(triangleCount);
+
+    // Each patch split again wherever its ACMR so far, from a cold cache, is already within the
+    // threshold of the whole patch's, so cutting there costs the cache little
+    std::vector<size_t> clusters;
+    for (size_t h = 0; h + 1 < hard.size(); ++h)
+    {
+        const size_t begin = hard[h];
+        const size_t end = hard[h + 1];
+
+        cache.Flush();
+        uint32_t patchMisses = 0;
+        for (size_t t = begin; t < end; ++t)
+        {
+            patchMisses += cache.UseTriangle(indices + t * 3);
+        }
+        const float limit = threshold * float(patchMisses) / float(end - begin);
+
+        cache.Flush();
+        clusters.push_back(begin);
+        uint32_t misses = 0;
+        uint32_t triangles = 0;
+        for (size_t t = begin; t + 1 < end; ++t)
+        {
+            misses += cache.UseTriangle(indices + t * 3);
+            ++triangles;
+            if (float(misses) <= limit * float(triangles))
+            {
+                clusters.push_back(t + 1);
+                cache.Flush();
+                misses = 0;
+                triangles = 0;
+            }
+        }
+    }
+    clusters.push_back(triangleCount);
+
+    // Area-weighted centroids and normals, of each cluster and of the whole mesh
+    struct Cluster
+    {
+        size_t  begin;
+        size_t  end;
+        Float3  centroid;
+        Float3  normal;
+        float   area;
+        float   sortKey;
+    };
+
+    std::vector<Cluster> sorted(clusters.size() - 1);
+    Float3 centre = {};
+    float totalArea = 0.f;
+    for (size_t c = 0; c < sorted.size(); ++c)
+    {
+        auto& cluster = sorted[c];
+        cluster = {};
+        cluster.begin = clusters[c];
+        cluster.end = clusters[c + 1];
+        for (size_t t = cluster.begin; t < cluster.end; ++t)
+        {
+            const Float3 a = ReadPosition(positions, stride, indices[t * 3]);
+            const Float3 b = ReadPosition(positions, stride, indices[t * 3 + 1]);
+            const Float3 p = ReadPosition(positions, stride, indices[t * 3 + 2]);
+
+            const Float3 e1 = { b.x - a.x, b.y - a.y, b.z - a.z };
+            const Float3 e2 = { p.x - a.x, p.y - a.y, p.z - a.z };
+            const Float3 n = { e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x };
+            const float area = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+
+            cluster.centroid.x += (a.x + b.x + p.x) * area;
+            cluster.centroid.y += (a.y + b.y + p.y) * area;
+            cluster.centroid.z += (a.z + b.z + p.z) * area;
+            cluster.normal.x += n.x;
+            cluster.normal.y += n.y;
+            cluster.normal.z += n.z;
+            cluster.area += area;
+        }
+
+        centre.x += cluster.centroid.x;
+        centre.y += cluster.centroid.y;
+        centre.z += cluster.centroid.z;
+        totalArea += cluster.area;
+
+        const float scale = cluster.area > 0.f ? 1.f / (3.f * cluster.area) : 0.f;
+        cluster.centroid = { cluster.centroid.x * scale, cluster.centroid.y * scale, cluster.centroid.z * scale };
+    }
+    if (totalArea <= 0.f)
+        return;
+
+    centre = { centre.x / (3.f * totalArea), centre.y / (3.f * totalArea), centre.z / (3.f * totalArea) };
+
+    // Whether the corners' order makes normals point out depends on the file's winding and
+    // handedness, so it is taken from the mesh: on the whole its normals face away from its centre
+    float outward = 0.f;
+    for (auto& cluster : sorted)
+    {
+        const Float3 offset = { cluster.centroid.x - centre.x, cluster.centroid.y - centre.y, cluster.centroid.z - centre.z };
+        const float length = sqrtf(cluster.normal.x * cluster.normal.x + cluster.normal.y * cluster.normal.y
+            + cluster.normal.z * cluster.normal.z);
+        const float dot = offset.x * cluster.normal.x + offset.y * cluster.normal.y + offset.z * cluster.normal.z;
+        outward += dot;
+        cluster.sortKey = length > 0.f ? dot / length : 0.f;
+    }
+    if (outward < 0.f)
+    {
+        for (auto& cluster : sorted)
+        {
+            cluster.sortKey = -cluster.sortKey;
+        }
+    }
+
+    std::stable_sort(sorted.begin(), sorted.end(), [](Cluster const& a, Cluster const& b) { return a.sortKey > b.sortKey; });
+
+    std::vector<uint32_t> order;
+    order.reserve(triangleCount * 3);
+    for (auto const& cluster : sorted)
+    {
+        order.insert(order.end(), indices + cluster.begin * 3, indices + cluster.end * 3);
+    }
+    std::copy(order.begin(), order.end(), indices);
+}
+
+std::vector<uint32_t> DX::OptimiseVertexFetch(uint32_t* indices, size_t indexCount, uint32_t vertexCount)
+{
+    std::vector<uint32_t> remap(vertexCount, c_NoVertex);
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+        auto& number = remap[indices[i]];
+        if (number == c_NoVertex)
+        {
+            number = next++;
+        }
+        indices[i] = number;
+    }
+
+    for (auto& number : remap)
+    {
+        if (number == c_NoVertex)
+        {
+            number = next++;
+        }
+    }
+    return remap;
+}
+
+MeshOptimisation DX::OptimiseModel(ModelData const& model, const uint8_t* source, uint8_t* file)
+{
+    MeshOptimisation result = {};
+
+    std::vector<std::vector<uint32_t>> indices;
+    for (auto const& stream : model.indexStreams)
+    {
+        indices.push_back(ReadIndices(stream));
+    }
+
+    std::vector<ModelData::Part const*> parts;
+    for (auto const& mesh : model.meshes)
+    {
+        for (auto const& part : mesh.parts)
+        {
+            if (part.indexStream >= indices.size() || part.vertexStream >= model.vertexStreams.size()
+                || uint64_t(part.startIndex) + part.indexCount > indices[part.indexStream].size())
+                throw std::runtime_error("model part is out of range of its streams");
+
+            parts.push_back(&part);
+        }
+    }
+
+    // Parts drawing the very same indices from the same vertices are reordered once; parts whose
+    // indices overlap otherwise are left as they are, as reordering one would change the other
+    auto sameDraw = [](ModelData::Part const& a, ModelData::Part const& b)
+    {
+        return a.indexStream == b.indexStream && a.startIndex == b.startIndex && a.indexCount == b.indexCount
+            && a.vertexStream == b.vertexStream && a.vertexOffset == b.vertexOffset && a.topology == b.topology;
+    };
+
+    std::vector<bool> duplicate(parts.size()), shared(parts.size());
+    std::vector<std::vector<uint32_t>> owners;
+    for (auto const& stream : indices)
+    {
+        owners.emplace_back(stream.size(), c_NoVertex);
+    }
+    for (uint32_t p = 0; p < parts.size(); ++p)
+    {
+        auto const& part = *parts[p];
+        auto& owner = owners[part.indexStream];
+        for (uint32_t i = part.startIndex; i < part.startIndex + part.indexCount; ++i)
+        {
+            if (owner[i] == c_NoVertex)
+            {
+                owner[i] = p;
+            }
+            else if (sameDraw(*parts[owner[i]], part))
+            {
+                duplicate[p] = true;
+            }
+            else
+            {
+                shared[p] = shared[owner[i]] = true;
+            }
+        }
+    }
+
+    for (uint32_t p = 0; p < parts.size(); ++p)
+    {
+        auto const& part = *parts[p];
+        auto const& vertices = model.vertexStreams[part.vertexStream];
+        uint32_t* local = indices[part.indexStream].data() + part.startIndex;
+
+        if (part.vertexOffset < 0 || uint32_t(part.vertexOffset) > vertices.vertexCount)
+            throw std::runtime_error("model part is out of range of its vertices");
+
+        const uint32_t vertexCount = vertices.vertexCount - uint32_t(part.vertexOffset);
+        for (uint32_t i = 0; i < part.indexCount; ++i)
+        {
+            if (local[i] >= vertexCount)
+                throw std::runtime_error("model index is out of range of its vertices");
+        }
+
+        if (duplicate[p] || part.topology != ModelData::Topology_TriangleList)
+            continue;
+
+        const auto before = AnalyseVertexCache(local, part.indexCount, vertexCount);
+        result.before += before;
+        if (shared[p] || part.indexCount % 3)
+        {
+            result.after += before;
+            ++result.partsSkipped;
+            continue;
+        }
+
+        OptimiseVertexCache(local, part.indexCount, vertexCount);
+
+        auto positions = FindPositions(vertices);
+        if (positions && !part.isAlpha)
+        {
+            OptimiseOverdraw(local, part.indexCount, positions + size_t(part.vertexOffset) * vertices.stride,
+                vertices.stride, vertexCount);
+        }
+
+        result.after += AnalyseVertexCache(local, part.indexCount, vertexCount);
+        ++result.partsReordered;
+    }
+
+    // Fetch order for each vertex stream the file stores as it is, over all of its parts' indices
+    for (uint32_t v = 0; v < model.vertexStreams.size(); ++v)
+    {
+        auto const& vertices = model.vertexStreams[v];
+        if (!vertices.owned.empty() || !vertices.data)
+            continue;
+
+        std::vector<uint32_t> drawn;
+        bool eligible = true;
+        for (uint32_t p = 0; p < parts.size() && eligible; ++p)
+        {
+            if (parts[p]->vertexStream != v)
+                continue;
+
+            eligible = parts[p]->vertexOffset == 0 && !shared[p];
+            if (!duplicate[p])
+                drawn.push_back(p);
+        }
+        if (!eligible || drawn.empty())
+            continue;
+
+        std::vector<uint32_t> combined;
+        for (auto p : drawn)
+        {
+            auto const& stream = indices[parts[p]->indexStream];
+            combined.insert(combined.end(), stream.begin() + parts[p]->startIndex,
+                stream.begin() + parts[p]->startIndex + parts[p]->indexCount);
+        }
+
+        auto remap = OptimiseVertexFetch(combined.data(), combined.size(), vertices.vertexCount);
+
+        auto next = combined.begin();
+        for (auto p : drawn)
+        {
+            auto& stream = indices[parts[p]->indexStream];
+            std::copy(next, next + parts[p]->indexCount, stream.begin() + parts[p]->startIndex);
+            next += parts[p]->indexCount;
+        }
+
+        uint8_t* destination = file + (vertices.data - source);
+        for (uint32_t old = 0; old < vertices.vertexCount; ++old)
+        {
+            memcpy(destination + size_t(remap[old]) * vertices.stride, vertices.data + size_t(old) * vertices.stride, vertices.stride);
+        }
+        ++result.streamsRemapped;
+    }
+
+    for (size_t s = 0; s < indices.size(); ++s)
+    {
+        auto const& stream = model.indexStreams[s];
+        WriteIndices(stream, indices[s], file + (stream.data - source));
+    }
+    return result;
+}
+
+std::vector<uint8_t> DX::OptimiseModelFile(fs::path const& name, std::vector<uint8_t> const& data, MeshOptimisation& optimisation)
+{
+    const auto fileName = name.wstring();
+    auto model = ModelData::Parse(fileName.c_str(), data.data(), data.size());
+
+    std::vector<uint8_t> file(data);
+    optimisation = OptimiseModel(*model, data.data(), file.data());
+    optimisation.indexBytesBefore = GetIndexBytes(*model);
+
+    if (HasExtension(name, c_SDKMeshExtensions))
+    {
+        optimisation.streamsNarrowed = NarrowSDKMeshIndices(file);
+    }
+
+    // The game parses the result; anything wrong with it should fail the cook instead
+    auto optimised = ModelData::Parse(fileName.c_str(), file.data(), file.size());
+    optimisation.indexBytesAfter = GetIndexBytes(*optimised);
+    return file;
+}
+
+int DX::ReportMeshOptimisation(std::vector<fs::path> const& files)
+{
+    size_t measured = 0;
+    MeshOptimisation total = {};
+
+    printf("%-40s %9s %9s %7s %7s %7s %7s %11s %11s %8s\n", "model", "triangles", "vertices",
+        "ACMR", "after", "ATVR", "after", "index bytes", "after", "ms");
+    for (auto const& file : files)
+    {
+        if (!HasExtension(file, c_ModelExtensions))
+            continue;
+
+        MeshOptimisation optimisation;
+        double ms;
+        try
+        {
+            auto data = ReadFile(file);
+            auto start = std::chrono::steady_clock::now();
+            OptimiseModelFile(file, data, optimisation);
+            ms = MillisecondsSince(start);
+        }
+        catch (std::exception const& e)
+        {
+            fprintf(stderr, "AssetCooker: %s: %s\n", file.generic_u8string().c_str(), e.what());
+            continue;
+        }
+
+        auto const& before = optimisation.before;
+        auto const& after = optimisation.after;
+        printf("%-40s %9llu %9llu %7.3f %7.3f %7.3f %7.3f %11llu %11llu %8.2f\n", file.generic_u8string().c_str(),
+            (unsigned long long)before.triangles, (unsigned long long)before.vertices, before.GetACMR(), after.GetACMR(),
+            before.GetATVR(), after.GetATVR(), (unsigned long long)optimisation.indexBytesBefore,
+            (unsigned long long)optimisation.indexBytesAfter, ms);
+
+        total.before += before;
+        total.after += after;
+        total.partsReordered += optimisation.partsReordered;
+        total.partsSkipped += optimisation.partsSkipped;
+        total.streamsRemapped += optimisation.streamsRemapped;
+        total.streamsNarrowed += optimisation.streamsNarrowed;
+        total.indexBytesBefore += optimisation.indexBytesBefore;
+        total.indexBytesAfter += optimisation.indexBytesAfter;
+        ++measured;
+    }
+
+    printf("%zu models: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %u parts reordered, %u skipped, "
+        "%u vertex streams remapped, %u index streams narrowed, index bytes %llu -> %llu\n",
+        measured, total.before.GetACMR(), total.after.GetACMR(), total.before.GetATVR(), total.after.GetATVR(),
+        total.partsReordered, total.partsSkipped, total.streamsRemapped, total.streamsNarrowed,
+        (unsigned long long)total.indexBytesBefore, (unsigned long long)total.indexBytesAfter);
+    return measured ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+//
+// MeshOptimiser.h - Triangle and vertex reordering for the post-transform cache, overdraw and fetch
+//
+
+#pragma once
+
+#include "ModelData.h"
+
+#include <filesystem>
+#include <stdint.h>
+#include <vector>
+
+namespace DX
+{
+    // The post-transform cache is modelled as a FIFO of this many vertices, both to measure it
+    // and to optimise for it; smaller than most GPUs', so orders built for it suit them all.
+    const uint32_t c_VertexCacheSize = 16;
+
+    // How much worse than the vertex cache order the overdraw order may make a cluster's ACMR.
+    const float c_OverdrawThreshold = 1.05f;
+
+    struct VertexCacheStatistics
+    {
+        uint64_t    triangles;
+        uint64_t    vertices;       // referenced by them
+        uint64_t    misses;         // vertices transformed
+
+        // Average cache miss ratio, transforms per triangle: 0.5 at best for a large grid
+        double GetACMR() const { return triangles ? double(misses) / double(triangles) : 0.0; }
+
+        // Average transform to vertex ratio: 1.0 when every vertex is transformed once
+        double GetATVR() const { return vertices ? double(misses) / double(vertices) : 0.0; }
+
+        VertexCacheStatistics& operator+= (VertexCacheStatistics const& other);
+    };
+
+    // Transforms a triangle list needs with a FIFO cache of 'cacheSize' vertices.
+    VertexCacheStatistics AnalyseVertexCache(const uint32_t* indices, size_t indexCount, uint32_t vertexCount,
+        uint32_t cacheSize = c_VertexCacheSize);
+
+    // Reorders a triangle list's triangles for the cache with Tipsify (Sander, Nehab and Barczak,
+    // "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", 2007), which fans
+    // around one vertex at a time and, when it runs out, moves on to the vertex still in the
+    // cache whose remaining triangles fit; linear in the triangle count. Corners keep their order
+    // within each triangle, so winding is unchanged.
+    void OptimiseVertexCache(uint32_t* indices, size_t indexCount, uint32_t vertexCount,
+        uint32_t cacheSize = c_VertexCacheSize);
+
+    // Then, from the same paper, splits the cache order into clusters where it restarts (all
+    // three corners missing), and further wherever the ACMR so far falls to within 'threshold'
+    // of the cluster's, and sorts the clusters so the ones facing out from the centre draw
+    // first, and occlude those behind them. 'positions' are three floats at a 'stride'.
+    void OptimiseOverdraw(uint32_t* indices, size_t indexCount, const uint8_t* positions, uint32_t stride,
+        uint32_t vertexCount, float threshold = c_OverdrawThreshold, uint32_t cacheSize = c_VertexCacheSize);
+
+    // Numbers the vertices in the order the indices first use them, so the vertex fetch reads
+    // memory in order, and rewrites the indices to match. Returns the new number of each vertex;
+    // unused vertices go at the end, in their old order.
+    std::vector<uint32_t> OptimiseVertexFetch(uint32_t* indices, size_t indexCount, uint32_t vertexCount);
+
+    struct MeshOptimisation
+    {
+        VertexCacheStatistics   before;
+        VertexCacheStatistics   after;
+        uint32_t                partsReordered;
+        uint32_t                partsSkipped;       // not triangle lists, or sharing indices with another
+        uint32_t                streamsRemapped;    // vertex streams put in fetch order
+        uint32_t                streamsNarrowed;    // 32-bit index streams rewritten as 16-bit
+        uint64_t                indexBytesBefore;
+        uint64_t                indexBytesAfter;
+    };
+
+    // Runs all three over a parsed model, writing the results into 'file', a copy of the bytes
+    // it was parsed from (streams that point into 'source' are at the same offsets there). Each
+    // triangle-list part is reordered on its own, and overdraw is left alone for alpha parts,
+    // whose triangles blend in order. A vertex stream is put in fetch order only when it is
+    // stored in the file as it is loaded and every part drawing from it starts at vertex 0 and
+    // has indices of its own.
+    MeshOptimisation OptimiseModel(ModelData const& model, const uint8_t* source, uint8_t* file);
+
+    // The model file (SDKMESH, CMO or VBO, by the name's extension) optimised, and for SDKMESH
+    // with its 32-bit index buffers narrowed to 16 bits where every index fits. The result is
+    // parsed again before it is returned; malformed files throw std::runtime_error.
+    std::vector<uint8_t> OptimiseModelFile(std::filesystem::path const& name, std::vector<uint8_t> const& data,
+        MeshOptimisation& optimisation);
+
+    // Optimises every model among the files, without writing anything, and reports each one's
+    // ACMR and ATVR before and after, with the index bytes narrowing saves.
+    int ReportMeshOptimisation(std::vector<std::filesystem::path> const& files);
+}
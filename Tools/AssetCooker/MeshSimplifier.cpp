@@ -0,0 +1,772 @@
+//
+// MeshSimplifier.cpp - Quadric error simplification of model meshes into levels of detail
+//
+
+#include "MeshSimplifier.h"
+#include "Cooker.h"
+#include "MeshOptimiser.h"
+#include "VertexPacking.h"
+#include "../Common/FileIO.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <float.h>
+#include <map>
+#include <math.h>
+#include <memory>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const uint32_t c_NoVertex = UINT32_MAX;
+    const uint32_t c_SharedPosition = UINT32_MAX;
+    const char* const c_ModelExtensions[] = { ".sdkmesh", ".cmo", ".vbo", nullptr };
+
+    // Planes along open edges weigh this much more than a triangle of the same area
+    const double c_BorderWeight = 10.0;
+
+    struct Candidate
+    {
+        double      cost;
+        uint32_t    from;
+        uint32_t    to;
+    };
+
+    uint64_t EdgeKey(uint32_t a, uint32_t b)
+    {
+        return (uint64_t(a) << 32) | b;
+    }
+
+    // (b - a) x (c - a)
+    void TriangleNormal(const float* a, const float* b, const float* c, double* normal)
+    {
+        const double e1[3] = { double(b[0]) - a[0], double(b[1]) - a[1], double(b[2]) - a[2] };
+        const double e2[3] = { double(c[0]) - a[0], double(c[1]) - a[1], double(c[2]) - a[2] };
+        normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    }
+
+    // Three floats, or packed (VertexPacking.h); null when the stream has neither
+    const ModelData::VertexElement* FindPositions(ModelData::VertexStream const& stream)
+    {
+        for (auto const& element : stream.elements)
+        {
+            if (!strcmp(element.semanticName, "SV_Position") && element.semanticIndex == 0
+                && (element.format == ModelData::Format_R32G32B32_Float || element.format == ModelData::Format_R32G32B32A32_Float
+                    || element.format == ModelData::Format_R16G16B16A16_SNorm))
+                return &element;
+        }
+        return nullptr;
+    }
+
+    std::vector<uint32_t> ReadIndices(ModelData::IndexStream const& stream, uint32_t start, uint32_t count)
+    {
+        std::vector<uint32_t> indices(count);
+        if (stream.format == ModelData::Format_R32_UInt)
+        {
+            memcpy(indices.data(), stream.data + size_t(start) * sizeof(uint32_t), indices.size() * sizeof(uint32_t));
+        }
+        else
+        {
+            for (size_t i = 0; i < indices.size(); ++i)
+            {
+                uint16_t index;
+                memcpy(&index, stream.data + (start + i) * sizeof(uint16_t), sizeof(index));
+                indices[i] = index;
+            }
+        }
+        return indices;
+    }
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // One part's triangles and the vertices they use, relative to its vertexOffset
+    struct PartSource
+    {
+        std::vector<uint32_t>   indices;
+        const uint8_t*          positions;
+        uint32_t                stride;
+        uint32_t                vertexCount;
+        std::vector<float>      decoded;    // packed positions in model units, which 'positions' then points to
+    };
+
+    bool ReadPart(ModelData const& model, ModelData::Mesh const& mesh, ModelData::Part const& part, PartSource& source)
+    {
+        if (part.topology != ModelData::Topology_TriangleList || part.indexCount % 3
+            || part.vertexStream >= model.vertexStreams.size() || part.indexStream >= model.indexStreams.size())
+            return false;
+
+        auto const& vertices = model.vertexStreams[part.vertexStream];
+        auto const& indices = model.indexStreams[part.indexStream];
+        const auto positions = FindPositions(vertices);
+        if (!positions || part.vertexOffset < 0 || part.startIndex > indices.indexCount
+            || part.indexCount > indices.indexCount - part.startIndex)
+            return false;
+
+        source.indices = ReadIndices(indices, part.startIndex, part.indexCount);
+        uint32_t last = 0;
+        for (uint32_t index : source.indices)
+        {
+            last = std::max(last, index);
+        }
+        if (uint64_t(part.vertexOffset) + last >= vertices.vertexCount)
+            return false;
+
+        source.positions = vertices.GetData() + size_t(part.vertexOffset) * vertices.stride + positions->offset;
+        source.stride = vertices.stride;
+        source.vertexCount = source.indices.empty() ? 0 : last + 1;
+
+        // Simplified in model units, so errors measure the same as for float positions
+        if (positions->format == ModelData::Format_R16G16B16A16_SNorm)
+        {
+            source.decoded.resize(size_t(source.vertexCount) * 3);
+            for (uint32_t v = 0; v < source.vertexCount; ++v)
+            {
+                int16_t packed[3];
+                memcpy(packed, source.positions + size_t(v) * source.stride, sizeof(packed));
+                UnpackPosition(packed, mesh.positionOffset, mesh.positionScale, &source.decoded[size_t(v) * 3]);
+            }
+            source.positions = reinterpret_cast<const uint8_t*>(source.decoded.data());
+            source.stride = 3 * sizeof(float);
+        }
+        return true;
+    }
+
+    // Simplifies every part of the mesh level by level, appending each level's indices to
+    // 'lodIndices'. False, with the mesh untouched, when some part cannot be simplified.
+    bool GenerateMeshLods(ModelData const& model, ModelData::Mesh& mesh, std::vector<uint32_t>& lodIndices,
+        ModelLodGeneration& generation)
+    {
+        if (mesh.parts.empty() || !(mesh.sphereRadius > 0.f))
+            return false;
+
+        std::vector<PartSource> sources(mesh.parts.size());
+        for (size_t p = 0; p < mesh.parts.size(); ++p)
+        {
+            if (!ReadPart(model, mesh, mesh.parts[p], sources[p]))
+                return false;
+        }
+
+        // Where two parts meet, both keep the vertices along the join, so the levels of one
+        // never pull away from the other
+        std::map<std::array<uint32_t, 3>, uint32_t> owners;
+        for (uint32_t p = 0; p < sources.size(); ++p)
+        {
+            for (uint32_t index : sources[p].indices)
+            {
+                std::array<uint32_t, 3> key;
+                memcpy(key.data(), sources[p].positions + size_t(index) * sources[p].stride, sizeof(key));
+                auto found = owners.emplace(key, p);
+                if (!found.second && found.first->second != p)
+                {
+                    found.first->second = c_SharedPosition;
+                }
+            }
+        }
+
+        std::vector<std::unique_ptr<MeshSimplifier>> simplifiers;
+        uint64_t previous = 0;
+        for (uint32_t p = 0; p < sources.size(); ++p)
+        {
+            auto const& source = sources[p];
+            std::unique_ptr<bool[]> locked(new bool[source.vertexCount]());
+            for (uint32_t index : source.indices)
+            {
+                std::array<uint32_t, 3> key;
+                memcpy(key.data(), source.positions + size_t(index) * source.stride, sizeof(key));
+                locked[index] = owners[key] == c_SharedPosition;
+            }
+
+            simplifiers.push_back(std::make_unique<MeshSimplifier>(source.indices.data(), source.indices.size(),
+                source.positions, source.stride, source.vertexCount, locked.get()));
+            previous += source.indices.size() / 3;
+        }
+        generation.triangles[0] += previous;
+
+        uint32_t level = 0;
+        for (; level < c_MaxModelLods && previous >= c_MinLodTriangles; ++level)
+        {
+            uint64_t triangles = 0;
+            float error = 0.f;
+            for (auto& simplifier : simplifiers)
+            {
+                const size_t target = size_t(double(simplifier->GetIndices().size() / 3) * c_LodReduction) * 3;
+                triangles += simplifier->Simplify(target) / 3;
+                error = std::max(error, simplifier->GetError());
+            }
+
+            if (double(triangles) > double(previous) * c_MinLodReduction)
+                break;
+
+            mesh.lodErrors.push_back(error / mesh.sphereRadius);
+            for (size_t p = 0; p < simplifiers.size(); ++p)
+            {
+                std::vector<uint32_t> indices(simplifiers[p]->GetIndices());
+                OptimiseVertexCache(indices.data(), indices.size(), sources[p].vertexCount);
+
+                mesh.parts[p].lods.push_back({ 0, uint32_t(lodIndices.size()), uint32_t(indices.size()) });
+                lodIndices.insert(lodIndices.end(), indices.begin(), indices.end());
+            }
+
+            generation.triangles[level + 1] += triangles;
+            previous = triangles;
+        }
+
+        for (++level; level <= c_MaxModelLods; ++level)
+        {
+            generation.triangles[level] += previous;
+        }
+        return true;
+    }
+}
+
+void MeshSimplifier::Quadric::AddPlane(double a, double b, double c, double d, double planeWeight)
+{
+    aa += planeWeight * a * a;
+    ab += planeWeight * a * b;
+    ac += planeWeight * a * c;
+    ad += planeWeight * a * d;
+    bb += planeWeight * b * b;
+    bc += planeWeight * b * c;
+    bd += planeWeight * b * d;
+    cc += planeWeight * c * c;
+    cd += planeWeight * c * d;
+    dd += planeWeight * d * d;
+    weight += planeWeight;
+}
+
+MeshSimplifier::Quadric& MeshSimplifier::Quadric::operator+= (Quadric const& other)
+{
+    aa += other.aa;
+    ab += other.ab;
+    ac += other.ac;
+    ad += other.ad;
+    bb += other.bb;
+    bc += other.bc;
+    bd += other.bd;
+    cc += other.cc;
+    cd += other.cd;
+    dd += other.dd;
+    weight += other.weight;
+    return *this;
+}
+
+// The weighted sum of squared distances from the planes
+double MeshSimplifier::Quadric::Evaluate(float const* position) const
+{
+    const double x = position[0];
+    const double y = position[1];
+    const double z = position[2];
+    const double sum = aa * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+        + bb * y * y + 2 * bc * y * z + 2 * bd * y
+        + cc * z * z + 2 * cd * z
+        + dd;
+    return std::max(sum, 0.0);
+}
+
+MeshSimplifier::MeshSimplifier(const uint32_t* indices, size_t indexCount, const uint8_t* positions, uint32_t stride,
+    uint32_t vertexCount, const bool* locked) :
+    m_indices(indices, indices + (indexCount - indexCount % 3)),
+    m_positions(size_t(vertexCount) * 3),
+    m_error(0)
+{
+    for (uint32_t index : m_indices)
+    {
+        if (index >= vertexCount)
+            throw std::runtime_error("Mesh to simplify refers to a missing vertex");
+    }
+
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        memcpy(&m_positions[size_t(v) * 3], positions + size_t(v) * stride, 3 * sizeof(float));
+    }
+
+    Classify(locked);
+    BuildQuadrics();
+}
+
+void MeshSimplifier::Classify(const bool* locked)
+{
+    const uint32_t vertexCount = uint32_t(m_positions.size() / 3);
+    m_kinds.assign(vertexCount, Kind_Manifold);
+    m_borderNext.assign(vertexCount, c_NoVertex);
+    m_borderPrevious.assign(vertexCount, c_NoVertex);
+
+    // Vertices that share a position are numbered by the first of them
+    std::vector<uint32_t> order(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        order[v] = v;
+    }
+
+    auto position = [&](uint32_t v) { return &m_positions[size_t(v) * 3]; };
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+    {
+        const int compare = memcmp(position(a), position(b), 3 * sizeof(float));
+        return compare < 0 || (compare == 0 && a < b);
+    });
+
+    m_positionIds.resize(vertexCount);
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        const bool sameAsPrevious = i > 0 && !memcmp(position(order[i]), position(order[i - 1]), 3 * sizeof(float));
+        m_positionIds[order[i]] = sameAsPrevious ? m_positionIds[order[i - 1]] : order[i];
+    }
+
+    // Triangles with two corners at one position cover nothing
+    size_t kept = 0;
+    for (size_t t = 0; t < m_indices.size(); t += 3)
+    {
+        const uint32_t a = m_positionIds[m_indices[t]];
+        const uint32_t b = m_positionIds[m_indices[t + 1]];
+        const uint32_t c = m_positionIds[m_indices[t + 2]];
+        if (a == b || b == c || c == a)
+            continue;
+
+        std::copy(&m_indices[t], &m_indices[t] + 3, &m_indices[kept]);
+        kept += 3;
+    }
+    m_indices.resize(kept);
+
+    // Edges between positions: open ones, which only one triangle has, make up the borders
+    // and are followed in the direction the triangles wind; edges more triangles share lock
+    // their ends
+    std::unordered_map<uint64_t, uint32_t> edges;
+    edges.reserve(m_indices.size());
+    for (size_t t = 0; t < m_indices.size(); t += 3)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            ++edges[EdgeKey(m_positionIds[m_indices[t + k]], m_positionIds[m_indices[t + (k + 1) % 3]])];
+        }
+    }
+
+    for (auto const& edge : edges)
+    {
+        const uint32_t a = uint32_t(edge.first >> 32);
+        const uint32_t b = uint32_t(edge.first);
+        auto reverse = edges.find(EdgeKey(b, a));
+        const uint32_t reverseCount = (reverse != edges.end()) ? reverse->second : 0;
+
+        if (edge.second > 1 || reverseCount > 1)
+        {
+            m_kinds[a] = m_kinds[b] = Kind_Locked;
+        }
+        else if (!reverseCount)
+        {
+            if (m_borderNext[a] != c_NoVertex)
+                m_kinds[a] = Kind_Locked;
+            m_borderNext[a] = b;
+
+            if (m_borderPrevious[b] != c_NoVertex)
+                m_kinds[b] = Kind_Locked;
+            m_borderPrevious[b] = a;
+        }
+    }
+
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+        const uint32_t p = m_positionIds[v];
+        if (locked && locked[v])
+        {
+            m_kinds[p] = Kind_Locked;
+        }
+        else if (p == v && m_kinds[p] == Kind_Manifold && (m_borderNext[p] != c_NoVertex || m_borderPrevious[p] != c_NoVertex))
+        {
+            // Only a border that passes straight through may be followed
+            m_kinds[p] = (m_borderNext[p] != c_NoVertex && m_borderPrevious[p] != c_NoVertex) ? Kind_Border : Kind_Locked;
+        }
+    }
+}
+
+void MeshSimplifier::BuildQuadrics()
+{
+    m_quadrics.assign(m_positions.size() / 3, Quadric{});
+
+    // Open edges between vertices rather than positions: borders, and seams in the attributes
+    std::unordered_map<uint64_t, bool> edges;
+    edges.reserve(m_indices.size());
+    for (size_t t = 0; t < m_indices.size(); t += 3)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            edges[EdgeKey(m_indices[t + k], m_indices[t + (k + 1) % 3])] = true;
+        }
+    }
+
+    auto position = [&](uint32_t v) { return &m_positions[size_t(v) * 3]; };
+    for (size_t t = 0; t < m_indices.size(); t += 3)
+    {
+        const uint32_t corners[3] = { m_indices[t], m_indices[t + 1], m_indices[t + 2] };
+
+        double normal[3];
+        TriangleNormal(position(corners[0]), position(corners[1]), position(corners[2]), normal);
+        const double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (!(length > 0.0))
+            continue;
+
+        for (double& n : normal)
+        {
+            n /= length;
+        }
+
+        const float* p0 = position(corners[0]);
+        const double d = -(normal[0] * p0[0] + normal[1] * p0[1] + normal[2] * p0[2]);
+        const double area = length * 0.5;
+        for (uint32_t corner : corners)
+        {
+            m_quadrics[m_positionIds[corner]].AddPlane(normal[0], normal[1], normal[2], d, area);
+        }
+
+        // A plane through each open edge, upright on the triangle, so the border or seam keeps
+        // its line
+        for (int k = 0; k < 3; ++k)
+        {
+            const uint32_t a = corners[k];
+            const uint32_t b = corners[(k + 1) % 3];
+            if (edges.count(EdgeKey(b, a)))
+                continue;
+
+            const float* pa = position(a);
+            const float* pb = position(b);
+            const double edge[3] = { double(pb[0]) - pa[0], double(pb[1]) - pa[1], double(pb[2]) - pa[2] };
+            double side[3] =
+            {
+                edge[1] * normal[2] - edge[2] * normal[1],
+                edge[2] * normal[0] - edge[0] * normal[2],
+                edge[0] * normal[1] - edge[1] * normal[0],
+            };
+            const double sideLength = sqrt(side[0] * side[0] + side[1] * side[1] + side[2] * side[2]);
+            if (!(sideLength > 0.0))
+                continue;
+
+            for (double& s : side)
+            {
+                s /= sideLength;
+            }
+
+            const double sideD = -(side[0] * pa[0] + side[1] * pa[1] + side[2] * pa[2]);
+            const double weight = (edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2]) * c_BorderWeight;
+            m_quadrics[m_positionIds[a]].AddPlane(side[0], side[1], side[2], sideD, weight);
+            m_quadrics[m_positionIds[b]].AddPlane(side[0], side[1], side[2], sideD, weight);
+        }
+    }
+}
+
+// Whether moving position 'from' onto 'to' turns over any triangle around it that survives
+bool MeshSimplifier::Flips(uint32_t from, uint32_t to) const
+{
+    auto position = [&](uint32_t v) { return &m_positions[size_t(v) * 3]; };
+    for (uint32_t i = m_offsets[from]; i < m_offsets[from + 1]; ++i)
+    {
+        const uint32_t* corners = &m_indices[size_t(m_adjacency[i]) * 3];
+        uint32_t ids[3] = { m_positionIds[corners[0]], m_positionIds[corners[1]], m_positionIds[corners[2]] };
+        if (ids[0] == to || ids[1] == to || ids[2] == to)
+            continue;
+
+        double before[3], after[3];
+        TriangleNormal(position(ids[0]), position(ids[1]), position(ids[2]), before);
+        for (uint32_t& id : ids)
+        {
+            if (id == from)
+                id = to;
+        }
+        TriangleNormal(position(ids[0]), position(ids[1]), position(ids[2]), after);
+
+        if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0)
+            return true;
+    }
+    return false;
+}
+
+// Pairs every vertex at position 'from' with the vertex at 'to' it shares a triangle with, so
+// each corner moves to the vertex on its own side of any seam. False if a vertex has none,
+// or two: moving it would drag attributes across a seam.
+bool MeshSimplifier::MapCorners(uint32_t from, uint32_t to, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const
+{
+    pairs.clear();
+    for (uint32_t i = m_offsets[from]; i < m_offsets[from + 1]; ++i)
+    {
+        const uint32_t* corners = &m_indices[size_t(m_adjacency[i]) * 3];
+        uint32_t source = c_NoVertex;
+        uint32_t target = c_NoVertex;
+        for (int k = 0; k < 3; ++k)
+        {
+            if (m_positionIds[corners[k]] == from)
+                source = corners[k];
+            else if (m_positionIds[corners[k]] == to)
+                target = corners[k];
+        }
+        if (target == c_NoVertex)
+            continue;
+
+        auto found = std::find_if(pairs.begin(), pairs.end(), [&](std::pair<uint32_t, uint32_t> const& pair) { return pair.first == source; });
+        if (found == pairs.end())
+            pairs.emplace_back(source, target);
+        else if (found->second != target)
+            return false;
+    }
+
+    for (uint32_t i = m_offsets[from]; i < m_offsets[from + 1]; ++i)
+    {
+        const uint32_t* corners = &m_indices[size_t(m_adjacency[i]) * 3];
+        for (int k = 0; k < 3; ++k)
+        {
+            if (m_positionIds[corners[k]] == from
+                && std::none_of(pairs.begin(), pairs.end(), [&](std::pair<uint32_t, uint32_t> const& pair) { return pair.first == corners[k]; }))
+                return false;
+        }
+    }
+    return true;
+}
+
+size_t MeshSimplifier::Simplify(size_t targetIndexCount)
+{
+    const uint32_t vertexCount = uint32_t(m_positions.size() / 3);
+
+    std::vector<Candidate> best;
+    std::vector<Candidate> candidates;
+    std::vector<bool> touched;
+    std::vector<std::pair<uint32_t, uint32_t>> pairs;
+
+    while (m_indices.size() > targetIndexCount)
+    {
+        const size_t triangleCount = m_indices.size() / 3;
+
+        // The triangles around each position
+        m_offsets.assign(vertexCount + 1, 0);
+        for (uint32_t index : m_indices)
+        {
+            ++m_offsets[m_positionIds[index] + 1];
+        }
+        for (uint32_t v = 0; v < vertexCount; ++v)
+        {
+            m_offsets[v + 1] += m_offsets[v];
+        }
+        m_adjacency.resize(m_indices.size());
+        {
+            std::vector<uint32_t> fill(m_offsets.begin(), m_offsets.end() - 1);
+            for (size_t i = 0; i < m_indices.size(); ++i)
+            {
+                m_adjacency[fill[m_positionIds[m_indices[i]]]++] = uint32_t(i / 3);
+            }
+        }
+
+        // The cheapest collapse of every position that may move
+        best.assign(vertexCount, Candidate{ DBL_MAX, c_NoVertex, c_NoVertex });
+        auto consider = [&](uint32_t from, uint32_t to)
+        {
+            const Kind kind = m_kinds[from];
+            if (kind == Kind_Locked || (kind == Kind_Border && to != m_borderNext[from] && to != m_borderPrevious[from]))
+                return;
+
+            auto const& a = m_quadrics[from];
+            auto const& b = m_quadrics[to];
+            const float* p = &m_positions[size_t(to) * 3];
+            const double weight = a.weight + b.weight;
+            const double cost = weight > 0.0 ? (a.Evaluate(p) + b.Evaluate(p)) / weight : 0.0;
+            if (cost < best[from].cost)
+            {
+                best[from] = { cost, from, to };
+            }
+        };
+
+        for (size_t t = 0; t < m_indices.size(); t += 3)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                const uint32_t a = m_positionIds[m_indices[t + k]];
+                const uint32_t b = m_positionIds[m_indices[t + (k + 1) % 3]];
+                consider(a, b);
+                consider(b, a);
+            }
+        }
+
+        candidates.clear();
+        for (auto const& candidate : best)
+        {
+            if (candidate.from != c_NoVertex)
+                candidates.push_back(candidate);
+        }
+        std::sort(candidates.begin(), candidates.end(), [](Candidate const& a, Candidate const& b)
+        {
+            return a.cost < b.cost || (a.cost == b.cost && a.from < b.from);
+        });
+
+        // A collapse inside the surface removes two triangles, one on a border one
+        const size_t goal = std::max<size_t>((triangleCount - targetIndexCount / 3) / 2, 1);
+        size_t collapses = 0;
+        touched.assign(vertexCount, false);
+
+        for (auto const& candidate : candidates)
+        {
+            if (collapses >= goal)
+                break;
+
+            const uint32_t from = candidate.from;
+            const uint32_t to = candidate.to;
+            if (touched[from] || touched[to] || !MapCorners(from, to, pairs) || Flips(from, to))
+                continue;
+
+            // Nothing else this pass may use the triangles around 'from', whose corners change
+            for (uint32_t i = m_offsets[from]; i < m_offsets[from + 1]; ++i)
+            {
+                uint32_t* corners = &m_indices[size_t(m_adjacency[i]) * 3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    for (auto const& pair : pairs)
+                    {
+                        if (corners[k] == pair.first)
+                        {
+                            corners[k] = pair.second;
+                            break;
+                        }
+                    }
+                    touched[m_positionIds[corners[k]]] = true;
+                }
+            }
+            touched[from] = true;
+
+            if (m_kinds[from] == Kind_Border)
+            {
+                if (to == m_borderNext[from])
+                {
+                    const uint32_t previous = m_borderPrevious[from];
+                    m_borderNext[previous] = to;
+                    m_borderPrevious[to] = previous;
+                }
+                else
+                {
+                    const uint32_t next = m_borderNext[from];
+                    m_borderPrevious[next] = to;
+                    m_borderNext[to] = next;
+                }
+
+                // A border closed down to two vertices has nowhere left to go
+                if (m_borderNext[to] == m_borderPrevious[to])
+                {
+                    m_kinds[to] = Kind_Locked;
+                }
+            }
+
+            m_quadrics[to] += m_quadrics[from];
+            m_kinds[from] = Kind_Locked;
+            m_error = std::max(m_error, candidate.cost);
+            ++collapses;
+        }
+
+        if (!collapses)
+            break;
+
+        // Triangles that lost a corner to the collapse that removed their edge
+        size_t kept = 0;
+        for (size_t t = 0; t < m_indices.size(); t += 3)
+        {
+            const uint32_t a = m_positionIds[m_indices[t]];
+            const uint32_t b = m_positionIds[m_indices[t + 1]];
+            const uint32_t c = m_positionIds[m_indices[t + 2]];
+            if (a == b || b == c || c == a)
+                continue;
+
+            std::copy(&m_indices[t], &m_indices[t] + 3, &m_indices[kept]);
+            kept += 3;
+        }
+        m_indices.resize(kept);
+    }
+
+    return m_indices.size();
+}
+
+float MeshSimplifier::GetError() const
+{
+    return float(sqrt(m_error));
+}
+
+std::vector<uint8_t> DX::GenerateModelLods(fs::path const& name, std::vector<uint8_t> const& data,
+    ModelLodGeneration& generation)
+{
+    generation = {};
+
+    const auto fileName = name.wstring();
+    auto model = ModelData::Parse(fileName.c_str(), data.data(), data.size());
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint32_t> lodIndices;
+    for (auto& mesh : model->meshes)
+    {
+        ++generation.meshes;
+        if (!GenerateMeshLods(*model, mesh, lodIndices, generation))
+        {
+            ++generation.meshesSkipped;
+        }
+    }
+    generation.ms = MillisecondsSince(start);
+
+    std::vector<uint8_t> file(data);
+    AppendModelLods(*model, lodIndices, file);
+
+    // The game parses the result; anything wrong with it should fail the cook instead
+    ModelData::Parse(fileName.c_str(), file.data(), file.size());
+    return file;
+}
+
+int DX::ReportModelLods(std::vector<fs::path> const& files)
+{
+    size_t measured = 0;
+    ModelLodGeneration total = {};
+
+    printf("%-40s %9s %9s %9s %9s %9s %6s %8s %9s\n", "model", "triangles", "level 1", "level 2", "level 3", "level 4",
+        "meshes", "ms", "Mtris/s");
+    for (auto const& file : files)
+    {
+        if (!HasExtension(file, c_ModelExtensions))
+            continue;
+
+        ModelLodGeneration generation;
+        try
+        {
+            GenerateModelLods(file, ReadFile(file), generation);
+        }
+        catch (std::exception const& e)
+        {
+            fprintf(stderr, "AssetCooker: %s: %s\n", file.generic_u8string().c_str(), e.what());
+            continue;
+        }
+
+        printf("%-40s", file.generic_u8string().c_str());
+        for (uint32_t level = 0; level <= c_MaxModelLods; ++level)
+        {
+            printf(" %9llu", (unsigned long long)generation.triangles[level]);
+            total.triangles[level] += generation.triangles[level];
+        }
+        printf(" %6u %8.2f %9.2f\n", generation.meshes - generation.meshesSkipped, generation.ms,
+            generation.ms > 0.0 ? double(generation.triangles[0]) / (generation.ms * 1000.0) : 0.0);
+
+        total.meshes += generation.meshes;
+        total.meshesSkipped += generation.meshesSkipped;
+        total.ms += generation.ms;
+        ++measured;
+    }
+
+    printf("%zu models: %u meshes simplified, %u skipped, triangles", measured,
+        total.meshes - total.meshesSkipped, total.meshesSkipped);
+    for (uint32_t level = 0; level <= c_MaxModelLods; ++level)
+    {
+        printf("%s%llu", level ? " -> " : " ", (unsigned long long)total.triangles[level]);
+    }
+    printf(", %.2f ms, %.2f million triangles/s\n", total.ms,
+        total.ms > 0.0 ? double(total.triangles[0]) / (total.ms * 1000.0) : 0.0);
+    return measured ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+//
+// MeshSimplifier.h - Quadric error simplification of model meshes into levels of detail
+//
+
+#pragma once
+
+#include "ModelData.h"
+#include "ModelLod.h"
+
+#include <filesystem>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace DX
+{
+    // Each level aims for this fraction of the previous level's triangles.
+    const float c_LodReduction = 0.5f;
+
+    // A level is kept only if it has at most this fraction of the previous level's triangles;
+    // the chain stops at the first one that simplification could not bring down that far.
+    const float c_MinLodReduction = 0.8f;
+
+    // Meshes with fewer triangles than this get no coarser level.
+    const uint32_t c_MinLodTriangles = 64;
+
+    // Simplifies a triangle list by collapsing edges onto existing vertices, cheapest first,
+    // with the quadric error metric (Garland and Heckbert, "Surface Simplification Using Quadric
+    // Error Metrics", 1997): every position carries the sum of the squared distances to the
+    // planes of its original triangles, weighted by their areas, and a collapse costs the
+    // distance its surviving position then has from them. Open edges, at borders and at seams
+    // in the other attributes, add planes at right angles to their triangle, so both keep
+    // their line.
+    //
+    // Topology is that of the positions, so a seam is no border. Each vertex at the position
+    // that moves goes to the vertex at the target it shares a triangle with, which keeps every
+    // corner on its own side of a seam; a collapse that leaves some vertex without exactly one
+    // such partner (one that would cross a seam) is refused, as are those that would turn a
+    // triangle over. A border position moves only along its border, and positions where
+    // borders meet, on an edge more than two triangles share, or flagged by the caller, stay.
+    //
+    // Each pass finds the cheapest collapse of every vertex and makes those that touch no
+    // other collapse of the pass, in order of cost, so a pass costs a sort and a sweep over
+    // the triangles. Simplify may be called again with smaller targets to continue from where
+    // the last call stopped, so a whole chain of levels is measured against the original mesh.
+    class MeshSimplifier
+    {
+    public:
+        // 'positions' are three floats at a 'stride'; 'locked', when given, one flag per vertex.
+        MeshSimplifier(const uint32_t* indices, size_t indexCount, const uint8_t* positions, uint32_t stride,
+            uint32_t vertexCount, const bool* locked = nullptr);
+
+        // Collapses edges until at most 'targetIndexCount' indices are left or nothing more can
+        // collapse. Returns the number of indices left.
+        size_t Simplify(size_t targetIndexCount);
+
+        std::vector<uint32_t> const& GetIndices() const { return m_indices; }
+
+        // The largest distance, in model units, of any surviving vertex from the original
+        // surface around it, as the quadrics measure it.
+        float GetError() const;
+
+    private:
+        enum Kind : uint8_t
+        {
+            Kind_Manifold,      // moves onto any neighbour
+            Kind_Border,        // moves along its border
+            Kind_Locked,        // stays, but others may move onto it
+        };
+
+        struct Quadric
+        {
+            void AddPlane(double a, double b, double c, double d, double weight);
+            Quadric& operator+= (Quadric const& other);
+            double Evaluate(float const* position) const;  // weighted sum of squared distances
+
+            double  aa, ab, ac, ad, bb, bc, bd, cc, cd, dd;
+            double  weight;
+        };
+
+        void Classify(const bool* locked);
+        void BuildQuadrics();
+        bool Flips(uint32_t from, uint32_t to) const;
+        bool MapCorners(uint32_t from, uint32_t to, std::vector<std::pair<uint32_t, uint32_t>>& pairs) const;
+
+        // Positions are numbered by the first vertex at each; the per-position arrays below are
+        // indexed that way, so only the first vertex's entry is used.
+        std::vector<uint32_t>   m_indices;
+        std::vector<float>      m_positions;    // three per vertex
+        std::vector<uint32_t>   m_positionIds;  // by vertex
+        std::vector<uint32_t>   m_borderNext;   // along the border, by position
+        std::vector<uint32_t>   m_borderPrevious;
+        std::vector<Kind>       m_kinds;
+        std::vector<Quadric>    m_quadrics;
+        std::vector<uint32_t>   m_offsets;      // into m_adjacency, by position, for the current pass
+        std::vector<uint32_t>   m_adjacency;    // the triangles around each position
+        double                  m_error;        // squared
+    };
+
+    struct ModelLodGeneration
+    {
+        uint32_t    meshes;
+        uint32_t    meshesSkipped;      // not all triangle lists, or without positions
+        uint64_t    triangles[c_MaxModelLods + 1];  // of every mesh at each level, or its finest below
+        double      ms;                 // simplifying, not parsing or writing
+    };
+
+    // The model file (SDKMESH, CMO or VBO, by the name's extension) with a chain of levels of
+    // detail appended for each mesh (ModelLod.h). Each part is simplified on its own, with the
+    // vertices it shares with another part of the mesh locked so parts never open cracks
+    // between them, and every level's triangles are reordered for the vertex cache. A level's
+    // error is the largest of its parts'. The result is parsed again before it is returned;
+    // malformed files throw std::runtime_error.
+    std::vector<uint8_t> GenerateModelLods(std::filesystem::path const& name, std::vector<uint8_t> const& data,
+        ModelLodGeneration& generation);
+
+    // Generates every model's levels, without writing anything, and reports the triangles at
+    // each level and how fast simplification ran.
+    int ReportModelLods(std::vector<std::filesystem::path> const& files);
+}
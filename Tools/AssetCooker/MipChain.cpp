@@ -0,0 +1,487 @@
+//
+// MipChain.cpp - Uncompressed images and their mip chains, for the texture cooker
+//
+
+#include "MipChain.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdexcept>
+#include <string.h>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+using namespace DX;
+
+namespace
+{
+    const float c_KaiserWidth = 3.0f;   // destination texels either side of the centre
+    const float c_KaiserAlpha = 4.0f;
+    const float c_Pi = 3.14159265358979f;
+
+    // Four floats per texel, so a texel is one SSE register
+    struct FloatImage
+    {
+        uint32_t            width;
+        uint32_t            height;
+        std::vector<float>  texels;
+
+        float* GetRow(uint32_t y) { return texels.data() + size_t(y) * width * 4; }
+        const float* GetRow(uint32_t y) const { return texels.data() + size_t(y) * width * 4; }
+    };
+
+    struct Tap
+    {
+        uint32_t    index;
+        float       weight;
+    };
+
+    // The source texels, and their weights, that make each destination texel along one axis
+    using TapList = std::vector<std::vector<Tap>>;
+
+    float HalfToFloat(uint16_t half)
+    {
+        const uint32_t sign = uint32_t(half & 0x8000) << 16;
+        const uint32_t exponent = (half >> 10) & 0x1F;
+        const uint32_t mantissa = half & 0x3FF;
+
+        uint32_t bits;
+        if (exponent == 0)
+        {
+            const float value = ldexpf(float(mantissa), -24);
+            return sign ? -value : value;
+        }
+        else if (exponent == 31)
+        {
+            bits = sign | 0x7F800000 | (mantissa << 13);
+        }
+        else
+        {
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        }
+
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // Rounds to nearest even, as the GPU does
+    uint16_t FloatToHalf(float value)
+    {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        const uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+        const uint32_t magnitude = bits & 0x7FFFFFFF;
+
+        if (magnitude >= 0x7F800000)
+            return uint16_t(sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0));
+        if (magnitude >= 0x477FF000)
+            return uint16_t(sign | 0x7C00);             // 65520 and above round to infinity
+        if (magnitude < 0x38800000)
+        {
+            float small;
+            memcpy(&small, &magnitude, sizeof(small));
+            return uint16_t(sign | uint32_t(lrintf(small * 16777216.0f)));
+        }
+        return uint16_t(sign | (((magnitude - 0x38000000) + 0xFFF + ((magnitude >> 13) & 1)) >> 13));
+    }
+
+    float SRGBToLinear(float c)
+    {
+        return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    float LinearToSRGB(float c)
+    {
+        c = std::min(std::max(c, 0.0f), 1.0f);
+        return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+    }
+
+    // Encoding is by a table fine enough that dark values, where sRGB is steepest, still land
+    // on the byte powf would give
+    struct SRGBTable
+    {
+        static const int c_EncodeSteps = 65535;
+
+        float   toLinear[256];
+        uint8_t fromLinear[c_EncodeSteps + 1];
+
+        SRGBTable()
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                toLinear[i] = SRGBToLinear(i / 255.0f);
+            }
+            for (int i = 0; i <= c_EncodeSteps; ++i)
+            {
+                fromLinear[i] = uint8_t(LinearToSRGB(float(i) / c_EncodeSteps) * 255.0f + 0.5f);
+            }
+        }
+
+        uint8_t Encode(float c) const
+        {
+            return fromLinear[int(std::min(std::max(c, 0.0f), 1.0f) * c_EncodeSteps + 0.5f)];
+        }
+    };
+
+    const SRGBTable c_SRGB;
+
+    float Sinc(float x)
+    {
+        if (fabsf(x) < 1e-4f)
+            return 1.0f;
+        return sinf(c_Pi * x) / (c_Pi * x);
+    }
+
+    // Modified Bessel function of the first kind, order zero, by its power series
+    float BesselI0(float x)
+    {
+        float sum = 1.0f;
+        float term = 1.0f;
+        const float quarterSquare = x * x / 4.0f;
+        for (int k = 1; k < 32 && term > sum * 1e-8f; ++k)
+        {
+            term *= quarterSquare / float(k * k);
+            sum += term;
+        }
+        return sum;
+    }
+
+    float Kaiser(float u)
+    {
+        const float t = u / c_KaiserWidth;
+        if (t * t >= 1.0f)
+            return 0.0f;
+        return Sinc(u) * BesselI0(c_KaiserAlpha * sqrtf(1.0f - t * t)) / BesselI0(c_KaiserAlpha);
+    }
+
+    void AddTap(std::vector<Tap>& taps, int64_t index, uint32_t size, float weight)
+    {
+        const uint32_t clamped = uint32_t(std::min<int64_t>(std::max<int64_t>(index, 0), size - 1));
+        for (auto& tap : taps)
+        {
+            if (tap.index == clamped)
+            {
+                tap.weight += weight;
+                return;
+            }
+        }
+        taps.push_back({ clamped, weight });
+    }
+
+    // The box takes each source texel by how much of it the destination texel covers, so odd
+    // sizes lose nothing; the Kaiser window is stretched by the same ratio.
+    TapList MakeTaps(MipFilter filter, uint32_t sourceSize, uint32_t destSize)
+    {
+        TapList list(destSize);
+        const double scale = double(sourceSize) / destSize;
+        for (uint32_t d = 0; d < destSize; ++d)
+        {
+            auto& taps = list[d];
+            if (sourceSize == destSize)
+            {
+                taps.push_back({ d, 1.0f });
+                continue;
+            }
+
+            float total = 0;
+            if (filter == MipFilter::Box)
+            {
+                const double begin = d * scale;
+                const double end = (d + 1) * scale;
+                for (int64_t s = int64_t(begin); s < int64_t(ceil(end)); ++s)
+                {
+                    const float weight = float(std::min(end, double(s + 1)) - std::max(begin, double(s)));
+                    if (weight <= 0)
+                        continue;
+                    AddTap(taps, s, sourceSize, weight);
+                    total += weight;
+                }
+            }
+            else
+            {
+                const double centre = (d + 0.5) * scale;
+                const int64_t first = int64_t(floor(centre - c_KaiserWidth * scale));
+                const int64_t last = int64_t(ceil(centre + c_KaiserWidth * scale));
+                for (int64_t s = first; s <= last; ++s)
+                {
+                    const float weight = Kaiser(float((s + 0.5 - centre) / scale));
+                    if (weight == 0)
+                        continue;
+                    AddTap(taps, s, sourceSize, weight);
+                    total += weight;
+                }
+            }
+
+            for (auto& tap : taps)
+            {
+                tap.weight /= total;
+            }
+        }
+        return list;
+    }
+
+    // out = sum of weight * texel over the taps, for one texel
+    void FilterTexel(const float* row, std::vector<Tap> const& taps, float* out)
+    {
+#if defined(MIP_SSE2)
+        __m128 sum = _mm_setzero_ps();
+        for (auto const& tap : taps)
+        {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(row + tap.index * 4), _mm_set1_ps(tap.weight)));
+        }
+        _mm_storeu_ps(out, sum);
+#else
+        float sum[4] = {};
+        for (auto const& tap : taps)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                sum[c] += row[tap.index * 4 + c] * tap.weight;
+            }
+        }
+        memcpy(out, sum, sizeof(sum));
+#endif
+    }
+
+    // out += weight * source, along a whole row of floats (a multiple of four)
+    void AccumulateRow(const float* source, float weight, float* out, size_t count)
+    {
+#if defined(MIP_SSE2)
+        const __m128 w = _mm_set1_ps(weight);
+        for (size_t i = 0; i < count; i += 4)
+        {
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(source + i), w)));
+        }
+#else
+        for (size_t i = 0; i < count; ++i)
+        {
+            out[i] += source[i] * weight;
+        }
+#endif
+    }
+
+    void DecodeRow(Image const& image, MipContent content, uint32_t y, float* out)
+    {
+        const uint8_t* row = image.pixels.data() + y * image.GetRowPitch();
+        const size_t count = size_t(image.width) * 4;
+        if (image.format == ImageFormat::RGBA16F)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                uint16_t half;
+                memcpy(&half, row + i * 2, sizeof(half));
+                out[i] = HalfToFloat(half);
+            }
+            return;
+        }
+
+        for (size_t i = 0; i < count; i += 4)
+        {
+            for (size_t c = 0; c < 3; ++c)
+            {
+                switch (content)
+                {
+                case MipContent::Linear:    out[i + c] = row[i + c] / 255.0f; break;
+                case MipContent::sRGB:      out[i + c] = c_SRGB.toLinear[row[i + c]]; break;
+                case MipContent::NormalMap: out[i + c] = row[i + c] / 127.5f - 1.0f; break;
+                }
+            }
+            out[i + 3] = row[i + 3] / 255.0f;
+        }
+    }
+
+    void Normalize(float* texel, bool biased)
+    {
+        const float length = sqrtf(texel[0] * texel[0] + texel[1] * texel[1] + texel[2] * texel[2]);
+        if (length > 1e-6f)
+        {
+            texel[0] /= length;
+            texel[1] /= length;
+            texel[2] /= length;
+        }
+        else
+        {
+            texel[0] = texel[1] = 0;
+            texel[2] = 1;
+        }
+
+        if (biased)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                texel[c] = texel[c] * 0.5f + 0.5f;
+            }
+        }
+    }
+
+    Image Encode(FloatImage const& source, ImageFormat format, MipContent content)
+    {
+        Image image;
+        image.width = source.width;
+        image.height = source.height;
+        image.format = format;
+        image.pixels.resize(image.GetRowPitch() * image.height);
+
+        const size_t count = source.texels.size();
+        for (size_t i = 0; i < count; i += 4)
+        {
+            float texel[4];
+            memcpy(texel, source.texels.data() + i, sizeof(texel));
+
+            if (content == MipContent::NormalMap)
+                Normalize(texel, format == ImageFormat::RGBA8);
+
+            if (content == MipContent::sRGB)
+            {
+                // Only ever RGBA8; half-float sRGB is averaged as linear
+                for (int c = 0; c < 3; ++c)
+                {
+                    image.pixels[i + c] = c_SRGB.Encode(texel[c]);
+                }
+                image.pixels[i + 3] = uint8_t(std::min(std::max(texel[3], 0.0f), 1.0f) * 255.0f + 0.5f);
+            }
+            else if (format == ImageFormat::RGBA16F)
+            {
+                for (int c = 0; c < 4; ++c)
+                {
+                    const uint16_t half = FloatToHalf(texel[c]);
+                    memcpy(image.pixels.data() + (i + c) * 2, &half, sizeof(half));
+                }
+            }
+            else
+            {
+                // The Kaiser filter's negative lobes can overshoot a little
+                for (int c = 0; c < 4; ++c)
+                {
+                    image.pixels[i + c] = uint8_t(std::min(std::max(texel[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+                }
+            }
+        }
+        return image;
+    }
+
+    void Run(ParallelFor const& parallelFor, size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)
+    {
+        if (parallelFor)
+            parallelFor(count, grain, body);
+        else
+            body(0, count);
+    }
+}
+
+std::vector<Image> DX::BuildMipChain(Image const& top, MipSettings const& settings, ParallelFor const& parallelFor)
+{
+    return std::move(BuildMipChains(std::vector<Image>(1, top), settings, parallelFor)[0]);
+}
+
+std::vector<std::vector<Image>> DX::BuildMipChains(std::vector<Image> const& faces, MipSettings const& settings,
+    ParallelFor const& parallelFor)
+{
+    if (faces.empty())
+        return {};
+
+    auto const& top = faces[0];
+    for (auto const& face : faces)
+    {
+        if (face.width != top.width || face.height != top.height || face.format != top.format || !face.width || !face.height
+            || face.pixels.size() != face.GetRowPitch() * face.height)
+            throw std::runtime_error("mip chain faces differ in size or format");
+    }
+
+    // Half-float images hold linear values already, and signed normals
+    auto content = settings.content;
+    if (top.format == ImageFormat::RGBA16F && content == MipContent::sRGB)
+        content = MipContent::Linear;
+
+    const size_t faceCount = faces.size();
+    const size_t c_RowGrain = 8;
+
+    std::vector<std::vector<FloatImage>> levels(faceCount);
+    for (auto& chain : levels)
+    {
+        uint32_t width = top.width;
+        uint32_t height = top.height;
+        for (;;)
+        {
+            chain.push_back({ width, height, std::vector<float>(size_t(width) * height * 4) });
+            if (width == 1 && height == 1)
+                break;
+            width = std::max(1u, width / 2);
+            height = std::max(1u, height / 2);
+        }
+    }
+    const size_t levelCount = levels[0].size();
+
+    Run(parallelFor, faceCount * top.height, c_RowGrain, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            const size_t face = i / top.height;
+            const uint32_t y = uint32_t(i % top.height);
+            DecodeRow(faces[face], content, y, levels[face][0].GetRow(y));
+        }
+    });
+
+    // Separable: across each row into a level as wide as the next and as high as this one,
+    // then down the columns of that
+    for (size_t level = 1; level < levelCount; ++level)
+    {
+        const auto& above = levels[0][level - 1];
+        const uint32_t width = levels[0][level].width;
+        const uint32_t height = levels[0][level].height;
+        const auto across = MakeTaps(settings.filter, above.width, width);
+        const auto down = MakeTaps(settings.filter, above.height, height);
+
+        std::vector<FloatImage> halfway(faceCount, FloatImage{ width, above.height, std::vector<float>(size_t(width) * above.height * 4) });
+        Run(parallelFor, faceCount * above.height, c_RowGrain, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const size_t face = i / above.height;
+                const uint32_t y = uint32_t(i % above.height);
+                const float* source = levels[face][level - 1].GetRow(y);
+                float* out = halfway[face].GetRow(y);
+                for (uint32_t x = 0; x < width; ++x)
+                {
+                    FilterTexel(source, across[x], out + x * 4);
+                }
+            }
+        });
+
+        Run(parallelFor, faceCount * height, c_RowGrain, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const size_t face = i / height;
+                const uint32_t y = uint32_t(i % height);
+                float* out = levels[face][level].GetRow(y);
+                for (auto const& tap : down[y])
+                {
+                    AccumulateRow(halfway[face].GetRow(tap.index), tap.weight, out, size_t(width) * 4);
+                }
+            }
+        });
+    }
+
+    // Every level of every face converts back independently
+    std::vector<std::vector<Image>> chains(faceCount, std::vector<Image>(levelCount));
+    for (size_t face = 0; face < faceCount; ++face)
+    {
+        chains[face][0] = faces[face];
+    }
+
+    Run(parallelFor, faceCount * (levelCount - 1), 1, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            const size_t face = i / (levelCount - 1);
+            const size_t level = 1 + i % (levelCount - 1);
+            chains[face][level] = Encode(levels[face][level], top.format, content);
+        }
+    });
+    return chains;
+}
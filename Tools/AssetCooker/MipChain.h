@@ -0,0 +1,64 @@
+//
+// MipChain.h - Uncompressed images and their mip chains, for the texture cooker
+//
+
+#pragma once
+
+#include "../Common/ParallelFor.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace DX
+{
+    enum class ImageFormat
+    {
+        RGBA8,
+        RGBA16F,    // IEEE half floats
+    };
+
+    // Rows packed
+    struct Image
+    {
+        uint32_t                width;
+        uint32_t                height;
+        ImageFormat             format = ImageFormat::RGBA8;
+        bool                    sRGB = false;   // the source file says its colour is sRGB
+        std::vector<uint8_t>    pixels;
+
+        size_t GetPixelBytes() const { return format == ImageFormat::RGBA16F ? 8 : 4; }
+        size_t GetRowPitch() const { return size_t(width) * GetPixelBytes(); }
+    };
+
+    // What the texel values mean, which decides how they are averaged
+    enum class MipContent
+    {
+        Linear,     // averaged as stored
+        sRGB,       // colour averaged in linear light, then re-encoded; alpha as stored
+        NormalMap,  // RGB is a unit vector, renormalised after averaging; biased to [0, 1] in RGBA8
+    };
+
+    enum class MipFilter
+    {
+        Box,        // average of the texels each covers, 2x2 at even sizes; fast, but aliases and blurs
+        Kaiser,     // windowed sinc, 12 texels across at 2:1; sharper, without the ringing of plain sinc
+    };
+
+    struct MipSettings
+    {
+        MipContent  content = MipContent::Linear;
+        MipFilter   filter = MipFilter::Box;
+    };
+
+    // The image followed by each smaller level down to 1x1, all in the image's format. Levels
+    // are filtered in float from the level above, which is never rounded back to eight bits,
+    // so the error does not build up down the chain. Edges clamp. Rows of each level, and the
+    // final conversion of every level, are spread over parallelFor when one is given.
+    std::vector<Image> BuildMipChain(Image const& top, MipSettings const& settings, ParallelFor const& parallelFor = nullptr);
+
+    // One chain per face, for cube maps and arrays; the faces must be the same size and format.
+    // Faces are filtered together, so a few small faces still fill the threads.
+    std::vector<std::vector<Image>> BuildMipChains(std::vector<Image> const& faces, MipSettings const& settings,
+        ParallelFor const& parallelFor = nullptr);
+}
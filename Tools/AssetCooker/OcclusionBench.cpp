@@ -0,0 +1,450 @@
+//
+// OcclusionBench.cpp - Speed and correctness of the game's software occlusion culling
+//
+
+#include "OcclusionBench.h"
+#include "BenchCamera.h"
+#include "OcclusionBuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <float.h>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+
+using namespace DX;
+
+namespace
+{
+    // The game's buffer and field of view
+    const uint32_t c_Width = 256;
+    const uint32_t c_Height = 128;
+    const float c_FieldOfView = 1.2217305f;     // 70 degrees
+    const float c_NearPlane = 0.5f;
+    const float c_FarPlane = 400.f;
+
+    // The city: blocks on a grid in front of the camera, and boxes scattered among them
+    const unsigned c_BlocksWide = 16;
+    const unsigned c_BlocksDeep = 24;
+    const float c_BlockSpacing = 6.f;
+    const unsigned c_CityBoxes = 4096;
+    const unsigned c_Seed = 1;
+
+    // Drawing and testing are timed over repeated runs until this much time has passed
+    const double c_MinBenchMs = 50.0;
+
+    // Depths closer than this to the reference's are too close to call
+    const float c_DepthTolerance = 1e-5f;
+
+    struct Box
+    {
+        float   minimum[3];
+        float   maximum[3];
+    };
+
+    struct Scene
+    {
+        const char*                 name;
+        std::vector<OccluderMesh>   occluders;
+        OccluderCulling             culling;
+        std::vector<Box>            boxes;
+        std::vector<int>            expected;       // by box, when the results are known: 1 visible, 0 hidden
+        float                       modelToClip[16];
+    };
+
+    struct SceneResult
+    {
+        uint64_t    hidden;
+        uint64_t    missed;         // hidden in the reference but not by the buffer
+        uint64_t    wronglyHidden;  // hidden by the buffer but showing in the reference
+        uint64_t    mismatched;     // between instruction sets, or one thread and many
+    };
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void SetCamera(Scene& scene, const float* eye, const float* target)
+    {
+        const float up[3] = { 0.f, 1.f, 0.f };
+        float view[16], projection[16];
+        LookAt(eye, target, up, view);
+        Perspective(c_FieldOfView, float(c_Width) / float(c_Height), c_NearPlane, c_FarPlane, projection);
+        Multiply(view, projection, scene.modelToClip);
+    }
+
+    // Outward faces wind counter-clockwise seen from outside, so Clockwise culling drops those
+    // turned away, as the game culls meshes that are not counterClockwise
+    void AddCube(OccluderMesh& mesh, const float* minimum, const float* maximum)
+    {
+        const uint32_t base = uint32_t(mesh.positions.size() / 3);
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            mesh.positions.push_back((corner & 1) ? maximum[0] : minimum[0]);
+            mesh.positions.push_back((corner & 2) ? maximum[1] : minimum[1]);
+            mesh.positions.push_back((corner & 4) ? maximum[2] : minimum[2]);
+        }
+
+        static const uint32_t c_Faces[6][4] =
+        {
+            { 0, 4, 6, 2 }, { 1, 3, 7, 5 },     // -x, +x
+            { 0, 1, 5, 4 }, { 2, 6, 7, 3 },     // -y, +y
+            { 0, 2, 3, 1 }, { 4, 5, 7, 6 },     // -z, +z
+        };
+        for (auto const& face : c_Faces)
+        {
+            for (uint32_t index : { face[0], face[1], face[2], face[0], face[2], face[3] })
+            {
+                mesh.indices.push_back(base + index);
+            }
+        }
+        mesh.counterClockwise = false;
+    }
+
+    Box MakeBox(float x, float y, float z, float halfSize)
+    {
+        return { { x - halfSize, y - halfSize, z - halfSize }, { x + halfSize, y + halfSize, z + halfSize } };
+    }
+
+    // A wall across the view, facing the camera, and boxes whose fates are plain
+    Scene MakeWallScene(bool facingAway)
+    {
+        Scene scene = {};
+        scene.name = facingAway ? "wall culled" : "wall";
+
+        OccluderMesh wall;
+        wall.positions = { -5.f, -5.f, -10.f, 5.f, -5.f, -10.f, 5.f, 5.f, -10.f, -5.f, 5.f, -10.f };
+        wall.indices = { 0, 1, 2, 0, 2, 3 };
+        wall.counterClockwise = false;
+        scene.occluders.push_back(wall);
+        scene.culling = facingAway ? OccluderCulling::CounterClockwise : OccluderCulling::Clockwise;
+
+        const int behind = facingAway ? 1 : 0;
+        const struct { Box box; int visible; } c_Boxes[] =
+        {
+            { MakeBox(0.f, 0.f, -20.f, 0.5f), behind },     // behind the middle
+            { MakeBox(8.f, 0.f, -20.f, 0.5f), behind },     // behind, near the edge
+            { MakeBox(0.f, 6.f, -20.f, 0.5f), behind },
+            { MakeBox(11.f, 0.f, -20.f, 0.5f), 1 },         // behind, but past the edge
+            { MakeBox(0.f, 0.f, -20.f, 8.f), 1 },           // behind, but larger
+            { MakeBox(0.f, 0.f, -5.f, 0.5f), 1 },           // in front
+            { MakeBox(0.f, 0.f, -10.f, 1.f), 1 },           // through it
+            { MakeBox(100.f, 0.f, -10.f, 0.5f), 0 },        // off screen
+            { MakeBox(0.f, 0.f, 5.f, 0.5f), 1 },            // behind the camera: not tested
+            { MakeBox(0.f, 0.f, 0.f, 1.f), 1 },             // round the camera
+        };
+        for (auto const& entry : c_Boxes)
+        {
+            scene.boxes.push_back(entry.box);
+            scene.expected.push_back(entry.visible);
+        }
+
+        const float eye[3] = { 0.f, 0.f, 0.f };
+        const float target[3] = { 0.f, 0.f, -1.f };
+        SetCamera(scene, eye, target);
+        return scene;
+    }
+
+    // Blocks of random heights on a grid, seen from the street, with boxes among them
+    Scene MakeCityScene(bool cullBackFaces)
+    {
+        Scene scene = {};
+        scene.name = cullBackFaces ? "city culled" : "city";
+        scene.culling = cullBackFaces ? OccluderCulling::Clockwise : OccluderCulling::None;
+
+        std::mt19937 random(c_Seed);
+        std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+        const float halfWidth = float(c_BlocksWide) * c_BlockSpacing * 0.5f;
+        for (unsigned z = 0; z < c_BlocksDeep; ++z)
+        {
+            for (unsigned x = 0; x < c_BlocksWide; ++x)
+            {
+                const float size = c_BlockSpacing * (0.3f + 0.4f * unit(random));
+                const float height = 2.f + 14.f * unit(random);
+                const float left = float(x) * c_BlockSpacing - halfWidth + (c_BlockSpacing - size) * unit(random);
+                const float front = -float(z) * c_BlockSpacing - (c_BlockSpacing - size) * unit(random);
+                const float minimum[3] = { left, 0.f, front - size };
+                const float maximum[3] = { left + size, height, front };
+
+                OccluderMesh block;
+                AddCube(block, minimum, maximum);
+                scene.occluders.push_back(std::move(block));
+            }
+        }
+
+        const float depth = float(c_BlocksDeep) * c_BlockSpacing;
+        for (unsigned i = 0; i < c_CityBoxes; ++i)
+        {
+            const float halfSize = 0.25f + 1.5f * unit(random);
+            scene.boxes.push_back(MakeBox(-halfWidth + 2.f * halfWidth * unit(random), 8.f * unit(random),
+                -depth * unit(random), halfSize));
+        }
+
+        const float eye[3] = { 0.f, 3.f, 16.f };
+        const float target[3] = { 0.f, 2.f, -depth };
+        SetCamera(scene, eye, target);
+        return scene;
+    }
+
+    void Transform(const float* p, const float* m, float* clip)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            clip[c] = p[0] * m[c] + p[1] * m[4 + c] + p[2] * m[8 + c] + m[12 + c];
+        }
+    }
+
+    // The nearest depth at every pixel centre, drawn a triangle and a pixel at a time. Edges
+    // are taken generously, so the reference never shows what the buffer rightly hides only
+    // because the two rounded one way and the other. The scenes keep every occluder in front
+    // of the camera, so nothing needs clipping.
+    std::vector<float> DrawReference(Scene const& scene)
+    {
+        std::vector<float> depths(size_t(c_Width) * c_Height, 1.f);
+        for (auto const& mesh : scene.occluders)
+        {
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+            {
+                double x[3], y[3], z[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    float clip[4];
+                    Transform(&mesh.positions[size_t(mesh.indices[i + k]) * 3], scene.modelToClip, clip);
+                    x[k] = (double(clip[0]) / clip[3] + 1.0) * 0.5 * c_Width;
+                    y[k] = (1.0 - double(clip[1]) / clip[3]) * 0.5 * c_Height;
+                    z[k] = double(clip[2]) / clip[3];
+                }
+
+                const double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+                if (area == 0.0
+                    || (scene.culling == OccluderCulling::Clockwise && area > 0.0)
+                    || (scene.culling == OccluderCulling::CounterClockwise && area < 0.0))
+                    continue;
+
+                const int x0 = std::max(int(floor(std::min({ x[0], x[1], x[2] }))) - 1, 0);
+                const int y0 = std::max(int(floor(std::min({ y[0], y[1], y[2] }))) - 1, 0);
+                const int x1 = std::min(int(ceil(std::max({ x[0], x[1], x[2] }))) + 1, int(c_Width) - 1);
+                const int y1 = std::min(int(ceil(std::max({ y[0], y[1], y[2] }))) + 1, int(c_Height) - 1);
+                for (int py = y0; py <= y1; ++py)
+                {
+                    for (int px = x0; px <= x1; ++px)
+                    {
+                        const double cx = px + 0.5, cy = py + 0.5;
+                        double weights[3];
+                        bool inside = true;
+                        for (int e = 0; e < 3; ++e)
+                        {
+                            const int a = (e + 1) % 3, b = (e + 2) % 3;
+                            weights[e] = ((x[b] - x[a]) * (cy - y[a]) - (cx - x[a]) * (y[b] - y[a])) / area;
+                            inside = inside && weights[e] > -1e-4;
+                        }
+                        if (!inside)
+                            continue;
+
+                        const double d = weights[0] * z[0] + weights[1] * z[1] + weights[2] * z[2];
+                        float& depth = depths[size_t(py) * c_Width + px];
+                        depth = std::min(depth, float(d));
+                    }
+                }
+            }
+        }
+        return depths;
+    }
+
+    // 1 when some pixel centre of the box's rectangle is nearer than the reference, 0 when none
+    // is, and -1 for a box that reaches the near plane, which the buffer does not test
+    int TestReference(Box const& box, Scene const& scene, std::vector<float> const& depths, float tolerance)
+    {
+        float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, nearest = FLT_MAX;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            const float p[3] = { (corner & 1) ? box.maximum[0] : box.minimum[0], (corner & 2) ? box.maximum[1] : box.minimum[1],
+                (corner & 4) ? box.maximum[2] : box.minimum[2] };
+            float clip[4];
+            Transform(p, scene.modelToClip, clip);
+            if (!(clip[2] > 0.f) || !(clip[3] > 0.f))
+                return -1;
+
+            minX = std::min(minX, (clip[0] / clip[3] + 1.f) * 0.5f * c_Width);
+            maxX = std::max(maxX, (clip[0] / clip[3] + 1.f) * 0.5f * c_Width);
+            minY = std::min(minY, (1.f - clip[1] / clip[3]) * 0.5f * c_Height);
+            maxY = std::max(maxY, (1.f - clip[1] / clip[3]) * 0.5f * c_Height);
+            nearest = std::min(nearest, clip[2] / clip[3]);
+        }
+
+        const int x0 = std::max(int(ceilf(minX - 0.5f)), 0);
+        const int y0 = std::max(int(ceilf(minY - 0.5f)), 0);
+        const int x1 = std::min(int(floorf(maxX - 0.5f)), int(c_Width) - 1);
+        const int y1 = std::min(int(floorf(maxY - 0.5f)), int(c_Height) - 1);
+        for (int py = y0; py <= y1; ++py)
+        {
+            for (int px = x0; px <= x1; ++px)
+            {
+                if (nearest + tolerance <= depths[size_t(py) * c_Width + px])
+                    return 1;
+            }
+        }
+        return 0;
+    }
+
+    void Draw(OcclusionBuffer& buffer, Scene const& scene, OcclusionBuffer::ParallelFor const& parallelFor)
+    {
+        buffer.Clear();
+        for (auto const& mesh : scene.occluders)
+        {
+            buffer.AddOccluder(mesh.positions.data(), uint32_t(mesh.positions.size() / 3), mesh.indices.data(),
+                mesh.indices.size(), scene.modelToClip, scene.culling);
+        }
+        buffer.Render(parallelFor);
+    }
+
+    void Test(OcclusionBuffer const& buffer, Scene const& scene, std::vector<uint8_t>& visible,
+        OcclusionBuffer::ParallelFor const& parallelFor)
+    {
+        visible.resize(scene.boxes.size());
+        auto body = [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                visible[i] = buffer.IsVisible(scene.boxes[i].minimum, scene.boxes[i].maximum, scene.modelToClip) ? 1 : 0;
+            }
+        };
+
+        if (parallelFor)
+            parallelFor(scene.boxes.size(), 256, body);
+        else
+            body(0, scene.boxes.size());
+    }
+
+    SceneResult CheckScene(Scene const& scene, OcclusionBuffer& buffer, ParallelFor const& parallelFor)
+    {
+        SceneResult result = {};
+        const auto depths = DrawReference(scene);
+
+        const auto widest = GetOcclusionSimdLevel();
+        std::vector<uint8_t> first, visible;
+        for (int level = 0; level <= int(widest); ++level)
+        {
+            SetOcclusionSimdLevel(OcclusionSimdLevel(level));
+            for (int threaded = 0; threaded < 2; ++threaded)
+            {
+                Draw(buffer, scene, threaded ? parallelFor : nullptr);
+                Test(buffer, scene, visible, threaded ? parallelFor : nullptr);
+                if (level == 0 && !threaded)
+                {
+                    first = visible;
+                    continue;
+                }
+
+                for (size_t i = 0; i < visible.size(); ++i)
+                {
+                    result.mismatched += (visible[i] != first[i]) ? 1 : 0;
+                }
+            }
+        }
+        SetOcclusionSimdLevel(widest);
+
+        for (size_t i = 0; i < scene.boxes.size(); ++i)
+        {
+            if (first[i])
+            {
+                result.missed += (TestReference(scene.boxes[i], scene, depths, 0.f) == 0) ? 1 : 0;
+                continue;
+            }
+
+            ++result.hidden;
+            if (!scene.expected.empty())
+            {
+                result.wronglyHidden += scene.expected[i] ? 1 : 0;
+            }
+            else
+            {
+                result.wronglyHidden += (TestReference(scene.boxes[i], scene, depths, c_DepthTolerance) != 0) ? 1 : 0;
+            }
+        }
+
+        // Known results are exact both ways
+        for (size_t i = 0; i < scene.expected.size(); ++i)
+        {
+            result.wronglyHidden += (first[i] && !scene.expected[i]) ? 1 : 0;
+        }
+        return result;
+    }
+
+    template<typename Function>
+    double TimePerRun(Function const& function)
+    {
+        unsigned runs = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed;
+        do
+        {
+            function();
+            ++runs;
+            elapsed = MillisecondsSince(start);
+        } while (elapsed < c_MinBenchMs);
+        return elapsed / runs;
+    }
+}
+
+int DX::BenchmarkOcclusion(unsigned threads, ParallelFor const& parallelFor)
+{
+    Scene scenes[] = { MakeWallScene(false), MakeWallScene(true), MakeCityScene(false), MakeCityScene(true) };
+    OcclusionBuffer buffer(c_Width, c_Height);
+
+    SceneResult total = {};
+    printf("%-12s %9s %8s %8s %8s %8s %10s\n", "scene", "triangles", "boxes", "hidden", "missed", "wrong", "mismatched");
+    for (auto const& scene : scenes)
+    {
+        size_t triangles = 0;
+        for (auto const& mesh : scene.occluders)
+        {
+            triangles += mesh.indices.size() / 3;
+        }
+
+        const auto result = CheckScene(scene, buffer, parallelFor);
+        printf("%-12s %9zu %8zu %8llu %8llu %8llu %10llu\n", scene.name, triangles, scene.boxes.size(),
+            (unsigned long long)result.hidden, (unsigned long long)result.missed, (unsigned long long)result.wronglyHidden,
+            (unsigned long long)result.mismatched);
+
+        total.hidden += result.hidden;
+        total.missed += result.missed;
+        total.wronglyHidden += result.wronglyHidden;
+        total.mismatched += result.mismatched;
+    }
+
+    // Triangles are those left to draw after culling and clipping
+    const auto widest = GetOcclusionSimdLevel();
+    std::vector<uint8_t> visible;
+    printf("\n%-12s %-6s %12s %12s %12s %12s\n", "scene", "simd", "tris/ms x1", "tris/ms xN", "boxes/ms x1", "boxes/ms xN");
+    for (auto const& scene : scenes)
+    {
+        for (int level = 0; level <= int(widest); ++level)
+        {
+            SetOcclusionSimdLevel(OcclusionSimdLevel(level));
+
+            double rates[4];
+            for (int threaded = 0; threaded < 2; ++threaded)
+            {
+                const auto& run = threaded ? parallelFor : ParallelFor();
+                buffer.ResetStatistics();
+                Draw(buffer, scene, run);
+                const double drawn = double(buffer.GetStatistics().trianglesDrawn);
+
+                rates[threaded] = drawn / TimePerRun([&]() { Draw(buffer, scene, run); });
+                rates[2 + threaded] = double(scene.boxes.size()) / TimePerRun([&]() { Test(buffer, scene, visible, run); });
+            }
+            printf("%-12s %-6s %12.0f %12.0f %12.0f %12.0f\n", scene.name, GetOcclusionSimdLevelName(OcclusionSimdLevel(level)),
+                rates[0], rates[1], rates[2], rates[3]);
+        }
+    }
+    SetOcclusionSimdLevel(widest);
+
+    printf("%u threads, %ux%u buffer: %llu boxes hidden, %llu missed, %llu wrongly hidden, %llu results differing between "
+        "instruction sets or thread counts\n", threads, buffer.GetWidth(), buffer.GetHeight(), (unsigned long long)total.hidden,
+        (unsigned long long)total.missed, (unsigned long long)total.wronglyHidden, (unsigned long long)total.mismatched);
+    return (total.wronglyHidden || total.mismatched) ? 1 : 0;
+}
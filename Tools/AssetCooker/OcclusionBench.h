@@ -0,0 +1,18 @@
+//
+// OcclusionBench.h - Speed and correctness of the game's software occlusion culling
+//
+
+#pragma once
+
+#include "../Common/ParallelFor.h"
+
+namespace DX
+{
+    // Draws synthetic scenes into an OcclusionBuffer as the game does each frame: a wall with
+    // boxes round it whose results are known, and a city of random blocks with boxes among
+    // them, checked against a depth buffer drawn pixel by pixel. Any box hidden that shows in
+    // that buffer, any result that differs between instruction sets or between one thread
+    // and many, fails the run. Then reports the triangles drawn and boxes tested each
+    // millisecond, for each instruction set the CPU has, on one thread and on 'threads'.
+    int BenchmarkOcclusion(unsigned threads, ParallelFor const& parallelFor);
+}
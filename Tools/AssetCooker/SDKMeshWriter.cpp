@@ -0,0 +1,346 @@
+//
+// SDKMeshWriter.cpp - Writes a single-mesh SDKMESH file
+//
+
+#include "SDKMeshWriter.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+using namespace DX;
+using namespace SDKMESH;
+
+namespace
+{
+    const uint64_t c_BufferAlignment = 16;
+
+    uint64_t AlignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    void CopyName(char* destination, size_t capacity, std::string const& name)
+    {
+        if (name.size() >= capacity)
+            throw std::runtime_error("SDKMESH name too long: " + name);
+        memcpy(destination, name.data(), name.size());
+    }
+
+    template<typename T>
+    void Put(std::vector<uint8_t>& file, uint64_t offset, T const& value)
+    {
+        memcpy(file.data() + offset, &value, sizeof(T));
+    }
+
+    // Moves every buffer, vertex and index, up in file order behind the one before, each
+    // aligned as WriteSDKMESH aligns them, after their sizes shrank in place
+    void CompactBuffers(std::vector<uint8_t>& file)
+    {
+        Header header;
+        memcpy(&header, file.data(), sizeof(header));
+
+        auto vertexHeaderOffset = [&](uint32_t i) { return header.vertexStreamHeadersOffset + i * sizeof(VertexBufferHeader); };
+        auto indexHeaderOffset = [&](uint32_t i) { return header.indexStreamHeadersOffset + i * sizeof(IndexBufferHeader); };
+
+        struct Buffer
+        {
+            uint64_t    headerOffset;
+            uint64_t    dataOffset;
+            uint64_t    sizeBytes;
+            bool        index;
+        };
+
+        std::vector<Buffer> buffers;
+        for (uint32_t i = 0; i < header.numVertexBuffers; ++i)
+        {
+            VertexBufferHeader vb;
+            memcpy(&vb, file.data() + vertexHeaderOffset(i), sizeof(vb));
+            buffers.push_back({ vertexHeaderOffset(i), vb.dataOffset, vb.sizeBytes, false });
+        }
+        for (uint32_t i = 0; i < header.numIndexBuffers; ++i)
+        {
+            IndexBufferHeader ib;
+            memcpy(&ib, file.data() + indexHeaderOffset(i), sizeof(ib));
+            buffers.push_back({ indexHeaderOffset(i), ib.dataOffset, ib.sizeBytes, true });
+        }
+        std::stable_sort(buffers.begin(), buffers.end(), [](Buffer const& a, Buffer const& b) { return a.dataOffset < b.dataOffset; });
+
+        const uint64_t bufferDataOffset = header.headerSize + header.nonBufferDataSize;
+        std::vector<uint8_t> packed(file.begin(), file.begin() + size_t(bufferDataOffset));
+        uint64_t lastOffset = UINT64_MAX, lastMoved = 0;
+        for (auto const& buffer : buffers)
+        {
+            // Headers sharing one buffer keep sharing it
+            if (buffer.dataOffset != lastOffset)
+            {
+                lastOffset = buffer.dataOffset;
+                lastMoved = AlignUp(packed.size(), c_BufferAlignment);
+                packed.resize(size_t(lastMoved));
+                packed.insert(packed.end(), file.begin() + size_t(buffer.dataOffset),
+                    file.begin() + size_t(buffer.dataOffset + buffer.sizeBytes));
+            }
+
+            if (buffer.index)
+            {
+                IndexBufferHeader ib;
+                memcpy(&ib, packed.data() + buffer.headerOffset, sizeof(ib));
+                ib.dataOffset = lastMoved;
+                Put(packed, buffer.headerOffset, ib);
+            }
+            else
+            {
+                VertexBufferHeader vb;
+                memcpy(&vb, packed.data() + buffer.headerOffset, sizeof(vb));
+                vb.dataOffset = lastMoved;
+                Put(packed, buffer.headerOffset, vb);
+            }
+        }
+
+        header.bufferDataSize = packed.size() - bufferDataOffset;
+        Put(packed, 0, header);
+
+        file.swap(packed);
+    }
+}
+
+std::vector<uint8_t> DX::WriteSDKMESH(SDKMeshDesc const& desc)
+{
+    if (desc.declaration.empty() || desc.declaration.size() >= c_MaxVertexElements)
+        throw std::runtime_error("SDKMESH vertex declaration must have 1 to 31 elements");
+    if (!desc.vertexStride || desc.vertices.size() != uint64_t(desc.vertexStride) * desc.vertexCount)
+        throw std::runtime_error("SDKMESH vertex data does not match its stride and count");
+    if (desc.indices.empty() || desc.subsets.empty() || desc.materials.empty())
+        throw std::runtime_error("SDKMESH needs indices, subsets and materials");
+
+    const bool index32 = std::any_of(desc.indices.begin(), desc.indices.end(), [](uint32_t i) { return i >= 0xFFFF; });
+    const uint64_t indexBytes = desc.indices.size() * (index32 ? 4 : 2);
+
+    // Headers, then the non-buffer data (mesh, subsets, frame, materials, the mesh's subset
+    // list), then the vertex and index data
+    Header header = {};
+    header.version = c_FileVersion;
+    header.numVertexBuffers = 1;
+    header.numIndexBuffers = 1;
+    header.numMeshes = 1;
+    header.numTotalSubsets = uint32_t(desc.subsets.size());
+    header.numFrames = 1;
+    header.numMaterials = uint32_t(desc.materials.size());
+    header.headerSize = sizeof(Header) + sizeof(VertexBufferHeader) + sizeof(IndexBufferHeader);
+    header.vertexStreamHeadersOffset = sizeof(Header);
+    header.indexStreamHeadersOffset = header.vertexStreamHeadersOffset + sizeof(VertexBufferHeader);
+    header.meshDataOffset = header.headerSize;
+    header.subsetDataOffset = header.meshDataOffset + sizeof(MeshHeader);
+    header.frameDataOffset = header.subsetDataOffset + desc.subsets.size() * sizeof(SubsetHeader);
+    header.materialDataOffset = header.frameDataOffset + sizeof(FrameHeader);
+
+    const uint64_t subsetListOffset = header.materialDataOffset + desc.materials.size() * sizeof(MaterialHeader);
+    const uint64_t bufferDataOffset = AlignUp(subsetListOffset + desc.subsets.size() * sizeof(uint32_t), c_BufferAlignment);
+    const uint64_t indexDataOffset = AlignUp(bufferDataOffset + desc.vertices.size(), c_BufferAlignment);
+
+    header.nonBufferDataSize = bufferDataOffset - header.headerSize;
+    header.bufferDataSize = indexDataOffset + indexBytes - bufferDataOffset;
+
+    std::vector<uint8_t> file(size_t(indexDataOffset + indexBytes));
+    Put(file, 0, header);
+
+    VertexBufferHeader vb = {};
+    vb.numVertices = desc.vertexCount;
+    vb.sizeBytes = desc.vertices.size();
+    vb.strideBytes = desc.vertexStride;
+    std::copy(desc.declaration.begin(), desc.declaration.end(), vb.decl);
+    vb.decl[desc.declaration.size()] = { 0xFF, 0, DeclType_Unused, 0, 0, 0 };
+    vb.dataOffset = bufferDataOffset;
+    Put(file, header.vertexStreamHeadersOffset, vb);
+
+    IndexBufferHeader ib = {};
+    ib.numIndices = desc.indices.size();
+    ib.sizeBytes = indexBytes;
+    ib.indexType = index32 ? c_Index32 : 0;
+    ib.dataOffset = indexDataOffset;
+    Put(file, header.indexStreamHeadersOffset, ib);
+
+    MeshHeader mesh = {};
+    CopyName(mesh.name, c_MaxName, desc.name);
+    mesh.numVertexBuffers = 1;
+    mesh.numSubsets = uint32_t(desc.subsets.size());
+    std::copy(desc.boxCenter, desc.boxCenter + 3, mesh.boundingBoxCenter);
+    std::copy(desc.boxExtents, desc.boxExtents + 3, mesh.boundingBoxExtents);
+    mesh.subsetOffset = subsetListOffset;
+    Put(file, header.meshDataOffset, mesh);
+
+    for (size_t i = 0; i < desc.subsets.size(); ++i)
+    {
+        auto const& source = desc.subsets[i];
+        if (source.material >= desc.materials.size()
+            || source.indexStart > desc.indices.size()
+            || source.indexCount > desc.indices.size() - source.indexStart)
+            throw std::runtime_error("SDKMESH subset out of range");
+
+        SubsetHeader subset = {};
+        subset.materialID = source.material;
+        subset.primitiveType = PT_TriangleList;
+        subset.indexStart = source.indexStart;
+        subset.indexCount = source.indexCount;
+        subset.vertexCount = desc.vertexCount;
+        Put(file, header.subsetDataOffset + i * sizeof(SubsetHeader), subset);
+        Put(file, subsetListOffset + i * sizeof(uint32_t), uint32_t(i));
+    }
+
+    FrameHeader frame = {};
+    CopyName(frame.name, c_MaxName, "root");
+    frame.parentFrame = frame.childFrame = frame.siblingFrame = frame.animationDataIndex = UINT32_MAX;
+    frame.matrix[0] = frame.matrix[5] = frame.matrix[10] = frame.matrix[15] = 1.f;
+    Put(file, header.frameDataOffset, frame);
+
+    for (size_t i = 0; i < desc.materials.size(); ++i)
+    {
+        auto const& source = desc.materials[i];
+
+        MaterialHeader material = {};
+        CopyName(material.name, c_MaxName, source.name);
+        CopyName(material.diffuseTexture, c_MaxPath, source.diffuseTexture);
+        CopyName(material.normalTexture, c_MaxPath, source.normalTexture);
+        CopyName(material.specularTexture, c_MaxPath, source.specularTexture);
+        std::copy(source.diffuse, source.diffuse + 4, material.diffuse);
+        std::copy(source.ambient, source.ambient + 4, material.ambient);
+        std::copy(source.specular, source.specular + 4, material.specular);
+        std::copy(source.emissive, source.emissive + 4, material.emissive);
+        material.power = source.power;
+        Put(file, header.materialDataOffset + i * sizeof(MaterialHeader), material);
+    }
+
+    memcpy(file.data() + bufferDataOffset, desc.vertices.data(), desc.vertices.size());
+
+    uint8_t* indices = file.data() + indexDataOffset;
+    for (size_t i = 0; i < desc.indices.size(); ++i)
+    {
+        if (desc.indices[i] >= desc.vertexCount)
+            throw std::runtime_error("SDKMESH index out of range");
+
+        if (index32)
+        {
+            memcpy(indices + i * 4, &desc.indices[i], 4);
+        }
+        else
+        {
+            uint16_t index = uint16_t(desc.indices[i]);
+            memcpy(indices + i * 2, &index, 2);
+        }
+    }
+
+    return file;
+}
+
+uint32_t DX::NarrowSDKMeshIndices(std::vector<uint8_t>& file)
+{
+    Header header;
+    memcpy(&header, file.data(), sizeof(header));
+
+    auto indexHeaderOffset = [&](uint32_t i) { return header.indexStreamHeadersOffset + i * sizeof(IndexBufferHeader); };
+
+    uint32_t narrowed = 0;
+    for (uint32_t i = 0; i < header.numIndexBuffers; ++i)
+    {
+        IndexBufferHeader ib;
+        memcpy(&ib, file.data() + indexHeaderOffset(i), sizeof(ib));
+        if (ib.indexType != c_Index32 || ib.sizeBytes < ib.numIndices * 4)
+            continue;
+
+        const uint8_t* data = file.data() + ib.dataOffset;
+        bool fits = true;
+        for (uint64_t j = 0; j < ib.numIndices && fits; ++j)
+        {
+            uint32_t index;
+            memcpy(&index, data + j * 4, 4);
+            fits = index < 0xFFFF;
+        }
+        if (!fits)
+            continue;
+
+        // In place, front to back, as each 16-bit index lands at or before its 32-bit one
+        for (uint64_t j = 0; j < ib.numIndices; ++j)
+        {
+            uint32_t index;
+            memcpy(&index, file.data() + ib.dataOffset + j * 4, 4);
+            uint16_t narrow = uint16_t(index);
+            memcpy(file.data() + ib.dataOffset + j * 2, &narrow, 2);
+        }
+
+        ib.indexType = 0;
+        ib.sizeBytes = ib.numIndices * 2;
+        Put(file, indexHeaderOffset(i), ib);
+        ++narrowed;
+    }
+    if (!narrowed)
+        return 0;
+
+    CompactBuffers(file);
+    return narrowed;
+}
+
+VertexPacking DX::PackSDKMeshVertices(std::vector<uint8_t>& file)
+{
+    Header header;
+    memcpy(&header, file.data(), sizeof(header));
+
+    auto vertexHeaderOffset = [&](uint32_t i) { return header.vertexStreamHeadersOffset + i * sizeof(VertexBufferHeader); };
+
+    // Vertex buffers sharing their bytes could be packed against different boxes
+    std::vector<uint64_t> offsets;
+    for (uint32_t i = 0; i < header.numVertexBuffers; ++i)
+    {
+        VertexBufferHeader vb;
+        memcpy(&vb, file.data() + vertexHeaderOffset(i), sizeof(vb));
+        offsets.push_back(vb.dataOffset);
+    }
+    std::sort(offsets.begin(), offsets.end());
+    if (std::adjacent_find(offsets.begin(), offsets.end()) != offsets.end())
+        return {};
+
+    auto model = ModelData::ParseSDKMESH(file.data(), file.size());
+    const VertexPacking packing = PackModelVertices(*model);
+    if (!packing.streamsPacked)
+        return packing;
+
+    for (uint32_t i = 0; i < header.numVertexBuffers; ++i)
+    {
+        auto const& stream = model->vertexStreams[i];
+        if (stream.owned.empty())
+            continue;
+
+        // The declaration decoded one element per entry, in order, up to its stride
+        VertexBufferHeader vb;
+        memcpy(&vb, file.data() + vertexHeaderOffset(i), sizeof(vb));
+        for (size_t e = 0; e < stream.elements.size(); ++e)
+        {
+            auto& decl = vb.decl[e];
+            decl.offset = uint16_t(stream.elements[e].offset);
+            switch (stream.elements[e].format)
+            {
+            case ModelData::Format_R16G16B16A16_SNorm:  decl.type = DeclType_Short4N; break;
+            case ModelData::Format_R8G8B8A8_SNorm:      decl.type = DeclType_R8G8B8A8_SNorm; break;
+            case ModelData::Format_R16G16_Float:        decl.type = DeclType_Float16_2; break;
+            default:                                    break;
+            }
+        }
+        vb.strideBytes = stream.stride;
+        vb.sizeBytes = stream.owned.size();
+        memcpy(file.data() + vb.dataOffset, stream.owned.data(), stream.owned.size());
+        Put(file, vertexHeaderOffset(i), vb);
+    }
+
+    // The bounds now describe the packed positions' box, which the loader maps them back with
+    for (uint32_t i = 0; i < header.numMeshes; ++i)
+    {
+        const uint64_t offset = header.meshDataOffset + i * sizeof(MeshHeader);
+        MeshHeader mh;
+        memcpy(&mh, file.data() + offset, sizeof(mh));
+        memcpy(mh.boundingBoxCenter, model->meshes[i].boxCenter, sizeof(mh.boundingBoxCenter));
+        memcpy(mh.boundingBoxExtents, model->meshes[i].boxExtents, sizeof(mh.boundingBoxExtents));
+        Put(file, offset, mh);
+    }
+
+    CompactBuffers(file);
+    return packing;
+}
@@ -0,0 +1,67 @@
+//
+// SDKMeshWriter.h - Writes a single-mesh SDKMESH file
+//
+
+#pragma once
+
+#include "SDKMeshFormat.h"
+#include "VertexPacking.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DX
+{
+    // Everything a static, single-frame model needs. The layout matches what meshconvert
+    // writes: one vertex buffer, one index buffer, one mesh of triangle-list subsets under a
+    // root frame, and materials in the version 1 (Phong) form.
+    struct SDKMeshDesc
+    {
+        struct Material
+        {
+            std::string     name;
+            float           diffuse[4];
+            float           ambient[4];
+            float           specular[4];
+            float           emissive[4];
+            float           power;
+            std::string     diffuseTexture;     // file names, empty for none
+            std::string     normalTexture;
+            std::string     specularTexture;
+        };
+
+        struct Subset
+        {
+            uint32_t        material;
+            uint32_t        indexStart;
+            uint32_t        indexCount;
+        };
+
+        std::string                         name;
+        std::vector<SDKMESH::DeclElement>   declaration;    // without the end marker
+        uint32_t                            vertexStride;
+        uint32_t                            vertexCount;
+        std::vector<uint8_t>                vertices;
+        std::vector<uint32_t>               indices;        // written as 16-bit when they all fit
+        std::vector<Subset>                 subsets;
+        std::vector<Material>               materials;
+        float                               boxCenter[3];
+        float                               boxExtents[3];
+    };
+
+    // Throws std::runtime_error for a description the format cannot hold.
+    std::vector<uint8_t> WriteSDKMESH(SDKMeshDesc const& desc);
+
+    // Rewrites the 32-bit index buffers of any SDKMESH file whose indices all fit in 16 bits
+    // (below 0xFFFF, the strip cut), packing the buffer data up behind them; the rest of the
+    // file is unchanged. Returns how many were narrowed. The file must already have parsed.
+    uint32_t NarrowSDKMeshIndices(std::vector<uint8_t>& file);
+
+    // Packs the vertex buffers of an SDKMESH file (PackModelVertices) in place, rewriting their
+    // declarations and strides and each mesh's bounding box, which is the box the positions are
+    // packed against, and packing the buffer data up behind them. Anything after the buffers is
+    // dropped. Vertex buffers that share their bytes leave the file as it was. The file must
+    // already have parsed.
+    VertexPacking PackSDKMeshVertices(std::vector<uint8_t>& file);
+}
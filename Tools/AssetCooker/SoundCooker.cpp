@@ -0,0 +1,89 @@
+//
+// SoundCooker.cpp - Strips wave files down to the chunks the audio engine reads
+//
+
+#include "Cooker.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const char* const c_SoundExtensions[] = { ".wav", nullptr };
+
+    // fmt and data, plus the loop points and xWMA / XMA seek tables that WAVFileReader uses.
+    // Authoring tools add LIST, bext, junk and the like, which are only ever skipped over.
+    const char c_KeptChunks[][5] = { "fmt ", "data", "smpl", "wsmp", "dpds", "seek" };
+
+    uint32_t ReadU32(const uint8_t* data)
+    {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    class SoundCooker : public Cooker
+    {
+    public:
+        const char* GetName() const override { return "sound"; }
+        uint32_t GetVersion() const override { return 1; }
+
+        bool Accepts(fs::path const& source) const override
+        {
+            return HasExtension(source, c_SoundExtensions);
+        }
+
+        std::vector<uint8_t> Cook(fs::path const&, std::vector<uint8_t> const& data, std::vector<fs::path>&) const override
+        {
+            if (data.size() < 12 || memcmp(data.data(), "RIFF", 4) || memcmp(data.data() + 8, "WAVE", 4))
+                throw std::runtime_error("not a RIFF WAVE file");
+
+            const size_t end = std::min<size_t>(data.size(), size_t(ReadU32(data.data() + 4)) + 8);
+
+            std::vector<uint8_t> out(data.begin(), data.begin() + 12);
+            bool hasFormat = false, hasData = false;
+
+            for (size_t offset = 12; offset + 8 <= end;)
+            {
+                const uint8_t* chunk = data.data() + offset;
+                const uint32_t size = ReadU32(chunk + 4);
+                if (size > end - offset - 8)
+                    throw std::runtime_error("wave chunk runs past the end of the file");
+
+                for (auto kept : c_KeptChunks)
+                {
+                    if (memcmp(chunk, kept, 4))
+                        continue;
+
+                    hasFormat |= !memcmp(chunk, "fmt ", 4);
+                    hasData |= !memcmp(chunk, "data", 4);
+
+                    out.insert(out.end(), chunk, chunk + 8 + size);
+                    if (size & 1)
+                        out.push_back(0);
+                    break;
+                }
+
+                // Chunks are word aligned, though some writers leave the pad byte out at the end
+                offset += 8 + size_t(size) + (size & 1);
+            }
+
+            if (!hasFormat || !hasData)
+                throw std::runtime_error("wave file has no fmt or data chunk");
+
+            const uint32_t riffSize = uint32_t(out.size() - 8);
+            memcpy(out.data() + 4, &riffSize, sizeof(riffSize));
+            return out;
+        }
+    };
+}
+
+std::unique_ptr<Cooker> DX::CreateSoundCooker()
+{
+    return std::make_unique<SoundCooker>();
+}
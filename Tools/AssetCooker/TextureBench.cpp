@@ -0,0 +1,279 @@
+//
+// TextureBench.cpp - Speed and quality of the block compressor and image decoders on real textures
+//
+
+#include "TextureCooker.h"
+#include "ImageDecoder.h"
+#include "../Common/FileIO.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const BlockFormat c_Formats[] = { BlockFormat::BC1, BlockFormat::BC3, BlockFormat::BC4, BlockFormat::BC5, BlockFormat::BC7 };
+    const char* const c_FormatNames[] = { "BC1", "BC3", "BC4", "BC5", "BC7" };
+
+    // Channels each format keeps; the rest are not compared
+    unsigned GetChannelCount(BlockFormat format)
+    {
+        switch (format)
+        {
+        case BlockFormat::BC1:  return 3;
+        case BlockFormat::BC4:  return 1;
+        case BlockFormat::BC5:  return 2;
+        default:                return 4;
+        }
+    }
+
+    template<typename Function>
+    double Time(Function const& function)
+    {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double Compress(BlockFormat format, Image const& image, std::vector<uint8_t>& blocks, ParallelFor const& parallelFor)
+    {
+        return Time([&]()
+        {
+            CompressImage(format, image.pixels.data(), image.width, image.height, image.GetRowPitch(), blocks.data(), parallelFor);
+        });
+    }
+
+    double MeasurePSNR(BlockFormat format, Image const& image, std::vector<uint8_t> const& blocks)
+    {
+        const uint32_t blocksWide = (image.width + 3) / 4;
+        const uint32_t blocksHigh = (image.height + 3) / 4;
+        const unsigned channels = GetChannelCount(format);
+
+        double error = 0;
+        uint64_t samples = 0;
+        uint8_t texels[64];
+        for (uint32_t by = 0; by < blocksHigh; ++by)
+        {
+            for (uint32_t bx = 0; bx < blocksWide; ++bx)
+            {
+                DecompressBlock(format, blocks.data() + (size_t(by) * blocksWide + bx) * GetBlockBytes(format), texels);
+                for (uint32_t y = by * 4; y < std::min(by * 4 + 4, image.height); ++y)
+                {
+                    for (uint32_t x = bx * 4; x < std::min(bx * 4 + 4, image.width); ++x)
+                    {
+                        const uint8_t* source = image.pixels.data() + y * image.GetRowPitch() + x * 4;
+                        const uint8_t* decoded = texels + ((y - by * 4) * 4 + (x - bx * 4)) * 4;
+                        for (unsigned c = 0; c < channels; ++c)
+                        {
+                            const double d = double(source[c]) - double(decoded[c]);
+                            error += d * d;
+                        }
+                        samples += channels;
+                    }
+                }
+            }
+        }
+
+        const double mse = error / double(samples);
+        return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 99.0;
+    }
+
+    const char* GetImageFormatName(ImageFileFormat format)
+    {
+        switch (format)
+        {
+        case ImageFileFormat::PNG:  return "PNG";
+        case ImageFileFormat::JPEG: return "JPEG";
+        case ImageFileFormat::BMP:  return "BMP";
+        default:                    return "?";
+        }
+    }
+
+    struct EncodedImage
+    {
+        fs::path                path;
+        ImageFileFormat         format;
+        std::vector<uint8_t>    data;
+        double                  megapixels;
+    };
+
+    // The fastest of a few runs, as one decode of a small image is quick enough for the clock's
+    // resolution and the cache to matter
+    double TimeDecode(EncodedImage const& encoded, DecodedImage& image)
+    {
+        double best = 0;
+        for (int run = 0; run < 3; ++run)
+        {
+            const double seconds = Time([&]() { DecodeImage(encoded.data.data(), encoded.data.size(), image); });
+            best = run ? std::min(best, seconds) : seconds;
+        }
+        return best;
+    }
+}
+
+int DX::BenchmarkTextures(std::vector<fs::path> const& files, unsigned threads, ParallelFor const& parallelFor)
+{
+    const auto widest = GetSimdLevel();
+    size_t measured = 0;
+
+    printf("%-40s %-6s %-6s %12s %12s %8s\n", "texture", "format", "simd", "MPix/s x1", "MPix/s xN", "PSNR");
+    for (auto const& file : files)
+    {
+        Image image;
+        try
+        {
+            if (!DecodeTexture(ReadFile(file), image) || image.format != ImageFormat::RGBA8)
+                continue;
+        }
+        catch (std::exception const& e)
+        {
+            fprintf(stderr, "AssetCooker: %s: %s\n", file.generic_u8string().c_str(), e.what());
+            continue;
+        }
+
+        const double megapixels = double(image.width) * image.height / 1e6;
+        for (size_t f = 0; f < sizeof(c_Formats) / sizeof(c_Formats[0]); ++f)
+        {
+            const auto format = c_Formats[f];
+            std::vector<uint8_t> blocks(size_t((image.width + 3) / 4) * ((image.height + 3) / 4) * GetBlockBytes(format));
+
+            for (int level = 0; level <= int(widest); ++level)
+            {
+                SetSimdLevel(SimdLevel(level));
+                const double single = Compress(format, image, blocks, nullptr);
+                const double parallel = Compress(format, image, blocks, parallelFor);
+
+                printf("%-40s %-6s %-6s %12.1f %12.1f %8.2f\n", file.generic_u8string().c_str(), c_FormatNames[f],
+                    GetSimdLevelName(SimdLevel(level)), megapixels / single, megapixels / parallel,
+                    MeasurePSNR(format, image, blocks));
+            }
+        }
+        SetSimdLevel(widest);
+
+        // Whole chains, counted by the top level's pixels
+        for (auto filter : { MipFilter::Box, MipFilter::Kaiser })
+        {
+            MipSettings settings;
+            settings.content = MipContent::sRGB;
+            settings.filter = filter;
+            const double single = Time([&]() { BuildMipChain(image, settings); });
+            const double parallel = Time([&]() { BuildMipChain(image, settings, parallelFor); });
+
+            printf("%-40s %-6s %-6s %12.1f %12.1f\n", file.generic_u8string().c_str(),
+                filter == MipFilter::Box ? "box" : "kaiser", "mips", megapixels / single, megapixels / parallel);
+        }
+        ++measured;
+    }
+
+    printf("%zu textures measured, %u threads\n", measured, threads);
+    return measured ? 0 : 1;
+}
+
+int DX::BenchmarkDecode(std::vector<fs::path> const& files, unsigned threads, ParallelFor const& parallelFor)
+{
+    std::vector<EncodedImage> images;
+    double serial = 0;
+
+    printf("%-40s %-6s %11s %10s %12s %10s\n", "image", "format", "size", "ms", "MPix/s", "MB/s in");
+    for (auto const& file : files)
+    {
+        EncodedImage encoded;
+        encoded.path = file;
+        encoded.data = ReadFile(file);
+        encoded.format = DetectImageFormat(encoded.data.data(), encoded.data.size());
+        if (encoded.format == ImageFileFormat::Unknown)
+            continue;
+
+        DecodedImage image;
+        double seconds;
+        try
+        {
+            seconds = TimeDecode(encoded, image);
+        }
+        catch (std::exception const& e)
+        {
+            fprintf(stderr, "AssetCooker: %s: %s\n", file.generic_u8string().c_str(), e.what());
+            continue;
+        }
+
+        char size[32];
+        snprintf(size, sizeof(size), "%ux%u", image.width, image.height);
+        encoded.megapixels = double(image.width) * image.height / 1e6;
+        printf("%-40s %-6s %11s %10.3f %12.1f %10.1f\n", file.generic_u8string().c_str(), GetImageFormatName(encoded.format),
+            size, seconds * 1000, encoded.megapixels / seconds, double(encoded.data.size()) / 1e6 / seconds);
+
+        serial += seconds;
+        images.push_back(std::move(encoded));
+    }
+
+    if (images.empty())
+    {
+        printf("no images measured\n");
+        return 1;
+    }
+
+    // Every image at once, one decode to a task, as the game's streamers decode them
+    double megapixels = 0;
+    for (auto const& encoded : images)
+    {
+        megapixels += encoded.megapixels;
+    }
+
+    std::vector<DecodedImage> decoded(images.size());
+    const double parallel = Time([&]()
+    {
+        parallelFor(images.size(), 1, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                DecodeImage(images[i].data.data(), images[i].data.size(), decoded[i]);
+            }
+        });
+    });
+    printf("%zu images, %.2f MPix: %.1f ms one by one, %.1f ms in parallel on %u threads (%.2fx)\n",
+        images.size(), megapixels, serial * 1000, parallel * 1000, threads, serial / parallel);
+
+    // The conversions the decoders finish with, on a buffer larger than the caches
+    const size_t c_Pixels = 4 * 1024 * 1024;
+    std::vector<uint8_t> source(c_Pixels * 4);
+    std::vector<uint8_t> destination(c_Pixels * 4);
+    for (size_t i = 0; i < source.size(); ++i)
+    {
+        source[i] = uint8_t(i * 7 + (i >> 9));
+    }
+
+    using Swizzle = void (*)(const uint8_t*, uint8_t*, size_t);
+    const struct { const char* name; Swizzle swizzle; } c_Swizzles[] =
+    {
+        { "BGRA to RGBA", SwizzleBGRAToRGBA },
+        { "BGRX to RGBA", SwizzleBGRXToRGBA },
+        { "RGB to RGBA", ExpandRGBToRGBA },
+        { "BGR to RGBA", ExpandBGRToRGBA },
+        { "grey to RGBA", ExpandGrayToRGBA },
+        { "grey+alpha to RGBA", ExpandGrayAlphaToRGBA },
+    };
+
+    const auto widest = GetSwizzleLevel();
+    printf("\n%-40s %-6s %12s\n", "conversion", "simd", "MPix/s");
+    for (auto const& swizzle : c_Swizzles)
+    {
+        for (int level = 0; level <= int(widest); ++level)
+        {
+            SetSwizzleLevel(SwizzleLevel(level));
+            double best = 0;
+            for (int run = 0; run < 3; ++run)
+            {
+                const double seconds = Time([&]() { swizzle.swizzle(source.data(), destination.data(), c_Pixels); });
+                best = run ? std::min(best, seconds) : seconds;
+            }
+            printf("%-40s %-6s %12.1f\n", swizzle.name, GetSwizzleLevelName(SwizzleLevel(level)), double(c_Pixels) / 1e6 / best);
+        }
+    }
+    SetSwizzleLevel(widest);
+    return 0;
+}
@@ -0,0 +1,387 @@
+//
+// TextureCooker.cpp - Converts textures to block-compressed, mip-mapped DDS
+//
+
+#include "TextureCooker.h"
+#include "DDSFormat.h"
+#include "ImageDecoder.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const char* const c_TextureExtensions[] = { ".dds", ".bmp", ".jpg", ".jpeg", ".png", ".tif", ".tiff", ".gif", nullptr };
+
+    // DXGI_FORMAT values for the DX10 header
+    const uint32_t c_DXGIFormatRGBA16F = 10;
+    const uint32_t c_DXGIFormatRGBA8sRGB = 29;
+    const uint32_t c_DXGIFormatBC1sRGB = 72;
+    const uint32_t c_DXGIFormatBC3sRGB = 78;
+    const uint32_t c_DXGIFormatBC7 = 98;
+    const uint32_t c_DXGIFormatBC7sRGB = 99;
+    const uint32_t c_ResourceDimensionTexture2D = 3;
+
+    // D3DFMT_A16B16G16R16F, which legacy headers give in place of a FourCC
+    const uint32_t c_FourCCRGBA16F = 113;
+
+    template<typename T>
+    T ReadAt(std::vector<uint8_t> const& data, size_t offset)
+    {
+        if (offset + sizeof(T) > data.size())
+            throw std::runtime_error("texture file is truncated");
+
+        T value;
+        memcpy(&value, data.data() + offset, sizeof(T));
+        return value;
+    }
+
+    bool IsDDS(std::vector<uint8_t> const& data)
+    {
+        return data.size() >= 4 && ReadAt<uint32_t>(data, 0) == DDS::c_Magic;
+    }
+
+    bool HasDX10Header(DDS::Header const& header)
+    {
+        return (header.ddspf.flags & DDS::c_PixelFourCC) && header.ddspf.fourCC == DDS::MakeFourCC('D', 'X', '1', '0');
+    }
+
+    DDS::Header ReadDDSHeader(std::vector<uint8_t> const& data)
+    {
+        auto header = ReadAt<DDS::Header>(data, sizeof(uint32_t));
+        if (header.size != sizeof(DDS::Header) || header.ddspf.size != sizeof(DDS::PixelFormat))
+            throw std::runtime_error("DDS header is damaged");
+
+        if (HasDX10Header(header))
+            ReadAt<DDS::HeaderDXT10>(data, sizeof(uint32_t) + sizeof(DDS::Header));
+        return header;
+    }
+
+    // Half-float RGBA, by either header; the top level only, as the mips are rebuilt
+    bool DecodeHalfDDS(std::vector<uint8_t> const& data, DDS::Header const& header, Image& image)
+    {
+        size_t offset = sizeof(uint32_t) + sizeof(DDS::Header);
+        if (HasDX10Header(header))
+        {
+            auto extension = ReadAt<DDS::HeaderDXT10>(data, offset);
+            if (extension.dxgiFormat != c_DXGIFormatRGBA16F || extension.resourceDimension != c_ResourceDimensionTexture2D
+                || extension.arraySize != 1 || extension.miscFlag != 0)
+                return false;
+            offset += sizeof(extension);
+        }
+        else if (!(header.ddspf.flags & DDS::c_PixelFourCC) || header.ddspf.fourCC != c_FourCCRGBA16F)
+        {
+            return false;
+        }
+        if (header.caps2 != 0 || (header.flags & DDS::c_FlagDepth))
+            return false;
+
+        const uint64_t size = uint64_t(header.width) * header.height * 8;
+        if (!header.width || !header.height || size > data.size() - std::min(data.size(), offset))
+            throw std::runtime_error("DDS file is truncated");
+
+        image.width = header.width;
+        image.height = header.height;
+        image.format = ImageFormat::RGBA16F;
+        image.pixels.assign(data.begin() + offset, data.begin() + offset + size_t(size));
+        return true;
+    }
+
+    // Plain 32-bit RGBA or BGRA DDS files, and half-float RGBA; anything compressed, volume or
+    // cube map is already as the GPU wants it and is left alone.
+    bool DecodeDDS(std::vector<uint8_t> const& data, Image& image)
+    {
+        auto header = ReadDDSHeader(data);
+        auto const& pf = header.ddspf;
+        if (pf.flags & DDS::c_PixelFourCC)
+            return DecodeHalfDDS(data, header, image);
+
+        if (!(pf.flags & DDS::c_PixelRGB) || pf.RGBBitCount != 32 || header.caps2 != 0 || (header.flags & DDS::c_FlagDepth))
+            return false;
+
+        const bool bgra = pf.RBitMask == 0x00FF0000 && pf.GBitMask == 0x0000FF00 && pf.BBitMask == 0x000000FF;
+        const bool rgba = pf.RBitMask == 0x000000FF && pf.GBitMask == 0x0000FF00 && pf.BBitMask == 0x00FF0000;
+        if (!bgra && !rgba)
+            return false;
+
+        const bool hasAlpha = (pf.flags & DDS::c_PixelAlpha) && pf.ABitMask == 0xFF000000;
+        const size_t offset = sizeof(uint32_t) + sizeof(DDS::Header);
+        const uint64_t size = uint64_t(header.width) * header.height * 4;
+        if (!header.width || !header.height || size > data.size() - std::min(data.size(), offset))
+            throw std::runtime_error("DDS file is truncated");
+
+        image.width = header.width;
+        image.height = header.height;
+        image.pixels.assign(data.begin() + offset, data.begin() + offset + size_t(size));
+        for (size_t i = 0; i < image.pixels.size(); i += 4)
+        {
+            if (bgra)
+                std::swap(image.pixels[i], image.pixels[i + 2]);
+            if (!hasAlpha)
+                image.pixels[i + 3] = 0xFF;
+        }
+        return true;
+    }
+
+    std::string LowercaseStem(fs::path const& source)
+    {
+        std::string name = source.stem().string();
+        std::transform(name.begin(), name.end(), name.begin(),
+            [](char c) { return char(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c); });
+        return name;
+    }
+
+    bool NameContains(std::string const& name, std::initializer_list<const char*> words)
+    {
+        for (auto word : words)
+        {
+            if (name.find(word) != std::string::npos)
+                return true;
+        }
+        return false;
+    }
+
+    bool NameEndsWith(std::string const& name, std::initializer_list<const char*> words)
+    {
+        for (auto word : words)
+        {
+            const size_t length = strlen(word);
+            if (name.size() >= length && name.compare(name.size() - length, length, word) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    DDS::Header MakeHeader(uint32_t width, uint32_t height, uint32_t mipCount)
+    {
+        DDS::Header header = {};
+        header.size = sizeof(DDS::Header);
+        header.flags = DDS::c_FlagCaps | DDS::c_FlagHeight | DDS::c_FlagWidth | DDS::c_FlagPixelFormat | DDS::c_FlagMipMapCount;
+        header.height = height;
+        header.width = width;
+        header.mipMapCount = mipCount;
+        header.ddspf.size = sizeof(DDS::PixelFormat);
+        header.caps = DDS::c_CapsTexture | (mipCount > 1 ? DDS::c_CapsComplex | DDS::c_CapsMipMap : 0);
+        return header;
+    }
+
+    std::vector<uint8_t> WriteDDS(DDS::Header const& header, const DDS::HeaderDXT10* extension, std::vector<std::vector<uint8_t>> const& levels)
+    {
+        std::vector<uint8_t> file(sizeof(uint32_t) + sizeof(header) + (extension ? sizeof(*extension) : 0));
+        memcpy(file.data(), &DDS::c_Magic, sizeof(uint32_t));
+        memcpy(file.data() + sizeof(uint32_t), &header, sizeof(header));
+        if (extension)
+            memcpy(file.data() + sizeof(uint32_t) + sizeof(header), extension, sizeof(*extension));
+
+        for (auto const& level : levels)
+        {
+            file.insert(file.end(), level.begin(), level.end());
+        }
+        return file;
+    }
+
+    void SetExtension(DDS::Header& header, DDS::HeaderDXT10& extension, uint32_t dxgiFormat)
+    {
+        header.ddspf.flags = DDS::c_PixelFourCC;
+        header.ddspf.fourCC = DDS::MakeFourCC('D', 'X', '1', '0');
+        extension.dxgiFormat = dxgiFormat;
+        extension.resourceDimension = c_ResourceDimensionTexture2D;
+        extension.arraySize = 1;
+    }
+
+    // Legacy 32-bit RGBA, for sizes the block formats cannot take, or half-float RGBA. sRGB
+    // needs the DX10 header, as legacy ones cannot say so.
+    std::vector<uint8_t> WriteUncompressed(std::vector<Image> const& chain, bool sRGB)
+    {
+        auto header = MakeHeader(chain[0].width, chain[0].height, uint32_t(chain.size()));
+        header.flags |= DDS::c_FlagPitch;
+        header.pitchOrLinearSize = uint32_t(chain[0].GetRowPitch());
+
+        DDS::HeaderDXT10 extension = {};
+        const bool extended = sRGB && chain[0].format == ImageFormat::RGBA8;
+        if (extended)
+        {
+            SetExtension(header, extension, c_DXGIFormatRGBA8sRGB);
+        }
+        else if (chain[0].format == ImageFormat::RGBA16F)
+        {
+            header.ddspf.flags = DDS::c_PixelFourCC;
+            header.ddspf.fourCC = c_FourCCRGBA16F;
+        }
+        else
+        {
+            header.ddspf.flags = DDS::c_PixelRGB | DDS::c_PixelAlpha;
+            header.ddspf.RGBBitCount = 32;
+            header.ddspf.RBitMask = 0x000000FF;
+            header.ddspf.GBitMask = 0x0000FF00;
+            header.ddspf.BBitMask = 0x00FF0000;
+            header.ddspf.ABitMask = 0xFF000000;
+        }
+
+        std::vector<std::vector<uint8_t>> levels;
+        for (auto const& image : chain)
+        {
+            levels.push_back(image.pixels);
+        }
+        return WriteDDS(header, extended ? &extension : nullptr, levels);
+    }
+
+    // sRGB applies to the colour formats, BC1, BC3 and BC7
+    std::vector<uint8_t> WriteCompressed(BlockFormat format, bool sRGB, std::vector<Image> const& chain, ParallelFor const& parallelFor)
+    {
+        auto header = MakeHeader(chain[0].width, chain[0].height, uint32_t(chain.size()));
+        header.flags |= DDS::c_FlagLinearSize;
+        header.ddspf.flags = DDS::c_PixelFourCC;
+
+        // Set for the formats only the DX10 header can give
+        uint32_t dxgiFormat = 0;
+        switch (format)
+        {
+        case BlockFormat::BC1:
+            header.ddspf.fourCC = DDS::MakeFourCC('D', 'X', 'T', '1');
+            dxgiFormat = sRGB ? c_DXGIFormatBC1sRGB : 0;
+            break;
+        case BlockFormat::BC3:
+            header.ddspf.fourCC = DDS::MakeFourCC('D', 'X', 'T', '5');
+            dxgiFormat = sRGB ? c_DXGIFormatBC3sRGB : 0;
+            break;
+        case BlockFormat::BC4:  header.ddspf.fourCC = DDS::MakeFourCC('B', 'C', '4', 'U'); break;
+        case BlockFormat::BC5:  header.ddspf.fourCC = DDS::MakeFourCC('B', 'C', '5', 'U'); break;
+        case BlockFormat::BC7:
+            dxgiFormat = sRGB ? c_DXGIFormatBC7sRGB : c_DXGIFormatBC7;
+            break;
+        }
+
+        DDS::HeaderDXT10 extension = {};
+        if (dxgiFormat)
+        {
+            SetExtension(header, extension, dxgiFormat);
+        }
+
+        std::vector<std::vector<uint8_t>> levels;
+        for (auto const& image : chain)
+        {
+            const size_t blocks = size_t((image.width + 3) / 4) * ((image.height + 3) / 4);
+            levels.emplace_back(blocks * GetBlockBytes(format));
+            CompressImage(format, image.pixels.data(), image.width, image.height, image.GetRowPitch(),
+                levels.back().data(), parallelFor);
+        }
+        header.pitchOrLinearSize = uint32_t(levels[0].size());
+
+        return WriteDDS(header, dxgiFormat ? &extension : nullptr, levels);
+    }
+
+    // The output keeps the source's name whatever it holds; the game tells DDS from the
+    // other image formats by the file's magic number, not its extension.
+    class TextureCooker : public Cooker
+    {
+    public:
+        TextureCooker(bool highQuality, MipFilter mipFilter, ParallelFor parallelFor) :
+            m_highQuality(highQuality),
+            m_mipFilter(mipFilter),
+            m_parallelFor(std::move(parallelFor))
+        {
+        }
+
+        const char* GetName() const override { return "texture"; }
+        uint32_t GetVersion() const override { return 4; }
+
+        std::string GetSettings() const override
+        {
+            return std::string(m_highQuality ? "bc7" : "bc1") + (m_mipFilter == MipFilter::Kaiser ? " kaiser" : " box");
+        }
+
+        bool Accepts(fs::path const& source) const override
+        {
+            return HasExtension(source, c_TextureExtensions);
+        }
+
+        std::vector<uint8_t> Cook(fs::path const& source, std::vector<uint8_t> const& data, std::vector<fs::path>&) const override
+        {
+            Image image;
+            if (!DecodeTexture(data, image))
+                return data;
+
+            const auto format = ChooseBlockFormat(source, image, m_highQuality);
+
+            MipSettings settings;
+            settings.filter = m_mipFilter;
+            if (format == BlockFormat::BC5)
+                settings.content = MipContent::NormalMap;
+            else if (format != BlockFormat::BC4)
+                settings.content = MipContent::sRGB;
+
+            auto chain = BuildMipChain(image, settings, m_parallelFor);
+
+            // The game samples an image tagged sRGB through an sRGB format, as it would uncooked
+            const bool sRGB = image.sRGB && settings.content == MipContent::sRGB;
+
+            return WriteTexture(chain, format, sRGB, m_parallelFor);
+        }
+
+    private:
+        bool            m_highQuality;
+        MipFilter       m_mipFilter;
+        ParallelFor     m_parallelFor;
+    };
+}
+
+bool DX::DecodeTexture(std::vector<uint8_t> const& data, Image& image)
+{
+    if (IsDDS(data))
+        return DecodeDDS(data, image);
+
+    // With the game's own decoders, so both read the same pixels; TIFF and GIF are left to WIC
+    // at runtime
+    if (DetectImageFormat(data.data(), data.size()) == ImageFileFormat::Unknown)
+        return false;
+
+    DecodedImage decoded;
+    DecodeImage(data.data(), data.size(), decoded);
+
+    image.width = decoded.width;
+    image.height = decoded.height;
+    image.format = ImageFormat::RGBA8;
+    image.sRGB = decoded.sRGB;
+    image.pixels = std::move(decoded.pixels);
+    return true;
+}
+
+std::vector<uint8_t> DX::WriteTexture(std::vector<Image> const& chain, BlockFormat format, bool sRGB, ParallelFor const& parallelFor)
+{
+    // Block-compressed top levels must be whole blocks on older hardware
+    if (chain[0].format != ImageFormat::RGBA8 || chain[0].width % 4 || chain[0].height % 4)
+        return WriteUncompressed(chain, sRGB);
+
+    return WriteCompressed(format, sRGB, chain, parallelFor);
+}
+
+BlockFormat DX::ChooseBlockFormat(fs::path const& source, Image const& image, bool highQuality)
+{
+    const auto name = LowercaseStem(source);
+    if (NameContains(name, { "normal", "_nrm" }) || NameEndsWith(name, { "norm", "_n" }))
+        return BlockFormat::BC5;
+
+    if (NameContains(name, { "roughness", "metallic", "metalness", "height", "occlusion" }) || NameEndsWith(name, { "_ao" }))
+        return BlockFormat::BC4;
+
+    if (highQuality)
+        return BlockFormat::BC7;
+
+    for (size_t i = 3; i < image.pixels.size(); i += 4)
+    {
+        if (image.pixels[i] != 0xFF)
+            return BlockFormat::BC3;
+    }
+    return BlockFormat::BC1;
+}
+
+std::unique_ptr<Cooker> DX::CreateTextureCooker(bool highQuality, MipFilter mipFilter, ParallelFor parallelFor)
+{
+    return std::make_unique<TextureCooker>(highQuality, mipFilter, std::move(parallelFor));
+}
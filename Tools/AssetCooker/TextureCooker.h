@@ -0,0 +1,35 @@
+//
+// TextureCooker.h - Texture decoding and format choice, shared by the cooker and its benchmark
+//
+
+#pragma once
+
+#include "BlockCompress.h"
+#include "Cooker.h"
+#include "MipChain.h"
+
+namespace DX
+{
+    // Decodes the textures the tool can read (DDS, PNG, JPEG and BMP, by their magic number)
+    // into RGBA8, or half floats; false for those it cannot, which are cooked unchanged and
+    // decoded at runtime. Damaged files throw std::runtime_error.
+    bool DecodeTexture(std::vector<uint8_t> const& data, Image& image);
+
+    // Normal maps (by name) get BC5, single-channel material maps BC4, and colour BC1, or BC3
+    // with alpha; high quality uses BC7 for colour.
+    BlockFormat ChooseBlockFormat(std::filesystem::path const& source, Image const& image, bool highQuality);
+
+    // A DDS file of the chain in the block format, or uncompressed RGBA8 when the top level is
+    // not whole blocks, and half floats as they are. sRGB applies to BC1, BC3, BC7 and RGBA8.
+    std::vector<uint8_t> WriteTexture(std::vector<Image> const& chain, BlockFormat format, bool sRGB,
+        ParallelFor const& parallelFor = nullptr);
+
+    // Compresses every file the tool can decode in every block format, with each instruction
+    // set, and reports throughput and PSNR against the source.
+    int BenchmarkTextures(std::vector<std::filesystem::path> const& files, unsigned threads, ParallelFor const& parallelFor);
+
+    // Decodes every PNG, JPEG and BMP file on its own and then all of them in parallel, one to
+    // a task, and reports throughput, then that of the decoders' pixel conversions with each
+    // instruction set the CPU has.
+    int BenchmarkDecode(std::vector<std::filesystem::path> const& files, unsigned threads, ParallelFor const& parallelFor);
+}
@@ -0,0 +1,107 @@
+//
+// VertexPacker.cpp - Packs model vertex streams into compact formats when cooking
+//
+
+#include "VertexPacker.h"
+#include "Cooker.h"
+#include "ModelData.h"
+#include "SDKMeshWriter.h"
+#include "../Common/FileIO.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <stdio.h>
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const char* const c_SDKMeshExtensions[] = { ".sdkmesh", nullptr };
+    const char* const c_ModelExtensions[] = { ".sdkmesh", ".cmo", ".vbo", nullptr };
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+std::vector<uint8_t> DX::PackModelFile(fs::path const& name, std::vector<uint8_t> const& data, VertexPacking& packing)
+{
+    packing = {};
+
+    const auto fileName = name.wstring();
+    ModelData::Parse(fileName.c_str(), data.data(), data.size());
+    if (!HasExtension(name, c_SDKMeshExtensions))
+        return data;
+
+    std::vector<uint8_t> file(data);
+    packing = PackSDKMeshVertices(file);
+
+    // The game parses the result; anything wrong with it should fail the cook instead
+    ModelData::Parse(fileName.c_str(), file.data(), file.size());
+    return file;
+}
+
+int DX::ReportVertexPacking(std::vector<fs::path> const& files)
+{
+    size_t measured = 0;
+    VertexPacking total = {};
+
+    printf("%-40s %7s %7s %11s %11s %7s %10s %9s %10s %8s\n", "model", "packed", "skipped", "vertex bytes", "after",
+        "saved", "position", "normal", "texcoord", "ms");
+    for (auto const& file : files)
+    {
+        if (!HasExtension(file, c_ModelExtensions))
+            continue;
+
+        VertexPacking packing;
+        double ms;
+        try
+        {
+            auto data = ReadFile(file);
+            auto start = std::chrono::steady_clock::now();
+            if (HasExtension(file, c_SDKMeshExtensions))
+            {
+                PackModelFile(file, data, packing);
+            }
+            else
+            {
+                auto model = ModelData::Parse(file.wstring().c_str(), data.data(), data.size());
+                packing = PackModelVertices(*model);
+            }
+            ms = MillisecondsSince(start);
+        }
+        catch (std::exception const& e)
+        {
+            fprintf(stderr, "AssetCooker: %s: %s\n", file.generic_u8string().c_str(), e.what());
+            continue;
+        }
+
+        printf("%-40s %7u %7u %11llu %11llu %6.1f%% %10.2e %8.3f%c %10.2e %8.2f\n", file.generic_u8string().c_str(),
+            packing.streamsPacked, packing.streamsSkipped, (unsigned long long)packing.bytesBefore,
+            (unsigned long long)packing.bytesAfter,
+            packing.bytesBefore ? 100.0 * double(packing.bytesBefore - packing.bytesAfter) / double(packing.bytesBefore) : 0.0,
+            packing.maxPositionError, packing.maxDirectionError, packing.texCoordsKept ? '*' : ' ', packing.maxTexCoordError, ms);
+
+        total.streamsPacked += packing.streamsPacked;
+        total.streamsSkipped += packing.streamsSkipped;
+        total.texCoordsKept += packing.texCoordsKept;
+        total.bytesBefore += packing.bytesBefore;
+        total.bytesAfter += packing.bytesAfter;
+        total.maxPositionError = std::max(total.maxPositionError, packing.maxPositionError);
+        total.maxDirectionError = std::max(total.maxDirectionError, packing.maxDirectionError);
+        total.maxTexCoordError = std::max(total.maxTexCoordError, packing.maxTexCoordError);
+        ++measured;
+    }
+
+    // Position errors are fractions of each box's largest extent, normal errors degrees
+    printf("%zu models: %u vertex streams packed, %u skipped, %u texture coordinate sets kept as floats (*), "
+        "vertex bytes %llu -> %llu, largest errors %.2e of the box, %.3f degrees, %.2e in texture coordinates\n",
+        measured, total.streamsPacked, total.streamsSkipped, total.texCoordsKept,
+        (unsigned long long)total.bytesBefore, (unsigned long long)total.bytesAfter,
+        total.maxPositionError, total.maxDirectionError, total.maxTexCoordError);
+    return measured ? 0 : 1;
+}
@@ -0,0 +1,26 @@
+//
+// VertexPacker.h - Packs model vertex streams into compact formats when cooking
+//
+
+#pragma once
+
+#include "VertexPacking.h"
+
+#include <filesystem>
+#include <stdint.h>
+#include <vector>
+
+namespace DX
+{
+    // The model file with its vertex streams packed (VertexPacking.h), for SDKMESH files, which
+    // can declare the packed formats; CMO and VBO files cannot, so they are returned as they are
+    // and the game packs them as it loads them. The result is parsed again before it is
+    // returned; malformed files throw std::runtime_error.
+    std::vector<uint8_t> PackModelFile(std::filesystem::path const& name, std::vector<uint8_t> const& data,
+        VertexPacking& packing);
+
+    // Packs every model's vertices, without writing anything, and reports the vertex bytes
+    // before and after with the largest error of positions, normals and texture coordinates.
+    // CMO and VBO files are measured as the game packs them when it loads them.
+    int ReportVertexPacking(std::vector<std::filesystem::path> const& files);
+}
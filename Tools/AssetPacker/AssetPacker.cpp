@@ -0,0 +1,368 @@
+//
+// AssetPacker.cpp - Builds Content.pak from the loose content files and benchmarks loading it
+//
+// Builds with Visual Studio (AssetPacker.vcxproj) or, on Linux, with
+//
+//   g++ -std=c++17 -O2 -pthread -I../../Rohan-GamesProgrammingProject AssetPacker.cpp PackWriter.cpp
+//       ../../Rohan-GamesProgrammingProject/PackFile.cpp ../../Rohan-GamesProgrammingProject/LZ4Block.cpp
+//       ../../Rohan-GamesProgrammingProject/MappedFile.cpp ../../Rohan-GamesProgrammingProject/JobSystem.cpp
+//       -o AssetPacker
+//
+// Usage, from the game's content directory:
+//
+//   AssetPacker [-o Content.pak] [-shaders dir] [-cooked dir] [-nocompress] [-chunk KB] [-threads N] [files or dirs...]
+//   AssetPacker -bench [-o Content.pak] [-shaders dir] [-cooked dir] [-repeat N] [-threads N] [files or dirs...]
+//
+// Directories are searched recursively for content file types; with none given, the game's
+// Mesh, Textures, Sounds, Scenes and Fonts directories are packed. Files keep their path
+// relative to the working directory as their name, except compiled shaders from -shaders,
+// which the game loads by bare file name, and files from -cooked (AssetCooker's output), which
+// are named relative to that directory and take the place of the loose files they were cooked from.
+//
+// -bench loads the same set of files, first loose and then from the pack, and reports cold
+// (page cache dropped first, Linux only) and warm times for each.
+//
+
+#include "JobSystem.h"
+#include "PackWriter.h"
+#include "../Common/FileIO.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <stdexcept>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+using namespace DX;
+
+namespace
+{
+    const char* const c_ContentExtensions[] =
+    {
+        ".sdkmesh", ".cmo", ".vbo",
+        ".dds", ".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff",
+        ".wav",
+        ".cso",
+        ".scene",
+        ".spritefont",
+    };
+
+    const char* const c_DefaultInputs[] = { "Mesh", "Textures", "Sounds", "Scenes", "Fonts" };
+
+    bool IsContent(fs::path const& path)
+    {
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+            [](char c) { return char(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c); });
+
+        for (auto candidate : c_ContentExtensions)
+        {
+            if (extension == candidate)
+                return true;
+        }
+        return false;
+    }
+
+    // Asks the OS to forget the file's cached pages, so the next read comes from the disk
+    bool DropFromCache(fs::path const& path)
+    {
+#if defined(_WIN32)
+        (void)path;
+        return false;
+#else
+        int file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+            return false;
+        fdatasync(file);
+        bool dropped = posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED) == 0;
+        close(file);
+        return dropped;
+#endif
+    }
+
+    double MillisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    struct Options
+    {
+        bool                    bench = false;
+        fs::path                output = "Content.pak";
+        fs::path                shaders;
+        fs::path                cooked;
+        bool                    compress = true;
+        uint32_t                chunkSize = PackFile::c_DefaultChunkSize;
+        unsigned                threads = std::max(1u, std::thread::hardware_concurrency());
+        unsigned                repeats = 5;
+        std::vector<fs::path>   inputs;
+    };
+
+    Options ParseOptions(int argc, char** argv)
+    {
+        Options options;
+        for (int i = 1; i < argc; ++i)
+        {
+            if (!strcmp(argv[i], "-bench"))
+                options.bench = true;
+            else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+                options.output = argv[++i];
+            else if (!strcmp(argv[i], "-shaders") && i + 1 < argc)
+                options.shaders = argv[++i];
+            else if (!strcmp(argv[i], "-cooked") && i + 1 < argc)
+                options.cooked = argv[++i];
+            else if (!strcmp(argv[i], "-nocompress"))
+                options.compress = false;
+            else if (!strcmp(argv[i], "-chunk") && i + 1 < argc)
+                options.chunkSize = uint32_t(std::max(1, atoi(argv[++i]))) * 1024;
+            else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+                options.threads = unsigned(std::max(1, atoi(argv[++i])));
+            else if (!strcmp(argv[i], "-repeat") && i + 1 < argc)
+                options.repeats = unsigned(std::max(1, atoi(argv[++i])));
+            else if (argv[i][0] == '-')
+                throw std::runtime_error(std::string("unknown option ") + argv[i]);
+            else
+                options.inputs.push_back(argv[i]);
+        }
+
+        if (options.inputs.empty())
+        {
+            for (auto input : c_DefaultInputs)
+            {
+                if (fs::is_directory(input))
+                    options.inputs.push_back(input);
+            }
+        }
+        return options;
+    }
+
+    // Pack name -> file, sorted so the pack is the same whatever order the directories list in
+    std::map<fs::path, fs::path> CollectFiles(Options const& options)
+    {
+        std::map<fs::path, fs::path> files;
+        for (auto const& input : options.inputs)
+        {
+            if (fs::is_directory(input))
+            {
+                for (auto const& found : fs::recursive_directory_iterator(input))
+                {
+                    if (found.is_regular_file() && IsContent(found.path()))
+                        files.emplace(found.path().lexically_normal(), found.path());
+                }
+            }
+            else if (fs::is_regular_file(input))
+            {
+                files.emplace(input.lexically_normal(), input);
+            }
+            else
+            {
+                throw std::runtime_error("no such file or directory: " + input.string());
+            }
+        }
+
+        if (!options.shaders.empty())
+        {
+            for (auto const& found : fs::directory_iterator(options.shaders))
+            {
+                if (found.is_regular_file() && found.path().extension() == ".cso")
+                    files.emplace(found.path().filename(), found.path());
+            }
+        }
+
+        if (!options.cooked.empty())
+        {
+            for (auto const& found : fs::recursive_directory_iterator(options.cooked))
+            {
+                if (found.is_regular_file() && IsContent(found.path()))
+                    files[found.path().lexically_relative(options.cooked)] = found.path();
+            }
+        }
+        return files;
+    }
+
+    int Pack(Options const& options)
+    {
+        auto files = CollectFiles(options);
+        auto start = std::chrono::steady_clock::now();
+
+        PackWriter writer(options.chunkSize);
+        for (auto const& file : files)
+        {
+            writer.Add(file.first.wstring().c_str(), ReadFile(file.second), options.compress);
+        }
+
+        JobSystem jobSystem(options.threads - 1);
+        auto parallelFor = [&jobSystem](size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)
+        {
+            jobSystem.ParallelFor(count, grain, body);
+        };
+
+        fs::path temporary = options.output;
+        temporary += ".tmp";
+
+        FILE* file = fopen(temporary.string().c_str(), "wb");
+        if (!file)
+            throw std::runtime_error("unable to create " + temporary.string());
+
+        PackWriter::Statistics stats;
+        try
+        {
+            stats = writer.Write(file, parallelFor);
+        }
+        catch (...)
+        {
+            fclose(file);
+            fs::remove(temporary);
+            throw;
+        }
+        if (fclose(file))
+            throw std::runtime_error("unable to write " + temporary.string());
+
+        // Replace the old pack only once the new one is complete
+        fs::rename(temporary, options.output);
+
+        printf("%s: %zu files (%zu compressed), %.2f MB -> %.2f MB payload, %.2f MB file, %.0f ms\n",
+            options.output.string().c_str(), stats.entries, stats.compressedEntries,
+            stats.inputBytes / (1024.0 * 1024.0), stats.payloadBytes / (1024.0 * 1024.0),
+            stats.fileSize / (1024.0 * 1024.0), MillisecondsSince(start));
+        return 0;
+    }
+
+    struct Timing
+    {
+        double  coldMs;
+        double  warmMs;
+    };
+
+    // Best of several runs, each loading every named file
+    template<typename Load>
+    Timing Measure(unsigned repeats, std::vector<fs::path> const& files, bool& coldSupported, Load load)
+    {
+        Timing timing = { 1e30, 1e30 };
+        for (unsigned r = 0; r < repeats; ++r)
+        {
+            for (auto const& file : files)
+            {
+                coldSupported = DropFromCache(file) && coldSupported;
+            }
+            auto start = std::chrono::steady_clock::now();
+            load();
+            timing.coldMs = std::min(timing.coldMs, MillisecondsSince(start));
+
+            start = std::chrono::steady_clock::now();
+            load();
+            timing.warmMs = std::min(timing.warmMs, MillisecondsSince(start));
+        }
+        return timing;
+    }
+
+    int Bench(Options const& options)
+    {
+        const fs::path& packName = options.output;
+        const unsigned repeats = options.repeats;
+        const unsigned threads = options.threads;
+
+        // The same files the packer would take, so both sides load the same set
+        std::vector<std::wstring> names;
+        std::vector<fs::path> looseFiles;
+        uint64_t totalBytes = 0;
+        {
+            PackFile pack(packName.wstring().c_str());
+            for (auto const& file : CollectFiles(options))
+            {
+                auto entry = pack.Find(file.first.wstring().c_str());
+                if (!entry)
+                    throw std::runtime_error(file.first.string() + " is not in " + packName.string());
+                names.push_back(file.first.wstring());
+                looseFiles.push_back(file.second);
+                totalBytes += entry->size;
+            }
+        }
+
+        if (names.empty())
+            throw std::runtime_error("no content files to load");
+
+        JobSystem jobSystem(threads - 1);
+        auto parallelFor = [&jobSystem](size_t count, size_t grain, std::function<void(size_t, size_t)> const& body)
+        {
+            jobSystem.ParallelFor(count, grain, body);
+        };
+
+        volatile uint64_t checksum = 0;
+
+        bool looseCold = true;
+        Timing loose = Measure(repeats, looseFiles, looseCold, [&]()
+        {
+            for (auto const& file : looseFiles)
+            {
+                auto data = ReadFile(file);
+                checksum = checksum + data.size();
+            }
+        });
+
+        // As the game does: stored files are used in place, so each page is touched rather
+        // than copied; compressed ones are decompressed with their chunks in parallel
+        bool packCold = true;
+        Timing packed = Measure(repeats, { packName }, packCold, [&]()
+        {
+            PackFile pack(packName.wstring().c_str());
+            for (auto const& name : names)
+            {
+                auto entry = pack.Find(name.c_str());
+                if (auto stored = pack.GetStoredData(*entry))
+                {
+                    uint64_t sum = 0;
+                    for (uint64_t offset = 0; offset < entry->size; offset += 4096)
+                    {
+                        sum += stored[offset];
+                    }
+                    checksum = checksum + sum;
+                }
+                else
+                {
+                    auto data = pack.Read(*entry, parallelFor);
+                    checksum = checksum + data.size();
+                }
+            }
+        });
+
+        const double megabytes = totalBytes / (1024.0 * 1024.0);
+        printf("%zu files, %.2f MB, best of %u, %u threads\n", names.size(), megabytes, repeats, threads);
+        if (looseCold && packCold)
+        {
+            printf("loose cold ms %10.2f  (%8.1f MB/s)\n", loose.coldMs, megabytes * 1000.0 / loose.coldMs);
+            printf("pack  cold ms %10.2f  (%8.1f MB/s)\n", packed.coldMs, megabytes * 1000.0 / packed.coldMs);
+        }
+        else
+        {
+            printf("cold loads not measured: the page cache could not be dropped\n");
+        }
+        printf("loose warm ms %10.2f  (%8.1f MB/s)\n", loose.warmMs, megabytes * 1000.0 / loose.warmMs);
+        printf("pack  warm ms %10.2f  (%8.1f MB/s)\n", packed.warmMs, megabytes * 1000.0 / packed.warmMs);
+        return 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        auto options = ParseOptions(argc, argv);
+        return options.bench ? Bench(options) : Pack(options);
+    }
+    catch (std::exception const& e)
+    {
+        fprintf(stderr, "AssetPacker: %s\n", e.what());
+        return 1;
+    }
+}
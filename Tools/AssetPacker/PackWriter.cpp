@@ -0,0 +1,238 @@
+//
+// PackWriter.cpp - Builds a cooked asset pack
+//
+
+#include "PackWriter.h"
+#include "LZ4Block.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+using namespace DX;
+
+namespace
+{
+    uint64_t AlignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    class Output
+    {
+    public:
+        explicit Output(FILE* file) : m_file(file), m_offset(0) {}
+
+        void Write(const void* data, size_t size)
+        {
+            if (size && fwrite(data, 1, size, m_file) != size)
+                throw std::runtime_error("PackWriter: write failed");
+            m_offset += size;
+        }
+
+        void PadTo(uint64_t offset)
+        {
+            static const uint8_t s_zeros[4096] = {};
+            while (m_offset < offset)
+            {
+                Write(s_zeros, size_t(std::min<uint64_t>(offset - m_offset, sizeof(s_zeros))));
+            }
+        }
+
+        uint64_t Offset() const { return m_offset; }
+
+    private:
+        FILE*       m_file;
+        uint64_t    m_offset;
+    };
+}
+
+PackWriter::PackWriter(uint32_t chunkSize, uint32_t alignment) :
+    m_chunkSize(chunkSize),
+    m_alignment(alignment)
+{
+    if (!chunkSize || !alignment)
+        throw std::invalid_argument("PackWriter: chunk size and alignment must be non-zero");
+}
+
+void PackWriter::Add(const wchar_t* name, std::vector<uint8_t> data, bool compress)
+{
+    Source source;
+    source.name = PackFile::NormalizeName(name);
+    source.hash = PackFile::HashName(source.name);
+    source.data = std::move(data);
+    source.compress = compress && !source.data.empty();
+
+    for (const auto& other : m_sources)
+    {
+        if (other.hash == source.hash && other.name == source.name)
+            throw std::runtime_error("PackWriter: " + source.name + " added twice");
+    }
+
+    m_sources.push_back(std::move(source));
+}
+
+void PackWriter::Compress(Source& source, size_t chunk) const
+{
+    const size_t begin = chunk * m_chunkSize;
+    const size_t size = std::min<size_t>(m_chunkSize, source.data.size() - begin);
+
+    std::vector<uint8_t> compressed(LZ4CompressBound(size));
+    size_t storedSize = LZ4Compress(source.data.data() + begin, size, compressed.data(), compressed.size());
+
+    // A chunk that does not shrink is kept raw, marked by an empty buffer
+    if (storedSize && storedSize < size)
+    {
+        compressed.resize(storedSize);
+        source.chunks[chunk] = std::move(compressed);
+    }
+}
+
+PackWriter::Statistics PackWriter::Write(FILE* file, PackFile::ParallelFor const& parallelFor)
+{
+    // The table of contents is sorted by hash; names break ties so the output is deterministic
+    std::sort(m_sources.begin(), m_sources.end(), [](Source const& a, Source const& b)
+    {
+        return a.hash != b.hash ? a.hash < b.hash : a.name < b.name;
+    });
+
+    std::vector<std::pair<size_t, size_t>> work;
+    for (size_t i = 0; i < m_sources.size(); ++i)
+    {
+        auto& source = m_sources[i];
+        if (!source.compress)
+            continue;
+
+        const size_t chunkCount = (source.data.size() + m_chunkSize - 1) / m_chunkSize;
+        source.chunks.assign(chunkCount, std::vector<uint8_t>());
+        for (size_t c = 0; c < chunkCount; ++c)
+        {
+            work.emplace_back(i, c);
+        }
+    }
+
+    auto compress = [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            Compress(m_sources[work[i].first], work[i].second);
+        }
+    };
+
+    if (parallelFor)
+    {
+        parallelFor(work.size(), 1, compress);
+    }
+    else
+    {
+        compress(0, work.size());
+    }
+
+    Statistics stats = {};
+    stats.entries = m_sources.size();
+
+    // Lay out the payloads and build the tables
+    std::vector<PackFile::Entry> entries(m_sources.size());
+    std::vector<PackFile::Chunk> chunks;
+    std::string names;
+
+    uint64_t offset = sizeof(PackFile::Header);
+    for (size_t i = 0; i < m_sources.size(); ++i)
+    {
+        auto& source = m_sources[i];
+        auto& entry = entries[i];
+
+        uint64_t storedSize = 0;
+        for (size_t c = 0; c < source.chunks.size(); ++c)
+        {
+            storedSize += source.chunks[c].empty()
+                ? std::min<size_t>(m_chunkSize, source.data.size() - c * m_chunkSize)
+                : source.chunks[c].size();
+        }
+
+        if (source.compress && storedSize > source.data.size() - source.data.size() / c_MinSavings)
+        {
+            source.compress = false;
+            source.chunks.clear();
+        }
+
+        offset = AlignUp(offset, m_alignment);
+
+        entry.nameHash = source.hash;
+        entry.offset = offset;
+        entry.size = source.data.size();
+        entry.storedSize = source.compress ? storedSize : source.data.size();
+        entry.nameOffset = uint32_t(names.size());
+        entry.nameLength = uint32_t(source.name.size());
+        entry.firstChunk = uint32_t(chunks.size());
+        entry.chunkCount = uint32_t(source.chunks.size());
+
+        uint64_t chunkOffset = offset;
+        for (size_t c = 0; c < source.chunks.size(); ++c)
+        {
+            PackFile::Chunk chunk;
+            chunk.offset = chunkOffset;
+            chunk.size = uint32_t(std::min<size_t>(m_chunkSize, source.data.size() - c * m_chunkSize));
+            chunk.storedSize = source.chunks[c].empty() ? chunk.size : uint32_t(source.chunks[c].size());
+            chunks.push_back(chunk);
+            chunkOffset += chunk.storedSize;
+        }
+
+        names += source.name;
+        offset += entry.storedSize;
+
+        stats.compressedEntries += source.compress ? 1 : 0;
+        stats.inputBytes += entry.size;
+        stats.payloadBytes += entry.storedSize;
+    }
+
+    PackFile::Header header = {};
+    header.magic = PackFile::c_Magic;
+    header.version = PackFile::c_Version;
+    header.entryCount = uint32_t(entries.size());
+    header.chunkCount = uint32_t(chunks.size());
+    header.alignment = m_alignment;
+    header.chunkSize = m_chunkSize;
+    header.chunksOffset = AlignUp(offset, alignof(PackFile::Chunk));
+    header.entriesOffset = AlignUp(header.chunksOffset + chunks.size() * sizeof(PackFile::Chunk), alignof(PackFile::Entry));
+    header.namesOffset = header.entriesOffset + entries.size() * sizeof(PackFile::Entry);
+    header.namesSize = names.size();
+    header.fileSize = header.namesOffset + header.namesSize;
+
+    Output out(file);
+    out.Write(&header, sizeof(header));
+
+    for (size_t i = 0; i < m_sources.size(); ++i)
+    {
+        const auto& source = m_sources[i];
+        out.PadTo(entries[i].offset);
+
+        if (!source.compress)
+        {
+            out.Write(source.data.data(), source.data.size());
+            continue;
+        }
+
+        for (size_t c = 0; c < source.chunks.size(); ++c)
+        {
+            const auto& chunk = chunks[entries[i].firstChunk + c];
+            if (source.chunks[c].empty())
+            {
+                out.Write(source.data.data() + c * m_chunkSize, chunk.size);
+            }
+            else
+            {
+                out.Write(source.chunks[c].data(), source.chunks[c].size());
+            }
+        }
+    }
+
+    out.PadTo(header.chunksOffset);
+    out.Write(chunks.data(), chunks.size() * sizeof(PackFile::Chunk));
+    out.PadTo(header.entriesOffset);
+    out.Write(entries.data(), entries.size() * sizeof(PackFile::Entry));
+    out.Write(names.data(), names.size());
+
+    stats.fileSize = out.Offset();
+    return stats;
+}
@@ -0,0 +1,57 @@
+//
+// PackWriter.h - Builds a cooked asset pack
+//
+
+#pragma once
+
+#include "PackFile.h"
+
+#include <stdio.h>
+
+namespace DX
+{
+    // Collects assets and writes them as a PackFile. Compression happens in Write, one LZ4
+    // block per chunk, spread over parallelFor. A chunk that does not shrink is kept raw, and
+    // an entry whose chunks save less than c_MinSavings of its size is stored whole instead,
+    // so the runtime can use it in place from the mapping.
+    class PackWriter
+    {
+    public:
+        static const unsigned c_MinSavings = 16;        // one part in this many
+
+        struct Statistics
+        {
+            size_t      entries;
+            size_t      compressedEntries;
+            uint64_t    inputBytes;
+            uint64_t    payloadBytes;       // as stored, before alignment padding
+            uint64_t    fileSize;
+        };
+
+        explicit PackWriter(uint32_t chunkSize = PackFile::c_DefaultChunkSize, uint32_t alignment = PackFile::c_DefaultAlignment);
+
+        PackWriter(PackWriter const&) = delete;
+        PackWriter& operator= (PackWriter const&) = delete;
+
+        // Names are normalised as PackFile::Find does; adding one twice throws.
+        void Add(const wchar_t* name, std::vector<uint8_t> data, bool compress = true);
+
+        Statistics Write(FILE* file, PackFile::ParallelFor const& parallelFor = nullptr);
+
+    private:
+        struct Source
+        {
+            std::string                         name;
+            uint64_t                            hash;
+            std::vector<uint8_t>                data;
+            bool                                compress;
+            std::vector<std::vector<uint8_t>>   chunks;     // compressed, empty when kept raw
+        };
+
+        void Compress(Source& source, size_t chunk) const;
+
+        uint32_t                m_chunkSize;
+        uint32_t                m_alignment;
+        std::vector<Source>     m_sources;
+    };
+}
@@ -0,0 +1,71 @@
+//
+// FileIO.h - Whole-file reads and atomic writes for the offline tools
+//
+
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace DX
+{
+    inline std::vector<uint8_t> ReadFile(std::filesystem::path const& path)
+    {
+        std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file)
+            throw std::runtime_error("unable to open " + path.string());
+
+        std::vector<uint8_t> data(size_t(file.tellg()));
+        file.seekg(0, std::ios::beg);
+        file.read(reinterpret_cast<char*>(data.data()), std::streamsize(data.size()));
+        if (!file)
+            throw std::runtime_error("unable to read " + path.string());
+
+        return data;
+    }
+
+    // Writes next to the target and renames over it, so an interrupted tool never leaves a
+    // truncated file behind that a later run would take as up to date.
+    inline void WriteFileAtomically(std::filesystem::path const& path, const uint8_t* data, size_t size)
+    {
+        if (path.has_parent_path())
+        {
+            std::filesystem::create_directories(path.parent_path());
+        }
+
+        auto temporary = path;
+        temporary += ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(data), std::streamsize(size));
+            file.close();
+            if (!file)
+            {
+                std::error_code ignored;
+                std::filesystem::remove(temporary, ignored);
+                throw std::runtime_error("unable to write " + temporary.string());
+            }
+        }
+        std::filesystem::rename(temporary, path);
+    }
+
+    inline void WriteFileAtomically(std::filesystem::path const& path, std::vector<uint8_t> const& data)
+    {
+        WriteFileAtomically(path, data.data(), data.size());
+    }
+
+    // FNV-1a, 64-bit, as the game's ModelCache hashes contents
+    inline uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t hash = 14695981039346656037ull)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= data[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+}
@@ -0,0 +1,15 @@
+//
+// ParallelFor.h - How the tools' libraries are handed a thread pool without depending on one
+//
+
+#pragma once
+
+#include <functional>
+#include <stddef.h>
+
+namespace DX
+{
+    // Splits [0, count) into ranges of at least 'grain' and runs them, possibly in parallel;
+    // JobSystem::ParallelFor fits. An empty one means run everything on the calling thread.
+    using ParallelFor = std::function<void(size_t, size_t, std::function<void(size_t, size_t)> const&)>;
+}